@@ -41,25 +41,16 @@
 * Description:
 * This file contains the bootloader communication functions implemented using 
 * UART. Some portion of this code depends on the code placed in UART receive 
-* interrupt routine in main.c file.
+* interrupt routine in main.c file.  Packet framing lives in btldr_packet.c.
 ********************************************************************************/
 
 #include "UART.h" 
 #include "project.h"
 
-/* Byte to Byte time out in ms for detecting end of block data from host*/
-#define BYTE2BYTE_TIME_OUT 2
+#include "btldr_packet.h"
 
 #define BTLDR_SIZEOF_READ_BUFFER 0xff
 #define BTLDR_SIZEOF_WRITE_BUFFER 0xff
-#define END_OF_PACKET 0x17
-
-/***************************************
-*Global variables
-***************************************/
-
-/* UART receive data count variable  */
-volatile uint16 receivedDataCount=0;
 
 /*******************************************************************************
 * Function Name: CyBtldrCommStart
@@ -157,8 +148,6 @@ cystatus CyBtldrCommWrite(uint8 * pData, uint16 Size, uint16 * Count, uint8 Time
 	
     uint8 timeOutms = TimeOut; /* This timeout is not used in this function, defined to avoid compiler warning */   
 	timeOutms += 10;
-	
-   	receivedDataCount=0;
     
 	/* Write TX data using blocking function */
 	UART_SpiUartPutArray(pData, (uint8)Size);
@@ -170,6 +159,32 @@ cystatus CyBtldrCommWrite(uint8 * pData, uint16 Size, uint16 * Count, uint8 Time
     return status;
 }
 
+/*******************************************************************************
+* Function Name: rxBufferSize, readRxData, delayUs
+********************************************************************************
+*
+* Summary:
+*  Adapters from the UART component API to the T_BtldrPort functions used by
+*  BtldrPacket_Read.
+*
+*******************************************************************************/
+static uint32_t rxBufferSize(void)
+{
+	return UART_SpiUartGetRxBufferSize();
+}
+
+static uint32_t readRxData(void)
+{
+	return UART_SpiUartReadRxData();
+}
+
+static void delayUs(uint16_t microseconds)
+{
+	CyDelayUs(microseconds);
+}
+
+static const T_BtldrPort uartPort = { rxBufferSize, readRxData, delayUs };
+
 /*******************************************************************************
 * Function Name: CyBtldrCommRead
 ********************************************************************************
@@ -192,101 +207,31 @@ cystatus CyBtldrCommWrite(uint8 * pData, uint16 Size, uint16 * Count, uint8 Time
 *			 function will return CYRET_EMPTY.
 *
 * Theory: 
-*  'receivedDataCount' is updated with number of bytes received in the UART RX 
-*  interrupt routine. This variable is used to check whether some data is received 
-*  within the timeout period specified in *.cydwr. If data is received before the timeout, 
-*  the control will remain in another loop waiting for more data until no data is 
-*  received for a BYTE2BYTE_TIME_OUT(2 ms) interval.
-*
-*  Note: Increase the BYTE2BYTE_TIME_OUT to 10 ms for baud rates less than 9600.  
-* 
-*  BYTE2BYTE_TIME_OUT is used for detecting timeout marking end of block data from host. 
-*  This has to be set to a value which is greater than the expected maximum delay 
-*  between two bytes during a block/packet transmission from the host. 
-*  You have to account for the delay in hardware converters while calculating this value,
-*  if you are using any USB-UART bridges.   
+*  The packet header carries the data length, so the command is complete as
+*  soon as SOP, the header, the data, the checksum and EOP have arrived.  The
+*  bytes are read one at a time and no further than that, so a host that
+*  sends its next command early does not have it merged into this one.
+*
+*  Only data that does not start with SOP, declares more than the buffer can
+*  hold or is missing its EOP falls back to the byte to byte timeout: it is
+*  taken as ended when no data is received for a BTLDR_BYTE_TIMEOUT_US (2 ms)
+*  interval, or 5 ms longer if the last byte is not EOP.  The bootloader then
+*  rejects it with the usual error response.
+*
+*  Note: Increase BTLDR_BYTE_TIMEOUT_US to 10 ms for baud rates less than 9600.  
 *******************************************************************************/
 cystatus CyBtldrCommRead(uint8 * pData, uint16 Size, uint16 * Count, uint8 TimeOut)
 {
-    uint16 cntr,dataIndexCntr;
-    uint16 tempCount,oldDataCount;
-	
-    cystatus status = CYRET_EMPTY;
-
-    /* Check whether data is received within the timeout period. 
-	*  Timeout period is in units of 10ms.
-	*  If at least one byte is received within the timeout interval, wait for more data */
-	for (cntr = 0; cntr < TimeOut*10; cntr++)
-    {
-	    receivedDataCount = UART_SpiUartGetRxBufferSize();
-		
-		/* If at least one byte is received within the timeout interval enter the next loop
-		* waiting for more data reception */
-		if(receivedDataCount!=0) 
-	   	{
-			/* Wait for more data until 2 ms byte to byte time out interval receivedDataCount 
-			* variable is updated in on each data reception. If no data is received during the 
-			* last 2 ms (BYTE2BYTE_TIME_OUT) then it is considered as end of transmitted data 
-			* block (packet) from the host and the program execution will break from the data 
-			* awaiting loop with status=CYRET_SUCCESS */
-			do{
-			   	oldDataCount = receivedDataCount;
-				CyDelay(BYTE2BYTE_TIME_OUT);
-				receivedDataCount = UART_SpiUartGetRxBufferSize();			    
-			}while(receivedDataCount > oldDataCount);
-			status = CYRET_SUCCESS;	
-			break;
-		}
-		/* If no data is received, give a delay of 1ms and check again until the Timeout specified in .cydwr. */
-		else 
-		{
-			CyDelay(1);
-		}
-    }
-	
-	/* Initialize the data read indexes and Count value*/
-	*Count = 0;
-	dataIndexCntr = 0;
+	uint16_t count;
 	
-	/* If receivedDataCount>0 , move the received data to the pData buffer */
-	while(receivedDataCount > 0)
+	if (BtldrPacket_Read(&uartPort, pData, Size, &count, TimeOut) != BTLDR_READ_SUCCESS)
 	{
-		tempCount=receivedDataCount;
-		*Count  =(*Count ) + tempCount;
-		
-		/* Check if buffer overflow will occur before moving the data */
-		if(*Count < Size)
-		{
-			for (cntr = 0;((cntr < tempCount) ); cntr++)
-			{
-				/* Read the data and move it to the pData buffer */
-				pData[dataIndexCntr++] = UART_SpiUartReadRxData();   
-			}
-			/* Disable the interrupts before updating the receivedDataCount and 
-			*  re-enable the interrupts after updating */
-			CyGlobalIntDisable;
-			
-			/* subtract the read data count from received data count */
-			receivedDataCount=receivedDataCount-tempCount;
-			
-			CyGlobalIntEnable;
-			
-			/* Check if the last data received is End of packet(0x17) 
-			*  If not wait for additional 5ms */
-			if(pData[dataIndexCntr-1]!= END_OF_PACKET)
-			    CyDelay(5);
-	 	}	
-		
-		/* If there is no space to move data, break from the loop */
-		else
-		{
-			*Count=(*Count)-tempCount;
-			UART_SpiUartClearRxBuffer();
-			status = CYRET_EMPTY;
-			break;
-		}
+		*Count = 0;
+		return CYRET_EMPTY;
 	}
-	return status;
+	
+	*Count = count;
+	return CYRET_SUCCESS;
 }
 
 /* [] END OF FILE */
@@ -0,0 +1,182 @@
+/*
+ * Packet aware receive for the UART bootloader transport.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * The receive path reads the packet header and returns as soon as the
+ * declared length has arrived, instead of waiting for the line to go quiet.
+ * The byte to byte timeout is only used when the header can not be trusted.
+ */
+
+#include "btldr_packet.h"
+
+/*******************************************************************************
+* Function Name: BtldrPacket_Check
+********************************************************************************
+*
+* Summary:
+*  Looks at the bytes received so far and decides whether they form a whole
+*  packet.
+*
+* Parameters:
+*  pData:    The bytes received so far.
+*  count:    Number of bytes in pData.
+*  size:     Size of the receive buffer.
+*  pLength:  Set to the full packet length once the header is known.
+*
+* Return:
+*  BTLDR_PACKET_COMPLETE once the declared length ending in EOP has arrived,
+*  BTLDR_PACKET_INCOMPLETE while more bytes are expected, and
+*  BTLDR_PACKET_INVALID if the data does not start with SOP, declares more
+*  than fits in the buffer or does not end in EOP where it should.
+*
+*******************************************************************************/
+uint8_t BtldrPacket_Check(const uint8_t * pData, uint16_t count, uint16_t size, uint16_t * pLength)
+{
+	uint16_t length;
+
+	if (count == 0u)
+	{
+		return BTLDR_PACKET_INCOMPLETE;
+	}
+	if (pData[0] != BTLDR_PACKET_SOP)
+	{
+		return BTLDR_PACKET_INVALID;
+	}
+	if (count < 4u)
+	{
+		return BTLDR_PACKET_INCOMPLETE;
+	}
+
+	length = BTLDR_PACKET_OVERHEAD + ((uint16_t)pData[2] | ((uint16_t)pData[3] << 8));
+	if (length > size)
+	{
+		return BTLDR_PACKET_INVALID;
+	}
+	*pLength = length;
+
+	if (count < length)
+	{
+		return BTLDR_PACKET_INCOMPLETE;
+	}
+	if (pData[length - 1u] != BTLDR_PACKET_EOP)
+	{
+		return BTLDR_PACKET_INVALID;
+	}
+
+	return BTLDR_PACKET_COMPLETE;
+}
+
+/*******************************************************************************
+* Function Name: BtldrPacket_Read
+********************************************************************************
+*
+* Summary:
+*  Receives one command packet.
+*
+* Parameters:
+*  pPort:    The UART receive functions.
+*  pData:    A pointer to the area to store the packet.
+*  size:     Maximum size of the read buffer.
+*  pCount:   Set to the number of bytes actually read.
+*  timeOut:  Time to wait for the first byte, in 10s of ms.
+*
+* Return:
+*  BTLDR_READ_SUCCESS if at least one byte was received, BTLDR_READ_EMPTY if
+*  nothing arrived in time or the data did not fit in the buffer.
+*
+* Theory:
+*  Bytes are moved one at a time so that nothing past the end of the packet
+*  is taken from the UART; a host that pipelines its next command leaves it
+*  waiting in the RX buffer for the next call.  A packet that fails
+*  BtldrPacket_Check is collected the old way, until no byte has arrived for
+*  BTLDR_BYTE_TIMEOUT_US, plus BTLDR_EOP_GRACE_US if it does not end in EOP.
+*
+*******************************************************************************/
+uint8_t BtldrPacket_Read(const T_BtldrPort * pPort, uint8_t * pData, uint16_t size, uint16_t * pCount, uint8_t timeOut)
+{
+	uint32_t waitedUs = 0u;
+	uint32_t idleUs = 0u;
+	uint32_t idleLimitUs;
+	uint16_t count = 0u;
+	uint16_t length = 0u;
+	uint8_t status = BTLDR_PACKET_INCOMPLETE;
+
+	*pCount = 0u;
+
+	/* Wait for the first byte */
+	while (pPort->rxBufferSize() == 0u)
+	{
+		if (waitedUs >= ((uint32_t)timeOut * 10000u))
+		{
+			return BTLDR_READ_EMPTY;
+		}
+		pPort->delayUs(BTLDR_POLL_US);
+		waitedUs += BTLDR_POLL_US;
+	}
+
+	for (;;)
+	{
+		if (pPort->rxBufferSize() != 0u)
+		{
+			if (count >= size)
+			{
+				/* No space left, throw away the rest like the old code did */
+				while (pPort->rxBufferSize() != 0u)
+				{
+					(void)pPort->readRxData();
+				}
+				return BTLDR_READ_EMPTY;
+			}
+
+			pData[count++] = (uint8_t)pPort->readRxData();
+			idleUs = 0u;
+
+			status = BtldrPacket_Check(pData, count, size, &length);
+			if (status == BTLDR_PACKET_COMPLETE)
+			{
+				break;
+			}
+		}
+		else
+		{
+			idleLimitUs = BTLDR_BYTE_TIMEOUT_US;
+			if (pData[count - 1u] != BTLDR_PACKET_EOP)
+			{
+				idleLimitUs += BTLDR_EOP_GRACE_US;
+			}
+			if (idleUs >= idleLimitUs)
+			{
+				break;
+			}
+			pPort->delayUs(BTLDR_POLL_US);
+			idleUs += BTLDR_POLL_US;
+		}
+	}
+
+	*pCount = count;
+
+	return BTLDR_READ_SUCCESS;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,71 @@
+/*
+ * Packet framing for the UART bootloader transport.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Kept free of component calls so that it builds on the host.  A bootloader
+ * packet is
+ *
+ *   SOP(0x01) CMD LEN_LO LEN_HI DATA[LEN] CHECKSUM_LO CHECKSUM_HI EOP(0x17)
+ */
+
+#ifndef BTLDR_PACKET_H
+#define BTLDR_PACKET_H
+
+#include <stdint.h>
+
+#define BTLDR_PACKET_SOP 0x01u
+#define BTLDR_PACKET_EOP 0x17u
+
+/* SOP, command, two length bytes, two checksum bytes and EOP */
+#define BTLDR_PACKET_OVERHEAD 7u
+
+/* BtldrPacket_Check results */
+#define BTLDR_PACKET_INCOMPLETE 0u
+#define BTLDR_PACKET_COMPLETE 1u
+#define BTLDR_PACKET_INVALID 2u
+
+/* BtldrPacket_Read results */
+#define BTLDR_READ_SUCCESS 0u
+#define BTLDR_READ_EMPTY 1u
+
+/* Poll interval while waiting for bytes */
+#define BTLDR_POLL_US 10u
+
+/* Silence that ends a packet whose header could not be used, and the extra
+*  wait when such a packet does not end in EOP */
+#define BTLDR_BYTE_TIMEOUT_US 2000u
+#define BTLDR_EOP_GRACE_US 5000u
+
+typedef struct T_BtldrPort {
+	uint32_t (*rxBufferSize)(void);
+	uint32_t (*readRxData)(void);
+	void (*delayUs)(uint16_t microseconds);
+} T_BtldrPort;
+
+uint8_t BtldrPacket_Check(const uint8_t * pData, uint16_t count, uint16_t size, uint16_t * pLength);
+uint8_t BtldrPacket_Read(const T_BtldrPort * pPort, uint8_t * pData, uint16_t size, uint16_t * pCount, uint8_t timeOut);
+
+#endif
+
+/* [] END OF FILE */
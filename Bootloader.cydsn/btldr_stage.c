@@ -0,0 +1,210 @@
+/*
+ * Installs a firmware image the application staged in flash.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * The staged image is checked in full before the first application row is
+ * touched, and the descriptor is only cleared once every row has been
+ * written and read back.  Power lost half way leaves the descriptor in place
+ * and the copy starts over on the next reset.
+ */
+
+#include "btldr_stage.h"
+
+static uint32_t readLe32(const uint8_t * pData)
+{
+	return (uint32_t)pData[0] | ((uint32_t)pData[1] << 8) |
+	       ((uint32_t)pData[2] << 16) | ((uint32_t)pData[3] << 24);
+}
+
+static uint8_t rowsEqual(const uint8_t * pA, const uint8_t * pB, uint16_t length)
+{
+	uint16_t i;
+
+	for (i = 0u; i < length; i++)
+	{
+		if (pA[i] != pB[i])
+		{
+			return 0u;
+		}
+	}
+	return 1u;
+}
+
+/* Writes a row unless it already holds the data, and reads it back */
+static uint8_t copyRow(const T_BtldrFlash * pFlash, uint16_t row, const uint8_t * pData)
+{
+	if (rowsEqual(pFlash->rowData(row), pData, pFlash->rowSize) != 0u)
+	{
+		return BTLDR_FLASH_SUCCESS;
+	}
+	if (pFlash->writeRow(row, pData) != BTLDR_FLASH_SUCCESS)
+	{
+		return BTLDR_FLASH_FAILURE;
+	}
+	return (rowsEqual(pFlash->rowData(row), pData, pFlash->rowSize) != 0u) ? BTLDR_FLASH_SUCCESS : BTLDR_FLASH_FAILURE;
+}
+
+/*******************************************************************************
+* Function Name: BtldrStage_Crc
+********************************************************************************
+*
+* Summary:
+*  Updates a CRC-16/CCITT-FALSE, the CRC the application uses for the image.
+*  Start with 0xFFFF.
+*
+*******************************************************************************/
+uint16_t BtldrStage_Crc(uint16_t crc, const uint8_t * pData, uint32_t length)
+{
+	uint8_t bit;
+
+	while (length-- != 0u)
+	{
+		crc ^= (uint16_t)((uint16_t)*pData++ << 8);
+		for (bit = 0u; bit < 8u; bit++)
+		{
+			crc = ((crc & 0x8000u) != 0u) ? (uint16_t)((crc << 1) ^ 0x1021u) : (uint16_t)(crc << 1);
+		}
+	}
+	return crc;
+}
+
+/*******************************************************************************
+* Function Name: BtldrStage_Check
+********************************************************************************
+*
+* Summary:
+*  Looks for a staged image and checks it.
+*
+* Parameters:
+*  pFlash:   The flash functions and layout.
+*  pSize:    Set to the image size when an image is ready.
+*
+* Return:
+*  BTLDR_STAGE_NONE if no descriptor is written, BTLDR_STAGE_READY if the
+*  image fits the application rows and its CRC matches, and
+*  BTLDR_STAGE_INVALID otherwise.
+*
+*******************************************************************************/
+uint8_t BtldrStage_Check(const T_BtldrFlash * pFlash, uint32_t * pSize)
+{
+	const uint8_t * pDescriptor = pFlash->rowData(BTLDR_STAGE_FIRST_ROW);
+	uint32_t size;
+	uint32_t rows;
+	uint32_t row;
+	uint16_t crc = 0xFFFFu;
+
+	if (readLe32(pDescriptor) != BTLDR_STAGE_MAGIC)
+	{
+		return BTLDR_STAGE_NONE;
+	}
+
+	/* At least one application row and the metadata, in whole rows, with
+	*  the application ending before the staging rows start */
+	size = readLe32(&pDescriptor[4]);
+	rows = size / pFlash->rowSize;
+	if ((pFlash->appFirstRow == 0u) ||
+	    ((size % pFlash->rowSize) != 0u) || (rows < 2u) ||
+	    (rows > (BTLDR_STAGE_ROWS - 1u)) ||
+	    (((uint32_t)pFlash->appFirstRow + rows - 1u) > BTLDR_STAGE_FIRST_ROW))
+	{
+		return BTLDR_STAGE_INVALID;
+	}
+
+	for (row = 0u; row < rows; row++)
+	{
+		crc = BtldrStage_Crc(crc, pFlash->rowData((uint16_t)(BTLDR_STAGE_FIRST_ROW + 1u + row)), pFlash->rowSize);
+	}
+	if (crc != ((uint16_t)pDescriptor[8] | ((uint16_t)pDescriptor[9] << 8)))
+	{
+		return BTLDR_STAGE_INVALID;
+	}
+
+	*pSize = size;
+	return BTLDR_STAGE_READY;
+}
+
+/*******************************************************************************
+* Function Name: BtldrStage_Install
+********************************************************************************
+*
+* Summary:
+*  Copies a staged image into the application rows.
+*
+* Parameters:
+*  pFlash:      The flash functions and layout.
+*  pRowBuffer:  A row sized buffer used to clear the descriptor.
+*
+* Return:
+*  BTLDR_INSTALL_NOTHING if nothing is staged, BTLDR_INSTALL_DONE once the
+*  image is in place, BTLDR_INSTALL_INVALID if the staged image fails
+*  BtldrStage_Check and BTLDR_INSTALL_WRITE_FAILED if a row did not take.
+*
+* Theory:
+*  The metadata row goes last, so an application that is only partly copied
+*  never carries the checksum of the new one.  An invalid descriptor is
+*  cleared so it is not checked again on every reset; the application rows
+*  are untouched in that case.
+*
+*******************************************************************************/
+uint8_t BtldrStage_Install(const T_BtldrFlash * pFlash, uint8_t * pRowBuffer)
+{
+	uint32_t size = 0u;
+	uint16_t rows;
+	uint16_t row;
+	uint8_t status;
+	uint16_t i;
+
+	status = BtldrStage_Check(pFlash, &size);
+	if (status == BTLDR_STAGE_NONE)
+	{
+		return BTLDR_INSTALL_NOTHING;
+	}
+
+	if (status == BTLDR_STAGE_READY)
+	{
+		rows = (uint16_t)(size / pFlash->rowSize);
+		for (row = 0u; row < rows; row++)
+		{
+			if (copyRow(pFlash,
+			            (row == (rows - 1u)) ? (uint16_t)(pFlash->rows - 1u) : (uint16_t)(pFlash->appFirstRow + row),
+			            pFlash->rowData((uint16_t)(BTLDR_STAGE_FIRST_ROW + 1u + row))) != BTLDR_FLASH_SUCCESS)
+			{
+				return BTLDR_INSTALL_WRITE_FAILED;
+			}
+		}
+	}
+
+	for (i = 0u; i < pFlash->rowSize; i++)
+	{
+		pRowBuffer[i] = 0u;
+	}
+	if (pFlash->writeRow(BTLDR_STAGE_FIRST_ROW, pRowBuffer) != BTLDR_FLASH_SUCCESS)
+	{
+		return BTLDR_INSTALL_WRITE_FAILED;
+	}
+
+	return (status == BTLDR_STAGE_READY) ? BTLDR_INSTALL_DONE : BTLDR_INSTALL_INVALID;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,101 @@
+/*
+ * Installs a firmware image the application staged in flash.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Kept free of component calls so that it builds on the host.  The
+ * application receives a new image while it runs, writes it to the staging
+ * rows and, once the image is verified, writes a descriptor to the row in
+ * front of it and resets:
+ *
+ *   MAGIC[4] SIZE[4] CRC[2]            (little endian)
+ *
+ * The image is the application rows from the first row after the bootloader,
+ * followed by the row of bootloadable metadata; SIZE is a whole number of
+ * rows.  CRC is the CRC-16/CCITT-FALSE of the image, as sent by the hub.
+ *
+ * The flash of the 32K part is laid out as
+ *
+ *   rows   0 - 127  bootloader, then the application
+ *   rows 128 - 247  descriptor and staged image
+ *   row  248        EEPROM section of the application (0x7C00)
+ *   rows 249 - 254  application data
+ *   row  255        bootloadable metadata
+ */
+
+#ifndef BTLDR_STAGE_H
+#define BTLDR_STAGE_H
+
+#include <stdint.h>
+
+#define BTLDR_STAGE_FIRST_ROW 128u
+#define BTLDR_STAGE_ROWS 120u
+
+#define BTLDR_STAGE_MAGIC 0x5746534Du
+#define BTLDR_STAGE_DESCRIPTOR_SIZE 10u
+
+/* BtldrStage_Check results */
+#define BTLDR_STAGE_NONE 0u
+#define BTLDR_STAGE_READY 1u
+#define BTLDR_STAGE_INVALID 2u
+
+/* BtldrStage_Install results */
+#define BTLDR_INSTALL_NOTHING 0u
+#define BTLDR_INSTALL_DONE 1u
+#define BTLDR_INSTALL_INVALID 2u
+#define BTLDR_INSTALL_WRITE_FAILED 3u
+
+/* T_BtldrFlash writeRow results */
+#define BTLDR_FLASH_SUCCESS 0u
+#define BTLDR_FLASH_FAILURE 1u
+
+typedef struct T_BtldrFlash {
+	uint16_t rowSize;
+	uint16_t rows;
+	uint16_t appFirstRow;
+	const uint8_t * (*rowData)(uint16_t row);
+	uint8_t (*writeRow)(uint16_t row, const uint8_t * pData);
+} T_BtldrFlash;
+
+uint16_t BtldrStage_Crc(uint16_t crc, const uint8_t * pData, uint32_t length);
+uint8_t BtldrStage_Check(const T_BtldrFlash * pFlash, uint32_t * pSize);
+uint8_t BtldrStage_Install(const T_BtldrFlash * pFlash, uint8_t * pRowBuffer);
+
+/* Fills the start of a descriptor row; the rest of the row is left alone */
+static inline void BtldrStage_Describe(uint8_t * pRow, uint32_t size, uint16_t crc)
+{
+	uint32_t magic = BTLDR_STAGE_MAGIC;
+	uint8_t i;
+
+	for (i = 0u; i < 4u; i++)
+	{
+		pRow[i] = (uint8_t)(magic >> (8u * i));
+		pRow[4u + i] = (uint8_t)(size >> (8u * i));
+	}
+	pRow[8] = (uint8_t)crc;
+	pRow[9] = (uint8_t)(crc >> 8);
+}
+
+#endif
+
+/* [] END OF FILE */
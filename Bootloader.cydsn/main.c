@@ -55,10 +55,43 @@
 ***********************************************************************************/
 
 #include <project.h>
+#include "btldr_stage.h"
 
 /* Define the Bootload Switch timeout in ms */
 #define SWITCH_PRESS_TIMEOUT 100
 
+static uint8 stageRow[CY_FLASH_SIZEOF_ROW];
+
+static const uint8_t * flashRowData(uint16_t row)
+{
+	return (const uint8_t *)(CY_FLASH_BASE + ((uint32)row * CY_FLASH_SIZEOF_ROW));
+}
+
+static uint8_t flashWriteRow(uint16_t row, const uint8_t * pData)
+{
+	return (CySysFlashWriteRow(row, pData) == CY_SYS_FLASH_SUCCESS) ? BTLDR_FLASH_SUCCESS : BTLDR_FLASH_FAILURE;
+}
+
+/* Installs an image the application staged and verified before it reset.
+ * The application starts after the last bootloader row recorded in the
+ * metadata; a failed copy leaves the staged image for the next reset and the
+ * bootloader waits for a host, as the old application is no longer whole. */
+static void installStagedImage(void)
+{
+	T_BtldrFlash flash;
+
+	flash.rowSize = CY_FLASH_SIZEOF_ROW;
+	flash.rows = (uint16_t)(CY_FLASH_SIZE / CY_FLASH_SIZEOF_ROW);
+	flash.appFirstRow = (uint16_t)(Bootloader_GetMetadata(Bootloader_GET_BTLDR_LAST_ROW, 0u) + 1u);
+	flash.rowData = flashRowData;
+	flash.writeRow = flashWriteRow;
+
+	if (BtldrStage_Install(&flash, stageRow) == BTLDR_INSTALL_WRITE_FAILED)
+	{
+		Bootloader_SET_RUN_TYPE (Bootloader_START_BTLDR);
+	}
+}
+
 int main()
 {
     
@@ -67,6 +100,9 @@ int main()
 	/* Enable global interrupts*/
 	CyGlobalIntEnable;
 	
+	/* Take over a firmware image the application received from the hub */
+	installStagedImage();
+	
 	/* Check if the switch is pressed during power up */ 
 	if(Boot_P0_7_Read() == 0)
 	{
@@ -0,0 +1,178 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTestExt/MockSupport.h"
+#include <stdint.h>
+#include <string.h>
+#include <deque>
+#include <vector>
+
+using namespace std;
+
+extern "C"
+{
+#include "btldr_packet.h"
+}
+
+// A UART receiving at 115200 baud: each byte lands 87us after the previous
+// one, and the clock only moves when the code under test delays.
+#define BYTE_TIME_US 87
+
+struct RxByte {
+   uint32_t arrivalUs;
+   uint8_t value;
+};
+
+static deque<RxByte> line;
+static uint32_t nowUs;
+
+static uint32_t fakeRxBufferSize(void)
+{
+   uint32_t n = 0;
+
+   for (size_t i = 0; i < line.size() && line[i].arrivalUs <= nowUs; i++) {
+      n++;
+   }
+   return n;
+}
+
+static uint32_t fakeReadRxData(void)
+{
+   uint8_t b = line.front().value;
+
+   line.pop_front();
+   return b;
+}
+
+static void fakeDelayUs(uint16_t microseconds)
+{
+   nowUs += microseconds;
+}
+
+static const T_BtldrPort fakePort = { fakeRxBufferSize, fakeReadRxData, fakeDelayUs };
+
+static vector<uint8_t> packet(uint8_t cmd, const vector<uint8_t> &data)
+{
+   vector<uint8_t> p;
+   uint16_t sum = 0;
+
+   p.push_back(BTLDR_PACKET_SOP);
+   p.push_back(cmd);
+   p.push_back(data.size() & 0xff);
+   p.push_back(data.size() >> 8);
+   p.insert(p.end(), data.begin(), data.end());
+   for (size_t i = 0; i < p.size(); i++) {
+      sum += p[i];
+   }
+   sum = 1 + ~sum;
+   p.push_back(sum & 0xff);
+   p.push_back(sum >> 8);
+   p.push_back(BTLDR_PACKET_EOP);
+   return p;
+}
+
+static void send(const vector<uint8_t> &bytes, uint32_t startUs)
+{
+   for (size_t i = 0; i < bytes.size(); i++) {
+      RxByte b = { startUs + (uint32_t)(i + 1) * BYTE_TIME_US, bytes[i] };
+      line.push_back(b);
+   }
+}
+
+TEST_GROUP(btldrPacketTests)
+{
+   uint8_t buffer[0xff];
+   uint16_t count;
+
+   void setup()
+   {
+      line.clear();
+      nowUs = 0;
+      count = 0xffff;
+      memset(buffer, 0, sizeof(buffer));
+   }
+
+   void teardown()
+   {
+   }
+};
+
+TEST(btldrPacketTests, checkFollowsDeclaredLength)
+{
+   vector<uint8_t> p = packet(0x37, vector<uint8_t>(5, 0xaa));
+   uint16_t length = 0;
+
+   BYTES_EQUAL(BTLDR_PACKET_INCOMPLETE, BtldrPacket_Check(&p[0], 0, 0xff, &length));
+   BYTES_EQUAL(BTLDR_PACKET_INCOMPLETE, BtldrPacket_Check(&p[0], 3, 0xff, &length));
+   BYTES_EQUAL(BTLDR_PACKET_INCOMPLETE, BtldrPacket_Check(&p[0], 11, 0xff, &length));
+   LONGS_EQUAL(12, length);
+   BYTES_EQUAL(BTLDR_PACKET_COMPLETE, BtldrPacket_Check(&p[0], 12, 0xff, &length));
+}
+
+TEST(btldrPacketTests, checkRejectsBadFraming)
+{
+   vector<uint8_t> p = packet(0x37, vector<uint8_t>(5, 0xaa));
+   uint16_t length = 0;
+
+   p[11] = 0x00;
+   BYTES_EQUAL(BTLDR_PACKET_INVALID, BtldrPacket_Check(&p[0], 12, 0xff, &length));
+   p[0] = 0x02;
+   BYTES_EQUAL(BTLDR_PACKET_INVALID, BtldrPacket_Check(&p[0], 1, 0xff, &length));
+   p = packet(0x37, vector<uint8_t>(250, 0));
+   BYTES_EQUAL(BTLDR_PACKET_INVALID, BtldrPacket_Check(&p[0], 4, 0xff, &length));
+}
+
+TEST(btldrPacketTests, nothingArrivesBeforeTimeout)
+{
+   BYTES_EQUAL(BTLDR_READ_EMPTY, BtldrPacket_Read(&fakePort, buffer, sizeof(buffer), &count, 2));
+   LONGS_EQUAL(0, count);
+   LONGS_EQUAL(20000, nowUs);
+}
+
+TEST(btldrPacketTests, returnsWhenLastByteArrives)
+{
+   vector<uint8_t> p = packet(0x37, vector<uint8_t>(57, 0x5a));
+
+   send(p, 100);
+   BYTES_EQUAL(BTLDR_READ_SUCCESS, BtldrPacket_Read(&fakePort, buffer, sizeof(buffer), &count, 10));
+   LONGS_EQUAL(p.size(), count);
+   MEMCMP_EQUAL(&p[0], buffer, p.size());
+   // within one poll of the last byte, not a byte to byte timeout later
+   CHECK(nowUs < 100 + p.size() * BYTE_TIME_US + BTLDR_POLL_US);
+}
+
+TEST(btldrPacketTests, pipelinedPacketIsLeftForNextRead)
+{
+   vector<uint8_t> first = packet(0x39, vector<uint8_t>(3, 1));
+   vector<uint8_t> second = packet(0x31, vector<uint8_t>());
+
+   send(first, 0);
+   send(second, first.size() * BYTE_TIME_US);
+   nowUs = 100000;
+
+   BtldrPacket_Read(&fakePort, buffer, sizeof(buffer), &count, 10);
+   LONGS_EQUAL(first.size(), count);
+   BtldrPacket_Read(&fakePort, buffer, sizeof(buffer), &count, 10);
+   LONGS_EQUAL(second.size(), count);
+   MEMCMP_EQUAL(&second[0], buffer, second.size());
+   LONGS_EQUAL(100000, nowUs);
+}
+
+TEST(btldrPacketTests, junkFallsBackToByteTimeout)
+{
+   vector<uint8_t> junk(4, 0x55);
+
+   send(junk, 0);
+   BYTES_EQUAL(BTLDR_READ_SUCCESS, BtldrPacket_Read(&fakePort, buffer, sizeof(buffer), &count, 10));
+   LONGS_EQUAL(4, count);
+   CHECK(nowUs >= 4 * BYTE_TIME_US + BTLDR_BYTE_TIMEOUT_US + BTLDR_EOP_GRACE_US);
+}
+
+TEST(btldrPacketTests, overflowDrainsAndFails)
+{
+   vector<uint8_t> junk(40, 0x55);
+
+   send(junk, 0);
+   nowUs = 10000;
+   BYTES_EQUAL(BTLDR_READ_EMPTY, BtldrPacket_Read(&fakePort, buffer, 16, &count, 10));
+   LONGS_EQUAL(0, count);
+   LONGS_EQUAL(0, line.size());
+}
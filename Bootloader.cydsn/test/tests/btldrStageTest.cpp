@@ -0,0 +1,173 @@
+#include "CppUTest/TestHarness.h"
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+using namespace std;
+
+extern "C"
+{
+#include "btldr_stage.h"
+}
+
+#define ROW_SIZE 128
+#define ROWS 256
+#define APP_FIRST_ROW 40
+#define IMAGE_ROW (BTLDR_STAGE_FIRST_ROW + 1)
+
+static vector<uint8_t> flash;
+static vector<uint16_t> written;
+static int writesLeft;
+
+static const uint8_t *fakeRowData(uint16_t row)
+{
+   return &flash[row * ROW_SIZE];
+}
+
+// Fails every write once writesLeft runs out, like power going away.
+static uint8_t fakeWriteRow(uint16_t row, const uint8_t *pData)
+{
+   if (writesLeft == 0) {
+      return BTLDR_FLASH_FAILURE;
+   }
+   writesLeft--;
+   memmove(&flash[row * ROW_SIZE], pData, ROW_SIZE);
+   written.push_back(row);
+   return BTLDR_FLASH_SUCCESS;
+}
+
+static const T_BtldrFlash fakeFlash = { ROW_SIZE, ROWS, APP_FIRST_ROW, fakeRowData, fakeWriteRow };
+
+// Stages an image of appRows rows and a metadata row, each row filled with
+// a value derived from its index.
+static void stage(uint16_t appRows)
+{
+   uint32_t size = (appRows + 1) * ROW_SIZE;
+   uint16_t crc;
+
+   for (uint16_t row = 0; row <= appRows; row++) {
+      memset(&flash[(IMAGE_ROW + row) * ROW_SIZE], 0x30 + row, ROW_SIZE);
+   }
+   crc = BtldrStage_Crc(0xffff, &flash[IMAGE_ROW * ROW_SIZE], size);
+   BtldrStage_Describe(&flash[BTLDR_STAGE_FIRST_ROW * ROW_SIZE], size, crc);
+}
+
+static bool rowIs(uint16_t row, uint8_t value)
+{
+   for (int i = 0; i < ROW_SIZE; i++) {
+      if (flash[row * ROW_SIZE + i] != value) {
+         return false;
+      }
+   }
+   return true;
+}
+
+TEST_GROUP(btldrStageTests)
+{
+   uint8_t rowBuffer[ROW_SIZE];
+   uint32_t size;
+
+   void setup()
+   {
+      flash.assign(ROWS * ROW_SIZE, 0xee);
+      memset(&flash[BTLDR_STAGE_FIRST_ROW * ROW_SIZE], 0, ROW_SIZE);
+      written.clear();
+      writesLeft = -1;
+      size = 0;
+   }
+
+   void teardown()
+   {
+   }
+};
+
+TEST(btldrStageTests, crcMatchesTheApplication)
+{
+   const uint8_t check[] = "123456789";
+
+   LONGS_EQUAL(0x29b1, BtldrStage_Crc(0xffff, check, 9));
+}
+
+TEST(btldrStageTests, nothingStagedLeavesFlashAlone)
+{
+   BYTES_EQUAL(BTLDR_STAGE_NONE, BtldrStage_Check(&fakeFlash, &size));
+   BYTES_EQUAL(BTLDR_INSTALL_NOTHING, BtldrStage_Install(&fakeFlash, rowBuffer));
+   LONGS_EQUAL(0, written.size());
+}
+
+TEST(btldrStageTests, stagedImageIsCopiedAndDescriptorCleared)
+{
+   stage(3);
+   BYTES_EQUAL(BTLDR_STAGE_READY, BtldrStage_Check(&fakeFlash, &size));
+   LONGS_EQUAL(4 * ROW_SIZE, size);
+
+   BYTES_EQUAL(BTLDR_INSTALL_DONE, BtldrStage_Install(&fakeFlash, rowBuffer));
+   CHECK(rowIs(APP_FIRST_ROW, 0x30));
+   CHECK(rowIs(APP_FIRST_ROW + 2, 0x32));
+   CHECK(rowIs(APP_FIRST_ROW + 3, 0xee));
+   CHECK(rowIs(ROWS - 1, 0x33));
+   CHECK(rowIs(APP_FIRST_ROW - 1, 0xee));
+   CHECK(rowIs(BTLDR_STAGE_FIRST_ROW, 0));
+   BYTES_EQUAL(BTLDR_STAGE_NONE, BtldrStage_Check(&fakeFlash, &size));
+}
+
+TEST(btldrStageTests, metadataRowIsWrittenLast)
+{
+   stage(3);
+   BtldrStage_Install(&fakeFlash, rowBuffer);
+   LONGS_EQUAL(5, written.size());
+   LONGS_EQUAL(ROWS - 1, written[3]);
+   LONGS_EQUAL(BTLDR_STAGE_FIRST_ROW, written[4]);
+}
+
+TEST(btldrStageTests, corruptedImageIsNotInstalled)
+{
+   stage(3);
+   flash[(IMAGE_ROW + 1) * ROW_SIZE + 17] ^= 0x01;
+
+   BYTES_EQUAL(BTLDR_STAGE_INVALID, BtldrStage_Check(&fakeFlash, &size));
+   BYTES_EQUAL(BTLDR_INSTALL_INVALID, BtldrStage_Install(&fakeFlash, rowBuffer));
+   CHECK(rowIs(APP_FIRST_ROW, 0xee));
+   CHECK(rowIs(ROWS - 1, 0xee));
+   LONGS_EQUAL(1, written.size());
+   BYTES_EQUAL(BTLDR_STAGE_NONE, BtldrStage_Check(&fakeFlash, &size));
+}
+
+TEST(btldrStageTests, imageReachingTheStagingRowsIsRefused)
+{
+   // application rows 40 to 128 would overwrite the descriptor
+   stage(BTLDR_STAGE_FIRST_ROW - APP_FIRST_ROW + 1);
+   BYTES_EQUAL(BTLDR_STAGE_INVALID, BtldrStage_Check(&fakeFlash, &size));
+
+   stage(BTLDR_STAGE_FIRST_ROW - APP_FIRST_ROW);
+   BYTES_EQUAL(BTLDR_STAGE_READY, BtldrStage_Check(&fakeFlash, &size));
+}
+
+TEST(btldrStageTests, partialRowsAreRefused)
+{
+   stage(3);
+   BtldrStage_Describe(&flash[BTLDR_STAGE_FIRST_ROW * ROW_SIZE], 4 * ROW_SIZE - 1, 0);
+   BYTES_EQUAL(BTLDR_STAGE_INVALID, BtldrStage_Check(&fakeFlash, &size));
+
+   // no application rows, only metadata
+   stage(0);
+   BYTES_EQUAL(BTLDR_STAGE_INVALID, BtldrStage_Check(&fakeFlash, &size));
+}
+
+TEST(btldrStageTests, interruptedInstallStartsOver)
+{
+   stage(5);
+   writesLeft = 3;
+   BYTES_EQUAL(BTLDR_INSTALL_WRITE_FAILED, BtldrStage_Install(&fakeFlash, rowBuffer));
+   CHECK(rowIs(ROWS - 1, 0xee));
+   BYTES_EQUAL(BTLDR_STAGE_READY, BtldrStage_Check(&fakeFlash, &size));
+
+   // rows that already made it are not written again
+   written.clear();
+   writesLeft = -1;
+   BYTES_EQUAL(BTLDR_INSTALL_DONE, BtldrStage_Install(&fakeFlash, rowBuffer));
+   LONGS_EQUAL(4, written.size());
+   LONGS_EQUAL(APP_FIRST_ROW + 3, written[0]);
+   CHECK(rowIs(APP_FIRST_ROW + 4, 0x34));
+   CHECK(rowIs(ROWS - 1, 0x35));
+}
@@ -0,0 +1,219 @@
+/*
+ * Tracking of the empty and full readings of the FSRs.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "autozero.h"
+#include <stdlib.h>
+
+#ifndef FALSE
+#define FALSE 0
+#define TRUE !FALSE
+#endif
+
+#define TICKS_PER_DAY 86400000LL
+
+uint8_t AutoZero_Init(T_AutoZeroCB *pControlBlock, const T_AutoZeroPolicy *pPolicy, uint32_t *pLow, uint32_t *pHigh,
+                      void (*store)(void)) {
+   uint8_t j;
+
+   if ((pControlBlock == NULL) || (pPolicy == NULL) || (pLow == NULL) || (pHigh == NULL) || (store == NULL)) {
+      return AUTOZERO_FAILURE;
+   }
+   if ((pPolicy->stableReadings == 0) || (pPolicy->zeroShift > 12) || (pPolicy->gainShift > 16)) {
+      return AUTOZERO_FAILURE;
+   }
+
+   pControlBlock->pPolicy = pPolicy;
+   pControlBlock->pLow = pLow;
+   pControlBlock->pHigh = pHigh;
+   pControlBlock->store = store;
+   for (j = 0; j < AUTOZERO_CHANNELS; j++) {
+      pControlBlock->driftPerDay[j] = 0;
+   }
+   pControlBlock->stats.emptyReadings = 0;
+   pControlBlock->stats.fullReadings = 0;
+   pControlBlock->stats.stores = 0;
+   AutoZero_Restart(pControlBlock);
+
+   return AUTOZERO_SUCCESS;
+}
+
+// Starts over from the limits as they are, which are taken to be stored: at
+// start up, and after a factory calibration.
+void AutoZero_Restart(T_AutoZeroCB *pControlBlock) {
+   uint8_t j;
+
+   for (j = 0; j < AUTOZERO_CHANNELS; j++) {
+      pControlBlock->low[j] = (int32_t)pControlBlock->pLow[j] << AUTOZERO_FRACTION_BITS;
+      pControlBlock->high[j] = (int32_t)pControlBlock->pHigh[j] << AUTOZERO_FRACTION_BITS;
+      pControlBlock->storedLow[j] = pControlBlock->pLow[j];
+      pControlBlock->storedHigh[j] = pControlBlock->pHigh[j];
+      pControlBlock->previous[j] = 0;
+   }
+   pControlBlock->zone = AUTOZERO_LOADED;
+   pControlBlock->stableCount = 0;
+   pControlBlock->emptyRun = 0;
+   pControlBlock->hasAnchor = FALSE;
+}
+
+static uint32_t whole(int32_t tracked) {
+   if (tracked < 0) {
+      return 0;
+   }
+   return (uint32_t)((tracked + (1 << (AUTOZERO_FRACTION_BITS - 1))) >> AUTOZERO_FRACTION_BITS);
+}
+
+static uint32_t distance(uint32_t a, uint32_t b) {
+   return (a > b) ? (a - b) : (b - a);
+}
+
+// Whether the reading is in the same zone as the last one and close to it,
+// counting readings in a row that are.
+static uint8_t isStable(T_AutoZeroCB *pControlBlock, const int32_t *pReadings, uint8_t zone) {
+   uint8_t steady = (zone == pControlBlock->zone);
+   uint8_t j;
+
+   for (j = 0; j < AUTOZERO_CHANNELS; j++) {
+      if (distance((uint32_t)pReadings[j], (uint32_t)pControlBlock->previous[j]) > pControlBlock->pPolicy->stableBand) {
+         steady = FALSE;
+      }
+      pControlBlock->previous[j] = pReadings[j];
+   }
+   pControlBlock->zone = zone;
+
+   if (!steady) {
+      pControlBlock->stableCount = 0;
+      pControlBlock->emptyRun = 0;
+   } else if (pControlBlock->stableCount < pControlBlock->pPolicy->stableReadings) {
+      pControlBlock->stableCount++;
+   }
+   return (zone != AUTOZERO_LOADED) && (pControlBlock->stableCount >= pControlBlock->pPolicy->stableReadings);
+}
+
+static void follow(int32_t *pTracked, const int32_t *pReadings, uint8_t shift) {
+   uint8_t j;
+
+   for (j = 0; j < AUTOZERO_CHANNELS; j++) {
+      int32_t target = pReadings[j] << AUTOZERO_FRACTION_BITS;
+
+      int32_t step = target - pTracked[j];
+      int32_t half = (1 << shift) / 2;
+
+      // rounded, so the tracked reading gets to within half a count
+      pTracked[j] += ((step < 0) ? (step - half) : (step + half)) / (1 << shift);
+   }
+}
+
+// The drift of the empty reading since the anchor, once the window is over
+// and the tracked reading has caught up.
+static void measureDrift(T_AutoZeroCB *pControlBlock, uint32_t now) {
+   uint32_t elapsed = now - pControlBlock->anchorTicks;
+   uint8_t j;
+
+   if (pControlBlock->emptyRun < (4U << pControlBlock->pPolicy->zeroShift)) {
+      pControlBlock->emptyRun++;
+      return;
+   }
+   if (pControlBlock->hasAnchor && (elapsed < pControlBlock->pPolicy->rateWindow)) {
+      return;
+   }
+   // an anchor half the tick range old may have wrapped; it only starts over
+   if (pControlBlock->hasAnchor && (elapsed <= 0x7fffffffUL)) {
+      for (j = 0; j < AUTOZERO_CHANNELS; j++) {
+         int64_t moved = pControlBlock->low[j] - pControlBlock->anchorLow[j];
+
+         pControlBlock->driftPerDay[j] = (int32_t)(moved * TICKS_PER_DAY / elapsed);
+      }
+   }
+   for (j = 0; j < AUTOZERO_CHANNELS; j++) {
+      pControlBlock->anchorLow[j] = pControlBlock->low[j];
+   }
+   pControlBlock->anchorTicks = now;
+   pControlBlock->hasAnchor = TRUE;
+}
+
+// Copies the tracked readings into the limits, and stores them once one has
+// moved far enough.  Returns TRUE when a limit changed.
+static uint8_t apply(T_AutoZeroCB *pControlBlock) {
+   uint16_t threshold = pControlBlock->pPolicy->persistThreshold;
+   uint8_t changed = FALSE;
+   uint8_t moved = FALSE;
+   uint8_t j;
+
+   for (j = 0; j < AUTOZERO_CHANNELS; j++) {
+      uint32_t low = whole(pControlBlock->low[j]);
+      uint32_t high = whole(pControlBlock->high[j]);
+
+      // a curve needs the full reading above the empty one
+      if (high <= low) {
+         continue;
+      }
+      if ((low != pControlBlock->pLow[j]) || (high != pControlBlock->pHigh[j])) {
+         pControlBlock->pLow[j] = low;
+         pControlBlock->pHigh[j] = high;
+         changed = TRUE;
+      }
+      if ((distance(low, pControlBlock->storedLow[j]) >= threshold) ||
+          (distance(high, pControlBlock->storedHigh[j]) >= threshold)) {
+         moved = TRUE;
+      }
+   }
+
+   if (moved) {
+      pControlBlock->store();
+      pControlBlock->stats.stores++;
+      for (j = 0; j < AUTOZERO_CHANNELS; j++) {
+         pControlBlock->storedLow[j] = pControlBlock->pLow[j];
+         pControlBlock->storedHigh[j] = pControlBlock->pHigh[j];
+      }
+   }
+   return changed;
+}
+
+uint8_t AutoZero_Update(T_AutoZeroCB *pControlBlock, const int32_t *pReadings, uint8_t zone, uint32_t now) {
+   if (!isStable(pControlBlock, pReadings, zone)) {
+      return FALSE;
+   }
+
+   if (zone == AUTOZERO_EMPTY) {
+      follow(pControlBlock->low, pReadings, pControlBlock->pPolicy->zeroShift);
+      measureDrift(pControlBlock, now);
+      pControlBlock->stats.emptyReadings++;
+   } else {
+      follow(pControlBlock->high, pReadings, pControlBlock->pPolicy->gainShift);
+      pControlBlock->stats.fullReadings++;
+   }
+   return apply(pControlBlock);
+}
+
+// The drift of the empty reading over the last window, in counts a day
+// summed over the channels.
+int32_t AutoZero_DriftPerDay(const T_AutoZeroCB *pControlBlock) {
+   int32_t drift = 0;
+   uint8_t j;
+
+   for (j = 0; j < AUTOZERO_CHANNELS; j++) {
+      drift += pControlBlock->driftPerDay[j];
+   }
+   return (drift + ((drift < 0) ? -128 : 128)) / (1 << AUTOZERO_FRACTION_BITS);
+}
@@ -0,0 +1,101 @@
+/*
+ * Tracking of the empty and full readings of the FSRs.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * FSRs creep under load and with temperature, so the readings of an empty
+ * and of a full scale drift away from the calibration.  AutoZero_Update is
+ * given every periodic reading and whether the weight it gives is empty,
+ * full or neither.  Once the scale has been empty (or full) for
+ * stableReadings readings in a row, each within stableBand counts of the
+ * one before, every further reading pulls the tracked empty (full) reading
+ * of each channel 1 / 2^zeroShift (1 / 2^gainShift) of the way towards it.
+ * The tracked readings live in RAM, in 1/256 counts, and are copied into
+ * the low and high limits the weight is worked out from.  The limits are
+ * stored only once one of them has moved persistThreshold counts from what
+ * was stored last.
+ *
+ * The drift of the empty reading, in counts a day, is worked out between
+ * two points at least rateWindow ticks apart at which the tracked reading
+ * had caught up: four filter time constants into a spell of being empty.
+ * Ticks are the millisecond ticks of the main loop and may wrap.
+ */
+
+#ifndef AUTOZERO_H
+#define AUTOZERO_H
+
+#include <stdint.h>
+
+#define AUTOZERO_CHANNELS 3
+#define AUTOZERO_FRACTION_BITS 8
+
+// What the weight of a reading says the scale holds.
+#define AUTOZERO_LOADED 0
+#define AUTOZERO_EMPTY 1
+#define AUTOZERO_FULL 2
+
+typedef struct T_AutoZeroPolicy {
+   uint32_t rateWindow;
+   uint16_t stableBand;
+   uint16_t persistThreshold;
+   uint8_t stableReadings;
+   uint8_t zeroShift;
+   uint8_t gainShift;
+} T_AutoZeroPolicy;
+
+typedef struct T_AutoZeroStats {
+   uint32_t emptyReadings;
+   uint32_t fullReadings;
+   uint32_t stores;
+} T_AutoZeroStats;
+
+typedef struct T_AutoZeroCB {
+   const T_AutoZeroPolicy *pPolicy;
+   uint32_t *pLow;
+   uint32_t *pHigh;
+   void (*store)(void);
+   int32_t low[AUTOZERO_CHANNELS];
+   int32_t high[AUTOZERO_CHANNELS];
+   uint32_t storedLow[AUTOZERO_CHANNELS];
+   uint32_t storedHigh[AUTOZERO_CHANNELS];
+   int32_t previous[AUTOZERO_CHANNELS];
+   uint8_t zone;
+   uint8_t stableCount;
+   uint16_t emptyRun;
+   uint8_t hasAnchor;
+   uint32_t anchorTicks;
+   int32_t anchorLow[AUTOZERO_CHANNELS];
+   int32_t driftPerDay[AUTOZERO_CHANNELS];   // 1/256 counts a day
+   T_AutoZeroStats stats;
+} T_AutoZeroCB;
+
+#define AUTOZERO_FAILURE 0
+#define AUTOZERO_SUCCESS 1
+
+uint8_t AutoZero_Init(T_AutoZeroCB *pControlBlock, const T_AutoZeroPolicy *pPolicy, uint32_t *pLow, uint32_t *pHigh,
+                      void (*store)(void));
+void AutoZero_Restart(T_AutoZeroCB *pControlBlock);
+uint8_t AutoZero_Update(T_AutoZeroCB *pControlBlock, const int32_t *pReadings, uint8_t zone, uint32_t now);
+int32_t AutoZero_DriftPerDay(const T_AutoZeroCB *pControlBlock);
+
+#endif
@@ -10,6 +10,7 @@
 #include "DebugUart.h"
 #include "ringbuf.h"
 #include "crc.h"
+#include "profile.h"
 
 #ifndef NULL
 #define NULL 0
@@ -29,32 +30,28 @@
  * Private Stuff
  */
 
-// Message handling stuff
-static unsigned char recvBuf[64] = { 0 };
-static uint8_t bufIndex;
-static uint8_t payloadLen;
-static uint8_t msgType;
-static uint8_t dataType;
-
-// Packet handling stuff
-static unsigned char packetBuf[64] = { 0 };
-static T_RingBufferCB packetBufCb;
-static uint8_t packetLen;
-static uint8_t packetIndex;
+// the communication states
+enum ECommState {
+  State_WaitingForStx,
+  State_WaitingForLength,
+  State_WaitingForPacket,
+  State_Invalid = 0xff
+};
 
-#define MAX_CALLBACKS (10)
 #define NO_CALLBACK (0xff)
-static chCbTableType callbackTable[MAX_CALLBACKS];
+
+// The link behind the ChillHub singleton
+static T_ChillHubCB hub;
 
 /*
  * Private function prototypes
  */
-static void storeCallbackEntry(unsigned char id, unsigned char typ, chillhubCallbackFunction fcn);
-static chillhubCallbackFunction callbackLookup(unsigned char sym, unsigned char typ);
-static uint8_t getIndexOfCallback(unsigned char sym, unsigned char typ);
-static uint8_t getUnusedIndexFromCallbackTable(void);
-static void callbackRemove(unsigned char sym, unsigned char typ);
-static void setName(const char* name, const char *UUID);
+static void storeCallbackEntry(T_ChillHubCB *pControlBlock, unsigned char id, unsigned char typ, chillhubCallbackFunction fcn);
+static chillhubCallbackFunction callbackLookup(T_ChillHubCB *pControlBlock, unsigned char sym, unsigned char typ);
+static uint8_t getIndexOfCallback(T_ChillHubCB *pControlBlock, unsigned char sym, unsigned char typ);
+static uint8_t getUnusedIndexFromCallbackTable(T_ChillHubCB *pControlBlock);
+static void callbackRemove(T_ChillHubCB *pControlBlock, unsigned char sym, unsigned char typ);
+static void setName(T_ChillHubCB *pControlBlock, const char* name, const char *UUID);
 static void setup(const char* name, const char *UUID, const T_Serial* serial);
 static void subscribe(unsigned char type, chillhubCallbackFunction cb);
 static void unsubscribe(unsigned char type);
@@ -64,15 +61,26 @@ static void getTime(chillhubCallbackFunction cb);
 static void addCloudListener(unsigned char msgType, chillhubCallbackFunction cb);
 static void createCloudResourceU16(const char *name, uint8_t resID, uint8_t canUpdate, uint16_t initVal);
 static void updateCloudResourceU16(uint8_t resID, uint16_t val);
-static void sendU8Msg(unsigned char msgType, unsigned char payload);
-static void sendU16Msg(unsigned char msgType, unsigned int payload);
-static void sendI8Msg(unsigned char msgType, signed char payload);
-static void sendI16Msg(unsigned char msgType, signed int payload);
-static void sendBooleanMsg(unsigned char msgType, unsigned char payload);
+#define SINGLETON_SENDER_PROTOTYPE(name, dataType, parameterType) \
+  static void send##name##Msg(unsigned char msgType, parameterType payload);
+CHILLHUB_SCALAR_SENDERS(SINGLETON_SENDER_PROTOTYPE)
+#undef SINGLETON_SENDER_PROTOTYPE
 static void loop(void);
-static void sendPacket(uint8_t *buf, uint8_t len);
+static uint8_t isIdle(void);
+static const T_ChillHubStats* getStats(void);
+static void countUsbReset(void);
+static void sendStats(unsigned char msgType);
+static void sendU8ArrayMsg(unsigned char msgType, const uint8_t *pData, uint8_t count);
+static void sendU16ArrayMsg(unsigned char msgType, const uint16_t *pData, uint8_t count);
+static const T_ChillHubPayload* getPayload(void);
+static void setTraceHook(chillhubTraceHook hook);
+static void sendPacket(T_ChillHubCB *pControlBlock, uint8_t *buf, uint8_t len);
 static uint8_t isControlChar(uint8_t c);
-static void outputChar(uint8_t c);
+static uint8_t putEscaped(uint8_t *pOut, uint8_t c);
+static T_ChillHubTemplate* resourceTemplate(T_ChillHubCB *pControlBlock, uint8_t resID);
+static void buildResourceTemplate(T_ChillHubCB *pControlBlock, uint8_t resID);
+static void outputChar(T_ChillHubCB *pControlBlock, uint8_t c);
+static void writeSerial(T_ChillHubCB *pControlBlock, const uint8_t *pBuf, uint8_t len);
 
 // The singleton ChillHub instance
 const chInterface ChillHub = {
@@ -90,31 +98,44 @@ const chInterface ChillHub = {
    .sendI8Msg = sendI8Msg,
    .sendI16Msg = sendI16Msg,
    .sendBooleanMsg = sendBooleanMsg,
-   .loop = loop
+   .loop = loop,
+   .isIdle = isIdle,
+   .getStats = getStats,
+   .countUsbReset = countUsbReset,
+   .sendStats = sendStats,
+   .sendU8ArrayMsg = sendU8ArrayMsg,
+   .sendU16ArrayMsg = sendU16ArrayMsg,
+   .getPayload = getPayload,
+   .setTraceHook = setTraceHook
 };
 
-static const T_Serial *Serial;
-
 enum eMsgByteIndices {
   lenIndex = 0,
   msgTypeIndex = 1,
   dataTypeIndex = 2
 };
 
-const char resIdKey[] = "resID";
-const char valKey[] = "val";
+// JSON keys.  On the wire a key is its length and its characters, which
+// takes as many bytes as sizeof counts with the terminating NUL.
+static const char nameKey[] = "name";
+static const char resIdKey[] = "resID";
+static const char canUpdateKey[] = "canUp";
+static const char initValKey[] = "initVal";
+static const char valKey[] = "val";
 
-const uint8_t sizeOfU16JsonField = 3;
-const uint8_t sizeOfU8JsonField = 2;
+#define JSON_KEY_SIZE(key) (sizeof(key))
+#define JSON_FIELD_SIZE(dataType) (1 + CHILLHUB_SIZE_##dataType)
+#define APPEND_JSON_KEY(pBuf, key) appendJsonKey(pBuf, key, sizeof(key) - 1)
+
+PROFILE_PROBE(checkPacketProbe, "CheckPacket");
+PROFILE_PROBE(processPayloadProbe, "processChillhubMessagePayload");
+PROFILE_PROBE(sendPacketProbe, "sendPacket");
+PROFILE_PROBE(sendTemplateProbe, "sendTemplate");
 
 /*
  * Functions
  */
 
-uint8_t sizeOfJsonKey(const char *key) {
-  return strlen(key) + 1;  
-}
-
 void printU8(uint8_t val) {
   uint8_t digits[3];
   uint8_t i;
@@ -205,91 +226,99 @@ void printI32(int32_t val) {
   }
 }
 
-static void setup(const char* name, const char *UUID, const T_Serial* serial) {
+void ChillHub_Init(T_ChillHubCB *pControlBlock) {
+  memset(pControlBlock, 0, sizeof(*pControlBlock));
+  pControlBlock->currentState = State_WaitingForStx;
+}
+
+void ChillHub_Setup(T_ChillHubCB *pControlBlock, const char* name, const char *UUID, const T_Serial* serial) {
   uint8_t i;
-  Serial = serial;
+  pControlBlock->pSerial = serial;
   
-  RingBuffer_Init(&packetBufCb, &packetBuf[0], sizeof(packetBuf));
+  RingBuffer_Init(&pControlBlock->packetBufCb, &pControlBlock->packetBuf[0], sizeof(pControlBlock->packetBuf));
+  pControlBlock->currentState = State_WaitingForStx;
+  pControlBlock->skippedBeforeStx = FALSE;
   
   // Initialize callback array
-  for(i=0; i<MAX_CALLBACKS; i++) {
-    callbackTable[i].inUse = FALSE;
+  for(i=0; i<CHILLHUB_MAX_CALLBACKS; i++) {
+    pControlBlock->callbackTable[i].inUse = FALSE;
   }
   
   // register device type with chillhub mailman
   DebugUart_UartPutString("Initializing chillhub interface...\r\n");
-  setName(name, UUID);
+  setName(pControlBlock, name, UUID);
   DebugUart_UartPutString("...initialized.\r\n");
 }
 
-static void sendU8Msg(unsigned char msgType, unsigned char payload) {
-  uint8_t buf[16];
+// msgLen comes from CHILLHUB_SCALAR_MSG_LEN; the value goes out most
+// significant byte first in what is left of it after the two type bytes
+static void sendScalar(T_ChillHubCB *pControlBlock, uint8_t msgType, uint8_t dataType, uint32_t value, uint8_t msgLen) {
+  uint8_t buf[1 + CHILLHUB_SCALAR_MSG_LEN(unsigned32DataType)];
   uint8_t index=0;
-  
-  DebugUart_UartPutString("Sending U8 message.\r\n");
+  uint8_t size = msgLen - 2;
 
-  buf[index++] = 3;
+  buf[index++] = msgLen;
   buf[index++] = msgType;
-  buf[index++] = unsigned8DataType;
-  buf[index++] = payload;
-  sendPacket(buf, index);
-}
-
-static void sendI8Msg(unsigned char msgType, signed char payload) {
-  uint8_t buf[16];
-  uint8_t index=0;
-  
-  DebugUart_UartPutString("Sendig I8 message.\r\n");
-
-  buf[index++] = 3;
-  buf[index++] = msgType;
-  buf[index++] = signed8DataType;
-  buf[index++] = payload;
-  sendPacket(buf, index);
+  buf[index++] = dataType;
+  while (size > 0) {
+    size--;
+    buf[index++] = (value >> (8 * size)) & 0xff;
+  }
+  sendPacket(pControlBlock, buf, index);
 }
 
-static void sendU16Msg(unsigned char msgType, unsigned int payload) {
-  uint8_t buf[16];
-  uint8_t index=0;
-
-  DebugUart_UartPutString("Sendig U16 message.\r\n");
-
-  buf[index++] = 4;
-  buf[index++] = msgType;
-  buf[index++] = unsigned16DataType;
-  buf[index++] = (payload >> 8) & 0xff;
-  buf[index++] = payload & 0xff;
-  sendPacket(buf, index);
-}
+#define SCALAR_SENDER(name, dataType, parameterType) \
+  void ChillHub_Send##name##Msg(T_ChillHubCB *pControlBlock, unsigned char msgType, parameterType payload) { \
+    DebugUart_UartPutString("Sending " #name " message.\r\n"); \
+    sendScalar(pControlBlock, msgType, dataType, (uint32_t)payload, CHILLHUB_SCALAR_MSG_LEN(dataType)); \
+  }
+CHILLHUB_SCALAR_SENDERS(SCALAR_SENDER)
+#undef SCALAR_SENDER
 
-static void sendI16Msg(unsigned char msgType, signed int payload) {
-  uint8_t buf[16];
+void ChillHub_SendU8ArrayMsg(T_ChillHubCB *pControlBlock, unsigned char msgType, const uint8_t *pData, uint8_t count) {
+  uint8_t buf[64];
   uint8_t index=0;
+  uint8_t i;
 
-  DebugUart_UartPutString("Sendig I16 message.\r\n");
+  if (count > (sizeof(buf) - 5)) {
+    DebugUart_UartPutString("U8 array too long.\r\n");
+    return;
+  }
 
-  buf[index++] = 4;
+  buf[index++] = count + 4;
   buf[index++] = msgType;
-  buf[index++] = signed16DataType;
-  buf[index++] = (payload >> 8) & 0xff;
-  buf[index++] = payload & 0xff;
-  sendPacket(buf, index);
+  buf[index++] = arrayDataType;
+  buf[index++] = count; // number of elements
+  buf[index++] = unsigned8DataType; // data type of elements
+  for (i = 0; i < count; i++) {
+    buf[index++] = pData[i];
+  }
+  sendPacket(pControlBlock, buf, index);
 }
 
-static void sendBooleanMsg(unsigned char msgType, unsigned char payload) {
-  uint8_t buf[16];
+void ChillHub_SendU16ArrayMsg(T_ChillHubCB *pControlBlock, unsigned char msgType, const uint16_t *pData, uint8_t count) {
+  uint8_t buf[64];
   uint8_t index=0;
+  uint8_t i;
 
-  DebugUart_UartPutString("Sending boolean message.\r\n");
+  if (count > ((sizeof(buf) - 5) / 2)) {
+    DebugUart_UartPutString("U16 array too long.\r\n");
+    return;
+  }
 
-  buf[index++] = 3;
+  buf[index++] = (2 * count) + 4;
   buf[index++] = msgType;
-  buf[index++] = booleanDataType;
-  buf[index++] = payload;
-  sendPacket(buf, index);
+  buf[index++] = arrayDataType;
+  buf[index++] = count; // number of elements
+  buf[index++] = unsigned16DataType; // data type of elements
+  for (i = 0; i < count; i++) {
+    buf[index++] = MSB_OF_U16(pData[i]);
+    buf[index++] = LSB_OF_U16(pData[i]);
+  }
+  sendPacket(pControlBlock, buf, index);
 }
 
-static void setName(const char* name, const char *UUID) {
+static void setName(T_ChillHubCB *pControlBlock, const char* name, const char *UUID) {
   uint8_t buf[256];
   uint8_t nameLen = strlen(name);
   uint8_t uuidLen = strlen(UUID);
@@ -309,88 +338,86 @@ static void setName(const char* name, const char *UUID) {
 
   // send device type
   buf[index++] = nameLen;
-  strcat((char *)&buf[index], name);
+  memcpy(&buf[index], name, nameLen);
   index += nameLen;
   
   // send UUID
   buf[index++] = uuidLen;
-  strcat((char *)&buf[index], UUID);
+  memcpy(&buf[index], UUID, uuidLen);
   index += uuidLen;
-  sendPacket(buf, index);
+  sendPacket(pControlBlock, buf, index);
 }
 
-static void subscribe(unsigned char type, chillhubCallbackFunction callback) {
+void ChillHub_Subscribe(T_ChillHubCB *pControlBlock, unsigned char type, chillhubCallbackFunction callback) {
   DebugUart_UartPutString("Received subscription request.\r\n");
   
-  storeCallbackEntry(type, CHILLHUB_CB_TYPE_FRIDGE, callback);
-  sendU8Msg(subscribeMsgType, type);
+  storeCallbackEntry(pControlBlock, type, CHILLHUB_CB_TYPE_FRIDGE, callback);
+  ChillHub_SendU8Msg(pControlBlock, subscribeMsgType, type);
 }
 
-static void unsubscribe(unsigned char type) {
+void ChillHub_Unsubscribe(T_ChillHubCB *pControlBlock, unsigned char type) {
   DebugUart_UartPutString("Received unsubscription request.\r\n");
   
-  sendU8Msg(unsubscribeMsgType, type);
-  callbackRemove(type, CHILLHUB_CB_TYPE_FRIDGE);
+  ChillHub_SendU8Msg(pControlBlock, unsubscribeMsgType, type);
+  callbackRemove(pControlBlock, type, CHILLHUB_CB_TYPE_FRIDGE);
 }
 
-static void setAlarm(unsigned char ID, char* cronString, unsigned char strLength, chillhubCallbackFunction callback) {
+void ChillHub_SetAlarm(T_ChillHubCB *pControlBlock, unsigned char ID, char* cronString, unsigned char strLength, chillhubCallbackFunction callback) {
   uint8_t buf[256];
   uint8_t index=0;
 
   DebugUart_UartPutString("Received set alarm request.\r\n");
   
-  storeCallbackEntry(ID, CHILLHUB_CB_TYPE_CRON, callback);  
+  storeCallbackEntry(pControlBlock, ID, CHILLHUB_CB_TYPE_CRON, callback);  
   buf[index++] = strLength + 4; // message length
   buf[index++] = setAlarmMsgType;
   buf[index++] = stringDataType;
   buf[index++] = strLength + 1; // string length
   buf[index++] = ID; // callback id... it's best to use a character here otherwise things don't work right
-  strncat((char *)&buf[index], cronString, strLength);
+  memcpy(&buf[index], cronString, strLength);
   index += strLength;
-  sendPacket(buf, index);
+  sendPacket(pControlBlock, buf, index);
 }
 
-static void unsetAlarm(unsigned char ID) {
+void ChillHub_UnsetAlarm(T_ChillHubCB *pControlBlock, unsigned char ID) {
   DebugUart_UartPutString("Received unset alarm request.\r\n");
   
-  sendU8Msg(unsetAlarmMsgType, ID);
-  callbackRemove(ID, CHILLHUB_CB_TYPE_CRON);
+  ChillHub_SendU8Msg(pControlBlock, unsetAlarmMsgType, ID);
+  callbackRemove(pControlBlock, ID, CHILLHUB_CB_TYPE_CRON);
 }
 
-static void getTime(chillhubCallbackFunction cb) {
+void ChillHub_GetTime(T_ChillHubCB *pControlBlock, chillhubCallbackFunction cb) {
   uint8_t buf[16];
   uint8_t index=0;
   
   DebugUart_UartPutString("Sending get time message.\r\n");
   
-  storeCallbackEntry(0, CHILLHUB_CB_TYPE_TIME, cb);
+  storeCallbackEntry(pControlBlock, 0, CHILLHUB_CB_TYPE_TIME, cb);
 
   buf[index++] = 1;
   buf[index++] = getTimeMsgType;
-  sendPacket(buf, index);
+  sendPacket(pControlBlock, buf, index);
 }
 
-static void addCloudListener(unsigned char ID, chillhubCallbackFunction cb) {
+void ChillHub_AddCloudListener(T_ChillHubCB *pControlBlock, unsigned char ID, chillhubCallbackFunction cb) {
   DebugUart_UartPutString("Adding cloud listener. ");
-  printU32((uint32_t)cb);
+  printU32((uint32_t)(uintptr_t)cb);
   DebugUart_UartPutString("\r\n");
   
-  storeCallbackEntry(ID, CHILLHUB_CB_TYPE_CLOUD, cb);
+  storeCallbackEntry(pControlBlock, ID, CHILLHUB_CB_TYPE_CLOUD, cb);
 }
 
-static uint8_t appendJsonKey(uint8_t *pBuf, const char *key) {
-  uint8_t keyLen = strlen(key);
+static uint8_t appendJsonKey(uint8_t *pBuf, const char *key, uint8_t keyLen) {
   *pBuf = keyLen;
   pBuf++;
-  strncpy((char *)pBuf, key, keyLen);
+  memcpy(pBuf, key, keyLen);
   return keyLen + 1;
 }
 
-static uint8_t appendJsonString(uint8_t *pBuf, const char *s) {
-  uint8_t len = strlen(s);
+static uint8_t appendJsonString(uint8_t *pBuf, const char *s, uint8_t len) {
   *pBuf++ = stringDataType;
   *pBuf++ = len;
-  strcpy((char*)pBuf, s);
+  memcpy(pBuf, s, len);
   return len + 2;
 }
 
@@ -407,127 +434,288 @@ static uint8_t appendJsonU16(uint8_t *pBuf, uint16_t v) {
   return 3;
 }
 
-static void createCloudResourceU16(const char *name, uint8_t resID, uint8_t canUpdate, uint16_t initVal) {
+void ChillHub_CreateCloudResourceU16(T_ChillHubCB *pControlBlock, const char *name, uint8_t resID, uint8_t canUpdate, uint16_t initVal) {
   uint8_t buf[256];
   uint8_t index=0;
+  uint8_t nameLen = strlen(name);
   
   // set up message header and send
   index = 0;
-  buf[index++] = 37 + strlen(name); // length
+  buf[index++] = 3 + // length
+    JSON_KEY_SIZE(nameKey) + 2 + nameLen +
+    JSON_KEY_SIZE(resIdKey) + JSON_FIELD_SIZE(unsigned8DataType) +
+    JSON_KEY_SIZE(canUpdateKey) + JSON_FIELD_SIZE(unsigned8DataType) +
+    JSON_KEY_SIZE(initValKey) + JSON_FIELD_SIZE(unsigned16DataType);
   buf[index++] = registerResourceType; // message type
   buf[index++] = jsonDataType; // message data type
   buf[index++] = 4; // JSON fields
 
-  index += appendJsonKey(&buf[index], "name");
-  index += appendJsonString(&buf[index], name);
+  index += APPEND_JSON_KEY(&buf[index], nameKey);
+  index += appendJsonString(&buf[index], name, nameLen);
   
-  index += appendJsonKey(&buf[index], resIdKey);
+  index += APPEND_JSON_KEY(&buf[index], resIdKey);
   index += appendJsonU8(&buf[index], resID);
 
-  index += appendJsonKey(&buf[index], "canUp");
+  index += APPEND_JSON_KEY(&buf[index], canUpdateKey);
   index += appendJsonU8(&buf[index], canUpdate);
   
-  index += appendJsonKey(&buf[index], "initVal");
+  index += APPEND_JSON_KEY(&buf[index], initValKey);
   index += appendJsonU16(&buf[index], initVal);
   
-  sendPacket(buf, index);
+  sendPacket(pControlBlock, buf, index);
+  buildResourceTemplate(pControlBlock, resID);
 }
 
-static void updateCloudResourceU16(uint8_t resID, uint16_t val) {
-  uint8_t buf[64];
+// The update message for a resource, up to the value
+static uint8_t buildUpdatePrefix(uint8_t *pBuf, uint8_t resID) {
   uint8_t index = 0;
 
-  buf[index++] = 3 + 
-    sizeOfJsonKey(resIdKey) + sizeOfU8JsonField +
-    sizeOfJsonKey(valKey) + sizeOfU16JsonField;
-    
-  buf[index++] = updateResourceType;
-  buf[index++] = jsonDataType;
-  buf[index++] = 2; // number of json fields
+  pBuf[index++] = 3 +
+    JSON_KEY_SIZE(resIdKey) + JSON_FIELD_SIZE(unsigned8DataType) +
+    JSON_KEY_SIZE(valKey) + JSON_FIELD_SIZE(unsigned16DataType);
+  pBuf[index++] = updateResourceType;
+  pBuf[index++] = jsonDataType;
+  pBuf[index++] = 2; // number of json fields
   
-  index += appendJsonKey(&buf[index], resIdKey);
-  index += appendJsonU8(&buf[index], resID);
-  index += appendJsonKey(&buf[index], valKey);
-  index += appendJsonU16(&buf[index], val);
+  index += APPEND_JSON_KEY(&pBuf[index], resIdKey);
+  index += appendJsonU8(&pBuf[index], resID);
+  index += APPEND_JSON_KEY(&pBuf[index], valKey);
+  pBuf[index++] = unsigned16DataType;
+  return index;
+}
+
+// Keeps the update frame of a resource as a template, in the slot it had
+// or a free one.  Without a slot its updates are built in full.
+static void buildResourceTemplate(T_ChillHubCB *pControlBlock, uint8_t resID) {
+  uint8_t buf[1 + 3 +
+    JSON_KEY_SIZE(resIdKey) + JSON_FIELD_SIZE(unsigned8DataType) +
+    JSON_KEY_SIZE(valKey) + 1];
+  T_ChillHubTemplate *pTemplate = resourceTemplate(pControlBlock, resID);
+  uint8_t i;
+
+  for (i = 0; (pTemplate == NULL) && (i < CHILLHUB_MAX_RESOURCES); i++) {
+    if (pControlBlock->resourceTemplates[i].prefixLen == 0) {
+      pControlBlock->resourceIds[i] = resID;
+      pTemplate = &pControlBlock->resourceTemplates[i];
+    }
+  }
+  if (pTemplate != NULL) {
+    ChillHub_InitTemplate(pTemplate, buf, buildUpdatePrefix(buf, resID));
+  }
+}
+
+static T_ChillHubTemplate* resourceTemplate(T_ChillHubCB *pControlBlock, uint8_t resID) {
+  uint8_t i;
+
+  for (i = 0; i < CHILLHUB_MAX_RESOURCES; i++) {
+    if ((pControlBlock->resourceTemplates[i].prefixLen != 0) && (pControlBlock->resourceIds[i] == resID)) {
+      return &pControlBlock->resourceTemplates[i];
+    }
+  }
+  return NULL;
+}
+
+void ChillHub_UpdateCloudResourceU16(T_ChillHubCB *pControlBlock, uint8_t resID, uint16_t val) {
+  uint8_t buf[1 + 3 +
+    JSON_KEY_SIZE(resIdKey) + JSON_FIELD_SIZE(unsigned8DataType) +
+    JSON_KEY_SIZE(valKey) + JSON_FIELD_SIZE(unsigned16DataType)];
+  const T_ChillHubTemplate *pTemplate = resourceTemplate(pControlBlock, resID);
+  uint8_t index;
+
+  if (pTemplate != NULL) {
+    ChillHub_SendTemplate(pControlBlock, pTemplate, val);
+    return;
+  }
+
+  index = buildUpdatePrefix(buf, resID);
+  buf[index++] = MSB_OF_U16(val);
+  buf[index++] = LSB_OF_U16(val);
   
-  sendPacket(buf, index);
+  sendPacket(pControlBlock, buf, index);
 }
 
-// the communication states
-enum ECommState {
-  State_WaitingForStx,
-  State_WaitingForLength,
-  State_WaitingForPacket,
-  State_Invalid = 0xff
-};
+uint8_t ChillHub_InitTemplate(T_ChillHubTemplate *pTemplate, const uint8_t *pBuf, uint8_t len) {
+  uint8_t index = 0;
+  uint8_t i;
+
+  // STX, then the length and the bytes, each of which may need an escape
+  pTemplate->prefixLen = 0;
+  if ((1 + 2 * ((uint16_t)len + 1)) > (int)sizeof(pTemplate->prefix)) {
+    return FALSE;
+  }
+
+  pTemplate->prefix[index++] = STX;
+  index += putEscaped(&pTemplate->prefix[index], len + 2);
+  for (i = 0; i < len; i++) {
+    index += putEscaped(&pTemplate->prefix[index], pBuf[i]);
+  }
+  pTemplate->crc = crc_update(crc_init(), pBuf, len);
+  pTemplate->prefixLen = index;
+  return TRUE;
+}
+
+void ChillHub_SendTemplate(T_ChillHubCB *pControlBlock, const T_ChillHubTemplate *pTemplate, uint16_t value) {
+  uint8_t valueBytes[2];
+  uint8_t tail[8];
+  uint8_t index = 0;
+  uint16_t crc;
+  PROFILE_BEGIN(sendTemplateProbe);
+
+  valueBytes[0] = MSB_OF_U16(value);
+  valueBytes[1] = LSB_OF_U16(value);
+  crc = crc_finalize(crc_update(pTemplate->crc, valueBytes, sizeof(valueBytes)));
+
+  index += putEscaped(&tail[index], valueBytes[0]);
+  index += putEscaped(&tail[index], valueBytes[1]);
+  index += putEscaped(&tail[index], MSB_OF_U16(crc));
+  index += putEscaped(&tail[index], LSB_OF_U16(crc));
+
+  writeSerial(pControlBlock, pTemplate->prefix, pTemplate->prefixLen);
+  writeSerial(pControlBlock, tail, index);
+  pControlBlock->stats.framesTx++;
+  pControlBlock->stats.bytesTx += pTemplate->prefixLen + index;
+  PROFILE_END(sendTemplateProbe);
+}
+
+// Whether a message of msgLen bytes (message type, data type, data) holds
+// what its type says it does: the data type the schema gives the message
+// type, if it gives one, and enough data for it
+static uint8_t messageFits(uint8_t msgType, uint8_t dataType, uint8_t msgLen) {
+  uint8_t needed = 2 + ChillHub_SizeOfDataType(dataType);
+  uint8_t expected;
+
+  if (ChillHub_DataTypeOfMsg(msgType, &expected) && (dataType != expected)) {
+    return FALSE;
+  }
+  if (msgType == timeResponseMsgType) {
+    // count, element type, 4 bytes of time
+    needed = 2 + 2 + 4;
+  } else if (msgType == alarmNotifyMsgType) {
+    // count, element type, alarm ID, 4 bytes of time
+    needed = 2 + 2 + 1 + 4;
+  }
+  return msgLen >= needed;
+}
+
+// The time in an alarm notification or a time response: an array of U8,
+// the alarm ID first for an alarm, then 4 bytes of time.
+static uint8_t timeOfMessage(const T_ChillHubPayload *pPayload, uint8_t *pAlarmId, T_ChillHubIter *pTime) {
+  T_ChillHubPayload element;
+
+  if (!ChillHubPayload_AsArray(pPayload, pTime) || (pTime->elementType != unsigned8DataType)) {
+    return FALSE;
+  }
+  if ((pAlarmId != NULL) &&
+      !(ChillHubIter_Next(pTime, &element) && ChillHubPayload_AsU8(&element, pAlarmId))) {
+    return FALSE;
+  }
+  return (pTime->remaining >= 4) && (pTime->length >= 4);
+}
 
-static void processChillhubMessagePayload(void) {
+static void processChillhubMessagePayload(T_ChillHubCB *pControlBlock) {
+  unsigned char *recvBuf = pControlBlock->recvBuf;
   chillhubCallbackFunction callback = NULL;
+  T_ChillHubIter time;
+  uint8_t alarmId;
+  uint8_t bufIndex;
+  uint8_t msgType;
+  uint8_t dataType;
+  uint8_t msgLen = pControlBlock->bufIndex - 1;
+  PROFILE_BEGIN(processPayloadProbe);
   
+  // StateHandler_WaitingForLength turns these away, but the view below
+  // must never be built over more than was received
+  if ((pControlBlock->bufIndex == 0) || (msgLen < 2)) {
+    pControlBlock->stats.malformedMessages++;
+    pControlBlock->bufIndex = 0;
+    PROFILE_END(processPayloadProbe);
+    return;
+  }
+
   // got the payload, process the message
   bufIndex = 0;
-  payloadLen = recvBuf[bufIndex++];
-  msgType = recvBuf[bufIndex++];
-  dataType = recvBuf[bufIndex++];
+  pControlBlock->payloadLen = recvBuf[bufIndex++];
+  msgType = pControlBlock->msgType = recvBuf[bufIndex++];
+  dataType = pControlBlock->dataType = recvBuf[bufIndex++];
+  // the data, for the callback to look at through ChillHub_GetPayload
+  pControlBlock->payload = ChillHubPayload_Make(&recvBuf[bufIndex], msgLen - 2, dataType);
   
-  if ((msgType == alarmNotifyMsgType) || (msgType == timeResponseMsgType)) {
-    // data is an array, don't care about data type or length
-    bufIndex+=2;
+  if (!messageFits(msgType, dataType, msgLen)) {
+    DebugUart_UartPutString("Message does not hold what its type carries.\r\n");
+    pControlBlock->stats.malformedMessages++;
+  }
+  else if (((msgType == alarmNotifyMsgType) || (msgType == timeResponseMsgType)) &&
+           !timeOfMessage(&pControlBlock->payload, (msgType == alarmNotifyMsgType) ? &alarmId : NULL, &time)) {
+    DebugUart_UartPutString("Time is not an array of U8.\r\n");
+    pControlBlock->stats.malformedMessages++;
+  }
+  else if ((msgType == alarmNotifyMsgType) || (msgType == timeResponseMsgType)) {
     if (msgType == alarmNotifyMsgType) {
       DebugUart_UartPutString("Got an alarm notification.\r\n");
-      callback = callbackLookup(recvBuf[bufIndex++], CHILLHUB_CB_TYPE_CRON);
+      callback = callbackLookup(pControlBlock, alarmId, CHILLHUB_CB_TYPE_CRON);
     }
     else {
       DebugUart_UartPutString("Received a time response.\r\n");
-      callback = callbackLookup(0, CHILLHUB_CB_TYPE_TIME);
+      callback = callbackLookup(pControlBlock, 0, CHILLHUB_CB_TYPE_TIME);
     }
 
     if (callback) {
-      unsigned char time[4];
-      for (uint8_t j = 0; j < 4; j++)
-      {
-        time[j] = recvBuf[bufIndex++];
-      }
+      // the 4 bytes of time where they are in the receive buffer
       DebugUart_UartPutString("Calling time response/alarm callback.\r\n");
-      ((chCbFcnTime)callback)(dataType, time); // <-- I don't think this works this way...
+      ((chCbFcnTime)callback)(dataType, (unsigned char *)time.pData);
 
       if (msgType == timeResponseMsgType) {
-        callbackRemove(0, CHILLHUB_CB_TYPE_TIME);
+        callbackRemove(pControlBlock, 0, CHILLHUB_CB_TYPE_TIME);
       }
     } else {
       DebugUart_UartPutString("No callback found.\r\n");
+      pControlBlock->stats.unhandledMessages++;
     }
   }
   else {
-    callback = callbackLookup(msgType, (msgType <= CHILLHUB_RESV_MSG_MAX)?CHILLHUB_CB_TYPE_FRIDGE:CHILLHUB_CB_TYPE_CLOUD);
+    callback = callbackLookup(pControlBlock, msgType, (msgType <= CHILLHUB_RESV_MSG_MAX)?CHILLHUB_CB_TYPE_FRIDGE:CHILLHUB_CB_TYPE_CLOUD);
 
     if (callback) {
       callback(dataType, &recvBuf[bufIndex]);
 
     } else {
       DebugUart_UartPutString("No callback for this message found.\r\n");
+      pControlBlock->stats.unhandledMessages++;
     }
   }
+
+  pControlBlock->bufIndex = bufIndex;
+  PROFILE_END(processPayloadProbe);
 }
 
-static void ReadFromSerialPort(void) {
-  if (Serial->available() > 0) {
+static void ReadFromSerialPort(T_ChillHubCB *pControlBlock) {
+  uint8_t c;
+
+  if (pControlBlock->pSerial->available() > 0) {
     // Get the payload length.  It is one less than the message length.
-    if (RingBuffer_IsFull(&packetBufCb) == RING_BUFFER_IS_FULL) {
+    if (RingBuffer_IsFull(&pControlBlock->packetBufCb) == RING_BUFFER_IS_FULL) {
       DebugUart_UartPutString("Ringbuffer was full, removing a byte.\r\n");
-      RingBuffer_Read(&packetBufCb); 
+      RingBuffer_Read(&pControlBlock->packetBufCb); 
+      pControlBlock->stats.overflowDrops++;
+    }
+    c = (uint8_t)pControlBlock->pSerial->read();
+    RingBuffer_Write(&pControlBlock->packetBufCb, c);
+    pControlBlock->stats.bytesRx++;
+    if (pControlBlock->traceHook != NULL) {
+      pControlBlock->traceHook(pControlBlock, CHILLHUB_TRACE_RX, &c, 1);
     }
-    RingBuffer_Write(&packetBufCb, Serial->read());
   }
 }
 
-static void CheckPacket(void) {
+static void CheckPacket(T_ChillHubCB *pControlBlock) {
+  unsigned char *recvBuf = pControlBlock->recvBuf;
   uint8_t i;
   uint16_t crc = crc_init();
-  uint16_t crcSent = (recvBuf[bufIndex-2]<<8) + recvBuf[bufIndex-1];
-  bufIndex -= 2;
+  uint16_t crcSent = (recvBuf[pControlBlock->bufIndex-2]<<8) + recvBuf[pControlBlock->bufIndex-1];
+  PROFILE_BEGIN(checkPacketProbe);
+  pControlBlock->bufIndex -= 2;
   
-  for(i=0; i<bufIndex; i++) {
+  for(i=0; i<pControlBlock->bufIndex; i++) {
     crc = crc_update(crc, &recvBuf[i], 1);
   }
   
@@ -535,8 +723,13 @@ static void CheckPacket(void) {
   
   if (crc == crcSent) {
     //DebugUart_UartPutString("Checksum checks!\r\n");
-    processChillhubMessagePayload();
+    pControlBlock->stats.framesRx++;
+    if (pControlBlock->frameHook != NULL) {
+      pControlBlock->frameHook(pControlBlock, &recvBuf[1], pControlBlock->bufIndex - 1);
+    }
+    processChillhubMessagePayload(pControlBlock);
   } else {
+    pControlBlock->stats.crcFailures++;
     DebugUart_UartPutString("Checksum FAILED!\r\n");
     DebugUart_UartPutString("Checksum received: ");
     printU16(crcSent);
@@ -544,46 +737,60 @@ static void CheckPacket(void) {
     printU16(crc);
     DebugUart_UartPutString("\r\n");
   }
+
+  PROFILE_END(checkPacketProbe);
 }
 
 // state handlers
-static uint8_t StateHandler_WaitingForStx(void) {
-  ReadFromSerialPort();
+static uint8_t StateHandler_WaitingForStx(T_ChillHubCB *pControlBlock) {
+  ReadFromSerialPort(pControlBlock);
   
   // process bytes in the buffer
-  while(RingBuffer_IsEmpty(&packetBufCb) == RING_BUFFER_NOT_EMPTY) {
-    if (RingBuffer_Read(&packetBufCb) == STX) {
+  while(RingBuffer_IsEmpty(&pControlBlock->packetBufCb) == RING_BUFFER_NOT_EMPTY) {
+    if (RingBuffer_Read(&pControlBlock->packetBufCb) == STX) {
       //DebugUart_UartPutString("Got STX.\r\n");
+      if (pControlBlock->skippedBeforeStx) {
+        pControlBlock->stats.resyncs++;
+        pControlBlock->skippedBeforeStx = FALSE;
+      }
       return State_WaitingForLength;
     }
+    pControlBlock->skippedBeforeStx = TRUE;
   }
   
   return State_WaitingForStx;
 }
 
-static uint8_t StateHandler_WaitingForLength(void) {
-  ReadFromSerialPort();
+static uint8_t StateHandler_WaitingForLength(T_ChillHubCB *pControlBlock) {
+  T_RingBufferCB *pPacketBufCb = &pControlBlock->packetBufCb;
+  ReadFromSerialPort(pControlBlock);
   
-  if (RingBuffer_IsEmpty(&packetBufCb) == RING_BUFFER_NOT_EMPTY) {
-    packetLen = RingBuffer_Peek(&packetBufCb, 0);
-    if (packetLen == ESC) {
-      if (RingBuffer_BytesUsed(&packetBufCb) > 1) {
-        RingBuffer_Read(&packetBufCb);
+  if (RingBuffer_IsEmpty(pPacketBufCb) == RING_BUFFER_NOT_EMPTY) {
+    pControlBlock->packetLen = RingBuffer_Peek(pPacketBufCb, 0);
+    if (pControlBlock->packetLen == ESC) {
+      if (RingBuffer_BytesUsed(pPacketBufCb) > 1) {
+        RingBuffer_Read(pPacketBufCb);
       } else {
         return State_WaitingForLength;
       }
     }
-    packetLen = RingBuffer_Read(&packetBufCb);
-    if (packetLen < sizeof(packetBuf)-2) {
-      bufIndex = 0;
-      payloadLen = 0;
-      msgType = 0;
-      dataType = 0;
-      packetIndex = 0;
+    pControlBlock->packetLen = RingBuffer_Read(pPacketBufCb);
+    if (pControlBlock->packetLen < 3) {
+      // not even the length, message type and data type
+      pControlBlock->stats.malformedMessages++;
+      return State_WaitingForStx;
+    }
+    else if (pControlBlock->packetLen < sizeof(pControlBlock->packetBuf)-2) {
+      pControlBlock->bufIndex = 0;
+      pControlBlock->payloadLen = 0;
+      pControlBlock->msgType = 0;
+      pControlBlock->dataType = 0;
+      pControlBlock->payload = ChillHubPayload_Make(NULL, 0, noDataType);
       //DebugUart_UartPutString("Got length!\r\n");
       return State_WaitingForPacket;
     } else {
       //DebugUart_UartPutString("Length is too long, aborting.\r\n");
+      pControlBlock->stats.oversizeFrames++;
       return State_WaitingForStx;
     }
   }
@@ -591,27 +798,28 @@ static uint8_t StateHandler_WaitingForLength(void) {
   return State_WaitingForLength;
 }
   
-static uint8_t StateHandler_WaitingForPacket(void) {
-  uint8_t bytesUsed;
+static uint8_t StateHandler_WaitingForPacket(T_ChillHubCB *pControlBlock) {
+  T_RingBufferCB *pPacketBufCb = &pControlBlock->packetBufCb;
   uint8_t b;
-  ReadFromSerialPort();
+  ReadFromSerialPort(pControlBlock);
   
-  bytesUsed = RingBuffer_BytesUsed(&packetBufCb);
-  while (bytesUsed > packetIndex) {
-    if (RingBuffer_Peek(&packetBufCb, packetIndex) == ESC) {
-      if ((bytesUsed - packetIndex) > 1) {
-        packetIndex++;
+  // The bytes are taken out of the buffer as they are decoded, so a packet
+  // that is longer than the buffer once escaped still gets through.
+  while (RingBuffer_IsEmpty(pPacketBufCb) == RING_BUFFER_NOT_EMPTY) {
+    if (RingBuffer_Peek(pPacketBufCb, 0) == ESC) {
+      if (RingBuffer_BytesUsed(pPacketBufCb) > 1) {
+        RingBuffer_Read(pPacketBufCb);
       } else {
         return State_WaitingForPacket;
       }
     }
-    b = RingBuffer_Peek(&packetBufCb, packetIndex++);
-    recvBuf[bufIndex++] =  b;
+    b = RingBuffer_Read(pPacketBufCb);
+    pControlBlock->recvBuf[pControlBlock->bufIndex++] =  b;
     //DebugUart_UartPutString("Got a byte: ");
     //printU8(b);
     //DebugUart_UartPutString("\r\n");
-    if (bufIndex >= packetLen + 2) {
-      CheckPacket();
+    if (pControlBlock->bufIndex >= pControlBlock->packetLen + 2) {
+      CheckPacket(pControlBlock);
       return State_WaitingForStx;
     }
   }
@@ -619,7 +827,7 @@ static uint8_t StateHandler_WaitingForPacket(void) {
   return State_WaitingForPacket;
 }
 
-typedef uint8_t (*StateHandler_fp)(void);
+typedef uint8_t (*StateHandler_fp)(T_ChillHubCB *pControlBlock);
 // Array of state handlers
 static const StateHandler_fp StateHandlers[] = {
   StateHandler_WaitingForStx,
@@ -628,24 +836,163 @@ static const StateHandler_fp StateHandlers[] = {
   NULL
 };
 
-static uint8_t currentState = State_WaitingForStx;
+void ChillHub_Loop(T_ChillHubCB *pControlBlock) {
+  uint8_t previousState = pControlBlock->currentState;
 
-static void loop(void) {
-  if (currentState < State_Invalid) {
-    if(StateHandlers[currentState] != NULL) {
-      currentState = StateHandlers[currentState]();
+  if (pControlBlock->currentState < State_Invalid) {
+    if(StateHandlers[pControlBlock->currentState] != NULL) {
+      pControlBlock->currentState = StateHandlers[pControlBlock->currentState](pControlBlock);
     } 
   }
+
+  // A handler that stays in its state has consumed everything it could, so
+  // nothing more happens until another byte arrives.
+  pControlBlock->loopIsIdle = (pControlBlock->currentState == previousState) && (pControlBlock->pSerial->available() == 0);
+}
+
+uint8_t ChillHub_IsIdle(const T_ChillHubCB *pControlBlock) {
+  return pControlBlock->loopIsIdle;
 }
 
-static void storeCallbackEntry(unsigned char sym, unsigned char typ, chillhubCallbackFunction fcn) {
-  uint8_t index = getIndexOfCallback(sym, typ);
+const T_ChillHubStats* ChillHub_GetStats(const T_ChillHubCB *pControlBlock) {
+  return &pControlBlock->stats;
+}
+
+void ChillHub_CountUsbReset(T_ChillHubCB *pControlBlock) {
+  pControlBlock->stats.usbResets++;
+}
+
+void ChillHub_SendStats(T_ChillHubCB *pControlBlock, unsigned char msgType) {
+  uint8_t buf[8 + (CHILLHUB_STATS_COUNT * 4)];
+  const uint32_t *pCounter = (const uint32_t *)&pControlBlock->stats;
+  uint8_t index = 0;
+  uint8_t i;
+
+  buf[index++] = 0; // length, filled in below
+  buf[index++] = msgType;
+  buf[index++] = arrayDataType;
+  buf[index++] = CHILLHUB_STATS_COUNT; // number of elements
+  buf[index++] = unsigned32DataType; // data type of elements
+  for (i = 0; i < CHILLHUB_STATS_COUNT; i++) {
+    buf[index++] = (pCounter[i] >> 24) & 0xff;
+    buf[index++] = (pCounter[i] >> 16) & 0xff;
+    buf[index++] = (pCounter[i] >> 8) & 0xff;
+    buf[index++] = pCounter[i] & 0xff;
+  }
+  buf[0] = index - 1;
+
+  sendPacket(pControlBlock, buf, index);
+}
+
+const T_ChillHubPayload* ChillHub_GetPayload(const T_ChillHubCB *pControlBlock) {
+  return &pControlBlock->payload;
+}
+
+void ChillHub_SetFrameHook(T_ChillHubCB *pControlBlock, chillhubFrameHook hook, void *pUserData) {
+  pControlBlock->frameHook = hook;
+  pControlBlock->pUserData = pUserData;
+}
+
+void ChillHub_SetTraceHook(T_ChillHubCB *pControlBlock, chillhubTraceHook hook) {
+  pControlBlock->traceHook = hook;
+}
+
+/*
+ * The singleton, one thin wrapper per entry of chInterface
+ */
+
+static void setup(const char* name, const char *UUID, const T_Serial* serial) {
+  ChillHub_Setup(&hub, name, UUID, serial);
+}
+
+static void subscribe(unsigned char type, chillhubCallbackFunction cb) {
+  ChillHub_Subscribe(&hub, type, cb);
+}
+
+static void unsubscribe(unsigned char type) {
+  ChillHub_Unsubscribe(&hub, type);
+}
+
+static void setAlarm(unsigned char ID, char* cronString, unsigned char strLength, chillhubCallbackFunction cb) {
+  ChillHub_SetAlarm(&hub, ID, cronString, strLength, cb);
+}
+
+static void unsetAlarm(unsigned char ID) {
+  ChillHub_UnsetAlarm(&hub, ID);
+}
+
+static void getTime(chillhubCallbackFunction cb) {
+  ChillHub_GetTime(&hub, cb);
+}
+
+static void addCloudListener(unsigned char msgType, chillhubCallbackFunction cb) {
+  ChillHub_AddCloudListener(&hub, msgType, cb);
+}
+
+static void createCloudResourceU16(const char *name, uint8_t resID, uint8_t canUpdate, uint16_t initVal) {
+  ChillHub_CreateCloudResourceU16(&hub, name, resID, canUpdate, initVal);
+}
+
+static void updateCloudResourceU16(uint8_t resID, uint16_t val) {
+  ChillHub_UpdateCloudResourceU16(&hub, resID, val);
+}
+
+#define SINGLETON_SENDER(name, dataType, parameterType) \
+  static void send##name##Msg(unsigned char msgType, parameterType payload) { \
+    ChillHub_Send##name##Msg(&hub, msgType, payload); \
+  }
+CHILLHUB_SCALAR_SENDERS(SINGLETON_SENDER)
+#undef SINGLETON_SENDER
+
+static void sendU8ArrayMsg(unsigned char msgType, const uint8_t *pData, uint8_t count) {
+  ChillHub_SendU8ArrayMsg(&hub, msgType, pData, count);
+}
+
+static void sendU16ArrayMsg(unsigned char msgType, const uint16_t *pData, uint8_t count) {
+  ChillHub_SendU16ArrayMsg(&hub, msgType, pData, count);
+}
+
+static const T_ChillHubPayload* getPayload(void) {
+  return ChillHub_GetPayload(&hub);
+}
+
+static void loop(void) {
+  ChillHub_Loop(&hub);
+}
+
+static uint8_t isIdle(void) {
+  return ChillHub_IsIdle(&hub);
+}
+
+static const T_ChillHubStats* getStats(void) {
+  return ChillHub_GetStats(&hub);
+}
+
+static void countUsbReset(void) {
+  ChillHub_CountUsbReset(&hub);
+}
+
+static void sendStats(unsigned char msgType) {
+  ChillHub_SendStats(&hub, msgType);
+}
+
+static void setTraceHook(chillhubTraceHook hook) {
+  ChillHub_SetTraceHook(&hub, hook);
+}
+
+/*
+ * Callback table
+ */
+
+static void storeCallbackEntry(T_ChillHubCB *pControlBlock, unsigned char sym, unsigned char typ, chillhubCallbackFunction fcn) {
+  chCbTableType *callbackTable = pControlBlock->callbackTable;
+  uint8_t index = getIndexOfCallback(pControlBlock, sym, typ);
   
   // Does this exist already?
   if (index == NO_CALLBACK) {
     // not found, store 
     DebugUart_UartPutString("Storing a new callback entry.\r\n");
-    index = getUnusedIndexFromCallbackTable();
+    index = getUnusedIndexFromCallbackTable(pControlBlock);
   } else {
     DebugUart_UartPutString("Revising an existing callback entry.\r\n");
   }
@@ -658,25 +1005,27 @@ static void storeCallbackEntry(unsigned char sym, unsigned char typ, chillhubCal
     DebugUart_UartPutString("Callback added.\r\n");      
   } else {
     DebugUart_UartPutString("No room left in callback table.\r\n");
+    pControlBlock->stats.callbackTableMisses++;
   }
 } 
 
-static chillhubCallbackFunction callbackLookup(unsigned char sym, unsigned char typ) {
+static chillhubCallbackFunction callbackLookup(T_ChillHubCB *pControlBlock, unsigned char sym, unsigned char typ) {
   uint8_t index;
   
-  index = getIndexOfCallback(sym, typ);
+  index = getIndexOfCallback(pControlBlock, sym, typ);
   if (index != NO_CALLBACK) {
-    return callbackTable[index].callback;
+    return pControlBlock->callbackTable[index].callback;
   } else {
     return NULL;
   }
 }
 
-static uint8_t getIndexOfCallback(unsigned char sym, unsigned char typ) {
+static uint8_t getIndexOfCallback(T_ChillHubCB *pControlBlock, unsigned char sym, unsigned char typ) {
+  const chCbTableType *callbackTable = pControlBlock->callbackTable;
   uint8_t index = NO_CALLBACK;
   uint8_t i;
   
-  for(i=0; i<MAX_CALLBACKS; i++) {
+  for(i=0; i<CHILLHUB_MAX_CALLBACKS; i++) {
     if (callbackTable[i].inUse == TRUE) {
       if ((callbackTable[i].type == typ) && (callbackTable[i].symbol == sym)) {
         index = i;
@@ -688,12 +1037,12 @@ static uint8_t getIndexOfCallback(unsigned char sym, unsigned char typ) {
   return index;
 }
 
-static uint8_t getUnusedIndexFromCallbackTable(void) {
+static uint8_t getUnusedIndexFromCallbackTable(T_ChillHubCB *pControlBlock) {
   uint8_t index = NO_CALLBACK;
   uint8_t i;
   
-  for(i=0; i<MAX_CALLBACKS; i++) {
-    if (callbackTable[i].inUse == FALSE) {
+  for(i=0; i<CHILLHUB_MAX_CALLBACKS; i++) {
+    if (pControlBlock->callbackTable[i].inUse == FALSE) {
       index = i;
       break;
     }
@@ -702,11 +1051,11 @@ static uint8_t getUnusedIndexFromCallbackTable(void) {
   return index;
 }
 
-static void callbackRemove(unsigned char sym, unsigned char typ) {
-  uint8_t index = getIndexOfCallback(sym, typ);
+static void callbackRemove(T_ChillHubCB *pControlBlock, unsigned char sym, unsigned char typ) {
+  uint8_t index = getIndexOfCallback(pControlBlock, sym, typ);
   
   if (index != NO_CALLBACK) {
-    callbackTable[index].inUse = FALSE;
+    pControlBlock->callbackTable[index].inUse = FALSE;
   }
 }
 
@@ -721,36 +1070,55 @@ static uint8_t isControlChar(uint8_t c) {
   }
 }
 
-static void outputChar(uint8_t c) {
-  uint8_t buf[2];
-  uint8_t index=0;
+// Writes c to pOut, escaped if need be, and returns the bytes written
+static uint8_t putEscaped(uint8_t *pOut, uint8_t c) {
+  uint8_t index = 0;
 
   if (isControlChar(c)) {
-    buf[index++] = ESC;
+    pOut[index++] = ESC;
+  }
+  pOut[index++] = c;
+  return index;
+}
+
+static void writeSerial(T_ChillHubCB *pControlBlock, const uint8_t *pBuf, uint8_t len) {
+  pControlBlock->pSerial->write(pBuf, len);
+  if (pControlBlock->traceHook != NULL) {
+    pControlBlock->traceHook(pControlBlock, CHILLHUB_TRACE_TX, pBuf, len);
   }
-  buf[index++] = c;
+}
+
+static void outputChar(T_ChillHubCB *pControlBlock, uint8_t c) {
+  uint8_t buf[2];
+  uint8_t index = putEscaped(buf, c);
   
-  Serial->write(buf, index);
+  writeSerial(pControlBlock, buf, index);
+  pControlBlock->stats.bytesTx += index;
 }
      
-static void sendPacket(uint8_t *pBuf, uint8_t len){
+static void sendPacket(T_ChillHubCB *pControlBlock, uint8_t *pBuf, uint8_t len){
   uint16_t crc = crc_init();
   uint8_t buf[1];
   uint8_t i;
+  PROFILE_BEGIN(sendPacketProbe);
   
   // send STX
   buf[0] = STX;
-  Serial->write(buf, 1);
+  writeSerial(pControlBlock, buf, 1);
+  pControlBlock->stats.bytesTx++;
+  pControlBlock->stats.framesTx++;
   // send packet length
-  outputChar(len);
+  outputChar(pControlBlock, len);
   
   // send packet
   for(i=0; i<len; i++) {
     crc = crc_update(crc, &pBuf[i], 1);
-    outputChar(pBuf[i]);
+    outputChar(pControlBlock, pBuf[i]);
   }
   
   // send CS
-  outputChar(MSB_OF_U16(crc));
-  outputChar(LSB_OF_U16(crc));
+  outputChar(pControlBlock, MSB_OF_U16(crc));
+  outputChar(pControlBlock, LSB_OF_U16(crc));
+
+  PROFILE_END(sendPacketProbe);
 }
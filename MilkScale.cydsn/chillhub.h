@@ -1,5 +1,8 @@
 #include <cytypes.h>
 #include <stdint.h>
+#include "ringbuf.h"
+#include "chillhubSchema.h"
+#include "chillhubPayload.h"
 
 #ifndef CHILLHUB_H
 #define CHILLHUB_H
@@ -39,6 +42,92 @@ typedef struct T_Serial {
 } T_Serial;
 
 typedef void (*chCbFcnTime)(uint8_t dataType, unsigned char[4]);
+
+// Link statistics.  The counters only ever count up and wrap; the hub polls
+// them with sendStats and works with differences.  sendStats sends them as
+// an array of U32 in this order.
+typedef struct T_ChillHubStats {
+  uint32_t framesRx;            // frames that passed the CRC check
+  uint32_t framesTx;
+  uint32_t bytesRx;
+  uint32_t bytesTx;             // including STX and escapes
+  uint32_t crcFailures;
+  uint32_t overflowDrops;       // bytes dropped because the packet buffer was full
+  uint32_t resyncs;             // searches for STX that had to skip bytes
+  uint32_t oversizeFrames;      // lengths too long for the receive buffer
+  uint32_t unhandledMessages;   // messages without a registered callback
+  uint32_t callbackTableMisses; // callbacks not stored, table full
+  uint32_t usbResets;
+  uint32_t malformedMessages;   // data of the wrong type or shorter than it needs,
+                                // and frames too short to hold a message
+} T_ChillHubStats;
+
+#define CHILLHUB_STATS_COUNT (sizeof(T_ChillHubStats) / sizeof(uint32_t))
+
+// The subscriptions and cloud listeners of main.c, the listeners of the
+// debug builds and the pending getTime.
+#define CHILLHUB_MAX_CALLBACKS 14
+#define CHILLHUB_BUFFER_SIZE 64
+#define CHILLHUB_MAX_RESOURCES 2
+#define CHILLHUB_TEMPLATE_SIZE 40
+
+// A frame that ends in a U16 and is the same every time up to it, kept as
+// it goes on the wire as far as the value: STX, length and the bytes before
+// the value, escaped, with the CRC over them.  Sending one escapes the value
+// and carries the CRC over its two bytes instead of building the frame.
+typedef struct T_ChillHubTemplate {
+  uint8_t prefix[CHILLHUB_TEMPLATE_SIZE];
+  uint8_t prefixLen;            // 0 while unused
+  uint16_t crc;
+} T_ChillHubTemplate;
+
+struct T_ChillHubCB;
+
+// Sees every frame that passes the CRC check, before the callbacks do.  pMsg
+// starts at the message type; length counts it and everything after it.
+typedef void (*chillhubFrameHook)(struct T_ChillHubCB *pControlBlock, const uint8_t *pMsg, uint8_t length);
+
+// Sees every byte on the wire: each byte read from the serial port as it is
+// read, and every write to it, escaping and framing included.
+#define CHILLHUB_TRACE_RX 0
+#define CHILLHUB_TRACE_TX 1
+typedef void (*chillhubTraceHook)(struct T_ChillHubCB *pControlBlock, uint8_t direction, const uint8_t *pData, uint8_t length);
+
+// Everything one link needs.  The firmware has a single one behind ChillHub;
+// host tools keep one per link and call the ChillHub_ functions directly.
+// Apart from the debug prints and the profiling probes nothing is shared, so
+// different links can be run from different threads.
+typedef struct T_ChillHubCB {
+  const T_Serial *pSerial;
+
+  // message handling
+  unsigned char recvBuf[CHILLHUB_BUFFER_SIZE];
+  uint8_t bufIndex;
+  uint8_t payloadLen;
+  uint8_t msgType;
+  uint8_t dataType;
+  T_ChillHubPayload payload;
+
+  // packet handling
+  unsigned char packetBuf[CHILLHUB_BUFFER_SIZE];
+  T_RingBufferCB packetBufCb;
+  uint8_t packetLen;
+  uint8_t currentState;
+  uint8_t loopIsIdle;
+  uint8_t skippedBeforeStx;
+
+  chCbTableType callbackTable[CHILLHUB_MAX_CALLBACKS];
+
+  // updateCloudResourceU16 frames, built by createCloudResourceU16
+  uint8_t resourceIds[CHILLHUB_MAX_RESOURCES];
+  T_ChillHubTemplate resourceTemplates[CHILLHUB_MAX_RESOURCES];
+
+  // kept across re-registration
+  T_ChillHubStats stats;
+  chillhubFrameHook frameHook;
+  void *pUserData;
+  chillhubTraceHook traceHook;
+} T_ChillHubCB;
   
 /*
  * Function prototypes
@@ -59,75 +148,56 @@ typedef struct chInterface {
   void (*sendI16Msg)(unsigned char msgType, signed int payload);
   void (*sendBooleanMsg)(unsigned char msgType, unsigned char payload);
   void (*loop)(void);
+  uint8_t (*isIdle)(void);
+  const T_ChillHubStats* (*getStats)(void);
+  void (*countUsbReset)(void);
+  void (*sendStats)(unsigned char msgType);
+  void (*sendU8ArrayMsg)(unsigned char msgType, const uint8_t *pData, uint8_t count);
+  void (*sendU16ArrayMsg)(unsigned char msgType, const uint16_t *pData, uint8_t count);
+  const T_ChillHubPayload* (*getPayload)(void);
+  void (*setTraceHook)(chillhubTraceHook hook);
 } chInterface;
 
-// Chill Hub data types
-enum ChillHubDataTypes {
-  arrayDataType = 0x01,
-  stringDataType = 0x02,
-  unsigned8DataType = 0x03,
-  signed8DataType = 0x04,
-  unsigned16DataType = 0x05,
-  signed16DataType = 0x06,
-  unsigned32DataType = 0x07,
-  signed32DataType = 0x08,
-  jsonDataType = 0x09,
-  booleanDataType = 0x10
-};
-
-// Chill Hub message types
-enum ChillHubMsgTypes {
-  deviceIdMsgType = 0x00,
-  subscribeMsgType = 0x01,
-  unsubscribeMsgType = 0x02,
-  setAlarmMsgType = 0x03,
-  unsetAlarmMsgType = 0x04,
-  alarmNotifyMsgType = 0x05,
-  getTimeMsgType = 0x06,
-  timeResponseMsgType = 0x07,
-  deviceIdRequestType = 0x08,
-  registerResourceType = 0x09,
-  updateResourceType = 0x0a,
-  resourceUpdatedType = 0x0b,
-  setDeviceUUIDType = 0x0c,
-  keepAliveType = 0x0d,
-  // 0x0e-0x0F Reserved for Future Use
-  filterAlertMsgType = 0x10,
-  waterFilterCalendarTimerMsgType = 0x11,
-  waterFilterCalendarPercentUsedMsgType = 0x12,
-  waterFilterHoursRemainingMsgType = 0x13,
-  waterUsageTimerMsgType = 0x14,
-  waterFilterUsageTimePercentUsedMsgType = 0x15,
-  waterFilterOuncesRemainingMsgType = 0x16,
-  commandFeaturesMsgType = 0x17,
-  temperatureAlertMsgType = 0x18,
-  freshFoodDisplayTemperatureMsgType = 0x19,
-  freezerDisplayTemperatureMsgType = 0x1A,
-  freshFoodSetpointTemperatureMsgType = 0x1B,
-  freezerSetpointTemperatureMsgType = 0x1C,
-  doorAlarmAlertMsgType = 0x1D,
-  iceMakerBucketStatusMsgType = 0x1E,
-  odorFilterCalendarTimerMsgType = 0x1F,
-  odorFilterPercentUsedMsgType = 0x20,
-  odorFilterHoursRemainingMsgType = 0x21,
-  doorStatusMsgType = 0x22,
-  dcSwitchStateMsgType = 0x23,
-  acInputStateMsgType = 0x24,
-  iceMakerMoldThermistorTemperatureMsgType = 0x25,
-  iceCabinetThermistorTemperatureMsgType = 0x26,
-  hotWaterThermistor1TemperatureMsgType = 0x27,
-  hotWaterThermistor2TemperatureMsgType = 0x28,
-  dctSwitchStateMsgType = 0x29,
-  relayStatusMsgType = 0x2A,
-  ductDoorStatusMsgType = 0x2B,
-  iceMakerStateSelectionMsgType = 0x2C,
-  iceMakerOperationalStateMsgType = 0x2D
-  // 0x2E-0x4F Reserved for Future Use
-  // 0x50-0xFF User Defined Messages
-};
-
 #define CHILLHUB_RESV_MSG_MAX 0x4F
 
 extern const chInterface ChillHub;
 
+/*
+ * The same functions for an explicit link.  ChillHub_Init clears a control
+ * block, statistics included; ChillHub_Setup then works as ChillHub.setup.
+ */
+void ChillHub_Init(T_ChillHubCB *pControlBlock);
+void ChillHub_Setup(T_ChillHubCB *pControlBlock, const char* name, const char *UUID, const T_Serial* serial);
+void ChillHub_Subscribe(T_ChillHubCB *pControlBlock, unsigned char type, chillhubCallbackFunction cb);
+void ChillHub_Unsubscribe(T_ChillHubCB *pControlBlock, unsigned char type);
+void ChillHub_SetAlarm(T_ChillHubCB *pControlBlock, unsigned char ID, char* cronString, unsigned char strLength, chillhubCallbackFunction cb);
+void ChillHub_UnsetAlarm(T_ChillHubCB *pControlBlock, unsigned char ID);
+void ChillHub_GetTime(T_ChillHubCB *pControlBlock, chillhubCallbackFunction cb);
+void ChillHub_AddCloudListener(T_ChillHubCB *pControlBlock, unsigned char msgType, chillhubCallbackFunction cb);
+void ChillHub_CreateCloudResourceU16(T_ChillHubCB *pControlBlock, const char *name, uint8_t resID, uint8_t canUpdate, uint16_t initVal);
+void ChillHub_UpdateCloudResourceU16(T_ChillHubCB *pControlBlock, uint8_t resID, uint16_t val);
+// ChillHub_SendU8Msg, ChillHub_SendU16Msg, ChillHub_SendI8Msg,
+// ChillHub_SendI16Msg and ChillHub_SendBooleanMsg
+#define CHILLHUB_SENDER_PROTOTYPE(name, dataType, parameterType) \
+  void ChillHub_Send##name##Msg(T_ChillHubCB *pControlBlock, unsigned char msgType, parameterType payload);
+CHILLHUB_SCALAR_SENDERS(CHILLHUB_SENDER_PROTOTYPE)
+#undef CHILLHUB_SENDER_PROTOTYPE
+void ChillHub_SendU8ArrayMsg(T_ChillHubCB *pControlBlock, unsigned char msgType, const uint8_t *pData, uint8_t count);
+void ChillHub_SendU16ArrayMsg(T_ChillHubCB *pControlBlock, unsigned char msgType, const uint16_t *pData, uint8_t count);
+void ChillHub_Loop(T_ChillHubCB *pControlBlock);
+uint8_t ChillHub_IsIdle(const T_ChillHubCB *pControlBlock);
+const T_ChillHubStats* ChillHub_GetStats(const T_ChillHubCB *pControlBlock);
+void ChillHub_CountUsbReset(T_ChillHubCB *pControlBlock);
+void ChillHub_SendStats(T_ChillHubCB *pControlBlock, unsigned char msgType);
+// The data of the message being dispatched, for callbacks that want it
+// bounds checked.  Good until the callback returns.
+const T_ChillHubPayload* ChillHub_GetPayload(const T_ChillHubCB *pControlBlock);
+void ChillHub_SetFrameHook(T_ChillHubCB *pControlBlock, chillhubFrameHook hook, void *pUserData);
+void ChillHub_SetTraceHook(T_ChillHubCB *pControlBlock, chillhubTraceHook hook);
+
+// pBuf and len are what sendPacket would get, less the two bytes of the
+// value at the end.  Returns FALSE if the frame is too long for a template.
+uint8_t ChillHub_InitTemplate(T_ChillHubTemplate *pTemplate, const uint8_t *pBuf, uint8_t len);
+void ChillHub_SendTemplate(T_ChillHubCB *pControlBlock, const T_ChillHubTemplate *pTemplate, uint16_t value);
+
 #endif
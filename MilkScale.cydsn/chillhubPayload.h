@@ -0,0 +1,301 @@
+/*
+ * Bounds checked views of the data in a chillhub message.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * A view is the data of a received message where it lies in the receive
+ * buffer: a pointer, the number of bytes there are and the data type the
+ * message declared.  The accessors decode in place and return FALSE, leaving
+ * the result alone, when the type is not the one asked for or the bytes run
+ * out, so a callback never reads past the message.
+ *
+ * Arrays and JSON objects are walked with an iterator.  Each element or
+ * field value is a view of its own, so nested arrays and strings work the
+ * same way.  Views point into the receive buffer and are only good until the
+ * callback returns.
+ */
+
+#ifndef CHILLHUBPAYLOAD_H
+#define CHILLHUBPAYLOAD_H
+
+#include <stdint.h>
+#include "chillhubSchema.h"
+
+#ifndef FALSE
+  #define FALSE 0
+#endif
+#ifndef TRUE
+  #define TRUE !FALSE
+#endif
+
+typedef struct T_ChillHubPayload {
+  const uint8_t *pData;
+  uint8_t length;
+  uint8_t dataType;
+} T_ChillHubPayload;
+
+// The elements of an array or the fields of a JSON object still to come
+typedef struct T_ChillHubIter {
+  const uint8_t *pData;
+  uint8_t length;
+  uint8_t remaining;
+  uint8_t elementType;  // arrays only
+} T_ChillHubIter;
+
+// Data bytes a value of the data type takes, 0 if the data says how long it is
+static inline uint8_t ChillHub_SizeOfDataType(uint8_t dataType) {
+  switch (dataType) {
+#define CHILLHUB_SIZE_CASE(name, value, size) case value: return size;
+    CHILLHUB_DATA_TYPES(CHILLHUB_SIZE_CASE)
+#undef CHILLHUB_SIZE_CASE
+    default: return 0;
+  }
+}
+
+// The data type CHILLHUB_MSG_TYPES gives the message type.  FALSE for the
+// reserved and user defined types, which carry whatever their sender chose.
+static inline uint8_t ChillHub_DataTypeOfMsg(uint8_t msgType, uint8_t *pDataType) {
+  switch (msgType) {
+#define CHILLHUB_MSG_DATA_TYPE_CASE(name, value, dataType) case value: *pDataType = dataType; return TRUE;
+    CHILLHUB_MSG_TYPES(CHILLHUB_MSG_DATA_TYPE_CASE)
+#undef CHILLHUB_MSG_DATA_TYPE_CASE
+    default: return FALSE;
+  }
+}
+
+static inline T_ChillHubPayload ChillHubPayload_Make(const uint8_t *pData, uint8_t length, uint8_t dataType) {
+  T_ChillHubPayload payload;
+
+  payload.pData = pData;
+  payload.length = length;
+  payload.dataType = dataType;
+  return payload;
+}
+
+static inline uint8_t ChillHubPayload_Fits(const T_ChillHubPayload *pPayload, uint8_t dataType, uint8_t size) {
+  return (pPayload->dataType == dataType) && (pPayload->length >= size);
+}
+
+static inline uint8_t ChillHubPayload_AsU8(const T_ChillHubPayload *pPayload, uint8_t *pValue) {
+  if (!ChillHubPayload_Fits(pPayload, unsigned8DataType, 1)) {
+    return FALSE;
+  }
+  *pValue = pPayload->pData[0];
+  return TRUE;
+}
+
+static inline uint8_t ChillHubPayload_AsBoolean(const T_ChillHubPayload *pPayload, uint8_t *pValue) {
+  if (!ChillHubPayload_Fits(pPayload, booleanDataType, 1)) {
+    return FALSE;
+  }
+  *pValue = (pPayload->pData[0] != 0);
+  return TRUE;
+}
+
+static inline uint8_t ChillHubPayload_AsI8(const T_ChillHubPayload *pPayload, int8_t *pValue) {
+  if (!ChillHubPayload_Fits(pPayload, signed8DataType, 1)) {
+    return FALSE;
+  }
+  *pValue = (int8_t)pPayload->pData[0];
+  return TRUE;
+}
+
+static inline uint8_t ChillHubPayload_AsU16(const T_ChillHubPayload *pPayload, uint16_t *pValue) {
+  if (!ChillHubPayload_Fits(pPayload, unsigned16DataType, 2)) {
+    return FALSE;
+  }
+  *pValue = (uint16_t)((pPayload->pData[0] << 8) | pPayload->pData[1]);
+  return TRUE;
+}
+
+static inline uint8_t ChillHubPayload_AsI16(const T_ChillHubPayload *pPayload, int16_t *pValue) {
+  if (!ChillHubPayload_Fits(pPayload, signed16DataType, 2)) {
+    return FALSE;
+  }
+  *pValue = (int16_t)((pPayload->pData[0] << 8) | pPayload->pData[1]);
+  return TRUE;
+}
+
+static inline uint32_t ChillHubPayload_BigEndian32(const uint8_t *pData) {
+  return ((uint32_t)pData[0] << 24) | ((uint32_t)pData[1] << 16) | ((uint32_t)pData[2] << 8) | pData[3];
+}
+
+static inline uint8_t ChillHubPayload_AsU32(const T_ChillHubPayload *pPayload, uint32_t *pValue) {
+  if (!ChillHubPayload_Fits(pPayload, unsigned32DataType, 4)) {
+    return FALSE;
+  }
+  *pValue = ChillHubPayload_BigEndian32(pPayload->pData);
+  return TRUE;
+}
+
+static inline uint8_t ChillHubPayload_AsI32(const T_ChillHubPayload *pPayload, int32_t *pValue) {
+  if (!ChillHubPayload_Fits(pPayload, signed32DataType, 4)) {
+    return FALSE;
+  }
+  *pValue = (int32_t)ChillHubPayload_BigEndian32(pPayload->pData);
+  return TRUE;
+}
+
+// Any of U8, U16 and U32, for values the hub may send in more than one width
+static inline uint8_t ChillHubPayload_AsUnsigned(const T_ChillHubPayload *pPayload, uint32_t *pValue) {
+  uint8_t u8;
+  uint16_t u16;
+
+  if (ChillHubPayload_AsU8(pPayload, &u8)) {
+    *pValue = u8;
+    return TRUE;
+  }
+  if (ChillHubPayload_AsU16(pPayload, &u16)) {
+    *pValue = u16;
+    return TRUE;
+  }
+  return ChillHubPayload_AsU32(pPayload, pValue);
+}
+
+// A string is its length and its characters, without a terminating NUL.
+static inline uint8_t ChillHubPayload_AsString(const T_ChillHubPayload *pPayload, const char **ppChars, uint8_t *pLength) {
+  if (!ChillHubPayload_Fits(pPayload, stringDataType, 1) || (pPayload->pData[0] >= pPayload->length)) {
+    return FALSE;
+  }
+  *ppChars = (const char *)&pPayload->pData[1];
+  *pLength = pPayload->pData[0];
+  return TRUE;
+}
+
+// An array is its element count and element type, then the elements.
+static inline uint8_t ChillHubPayload_AsArray(const T_ChillHubPayload *pPayload, T_ChillHubIter *pIter) {
+  if (!ChillHubPayload_Fits(pPayload, arrayDataType, 2)) {
+    return FALSE;
+  }
+  pIter->remaining = pPayload->pData[0];
+  pIter->elementType = pPayload->pData[1];
+  pIter->pData = &pPayload->pData[2];
+  pIter->length = pPayload->length - 2;
+  return TRUE;
+}
+
+// A JSON object is its field count, then for every field the key as a
+// string, the data type and the value.
+static inline uint8_t ChillHubPayload_AsJson(const T_ChillHubPayload *pPayload, T_ChillHubIter *pIter) {
+  if (!ChillHubPayload_Fits(pPayload, jsonDataType, 1)) {
+    return FALSE;
+  }
+  pIter->remaining = pPayload->pData[0];
+  pIter->elementType = noDataType;
+  pIter->pData = &pPayload->pData[1];
+  pIter->length = pPayload->length - 1;
+  return TRUE;
+}
+
+// Bytes the value at pData takes, nested arrays and objects included, or a
+// number larger than length if it does not fit in length bytes.
+static inline uint16_t ChillHubPayload_ValueLength(uint8_t dataType, const uint8_t *pData, uint8_t length) {
+  T_ChillHubIter iter;
+  uint16_t used;
+  uint8_t i;
+
+  switch (dataType) {
+    case stringDataType:
+      return (length < 1) ? 0x100 : (uint16_t)(1 + pData[0]);
+
+    case arrayDataType:
+    case jsonDataType:
+      used = (dataType == arrayDataType) ? 2 : 1;
+      if (length < used) {
+        return 0x100;
+      }
+      iter.remaining = pData[0];
+      iter.elementType = (dataType == arrayDataType) ? pData[1] : (uint8_t)noDataType;
+      for (i = 0; i < iter.remaining; i++) {
+        uint8_t elementType = iter.elementType;
+        uint16_t elementLength;
+
+        if (dataType == jsonDataType) {
+          // key and data type
+          if ((length - used < 1) || (length - used < 2 + pData[used])) {
+            return 0x100;
+          }
+          used += 1 + pData[used];
+          elementType = pData[used++];
+        }
+        elementLength = ChillHubPayload_ValueLength(elementType, &pData[used], (uint8_t)(length - used));
+        if (elementLength > (uint16_t)(length - used)) {
+          return 0x100;
+        }
+        used += elementLength;
+      }
+      return used;
+
+    default:
+      return ChillHub_SizeOfDataType(dataType);
+  }
+}
+
+static inline uint8_t ChillHubIter_Take(T_ChillHubIter *pIter, uint8_t dataType, T_ChillHubPayload *pValue) {
+  uint16_t valueLength = ChillHubPayload_ValueLength(dataType, pIter->pData, pIter->length);
+
+  if (valueLength > pIter->length) {
+    pIter->remaining = 0;
+    return FALSE;
+  }
+  *pValue = ChillHubPayload_Make(pIter->pData, (uint8_t)valueLength, dataType);
+  pIter->pData += valueLength;
+  pIter->length -= (uint8_t)valueLength;
+  pIter->remaining--;
+  return TRUE;
+}
+
+// The next array element.  FALSE at the end or if the element is cut short;
+// the iterator is then at its end.
+static inline uint8_t ChillHubIter_Next(T_ChillHubIter *pIter, T_ChillHubPayload *pElement) {
+  if (pIter->remaining == 0) {
+    return FALSE;
+  }
+  return ChillHubIter_Take(pIter, pIter->elementType, pElement);
+}
+
+// The next JSON field, its key and its value.
+static inline uint8_t ChillHubIter_NextField(T_ChillHubIter *pIter, const char **ppKey, uint8_t *pKeyLength,
+                                             T_ChillHubPayload *pValue) {
+  uint8_t keyLength;
+
+  if (pIter->remaining == 0) {
+    return FALSE;
+  }
+  // key length, key and data type
+  if ((pIter->length < 1) || (pIter->length - 1 < pIter->pData[0] + 1)) {
+    pIter->remaining = 0;
+    return FALSE;
+  }
+  keyLength = pIter->pData[0];
+  *ppKey = (const char *)&pIter->pData[1];
+  *pKeyLength = keyLength;
+  pIter->pData += 1 + keyLength;
+  pIter->length -= 1 + keyLength;
+  // past the data type as well
+  pIter->pData++;
+  pIter->length--;
+  return ChillHubIter_Take(pIter, pIter->pData[-1], pValue);
+}
+
+#endif
@@ -0,0 +1,130 @@
+/*
+ * The chillhub message schema.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * One table for each part of the protocol, as X-macros.  The
+ * ChillHubDataTypes and ChillHubMsgTypes enums are built from them below,
+ * chillhub.c builds the scalar senders and the size checks on received data,
+ * and the host SDK the same at compile time in C++.  Add a message here and
+ * everything follows.
+ */
+
+#ifndef CHILLHUBSCHEMA_H
+#define CHILLHUBSCHEMA_H
+
+// X(name, value, size): every data type.  size is the number of data bytes
+// a value of the type takes, 0 where the data says how long it is.
+// noDataType marks messages that end after the message type.
+#define CHILLHUB_DATA_TYPES(X) \
+  X(noDataType,         0x00, 0) \
+  X(arrayDataType,      0x01, 0) \
+  X(stringDataType,     0x02, 0) \
+  X(unsigned8DataType,  0x03, 1) \
+  X(signed8DataType,    0x04, 1) \
+  X(unsigned16DataType, 0x05, 2) \
+  X(signed16DataType,   0x06, 2) \
+  X(unsigned32DataType, 0x07, 4) \
+  X(signed32DataType,   0x08, 4) \
+  X(jsonDataType,       0x09, 0) \
+  X(booleanDataType,    0x10, 1)
+
+// X(name, value, dataType): every message type and the data type it carries.
+// 0x0e-0x0f and 0x2e-0x4f are reserved, 0x50-0xff are user defined.
+#define CHILLHUB_MSG_TYPES(X) \
+  X(deviceIdMsgType,                          0x00, arrayDataType) \
+  X(subscribeMsgType,                         0x01, unsigned8DataType) \
+  X(unsubscribeMsgType,                       0x02, unsigned8DataType) \
+  X(setAlarmMsgType,                          0x03, stringDataType) \
+  X(unsetAlarmMsgType,                        0x04, unsigned8DataType) \
+  X(alarmNotifyMsgType,                       0x05, arrayDataType) \
+  X(getTimeMsgType,                           0x06, noDataType) \
+  X(timeResponseMsgType,                      0x07, arrayDataType) \
+  X(deviceIdRequestType,                      0x08, unsigned8DataType) \
+  X(registerResourceType,                     0x09, jsonDataType) \
+  X(updateResourceType,                       0x0a, jsonDataType) \
+  X(resourceUpdatedType,                      0x0b, jsonDataType) \
+  X(setDeviceUUIDType,                        0x0c, stringDataType) \
+  X(keepAliveType,                            0x0d, unsigned8DataType) \
+  X(filterAlertMsgType,                       0x10, unsigned8DataType) \
+  X(waterFilterCalendarTimerMsgType,          0x11, unsigned16DataType) \
+  X(waterFilterCalendarPercentUsedMsgType,    0x12, unsigned8DataType) \
+  X(waterFilterHoursRemainingMsgType,         0x13, unsigned16DataType) \
+  X(waterUsageTimerMsgType,                   0x14, unsigned32DataType) \
+  X(waterFilterUsageTimePercentUsedMsgType,   0x15, unsigned8DataType) \
+  X(waterFilterOuncesRemainingMsgType,        0x16, unsigned32DataType) \
+  X(commandFeaturesMsgType,                   0x17, unsigned8DataType) \
+  X(temperatureAlertMsgType,                  0x18, unsigned8DataType) \
+  X(freshFoodDisplayTemperatureMsgType,       0x19, unsigned8DataType) \
+  X(freezerDisplayTemperatureMsgType,         0x1A, unsigned8DataType) \
+  X(freshFoodSetpointTemperatureMsgType,      0x1B, unsigned8DataType) \
+  X(freezerSetpointTemperatureMsgType,        0x1C, unsigned8DataType) \
+  X(doorAlarmAlertMsgType,                    0x1D, unsigned8DataType) \
+  X(iceMakerBucketStatusMsgType,              0x1E, unsigned8DataType) \
+  X(odorFilterCalendarTimerMsgType,           0x1F, unsigned16DataType) \
+  X(odorFilterPercentUsedMsgType,             0x20, unsigned8DataType) \
+  X(odorFilterHoursRemainingMsgType,          0x21, unsigned16DataType) \
+  X(doorStatusMsgType,                        0x22, unsigned8DataType) \
+  X(dcSwitchStateMsgType,                     0x23, unsigned8DataType) \
+  X(acInputStateMsgType,                      0x24, unsigned8DataType) \
+  X(iceMakerMoldThermistorTemperatureMsgType, 0x25, unsigned16DataType) \
+  X(iceCabinetThermistorTemperatureMsgType,   0x26, unsigned16DataType) \
+  X(hotWaterThermistor1TemperatureMsgType,    0x27, unsigned16DataType) \
+  X(hotWaterThermistor2TemperatureMsgType,    0x28, unsigned16DataType) \
+  X(dctSwitchStateMsgType,                    0x29, unsigned8DataType) \
+  X(relayStatusMsgType,                       0x2A, unsigned8DataType) \
+  X(ductDoorStatusMsgType,                    0x2B, unsigned8DataType) \
+  X(iceMakerStateSelectionMsgType,            0x2C, unsigned8DataType) \
+  X(iceMakerOperationalStateMsgType,          0x2D, unsigned8DataType)
+
+// X(name, dataType, parameterType): ChillHub_Send<name>Msg for the scalars
+#define CHILLHUB_SCALAR_SENDERS(X) \
+  X(U8,      unsigned8DataType,  unsigned char) \
+  X(U16,     unsigned16DataType, unsigned int) \
+  X(I8,      signed8DataType,    signed char) \
+  X(I16,     signed16DataType,   signed int) \
+  X(Boolean, booleanDataType,    unsigned char)
+
+// Chill Hub data types and message types
+#define CHILLHUB_ENUM_ENTRY(name, value, column) name = value,
+enum ChillHubDataTypes {
+  CHILLHUB_DATA_TYPES(CHILLHUB_ENUM_ENTRY)
+};
+
+enum ChillHubMsgTypes {
+  CHILLHUB_MSG_TYPES(CHILLHUB_ENUM_ENTRY)
+};
+#undef CHILLHUB_ENUM_ENTRY
+
+// CHILLHUB_SIZE_<data type>: the size column as constants
+#define CHILLHUB_SIZE_ENUM(name, value, size) CHILLHUB_SIZE_##name = size,
+enum ChillHubDataSizes {
+  CHILLHUB_DATA_TYPES(CHILLHUB_SIZE_ENUM)
+};
+#undef CHILLHUB_SIZE_ENUM
+
+// Length of a message with a scalar of the given type: message type, data
+// type, value.  It goes in the length byte in front of the message.
+#define CHILLHUB_SCALAR_MSG_LEN(dataType) (2 + CHILLHUB_SIZE_##dataType)
+
+#endif
@@ -0,0 +1,295 @@
+/*
+ * Firmware image transfer over the chillhub link.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include "chillhub.h"
+#include "crc.h"
+#include "fwupdate.h"
+
+// Bytes read back at a time when verifying the image
+#define VERIFY_BLOCK 32
+
+static void sendStatus(T_FwUpdateCB *pControlBlock) {
+   uint8_t status[FW_UPDATE_STATUS_LENGTH];
+
+   status[0] = pControlBlock->state;
+   status[1] = (pControlBlock->nextSeq >> 8) & 0xff;
+   status[2] = pControlBlock->nextSeq & 0xff;
+   status[3] = FW_UPDATE_WINDOW;
+   status[4] = FW_UPDATE_CHUNK_SIZE;
+   status[5] = pControlBlock->error;
+   pControlBlock->sinceAck = 0;
+   pControlBlock->sendStatus(status, sizeof(status));
+}
+
+static void fail(T_FwUpdateCB *pControlBlock, uint8_t error) {
+   pControlBlock->state = FW_STATE_FAILED;
+   pControlBlock->error = error;
+   sendStatus(pControlBlock);
+}
+
+// An array of at least minCount U8, every one of them in the message: the
+// count is the sender's and is not trusted past what was received.
+static uint8_t asU8Array(const T_ChillHubPayload *pPayload, uint8_t minCount, T_ChillHubIter *pArray) {
+   return ChillHubPayload_AsArray(pPayload, pArray) && (pArray->elementType == unsigned8DataType) &&
+          (pArray->remaining >= minCount) && (pArray->remaining <= pArray->length);
+}
+
+uint8_t FwUpdate_Init(T_FwUpdateCB *pControlBlock, const T_FwStore *pStore,
+                      void (*sendStatus)(const uint8_t *pStatus, uint8_t length), void (*commit)(void)) {
+   if (pControlBlock == NULL || pStore == NULL || sendStatus == NULL || commit == NULL) {
+      return FW_UPDATE_INIT_FAILURE;
+   }
+
+   pControlBlock->pStore = pStore;
+   pControlBlock->sendStatus = sendStatus;
+   pControlBlock->commit = commit;
+   pControlBlock->imageSize = 0;
+   pControlBlock->imageCrc = 0;
+   pControlBlock->chunkCount = 0;
+   pControlBlock->nextSeq = 0;
+   pControlBlock->state = FW_STATE_IDLE;
+   pControlBlock->error = FW_ERROR_NONE;
+   pControlBlock->sinceAck = 0;
+   pControlBlock->gapReported = 0;
+   pControlBlock->resumes = 0;
+   pControlBlock->rejectedChunks = 0;
+
+   return FW_UPDATE_INIT_SUCCESS;
+}
+
+// Length of the data in chunk seq; all but the last are full.
+uint16_t FwUpdate_ChunkLength(const T_FwUpdateCB *pControlBlock, uint16_t seq) {
+   uint32_t offset = (uint32_t)seq * FW_UPDATE_CHUNK_SIZE;
+
+   if (offset >= pControlBlock->imageSize) {
+      return 0;
+   }
+   if (pControlBlock->imageSize - offset < FW_UPDATE_CHUNK_SIZE) {
+      return (uint16_t)(pControlBlock->imageSize - offset);
+   }
+   return FW_UPDATE_CHUNK_SIZE;
+}
+
+void FwUpdate_Start(T_FwUpdateCB *pControlBlock, const T_ChillHubPayload *pPayload) {
+   T_ChillHubIter array;
+   const uint8_t *pData;
+   uint32_t size;
+   uint16_t crc;
+
+   if (!asU8Array(pPayload, 6, &array)) {
+      pControlBlock->error = FW_ERROR_BAD_MESSAGE;
+      sendStatus(pControlBlock);
+      return;
+   }
+   pData = array.pData;
+   size = ((uint32_t)pData[0] << 24) | ((uint32_t)pData[1] << 16) | ((uint32_t)pData[2] << 8) | pData[3];
+   crc = (uint16_t)((pData[4] << 8) | pData[5]);
+
+   // The same image again, after a USB reset or a lost status: carry on.
+   if (((pControlBlock->state == FW_STATE_RECEIVING) || (pControlBlock->state == FW_STATE_COMPLETE)) &&
+       (size == pControlBlock->imageSize) && (crc == pControlBlock->imageCrc)) {
+      pControlBlock->resumes++;
+      pControlBlock->gapReported = 0;
+      pControlBlock->error = FW_ERROR_NONE;
+      sendStatus(pControlBlock);
+      return;
+   }
+
+   pControlBlock->imageSize = size;
+   pControlBlock->imageCrc = crc;
+   pControlBlock->chunkCount = (uint16_t)((size + FW_UPDATE_CHUNK_SIZE - 1) / FW_UPDATE_CHUNK_SIZE);
+   pControlBlock->nextSeq = 0;
+   pControlBlock->gapReported = 0;
+   pControlBlock->error = FW_ERROR_NONE;
+
+   if ((size == 0) || (size > pControlBlock->pStore->capacity) ||
+       (size > (uint32_t)0xffff * FW_UPDATE_CHUNK_SIZE)) {
+      fail(pControlBlock, FW_ERROR_TOO_BIG);
+      return;
+   }
+   if (pControlBlock->pStore->begin(size) != FW_STORE_SUCCESS) {
+      fail(pControlBlock, FW_ERROR_STORE);
+      return;
+   }
+
+   pControlBlock->state = FW_STATE_RECEIVING;
+   sendStatus(pControlBlock);
+}
+
+// The length first, so the CRC only covers a chunk of the size expected.
+static uint8_t chunkIsGood(const T_FwUpdateCB *pControlBlock, uint16_t seq, const uint8_t *pData,
+                           uint16_t length, uint16_t crcSent) {
+   crc_t crc;
+
+   if (length != FwUpdate_ChunkLength(pControlBlock, seq)) {
+      return FALSE;
+   }
+   crc = crc_init();
+   crc = crc_update(crc, pData, 2);
+   crc = crc_update(crc, &pData[4], length);
+   return crc_finalize(crc) == crcSent;
+}
+
+void FwUpdate_Data(T_FwUpdateCB *pControlBlock, const T_ChillHubPayload *pPayload) {
+   T_ChillHubIter array;
+   const uint8_t *pData;
+   uint16_t seq;
+   uint16_t crcSent;
+   uint16_t length;
+
+   if (pControlBlock->state != FW_STATE_RECEIVING) {
+      return;
+   }
+   if (!asU8Array(pPayload, 5, &array)) {
+      pControlBlock->rejectedChunks++;
+      return;
+   }
+
+   length = array.remaining - 4;
+   pData = array.pData;
+   seq = (uint16_t)((pData[0] << 8) | pData[1]);
+   crcSent = (uint16_t)((pData[2] << 8) | pData[3]);
+
+   if (seq != pControlBlock->nextSeq) {
+      // Either a retransmission of something already stored or a chunk past
+      // a lost one.  Say once where to continue from.
+      pControlBlock->rejectedChunks++;
+      if (!pControlBlock->gapReported) {
+         pControlBlock->gapReported = 1;
+         pControlBlock->error = FW_ERROR_SEQUENCE;
+         sendStatus(pControlBlock);
+      }
+      return;
+   }
+
+   if (!chunkIsGood(pControlBlock, seq, pData, length, crcSent)) {
+      pControlBlock->rejectedChunks++;
+      if (!pControlBlock->gapReported) {
+         pControlBlock->gapReported = 1;
+         pControlBlock->error = FW_ERROR_CHUNK_CRC;
+         sendStatus(pControlBlock);
+      }
+      return;
+   }
+
+   if (pControlBlock->pStore->write((uint32_t)seq * FW_UPDATE_CHUNK_SIZE, &pData[4], (uint8_t)length) != FW_STORE_SUCCESS) {
+      fail(pControlBlock, FW_ERROR_STORE);
+      return;
+   }
+
+   pControlBlock->nextSeq++;
+   pControlBlock->gapReported = 0;
+   pControlBlock->error = FW_ERROR_NONE;
+   pControlBlock->sinceAck++;
+
+   if (pControlBlock->nextSeq == pControlBlock->chunkCount) {
+      if (pControlBlock->pStore->finish() != FW_STORE_SUCCESS) {
+         fail(pControlBlock, FW_ERROR_STORE);
+         return;
+      }
+      pControlBlock->state = FW_STATE_COMPLETE;
+      sendStatus(pControlBlock);
+   } else if (pControlBlock->sinceAck >= FW_UPDATE_ACK_EVERY) {
+      sendStatus(pControlBlock);
+   }
+}
+
+// CRC-16 of the stored image, read back from the store.
+static uint8_t verifyImage(T_FwUpdateCB *pControlBlock) {
+   uint8_t block[VERIFY_BLOCK];
+   uint32_t offset = 0;
+   uint8_t length;
+   crc_t crc = crc_init();
+
+   while (offset < pControlBlock->imageSize) {
+      length = VERIFY_BLOCK;
+      if (pControlBlock->imageSize - offset < VERIFY_BLOCK) {
+         length = (uint8_t)(pControlBlock->imageSize - offset);
+      }
+      if (pControlBlock->pStore->read(offset, block, length) != FW_STORE_SUCCESS) {
+         return FW_ERROR_STORE;
+      }
+      crc = crc_update(crc, block, length);
+      offset += length;
+   }
+
+   return (crc_finalize(crc) == pControlBlock->imageCrc) ? FW_ERROR_NONE : FW_ERROR_IMAGE_CRC;
+}
+
+void FwUpdate_Control(T_FwUpdateCB *pControlBlock, const T_ChillHubPayload *pPayload) {
+   uint8_t command;
+   uint8_t error;
+
+   if (!ChillHubPayload_AsU8(pPayload, &command)) {
+      pControlBlock->error = FW_ERROR_BAD_MESSAGE;
+      sendStatus(pControlBlock);
+      return;
+   }
+
+   switch (command) {
+      case FW_UPDATE_VERIFY:
+         if ((pControlBlock->state != FW_STATE_COMPLETE) && (pControlBlock->state != FW_STATE_VERIFIED)) {
+            pControlBlock->error = FW_ERROR_STATE;
+            sendStatus(pControlBlock);
+            return;
+         }
+         error = verifyImage(pControlBlock);
+         if (error != FW_ERROR_NONE) {
+            fail(pControlBlock, error);
+            return;
+         }
+         pControlBlock->state = FW_STATE_VERIFIED;
+         pControlBlock->error = FW_ERROR_NONE;
+         sendStatus(pControlBlock);
+         break;
+
+      case FW_UPDATE_COMMIT:
+         if (pControlBlock->state != FW_STATE_VERIFIED) {
+            pControlBlock->error = FW_ERROR_STATE;
+            sendStatus(pControlBlock);
+            return;
+         }
+         pControlBlock->state = FW_STATE_COMMITTING;
+         sendStatus(pControlBlock);
+         pControlBlock->commit();
+         break;
+
+      case FW_UPDATE_ABORT:
+         pControlBlock->state = FW_STATE_IDLE;
+         pControlBlock->error = FW_ERROR_NONE;
+         pControlBlock->nextSeq = 0;
+         sendStatus(pControlBlock);
+         break;
+
+      case FW_UPDATE_QUERY:
+         sendStatus(pControlBlock);
+         break;
+
+      default:
+         pControlBlock->error = FW_ERROR_BAD_MESSAGE;
+         sendStatus(pControlBlock);
+         break;
+   }
+}
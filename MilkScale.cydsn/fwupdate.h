@@ -0,0 +1,128 @@
+/*
+ * Firmware image transfer over the chillhub link.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * The hub streams a new application image in numbered chunks, each with its
+ * own CRC-16.  Chunks are only taken in order; the device acknowledges with
+ * a status message giving the next sequence number it wants, every
+ * FW_UPDATE_ACK_EVERY chunks and whenever something arrives out of order,
+ * so the hub can keep FW_UPDATE_WINDOW chunks on the wire and go back to the
+ * acknowledged point after a loss.
+ *
+ * The transfer state lives in RAM and survives a USB reset of the hub link:
+ * a repeated start for the same image size and CRC resumes where it stopped.
+ * When every chunk is in, the hub asks for a verify, which re-reads the
+ * stored image and checks the CRC-16 of the whole of it, and then for a
+ * commit, which hands over to the bootloader.  On the scale the bootloader
+ * copies the staged image into place after a reset, see btldr_stage.h.
+ *
+ * Messages, all arrays of U8 unless noted:
+ *   0x50 start    hub    size (U32 BE), image CRC (U16 BE)
+ *   0x51 data     hub    sequence (U16 BE), CRC of sequence and data (U16 BE), data
+ *   0x52 control  hub    U8: FW_UPDATE_VERIFY, FW_UPDATE_COMMIT, FW_UPDATE_ABORT
+ *                        or FW_UPDATE_QUERY
+ *   0x53 status   device state, next sequence (U16 BE), window, chunk size, error
+ */
+
+#ifndef FWUPDATE_H
+#define FWUPDATE_H
+
+#include <stdint.h>
+#include "chillhubPayload.h"
+
+#define FW_UPDATE_START_MSG 0x50
+#define FW_UPDATE_DATA_MSG 0x51
+#define FW_UPDATE_CONTROL_MSG 0x52
+#define FW_UPDATE_STATUS_MSG 0x53
+
+// A data message fills a chillhub frame: 61 bytes minus the length, message
+// type, data type, element count, element type, sequence and CRC.
+#define FW_UPDATE_CHUNK_SIZE 48
+#define FW_UPDATE_WINDOW 4
+#define FW_UPDATE_ACK_EVERY 2
+#define FW_UPDATE_STATUS_LENGTH 6
+
+// control commands
+#define FW_UPDATE_VERIFY 1
+#define FW_UPDATE_COMMIT 2
+#define FW_UPDATE_ABORT 3
+#define FW_UPDATE_QUERY 4
+
+// states
+#define FW_STATE_IDLE 0
+#define FW_STATE_RECEIVING 1
+#define FW_STATE_COMPLETE 2
+#define FW_STATE_VERIFIED 3
+#define FW_STATE_FAILED 4
+#define FW_STATE_COMMITTING 5
+
+// errors, reported with the status
+#define FW_ERROR_NONE 0
+#define FW_ERROR_BAD_MESSAGE 1
+#define FW_ERROR_TOO_BIG 2
+#define FW_ERROR_SEQUENCE 3
+#define FW_ERROR_CHUNK_CRC 4
+#define FW_ERROR_STORE 5
+#define FW_ERROR_IMAGE_CRC 6
+#define FW_ERROR_STATE 7
+
+// Where the image goes.  Writes come strictly in order.
+typedef struct T_FwStore {
+   uint32_t capacity;
+   uint8_t (*begin)(uint32_t size);
+   uint8_t (*write)(uint32_t offset, const uint8_t *pData, uint8_t length);
+   uint8_t (*finish)(void);
+   uint8_t (*read)(uint32_t offset, uint8_t *pData, uint8_t length);
+} T_FwStore;
+
+#define FW_STORE_FAILURE 0
+#define FW_STORE_SUCCESS 1
+
+typedef struct T_FwUpdateCB {
+   const T_FwStore *pStore;
+   void (*sendStatus)(const uint8_t *pStatus, uint8_t length);
+   void (*commit)(void);
+   uint32_t imageSize;
+   uint16_t imageCrc;
+   uint16_t chunkCount;
+   uint16_t nextSeq;
+   uint8_t state;
+   uint8_t error;
+   uint8_t sinceAck;
+   uint8_t gapReported;
+   uint16_t resumes;
+   uint16_t rejectedChunks;
+} T_FwUpdateCB;
+
+#define FW_UPDATE_INIT_FAILURE 0
+#define FW_UPDATE_INIT_SUCCESS 1
+
+uint8_t FwUpdate_Init(T_FwUpdateCB *pControlBlock, const T_FwStore *pStore,
+                      void (*sendStatus)(const uint8_t *pStatus, uint8_t length), void (*commit)(void));
+void FwUpdate_Start(T_FwUpdateCB *pControlBlock, const T_ChillHubPayload *pPayload);
+void FwUpdate_Data(T_FwUpdateCB *pControlBlock, const T_ChillHubPayload *pPayload);
+void FwUpdate_Control(T_FwUpdateCB *pControlBlock, const T_ChillHubPayload *pPayload);
+uint16_t FwUpdate_ChunkLength(const T_FwUpdateCB *pControlBlock, uint16_t seq);
+
+#endif
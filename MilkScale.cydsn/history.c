@@ -0,0 +1,335 @@
+/*
+ * Compressed history of the weight on the device.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "history.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef FALSE
+#define FALSE 0
+#define TRUE !FALSE
+#endif
+
+#define HISTORY_DATA_BITS ((HISTORY_BLOCK_SIZE - HISTORY_HEADER_SIZE) * 8)
+#define HISTORY_COUNT_OFFSET 6
+#define HISTORY_FLAGS_OFFSET 7
+
+// A code of up to 36 bits, the prefix then the change.
+typedef struct T_HistoryCode {
+   uint32_t prefix;
+   uint32_t bits;
+   uint8_t prefixLength;
+   uint8_t length;
+} T_HistoryCode;
+
+uint8_t History_Init(T_HistoryCB *pControlBlock, void (*store)(const uint8_t *pBlock)) {
+   if (pControlBlock == NULL) {
+      return HISTORY_FAILURE;
+   }
+
+   pControlBlock->store = store;
+   pControlBlock->first = 0;
+   pControlBlock->count = 0;
+   pControlBlock->open = FALSE;
+   pControlBlock->flags = HISTORY_FLAG_RESTART;
+   pControlBlock->stats.samples = 0;
+   pControlBlock->stats.blocks = 0;
+   pControlBlock->stats.dropped = 0;
+   pControlBlock->stats.fetches = 0;
+
+   return HISTORY_SUCCESS;
+}
+
+static uint8_t* newestBlock(T_HistoryCB *pControlBlock) {
+   return pControlBlock->blocks[(pControlBlock->first + pControlBlock->count - 1) % HISTORY_BLOCKS].bytes;
+}
+
+// Makes room for a block at the end of the ring, dropping the oldest.
+static uint8_t* appendBlock(T_HistoryCB *pControlBlock) {
+   if (pControlBlock->count == HISTORY_BLOCKS) {
+      pControlBlock->first = (pControlBlock->first + 1) % HISTORY_BLOCKS;
+      pControlBlock->count--;
+      pControlBlock->stats.dropped++;
+   }
+   pControlBlock->count++;
+   return newestBlock(pControlBlock);
+}
+
+static uint32_t readU32(const uint8_t *p) {
+   return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void openBlock(T_HistoryCB *pControlBlock, uint32_t seconds, uint16_t value) {
+   uint8_t *pBlock = appendBlock(pControlBlock);
+
+   memset(pBlock, 0, HISTORY_BLOCK_SIZE);
+   pBlock[0] = (uint8_t)seconds;
+   pBlock[1] = (uint8_t)(seconds >> 8);
+   pBlock[2] = (uint8_t)(seconds >> 16);
+   pBlock[3] = (uint8_t)(seconds >> 24);
+   pBlock[4] = (uint8_t)value;
+   pBlock[5] = (uint8_t)(value >> 8);
+   pBlock[HISTORY_COUNT_OFFSET] = 1;
+   pBlock[HISTORY_FLAGS_OFFSET] = pControlBlock->flags;
+   pControlBlock->flags = 0;
+   pControlBlock->open = TRUE;
+   pControlBlock->bitCount = 0;
+   pControlBlock->lastGap = 0;
+}
+
+static void closeBlock(T_HistoryCB *pControlBlock) {
+   pControlBlock->open = FALSE;
+   pControlBlock->stats.blocks++;
+   if (pControlBlock->store != NULL) {
+      pControlBlock->store(newestBlock(pControlBlock));
+   }
+}
+
+static void putBits(uint8_t *pData, uint16_t *pPosition, uint32_t bits, uint8_t length) {
+   while (length > 0) {
+      length--;
+      if ((bits >> length) & 1) {
+         pData[*pPosition >> 3] |= (uint8_t)(0x80 >> (*pPosition & 7));
+      }
+      (*pPosition)++;
+   }
+}
+
+static void makeCode(T_HistoryCode *pCode, uint32_t prefix, uint8_t prefixLength, uint32_t bits, uint8_t length) {
+   pCode->prefix = prefix;
+   pCode->prefixLength = prefixLength;
+   pCode->bits = (length < 32) ? (bits & ((1UL << length) - 1)) : bits;
+   pCode->length = length;
+}
+
+static void secondsCode(T_HistoryCode *pCode, uint32_t gap, uint32_t lastGap) {
+   int64_t change = (int64_t)gap - lastGap;
+
+   if (change == 0) {
+      makeCode(pCode, 0x0, 1, 0, 0);
+   } else if ((change >= -4) && (change < 4)) {
+      makeCode(pCode, 0x2, 2, (uint32_t)change, 3);
+   } else if ((change >= -256) && (change < 256)) {
+      makeCode(pCode, 0x6, 3, (uint32_t)change, 9);
+   } else if ((change >= -32768) && (change < 32768)) {
+      makeCode(pCode, 0xe, 4, (uint32_t)change, 16);
+   } else {
+      makeCode(pCode, 0xf, 4, gap, 32);
+   }
+}
+
+static void valueCode(T_HistoryCode *pCode, uint16_t value, uint16_t lastValue) {
+   int32_t change = (int32_t)value - lastValue;
+
+   if (change == 0) {
+      makeCode(pCode, 0x0, 1, 0, 0);
+   } else if ((change >= -8) && (change < 8)) {
+      makeCode(pCode, 0x2, 2, (uint32_t)change, 4);
+   } else if ((change >= -64) && (change < 64)) {
+      makeCode(pCode, 0x6, 3, (uint32_t)change, 7);
+   } else {
+      makeCode(pCode, 0x7, 3, value, 16);
+   }
+}
+
+void History_Record(T_HistoryCB *pControlBlock, uint32_t seconds, uint16_t value) {
+   T_HistoryCode time;
+   T_HistoryCode change;
+   uint32_t gap = seconds - pControlBlock->lastSeconds;
+   uint8_t *pBlock;
+
+   pControlBlock->stats.samples++;
+   if (!pControlBlock->open) {
+      openBlock(pControlBlock, seconds, value);
+   } else {
+      secondsCode(&time, gap, pControlBlock->lastGap);
+      valueCode(&change, value, pControlBlock->lastValue);
+      pBlock = newestBlock(pControlBlock);
+      if (((pControlBlock->bitCount + time.prefixLength + time.length + change.prefixLength + change.length) >
+           HISTORY_DATA_BITS) || (pBlock[HISTORY_COUNT_OFFSET] == 0xff)) {
+         closeBlock(pControlBlock);
+         openBlock(pControlBlock, seconds, value);
+      } else {
+         putBits(&pBlock[HISTORY_HEADER_SIZE], &pControlBlock->bitCount, time.prefix, time.prefixLength);
+         putBits(&pBlock[HISTORY_HEADER_SIZE], &pControlBlock->bitCount, time.bits, time.length);
+         putBits(&pBlock[HISTORY_HEADER_SIZE], &pControlBlock->bitCount, change.prefix, change.prefixLength);
+         putBits(&pBlock[HISTORY_HEADER_SIZE], &pControlBlock->bitCount, change.bits, change.length);
+         pBlock[HISTORY_COUNT_OFFSET]++;
+         pControlBlock->lastGap = gap;
+      }
+   }
+   pControlBlock->lastSeconds = seconds;
+   pControlBlock->lastValue = value;
+}
+
+// The last sample of a closed block, or FALSE if the block does not decode.
+static uint8_t lastSample(const uint8_t *pBlock, uint32_t *pSeconds, uint16_t *pValue) {
+   T_HistoryReader reader;
+   uint8_t samples = 0;
+
+   if (!History_ReaderInit(&reader, pBlock, HISTORY_BLOCK_SIZE)) {
+      return FALSE;
+   }
+   while (History_ReaderNext(&reader, pSeconds, pValue)) {
+      samples++;
+   }
+   return samples == pBlock[HISTORY_COUNT_OFFSET];
+}
+
+// A block kept in flash goes behind the ones restored before it; samples
+// are only recorded after the last one.
+uint8_t History_Restore(T_HistoryCB *pControlBlock, const uint8_t *pBlock) {
+   uint32_t seconds;
+   uint16_t value;
+
+   if (pControlBlock->open || !lastSample(pBlock, &seconds, &value)) {
+      return HISTORY_FAILURE;
+   }
+
+   memcpy(appendBlock(pControlBlock), pBlock, HISTORY_BLOCK_SIZE);
+   pControlBlock->lastSeconds = seconds;
+   pControlBlock->lastValue = value;
+   return HISTORY_SUCCESS;
+}
+
+uint8_t History_LastSeconds(const T_HistoryCB *pControlBlock, uint32_t *pSeconds) {
+   if (pControlBlock->count == 0) {
+      return FALSE;
+   }
+   *pSeconds = pControlBlock->lastSeconds;
+   return TRUE;
+}
+
+// Sends, oldest first, every block with a sample from since to until, both
+// included.  The open block is sent up to its last sample.
+uint8_t History_Fetch(T_HistoryCB *pControlBlock, uint32_t since, uint32_t until,
+                      void (*send)(const uint8_t *pBlock, uint8_t length)) {
+   uint8_t sent = 0;
+   uint8_t n;
+
+   pControlBlock->stats.fetches++;
+   for (n = 0; n < pControlBlock->count; n++) {
+      const uint8_t *pBlock = pControlBlock->blocks[(pControlBlock->first + n) % HISTORY_BLOCKS].bytes;
+      uint8_t isOpen = pControlBlock->open && (n == (pControlBlock->count - 1));
+      uint32_t last = pControlBlock->lastSeconds;
+      uint16_t value;
+
+      if (!isOpen) {
+         lastSample(pBlock, &last, &value);
+      }
+      if (((int32_t)(last - since) >= 0) && ((int32_t)(until - readU32(pBlock)) >= 0)) {
+         send(pBlock, isOpen ? (uint8_t)(HISTORY_HEADER_SIZE + (pControlBlock->bitCount + 7) / 8) : HISTORY_BLOCK_SIZE);
+         sent++;
+      }
+   }
+   return sent;
+}
+
+uint8_t History_ReaderInit(T_HistoryReader *pReader, const uint8_t *pBlock, uint8_t length) {
+   if ((length < HISTORY_HEADER_SIZE) || (length > HISTORY_BLOCK_SIZE) || (pBlock[HISTORY_COUNT_OFFSET] == 0)) {
+      return HISTORY_FAILURE;
+   }
+
+   pReader->pBlock = &pBlock[HISTORY_HEADER_SIZE];
+   pReader->bitPosition = 0;
+   pReader->bitCount = (uint16_t)(length - HISTORY_HEADER_SIZE) * 8;
+   pReader->remaining = pBlock[HISTORY_COUNT_OFFSET];
+   pReader->started = FALSE;
+   pReader->seconds = readU32(pBlock);
+   pReader->gap = 0;
+   pReader->value = (uint16_t)(pBlock[4] | (pBlock[5] << 8));
+   return HISTORY_SUCCESS;
+}
+
+static uint8_t takeBits(T_HistoryReader *pReader, uint8_t length, uint32_t *pBits) {
+   uint32_t bits = 0;
+
+   if ((pReader->bitPosition + length) > pReader->bitCount) {
+      return FALSE;
+   }
+   while (length > 0) {
+      bits = (bits << 1) | ((pReader->pBlock[pReader->bitPosition >> 3] >> (7 - (pReader->bitPosition & 7))) & 1);
+      pReader->bitPosition++;
+      length--;
+   }
+   *pBits = bits;
+   return TRUE;
+}
+
+// How many of up to limit 1 bits come first, FALSE if the block ends.
+static uint8_t takePrefix(T_HistoryReader *pReader, uint8_t limit, uint8_t *pOnes) {
+   uint32_t bit = 1;
+
+   *pOnes = 0;
+   while ((*pOnes < limit) && takeBits(pReader, 1, &bit) && (bit == 1)) {
+      (*pOnes)++;
+   }
+   return (*pOnes == limit) || (bit == 0);
+}
+
+static int32_t signExtend(uint32_t bits, uint8_t length) {
+   return (bits & (1UL << (length - 1))) ? (int32_t)(bits - (1UL << length)) : (int32_t)bits;
+}
+
+static uint8_t takeSample(T_HistoryReader *pReader) {
+   static const uint8_t changeLengths[] = { 0, 3, 9, 16 };
+   static const uint8_t valueLengths[] = { 0, 4, 7 };
+   uint8_t ones;
+   uint32_t bits = 0;
+
+   if (!takePrefix(pReader, 4, &ones) || ((ones > 0) && !takeBits(pReader, (ones < 4) ? changeLengths[ones] : 32, &bits))) {
+      return FALSE;
+   }
+   if (ones == 4) {
+      pReader->gap = bits;
+   } else if (ones > 0) {
+      pReader->gap += (uint32_t)signExtend(bits, changeLengths[ones]);
+   }
+   pReader->seconds += pReader->gap;
+
+   if (!takePrefix(pReader, 3, &ones) || ((ones > 0) && !takeBits(pReader, (ones < 3) ? valueLengths[ones] : 16, &bits))) {
+      return FALSE;
+   }
+   if (ones == 3) {
+      pReader->value = (uint16_t)bits;
+   } else if (ones > 0) {
+      pReader->value = (uint16_t)(pReader->value + signExtend(bits, valueLengths[ones]));
+   }
+   return TRUE;
+}
+
+uint8_t History_ReaderNext(T_HistoryReader *pReader, uint32_t *pSeconds, uint16_t *pValue) {
+   if (pReader->remaining == 0) {
+      return FALSE;
+   }
+   if (pReader->started && !takeSample(pReader)) {
+      pReader->remaining = 0;
+      return FALSE;
+   }
+   pReader->started = TRUE;
+   pReader->remaining--;
+   *pSeconds = pReader->seconds;
+   *pValue = pReader->value;
+   return TRUE;
+}
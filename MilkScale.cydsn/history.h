@@ -0,0 +1,114 @@
+/*
+ * Compressed history of the weight on the device.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * The values published for the weight, with the second they went out, are
+ * kept in a ring of HISTORY_BLOCKS blocks, so the history survives the hub
+ * or the cloud being away.  When the ring is full the oldest block goes.
+ *
+ * A block is HISTORY_BLOCK_SIZE bytes: the second and value of its first
+ * sample, the number of samples and flags, little endian, then the other
+ * samples as a bit stream, most significant bit first.  Each sample is the
+ * change in the gap since the one before (the delta of the delta of the
+ * seconds), then the change in the value:
+ *
+ *   seconds: 0 same gap          value: 0 same value
+ *            10 + 3 bits               10 + 4 bits
+ *            110 + 9 bits              110 + 7 bits
+ *            1110 + 16 bits            111 + 16 bits, the value itself
+ *            1111 + 32 bits, the gap itself
+ *
+ * the changes as two's complement.  A heartbeat of the same value is 2 bits
+ * and the jug lifted out and put back about ten bytes, so a family's day
+ * takes about 220 bytes and the ring holds over a day.  Blocks are
+ * sent to the hub as they are, one U8 array each, and a closed block can be
+ * handed to store to be kept in flash and given back to History_Restore
+ * after a reset.
+ *
+ * Seconds are the caller's, counted on across resets; the first block after
+ * History_Init has HISTORY_FLAG_RESTART set since its seconds do not follow
+ * on from the block before.
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+
+#define HISTORY_BLOCKS 6
+#define HISTORY_BLOCK_SIZE 48
+#define HISTORY_HEADER_SIZE 8
+
+#define HISTORY_FLAG_RESTART 0x01
+
+typedef struct T_HistoryBlock {
+   uint8_t bytes[HISTORY_BLOCK_SIZE];
+} T_HistoryBlock;
+
+typedef struct T_HistoryStats {
+   uint32_t samples;
+   uint32_t blocks;
+   uint32_t dropped;
+   uint32_t fetches;
+} T_HistoryStats;
+
+typedef struct T_HistoryCB {
+   void (*store)(const uint8_t *pBlock);
+   T_HistoryBlock blocks[HISTORY_BLOCKS];
+   uint8_t first;
+   uint8_t count;
+   uint8_t open;
+   uint16_t bitCount;
+   uint32_t lastSeconds;
+   uint32_t lastGap;
+   uint16_t lastValue;
+   uint8_t flags;
+   T_HistoryStats stats;
+} T_HistoryCB;
+
+// Reads the samples of a block back.
+typedef struct T_HistoryReader {
+   const uint8_t *pBlock;
+   uint16_t bitPosition;
+   uint16_t bitCount;
+   uint8_t remaining;
+   uint8_t started;
+   uint32_t seconds;
+   uint32_t gap;
+   uint16_t value;
+} T_HistoryReader;
+
+#define HISTORY_FAILURE 0
+#define HISTORY_SUCCESS 1
+
+uint8_t History_Init(T_HistoryCB *pControlBlock, void (*store)(const uint8_t *pBlock));
+uint8_t History_Restore(T_HistoryCB *pControlBlock, const uint8_t *pBlock);
+void History_Record(T_HistoryCB *pControlBlock, uint32_t seconds, uint16_t value);
+uint8_t History_LastSeconds(const T_HistoryCB *pControlBlock, uint32_t *pSeconds);
+uint8_t History_Fetch(T_HistoryCB *pControlBlock, uint32_t since, uint32_t until,
+                      void (*send)(const uint8_t *pBlock, uint8_t length));
+uint8_t History_ReaderInit(T_HistoryReader *pReader, const uint8_t *pBlock, uint8_t length);
+uint8_t History_ReaderNext(T_HistoryReader *pReader, uint32_t *pSeconds, uint16_t *pValue);
+
+#endif
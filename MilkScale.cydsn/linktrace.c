@@ -0,0 +1,200 @@
+/*
+ * Timestamped trace of the bytes on the chillhub link.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "linktrace.h"
+#include <stdlib.h>
+
+#ifndef FALSE
+#define FALSE 0
+#define TRUE !FALSE
+#endif
+
+uint8_t LinkTrace_Init(T_LinkTraceCB *pControlBlock, T_LinkTraceClock clock) {
+   if ((pControlBlock == NULL) || (clock == NULL)) {
+      return LINK_TRACE_FAILURE;
+   }
+
+   pControlBlock->clock = clock;
+   pControlBlock->head = 0;
+   pControlBlock->count = 0;
+   pControlBlock->overwritten = 0;
+   pControlBlock->startTicks = 0;
+   pControlBlock->lastTicks = 0;
+   pControlBlock->capturing = FALSE;
+
+   return LINK_TRACE_SUCCESS;
+}
+
+void LinkTrace_Start(T_LinkTraceCB *pControlBlock) {
+   pControlBlock->head = 0;
+   pControlBlock->count = 0;
+   pControlBlock->overwritten = 0;
+   pControlBlock->startTicks = pControlBlock->clock();
+   pControlBlock->lastTicks = pControlBlock->startTicks;
+   pControlBlock->capturing = TRUE;
+}
+
+void LinkTrace_Stop(T_LinkTraceCB *pControlBlock) {
+   pControlBlock->capturing = FALSE;
+}
+
+uint8_t LinkTrace_Decode(const T_LinkTraceRecord *pRecord, uint32_t *pTicks, uint8_t *pDirection) {
+   if (pRecord->header == LINK_TRACE_GAP) {
+      *pTicks += pRecord->data * LINK_TRACE_GAP_UNIT;
+      return FALSE;
+   }
+   if (pRecord->header == LINK_TRACE_LONG_GAP) {
+      *pTicks += pRecord->data * LINK_TRACE_LONG_GAP_UNIT;
+      return FALSE;
+   }
+
+   *pTicks += pRecord->header & LINK_TRACE_DELTA_MASK;
+   *pDirection = ((pRecord->header & LINK_TRACE_DIRECTION_BIT) != 0) ? LINK_TRACE_TX : LINK_TRACE_RX;
+   return TRUE;
+}
+
+// A full ring drops its oldest record; the time in it moves to startTicks so
+// the records left still add up to the right times.
+static void push(T_LinkTraceCB *pControlBlock, uint8_t header, uint8_t data) {
+   T_LinkTraceRecord *pRecord = &pControlBlock->records[pControlBlock->head];
+   uint8_t direction;
+
+   if (pControlBlock->count == LINK_TRACE_RECORDS) {
+      LinkTrace_Decode(pRecord, &pControlBlock->startTicks, &direction);
+      pControlBlock->overwritten++;
+   } else {
+      pControlBlock->count++;
+   }
+
+   pRecord->header = header;
+   pRecord->data = data;
+   pControlBlock->head = (pControlBlock->head + 1) % LINK_TRACE_RECORDS;
+}
+
+void LinkTrace_Record(T_LinkTraceCB *pControlBlock, uint8_t direction, const uint8_t *pData, uint8_t length) {
+   uint32_t now;
+   uint32_t elapsed;
+   uint32_t n;
+   uint8_t directionBit = (direction == LINK_TRACE_TX) ? LINK_TRACE_DIRECTION_BIT : 0;
+   uint8_t i;
+
+   if (!pControlBlock->capturing || (length == 0)) {
+      return;
+   }
+
+   now = pControlBlock->clock();
+   elapsed = now - pControlBlock->lastTicks;
+   pControlBlock->lastTicks = now;
+
+   while (elapsed >= LINK_TRACE_LONG_GAP_UNIT) {
+      n = elapsed / LINK_TRACE_LONG_GAP_UNIT;
+      if (n > 0xff) {
+         n = 0xff;
+      }
+      push(pControlBlock, LINK_TRACE_LONG_GAP, (uint8_t)n);
+      elapsed -= n * LINK_TRACE_LONG_GAP_UNIT;
+   }
+   if (elapsed > LINK_TRACE_MAX_DELTA) {
+      n = elapsed / LINK_TRACE_GAP_UNIT;
+      push(pControlBlock, LINK_TRACE_GAP, (uint8_t)n);
+      elapsed -= n * LINK_TRACE_GAP_UNIT;
+   }
+
+   // the rest of a write went out at the same tick as its first byte
+   for (i = 0; i < length; i++) {
+      push(pControlBlock, directionBit | (uint8_t)elapsed, pData[i]);
+      elapsed = 0;
+   }
+}
+
+const T_LinkTraceRecord *LinkTrace_At(const T_LinkTraceCB *pControlBlock, uint16_t index) {
+   uint16_t oldest = (pControlBlock->head + LINK_TRACE_RECORDS - pControlBlock->count) % LINK_TRACE_RECORDS;
+
+   return &pControlBlock->records[(oldest + index) % LINK_TRACE_RECORDS];
+}
+
+static char *appendString(char *p, const char *s) {
+   while (*s != 0) {
+      *p++ = *s++;
+   }
+   return p;
+}
+
+static char *appendU32(char *p, uint32_t value) {
+   char digits[10];
+   uint8_t n = 0;
+
+   do {
+      digits[n++] = (char)('0' + (value % 10));
+      value /= 10;
+   } while (value != 0);
+   while (n > 0) {
+      *p++ = digits[--n];
+   }
+   return p;
+}
+
+static char *appendHex(char *p, uint8_t value) {
+   static const char hex[] = "0123456789abcdef";
+
+   *p++ = hex[value >> 4];
+   *p++ = hex[value & 0x0f];
+   return p;
+}
+
+void LinkTrace_Dump(const T_LinkTraceCB *pControlBlock, T_LinkTracePrint print) {
+   const T_LinkTraceRecord *pRecord;
+   char line[(LINK_TRACE_LINE_RECORDS * 4) + 3];
+   char *p;
+   uint16_t i;
+
+   if (print == NULL) {
+      return;
+   }
+
+   p = appendString(line, "linktrace ");
+   p = appendU32(p, pControlBlock->startTicks);
+   p = appendString(p, " ");
+   p = appendU32(p, pControlBlock->count);
+   p = appendString(p, " ");
+   p = appendU32(p, pControlBlock->overwritten);
+   p = appendString(p, "\r\n");
+   *p = 0;
+   print(line);
+
+   p = line;
+   for (i = 0; i < pControlBlock->count; i++) {
+      pRecord = LinkTrace_At(pControlBlock, i);
+      p = appendHex(p, pRecord->header);
+      p = appendHex(p, pRecord->data);
+      if (((i + 1) % LINK_TRACE_LINE_RECORDS == 0) || (i + 1 == pControlBlock->count)) {
+         p = appendString(p, "\r\n");
+         *p = 0;
+         print(line);
+         p = line;
+      }
+   }
+
+   print("linktrace end\r\n");
+}
@@ -0,0 +1,112 @@
+/*
+ * Timestamped trace of the bytes on the chillhub link.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * A ring of the last LINK_TRACE_RECORDS bytes received and sent on the link,
+ * for looking at what the hub and the scale said to each other after the
+ * fact.  The chillhub trace hook hands every byte to LinkTrace_Record while
+ * a capture runs; once the ring is full the oldest records are overwritten.
+ *
+ * A record is two bytes, a header and a data byte.  The header of a byte on
+ * the wire holds the direction in the top bit and the ticks since the
+ * previous record in the other seven, 0 to 126.  Longer pauses go in gap
+ * records before the byte, which only advance the time:
+ *
+ *   0x7f, n    n * LINK_TRACE_GAP_UNIT ticks
+ *   0xff, n    n * LINK_TRACE_LONG_GAP_UNIT ticks
+ *
+ * LinkTrace_Dump prints the ring, oldest record first, as text the host
+ * tool tools/chillhub/tracecap reads back:
+ *
+ *   linktrace <ticks before the first record> <records> <records overwritten>
+ *   <records in hex, LINK_TRACE_LINE_RECORDS per line>
+ *   linktrace end
+ */
+
+#ifndef LINKTRACE_H
+#define LINKTRACE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef LINK_TRACE_RECORDS
+#define LINK_TRACE_RECORDS 256
+#endif
+
+#define LINK_TRACE_RX 0
+#define LINK_TRACE_TX 1
+
+#define LINK_TRACE_DIRECTION_BIT 0x80
+#define LINK_TRACE_DELTA_MASK 0x7f
+#define LINK_TRACE_MAX_DELTA 126
+#define LINK_TRACE_GAP 0x7f
+#define LINK_TRACE_LONG_GAP 0xff
+#define LINK_TRACE_GAP_UNIT 127UL
+#define LINK_TRACE_LONG_GAP_UNIT (LINK_TRACE_GAP_UNIT * 256UL)
+
+#define LINK_TRACE_LINE_RECORDS 16
+
+typedef uint32_t (*T_LinkTraceClock)(void);
+typedef void (*T_LinkTracePrint)(const char *s);
+
+typedef struct T_LinkTraceRecord {
+   uint8_t header;
+   uint8_t data;
+} T_LinkTraceRecord;
+
+typedef struct T_LinkTraceCB {
+   T_LinkTraceClock clock;
+   T_LinkTraceRecord records[LINK_TRACE_RECORDS];
+   uint16_t head;               // where the next record goes
+   uint16_t count;
+   uint32_t startTicks;         // the time the oldest record counts from
+   uint32_t lastTicks;          // the time of the newest record
+   uint32_t overwritten;
+   uint8_t capturing;
+} T_LinkTraceCB;
+
+#define LINK_TRACE_FAILURE 0
+#define LINK_TRACE_SUCCESS 1
+
+uint8_t LinkTrace_Init(T_LinkTraceCB *pControlBlock, T_LinkTraceClock clock);
+// Empties the ring and starts a capture.
+void LinkTrace_Start(T_LinkTraceCB *pControlBlock);
+void LinkTrace_Stop(T_LinkTraceCB *pControlBlock);
+void LinkTrace_Record(T_LinkTraceCB *pControlBlock, uint8_t direction, const uint8_t *pData, uint8_t length);
+// The index'th record, oldest first.
+const T_LinkTraceRecord *LinkTrace_At(const T_LinkTraceCB *pControlBlock, uint16_t index);
+void LinkTrace_Dump(const T_LinkTraceCB *pControlBlock, T_LinkTracePrint print);
+
+// Advances *pTicks by the time in a record.  Returns TRUE and fills in the
+// direction for a byte on the wire, FALSE for a gap.
+uint8_t LinkTrace_Decode(const T_LinkTraceRecord *pRecord, uint32_t *pTicks, uint8_t *pDirection);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ * Lock-in detection of the FSR excitation.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "lockin.h"
+#include <stdlib.h>
+
+#ifndef FALSE
+#define FALSE 0
+#define TRUE !FALSE
+#endif
+
+#define LOCKIN_TABLE_SIZE 16
+
+// round(1024 * sin(2 pi k / 16)); a quarter period on is the cosine
+static const int16_t sineTable[LOCKIN_TABLE_SIZE] = {
+   0, 392, 724, 946, 1024, 946, 724, 392, 0, -392, -724, -946, -1024, -946, -724, -392
+};
+
+static void clearSums(T_LockInCB *pControlBlock) {
+   uint8_t j;
+
+   for (j = 0; j < LOCKIN_CHANNELS; j++) {
+      pControlBlock->inPhase[j] = 0;
+      pControlBlock->quadrature[j] = 0;
+   }
+   pControlBlock->phase = 0;
+   pControlBlock->samples = 0;
+}
+
+uint8_t LockIn_Init(T_LockInCB *pControlBlock, uint8_t phasesPerPeriod, uint16_t periodsPerReading) {
+   uint8_t j;
+
+   if (pControlBlock == NULL) {
+      return LOCKIN_FAILURE;
+   }
+   if ((phasesPerPeriod != 4) && (phasesPerPeriod != 8) && (phasesPerPeriod != 16)) {
+      return LOCKIN_FAILURE;
+   }
+   if ((periodsPerReading == 0) || ((uint32_t)phasesPerPeriod * periodsPerReading > LOCKIN_MAX_SAMPLES)) {
+      return LOCKIN_FAILURE;
+   }
+
+   pControlBlock->pReference = sineTable;
+   pControlBlock->referenceStep = LOCKIN_TABLE_SIZE / phasesPerPeriod;
+   pControlBlock->phasesPerPeriod = phasesPerPeriod;
+   pControlBlock->samplesPerReading = phasesPerPeriod * periodsPerReading;
+   for (j = 0; j < LOCKIN_CHANNELS; j++) {
+      pControlBlock->readingInPhase[j] = 0;
+      pControlBlock->readingQuadrature[j] = 0;
+   }
+   pControlBlock->readings = 0;
+   clearSums(pControlBlock);
+
+   return LOCKIN_SUCCESS;
+}
+
+// floor(sqrt(v)), a bit at a time
+static uint32_t squareRoot(uint64_t v) {
+   uint64_t root = 0;
+   uint64_t bit = 1ULL << 62;
+
+   while (bit > v) {
+      bit >>= 2;
+   }
+   while (bit != 0) {
+      if (v >= root + bit) {
+         v -= root + bit;
+         root = (root >> 1) + bit;
+      } else {
+         root >>= 1;
+      }
+      bit >>= 2;
+   }
+   return (uint32_t)root;
+}
+
+uint8_t LockIn_AddScan(T_LockInCB *pControlBlock, const int16_t *pSamples) {
+   uint8_t index = pControlBlock->phase * pControlBlock->referenceStep;
+   int32_t sine = pControlBlock->pReference[index];
+   int32_t cosine = pControlBlock->pReference[(index + LOCKIN_TABLE_SIZE / 4) % LOCKIN_TABLE_SIZE];
+   uint8_t j;
+
+   for (j = 0; j < LOCKIN_CHANNELS; j++) {
+      pControlBlock->inPhase[j] += pSamples[j] * cosine;
+      pControlBlock->quadrature[j] += pSamples[j] * sine;
+   }
+
+   if (++pControlBlock->phase == pControlBlock->phasesPerPeriod) {
+      pControlBlock->phase = 0;
+   }
+   if (++pControlBlock->samples < pControlBlock->samplesPerReading) {
+      return FALSE;
+   }
+   for (j = 0; j < LOCKIN_CHANNELS; j++) {
+      pControlBlock->readingInPhase[j] = pControlBlock->inPhase[j];
+      pControlBlock->readingQuadrature[j] = pControlBlock->quadrature[j];
+   }
+   pControlBlock->readings++;
+   clearSums(pControlBlock);
+   return TRUE;
+}
+
+void LockIn_Restart(T_LockInCB *pControlBlock) {
+   clearSums(pControlBlock);
+}
+
+// The sums are N / 2 * A * 1024 for an amplitude A over N samples.
+uint32_t LockIn_Read(const T_LockInCB *pControlBlock, int32_t *paAmplitude) {
+   uint32_t scale = (uint32_t)pControlBlock->samplesPerReading << (LOCKIN_REF_SHIFT - 1);
+   uint8_t j;
+
+   for (j = 0; j < LOCKIN_CHANNELS; j++) {
+      int64_t i = pControlBlock->readingInPhase[j];
+      int64_t q = pControlBlock->readingQuadrature[j];
+      uint32_t length = squareRoot((uint64_t)(i * i + q * q));
+
+      paAmplitude[j] = (int32_t)((length + scale / 2) / scale);
+   }
+   return pControlBlock->readings;
+}
@@ -0,0 +1,85 @@
+/*
+ * Lock-in detection of the FSR excitation.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * The FSRs are driven with the sine from SineSource.  Instead of taking one
+ * ADC result per reading, the ADC scan is started phasesPerPeriod times per
+ * sine period by SampleStartDelay, and every scan is added here with the
+ * phase it was taken at.  Each channel is multiplied by a cosine and a sine
+ * reference and summed over periodsPerReading whole periods; the amplitude
+ * of the excitation on the channel is the length of the (I, Q) vector.
+ *
+ * Anything not at the excitation frequency, the DC offset included, sums to
+ * close to nothing over whole periods: mains at 50 or 60 Hz and compressor
+ * noise are rejected by about 1 / (pi * df * T) for an integration time T.
+ * The phase of the samples against the sine does not matter, so the delay
+ * through the opamp and the FSRs needs no calibration.
+ *
+ * The references are Q10 and the sums 32 bit, which holds any 12 bit ADC
+ * result for up to LOCKIN_MAX_SAMPLES samples per reading.  LockIn_AddScan
+ * is meant for the end of scan interrupt and only adds; the square root is
+ * left to LockIn_Read, which the main loop calls on a copy of the control
+ * block taken with interrupts masked.
+ */
+
+#ifndef LOCKIN_H
+#define LOCKIN_H
+
+#include <stdint.h>
+
+#define LOCKIN_CHANNELS 3
+#define LOCKIN_REF_SHIFT 10
+#define LOCKIN_MAX_SAMPLES 512
+
+typedef struct T_LockInCB {
+   const int16_t *pReference;   // sine table, stepped by referenceStep
+   uint8_t referenceStep;
+   uint8_t phasesPerPeriod;
+   uint8_t phase;
+   uint16_t samplesPerReading;
+   uint16_t samples;
+   int32_t inPhase[LOCKIN_CHANNELS];
+   int32_t quadrature[LOCKIN_CHANNELS];
+   // the sums of the last complete reading
+   int32_t readingInPhase[LOCKIN_CHANNELS];
+   int32_t readingQuadrature[LOCKIN_CHANNELS];
+   uint32_t readings;
+} T_LockInCB;
+
+#define LOCKIN_FAILURE 0
+#define LOCKIN_SUCCESS 1
+
+// phasesPerPeriod is 4, 8 or 16; phasesPerPeriod * periodsPerReading may
+// not be more than LOCKIN_MAX_SAMPLES.
+uint8_t LockIn_Init(T_LockInCB *pControlBlock, uint8_t phasesPerPeriod, uint16_t periodsPerReading);
+// One ADC result per channel, taken at the next phase.  Returns TRUE when
+// it completed a reading.
+uint8_t LockIn_AddScan(T_LockInCB *pControlBlock, const int16_t *pSamples);
+// Starts the next reading at phase 0, for when scans were missed.
+void LockIn_Restart(T_LockInCB *pControlBlock);
+// The amplitudes of the last reading in ADC counts; returns the number of
+// readings so far, 0 while there is none.
+uint32_t LockIn_Read(const T_LockInCB *pControlBlock, int32_t *paAmplitude);
+
+#endif
@@ -18,8 +18,24 @@
 #include "chillhub.h"
 #include "DebugUart.h"
 #include "crc.h"
+#include "tickless.h"
+#include "profile.h"
+#include "fwupdate.h"
+#include "publisher.h"
+#include "linktrace.h"
+#include "lockin.h"
+#include "measure.h"
+#include "autozero.h"
+#include "wallclock.h"
+#include "history.h"
+#include "outbox.h"
+#include "../Bootloader.cydsn/btldr_stage.h"
 
 uint32 ticks = 0;
+static T_TicklessCB tickless;
+// Bumped whenever the tickless bookkeeping changes, so readers can retry
+// instead of masking interrupts.
+static volatile uint32 timeBaseGeneration = 0;
 uint8_t buttonWasPressed = 0;
 
 uint16_t doorCounts = 0;
@@ -33,6 +49,61 @@ uint16_t doorCounts = 0;
 #define EMPTY_WEIGHT 0
 #define DIFF_THRESHOLD 1200  // 2%
 
+// The time base is a 16 bit TCPWM counter.
+#define TIME_BASE_COUNTER_MAX 0xffff
+
+// Periodic work, in ticks.
+#define BUTTON_CHECK_PERIOD 1000
+#define WEIGHT_PRINT_PERIOD 2000
+#define KEEPALIVE_TIMEOUT 20000
+#define USB_RESET_PULSE 500
+#define WEIGHT_HEARTBEAT_PERIOD 300000
+#define TELEMETRY_DEFAULT_PERIOD 10000
+
+// Updates made while the hub is away are replayed a frame at a time once it
+// is back.  The hub sends a keepalive every 5 s; a longer gap may have lost
+// frames, so what was sent in it is sent again.
+#define OUTBOX_REPLAY_INTERVAL 250
+#define OUTBOX_CONFIRM_WINDOW 7500
+
+// The weight after the door closes: a burst of samples once the jug has
+// stopped rocking, taken again if any FSR moved by more than a few counts.
+#define MEASURE_SETTLE_TICKS 1000
+#define MEASURE_SAMPLE_INTERVAL 40
+#define MEASURE_MAX_VARIANCE 100
+#define MEASURE_SAMPLES 16
+#define MEASURE_RETRIES 3
+
+// The wall clock asks the hub for the time every quarter of an hour, which
+// keeps it within a second; an answer lost on the link is asked for again.
+#define WALLCLOCK_SYNC_INTERVAL 900000
+#define WALLCLOCK_TIMEOUT 5000
+
+// The linker puts the EEPROM section here, see the linker command line.
+#define EEPROM_ADDRESS 0x7C00
+
+// Firmware images sent by the hub are staged here until the bootloader
+// installs them, a descriptor in the first row and the image after it; see
+// btldr_stage.h for the layout both sides share.  The linker places the
+// descriptor row at FW_STAGING_ADDRESS, so an application that grows into
+// the staging rows no longer links.
+#define FW_STAGING_FIRST_ROW BTLDR_STAGE_FIRST_ROW
+#define FW_STAGING_ROWS BTLDR_STAGE_ROWS
+#define FW_STAGING_ADDRESS (CY_FLASH_BASE + (FW_STAGING_FIRST_ROW * CY_FLASH_SIZEOF_ROW))
+
+_Static_assert(FW_STAGING_FIRST_ROW + FW_STAGING_ROWS <= EEPROM_ADDRESS / CY_FLASH_SIZEOF_ROW,
+               "the staging rows run into the EEPROM section");
+
+#ifdef HISTORY_FLASH_ENABLED
+// Closed blocks of the weight history, a block and its CRC to a row, in the
+// rows between the EEPROM section and the bootloadable metadata.
+#define HISTORY_FLASH_FIRST_ROW ((EEPROM_ADDRESS / CY_FLASH_SIZEOF_ROW) + 1)
+#define HISTORY_FLASH_ROWS 4
+
+_Static_assert(HISTORY_FLASH_FIRST_ROW + HISTORY_FLASH_ROWS < CY_FLASH_SIZE / CY_FLASH_SIZEOF_ROW,
+               "the history rows run into the bootloadable metadata");
+#endif
+
 uint8_t doorWasOpen = FALSE;
 uint32_t LO_MEAS[3] = { 0, 0, 0 };
 uint32_t HI_MEAS[3] = { 2048, 2048, 2048 };
@@ -50,6 +121,10 @@ typedef struct T_EEPROM {
   char UUID[MAX_UUID_LENGTH+1];
 } T_EEPROM;
 
+#ifdef HISTORY_FLASH_ENABLED
+_Static_assert(sizeof(T_EEPROM) <= CY_FLASH_SIZEOF_ROW, "the EEPROM section runs into the history rows");
+#endif
+
 static const T_EEPROM eeprom __attribute__ ((section (".EEPROMDATA"))) = {
   {
     {0,0,0},
@@ -85,16 +160,159 @@ static void applyFsrCurve(int32_t *pScaledVal, int32_t *pRawValue);
 static void readFromSensors(int32_t *paMeas);
 static void storeLimits(void);
 static void factoryCalibrate(uint8_t dataType, void *pData);
-static int32_t getMilkWeight(void);
+static void milkWeightMeasured(int32_t *pSensorReadings);
 static int32_t calculateMilkWeight(int32_t *pSensorReadings);
 static void checkForReset(void);
 //static uint16_t doSensorRead(unsigned char pinNumber);
 
+PROFILE_PROBE(applyFsrCurveProbe, "applyFsrCurve");
+
 // Timer interrupt for the time base.
 CY_ISR(isr_timer_interrupt) {
+    uint32 period;
+
     time_base_ClearInterrupt(time_base_INTR_MASK_TC | time_base_INTR_MASK_CC_MATCH);
     
-    ticks++;
+    period = Tickless_TerminalCount(&tickless);
+    if (period != TICKLESS_NO_CHANGE) {
+      time_base_WritePeriod(period);
+    }
+    ticks = tickless.ticks;
+    timeBaseGeneration++;
+}
+
+// Microseconds since start up, combining the tick count with the running
+// time base counter.  Interrupts stay enabled; a read that races with a time
+// base update is retried.
+uint32_t timestampMicros(void) {
+  uint32 generation;
+  uint32 counter;
+  uint8_t wrapPending;
+  uint32_t micros;
+
+  for (;;) {
+    generation = timeBaseGeneration;
+    wrapPending = ((time_base_GetInterruptSource() & time_base_INTR_MASK_TC) != 0);
+    counter = time_base_ReadCounter();
+    micros = Tickless_Micros(&tickless, counter, wrapPending);
+    if ((generation == timeBaseGeneration) &&
+        (wrapPending == ((time_base_GetInterruptSource() & time_base_INTR_MASK_TC) != 0))) {
+      return micros;
+    }
+  }
+}
+
+static T_FwUpdateCB fwUpdate;
+static uint8_t stagingRow[CY_FLASH_SIZEOF_ROW];
+static uint32 stagingRowNum;
+static uint16_t stagingRowUsed;
+
+static const uint8_t stagingDescriptor[CY_FLASH_SIZEOF_ROW] __attribute__ ((section (".FWSTAGING"))) = { 0 };
+
+// The bootloader installs whole rows, the application rows and then the
+// metadata row.  The descriptor of the last image is cleared first so a
+// half written image is never taken for a staged one.
+static uint8_t stagingBegin(uint32_t size) {
+  if (((uint32)stagingDescriptor != FW_STAGING_ADDRESS) ||
+      ((size % CY_FLASH_SIZEOF_ROW) != 0) || (size < 2 * CY_FLASH_SIZEOF_ROW)) {
+    return FW_STORE_FAILURE;
+  }
+  memset(stagingRow, 0, sizeof(stagingRow));
+  if (CySysFlashWriteRow(FW_STAGING_FIRST_ROW, stagingRow) != CY_SYS_FLASH_SUCCESS) {
+    return FW_STORE_FAILURE;
+  }
+  stagingRowNum = FW_STAGING_FIRST_ROW + 1;
+  stagingRowUsed = 0;
+  return FW_STORE_SUCCESS;
+}
+
+static uint8_t stagingFlushRow(void) {
+  if (stagingRowUsed == 0) {
+    return FW_STORE_SUCCESS;
+  }
+  memset(&stagingRow[stagingRowUsed], 0, CY_FLASH_SIZEOF_ROW - stagingRowUsed);
+  if (CySysFlashWriteRow(stagingRowNum, stagingRow) != CY_SYS_FLASH_SUCCESS) {
+    return FW_STORE_FAILURE;
+  }
+  stagingRowNum++;
+  stagingRowUsed = 0;
+  return FW_STORE_SUCCESS;
+}
+
+// Chunks arrive in order, so they are gathered into a row and the row is
+// written once it is full.
+static uint8_t stagingWrite(uint32_t offset, const uint8_t *pData, uint8_t length) {
+  uint16_t n;
+
+  if (offset != ((stagingRowNum - (FW_STAGING_FIRST_ROW + 1)) * CY_FLASH_SIZEOF_ROW) + stagingRowUsed) {
+    return FW_STORE_FAILURE;
+  }
+  while (length > 0) {
+    n = CY_FLASH_SIZEOF_ROW - stagingRowUsed;
+    if (n > length) {
+      n = length;
+    }
+    memcpy(&stagingRow[stagingRowUsed], pData, n);
+    stagingRowUsed += n;
+    pData += n;
+    length -= n;
+    if ((stagingRowUsed == CY_FLASH_SIZEOF_ROW) && (stagingFlushRow() != FW_STORE_SUCCESS)) {
+      return FW_STORE_FAILURE;
+    }
+  }
+  return FW_STORE_SUCCESS;
+}
+
+static uint8_t stagingFinish(void) {
+  return stagingFlushRow();
+}
+
+static uint8_t stagingRead(uint32_t offset, uint8_t *pData, uint8_t length) {
+  memcpy(pData, (const uint8_t *)(FW_STAGING_ADDRESS + CY_FLASH_SIZEOF_ROW + offset), length);
+  return FW_STORE_SUCCESS;
+}
+
+static const T_FwStore stagingStore = {
+    .capacity = (FW_STAGING_ROWS - 1) * CY_FLASH_SIZEOF_ROW,
+    .begin = stagingBegin,
+    .write = stagingWrite,
+    .finish = stagingFinish,
+    .read = stagingRead
+};
+
+static void fwSendStatus(const uint8_t *pStatus, uint8_t length) {
+  ChillHub.sendU8ArrayMsg(FW_UPDATE_STATUS_MSG, pStatus, length);
+}
+
+// The staged image is verified.  Describing it hands it to the bootloader,
+// which installs it on the way back from the reset.
+static void fwCommit(void) {
+  memset(stagingRow, 0, sizeof(stagingRow));
+  BtldrStage_Describe(stagingRow, fwUpdate.imageSize, fwUpdate.imageCrc);
+  if (CySysFlashWriteRow(FW_STAGING_FIRST_ROW, stagingRow) != CY_SYS_FLASH_SUCCESS) {
+    DebugUart_UartPutString("Firmware image verified, but it could not be handed over.\r\n");
+    return;
+  }
+  DebugUart_UartPutString("Firmware image verified, resetting to install it.\r\n");
+  CySoftwareReset();
+}
+
+static void fwStart(uint8_t dataType, void *pData) {
+  (void)dataType;
+  (void)pData;
+  FwUpdate_Start(&fwUpdate, ChillHub.getPayload());
+}
+
+static void fwData(uint8_t dataType, void *pData) {
+  (void)dataType;
+  (void)pData;
+  FwUpdate_Data(&fwUpdate, ChillHub.getPayload());
+}
+
+static void fwControl(uint8_t dataType, void *pData) {
+  (void)dataType;
+  (void)pData;
+  FwUpdate_Control(&fwUpdate, ChillHub.getPayload());
 }
 
 static const T_Serial uartInterface = {
@@ -112,17 +330,370 @@ enum {
 
 typedef enum cloudResorceId {
   weightID = 0x91,
-  calibrateID = 0x94
+  calibrateID = 0x94,
+  profileDumpID = 0x95,
+  diagnosticsID = 0x96,
+  telemetryID = 0x97,
+  linkTraceID = 0x98,
+  historyID = 0x99,
+  outboxID = 0x9a
 } T_cloudResourceId;
 
+// The telemetry frame on telemetryID, an array of U16: a sequence number,
+// the raw readings of channels A, B and C, their calibrated weights, the
+// total weight, the percent the weight resource shows and the drift of the
+// empty readings in counts a day, as a signed 16 bit value.
+enum {
+  telemetrySeq,
+  telemetryRawA,
+  telemetryRawB,
+  telemetryRawC,
+  telemetryWeightA,
+  telemetryWeightB,
+  telemetryWeightC,
+  telemetryTotal,
+  telemetryPercent,
+  telemetryZeroDrift,
+  TELEMETRY_COUNT
+};
+
+// Ticks between telemetry frames, 0 for none.  The hub sets it in seconds
+// with a U16 or U32 message on telemetryID.
+static uint32 telemetryPeriod = TELEMETRY_DEFAULT_PERIOD;
+static uint32 telemetryTicks = 0;
+static uint16_t telemetrySeqNumber = 0;
+
+// Cloud resources are published from the main loop, in one burst per pass.
+// The weight goes out when it moves by more than the two percent the sensors
+// wander, at most once a weight period and at least once a heartbeat period;
+// a calibrate reply goes out right away.
+static T_PublisherCB publisher;
+static const T_PublishPolicy weightPolicy = { WEIGHT_PRINT_PERIOD, WEIGHT_HEARTBEAT_PERIOD, 2 };
+static const T_PublishPolicy calibratePolicy = { 0, 0, 0 };
+
+static T_MeasureCB measure;
+static const T_MeasurePolicy measurePolicy = {
+  MEASURE_SETTLE_TICKS, MEASURE_SAMPLE_INTERVAL, MEASURE_MAX_VARIANCE, MEASURE_SAMPLES, MEASURE_RETRIES
+};
+
+// The empty and full readings follow the FSRs as they creep, from the
+// periodic readings while the scale is steadily empty or full: a minute
+// within 16 counts to settle, time constants of about 2 and 8 minutes,
+// stored when a limit moves 16 counts and the drift worked out over a day.
+static T_AutoZeroCB autoZero;
+static const T_AutoZeroPolicy autoZeroPolicy = { 86400000UL, 16, 16, 30, 6, 8 };
+
+static T_WallClockCB wallClock;
+static const T_WallClockPolicy wallClockPolicy = { WALLCLOCK_SYNC_INTERVAL, WALLCLOCK_TIMEOUT };
+
+static void wallClockAnswer(uint8_t dataType, unsigned char time[4]) {
+  uint32 ticksCopy;
+  (void)dataType;
+  
+	CyGlobalIntDisable;
+	ticksCopy = ticks;
+	CyGlobalIntEnable;
+  
+  WallClock_Response(&wallClock, time, ticksCopy);
+}
+
+static void requestWallClock(void) {
+  ChillHub.getTime((chillhubCallbackFunction)wallClockAnswer);
+}
+
+// The weight as it was published, kept on the device for the hub to fetch
+// after it has been away.
+static T_HistoryCB history;
+static uint32_t historySeconds = 0;
+static uint32 historyTicks = 0;
+
+// Seconds for the history, which go on from the last block kept in flash
+// across a reset.
+static uint32_t historyClock(void) {
+  uint32 ticksCopy;
+  uint32 elapsed;
+  
+	CyGlobalIntDisable;
+	ticksCopy = ticks;
+	CyGlobalIntEnable;
+  
+  elapsed = (ticksCopy - historyTicks) / 1000;
+  historySeconds += elapsed;
+  historyTicks += elapsed * 1000;
+  return historySeconds;
+}
+
+// Each block goes to the hub as one U8 array, after the seconds of the
+// history now so the hub can place the samples in time.
+static void sendHistoryBlock(const uint8_t *pBlock, uint8_t length) {
+  uint8_t frame[4 + HISTORY_BLOCK_SIZE];
+  uint32_t now = historySeconds;
+
+  frame[0] = (uint8_t)now;
+  frame[1] = (uint8_t)(now >> 8);
+  frame[2] = (uint8_t)(now >> 16);
+  frame[3] = (uint8_t)(now >> 24);
+  memcpy(&frame[4], pBlock, length);
+  ChillHub.sendU8ArrayMsg(historyID, frame, 4 + length);
+}
+
+// A U8, U16 or U32 on historyID fetches the history of that many seconds
+// back, 0 all of it.  An array of two U32 fetches the blocks with samples
+// from the first to the second, in the seconds the blocks are sent with.
+static void fetchHistory(uint8_t dataType, void *pData) {
+  (void)dataType;
+  (void)pData;
+  const T_ChillHubPayload *pPayload = ChillHub.getPayload();
+  T_ChillHubIter range;
+  T_ChillHubPayload element;
+  uint32_t back;
+  uint32_t since;
+  uint32_t until;
+  uint32_t now = historyClock();
+
+  if (ChillHubPayload_AsUnsigned(pPayload, &back)) {
+    since = ((back == 0) || (back > now)) ? 0 : now - back;
+    until = now;
+  } else if (!(ChillHubPayload_AsArray(pPayload, &range) && (range.elementType == unsigned32DataType) &&
+               (range.remaining == 2) &&
+               ChillHubIter_Next(&range, &element) && ChillHubPayload_AsU32(&element, &since) &&
+               ChillHubIter_Next(&range, &element) && ChillHubPayload_AsU32(&element, &until))) {
+    DebugUart_UartPutString("History fetch is neither unsigned nor a range.\r\n");
+    return;
+  }
+  History_Fetch(&history, since, until, sendHistoryBlock);
+}
+
+#ifdef HISTORY_FLASH_ENABLED
+static uint8_t historyRow = 0;
+
+static const uint8_t* historyFlashRow(uint8_t row) {
+  return (const uint8_t *)(CY_FLASH_BASE + ((HISTORY_FLASH_FIRST_ROW + row) * CY_FLASH_SIZEOF_ROW));
+}
+
+static uint32_t historyBlockSeconds(const uint8_t *pBlock) {
+  return pBlock[0] | (pBlock[1] << 8) | ((uint32_t)pBlock[2] << 16) | ((uint32_t)pBlock[3] << 24);
+}
+
+static uint16_t historyRowCrc(const uint8_t *pBlock) {
+  return crc_finalize(crc_update(crc_init(), pBlock, HISTORY_BLOCK_SIZE));
+}
+
+static void storeHistoryBlock(const uint8_t *pBlock) {
+  uint8_t row[CY_FLASH_SIZEOF_ROW];
+  uint16_t crc = historyRowCrc(pBlock);
+
+  memset(row, 0, sizeof(row));
+  memcpy(row, pBlock, HISTORY_BLOCK_SIZE);
+  row[HISTORY_BLOCK_SIZE] = (uint8_t)crc;
+  row[HISTORY_BLOCK_SIZE + 1] = (uint8_t)(crc >> 8);
+  CySysFlashWriteRow(HISTORY_FLASH_FIRST_ROW + historyRow, row);
+  historyRow = (historyRow + 1) % HISTORY_FLASH_ROWS;
+}
+
+// Gives the blocks with a good CRC back to the history, oldest first, and
+// carries on writing after the newest.
+static void restoreHistory(void) {
+  uint8_t restored[HISTORY_FLASH_ROWS];
+  uint8_t count = 0;
+  uint8_t row;
+
+  for (row = 0; row < HISTORY_FLASH_ROWS; row++) {
+    const uint8_t *pRow = historyFlashRow(row);
+    uint16_t crc = pRow[HISTORY_BLOCK_SIZE] | (pRow[HISTORY_BLOCK_SIZE + 1] << 8);
+
+    if (crc == historyRowCrc(pRow)) {
+      restored[count++] = row;
+    }
+  }
+  // the rows are a ring, so the oldest follows the newest
+  for (row = 0; row < count; row++) {
+    uint8_t n;
+    uint8_t oldest = row;
+
+    for (n = row + 1; n < count; n++) {
+      if ((int32_t)(historyBlockSeconds(historyFlashRow(restored[n])) -
+                    historyBlockSeconds(historyFlashRow(restored[oldest]))) < 0) {
+        oldest = n;
+      }
+    }
+    n = restored[row];
+    restored[row] = restored[oldest];
+    restored[oldest] = n;
+    if (History_Restore(&history, historyFlashRow(restored[row])) == HISTORY_SUCCESS) {
+      historyRow = (restored[row] + 1) % HISTORY_FLASH_ROWS;
+    }
+  }
+  if (History_LastSeconds(&history, &historySeconds)) {
+    historySeconds++;
+  }
+}
+#endif
+
+// Cloud resource updates, held while the hub is away.
+static T_OutboxCB outbox;
+static const T_OutboxPolicy outboxPolicy = { OUTBOX_REPLAY_INTERVAL, OUTBOX_CONFIRM_WINDOW, OUTBOX_MAX_BURST };
+
+static void sendLiveUpdate(uint8_t resID, uint16_t value) {
+  ChillHub.updateCloudResourceU16(resID, value);
+}
+
+// The updates the hub missed go as one U8 array, after the seconds of the
+// history now, like a history block.
+static void sendOutboxFrame(const uint8_t *pFrame, uint8_t length) {
+  uint8_t frame[4 + OUTBOX_MAX_BURST * OUTBOX_EVENT_SIZE];
+  uint32_t now = historyClock();
+
+  frame[0] = (uint8_t)now;
+  frame[1] = (uint8_t)(now >> 8);
+  frame[2] = (uint8_t)(now >> 16);
+  frame[3] = (uint8_t)(now >> 24);
+  memcpy(&frame[4], pFrame, length);
+  ChillHub.sendU8ArrayMsg(outboxID, frame, 4 + length);
+}
+
+static void sendCloudResource(uint8_t resID, uint16_t value) {
+  uint32_t seconds = historyClock();
+
+  Outbox_Put(&outbox, resID, value, seconds);
+  if (resID == weightID) {
+    History_Record(&history, seconds, value);
+  }
+}
+
+// Any message on diagnosticsID is answered with the link statistics.
+static void sendDiagnostics(uint8_t dataType, void *pData) {
+  (void)dataType;
+  (void)pData;
+
+  ChillHub.sendStats(diagnosticsID);
+}
+
+// A U8, U16 or U32 on telemetryID sets the telemetry period in seconds, 0
+// stops it.
+static void setTelemetryPeriod(uint8_t dataType, void *pData) {
+  (void)dataType;
+  (void)pData;
+  uint32_t seconds;
+
+  if (!ChillHubPayload_AsUnsigned(ChillHub.getPayload(), &seconds)) {
+    DebugUart_UartPutString("Telemetry period is not an unsigned number.\r\n");
+    return;
+  }
+
+  // deadlines more than half the tick range away would look past
+  if (seconds > (0x7fffffffUL / 1000)) {
+    seconds = 0x7fffffffUL / 1000;
+  }
+  telemetryPeriod = seconds * 1000;
+}
+
+#ifdef LINK_TRACE_ENABLED
+// Commands on linkTraceID, a U8.
+enum {
+  linkTraceStop,
+  linkTraceStart,
+  linkTraceDump
+};
+
+static T_LinkTraceCB linkTrace;
+
+static uint32_t linkTraceClock(void) {
+  uint32 ticksCopy;
+  
+	CyGlobalIntDisable;
+	ticksCopy = ticks;
+	CyGlobalIntEnable;
+  
+  return ticksCopy;
+}
+
+static void traceLink(T_ChillHubCB *pControlBlock, uint8_t direction, const uint8_t *pData, uint8_t length) {
+  (void)pControlBlock;
+  
+  LinkTrace_Record(&linkTrace, direction, pData, length);
+}
+
+static void printLinkTraceLine(const char *s) {
+  DebugUart_UartPutString(s);
+}
+
+// Starts and stops a capture of the link, or dumps it to the debug UART for
+// tools/chillhub/tracecap.  The capture goes on after a dump.
+static void linkTraceCommand(uint8_t dataType, void *pData) {
+  (void)dataType;
+  (void)pData;
+  uint8_t command;
+
+  if (!ChillHubPayload_AsU8(ChillHub.getPayload(), &command)) {
+    DebugUart_UartPutString("Link trace command is not a U8.\r\n");
+    return;
+  }
+
+  switch (command) {
+    case linkTraceStop:
+      LinkTrace_Stop(&linkTrace);
+      break;
+    case linkTraceStart:
+      LinkTrace_Start(&linkTrace);
+      break;
+    case linkTraceDump:
+      LinkTrace_Dump(&linkTrace, printLinkTraceLine);
+      break;
+    default:
+      DebugUart_UartPutString("Unknown link trace command.\r\n");
+      break;
+  }
+}
+#endif
+
+#ifdef LOCKIN_ENABLED
+// Scans per period of the excitation, which SampleStartDelay must match, and
+// periods per reading.
+#define LOCKIN_PHASES 16
+#define LOCKIN_PERIODS 32
+
+static T_LockInCB lockIn;
+
+// End of an ADC scan of the FSR channels, one phase of the excitation.
+CY_ISR(isr_adc_eos) {
+  int16_t samples[LOCKIN_CHANNELS];
+
+  samples[0] = ADC_GetResult16(WeightA_Channel);
+  samples[1] = ADC_GetResult16(WeightB_Channel);
+  samples[2] = ADC_GetResult16(WeightC_Channel);
+  LockIn_AddScan(&lockIn, samples);
+  ADC_SAR_INTR_REG = ADC_EOS_MASK;
+}
+#endif
+
+#ifdef PROFILE_ENABLED
+static void printProfileLine(const char *s) {
+  DebugUart_UartPutString(s);
+}
+
+// Any message on profileDumpID dumps the probes to the debug UART.
+static void profileDump(uint8_t dataType, void *pData) {
+  (void)dataType;
+  (void)pData;
+
+  Profile_Dump(printProfileLine);
+  Profile_Reset();
+}
+#endif
+
 void setDeviceUUID(uint8_t dataType, void *pData) {
   (void)dataType;
-  char *pUUID = (char*)pData;
-  uint8_t len = (uint8_t)pUUID[0];
-  char *pStr = &pUUID[1];
+  (void)pData;
+  const char *pChars;
+  char *pStr;
+  uint8_t len;
   
-  if (len <= MAX_UUID_LENGTH) {
-    // add null terminator
+  if (!ChillHubPayload_AsString(ChillHub.getPayload(), &pChars, &len)) {
+    DebugUart_UartPutString("Can't write UUID, it is not a string.\r\n");
+  } else if (len <= MAX_UUID_LENGTH) {
+    // add null terminator, in the receive buffer right after the string
+    pStr = (char *)pChars;
     pStr[len] = 0;
     EmNvMem_Write((const uint8_t *)pStr, (const uint8_t*)&eeprom.UUID, len+1);
     DebugUart_UartPutString("New UUID written to device.\r\n");
@@ -134,6 +705,26 @@ void setDeviceUUID(uint8_t dataType, void *pData) {
 static void hardwareSetup(void) {
   isr_timer_StartEx(isr_timer_interrupt);
   time_base_Start();
+  Tickless_Init(&tickless, time_base_ReadPeriod() + 1, TIME_BASE_COUNTER_MAX);
+  Profile_Init(timestampMicros);
+  FwUpdate_Init(&fwUpdate, &stagingStore, fwSendStatus, fwCommit);
+  Publisher_Init(&publisher, sendCloudResource);
+  Outbox_Init(&outbox, &outboxPolicy, sendLiveUpdate, sendOutboxFrame, 0);
+  Measure_Init(&measure, &measurePolicy, readFromSensors, milkWeightMeasured);
+  WallClock_Init(&wallClock, &wallClockPolicy, requestWallClock, 0);
+#ifdef HISTORY_FLASH_ENABLED
+  History_Init(&history, storeHistoryBlock);
+  restoreHistory();
+#else
+  History_Init(&history, NULL);
+#endif
+#ifdef LINK_TRACE_ENABLED
+  LinkTrace_Init(&linkTrace, linkTraceClock);
+  ChillHub.setTraceHook(traceLink);
+#endif
+#ifdef LOCKIN_ENABLED
+  LockIn_Init(&lockIn, LOCKIN_PHASES, LOCKIN_PERIODS);
+#endif
 
   Uart_Start();
   DebugUart_Start();
@@ -141,6 +732,9 @@ static void hardwareSetup(void) {
   Opamp_Start();
   ADC_Start();
   ADC_StartConvert();  
+#ifdef LOCKIN_ENABLED
+  ADC_IRQ_StartEx(isr_adc_eos);
+#endif
   SampleStartDelay_Start();
   UsbChipReset_Write(0);
   
@@ -149,56 +743,69 @@ static void hardwareSetup(void) {
     LO_MEAS[j] = eeprom.calValues.LO_MEAS[j];
     HI_MEAS[j] = eeprom.calValues.HI_MEAS[j];
   }
+  AutoZero_Init(&autoZero, &autoZeroPolicy, LO_MEAS, HI_MEAS, storeLimits);
   
 }
 
 static uint32_t keepAliveCheckTimer = 0;
+static uint32 resetStartTicks = 0;
+static uint32 buttonCheckTicks = 0;
+static uint32 weightPrintTicks = 0;
 
 void operateUsbReset(void) {
   uint32 ticksCopy;
-  static uint32 resetStartTicks=0;
 	
 	CyGlobalIntDisable;
 	ticksCopy = ticks;
 	CyGlobalIntEnable;
   
-  // Anything received in 10 seconds?
-	if ((ticksCopy-keepAliveCheckTimer) >= 20000)
-	{
-    DebugUart_UartPutString("No chillhub message received, resetting USB.\r\n");
-    // no, reset the USB
-    UsbChipReset_Write(0);
-    // Start the reset pin timer
-    resetStartTicks = ticksCopy;
-  }
-		
-	if ((ticksCopy-resetStartTicks) >= 500)
-	{
-    DebugUart_UartPutString("USB reset complete.\r\n");
-    UsbChipReset_Write(1);
-  }
-  
+  // The loop may have slept for a while, so only look at the timer that
+  // belongs to the current state of the reset pin.
   if (UsbChipReset_Read() == 1) {
-    resetStartTicks = ticksCopy;
+    // Anything received in 20 seconds?
+    if ((ticksCopy-keepAliveCheckTimer) >= KEEPALIVE_TIMEOUT)
+    {
+      DebugUart_UartPutString("No chillhub message received, resetting USB.\r\n");
+      // no, reset the USB
+      UsbChipReset_Write(0);
+      ChillHub.countUsbReset();
+      Outbox_LinkDown(&outbox);
+      // Start the reset pin timer
+      resetStartTicks = ticksCopy;
+    }
   } else {
-    keepAliveCheckTimer = ticksCopy;
+    if ((ticksCopy-resetStartTicks) >= USB_RESET_PULSE)
+    {
+      DebugUart_UartPutString("USB reset complete.\r\n");
+      UsbChipReset_Write(1);
+      keepAliveCheckTimer = ticksCopy;
+    }
   }
 }
 
 void keepaliveCallback(uint8_t dataType, void *pData) {
   (void)dataType;
   (void)pData;
+  uint32 ticksCopy;
   
   DebugUart_UartPutString("Keepalive message received from chillhub.\r\n");
   
 	CyGlobalIntDisable;
-	keepAliveCheckTimer = ticks;
+	ticksCopy = ticks;
 	CyGlobalIntEnable;
+  
+  keepAliveCheckTimer = ticksCopy;
+  Outbox_LinkUp(&outbox, ticksCopy);
 }
 
 void deviceAnnounce(uint8_t dataType, void *pData) { 
   (void)dataType;
   (void)pData;
+  uint32 ticksCopy;
+  
+	CyGlobalIntDisable;
+	ticksCopy = ticks;
+	CyGlobalIntEnable;
   
   DebugUart_UartPutString("\r\nRegistering with the chillhub.\r\n");
   
@@ -220,6 +827,28 @@ void deviceAnnounce(uint8_t dataType, void *pData) {
   DebugUart_UartPutString("\r\n");
   ChillHub.addCloudListener(calibrateID, &factoryCalibrate);
   ChillHub.createCloudResourceU16("calibrate", calibrateID, 1, 0);
+  Publisher_AddResource(&publisher, calibrateID, 0, &calibratePolicy, ticksCopy);
+
+  // let the hub poll the link statistics
+  ChillHub.addCloudListener(diagnosticsID, sendDiagnostics);
+
+  // and set the telemetry rate
+  ChillHub.addCloudListener(telemetryID, setTelemetryPeriod);
+
+  // and fetch the weight history
+  ChillHub.addCloudListener(historyID, fetchHistory);
+
+  // firmware transfer from the hub; a transfer in progress carries on
+  ChillHub.addCloudListener(FW_UPDATE_START_MSG, fwStart);
+  ChillHub.addCloudListener(FW_UPDATE_DATA_MSG, fwData);
+  ChillHub.addCloudListener(FW_UPDATE_CONTROL_MSG, fwControl);
+
+#ifdef PROFILE_ENABLED
+  ChillHub.addCloudListener(profileDumpID, profileDump);
+#endif
+#ifdef LINK_TRACE_ENABLED
+  ChillHub.addCloudListener(linkTraceID, linkTraceCommand);
+#endif
   
   DebugUart_UartPutString("Address of checkForReset: ");
   printU32(((uint32_t)(checkForReset)));
@@ -232,12 +861,16 @@ void deviceAnnounce(uint8_t dataType, void *pData) {
   
   // Create cloud resource for weight
   ChillHub.createCloudResourceU16("weight", weightID, FALSE, 0);
+  Publisher_AddResource(&publisher, weightID, 0, &weightPolicy, ticksCopy);
   
   // add a listener for setting the UUID of the device
   ChillHub.subscribe(setDeviceUUIDType, setDeviceUUID);
 
   DebugUart_UartPutString("Registration complete.\r\n");
 
+  // the hub is there, and gets what it missed from the main loop
+  Outbox_LinkUp(&outbox, ticksCopy);
+
   for (uint8_t j = 0; j < 3; j++) {
     DebugUart_UartPutString("Low ");
     printU8(j);
@@ -254,15 +887,14 @@ void deviceAnnounce(uint8_t dataType, void *pData) {
 
 static void checkForReset(void) {
   uint32 ticksCopy;
-  static uint32 oldTicks=0;
 	
 	CyGlobalIntDisable;
 	ticksCopy = ticks;
 	CyGlobalIntEnable;
 		
-	if ((ticksCopy-oldTicks) >= 1000)
+	if ((ticksCopy-buttonCheckTicks) >= BUTTON_CHECK_PERIOD)
 	{
-    oldTicks = ticksCopy;
+    buttonCheckTicks = ticksCopy;
 		if (UserButton_Read() == 0) {
 				if (buttonWasPressed < 5) {
 					buttonWasPressed++;
@@ -289,32 +921,97 @@ static void checkForReset(void) {
   }
 }
 
-static void sendWeight(uint32_t weight) {
+static uint16_t weightPercent(uint32_t weight) {
   uint16_t percent = (uint16_t)(weight/600);
   
   if (percent > 100) {
     percent = 100;
   }
-  DebugUart_UartPutString("Updating weight: ");
+  return percent;
+}
+
+static void publishWeight(uint32_t weight) {
+  uint16_t percent = weightPercent(weight);
+  
+  DebugUart_UartPutString("Publishing weight: ");
   printU16(percent);
   DebugUart_UartPutString("\r\n");
   
-  ChillHub.updateCloudResourceU16(weightID, percent);
+  Publisher_Publish(&publisher, weightID, percent);
+}
+
+// Replays the next updates the hub missed, once it is back and the frame
+// before has gone.
+static void forwardOutbox(void) {
+  uint32 ticksCopy;
+  
+	CyGlobalIntDisable;
+	ticksCopy = ticks;
+	CyGlobalIntEnable;
+  
+  Outbox_Poll(&outbox, ticksCopy);
+}
+
+// Takes the next sample of a measurement the door started, once it is due.
+static void measureMilkWeight(void) {
+  uint32 ticksCopy;
+  
+	CyGlobalIntDisable;
+	ticksCopy = ticks;
+	CyGlobalIntEnable;
+  
+  Measure_Poll(&measure, ticksCopy);
+}
+
+// Asks the hub for the time when the wall clock is due a sync.
+static void syncWallClock(void) {
+  uint32 ticksCopy;
+  
+	CyGlobalIntDisable;
+	ticksCopy = ticks;
+	CyGlobalIntEnable;
+  
+  WallClock_Poll(&wallClock, ticksCopy);
+}
+
+// Sends the cloud resources that are due, after the rest of the loop pass
+// has published what it has.
+static void flushCloudResources(void) {
+  uint32 ticksCopy;
+  
+	CyGlobalIntDisable;
+	ticksCopy = ticks;
+	CyGlobalIntEnable;
+  
+  Publisher_Flush(&publisher, ticksCopy);
+}
+
+// Whether the weight is close enough to empty or full for the limits to
+// follow the readings.
+static uint8_t weightZone(int32_t weight) {
+  if (weight < (EMPTY_WEIGHT + DIFF_THRESHOLD)) {
+    return AUTOZERO_EMPTY;
+  }
+  if (weight >= (FULL_WEIGHT - DIFF_THRESHOLD)) {
+    return AUTOZERO_FULL;
+  }
+  return AUTOZERO_LOADED;
 }
 
 void periodicPrintOfWeight(void) {
   uint32 ticksCopy;
-  static uint32 oldTicks=0;
   int32_t sensorReadings[3];
   int32_t weight;
+  int64_t time;
+  T_WallDate date;
   
 	CyGlobalIntDisable;
 	ticksCopy = ticks;
 	CyGlobalIntEnable;
 		
-	if ((ticksCopy-oldTicks) >= (2000))
+	if ((ticksCopy-weightPrintTicks) >= WEIGHT_PRINT_PERIOD)
 	{
-    oldTicks = ticksCopy;
+    weightPrintTicks = ticksCopy;
     
     readFromSensors(sensorReadings);
     
@@ -328,13 +1025,158 @@ void periodicPrintOfWeight(void) {
     printU16((uint16_t)sensorReadings[2]);
     DebugUart_UartPutString("\r\n");
     
+    if (WallClock_Now(&wallClock, ticksCopy, &time)) {
+      WallClock_ToDate(time, &date);
+      DebugUart_UartPutString("Time: ");
+      printU16(date.month);
+      DebugUart_UartPutString("/");
+      printU16(date.day);
+      DebugUart_UartPutString(" ");
+      printU16(date.hour);
+      DebugUart_UartPutString(":");
+      printU16(date.minute);
+      DebugUart_UartPutString(":");
+      printU16(date.second);
+      DebugUart_UartPutString("\r\n");
+    }
+    
     DebugUart_UartPutString("Milk weight: ");
     weight = calculateMilkWeight(sensorReadings);
     printU32(weight);
     DebugUart_UartPutString("\r\n");
     
-    sendWeight(weight);
+    AutoZero_Update(&autoZero, sensorReadings, weightZone(weight), ticksCopy);
+    
+    publishWeight(weight);
+  }
+}
+
+static uint16_t clampU16(int32_t value) {
+  if (value < 0) {
+    return 0;
+  }
+  if (value > 0xffff) {
+    return 0xffff;
+  }
+  return (uint16_t)value;
+}
+
+static uint16_t clampS16(int32_t value) {
+  if (value < -0x8000) {
+    return 0x8000;
+  }
+  if (value > 0x7fff) {
+    return 0x7fff;
+  }
+  return (uint16_t)(int16_t)value;
+}
+
+// All channels and the weight in one frame, instead of a resource update
+// for each of them.
+void periodicTelemetry(void) {
+  uint32 ticksCopy;
+  int32_t sensorReadings[3];
+  int32_t sensorWeights[3];
+  int32_t weight;
+  uint16_t telemetry[TELEMETRY_COUNT];
+  
+	CyGlobalIntDisable;
+	ticksCopy = ticks;
+	CyGlobalIntEnable;
+		
+	if ((telemetryPeriod != 0) && ((ticksCopy-telemetryTicks) >= telemetryPeriod))
+	{
+    telemetryTicks = ticksCopy;
+    
+    readFromSensors(sensorReadings);
+    applyFsrCurve(sensorWeights, sensorReadings);
+    weight = calculateMilkWeight(sensorReadings);
+    
+    telemetry[telemetrySeq] = telemetrySeqNumber++;
+    for (int j = 0; j < 3; j++) {
+      telemetry[telemetryRawA + j] = clampU16(sensorReadings[j]);
+      telemetry[telemetryWeightA + j] = clampU16(sensorWeights[j]);
+    }
+    telemetry[telemetryTotal] = clampU16(weight);
+    telemetry[telemetryPercent] = weightPercent(weight);
+    telemetry[telemetryZeroDrift] = clampS16(AutoZero_DriftPerDay(&autoZero));
+    
+    ChillHub.sendU16ArrayMsg(telemetryID, telemetry, TELEMETRY_COUNT);
+  }
+}
+
+static uint32 earlierDeadline(uint32 now, uint32 a, uint32 b) {
+  return (Tickless_TicksUntil(now, a) <= Tickless_TicksUntil(now, b)) ? a : b;
+}
+
+// The earliest tick at which one of the periodic jobs in the main loop is due.
+static uint32 nextDeadline(uint32 now) {
+  uint32 deadline = buttonCheckTicks + BUTTON_CHECK_PERIOD;
+  uint32 publishIn = Publisher_TicksUntilDue(&publisher, now);
+  uint32 measureIn = Measure_TicksUntilDue(&measure, now);
+  uint32 wallClockIn = WallClock_TicksUntilDue(&wallClock, now);
+  uint32 outboxIn = Outbox_TicksUntilDue(&outbox, now);
+
+  deadline = earlierDeadline(now, deadline, weightPrintTicks + WEIGHT_PRINT_PERIOD);
+  if (telemetryPeriod != 0) {
+    deadline = earlierDeadline(now, deadline, telemetryTicks + telemetryPeriod);
+  }
+  if (publishIn != PUBLISHER_NEVER) {
+    deadline = earlierDeadline(now, deadline, now + publishIn);
+  }
+  if (measureIn != MEASURE_NEVER) {
+    deadline = earlierDeadline(now, deadline, now + measureIn);
+  }
+  deadline = earlierDeadline(now, deadline, now + wallClockIn);
+  if (outboxIn != OUTBOX_NEVER) {
+    deadline = earlierDeadline(now, deadline, now + outboxIn);
+  }
+  if (UsbChipReset_Read() == 1) {
+    deadline = earlierDeadline(now, deadline, keepAliveCheckTimer + KEEPALIVE_TIMEOUT);
+  } else {
+    deadline = earlierDeadline(now, deadline, resetStartTicks + USB_RESET_PULSE);
+  }
+
+  return deadline;
+}
+
+// Sleep until the deadline or until any other interrupt (chillhub UART, ADC)
+// wakes the core.  The time base period is stretched to the deadline so the
+// core is not woken every tick, and the tick count is caught up on an early
+// wake so it stays monotonic and correct.
+static void sleepUntil(uint32 deadline) {
+  uint32 period;
+  uint32 counter;
+
+  CyGlobalIntDisable;
+
+  // Bytes that arrived after the last look at the UART are handled first.
+  if (Uart_SpiUartGetRxBufferSize() == 0) {
+    period = Tickless_PlanSleep(&tickless, deadline);
+    if (period != TICKLESS_NO_CHANGE) {
+      time_base_WritePeriod(period);
+      if ((time_base_GetInterruptSource() & time_base_INTR_MASK_TC) != 0) {
+        // a regular tick ended while the period was being stretched
+        time_base_WritePeriod(Tickless_CancelSleep(&tickless));
+      }
+    }
+
+    // Pending interrupts still end the sleep with interrupts masked; they are
+    // serviced once interrupts are enabled again below.
+    CySysPmSleep();
+
+    counter = time_base_ReadCounter();
+    if ((time_base_GetInterruptSource() & time_base_INTR_MASK_TC) == 0) {
+      period = Tickless_EarlyWake(&tickless, counter);
+      if (period != TICKLESS_NO_CHANGE) {
+        time_base_WritePeriod(period);
+        ticks = tickless.ticks;
+        timeBaseGeneration++;
+      }
+    }
   }
+
+  CyGlobalIntEnable;
 }
 
 void delayMS(uint32 waitTicks) 
@@ -349,6 +1191,7 @@ void delayMS(uint32 waitTicks)
 		
 	while ((ticksCopy-oldTicks) <= waitTicks)
 	{
+    sleepUntil(oldTicks + waitTicks + 1);
   	CyGlobalIntDisable;
   	ticksCopy = ticks;
   	CyGlobalIntEnable;
@@ -374,11 +1217,25 @@ int main()
   
 	for(;;)
 	{
+    uint32 ticksCopy;
+
 		ChillHub.loop();
     
     checkForReset();
     periodicPrintOfWeight();
+    periodicTelemetry();
+    measureMilkWeight();
+    syncWallClock();
+    flushCloudResources();
+    forwardOutbox();
     operateUsbReset();
+
+    if (ChillHub.isIdle()) {
+      CyGlobalIntDisable;
+      ticksCopy = ticks;
+      CyGlobalIntEnable;
+      sleepUntil(nextDeadline(ticksCopy));
+    }
   }
 }
 
@@ -398,39 +1255,44 @@ static int32_t calculateMilkWeight(int32_t *pSensorReadings) {
   return weight;
 }
 
-static int32_t getMilkWeight(void) {
-  int32_t sensorReadings[3];
-
-  readFromSensors(sensorReadings);
-  int32_t weight = calculateMilkWeight(sensorReadings);
-
-  if (weight >= (FULL_WEIGHT - DIFF_THRESHOLD)) {
-    for (int j = 0; j < 3; j++)
-      HI_MEAS[j] = sensorReadings[j];
-    storeLimits();
-  }
-  else if (weight < (EMPTY_WEIGHT + DIFF_THRESHOLD)) {
-    for (int j = 0; j < 3; j++)
-      LO_MEAS[j] = sensorReadings[j];
-    storeLimits();
-  }
-  
-  return weight;
+// The mean of a settled burst of readings after the door closed.  The
+// limits are left to autoZero, which follows them without a flash write on
+// every close.
+static void milkWeightMeasured(int32_t *pSensorReadings) {
+  publishWeight(calculateMilkWeight(pSensorReadings));
 }
 
 static void readMilkWeight(uint8_t dataType, void *pData) {
   (void)dataType;
-  unsigned char doorStatus = *(uint32_t*)pData;
-  uint8_t doorNowOpen = (doorStatus & 0x01);
+  (void)pData;
+  uint8_t doorStatus;
+  uint8_t doorNowOpen;
+  uint32 ticksCopy;
+  
+  if (!ChillHubPayload_AsU8(ChillHub.getPayload(), &doorStatus)) {
+    DebugUart_UartPutString("Door status is not a U8.\r\n");
+    return;
+  }
+  doorNowOpen = (doorStatus & 0x01);
+  
   
+	CyGlobalIntDisable;
+	ticksCopy = ticks;
+	CyGlobalIntEnable;
+  
+  // the jug has often just been put back; it is weighed from the main loop
+  // once it settles, and not while the door is open
   if (doorWasOpen && !doorNowOpen) {
-    
-    sendWeight(getMilkWeight());
+    Measure_Schedule(&measure, ticksCopy);
+  } else if (doorNowOpen) {
+    Measure_Cancel(&measure);
   }
   doorWasOpen = doorNowOpen;
 }
 
 static void applyFsrCurve(int32_t *pScaledVal, int32_t *pRawValue) {
+  PROFILE_BEGIN(applyFsrCurveProbe);
+
   for (int j = 0; j < 3; j++) {
     if (pRawValue[j] >= (int32_t)LO_MEAS[j]) {      
       pScaledVal[j] = (pRawValue[j] - LO_MEAS[j]) * W_MAX[j] / (HI_MEAS[j] - LO_MEAS[j]);
@@ -438,11 +1300,26 @@ static void applyFsrCurve(int32_t *pScaledVal, int32_t *pRawValue) {
       pScaledVal[j] = 0;
     }
   }
+
+  PROFILE_END(applyFsrCurveProbe);
 }
 
 static void readFromSensors(int32_t *paMeas) {
   int16_t meas;
   
+#ifdef LOCKIN_ENABLED
+  T_LockInCB lockInCopy;
+  
+	CyGlobalIntDisable;
+	lockInCopy = lockIn;
+	CyGlobalIntEnable;
+  
+  // the amplitude of the excitation on each FSR, once there is a reading
+  if (LockIn_Read(&lockInCopy, paMeas) > 0) {
+    return;
+  }
+#endif
+
   meas = ADC_GetResult16(WeightA_Channel);
   if (meas < 0) {meas = 0;}
   paMeas[0] = (int32_t)meas;
@@ -469,23 +1346,17 @@ static void storeLimits(void) {
 
 static void factoryCalibrate(uint8_t dataType, void *pData) {
   (void)dataType;
+  (void)pData;
   int32_t sensorReadings[3];
   uint32_t *pMeas;
-  uint8_t *pU8Data = pData;
   uint32_t which=0;
 
   DebugUart_UartPutString("Got a factory calibrate message.\r\n");
+  // the hub wrote the resource, so the reply is sent whatever it is
+  Publisher_Invalidate(&publisher, calibrateID);
   
-  switch(dataType) {
-    case unsigned32DataType:
-      which = (pU8Data[0] << 24 ) +
-              (pU8Data[1] << 16 ) +
-              (pU8Data[2] << 8 ) +
-               pU8Data[3];
-      break;
-     default:
-        DebugUart_UartPutString("Did not receive a U32.\r\n");
-        break;
+  if (!ChillHubPayload_AsU32(ChillHub.getPayload(), &which)) {
+    DebugUart_UartPutString("Did not receive a U32.\r\n");
   }
     
   DebugUart_UartPutString("Value is: ");
@@ -505,7 +1376,7 @@ static void factoryCalibrate(uint8_t dataType, void *pData) {
     
     default:
       // illegal value, reset to 0
-      ChillHub.updateCloudResourceU16(calibrateID, 0);
+      Publisher_Publish(&publisher, calibrateID, 0);
       return;
   }
   
@@ -516,8 +1387,9 @@ static void factoryCalibrate(uint8_t dataType, void *pData) {
   }
   
   storeLimits();
+  AutoZero_Restart(&autoZero);
   
-  ChillHub.updateCloudResourceU16(calibrateID, 0);
+  Publisher_Publish(&publisher, calibrateID, 0);
 
 }
 
@@ -0,0 +1,161 @@
+/*
+ * Deferred measurement of the jug once it has settled.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "measure.h"
+#include <stdlib.h>
+
+#ifndef FALSE
+#define FALSE 0
+#define TRUE !FALSE
+#endif
+
+uint8_t Measure_Init(T_MeasureCB *pControlBlock, const T_MeasurePolicy *pPolicy, void (*read)(int32_t *paMeas),
+                     void (*done)(int32_t *paMeas)) {
+   if ((pControlBlock == NULL) || (pPolicy == NULL) || (read == NULL) || (done == NULL)) {
+      return MEASURE_FAILURE;
+   }
+   if ((pPolicy->samplesPerBurst == 0) || (pPolicy->samplesPerBurst > MEASURE_MAX_SAMPLES)) {
+      return MEASURE_FAILURE;
+   }
+
+   pControlBlock->pPolicy = pPolicy;
+   pControlBlock->read = read;
+   pControlBlock->done = done;
+   pControlBlock->pending = FALSE;
+   pControlBlock->stats.scheduled = 0;
+   pControlBlock->stats.cancelled = 0;
+   pControlBlock->stats.bursts = 0;
+   pControlBlock->stats.rejected = 0;
+   pControlBlock->stats.measured = 0;
+   pControlBlock->stats.unsettled = 0;
+
+   return MEASURE_SUCCESS;
+}
+
+static void startBurst(T_MeasureCB *pControlBlock, uint32_t now) {
+   uint8_t j;
+
+   for (j = 0; j < MEASURE_CHANNELS; j++) {
+      pControlBlock->sum[j] = 0;
+      pControlBlock->sumSquares[j] = 0;
+   }
+   pControlBlock->sampleCount = 0;
+   pControlBlock->dueTicks = now + pControlBlock->pPolicy->settleTicks;
+}
+
+// Cheap enough for a chillhub callback: no sensor is read here.
+void Measure_Schedule(T_MeasureCB *pControlBlock, uint32_t now) {
+   pControlBlock->pending = TRUE;
+   pControlBlock->retries = 0;
+   startBurst(pControlBlock, now);
+   pControlBlock->stats.scheduled++;
+}
+
+void Measure_Cancel(T_MeasureCB *pControlBlock) {
+   if (pControlBlock->pending) {
+      pControlBlock->pending = FALSE;
+      pControlBlock->stats.cancelled++;
+   }
+}
+
+// Whether every channel stayed within maxVariance over the burst, from
+// n * sum(x^2) - sum(x)^2 = n^2 * variance.
+static uint8_t isQuiet(const T_MeasureCB *pControlBlock) {
+   int64_t n = pControlBlock->sampleCount;
+   int64_t limit = (int64_t)pControlBlock->pPolicy->maxVariance * n * n;
+   uint8_t j;
+
+   for (j = 0; j < MEASURE_CHANNELS; j++) {
+      int64_t sum = pControlBlock->sum[j];
+
+      if ((n * pControlBlock->sumSquares[j]) - (sum * sum) > limit) {
+         return FALSE;
+      }
+   }
+   return TRUE;
+}
+
+static void finishBurst(T_MeasureCB *pControlBlock, uint32_t now) {
+   const T_MeasurePolicy *pPolicy = pControlBlock->pPolicy;
+   int32_t mean[MEASURE_CHANNELS];
+   uint8_t quiet = isQuiet(pControlBlock);
+   uint8_t j;
+
+   pControlBlock->stats.bursts++;
+   if (!quiet) {
+      pControlBlock->stats.rejected++;
+      if (pControlBlock->retries < pPolicy->maxRetries) {
+         pControlBlock->retries++;
+         startBurst(pControlBlock, now);
+         return;
+      }
+      pControlBlock->stats.unsettled++;
+   }
+
+   for (j = 0; j < MEASURE_CHANNELS; j++) {
+      int32_t sum = pControlBlock->sum[j];
+      int32_t half = pControlBlock->sampleCount / 2;
+
+      mean[j] = ((sum < 0) ? (sum - half) : (sum + half)) / pControlBlock->sampleCount;
+   }
+   pControlBlock->pending = FALSE;
+   pControlBlock->stats.measured++;
+   pControlBlock->done(mean);
+}
+
+// Takes the sample that is due, if one is, and hands a finished measurement
+// to done.  Returns TRUE when it read the sensors.
+uint8_t Measure_Poll(T_MeasureCB *pControlBlock, uint32_t now) {
+   int32_t sample[MEASURE_CHANNELS];
+   uint8_t j;
+
+   if (Measure_TicksUntilDue(pControlBlock, now) != 0) {
+      return FALSE;
+   }
+
+   pControlBlock->read(sample);
+   for (j = 0; j < MEASURE_CHANNELS; j++) {
+      pControlBlock->sum[j] += sample[j];
+      pControlBlock->sumSquares[j] += (int64_t)sample[j] * sample[j];
+   }
+   pControlBlock->sampleCount++;
+   pControlBlock->dueTicks = now + pControlBlock->pPolicy->sampleInterval;
+
+   if (pControlBlock->sampleCount >= pControlBlock->pPolicy->samplesPerBurst) {
+      finishBurst(pControlBlock, now);
+   }
+   return TRUE;
+}
+
+// Ticks from now until the next sample, 0 if it is due.  A sample that is
+// late is due, as long as it is less than half the tick range late.
+uint32_t Measure_TicksUntilDue(const T_MeasureCB *pControlBlock, uint32_t now) {
+   uint32_t until;
+
+   if (!pControlBlock->pending) {
+      return MEASURE_NEVER;
+   }
+   until = pControlBlock->dueTicks - now;
+   return (until > 0x7fffffffUL) ? 0 : until;
+}
@@ -0,0 +1,93 @@
+/*
+ * Deferred measurement of the jug once it has settled.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * A door close only schedules a measurement; nothing is read from the
+ * sensors in the chillhub callback.  Measure_Poll, called from the main
+ * loop, waits settleTicks for the jug to stop rocking, then reads the
+ * sensors once every sampleInterval ticks until it has a burst of
+ * samplesPerBurst.  A burst in which any channel varies by more than
+ * maxVariance (in counts squared) is dropped and a new one taken after
+ * another settleTicks.  The mean of the first quiet burst goes to done;
+ * after maxRetries dropped bursts the last one goes to done anyway, so a
+ * fridge that never stops shaking still reports, and is counted as
+ * unsettled.
+ *
+ * Another close while a measurement is pending starts it over; an open
+ * cancels it.  Ticks are the millisecond ticks of the main loop and may
+ * wrap.
+ */
+
+#ifndef MEASURE_H
+#define MEASURE_H
+
+#include <stdint.h>
+
+#define MEASURE_CHANNELS 3
+#define MEASURE_MAX_SAMPLES 32
+
+// Returned by Measure_TicksUntilDue when no measurement is pending.
+#define MEASURE_NEVER 0xffffffffUL
+
+typedef struct T_MeasurePolicy {
+   uint32_t settleTicks;
+   uint32_t sampleInterval;
+   uint32_t maxVariance;
+   uint8_t samplesPerBurst;
+   uint8_t maxRetries;
+} T_MeasurePolicy;
+
+typedef struct T_MeasureStats {
+   uint32_t scheduled;
+   uint32_t cancelled;
+   uint32_t bursts;
+   uint32_t rejected;
+   uint32_t measured;
+   uint32_t unsettled;
+} T_MeasureStats;
+
+typedef struct T_MeasureCB {
+   const T_MeasurePolicy *pPolicy;
+   void (*read)(int32_t *paMeas);
+   void (*done)(int32_t *paMeas);
+   uint32_t dueTicks;
+   int32_t sum[MEASURE_CHANNELS];
+   int64_t sumSquares[MEASURE_CHANNELS];
+   uint8_t pending;
+   uint8_t sampleCount;
+   uint8_t retries;
+   T_MeasureStats stats;
+} T_MeasureCB;
+
+#define MEASURE_FAILURE 0
+#define MEASURE_SUCCESS 1
+
+uint8_t Measure_Init(T_MeasureCB *pControlBlock, const T_MeasurePolicy *pPolicy, void (*read)(int32_t *paMeas),
+                     void (*done)(int32_t *paMeas));
+void Measure_Schedule(T_MeasureCB *pControlBlock, uint32_t now);
+void Measure_Cancel(T_MeasureCB *pControlBlock);
+uint8_t Measure_Poll(T_MeasureCB *pControlBlock, uint32_t now);
+uint32_t Measure_TicksUntilDue(const T_MeasureCB *pControlBlock, uint32_t now);
+
+#endif
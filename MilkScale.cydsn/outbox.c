@@ -0,0 +1,191 @@
+/*
+ * Store and forward of cloud resource updates while the hub is away.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "outbox.h"
+#include <stdlib.h>
+
+#ifndef FALSE
+#define FALSE 0
+#define TRUE !FALSE
+#endif
+
+uint8_t Outbox_Init(T_OutboxCB *pControlBlock, const T_OutboxPolicy *pPolicy,
+                    void (*send)(uint8_t resID, uint16_t value),
+                    void (*replay)(const uint8_t *pFrame, uint8_t length), uint32_t now) {
+   if ((pControlBlock == NULL) || (pPolicy == NULL) || (send == NULL) || (replay == NULL) ||
+       (pPolicy->burst == 0) || (pPolicy->burst > OUTBOX_MAX_BURST)) {
+      return OUTBOX_FAILURE;
+   }
+
+   pControlBlock->pPolicy = pPolicy;
+   pControlBlock->send = send;
+   pControlBlock->replay = replay;
+   pControlBlock->first = 0;
+   pControlBlock->count = 0;
+   pControlBlock->unconfirmed = 0;
+   pControlBlock->linkUp = TRUE;
+   pControlBlock->heardTicks = now;
+   pControlBlock->replayTicks = now - pPolicy->replayInterval;
+   pControlBlock->stats.sent = 0;
+   pControlBlock->stats.queued = 0;
+   pControlBlock->stats.coalesced = 0;
+   pControlBlock->stats.replayed = 0;
+   pControlBlock->stats.resent = 0;
+   pControlBlock->stats.confirmed = 0;
+   pControlBlock->stats.dropped = 0;
+   pControlBlock->stats.droppedUnconfirmed = 0;
+   pControlBlock->stats.outages = 0;
+
+   return OUTBOX_SUCCESS;
+}
+
+static T_OutboxEvent* eventAt(T_OutboxCB *pControlBlock, uint8_t n) {
+   return &pControlBlock->events[(pControlBlock->first + n) % OUTBOX_EVENTS];
+}
+
+// Frees the oldest slots: the unconfirmed updates come first in the ring.
+static void release(T_OutboxCB *pControlBlock, uint8_t n) {
+   pControlBlock->first = (pControlBlock->first + n) % OUTBOX_EVENTS;
+   pControlBlock->count -= n;
+}
+
+// The unconfirmed updates go back to waiting, to be replayed.
+static void requeueUnconfirmed(T_OutboxCB *pControlBlock) {
+   pControlBlock->stats.resent += pControlBlock->unconfirmed;
+   pControlBlock->unconfirmed = 0;
+}
+
+uint8_t Outbox_Waiting(const T_OutboxCB *pControlBlock) {
+   return pControlBlock->count - pControlBlock->unconfirmed;
+}
+
+// Whether the last update waiting for the resource has the value.
+static uint8_t isRepeat(T_OutboxCB *pControlBlock, uint8_t resID, uint16_t value) {
+   uint8_t n;
+
+   for (n = pControlBlock->count; n > pControlBlock->unconfirmed; n--) {
+      const T_OutboxEvent *pEvent = eventAt(pControlBlock, n - 1);
+
+      if (pEvent->resID == resID) {
+         return pEvent->value == value;
+      }
+   }
+   return FALSE;
+}
+
+void Outbox_Put(T_OutboxCB *pControlBlock, uint8_t resID, uint16_t value, uint32_t seconds) {
+   uint8_t live = pControlBlock->linkUp && (Outbox_Waiting(pControlBlock) == 0);
+   T_OutboxEvent *pEvent;
+
+   if (!live && isRepeat(pControlBlock, resID, value)) {
+      pControlBlock->stats.coalesced++;
+      return;
+   }
+   if (pControlBlock->count == OUTBOX_EVENTS) {
+      if (pControlBlock->unconfirmed != 0) {
+         pControlBlock->unconfirmed--;
+         pControlBlock->stats.droppedUnconfirmed++;
+      } else {
+         pControlBlock->stats.dropped++;
+      }
+      release(pControlBlock, 1);
+   }
+
+   pEvent = eventAt(pControlBlock, pControlBlock->count++);
+   pEvent->seconds = seconds;
+   pEvent->value = value;
+   pEvent->resID = resID;
+
+   if (live) {
+      pControlBlock->send(resID, value);
+      pControlBlock->unconfirmed++;
+      pControlBlock->stats.sent++;
+   } else {
+      pControlBlock->stats.queued++;
+   }
+}
+
+// A keepalive or device ID request from the hub.
+void Outbox_LinkUp(T_OutboxCB *pControlBlock, uint32_t now) {
+   if (pControlBlock->linkUp && ((now - pControlBlock->heardTicks) <= pControlBlock->pPolicy->confirmWindow)) {
+      pControlBlock->stats.confirmed += pControlBlock->unconfirmed;
+      release(pControlBlock, pControlBlock->unconfirmed);
+      pControlBlock->unconfirmed = 0;
+   } else {
+      requeueUnconfirmed(pControlBlock);
+   }
+   pControlBlock->linkUp = TRUE;
+   pControlBlock->heardTicks = now;
+}
+
+void Outbox_LinkDown(T_OutboxCB *pControlBlock) {
+   if (pControlBlock->linkUp) {
+      pControlBlock->linkUp = FALSE;
+      pControlBlock->stats.outages++;
+      requeueUnconfirmed(pControlBlock);
+   }
+}
+
+static void putEvent(uint8_t *pOut, const T_OutboxEvent *pEvent) {
+   pOut[0] = pEvent->resID;
+   pOut[1] = (uint8_t)pEvent->value;
+   pOut[2] = (uint8_t)(pEvent->value >> 8);
+   pOut[3] = (uint8_t)pEvent->seconds;
+   pOut[4] = (uint8_t)(pEvent->seconds >> 8);
+   pOut[5] = (uint8_t)(pEvent->seconds >> 16);
+   pOut[6] = (uint8_t)(pEvent->seconds >> 24);
+}
+
+// Replays the next waiting updates if the link is up and the last frame
+// went out replayInterval ago.  Returns how many went out.
+uint8_t Outbox_Poll(T_OutboxCB *pControlBlock, uint32_t now) {
+   uint8_t frame[OUTBOX_MAX_BURST * OUTBOX_EVENT_SIZE];
+   uint8_t count = Outbox_Waiting(pControlBlock);
+   uint8_t n;
+
+   if (Outbox_TicksUntilDue(pControlBlock, now) != 0) {
+      return 0;
+   }
+   if (count > pControlBlock->pPolicy->burst) {
+      count = pControlBlock->pPolicy->burst;
+   }
+   for (n = 0; n < count; n++) {
+      putEvent(&frame[n * OUTBOX_EVENT_SIZE], eventAt(pControlBlock, pControlBlock->unconfirmed + n));
+   }
+   pControlBlock->replay(frame, count * OUTBOX_EVENT_SIZE);
+   pControlBlock->unconfirmed += count;
+   pControlBlock->replayTicks = now;
+   pControlBlock->stats.replayed += count;
+
+   return count;
+}
+
+uint32_t Outbox_TicksUntilDue(const T_OutboxCB *pControlBlock, uint32_t now) {
+   uint32_t since = now - pControlBlock->replayTicks;
+
+   if (!pControlBlock->linkUp || (Outbox_Waiting(pControlBlock) == 0)) {
+      return OUTBOX_NEVER;
+   }
+   return (since >= pControlBlock->pPolicy->replayInterval) ? 0 : (pControlBlock->pPolicy->replayInterval - since);
+}
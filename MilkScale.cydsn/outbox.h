@@ -0,0 +1,118 @@
+/*
+ * Store and forward of cloud resource updates while the hub is away.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Every update of a cloud resource goes through the outbox, with the second
+ * it was made.  While the link is up and nothing is waiting it is sent at
+ * once through send and kept as unconfirmed; the next keepalive confirms it
+ * and frees its slot.  A keepalive that comes more than confirmWindow ticks
+ * after the one before may follow a gap in which the hub missed frames, so
+ * the unconfirmed updates are sent again instead.
+ *
+ * Once the link is declared down (Outbox_LinkDown, when the keepalive has
+ * been missing long enough for the USB to be reset) the unconfirmed updates
+ * go back to waiting, and new ones wait behind them.  The next keepalive or
+ * device ID request brings the link up, and Outbox_Poll replays the waiting
+ * updates oldest first, up to burst of them every replayInterval ticks, as
+ * one frame of OUTBOX_EVENT_SIZE bytes each:
+ *
+ *   resID, value (LE16), seconds (LE32)
+ *
+ * which replay sends on.  Updates made while some are waiting join the end
+ * of the queue, so the hub gets them in order.  An update of the same value
+ * as the last one waiting for its resource (a heartbeat) is not queued.
+ * When all OUTBOX_EVENTS slots are taken the oldest update goes.
+ *
+ * Updates replayed may reach the hub twice; the resource and the second
+ * tell them apart.  Ticks are the millisecond ticks of the main loop and may
+ * wrap.
+ */
+
+#ifndef OUTBOX_H
+#define OUTBOX_H
+
+#include <stdint.h>
+
+#define OUTBOX_EVENTS 24
+#define OUTBOX_EVENT_SIZE 7
+
+// The most updates in a frame: with the 4 bytes the application puts in
+// front, what fits in a U8 array message.
+#define OUTBOX_MAX_BURST 7
+
+// Returned by Outbox_TicksUntilDue when nothing is waiting to be replayed.
+#define OUTBOX_NEVER 0xffffffffUL
+
+typedef struct T_OutboxPolicy {
+   uint32_t replayInterval;
+   uint32_t confirmWindow;
+   uint8_t burst;
+} T_OutboxPolicy;
+
+typedef struct T_OutboxEvent {
+   uint32_t seconds;
+   uint16_t value;
+   uint8_t resID;
+} T_OutboxEvent;
+
+typedef struct T_OutboxStats {
+   uint32_t sent;
+   uint32_t queued;
+   uint32_t coalesced;
+   uint32_t replayed;
+   uint32_t resent;
+   uint32_t confirmed;
+   uint32_t dropped;
+   uint32_t droppedUnconfirmed;
+   uint32_t outages;
+} T_OutboxStats;
+
+typedef struct T_OutboxCB {
+   const T_OutboxPolicy *pPolicy;
+   void (*send)(uint8_t resID, uint16_t value);
+   void (*replay)(const uint8_t *pFrame, uint8_t length);
+   T_OutboxEvent events[OUTBOX_EVENTS];
+   uint8_t first;
+   uint8_t count;
+   uint8_t unconfirmed;
+   uint8_t linkUp;
+   uint32_t heardTicks;
+   uint32_t replayTicks;
+   T_OutboxStats stats;
+} T_OutboxCB;
+
+#define OUTBOX_FAILURE 0
+#define OUTBOX_SUCCESS 1
+
+uint8_t Outbox_Init(T_OutboxCB *pControlBlock, const T_OutboxPolicy *pPolicy,
+                    void (*send)(uint8_t resID, uint16_t value),
+                    void (*replay)(const uint8_t *pFrame, uint8_t length), uint32_t now);
+void Outbox_Put(T_OutboxCB *pControlBlock, uint8_t resID, uint16_t value, uint32_t seconds);
+void Outbox_LinkUp(T_OutboxCB *pControlBlock, uint32_t now);
+void Outbox_LinkDown(T_OutboxCB *pControlBlock);
+uint8_t Outbox_Waiting(const T_OutboxCB *pControlBlock);
+uint8_t Outbox_Poll(T_OutboxCB *pControlBlock, uint32_t now);
+uint32_t Outbox_TicksUntilDue(const T_OutboxCB *pControlBlock, uint32_t now);
+
+#endif
@@ -0,0 +1,185 @@
+/*
+ * Lightweight named timing probes.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "profile.h"
+#include <stdlib.h>
+
+#ifdef PROFILE_HOST_CLOCK
+#include <time.h>
+#endif
+
+static T_ProfileClock profileClock = NULL;
+static T_ProfileProbe *probeList = NULL;
+
+// Also forgets every probe recorded so far.
+void Profile_Init(T_ProfileClock clock) {
+   profileClock = clock;
+   probeList = NULL;
+}
+
+uint32_t Profile_Now(void) {
+   if (profileClock == NULL) {
+      return 0;
+   }
+
+   return profileClock();
+}
+
+// Histogram bucket 0 holds zero durations, bucket n holds 2^(n-1) up to
+// 2^n - 1 microseconds, and the last bucket everything longer.
+uint8_t Profile_Bucket(uint32_t duration) {
+   uint8_t bucket = 0;
+
+   while ((duration != 0) && (bucket < (PROFILE_HISTOGRAM_BUCKETS - 1))) {
+      duration >>= 1;
+      bucket++;
+   }
+
+   return bucket;
+}
+
+void Profile_Add(T_ProfileProbe *pProbe, uint32_t duration) {
+   uint8_t bucket;
+
+   if (pProbe == NULL) {
+      return;
+   }
+
+   if (!pProbe->registered) {
+      pProbe->registered = 1;
+      pProbe->next = probeList;
+      probeList = pProbe;
+   }
+
+   if ((pProbe->count == 0) || (duration < pProbe->min)) {
+      pProbe->min = duration;
+   }
+   if (duration > pProbe->max) {
+      pProbe->max = duration;
+   }
+   pProbe->count++;
+   pProbe->total += duration;
+
+   bucket = Profile_Bucket(duration);
+   if (pProbe->histogram[bucket] != 0xffff) {
+      pProbe->histogram[bucket]++;
+   }
+}
+
+void Profile_Record(T_ProfileProbe *pProbe, uint32_t start) {
+   // unsigned subtraction keeps this right across a clock wrap
+   Profile_Add(pProbe, Profile_Now() - start);
+}
+
+void Profile_Reset(void) {
+   T_ProfileProbe *pProbe;
+   uint8_t i;
+
+   for (pProbe = probeList; pProbe != NULL; pProbe = pProbe->next) {
+      pProbe->count = 0;
+      pProbe->min = 0;
+      pProbe->max = 0;
+      pProbe->total = 0;
+      for (i = 0; i < PROFILE_HISTOGRAM_BUCKETS; i++) {
+         pProbe->histogram[i] = 0;
+      }
+   }
+}
+
+// Appends the decimal form of val and returns the new end of the string.
+static char *appendU32(char *p, uint32_t val) {
+   char digits[10];
+   uint8_t n = 0;
+
+   do {
+      digits[n++] = '0' + (val % 10);
+      val /= 10;
+   } while (val != 0);
+
+   while (n > 0) {
+      *p++ = digits[--n];
+   }
+
+   return p;
+}
+
+static char *appendString(char *p, const char *s) {
+   while (*s != 0) {
+      *p++ = *s++;
+   }
+
+   return p;
+}
+
+void Profile_Dump(T_ProfilePrint print) {
+   T_ProfileProbe *pProbe;
+   char line[32];
+   char *p;
+   uint8_t i;
+
+   if (print == NULL) {
+      return;
+   }
+
+   print("Profile (us):\r\n");
+   for (pProbe = probeList; pProbe != NULL; pProbe = pProbe->next) {
+      print(pProbe->name);
+
+      p = appendString(line, ": n=");
+      p = appendU32(p, pProbe->count);
+      *p = 0;
+      print(line);
+
+      p = appendString(line, " min=");
+      p = appendU32(p, pProbe->min);
+      p = appendString(p, " max=");
+      p = appendU32(p, pProbe->max);
+      *p = 0;
+      print(line);
+
+      p = appendString(line, " avg=");
+      p = appendU32(p, (pProbe->count != 0) ? (uint32_t)(pProbe->total / pProbe->count) : 0);
+      p = appendString(p, "\r\n  log2:");
+      *p = 0;
+      print(line);
+
+      for (i = 0; i < PROFILE_HISTOGRAM_BUCKETS; i++) {
+         p = appendString(line, " ");
+         p = appendU32(p, pProbe->histogram[i]);
+         *p = 0;
+         print(line);
+      }
+      print("\r\n");
+   }
+}
+
+#ifdef PROFILE_HOST_CLOCK
+uint32_t Profile_HostClock(void) {
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return (uint32_t)(((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000));
+}
+#endif
@@ -0,0 +1,104 @@
+/*
+ * Lightweight named timing probes.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * A probe accumulates count, min, max and total duration plus a log2
+ * histogram of the durations it has seen.  Durations are in microseconds from
+ * the clock handed to Profile_Init: the time base on the target, or
+ * clock_gettime on the host when built with PROFILE_HOST_CLOCK.
+ *
+ * Probes only exist when PROFILE_ENABLED is defined; otherwise the macros
+ * compile to nothing so the hot paths carry no cost.
+ *
+ *   PROFILE_PROBE(sendProbe, "sendPacket");
+ *
+ *   PROFILE_BEGIN(sendProbe);
+ *   ...
+ *   PROFILE_END(sendProbe);
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PROFILE_HISTOGRAM_BUCKETS 16
+
+typedef uint32_t (*T_ProfileClock)(void);
+typedef void (*T_ProfilePrint)(const char *s);
+
+typedef struct T_ProfileProbe {
+   const char *name;
+   uint32_t count;
+   uint32_t min;
+   uint32_t max;
+   uint64_t total;
+   uint16_t histogram[PROFILE_HISTOGRAM_BUCKETS];
+   struct T_ProfileProbe *next;
+   uint8_t registered;
+} T_ProfileProbe;
+
+void Profile_Init(T_ProfileClock clock);
+uint32_t Profile_Now(void);
+void Profile_Record(T_ProfileProbe *pProbe, uint32_t start);
+void Profile_Add(T_ProfileProbe *pProbe, uint32_t duration);
+uint8_t Profile_Bucket(uint32_t duration);
+void Profile_Reset(void);
+void Profile_Dump(T_ProfilePrint print);
+
+#ifdef PROFILE_HOST_CLOCK
+uint32_t Profile_HostClock(void);
+#endif
+
+#ifdef PROFILE_ENABLED
+  #define PROFILE_PROBE(probe, probeName) static T_ProfileProbe probe = { probeName, 0, 0, 0, 0, { 0 }, 0, 0 }
+  #define PROFILE_BEGIN(probe) uint32_t probe##Start = Profile_Now()
+  #define PROFILE_END(probe) Profile_Record(&probe, probe##Start)
+#else
+  #define PROFILE_PROBE(probe, probeName) extern T_ProfileProbe probe
+  #define PROFILE_BEGIN(probe) do {} while (0)
+  #define PROFILE_END(probe) do {} while (0)
+#endif
+
+#ifdef __cplusplus
+}           /* closing brace for extern "C" */
+
+// Records the lifetime of the enclosing scope into a probe.
+class ProfileScope {
+public:
+   explicit ProfileScope(T_ProfileProbe &probe) : probe_(probe), start_(Profile_Now()) {}
+   ~ProfileScope() { Profile_Record(&probe_, start_); }
+private:
+   ProfileScope(const ProfileScope &);
+   ProfileScope &operator=(const ProfileScope &);
+   T_ProfileProbe &probe_;
+   uint32_t start_;
+};
+#endif
+
+#endif
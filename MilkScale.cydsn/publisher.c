@@ -0,0 +1,180 @@
+/*
+ * Coalescing, rate limited publisher for cloud resources.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "publisher.h"
+#include <stdlib.h>
+
+#ifndef FALSE
+#define FALSE 0
+#define TRUE !FALSE
+#endif
+
+uint8_t Publisher_Init(T_PublisherCB *pControlBlock, void (*send)(uint8_t resID, uint16_t value)) {
+   if ((pControlBlock == NULL) || (send == NULL)) {
+      return PUBLISHER_FAILURE;
+   }
+
+   pControlBlock->send = send;
+   pControlBlock->resourceCount = 0;
+   pControlBlock->stats.published = 0;
+   pControlBlock->stats.sent = 0;
+   pControlBlock->stats.heartbeats = 0;
+   pControlBlock->stats.bursts = 0;
+
+   return PUBLISHER_SUCCESS;
+}
+
+static T_PublishedResource *findResource(const T_PublisherCB *pControlBlock, uint8_t resID) {
+   uint8_t i;
+
+   for (i = 0; i < pControlBlock->resourceCount; i++) {
+      if (pControlBlock->resources[i].resID == resID) {
+         return (T_PublishedResource *)&pControlBlock->resources[i];
+      }
+   }
+   return NULL;
+}
+
+// Adding a resource again, after the link registered it anew, starts it over
+// from the value the cloud was given.
+uint8_t Publisher_AddResource(T_PublisherCB *pControlBlock, uint8_t resID, uint16_t cloudValue,
+                              const T_PublishPolicy *pPolicy, uint32_t now) {
+   T_PublishedResource *pResource = findResource(pControlBlock, resID);
+
+   if (pPolicy == NULL) {
+      return PUBLISHER_FAILURE;
+   }
+   if (pResource == NULL) {
+      if (pControlBlock->resourceCount >= PUBLISHER_MAX_RESOURCES) {
+         return PUBLISHER_FAILURE;
+      }
+      pResource = &pControlBlock->resources[pControlBlock->resourceCount++];
+   }
+
+   pResource->pPolicy = pPolicy;
+   pResource->resID = resID;
+   pResource->sentValue = cloudValue;
+   pResource->value = cloudValue;
+   pResource->sentTicks = now;
+   pResource->hasValue = FALSE;
+   pResource->cloudUnknown = FALSE;
+
+   return PUBLISHER_SUCCESS;
+}
+
+uint8_t Publisher_Publish(T_PublisherCB *pControlBlock, uint8_t resID, uint16_t value) {
+   T_PublishedResource *pResource = findResource(pControlBlock, resID);
+
+   if (pResource == NULL) {
+      return PUBLISHER_FAILURE;
+   }
+
+   pResource->value = value;
+   pResource->hasValue = TRUE;
+   pControlBlock->stats.published++;
+
+   return PUBLISHER_SUCCESS;
+}
+
+void Publisher_Invalidate(T_PublisherCB *pControlBlock, uint8_t resID) {
+   T_PublishedResource *pResource = findResource(pControlBlock, resID);
+
+   if (pResource != NULL) {
+      pResource->cloudUnknown = TRUE;
+   }
+}
+
+static uint8_t hasChanged(const T_PublishedResource *pResource) {
+   uint16_t distance;
+
+   if (!pResource->hasValue) {
+      return FALSE;
+   }
+   if (pResource->cloudUnknown) {
+      return TRUE;
+   }
+   distance = (pResource->value > pResource->sentValue) ?
+      (pResource->value - pResource->sentValue) : (pResource->sentValue - pResource->value);
+   return distance > pResource->pPolicy->deadband;
+}
+
+// Ticks from now until the resource is due, 0 if it is, PUBLISHER_NEVER if
+// it will not be without another publish.
+static uint32_t ticksUntilDue(const T_PublishedResource *pResource, uint32_t now) {
+   uint32_t since = now - pResource->sentTicks;
+   uint32_t until = PUBLISHER_NEVER;
+
+   if (hasChanged(pResource)) {
+      until = (since >= pResource->pPolicy->minInterval) ? 0 : (pResource->pPolicy->minInterval - since);
+   }
+   if (pResource->hasValue && (pResource->pPolicy->maxStaleness != 0)) {
+      uint32_t stale = (since >= pResource->pPolicy->maxStaleness) ? 0 : (pResource->pPolicy->maxStaleness - since);
+
+      if (stale < until) {
+         until = stale;
+      }
+   }
+   return until;
+}
+
+// Sends everything that is due, back to back.  Returns how many went out.
+uint8_t Publisher_Flush(T_PublisherCB *pControlBlock, uint32_t now) {
+   uint8_t count = 0;
+   uint8_t i;
+
+   for (i = 0; i < pControlBlock->resourceCount; i++) {
+      T_PublishedResource *pResource = &pControlBlock->resources[i];
+
+      if (ticksUntilDue(pResource, now) == 0) {
+         if (!hasChanged(pResource)) {
+            pControlBlock->stats.heartbeats++;
+         }
+         pControlBlock->send(pResource->resID, pResource->value);
+         pResource->sentValue = pResource->value;
+         pResource->sentTicks = now;
+         pResource->cloudUnknown = FALSE;
+         count++;
+      }
+   }
+
+   if (count != 0) {
+      pControlBlock->stats.sent += count;
+      pControlBlock->stats.bursts++;
+   }
+   return count;
+}
+
+uint32_t Publisher_TicksUntilDue(const T_PublisherCB *pControlBlock, uint32_t now) {
+   uint32_t until = PUBLISHER_NEVER;
+   uint8_t i;
+
+   for (i = 0; i < pControlBlock->resourceCount; i++) {
+      uint32_t resourceUntil = ticksUntilDue(&pControlBlock->resources[i], now);
+
+      if (resourceUntil < until) {
+         until = resourceUntil;
+      }
+   }
+   return until;
+}
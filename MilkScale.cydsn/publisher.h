@@ -0,0 +1,93 @@
+/*
+ * Coalescing, rate limited publisher for cloud resources.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * The application publishes the latest value of a cloud resource whenever
+ * it has one; nothing goes out on the link then.  Publisher_Flush, called
+ * from the main loop, sends every resource that is due in one burst:
+ *
+ *   - a value never sent, or one that moved more than the deadband from the
+ *     value the cloud holds, once minInterval ticks have passed since the
+ *     last send;
+ *   - the current value as a heartbeat once maxStaleness ticks have passed
+ *     since the last send, 0 for none.
+ *
+ * When the cloud writes a resource itself (a calibrate request) the value it
+ * holds is no longer known; Publisher_Invalidate makes the next publish of
+ * that resource a change whatever its value.  Ticks are the
+ * millisecond ticks of the main loop and may wrap.
+ */
+
+#ifndef PUBLISHER_H
+#define PUBLISHER_H
+
+#include <stdint.h>
+
+#define PUBLISHER_MAX_RESOURCES 4
+
+// Returned by Publisher_TicksUntilDue when nothing will become due.
+#define PUBLISHER_NEVER 0xffffffffUL
+
+typedef struct T_PublishPolicy {
+   uint32_t minInterval;
+   uint32_t maxStaleness;
+   uint16_t deadband;
+} T_PublishPolicy;
+
+typedef struct T_PublishedResource {
+   const T_PublishPolicy *pPolicy;
+   uint32_t sentTicks;
+   uint16_t sentValue;
+   uint16_t value;
+   uint8_t resID;
+   uint8_t hasValue;
+   uint8_t cloudUnknown;
+} T_PublishedResource;
+
+typedef struct T_PublisherStats {
+   uint32_t published;
+   uint32_t sent;
+   uint32_t heartbeats;
+   uint32_t bursts;
+} T_PublisherStats;
+
+typedef struct T_PublisherCB {
+   void (*send)(uint8_t resID, uint16_t value);
+   T_PublishedResource resources[PUBLISHER_MAX_RESOURCES];
+   uint8_t resourceCount;
+   T_PublisherStats stats;
+} T_PublisherCB;
+
+#define PUBLISHER_FAILURE 0
+#define PUBLISHER_SUCCESS 1
+
+uint8_t Publisher_Init(T_PublisherCB *pControlBlock, void (*send)(uint8_t resID, uint16_t value));
+uint8_t Publisher_AddResource(T_PublisherCB *pControlBlock, uint8_t resID, uint16_t cloudValue,
+                              const T_PublishPolicy *pPolicy, uint32_t now);
+uint8_t Publisher_Publish(T_PublisherCB *pControlBlock, uint8_t resID, uint16_t value);
+void Publisher_Invalidate(T_PublisherCB *pControlBlock, uint8_t resID);
+uint8_t Publisher_Flush(T_PublisherCB *pControlBlock, uint32_t now);
+uint32_t Publisher_TicksUntilDue(const T_PublisherCB *pControlBlock, uint32_t now);
+
+#endif
@@ -111,6 +111,8 @@ uint8_t RingBuffer_IsFull(T_RingBufferCB *pControlBlock) {
 }
 
 uint8_t RingBuffer_Peek(T_RingBufferCB *pControlBlock, uint8_t pos) {
+   uint16_t index;
+
    if (pControlBlock == NULL) {
       return 0xff;
    }
@@ -124,12 +126,13 @@ uint8_t RingBuffer_Peek(T_RingBufferCB *pControlBlock, uint8_t pos) {
       return 0xff;
    }
 
-   pos += pControlBlock->head;
-   if (pos >= pControlBlock->size) {
-      pos -= (pControlBlock->size - 1);
+   // head + pos goes past 255 in buffers of more than 128 bytes
+   index = (uint16_t)pControlBlock->head + pos;
+   if (index >= pControlBlock->size) {
+      index -= pControlBlock->size;
    }
 
-   return pControlBlock->pBuf[pos];
+   return pControlBlock->pBuf[index];
 }
 
 
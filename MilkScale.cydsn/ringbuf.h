@@ -25,6 +25,9 @@
  * THE SOFTWARE.
  */
 
+#ifndef RINGBUF_H
+#define RINGBUF_H
+
 #include <stdint.h>
 
 typedef struct T_RingBufferCB {
@@ -56,4 +59,4 @@ uint8_t RingBuffer_Peek(T_RingBufferCB *pControlBlock, uint8_t pos);
 uint8_t RingBuffer_BytesUsed(T_RingBufferCB *pControlBlock);
 uint8_t RingBuffer_BytesAvailable(T_RingBufferCB *pControlBlock);
 
-
+#endif
@@ -0,0 +1,1081 @@
+/*
+ * Regression benchmark for the chillhub receive path over a trace corpus.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Every session of the corpus goes through a link of the host built chillhub
+ * code the way the firmware registers it, in slices of bytes like a UART
+ * delivers them.  A first pass records what the callbacks saw and what the
+ * link sent, and checks it against the golden file of the session; the
+ * timed passes after it run the same callbacks without recording.  Sessions
+ * are handed out to one thread per core, largest first.
+ *
+ *   regress [-t threads] [-p passes] [-s slice_bytes] [-g golden_dir] [-u]
+ *           [-b baseline.json] [-r percent] [-o results.json] [-x session]
+ *           corpus_dir
+ *
+ * The corpus directory holds
+ *
+ *   *.raw          bytes from the hub to a scale, as captured on the UART
+ *   *.pcap         tracecap pcaps, of which the hub to scale packets are used
+ *   sessions.txt   synthetic sessions, one per line: name, seed, frames and
+ *                  one of the profiles below
+ *
+ * A golden file holds the link statistics, a hash of the bytes sent and a
+ * hash of every CALLBACKS_PER_CHUNK callbacks; -x prints the callbacks of
+ * one session, to compare two builds with diff.  -u writes the golden files
+ * instead of checking them.  Sessions that take more than -r percent (10 by
+ * default) longer per byte than in the baseline are regressions.  The exit
+ * status is 1 if a session does not match its golden file or regressed.
+ */
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "chillhub.h"
+#include "crc.h"
+
+#define STX 0xff
+#define ESC 0xfe
+
+#define CALLBACKS_PER_CHUNK 1024
+#define MAX_SESSIONS 256
+
+// The cloud resources and listeners of main.c
+#define WEIGHT_ID 0x91
+#define CALIBRATE_ID 0x94
+#define DIAGNOSTICS_ID 0x96
+#define TELEMETRY_ID 0x97
+#define FW_START_ID 0x50
+#define FW_DATA_ID 0x51
+#define ALARM_ID 1
+
+enum EGolden {
+   Golden_Ok,
+   Golden_Missing,
+   Golden_Differs,
+   Golden_Written
+};
+
+typedef struct T_Text {
+   char *pChars;
+   size_t length;
+   size_t size;
+} T_Text;
+
+typedef struct T_Session {
+   char name[64];
+   uint8_t *pData;
+   uint32_t length;
+
+   T_Text golden;
+   uint8_t goldenState;
+   char goldenNote[1400];
+   uint64_t frames;
+   double bestSeconds;
+   double baselineNsPerByte;    // below 0 without a baseline
+   uint8_t regressed;
+} T_Session;
+
+// One link running one session on one thread
+typedef struct T_Run {
+   T_ChillHubCB hub;
+   const uint8_t *pData;
+   uint32_t length;
+   uint32_t pos;
+   uint32_t sliceEnd;
+
+   uint8_t recording;
+   FILE *pDump;
+   uint32_t callbacks;
+   uint64_t chunkHash;
+   T_Text chunks;
+   uint64_t txBytes;
+   uint64_t txHash;
+} T_Run;
+
+typedef struct T_Worker {
+   pthread_t thread;
+} T_Worker;
+
+static T_Session sessions[MAX_SESSIONS];
+static uint32_t sessionCount;
+static T_Session *pByLength[MAX_SESSIONS];
+static uint32_t nextSession;
+
+static uint32_t passes = 5;
+static uint32_t sliceBytes = 16;
+
+// The serial port functions and the callbacks carry no link, so each thread
+// points this at the run it is about to poll.
+static __thread T_Run *pCurrentRun;
+
+/*
+ * Text and hashes
+ */
+
+static void appendText(T_Text *pText, const char *pFormat, ...) {
+   va_list args;
+   int n;
+
+   for (;;) {
+      va_start(args, pFormat);
+      n = vsnprintf(pText->pChars + pText->length, pText->size - pText->length, pFormat, args);
+      va_end(args);
+      if (n >= 0 && pText->length + (size_t)n < pText->size) {
+         pText->length += (size_t)n;
+         return;
+      }
+      pText->size = (pText->size == 0) ? 4096 : pText->size * 2;
+      pText->pChars = realloc(pText->pChars, pText->size);
+      if (pText->pChars == NULL) {
+         fprintf(stderr, "out of memory\n");
+         exit(1);
+      }
+   }
+}
+
+static uint64_t fnv1a(uint64_t hash, const void *pData, size_t length) {
+   const uint8_t *p = pData;
+
+   while (length-- > 0) {
+      hash = (hash ^ *p++) * 0x100000001b3ULL;
+   }
+   return hash;
+}
+
+#define FNV_INIT 0xcbf29ce484222325ULL
+
+/*
+ * The link
+ */
+
+static void runWrite(const uint8 wrBuf[], uint32 count) {
+   if (pCurrentRun->recording) {
+      pCurrentRun->txHash = fnv1a(pCurrentRun->txHash, wrBuf, count);
+      pCurrentRun->txBytes += count;
+   }
+}
+
+static uint32 runAvailable(void) {
+   return pCurrentRun->sliceEnd - pCurrentRun->pos;
+}
+
+static uint32 runRead(void) {
+   return pCurrentRun->pData[pCurrentRun->pos++];
+}
+
+static void runPrint(const char8 string[]) {
+   (void)string;
+}
+
+static const T_Serial runSerial = { runWrite, runAvailable, runRead, runPrint };
+
+static void endChunk(T_Run *pRun) {
+   appendText(&pRun->chunks, "chunk %lu %016llx\n",
+              (unsigned long)((pRun->callbacks - 1) / CALLBACKS_PER_CHUNK),
+              (unsigned long long)pRun->chunkHash);
+   pRun->chunkHash = FNV_INIT;
+}
+
+// What a callback saw: the frame it came in, the message and data type and
+// the data.
+static void record(uint8_t dataType) {
+   T_Run *pRun = pCurrentRun;
+   const T_ChillHubPayload *pPayload;
+   char line[16 + 3 * 256];
+   int n;
+   uint8_t i;
+
+   if (!pRun->recording) {
+      return;
+   }
+   pPayload = ChillHub_GetPayload(&pRun->hub);
+   n = sprintf(line, "%lu %02x %02x", (unsigned long)pRun->hub.stats.framesRx,
+               pRun->hub.msgType, dataType);
+   for (i = 0; i < pPayload->length; i++) {
+      n += sprintf(line + n, " %02x", pPayload->pData[i]);
+   }
+   line[n++] = '\n';
+   line[n] = '\0';
+
+   pRun->chunkHash = fnv1a(pRun->chunkHash, line, (size_t)n);
+   if (++pRun->callbacks % CALLBACKS_PER_CHUNK == 0) {
+      endChunk(pRun);
+   }
+   if (pRun->pDump != NULL) {
+      fputs(line, pRun->pDump);
+   }
+}
+
+static void registerLink(T_ChillHubCB *pHub);
+
+static void deviceIdRequest(uint8_t dataType, void *pData) {
+   (void)pData;
+   record(dataType);
+   registerLink(&pCurrentRun->hub);
+}
+
+static void doorStatus(uint8_t dataType, void *pData) {
+   (void)pData;
+   record(dataType);
+   ChillHub_UpdateCloudResourceU16(&pCurrentRun->hub, WEIGHT_ID, (uint16_t)pCurrentRun->hub.stats.framesRx);
+}
+
+static void timeResponse(uint8_t dataType, void *pData) {
+   (void)pData;
+   record(dataType);
+   ChillHub_GetTime(&pCurrentRun->hub, timeResponse);
+}
+
+static void recordOnly(uint8_t dataType, void *pData) {
+   (void)pData;
+   record(dataType);
+}
+
+// As deviceAnnounce in main.c does it, within CHILLHUB_MAX_CALLBACKS
+static void registerLink(T_ChillHubCB *pHub) {
+   static char cron[] = "0 * * * *";
+
+   ChillHub_Setup(pHub, "milkyWeighs", "bench", &runSerial);
+   ChillHub_Subscribe(pHub, deviceIdRequestType, deviceIdRequest);
+   ChillHub_Subscribe(pHub, keepAliveType, recordOnly);
+   ChillHub_Subscribe(pHub, doorStatusMsgType, doorStatus);
+   ChillHub_AddCloudListener(pHub, CALIBRATE_ID, recordOnly);
+   ChillHub_CreateCloudResourceU16(pHub, "calibrate", CALIBRATE_ID, 1, 0);
+   ChillHub_AddCloudListener(pHub, DIAGNOSTICS_ID, recordOnly);
+   ChillHub_AddCloudListener(pHub, TELEMETRY_ID, recordOnly);
+   ChillHub_AddCloudListener(pHub, FW_START_ID, recordOnly);
+   ChillHub_AddCloudListener(pHub, FW_DATA_ID, recordOnly);
+   ChillHub_CreateCloudResourceU16(pHub, "weight", WEIGHT_ID, FALSE, 0);
+   ChillHub_SetAlarm(pHub, ALARM_ID, cron, sizeof(cron) - 1, recordOnly);
+   ChillHub_GetTime(pHub, timeResponse);
+}
+
+static void renderStats(T_Text *pText, const T_ChillHubStats *pStats) {
+   static const char *const names[CHILLHUB_STATS_COUNT] = {
+      "framesRx", "framesTx", "bytesRx", "bytesTx", "crcFailures", "overflowDrops", "resyncs",
+      "oversizeFrames", "unhandledMessages", "callbackTableMisses", "usbResets", "malformedMessages"
+   };
+   const uint32_t *pCounters = (const uint32_t *)pStats;
+   uint32_t i;
+
+   appendText(pText, "stats");
+   for (i = 0; i < CHILLHUB_STATS_COUNT; i++) {
+      appendText(pText, " %s=%lu", names[i], (unsigned long)pCounters[i]);
+   }
+   appendText(pText, "\n");
+}
+
+// Runs a session once.  Returns the CPU seconds the bytes took, setup left
+// out.
+static double runSession(T_Session *pSession, uint8_t recording, FILE *pDump) {
+   T_Run *pRun = calloc(1, sizeof(T_Run));
+   struct timespec start;
+   struct timespec end;
+   double seconds;
+
+   if (pRun == NULL) {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+   }
+   pRun->pData = pSession->pData;
+   pRun->length = pSession->length;
+   pRun->recording = recording;
+   pRun->pDump = pDump;
+   pRun->chunkHash = FNV_INIT;
+   pRun->txHash = FNV_INIT;
+
+   pCurrentRun = pRun;
+   ChillHub_Init(&pRun->hub);
+   registerLink(&pRun->hub);
+
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+   while (pRun->pos < pRun->length) {
+      pRun->sliceEnd = pRun->pos + sliceBytes;
+      if (pRun->sliceEnd > pRun->length) {
+         pRun->sliceEnd = pRun->length;
+      }
+      do {
+         ChillHub_Loop(&pRun->hub);
+      } while (!ChillHub_IsIdle(&pRun->hub));
+   }
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+   seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+   if (recording) {
+      if (pRun->callbacks % CALLBACKS_PER_CHUNK != 0) {
+         endChunk(pRun);
+      }
+      pSession->frames = pRun->hub.stats.framesRx;
+      pSession->golden.length = 0;
+      appendText(&pSession->golden, "# %s, %lu bytes from the hub\n", pSession->name,
+                 (unsigned long)pSession->length);
+      renderStats(&pSession->golden, &pRun->hub.stats);
+      appendText(&pSession->golden, "tx %llu %016llx\n", (unsigned long long)pRun->txBytes,
+                 (unsigned long long)pRun->txHash);
+      appendText(&pSession->golden, "callbacks %lu\n", (unsigned long)pRun->callbacks);
+      if (pRun->chunks.length > 0) {
+         appendText(&pSession->golden, "%s", pRun->chunks.pChars);
+      }
+   }
+   free(pRun->chunks.pChars);
+   free(pRun);
+   return seconds;
+}
+
+static void *work(void *pArg) {
+   uint32_t index;
+
+   (void)pArg;
+   while ((index = __sync_fetch_and_add(&nextSession, 1)) < sessionCount) {
+      T_Session *pSession = pByLength[index];
+      uint32_t pass;
+
+      runSession(pSession, TRUE, NULL);
+      pSession->bestSeconds = -1;
+      for (pass = 0; pass < passes; pass++) {
+         double seconds = runSession(pSession, FALSE, NULL);
+
+         if (pSession->bestSeconds < 0 || seconds < pSession->bestSeconds) {
+            pSession->bestSeconds = seconds;
+         }
+      }
+   }
+   return NULL;
+}
+
+/*
+ * Synthetic sessions
+ */
+
+enum EProfile {
+   Profile_Steady,        // keepalives, door events, time and cloud messages
+   Profile_FwUpdate,      // a firmware transfer, full frames of random data
+   Profile_Noisy,         // steady traffic with corrupt, cut short and stray bytes
+   Profile_Registration,  // device ID requests, alarms, unknown and short messages
+   Profile_Escapes,       // short messages full of bytes that need escaping
+   Profile_LongEscapes,   // steady traffic and the odd full frame with escapes
+   Profile_Count
+};
+
+static const char *const profileNames[Profile_Count] = {
+   "steady", "fwupdate", "noisy", "registration", "escapes", "longescapes"
+};
+
+typedef struct T_Synth {
+   uint8_t *pData;
+   uint32_t length;
+   uint32_t size;
+   uint32_t seed;
+} T_Synth;
+
+static uint32_t nextRandom(T_Synth *pSynth) {
+   pSynth->seed = pSynth->seed * 1103515245UL + 12345UL;
+   return (pSynth->seed >> 8) & 0xffffff;
+}
+
+static void put(T_Synth *pSynth, uint8_t b) {
+   if (pSynth->length == pSynth->size) {
+      pSynth->size = (pSynth->size == 0) ? 65536 : pSynth->size * 2;
+      pSynth->pData = realloc(pSynth->pData, pSynth->size);
+      if (pSynth->pData == NULL) {
+         fprintf(stderr, "out of memory\n");
+         exit(1);
+      }
+   }
+   pSynth->pData[pSynth->length++] = b;
+}
+
+static void putEscaped(T_Synth *pSynth, uint8_t b) {
+   if (b == STX || b == ESC) {
+      put(pSynth, ESC);
+   }
+   put(pSynth, b);
+}
+
+// Frames a message (message type, data type, data...) like sendPacket.
+static void putMessage(T_Synth *pSynth, const uint8_t *pMsg, uint8_t length) {
+   uint8_t body[256];
+   crc_t crc;
+   uint16_t i;
+
+   body[0] = length;
+   memcpy(&body[1], pMsg, length);
+   crc = crc_finalize(crc_update(crc_init(), body, length + 1));
+
+   put(pSynth, STX);
+   putEscaped(pSynth, length + 1);
+   for (i = 0; i < length + 1; i++) {
+      putEscaped(pSynth, body[i]);
+   }
+   putEscaped(pSynth, (crc >> 8) & 0xff);
+   putEscaped(pSynth, crc & 0xff);
+}
+
+// An array of U8 with count bytes, from the generator or mostly STX and ESC
+static uint8_t arrayMessage(T_Synth *pSynth, uint8_t *pMsg, uint8_t msgType, uint8_t count, uint8_t controlBytes) {
+   uint8_t i;
+
+   pMsg[0] = msgType;
+   pMsg[1] = arrayDataType;
+   pMsg[2] = count;
+   pMsg[3] = unsigned8DataType;
+   for (i = 0; i < count; i++) {
+      uint32_t r = nextRandom(pSynth);
+      pMsg[4 + i] = (controlBytes && (r & 1)) ? (uint8_t)(0xfe + ((r >> 1) & 1)) : (uint8_t)(r >> 8);
+   }
+   return 4 + count;
+}
+
+static void putSteadyMessage(T_Synth *pSynth) {
+   uint32_t r = nextRandom(pSynth);
+   uint8_t msg[64];
+   uint8_t length;
+
+   switch (r % 10) {
+      case 0:
+      case 1:
+      case 2:
+      case 3:
+         msg[0] = keepAliveType;
+         msg[1] = unsigned8DataType;
+         msg[2] = 1;
+         length = 3;
+         break;
+      case 4:
+      case 5:
+         msg[0] = doorStatusMsgType;
+         msg[1] = unsigned8DataType;
+         msg[2] = (r >> 8) & 1;
+         length = 3;
+         break;
+      case 6:
+         msg[0] = timeResponseMsgType;
+         msg[1] = arrayDataType;
+         msg[2] = 4;
+         msg[3] = unsigned8DataType;
+         msg[4] = (uint8_t)(r >> 16);
+         msg[5] = (uint8_t)(r >> 8);
+         msg[6] = (uint8_t)r;
+         msg[7] = 0xff;
+         length = 8;
+         break;
+      case 7:
+         msg[0] = CALIBRATE_ID;
+         msg[1] = unsigned16DataType;
+         msg[2] = (uint8_t)(r >> 16);
+         msg[3] = (uint8_t)(r >> 8);
+         length = 4;
+         break;
+      case 8:
+         msg[0] = DIAGNOSTICS_ID;
+         msg[1] = unsigned8DataType;
+         msg[2] = 0;
+         length = 3;
+         break;
+      default:
+         msg[0] = TELEMETRY_ID;
+         msg[1] = unsigned16DataType;
+         msg[2] = 0;
+         msg[3] = (uint8_t)(r >> 8);
+         length = 4;
+         break;
+   }
+   putMessage(pSynth, msg, length);
+}
+
+static void putRegistrationMessage(T_Synth *pSynth) {
+   uint32_t r = nextRandom(pSynth);
+   uint8_t msg[16];
+
+   switch (r % 8) {
+      case 0:
+         msg[0] = deviceIdRequestType;
+         msg[1] = unsigned8DataType;
+         msg[2] = 0;
+         putMessage(pSynth, msg, 3);
+         break;
+      case 1:
+         msg[0] = alarmNotifyMsgType;
+         msg[1] = arrayDataType;
+         msg[2] = 5;
+         msg[3] = unsigned8DataType;
+         msg[4] = ((r >> 8) & 1) ? ALARM_ID : 2;
+         msg[5] = 0;
+         msg[6] = 0;
+         msg[7] = (uint8_t)(r >> 16);
+         msg[8] = (uint8_t)(r >> 8);
+         putMessage(pSynth, msg, 9);
+         break;
+      case 2:
+         // a cloud message nobody listens to and a fridge message nobody
+         // subscribed to
+         msg[0] = ((r >> 8) & 1) ? 0x60 : freezerDisplayTemperatureMsgType;
+         msg[1] = unsigned8DataType;
+         msg[2] = (uint8_t)(r >> 16);
+         putMessage(pSynth, msg, 3);
+         break;
+      case 3:
+         // too short for its data type
+         msg[0] = CALIBRATE_ID;
+         msg[1] = unsigned16DataType;
+         msg[2] = (uint8_t)(r >> 16);
+         putMessage(pSynth, msg, 3);
+         break;
+      default:
+         putSteadyMessage(pSynth);
+         break;
+   }
+}
+
+static void putNoise(T_Synth *pSynth) {
+   uint32_t r = nextRandom(pSynth);
+   uint32_t start = pSynth->length;
+   uint32_t i;
+
+   switch (r % 4) {
+      case 0:
+         // a bit flipped somewhere in the frame
+         putSteadyMessage(pSynth);
+         i = start + 2 + (r >> 8) % (pSynth->length - start - 2);
+         if (pSynth->pData[i] != STX && pSynth->pData[i] != ESC && pSynth->pData[i - 1] != ESC) {
+            pSynth->pData[i] ^= 0x10;
+         }
+         break;
+      case 1:
+         // cut short
+         putSteadyMessage(pSynth);
+         pSynth->length = start + 2 + (r >> 8) % (pSynth->length - start - 2);
+         if (pSynth->pData[pSynth->length - 1] == ESC) {
+            pSynth->length--;
+         }
+         break;
+      case 2:
+         // stray bytes between frames
+         for (i = 0; i < 1 + (r >> 8) % 8; i++) {
+            put(pSynth, (uint8_t)(nextRandom(pSynth) % 0xfe));
+         }
+         break;
+      default:
+         // a length too long for the receive buffer
+         put(pSynth, STX);
+         put(pSynth, (uint8_t)(CHILLHUB_BUFFER_SIZE - 2 + (r >> 8) % 64));
+         break;
+   }
+}
+
+static void synthesize(T_Session *pSession, uint32_t seed, uint32_t frames, uint8_t profile) {
+   T_Synth synth;
+   uint8_t msg[64];
+   uint32_t i;
+
+   memset(&synth, 0, sizeof(synth));
+   synth.seed = seed;
+   for (i = 0; i < frames; i++) {
+      uint32_t r = nextRandom(&synth);
+
+      switch (profile) {
+         case Profile_Steady:
+            putSteadyMessage(&synth);
+            break;
+         case Profile_FwUpdate:
+            if (i % 500 == 0) {
+               putMessage(&synth, msg, arrayMessage(&synth, msg, FW_START_ID, 8, FALSE));
+            } else if (r % 20 == 0) {
+               putSteadyMessage(&synth);
+            } else {
+               // the longest message the receive buffer takes
+               putMessage(&synth, msg, arrayMessage(&synth, msg, FW_DATA_ID, CHILLHUB_BUFFER_SIZE - 3 - 2 - 6, FALSE));
+            }
+            break;
+         case Profile_Noisy:
+            if (r % 16 == 0) {
+               putNoise(&synth);
+            } else {
+               putSteadyMessage(&synth);
+            }
+            break;
+         case Profile_Registration:
+            putRegistrationMessage(&synth);
+            break;
+         case Profile_Escapes:
+            putMessage(&synth, msg, arrayMessage(&synth, msg, FW_DATA_ID, 8 + r % 17, TRUE));
+            break;
+         default:
+            if (r % 200 == 0) {
+               putMessage(&synth, msg, arrayMessage(&synth, msg, FW_DATA_ID, CHILLHUB_BUFFER_SIZE - 3 - 2 - 6, TRUE));
+            } else {
+               putSteadyMessage(&synth);
+            }
+            break;
+      }
+   }
+   pSession->pData = synth.pData;
+   pSession->length = synth.length;
+}
+
+/*
+ * The corpus
+ */
+
+static T_Session *newSession(const char *pName) {
+   T_Session *pSession;
+
+   if (sessionCount == MAX_SESSIONS) {
+      fprintf(stderr, "more than %d sessions\n", MAX_SESSIONS);
+      exit(1);
+   }
+   pSession = &sessions[sessionCount++];
+   snprintf(pSession->name, sizeof(pSession->name), "%s", pName);
+   pSession->baselineNsPerByte = -1;
+   return pSession;
+}
+
+static uint8_t *readFile(const char *pPath, uint32_t *pLength) {
+   FILE *f = fopen(pPath, "rb");
+   uint8_t *pData;
+   long size;
+
+   if (f == NULL || fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0) {
+      perror(pPath);
+      exit(1);
+   }
+   rewind(f);
+   pData = malloc((size_t)size + 1);
+   if (pData == NULL || fread(pData, 1, (size_t)size, f) != (size_t)size) {
+      perror(pPath);
+      exit(1);
+   }
+   fclose(f);
+   *pLength = (uint32_t)size;
+   return pData;
+}
+
+// The hub to scale packets of a tracecap pcap, one after the other
+static void loadPcap(T_Session *pSession, const char *pPath) {
+   uint32_t length;
+   uint8_t *pFile = readFile(pPath, &length);
+   uint32_t magic;
+   uint32_t pos = 24;
+
+   memcpy(&magic, pFile, (length >= 4) ? 4 : 0);
+   if (length < 24 || (magic != 0xa1b2c3d4UL && magic != 0xa1b23c4dUL)) {
+      fprintf(stderr, "%s: not a pcap in host byte order\n", pPath);
+      exit(1);
+   }
+   pSession->pData = pFile;
+   pSession->length = 0;
+   while (pos + 16 <= length) {
+      uint32_t captured;
+
+      memcpy(&captured, &pFile[pos + 8], 4);
+      pos += 16;
+      if (captured > length - pos) {
+         break;
+      }
+      if (captured > 1 && pFile[pos] == 0) {
+         // packets only get shorter, so this never overtakes pos
+         memmove(&pFile[pSession->length], &pFile[pos + 1], captured - 1);
+         pSession->length += captured - 1;
+      }
+      pos += captured;
+   }
+}
+
+static void loadSynthetic(const char *pPath) {
+   FILE *f = fopen(pPath, "r");
+   char line[256];
+   unsigned lineNumber = 0;
+
+   if (f == NULL) {
+      perror(pPath);
+      exit(1);
+   }
+   while (fgets(line, sizeof(line), f) != NULL) {
+      char name[64];
+      char profileName[32];
+      unsigned long seed;
+      unsigned long frames;
+      uint8_t profile;
+
+      lineNumber++;
+      if (line[0] == '#' || strspn(line, " \t\r\n") == strlen(line)) {
+         continue;
+      }
+      if (sscanf(line, "%63s %lu %lu %31s", name, &seed, &frames, profileName) != 4) {
+         fprintf(stderr, "%s:%u: expected name, seed, frames and profile\n", pPath, lineNumber);
+         exit(1);
+      }
+      for (profile = 0; profile < Profile_Count; profile++) {
+         if (strcmp(profileName, profileNames[profile]) == 0) {
+            break;
+         }
+      }
+      if (profile == Profile_Count) {
+         fprintf(stderr, "%s:%u: unknown profile %s\n", pPath, lineNumber, profileName);
+         exit(1);
+      }
+      synthesize(newSession(name), (uint32_t)seed, (uint32_t)frames, profile);
+   }
+   fclose(f);
+}
+
+static int endsWith(const char *pName, const char *pSuffix) {
+   size_t n = strlen(pName);
+   size_t m = strlen(pSuffix);
+
+   return (n > m) && (strcmp(pName + n - m, pSuffix) == 0);
+}
+
+static int byName(const void *pA, const void *pB) {
+   return strcmp(((const T_Session *)pA)->name, ((const T_Session *)pB)->name);
+}
+
+static int byLength(const void *pA, const void *pB) {
+   const T_Session *pSessionA = *(const T_Session *const *)pA;
+   const T_Session *pSessionB = *(const T_Session *const *)pB;
+
+   return (pSessionA->length < pSessionB->length) - (pSessionA->length > pSessionB->length);
+}
+
+static void loadCorpus(const char *pDir) {
+   DIR *pDirectory = opendir(pDir);
+   struct dirent *pEntry;
+   char path[1024];
+   uint32_t i;
+
+   if (pDirectory == NULL) {
+      perror(pDir);
+      exit(1);
+   }
+   while ((pEntry = readdir(pDirectory)) != NULL) {
+      snprintf(path, sizeof(path), "%s/%s", pDir, pEntry->d_name);
+      if (strcmp(pEntry->d_name, "sessions.txt") == 0) {
+         loadSynthetic(path);
+      } else if (endsWith(pEntry->d_name, ".raw")) {
+         T_Session *pSession = newSession(pEntry->d_name);
+
+         pSession->name[strlen(pSession->name) - 4] = '\0';
+         pSession->pData = readFile(path, &pSession->length);
+      } else if (endsWith(pEntry->d_name, ".pcap")) {
+         T_Session *pSession = newSession(pEntry->d_name);
+
+         pSession->name[strlen(pSession->name) - 5] = '\0';
+         loadPcap(pSession, path);
+      }
+   }
+   closedir(pDirectory);
+
+   qsort(sessions, sessionCount, sizeof(sessions[0]), byName);
+   for (i = 0; i < sessionCount; i++) {
+      if (i > 0 && strcmp(sessions[i - 1].name, sessions[i].name) == 0) {
+         fprintf(stderr, "two sessions named %s\n", sessions[i].name);
+         exit(1);
+      }
+      pByLength[i] = &sessions[i];
+   }
+   qsort(pByLength, sessionCount, sizeof(pByLength[0]), byLength);
+}
+
+/*
+ * Golden files and the baseline
+ */
+
+static void goldenPath(char *pPath, size_t size, const char *pDir, const T_Session *pSession) {
+   snprintf(pPath, size, "%s/%s.txt", pDir, pSession->name);
+}
+
+static void writeGolden(const char *pDir, T_Session *pSession) {
+   char path[1024];
+   FILE *f;
+
+   goldenPath(path, sizeof(path), pDir, pSession);
+   f = fopen(path, "w");
+   if (f == NULL || fwrite(pSession->golden.pChars, 1, pSession->golden.length, f) != pSession->golden.length) {
+      perror(path);
+      exit(1);
+   }
+   fclose(f);
+   pSession->goldenState = Golden_Written;
+}
+
+static void checkGolden(const char *pDir, T_Session *pSession) {
+   char path[1024];
+   uint32_t expectedLength;
+   uint8_t *pExpected;
+   const char *pA;
+   const char *pB;
+   unsigned line = 1;
+
+   goldenPath(path, sizeof(path), pDir, pSession);
+   if (access(path, R_OK) != 0) {
+      pSession->goldenState = Golden_Missing;
+      snprintf(pSession->goldenNote, sizeof(pSession->goldenNote), "no %s", path);
+      return;
+   }
+   pExpected = readFile(path, &expectedLength);
+   pExpected[expectedLength] = '\0';
+   pSession->golden.pChars[pSession->golden.length] = '\0';
+
+   pA = (const char *)pExpected;
+   pB = pSession->golden.pChars;
+   pSession->goldenState = Golden_Ok;
+   while (*pA != '\0' || *pB != '\0') {
+      size_t lengthA = strcspn(pA, "\n");
+      size_t lengthB = strcspn(pB, "\n");
+
+      if (lengthA != lengthB || memcmp(pA, pB, lengthA) != 0) {
+         unsigned long chunk;
+
+         pSession->goldenState = Golden_Differs;
+         if (sscanf(pB, "chunk %lu", &chunk) == 1) {
+            snprintf(pSession->goldenNote, sizeof(pSession->goldenNote),
+                     "%s:%u: callbacks %lu to %lu differ, regress -x %s lists them",
+                     path, line, chunk * CALLBACKS_PER_CHUNK, (chunk + 1) * CALLBACKS_PER_CHUNK - 1,
+                     pSession->name);
+         } else {
+            snprintf(pSession->goldenNote, sizeof(pSession->goldenNote), "%s:%u: expected \"%.*s\", got \"%.*s\"",
+                     path, line, (int)(lengthA < 80 ? lengthA : 80), pA, (int)(lengthB < 80 ? lengthB : 80), pB);
+         }
+         break;
+      }
+      pA += lengthA + (pA[lengthA] == '\n');
+      pB += lengthB + (pB[lengthB] == '\n');
+      line++;
+   }
+   free(pExpected);
+}
+
+// Only reads what writeResults writes: one session per line.
+static void loadBaseline(const char *pPath) {
+   FILE *f = fopen(pPath, "r");
+   char line[1024];
+
+   if (f == NULL) {
+      return;
+   }
+   while (fgets(line, sizeof(line), f) != NULL) {
+      char *pName = strstr(line, "\"name\": \"");
+      char *pNs = strstr(line, "\"nsPerByte\": ");
+      char *pEnd;
+      uint32_t i;
+
+      if (pName == NULL || pNs == NULL) {
+         continue;
+      }
+      pName += 9;
+      pEnd = strchr(pName, '"');
+      if (pEnd == NULL) {
+         continue;
+      }
+      *pEnd = '\0';
+      for (i = 0; i < sessionCount; i++) {
+         if (strcmp(sessions[i].name, pName) == 0) {
+            sessions[i].baselineNsPerByte = atof(pNs + 13);
+         }
+      }
+   }
+   fclose(f);
+}
+
+static const char *const goldenNames[] = { "ok", "missing", "differs", "written" };
+
+static void writeResults(const char *pPath, uint32_t threadCount, double wall, uint64_t totalBytes,
+                         uint64_t totalFrames, double totalSeconds, uint32_t failures, uint32_t regressions) {
+   FILE *f = fopen(pPath, "w");
+   uint32_t i;
+
+   if (f == NULL) {
+      perror(pPath);
+      exit(1);
+   }
+   fprintf(f, "{\n");
+   fprintf(f, "  \"threads\": %lu,\n  \"passes\": %lu,\n  \"sliceBytes\": %lu,\n",
+           (unsigned long)threadCount, (unsigned long)passes, (unsigned long)sliceBytes);
+   fprintf(f, "  \"sessions\": [\n");
+   for (i = 0; i < sessionCount; i++) {
+      const T_Session *pSession = &sessions[i];
+      double nsPerByte = pSession->bestSeconds * 1e9 / pSession->length;
+
+      fprintf(f, "    {\"name\": \"%s\", \"bytes\": %lu, \"frames\": %llu, \"framesPerSecond\": %.0f, "
+              "\"nsPerByte\": %.3f, ",
+              pSession->name, (unsigned long)pSession->length, (unsigned long long)pSession->frames,
+              pSession->frames / pSession->bestSeconds, nsPerByte);
+      if (pSession->baselineNsPerByte > 0) {
+         fprintf(f, "\"baselineNsPerByte\": %.3f, \"change\": %.1f, ", pSession->baselineNsPerByte,
+                 (nsPerByte / pSession->baselineNsPerByte - 1) * 100);
+      } else {
+         fprintf(f, "\"baselineNsPerByte\": null, \"change\": null, ");
+      }
+      fprintf(f, "\"golden\": \"%s\", \"regression\": %s}%s\n", goldenNames[pSession->goldenState],
+              pSession->regressed ? "true" : "false", (i + 1 < sessionCount) ? "," : "");
+   }
+   fprintf(f, "  ],\n");
+   fprintf(f, "  \"total\": {\"bytes\": %llu, \"frames\": %llu, \"framesPerSecond\": %.0f, \"nsPerByte\": %.3f, "
+           "\"allCoresFramesPerSecond\": %.0f, \"wallSeconds\": %.3f},\n",
+           (unsigned long long)totalBytes, (unsigned long long)totalFrames, totalFrames / totalSeconds,
+           totalSeconds * 1e9 / totalBytes, totalFrames * (passes + 1) / wall, wall);
+   fprintf(f, "  \"goldenFailures\": %lu,\n  \"regressions\": %lu\n}\n", (unsigned long)failures,
+           (unsigned long)regressions);
+   fclose(f);
+}
+
+static int usage(void) {
+   fprintf(stderr,
+           "usage: regress [-t threads] [-p passes] [-s slice_bytes] [-g golden_dir] [-u]\n"
+           "               [-b baseline.json] [-r percent] [-o results.json] [-x session] corpus_dir\n");
+   return 2;
+}
+
+int main(int argc, char **argv) {
+   uint32_t threadCount = (uint32_t)sysconf(_SC_NPROCESSORS_ONLN);
+   const char *pGoldenDir = "golden";
+   const char *pBaseline = NULL;
+   const char *pResults = NULL;
+   const char *pDumpSession = NULL;
+   double threshold = 10;
+   int update = 0;
+   T_Worker *pWorkers;
+   struct timespec start;
+   struct timespec end;
+   double wall;
+   uint64_t totalBytes = 0;
+   uint64_t totalFrames = 0;
+   double totalSeconds = 0;
+   uint32_t failures = 0;
+   uint32_t regressions = 0;
+   uint32_t i;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "t:p:s:g:ub:r:o:x:")) != -1) {
+      switch (opt) {
+         case 't': threadCount = (uint32_t)strtoul(optarg, NULL, 0); break;
+         case 'p': passes = (uint32_t)strtoul(optarg, NULL, 0); break;
+         case 's': sliceBytes = (uint32_t)strtoul(optarg, NULL, 0); break;
+         case 'g': pGoldenDir = optarg; break;
+         case 'u': update = 1; break;
+         case 'b': pBaseline = optarg; break;
+         case 'r': threshold = atof(optarg); break;
+         case 'o': pResults = optarg; break;
+         case 'x': pDumpSession = optarg; break;
+         default: return usage();
+      }
+   }
+   if (optind + 1 != argc || threadCount == 0 || passes == 0 || sliceBytes == 0) {
+      return usage();
+   }
+   loadCorpus(argv[optind]);
+   if (sessionCount == 0) {
+      fprintf(stderr, "no sessions in %s\n", argv[optind]);
+      return 1;
+   }
+
+   if (pDumpSession != NULL) {
+      for (i = 0; i < sessionCount; i++) {
+         if (strcmp(sessions[i].name, pDumpSession) == 0) {
+            runSession(&sessions[i], TRUE, stdout);
+            fputs(sessions[i].golden.pChars, stdout);
+            return 0;
+         }
+      }
+      fprintf(stderr, "no session %s\n", pDumpSession);
+      return 1;
+   }
+
+   if (threadCount > sessionCount) {
+      threadCount = sessionCount;
+   }
+   pWorkers = calloc(threadCount, sizeof(T_Worker));
+   if (pWorkers == NULL) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+   }
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   for (i = 0; i < threadCount; i++) {
+      pthread_create(&pWorkers[i].thread, NULL, work, NULL);
+   }
+   for (i = 0; i < threadCount; i++) {
+      pthread_join(pWorkers[i].thread, NULL);
+   }
+   clock_gettime(CLOCK_MONOTONIC, &end);
+   wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+   free(pWorkers);
+
+   if (pBaseline != NULL) {
+      loadBaseline(pBaseline);
+   }
+   printf("%-24s %10s %8s %12s %8s %8s  %s\n", "session", "bytes", "frames", "frames/s", "ns/byte", "change",
+          "golden");
+   for (i = 0; i < sessionCount; i++) {
+      T_Session *pSession = &sessions[i];
+      double nsPerByte = pSession->bestSeconds * 1e9 / pSession->length;
+      char change[16] = "-";
+
+      if (update) {
+         writeGolden(pGoldenDir, pSession);
+      } else {
+         checkGolden(pGoldenDir, pSession);
+      }
+      if (pSession->goldenState == Golden_Missing || pSession->goldenState == Golden_Differs) {
+         failures++;
+      }
+      if (pSession->baselineNsPerByte > 0) {
+         double percent = (nsPerByte / pSession->baselineNsPerByte - 1) * 100;
+
+         snprintf(change, sizeof(change), "%+.1f%%", percent);
+         if (percent > threshold) {
+            pSession->regressed = TRUE;
+            regressions++;
+         }
+      }
+      totalBytes += pSession->length;
+      totalFrames += pSession->frames;
+      totalSeconds += pSession->bestSeconds;
+      printf("%-24s %10lu %8llu %12.0f %8.2f %8s  %s%s\n", pSession->name, (unsigned long)pSession->length,
+             (unsigned long long)pSession->frames, pSession->frames / pSession->bestSeconds, nsPerByte, change,
+             goldenNames[pSession->goldenState], pSession->regressed ? ", slower" : "");
+      if (pSession->goldenNote[0] != '\0') {
+         printf("  %s\n", pSession->goldenNote);
+      }
+   }
+   printf("%lu sessions on %lu threads, best of %lu passes: %.0f frames/s and %.2f ns/byte per core, "
+          "%.0f frames/s in all\n",
+          (unsigned long)sessionCount, (unsigned long)threadCount, (unsigned long)passes,
+          totalFrames / totalSeconds, totalSeconds * 1e9 / totalBytes, totalFrames * (passes + 1) / wall);
+   if (failures > 0) {
+      printf("%lu sessions do not match their golden files\n", (unsigned long)failures);
+   }
+   if (regressions > 0) {
+      printf("%lu sessions are more than %.0f%% slower than the baseline\n", (unsigned long)regressions, threshold);
+   }
+   if (pResults != NULL) {
+      writeResults(pResults, threadCount, wall, totalBytes, totalFrames, totalSeconds, failures, regressions);
+   }
+   return (failures > 0 || regressions > 0) ? 1 : 0;
+}
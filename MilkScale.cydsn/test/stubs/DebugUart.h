@@ -0,0 +1,18 @@
+/*
+ * Host stand-in for the generated DebugUart component header.  Debug output is
+ * dropped.
+ */
+#ifndef DEBUGUART_H
+#define DEBUGUART_H
+
+#include "cytypes.h"
+
+static inline void DebugUart_UartPutString(const char8 string[]) {
+  (void)string;
+}
+
+static inline void DebugUart_SpiUartWriteTxData(uint32 txData) {
+  (void)txData;
+}
+
+#endif
@@ -0,0 +1,11 @@
+/*
+ * Host stand-in for the generated Uart component header.  The chillhub code
+ * only talks to the hub through the T_Serial handed to setup, so nothing is
+ * needed here.
+ */
+#ifndef UART_H
+#define UART_H
+
+#include "cytypes.h"
+
+#endif
@@ -0,0 +1,9 @@
+/*
+ * Host stand-in for the generated Uart component header.
+ */
+#ifndef UART_SPI_UART_H
+#define UART_SPI_UART_H
+
+#include "Uart.h"
+
+#endif
@@ -0,0 +1,12 @@
+/*
+ * Host stand-in for the PSoC Creator generated cylib.h.
+ */
+#ifndef CYLIB_H
+#define CYLIB_H
+
+#include "cytypes.h"
+
+#define CyGlobalIntEnable
+#define CyGlobalIntDisable
+
+#endif
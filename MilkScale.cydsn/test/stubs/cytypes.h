@@ -0,0 +1,18 @@
+/*
+ * Host stand-in for the PSoC Creator generated cytypes.h, just enough to
+ * build the chillhub code under test.
+ */
+#ifndef CYTYPES_H
+#define CYTYPES_H
+
+#include <stdint.h>
+
+typedef uint8_t uint8;
+typedef uint16_t uint16;
+typedef uint32_t uint32;
+typedef int8_t int8;
+typedef int16_t int16;
+typedef int32_t int32;
+typedef char char8;
+
+#endif
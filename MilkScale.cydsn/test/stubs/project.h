@@ -0,0 +1,12 @@
+/*
+ * Host stand-in for the PSoC Creator generated project.h.
+ */
+#ifndef PROJECT_H
+#define PROJECT_H
+
+#include "cytypes.h"
+#include "cylib.h"
+#include "Uart.h"
+#include "DebugUart.h"
+
+#endif
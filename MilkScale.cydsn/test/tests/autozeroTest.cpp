@@ -0,0 +1,365 @@
+#include "CppUTest/TestHarness.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+extern "C"
+{
+#include "autozero.h"
+}
+
+// 16 counts of noise, 30 readings (a minute) to settle, time constants of
+// 64 and 256 readings, stored every 16 counts, drift over a day
+static const T_AutoZeroPolicy policy = { 86400000UL, 16, 16, 30, 6, 8 };
+
+static T_AutoZeroCB zcb;
+static uint32_t low[AUTOZERO_CHANNELS];
+static uint32_t high[AUTOZERO_CHANNELS];
+static uint32_t stores;
+
+static void store(void)
+{
+   stores++;
+}
+
+// Feeds the same reading count times, two seconds apart
+static uint32_t feed(int32_t a, int32_t b, int32_t c, uint8_t zone, uint32_t count, uint32_t now)
+{
+   const int32_t readings[AUTOZERO_CHANNELS] = { a, b, c };
+
+   for (uint32_t n = 0; n < count; n++) {
+      AutoZero_Update(&zcb, readings, zone, now);
+      now += 2000;
+   }
+   return now;
+}
+
+TEST_GROUP(autozeroTests)
+{
+   void setup()
+   {
+      for (uint8_t j = 0; j < AUTOZERO_CHANNELS; j++) {
+         low[j] = 600;
+         high[j] = 2600;
+      }
+      stores = 0;
+      AutoZero_Init(&zcb, &policy, low, high, store);
+   }
+
+   void teardown()
+   {
+   }
+};
+
+TEST(autozeroTests, initChecksArguments)
+{
+   const T_AutoZeroPolicy neverStable = { 86400000UL, 8, 8, 0, 8, 10 };
+   const T_AutoZeroPolicy tooSlow = { 86400000UL, 8, 8, 30, 13, 10 };
+
+   BYTES_EQUAL(AUTOZERO_FAILURE, AutoZero_Init(NULL, &policy, low, high, store));
+   BYTES_EQUAL(AUTOZERO_FAILURE, AutoZero_Init(&zcb, NULL, low, high, store));
+   BYTES_EQUAL(AUTOZERO_FAILURE, AutoZero_Init(&zcb, &policy, NULL, high, store));
+   BYTES_EQUAL(AUTOZERO_FAILURE, AutoZero_Init(&zcb, &policy, low, NULL, store));
+   BYTES_EQUAL(AUTOZERO_FAILURE, AutoZero_Init(&zcb, &policy, low, high, NULL));
+   BYTES_EQUAL(AUTOZERO_FAILURE, AutoZero_Init(&zcb, &neverStable, low, high, store));
+   BYTES_EQUAL(AUTOZERO_FAILURE, AutoZero_Init(&zcb, &tooSlow, low, high, store));
+   BYTES_EQUAL(AUTOZERO_SUCCESS, AutoZero_Init(&zcb, &policy, low, high, store));
+}
+
+TEST(autozeroTests, loadedReadingsAreNotTracked)
+{
+   feed(1500, 1500, 1500, AUTOZERO_LOADED, 2000, 0);
+   LONGS_EQUAL(600, low[0]);
+   LONGS_EQUAL(2600, high[0]);
+   LONGS_EQUAL(0, zcb.stats.emptyReadings + zcb.stats.fullReadings);
+}
+
+TEST(autozeroTests, emptyIsTrackedOnlyOnceStable)
+{
+   uint32_t now = feed(620, 600, 600, AUTOZERO_EMPTY, 30, 0);
+
+   LONGS_EQUAL(600, low[0]);
+   LONGS_EQUAL(0, zcb.stats.emptyReadings);
+   feed(620, 600, 600, AUTOZERO_EMPTY, 1, now);
+   LONGS_EQUAL(1, zcb.stats.emptyReadings);
+}
+
+TEST(autozeroTests, movingReadingsStartTheCountOver)
+{
+   uint32_t now = 0;
+
+   for (uint8_t n = 0; n < 100; n++) {
+      now = feed(600 + (n & 1) * 20, 600, 600, AUTOZERO_EMPTY, 1, now);
+   }
+   LONGS_EQUAL(0, zcb.stats.emptyReadings);
+   now = feed(600, 600, 600, AUTOZERO_FULL, 20, now);
+   now = feed(600, 600, 600, AUTOZERO_EMPTY, 20, now);
+   LONGS_EQUAL(0, zcb.stats.emptyReadings + zcb.stats.fullReadings);
+}
+
+TEST(autozeroTests, emptyPullsTheLowLimitSlowly)
+{
+   uint32_t now = feed(640, 600, 580, AUTOZERO_EMPTY, 30, 0);
+
+   // one time constant gets most of the way, five all of it
+   now = feed(640, 600, 580, AUTOZERO_EMPTY, 64, now);
+   CHECK((low[0] > 620) && (low[0] < 630));
+   CHECK((low[2] > 584) && (low[2] < 590));
+   LONGS_EQUAL(600, low[1]);
+   feed(640, 600, 580, AUTOZERO_EMPTY, 4 * 64, now);
+   LONGS_EQUAL(640, low[0]);
+   LONGS_EQUAL(580, low[2]);
+   LONGS_EQUAL(2600, high[0]);
+}
+
+TEST(autozeroTests, fullPullsTheHighLimitMoreSlowly)
+{
+   uint32_t now = feed(2700, 2600, 2600, AUTOZERO_FULL, 30 + 64, 0);
+
+   CHECK((high[0] > 2620) && (high[0] < 2630));
+   now = feed(2700, 2600, 2600, AUTOZERO_FULL, 192, now);
+   CHECK((high[0] > 2655) && (high[0] < 2670));
+   feed(2700, 2600, 2600, AUTOZERO_FULL, 5 * 256, now);
+   LONGS_EQUAL(2700, high[0]);
+   LONGS_EQUAL(600, low[0]);
+}
+
+TEST(autozeroTests, storedOnlyOnceALimitMovesPastTheThreshold)
+{
+   uint32_t now = feed(607, 600, 600, AUTOZERO_EMPTY, 5000, 0);
+
+   LONGS_EQUAL(607, low[0]);
+   LONGS_EQUAL(0, stores);
+   now = feed(640, 600, 600, AUTOZERO_EMPTY, 5000, now);
+   LONGS_EQUAL(640, low[0]);
+   // at 616 and 632, but not for the last 8 counts to 640
+   LONGS_EQUAL(2, stores);
+   LONGS_EQUAL(stores, zcb.stats.stores);
+}
+
+TEST(autozeroTests, restartTakesTheLimitsAsStored)
+{
+   uint32_t now = feed(650, 600, 600, AUTOZERO_EMPTY, 5000, 0);
+   uint32_t storesBefore = stores;
+
+   // a factory calibration sets and stores the limits itself
+   low[0] = 700;
+   AutoZero_Restart(&zcb);
+   feed(705, 600, 600, AUTOZERO_EMPTY, 5000, now);
+   LONGS_EQUAL(705, low[0]);
+   LONGS_EQUAL(storesBefore, stores);
+}
+
+TEST(autozeroTests, driftIsMeasuredOnceCaughtUpAndOverAWindow)
+{
+   uint32_t now = 0xf0000000UL;
+
+   LONGS_EQUAL(0, AutoZero_DriftPerDay(&zcb));
+   // caught up four time constants into being empty, and again two days
+   // later with each empty reading 6 counts higher
+   now = feed(600, 600, 600, AUTOZERO_EMPTY, 31 + 4 * 64 - 1, now);
+   now = feed(600, 600, 600, AUTOZERO_EMPTY, 1, now);
+   LONGS_EQUAL(0, AutoZero_DriftPerDay(&zcb));
+   now = feed(600, 600, 600, AUTOZERO_LOADED, 86400 - 30 - 4 * 64 - 1, now);
+   now = feed(606, 606, 606, AUTOZERO_EMPTY, 31 + 4 * 64 - 1, now);
+   LONGS_EQUAL(0, AutoZero_DriftPerDay(&zcb));
+   now = feed(606, 606, 606, AUTOZERO_EMPTY, 1, now);
+   LONGS_EQUAL(9, AutoZero_DriftPerDay(&zcb));
+   // not again until another day has passed
+   feed(612, 612, 612, AUTOZERO_EMPTY, 2000, now);
+   LONGS_EQUAL(9, AutoZero_DriftPerDay(&zcb));
+}
+
+/*
+ * Four weeks of a fridge, a reading every two seconds.  The empty reading
+ * of each FSR creeps a few counts a day and swings with the temperature
+ * over the day, and the full scale span grows a little; the readings have
+ * a couple of counts of noise.  A gallon is bought on Sundays and used over
+ * the week, three times a day, and is lifted out for a minute or two each
+ * time; once it is used up the scale stays empty until the next one.  The
+ * door is opened for other things a dozen times a day.
+ *
+ * The weight is worked out as applyFsrCurve does, with the factory
+ * calibration only, with the limits overwritten and stored on every door
+ * close near empty or full as the firmware did, and with the tracker.
+ */
+#define DAY 86400000UL
+#define FULL_WEIGHT 60000
+#define DIFF_THRESHOLD 1200
+
+static const int32_t wMax[AUTOZERO_CHANNELS] = { 15016, 30000, 14984 };
+
+struct Fsr {
+   double zero;
+   double creepPerDay;
+   double span;
+   double spanPerDay;
+};
+
+static uint32_t lcg;
+
+static uint32_t nextRandom(void)
+{
+   lcg = lcg * 1664525u + 1013904223u;
+   return lcg >> 8;
+}
+
+static double gaussian(void)
+{
+   double sum = 0;
+
+   for (int n = 0; n < 12; n++) {
+      sum += nextRandom() / 16777216.0;
+   }
+   return sum - 6;
+}
+
+static double trueReading(const Fsr &fsr, uint8_t j, double days, double weight)
+{
+   double zero = fsr.zero + fsr.creepPerDay * days + 2 * sin(2 * M_PI * days);
+   double span = fsr.span * (1 + fsr.spanPerDay * days);
+
+   (void)j;
+   return zero + span * weight / FULL_WEIGHT;
+}
+
+static int32_t weightOf(const int32_t *pReadings, const uint32_t *pLow, const uint32_t *pHigh)
+{
+   int32_t weight = 0;
+
+   for (uint8_t j = 0; j < AUTOZERO_CHANNELS; j++) {
+      if (pReadings[j] >= (int32_t)pLow[j]) {
+         weight += (pReadings[j] - (int32_t)pLow[j]) * wMax[j] / (int32_t)(pHigh[j] - pLow[j]);
+      }
+   }
+   return weight;
+}
+
+static uint8_t zoneOf(int32_t weight)
+{
+   if (weight < DIFF_THRESHOLD) {
+      return AUTOZERO_EMPTY;
+   }
+   if (weight >= FULL_WEIGHT - DIFF_THRESHOLD) {
+      return AUTOZERO_FULL;
+   }
+   return AUTOZERO_LOADED;
+}
+
+struct Accuracy {
+   double squared;
+   double worst;
+   uint32_t count;
+
+   void add(int32_t estimate, double truth)
+   {
+      double error = fabs(estimate - truth) * 100 / FULL_WEIGHT;
+
+      squared += error * error;
+      worst = (error > worst) ? error : worst;
+      count++;
+   }
+
+   double rms(void) const
+   {
+      return sqrt(squared / count);
+   }
+};
+
+TEST(autozeroTests, fourWeeksOfDrift)
+{
+   Fsr fsrs[AUTOZERO_CHANNELS] = { { 610, 4.0, 1900, 0.0004 }, { 580, 6.5, 2300, 0.0003 }, { 640, 2.5, 1800, 0.0005 } };
+   uint32_t factoryLow[AUTOZERO_CHANNELS];
+   uint32_t factoryHigh[AUTOZERO_CHANNELS];
+   uint32_t doorLow[AUTOZERO_CHANNELS];
+   uint32_t doorHigh[AUTOZERO_CHANNELS];
+   uint32_t doorStores = 0;
+   Accuracy factory = { 0, 0, 0 };
+   Accuracy door = { 0, 0, 0 };
+   Accuracy tracked = { 0, 0, 0 };
+   double weight = 0;
+   uint32_t liftedUntil = 0;
+   uint8_t wasLifted = 0;
+   double trueDrift = 0;
+   // ticks wrap ten days in
+   const uint32_t start = (uint32_t)(0x100000000ULL - 10 * DAY);
+
+   lcg = 8642;
+   for (uint8_t j = 0; j < AUTOZERO_CHANNELS; j++) {
+      factoryLow[j] = doorLow[j] = low[j] = (uint32_t)lround(trueReading(fsrs[j], j, 0, 0));
+      factoryHigh[j] = doorHigh[j] = high[j] = (uint32_t)lround(trueReading(fsrs[j], j, 0, FULL_WEIGHT));
+      trueDrift += fsrs[j].creepPerDay;
+   }
+   AutoZero_Init(&zcb, &policy, low, high, store);
+
+   for (uint32_t t = 0; t < 28 * DAY; t += 2000) {
+      double days = (double)t / DAY;
+      uint32_t timeOfDay = t % DAY;
+      uint8_t lifted;
+      int32_t readings[AUTOZERO_CHANNELS];
+      int32_t estimate;
+
+      // a new gallon on Sunday evening, used at seven, noon and seven
+      if ((t % (7 * DAY)) == 18 * 3600000UL) {
+         weight = FULL_WEIGHT;
+         liftedUntil = t + 60000;
+      } else if ((weight > 0) && ((timeOfDay == 7 * 3600000UL) || (timeOfDay == 12 * 3600000UL) ||
+                                  (timeOfDay == 19 * 3600000UL))) {
+         liftedUntil = t + 60000 + (nextRandom() % 60) * 1000;
+         weight -= 2500 + nextRandom() % 2500;
+         if (weight < 3000) {
+            // used up and thrown away
+            weight = 0;
+         }
+      }
+      lifted = (t < liftedUntil);
+
+      for (uint8_t j = 0; j < AUTOZERO_CHANNELS; j++) {
+         readings[j] = (int32_t)lround(trueReading(fsrs[j], j, days, lifted ? 0 : weight) + 2 * gaussian());
+      }
+
+      // the door closes once the jug is back, and a dozen other times a day:
+      // a settled burst of readings
+      if ((wasLifted && !lifted) || (!lifted && (nextRandom() % 3600 == 0))) {
+         int32_t burst[AUTOZERO_CHANNELS];
+         int32_t burstWeight;
+         uint32_t *pLimits = NULL;
+
+         for (uint8_t j = 0; j < AUTOZERO_CHANNELS; j++) {
+            burst[j] = (int32_t)lround(trueReading(fsrs[j], j, days, weight) + 0.5 * gaussian());
+         }
+         burstWeight = weightOf(burst, doorLow, doorHigh);
+         if (burstWeight >= FULL_WEIGHT - DIFF_THRESHOLD) {
+            pLimits = doorHigh;
+         } else if (burstWeight < DIFF_THRESHOLD) {
+            pLimits = doorLow;
+         }
+         if (pLimits != NULL) {
+            for (uint8_t j = 0; j < AUTOZERO_CHANNELS; j++) {
+               pLimits[j] = (uint32_t)burst[j];
+            }
+            doorStores++;
+         }
+      }
+      wasLifted = lifted;
+
+      estimate = weightOf(readings, low, high);
+      AutoZero_Update(&zcb, readings, zoneOf(estimate), start + t);
+
+      // accuracy while the jug sits on the scale, a reading a minute
+      if (!lifted && ((t % 60000) == 0)) {
+         factory.add(weightOf(readings, factoryLow, factoryHigh), weight);
+         door.add(weightOf(readings, doorLow, doorHigh), weight);
+         tracked.add(weightOf(readings, low, high), weight);
+      }
+   }
+
+   printf("\nautozero, 4 weeks: weight error %% of full (rms, max) factory %.2f %.2f, door close %.2f %.2f"
+          " with %u flash writes, tracked %.2f %.2f with %u flash writes; zero drift %d counts/day (true %.0f)\n",
+          factory.rms(), factory.worst, door.rms(), door.worst, doorStores, tracked.rms(), tracked.worst,
+          zcb.stats.stores, AutoZero_DriftPerDay(&zcb), trueDrift);
+   CHECK(tracked.rms() < door.rms());
+   CHECK(tracked.rms() < factory.rms() / 2);
+   CHECK(zcb.stats.stores * 4 < doorStores);
+   CHECK(fabs(AutoZero_DriftPerDay(&zcb) - trueDrift) < trueDrift / 2);
+}
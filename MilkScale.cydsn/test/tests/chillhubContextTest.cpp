@@ -0,0 +1,244 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTestExt/MockSupport.h"
+#include <stdint.h>
+#include <string.h>
+#include <deque>
+#include <vector>
+#include "fakeHub.h"
+
+using namespace std;
+
+/*
+ * Two links side by side, each with its own serial port and callbacks.
+ */
+static deque<uint8_t> rxA;
+static deque<uint8_t> rxB;
+static vector<uint8_t> txA;
+static vector<uint8_t> txB;
+static vector<uint8_t> gotA;
+static vector<uint8_t> gotB;
+
+static void writeA(const uint8 wrBuf[], uint32 count)
+{
+   txA.insert(txA.end(), wrBuf, wrBuf + count);
+}
+
+static void writeB(const uint8 wrBuf[], uint32 count)
+{
+   txB.insert(txB.end(), wrBuf, wrBuf + count);
+}
+
+static uint32 availableA(void)
+{
+   return rxA.size();
+}
+
+static uint32 availableB(void)
+{
+   return rxB.size();
+}
+
+static uint32 readA(void)
+{
+   uint8_t b = rxA.front();
+   rxA.pop_front();
+   return b;
+}
+
+static uint32 readB(void)
+{
+   uint8_t b = rxB.front();
+   rxB.pop_front();
+   return b;
+}
+
+static void print(const char8 string[])
+{
+   (void)string;
+}
+
+static const T_Serial serialA = { writeA, availableA, readA, print };
+static const T_Serial serialB = { writeB, availableB, readB, print };
+
+static void doorA(uint8_t dataType, void *pData)
+{
+   (void)dataType;
+   gotA.push_back(*(uint8_t *)pData);
+}
+
+static void doorB(uint8_t dataType, void *pData)
+{
+   (void)dataType;
+   gotB.push_back(*(uint8_t *)pData);
+}
+
+static vector<vector<uint8_t> > hooked;
+static void *hookedUserData;
+
+static void frameHook(T_ChillHubCB *pControlBlock, const uint8_t *pMsg, uint8_t length)
+{
+   hookedUserData = pControlBlock->pUserData;
+   hooked.push_back(vector<uint8_t>(pMsg, pMsg + length));
+}
+
+static void queue(deque<uint8_t> &rx, const vector<uint8_t> &msg)
+{
+   vector<uint8_t> wire = FakeHub::frame(msg);
+   rx.insert(rx.end(), wire.begin(), wire.end());
+}
+
+TEST_GROUP(chillhubContextTests)
+{
+   T_ChillHubCB a;
+   T_ChillHubCB b;
+
+   void setup()
+   {
+      rxA.clear();
+      rxB.clear();
+      txA.clear();
+      txB.clear();
+      gotA.clear();
+      gotB.clear();
+      hooked.clear();
+      hookedUserData = NULL;
+      ChillHub_Init(&a);
+      ChillHub_Init(&b);
+      ChillHub_Setup(&a, "scaleA", "uuidA", &serialA);
+      ChillHub_Setup(&b, "scaleB", "uuidB", &serialB);
+      ChillHub_Subscribe(&a, doorStatusMsgType, doorA);
+      ChillHub_Subscribe(&b, doorStatusMsgType, doorB);
+   }
+
+   void teardown()
+   {
+   }
+
+   // One loop pass per link in turn, the way a gateway would poll them.
+   void pumpBoth()
+   {
+      for (int guard = 0; guard < 10000; guard++) {
+         ChillHub_Loop(&a);
+         ChillHub_Loop(&b);
+         if (rxA.empty() && rxB.empty() && ChillHub_IsIdle(&a) && ChillHub_IsIdle(&b)) {
+            break;
+         }
+      }
+   }
+};
+
+TEST(chillhubContextTests, setupAnnouncesOnItsOwnPort)
+{
+   CHECK(txA.size() > 0);
+   CHECK(txB.size() > 0);
+   CHECK(txA != txB);
+   LONGS_EQUAL(2, ChillHub_GetStats(&a)->framesTx);
+   LONGS_EQUAL(2, ChillHub_GetStats(&b)->framesTx);
+}
+
+TEST(chillhubContextTests, interleavedLinksDeliverTheirOwnFrames)
+{
+   queue(rxA, { doorStatusMsgType, unsigned8DataType, 1 });
+   queue(rxB, { doorStatusMsgType, unsigned8DataType, 0xff });
+   queue(rxA, { doorStatusMsgType, unsigned8DataType, 2 });
+   queue(rxB, { doorStatusMsgType, unsigned8DataType, 0xfe });
+   pumpBoth();
+
+   LONGS_EQUAL(2, gotA.size());
+   LONGS_EQUAL(1, gotA[0]);
+   LONGS_EQUAL(2, gotA[1]);
+   LONGS_EQUAL(2, gotB.size());
+   LONGS_EQUAL(0xff, gotB[0]);
+   LONGS_EQUAL(0xfe, gotB[1]);
+}
+
+TEST(chillhubContextTests, partialFrameOnOneLinkLeavesTheOtherAlone)
+{
+   vector<uint8_t> wire = FakeHub::frame({ doorStatusMsgType, unsigned8DataType, 7 });
+
+   rxA.insert(rxA.end(), wire.begin(), wire.begin() + 3);
+   queue(rxB, { doorStatusMsgType, unsigned8DataType, 8 });
+   pumpBoth();
+
+   LONGS_EQUAL(0, gotA.size());
+   LONGS_EQUAL(1, gotB.size());
+
+   rxA.insert(rxA.end(), wire.begin() + 3, wire.end());
+   pumpBoth();
+
+   LONGS_EQUAL(1, gotA.size());
+   LONGS_EQUAL(7, gotA[0]);
+   LONGS_EQUAL(1, gotB.size());
+}
+
+TEST(chillhubContextTests, statisticsArePerLink)
+{
+   vector<uint8_t> wire = FakeHub::frame({ doorStatusMsgType, unsigned8DataType, 1 });
+
+   wire[wire.size() - 1] ^= 0x01;
+   rxA.insert(rxA.end(), wire.begin(), wire.end());
+   queue(rxB, { doorStatusMsgType, unsigned8DataType, 1 });
+   pumpBoth();
+
+   LONGS_EQUAL(1, ChillHub_GetStats(&a)->crcFailures);
+   LONGS_EQUAL(0, ChillHub_GetStats(&a)->framesRx);
+   LONGS_EQUAL(0, ChillHub_GetStats(&b)->crcFailures);
+   LONGS_EQUAL(1, ChillHub_GetStats(&b)->framesRx);
+}
+
+TEST(chillhubContextTests, callbackTablesArePerLink)
+{
+   ChillHub_Unsubscribe(&a, doorStatusMsgType);
+   queue(rxA, { doorStatusMsgType, unsigned8DataType, 1 });
+   queue(rxB, { doorStatusMsgType, unsigned8DataType, 1 });
+   pumpBoth();
+
+   LONGS_EQUAL(0, gotA.size());
+   LONGS_EQUAL(1, ChillHub_GetStats(&a)->unhandledMessages);
+   LONGS_EQUAL(1, gotB.size());
+}
+
+TEST(chillhubContextTests, setupKeepsStatisticsInitClearsThem)
+{
+   ChillHub_CountUsbReset(&a);
+   ChillHub_Setup(&a, "scaleA", "uuidA", &serialA);
+   LONGS_EQUAL(1, ChillHub_GetStats(&a)->usbResets);
+
+   ChillHub_Init(&a);
+   LONGS_EQUAL(0, ChillHub_GetStats(&a)->usbResets);
+   LONGS_EQUAL(0, ChillHub_GetStats(&a)->framesTx);
+}
+
+TEST(chillhubContextTests, singletonIsAnIndependentLink)
+{
+   T_ChillHubStats before;
+
+   FakeHub::reset();
+   ChillHub.setup("scale", "uuid", &FakeHub::serial);
+   memcpy(&before, ChillHub.getStats(), sizeof(before));
+   queue(rxA, { doorStatusMsgType, unsigned8DataType, 1 });
+   pumpBoth();
+
+   LONGS_EQUAL(1, gotA.size());
+   LONGS_EQUAL(before.framesRx, ChillHub.getStats()->framesRx);
+   LONGS_EQUAL(before.bytesRx, ChillHub.getStats()->bytesRx);
+}
+
+TEST(chillhubContextTests, frameHookSeesGoodFramesBeforeDispatch)
+{
+   vector<uint8_t> bad = FakeHub::frame({ doorStatusMsgType, unsigned8DataType, 3 });
+
+   ChillHub_SetFrameHook(&a, frameHook, &b);
+   bad[bad.size() - 1] ^= 0x01;
+   rxA.insert(rxA.end(), bad.begin(), bad.end());
+   queue(rxA, { doorStatusMsgType, unsigned8DataType, 0xff });
+   queue(rxA, { 0x70, arrayDataType, 2, unsigned8DataType, 0xfe, 9 });
+   pumpBoth();
+
+   LONGS_EQUAL(2, hooked.size());
+   CHECK(hooked[0] == vector<uint8_t>({ doorStatusMsgType, unsigned8DataType, 0xff }));
+   CHECK(hooked[1] == vector<uint8_t>({ 0x70, arrayDataType, 2, unsigned8DataType, 0xfe, 9 }));
+   POINTERS_EQUAL(&b, hookedUserData);
+   LONGS_EQUAL(1, gotA.size());
+   LONGS_EQUAL(1, ChillHub_GetStats(&a)->unhandledMessages);
+}
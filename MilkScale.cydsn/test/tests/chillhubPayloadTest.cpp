@@ -0,0 +1,358 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTestExt/MockSupport.h"
+#include <stdint.h>
+#include <string.h>
+#include <deque>
+#include <vector>
+#include "fakeHub.h"
+
+using namespace std;
+
+static T_ChillHubPayload view(const vector<uint8_t> &data, uint8_t dataType)
+{
+   return ChillHubPayload_Make(data.empty() ? NULL : &data[0], (uint8_t)data.size(), dataType);
+}
+
+TEST_GROUP(chillhubPayloadTests)
+{
+   void setup()
+   {
+   }
+
+   void teardown()
+   {
+   }
+};
+
+TEST(chillhubPayloadTests, scalarsDecodeBigEndian)
+{
+   vector<uint8_t> data = { 0xfe, 0xdc, 0xba, 0x98 };
+   T_ChillHubPayload payload;
+   uint8_t u8;
+   int8_t i8;
+   uint16_t u16;
+   int16_t i16;
+   uint32_t u32;
+   int32_t i32;
+
+   payload = view(data, unsigned8DataType);
+   CHECK(ChillHubPayload_AsU8(&payload, &u8));
+   LONGS_EQUAL(0xfe, u8);
+   payload = view(data, signed8DataType);
+   CHECK(ChillHubPayload_AsI8(&payload, &i8));
+   LONGS_EQUAL(-2, i8);
+   payload = view(data, unsigned16DataType);
+   CHECK(ChillHubPayload_AsU16(&payload, &u16));
+   LONGS_EQUAL(0xfedc, u16);
+   payload = view(data, signed16DataType);
+   CHECK(ChillHubPayload_AsI16(&payload, &i16));
+   LONGS_EQUAL(-292, i16);
+   payload = view(data, unsigned32DataType);
+   CHECK(ChillHubPayload_AsU32(&payload, &u32));
+   LONGS_EQUAL(0xfedcba98UL, u32);
+   payload = view(data, signed32DataType);
+   CHECK(ChillHubPayload_AsI32(&payload, &i32));
+   LONGS_EQUAL((int32_t)0xfedcba98UL, i32);
+}
+
+TEST(chillhubPayloadTests, wrongTypeOrShortDataFailsAndLeavesTheResult)
+{
+   vector<uint8_t> data = { 1, 2, 3 };
+   T_ChillHubPayload payload = view(data, unsigned16DataType);
+   uint8_t u8 = 42;
+   uint32_t u32 = 42;
+
+   CHECK(!ChillHubPayload_AsU8(&payload, &u8));
+   CHECK(!ChillHubPayload_AsU32(&payload, &u32));
+   LONGS_EQUAL(42, u8);
+   LONGS_EQUAL(42, u32);
+
+   payload = view(data, unsigned32DataType);
+   CHECK(!ChillHubPayload_AsU32(&payload, &u32));
+   LONGS_EQUAL(42, u32);
+}
+
+TEST(chillhubPayloadTests, unsignedTakesEveryWidth)
+{
+   vector<uint8_t> data = { 0x12, 0x34, 0x56, 0x78 };
+   T_ChillHubPayload payload;
+   uint32_t value;
+
+   payload = view(data, unsigned8DataType);
+   CHECK(ChillHubPayload_AsUnsigned(&payload, &value));
+   LONGS_EQUAL(0x12, value);
+   payload = view(data, unsigned16DataType);
+   CHECK(ChillHubPayload_AsUnsigned(&payload, &value));
+   LONGS_EQUAL(0x1234, value);
+   payload = view(data, unsigned32DataType);
+   CHECK(ChillHubPayload_AsUnsigned(&payload, &value));
+   LONGS_EQUAL(0x12345678UL, value);
+   payload = view(data, signed16DataType);
+   CHECK(!ChillHubPayload_AsUnsigned(&payload, &value));
+}
+
+TEST(chillhubPayloadTests, stringMustFitItsLength)
+{
+   vector<uint8_t> data = { 4, 'u', 'u', 'i', 'd' };
+   T_ChillHubPayload payload = view(data, stringDataType);
+   const char *pChars = NULL;
+   uint8_t length = 0;
+
+   CHECK(ChillHubPayload_AsString(&payload, &pChars, &length));
+   LONGS_EQUAL(4, length);
+   CHECK(memcmp(pChars, "uuid", 4) == 0);
+   POINTERS_EQUAL(&data[1], pChars);
+
+   data[0] = 5;
+   payload = view(data, stringDataType);
+   CHECK(!ChillHubPayload_AsString(&payload, &pChars, &length));
+}
+
+TEST(chillhubPayloadTests, arrayElementsAreViewsInPlace)
+{
+   vector<uint8_t> data = { 3, unsigned16DataType, 0x00, 0x01, 0xfe, 0xff, 0x12, 0x34 };
+   T_ChillHubPayload payload = view(data, arrayDataType);
+   T_ChillHubPayload element;
+   T_ChillHubIter iter;
+   vector<uint16_t> values;
+   uint16_t value;
+
+   CHECK(ChillHubPayload_AsArray(&payload, &iter));
+   LONGS_EQUAL(3, iter.remaining);
+   while (ChillHubIter_Next(&iter, &element)) {
+      CHECK(ChillHubPayload_AsU16(&element, &value));
+      values.push_back(value);
+   }
+   CHECK(values == vector<uint16_t>({ 1, 0xfeff, 0x1234 }));
+   POINTERS_EQUAL(&data[data.size()], iter.pData);
+}
+
+TEST(chillhubPayloadTests, arrayCutShortStops)
+{
+   vector<uint8_t> data = { 3, unsigned16DataType, 0x00, 0x01, 0xfe };
+   T_ChillHubPayload payload = view(data, arrayDataType);
+   T_ChillHubPayload element;
+   T_ChillHubIter iter;
+
+   CHECK(ChillHubPayload_AsArray(&payload, &iter));
+   CHECK(ChillHubIter_Next(&iter, &element));
+   CHECK(!ChillHubIter_Next(&iter, &element));
+   LONGS_EQUAL(0, iter.remaining);
+   CHECK(!ChillHubIter_Next(&iter, &element));
+}
+
+TEST(chillhubPayloadTests, arrayOfStringsWalksEachString)
+{
+   // what setup sends: the device type and the UUID
+   vector<uint8_t> data = { 2, stringDataType, 5, 's', 'c', 'a', 'l', 'e', 4, 'u', 'u', 'i', 'd' };
+   T_ChillHubPayload payload = view(data, arrayDataType);
+   T_ChillHubPayload element;
+   T_ChillHubIter iter;
+   const char *pChars;
+   uint8_t length;
+
+   CHECK(ChillHubPayload_AsArray(&payload, &iter));
+   CHECK(ChillHubIter_Next(&iter, &element));
+   CHECK(ChillHubPayload_AsString(&element, &pChars, &length));
+   LONGS_EQUAL(5, length);
+   CHECK(ChillHubIter_Next(&iter, &element));
+   CHECK(ChillHubPayload_AsString(&element, &pChars, &length));
+   CHECK(memcmp(pChars, "uuid", 4) == 0);
+   CHECK(!ChillHubIter_Next(&iter, &element));
+}
+
+TEST(chillhubPayloadTests, nestedArrayHasItsWholeLength)
+{
+   vector<uint8_t> data = { 2, arrayDataType, 2, unsigned8DataType, 1, 2, 1, unsigned16DataType, 0x12, 0x34 };
+   T_ChillHubPayload payload = view(data, arrayDataType);
+   T_ChillHubPayload element;
+   T_ChillHubIter iter;
+
+   CHECK(ChillHubPayload_AsArray(&payload, &iter));
+   CHECK(ChillHubIter_Next(&iter, &element));
+   LONGS_EQUAL(4, element.length);
+   CHECK(ChillHubIter_Next(&iter, &element));
+   LONGS_EQUAL(4, element.length);
+   CHECK(!ChillHubIter_Next(&iter, &element));
+}
+
+TEST(chillhubPayloadTests, jsonFieldsHaveKeysAndTypedValues)
+{
+   // the data of the registerResource message for the weight
+   vector<uint8_t> data = {
+      4, 4, 'n', 'a', 'm', 'e', stringDataType, 6, 'w', 'e', 'i', 'g', 'h', 't',
+      5, 'r', 'e', 's', 'I', 'D', unsigned8DataType, 0x91,
+      5, 'c', 'a', 'n', 'U', 'p', unsigned8DataType, 0,
+      7, 'i', 'n', 'i', 't', 'V', 'a', 'l', unsigned16DataType, 0x01, 0xfe };
+   T_ChillHubPayload payload = view(data, jsonDataType);
+   T_ChillHubPayload value;
+   T_ChillHubIter iter;
+   const char *pKey;
+   uint8_t keyLength;
+   uint8_t u8;
+   uint16_t u16;
+
+   CHECK(ChillHubPayload_AsJson(&payload, &iter));
+   CHECK(ChillHubIter_NextField(&iter, &pKey, &keyLength, &value));
+   CHECK((keyLength == 4) && (memcmp(pKey, "name", 4) == 0));
+   LONGS_EQUAL(stringDataType, value.dataType);
+   CHECK(ChillHubIter_NextField(&iter, &pKey, &keyLength, &value));
+   CHECK(ChillHubPayload_AsU8(&value, &u8));
+   LONGS_EQUAL(0x91, u8);
+   CHECK(ChillHubIter_NextField(&iter, &pKey, &keyLength, &value));
+   CHECK(ChillHubIter_NextField(&iter, &pKey, &keyLength, &value));
+   CHECK((keyLength == 7) && (memcmp(pKey, "initVal", 7) == 0));
+   CHECK(ChillHubPayload_AsU16(&value, &u16));
+   LONGS_EQUAL(0x01fe, u16);
+   CHECK(!ChillHubIter_NextField(&iter, &pKey, &keyLength, &value));
+
+   // the same object, cut in the last key
+   payload.length = 34;
+   CHECK(ChillHubPayload_AsJson(&payload, &iter));
+   CHECK(ChillHubIter_NextField(&iter, &pKey, &keyLength, &value));
+   CHECK(ChillHubIter_NextField(&iter, &pKey, &keyLength, &value));
+   CHECK(ChillHubIter_NextField(&iter, &pKey, &keyLength, &value));
+   CHECK(!ChillHubIter_NextField(&iter, &pKey, &keyLength, &value));
+   LONGS_EQUAL(0x100, ChillHubPayload_ValueLength(jsonDataType, payload.pData, payload.length));
+   LONGS_EQUAL(data.size(), ChillHubPayload_ValueLength(jsonDataType, &data[0], (uint8_t)data.size()));
+}
+
+/*
+ * Dispatch hands out views of the receive buffer itself.
+ */
+static deque<uint8_t> rx;
+static T_ChillHubCB link;
+static vector<const uint8_t *> callbackData;
+static vector<T_ChillHubPayload> callbackViews;
+
+static void write(const uint8 wrBuf[], uint32 count)
+{
+   (void)wrBuf;
+   (void)count;
+}
+
+static uint32 available(void)
+{
+   return rx.size();
+}
+
+static uint32 read(void)
+{
+   uint8_t b = rx.front();
+   rx.pop_front();
+   return b;
+}
+
+static void print(const char8 string[])
+{
+   (void)string;
+}
+
+static const T_Serial serial = { write, available, read, print };
+
+static void recordingCallback(uint8_t dataType, void *pData)
+{
+   (void)dataType;
+   callbackData.push_back((const uint8_t *)pData);
+   callbackViews.push_back(*ChillHub_GetPayload(&link));
+}
+
+TEST_GROUP(chillhubDispatchViewTests)
+{
+   void setup()
+   {
+      rx.clear();
+      callbackData.clear();
+      callbackViews.clear();
+      ChillHub_Init(&link);
+      ChillHub_Setup(&link, "scale", "uuid", &serial);
+   }
+
+   void teardown()
+   {
+   }
+
+   void deliver(const vector<uint8_t> &msg)
+   {
+      vector<uint8_t> wire = FakeHub::frame(msg);
+
+      rx.insert(rx.end(), wire.begin(), wire.end());
+      for (int guard = 0; guard < 1000 && (!rx.empty() || !ChillHub_IsIdle(&link)); guard++) {
+         ChillHub_Loop(&link);
+      }
+   }
+
+   bool inReceiveBuffer(const uint8_t *p, uint8_t length)
+   {
+      return (p >= link.recvBuf) && (p + length <= link.recvBuf + sizeof(link.recvBuf));
+   }
+};
+
+TEST(chillhubDispatchViewTests, viewIsTheCallbackDataInTheReceiveBuffer)
+{
+   uint16_t value;
+
+   ChillHub_Subscribe(&link, doorStatusMsgType, recordingCallback);
+   ChillHub_AddCloudListener(&link, 0x97, recordingCallback);
+   deliver({ doorStatusMsgType, unsigned8DataType, 1 });
+   deliver({ 0x97, unsigned16DataType, 0x12, 0x34 });
+
+   LONGS_EQUAL(2, callbackViews.size());
+   for (size_t i = 0; i < callbackViews.size(); i++) {
+      POINTERS_EQUAL(callbackData[i], callbackViews[i].pData);
+      CHECK(inReceiveBuffer(callbackViews[i].pData, callbackViews[i].length));
+   }
+   LONGS_EQUAL(1, callbackViews[0].length);
+   LONGS_EQUAL(2, callbackViews[1].length);
+   CHECK(ChillHubPayload_AsU16(&callbackViews[1], &value));
+   LONGS_EQUAL(0x1234, value);
+}
+
+TEST(chillhubDispatchViewTests, timeIsPassedFromTheReceiveBuffer)
+{
+   ChillHub_GetTime(&link, recordingCallback);
+   deliver({ timeResponseMsgType, arrayDataType, 4, unsigned8DataType, 1, 2, 3, 4 });
+
+   LONGS_EQUAL(1, callbackData.size());
+   CHECK(inReceiveBuffer(callbackData[0], 4));
+   CHECK(memcmp(callbackData[0], "\x01\x02\x03\x04", 4) == 0);
+}
+
+TEST(chillhubDispatchViewTests, alarmIdComesFromTheArray)
+{
+   char cron[] = "* * * * *";
+
+   ChillHub_SetAlarm(&link, 'a', cron, strlen(cron), recordingCallback);
+   deliver({ alarmNotifyMsgType, arrayDataType, 5, unsigned8DataType, 'b', 1, 2, 3, 4 });
+   LONGS_EQUAL(0, callbackData.size());
+   deliver({ alarmNotifyMsgType, arrayDataType, 5, unsigned8DataType, 'a', 5, 6, 7, 8 });
+   LONGS_EQUAL(1, callbackData.size());
+   CHECK(memcmp(callbackData[0], "\x05\x06\x07\x08", 4) == 0);
+}
+
+TEST(chillhubDispatchViewTests, timeThatIsNotU8IsMalformed)
+{
+   ChillHub_GetTime(&link, recordingCallback);
+   deliver({ timeResponseMsgType, arrayDataType, 2, unsigned16DataType, 1, 2, 3, 4 });
+   deliver({ timeResponseMsgType, unsigned32DataType, 4, unsigned8DataType, 1, 2, 3, 4 });
+
+   LONGS_EQUAL(0, callbackData.size());
+   LONGS_EQUAL(2, ChillHub_GetStats(&link)->malformedMessages);
+}
+
+TEST(chillhubDispatchViewTests, frameWithoutTypesIsMalformed)
+{
+   // the CRC of no bytes is 0xffff, so an empty frame checks out
+   const uint8_t empty[] = { 0xff, 0x00, 0xfe, 0xff, 0xfe, 0xff };
+
+   ChillHub_AddCloudListener(&link, 0x97, recordingCallback);
+   rx.insert(rx.end(), empty, empty + sizeof(empty));
+   deliver({ 0x97 });
+   deliver({ 0x97, unsigned8DataType, 1 });
+
+   LONGS_EQUAL(1, callbackViews.size());
+   LONGS_EQUAL(1, callbackViews[0].length);
+   LONGS_EQUAL(1, ChillHub_GetStats(&link)->framesRx);
+   LONGS_EQUAL(2, ChillHub_GetStats(&link)->malformedMessages);
+   LONGS_EQUAL(0, ChillHub_GetStats(&link)->unhandledMessages);
+}
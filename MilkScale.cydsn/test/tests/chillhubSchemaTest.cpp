@@ -0,0 +1,237 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTestExt/MockSupport.h"
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "fakeHub.h"
+
+using namespace std;
+
+/*
+ * Frames the senders put on the wire, recorded before they were generated
+ * from the schema.  They must not change.
+ */
+static const vector<uint8_t> goldenSetup = {
+   0xff, 0x12, 0x11, 0x00, 0x01, 0x02, 0x02, 0x05, 0x73, 0x63, 0x61, 0x6c, 0x65, 0x06, 0x75, 0x75,
+   0x69, 0x64, 0x2d, 0x31, 0x8d, 0x20 };
+static const vector<uint8_t> goldenU8 = { 0xff, 0x04, 0x03, 0x60, 0x03, 0xfe, 0xfe, 0xdf, 0xf5 };
+static const vector<uint8_t> goldenI8 = { 0xff, 0x04, 0x03, 0x61, 0x04, 0xfe, 0xff, 0x61, 0x73 };
+static const vector<uint8_t> goldenU16 = { 0xff, 0x05, 0x04, 0x62, 0x05, 0x12, 0xfe, 0xff, 0xbc, 0xa1 };
+static const vector<uint8_t> goldenI16 = { 0xff, 0x05, 0x04, 0x63, 0x06, 0xfe, 0xfe, 0xd4, 0x53, 0x93 };
+static const vector<uint8_t> goldenBoolean = { 0xff, 0x04, 0x03, 0x64, 0x10, 0x01, 0x4b, 0xe5 };
+static const vector<uint8_t> goldenU8Array = {
+   0xff, 0x08, 0x07, 0x65, 0x01, 0x03, 0x03, 0x01, 0x02, 0xfe, 0xff, 0x43, 0x97 };
+static const vector<uint8_t> goldenSubscribe = { 0xff, 0x04, 0x03, 0x01, 0x03, 0x22, 0x79, 0x5f };
+static const vector<uint8_t> goldenUnsubscribe = { 0xff, 0x04, 0x03, 0x02, 0x03, 0x22, 0x20, 0x0f };
+static const vector<uint8_t> goldenSetAlarm = {
+   0xff, 0x10, 0x0f, 0x03, 0x02, 0x0c, 0x61, 0x2a, 0x2f, 0x35, 0x20, 0x2a, 0x20, 0x2a, 0x20, 0x2a,
+   0x20, 0x2a, 0x94, 0xe5 };
+static const vector<uint8_t> goldenUnsetAlarm = { 0xff, 0x04, 0x03, 0x04, 0x03, 0x61, 0xea, 0x08 };
+static const vector<uint8_t> goldenGetTime = { 0xff, 0x02, 0x01, 0x06, 0x4e, 0xf8 };
+static const vector<uint8_t> goldenCreateResource = {
+   0xff, 0x2c, 0x2b, 0x09, 0x09, 0x04, 0x04, 0x6e, 0x61, 0x6d, 0x65, 0x02, 0x06, 0x77, 0x65, 0x69,
+   0x67, 0x68, 0x74, 0x05, 0x72, 0x65, 0x73, 0x49, 0x44, 0x03, 0x91, 0x05, 0x63, 0x61, 0x6e, 0x55,
+   0x70, 0x03, 0x00, 0x07, 0x69, 0x6e, 0x69, 0x74, 0x56, 0x61, 0x6c, 0x05, 0x01, 0xfe, 0xfe, 0xe2,
+   0xcd };
+static const vector<uint8_t> goldenUpdateResource = {
+   0xff, 0x13, 0x12, 0x0a, 0x09, 0x02, 0x05, 0x72, 0x65, 0x73, 0x49, 0x44, 0x03, 0x91, 0x03, 0x76,
+   0x61, 0x6c, 0x05, 0xfe, 0xfe, 0xfe, 0xff, 0xc7, 0x05 };
+
+// An empty frame from the hub.  The CRC of no bytes is 0xffff, so it checks
+// out, but it holds neither a message type nor a data type.
+static const vector<uint8_t> goldenEmptyFrame = { 0xff, 0x00, 0xfe, 0xff, 0xfe, 0xff };
+
+static int callbackCount;
+
+static void countingCallback(uint8_t dataType, void *pData)
+{
+   (void)dataType;
+   (void)pData;
+   callbackCount++;
+}
+
+TEST_GROUP(chillhubSchemaTests)
+{
+   void setup()
+   {
+      FakeHub::reset();
+      ChillHub.setup("scale", "uuid-1", &FakeHub::serial);
+      callbackCount = 0;
+   }
+
+   void teardown()
+   {
+   }
+
+   // What was sent since the last call
+   vector<uint8_t> sent()
+   {
+      vector<uint8_t> bytes = FakeHub::tx;
+
+      FakeHub::tx.clear();
+      return bytes;
+   }
+};
+
+TEST(chillhubSchemaTests, setupFrameIsUnchanged)
+{
+   CHECK(sent() == goldenSetup);
+}
+
+TEST(chillhubSchemaTests, scalarFramesAreUnchanged)
+{
+   sent();
+   ChillHub.sendU8Msg(0x60, 0xfe);
+   CHECK(sent() == goldenU8);
+   ChillHub.sendI8Msg(0x61, -1);
+   CHECK(sent() == goldenI8);
+   ChillHub.sendU16Msg(0x62, 0x12ff);
+   CHECK(sent() == goldenU16);
+   ChillHub.sendI16Msg(0x63, -300);
+   CHECK(sent() == goldenI16);
+   ChillHub.sendBooleanMsg(0x64, 1);
+   CHECK(sent() == goldenBoolean);
+}
+
+TEST(chillhubSchemaTests, arrayFrameIsUnchanged)
+{
+   const uint8_t data[] = { 1, 2, 0xff };
+
+   sent();
+   ChillHub.sendU8ArrayMsg(0x65, data, sizeof(data));
+   CHECK(sent() == goldenU8Array);
+}
+
+TEST(chillhubSchemaTests, requestFramesAreUnchanged)
+{
+   char cron[] = "*/5 * * * *";
+
+   sent();
+   ChillHub.subscribe(doorStatusMsgType, countingCallback);
+   CHECK(sent() == goldenSubscribe);
+   ChillHub.unsubscribe(doorStatusMsgType);
+   CHECK(sent() == goldenUnsubscribe);
+   ChillHub.setAlarm('a', cron, strlen(cron), countingCallback);
+   CHECK(sent() == goldenSetAlarm);
+   ChillHub.unsetAlarm('a');
+   CHECK(sent() == goldenUnsetAlarm);
+   ChillHub.getTime(countingCallback);
+   CHECK(sent() == goldenGetTime);
+}
+
+TEST(chillhubSchemaTests, cloudResourceFramesAreUnchanged)
+{
+   sent();
+   ChillHub.createCloudResourceU16("weight", 0x91, 0, 0x01fe);
+   CHECK(sent() == goldenCreateResource);
+   ChillHub.updateCloudResourceU16(0x91, 0xfeff);
+   CHECK(sent() == goldenUpdateResource);
+}
+
+TEST(chillhubSchemaTests, schemaKeepsTheProtocolValues)
+{
+   LONGS_EQUAL(0x00, noDataType);
+   LONGS_EQUAL(0x10, booleanDataType);
+   LONGS_EQUAL(0x0d, keepAliveType);
+   LONGS_EQUAL(0x10, filterAlertMsgType);
+   LONGS_EQUAL(0x2D, iceMakerOperationalStateMsgType);
+   LONGS_EQUAL(3, CHILLHUB_SCALAR_MSG_LEN(unsigned8DataType));
+   LONGS_EQUAL(4, CHILLHUB_SCALAR_MSG_LEN(signed16DataType));
+   LONGS_EQUAL(6, CHILLHUB_SCALAR_MSG_LEN(unsigned32DataType));
+}
+
+TEST(chillhubSchemaTests, shortScalarIsDroppedAsMalformed)
+{
+   T_ChillHubStats before;
+
+   ChillHub.subscribe(doorStatusMsgType, countingCallback);
+   memcpy(&before, ChillHub.getStats(), sizeof(before));
+   FakeHub::queueMessage({ doorStatusMsgType, unsigned8DataType });
+   FakeHub::queueMessage({ doorStatusMsgType, unsigned8DataType, 1 });
+   FakeHub::pump();
+
+   LONGS_EQUAL(1, callbackCount);
+   LONGS_EQUAL(before.framesRx + 2, ChillHub.getStats()->framesRx);
+   LONGS_EQUAL(before.malformedMessages + 1, ChillHub.getStats()->malformedMessages);
+   LONGS_EQUAL(before.unhandledMessages, ChillHub.getStats()->unhandledMessages);
+}
+
+TEST(chillhubSchemaTests, frameShorterThanItsTypesIsDroppedAsMalformed)
+{
+   T_ChillHubStats before;
+
+   ChillHub.subscribe(doorStatusMsgType, countingCallback);
+   memcpy(&before, ChillHub.getStats(), sizeof(before));
+   // no message at all, twice, then a message type without a data type
+   FakeHub::queue(goldenEmptyFrame);
+   FakeHub::queueMessage({});
+   FakeHub::queueMessage({ doorStatusMsgType });
+   FakeHub::queueMessage({ doorStatusMsgType, unsigned8DataType, 1 });
+   FakeHub::pump();
+
+   LONGS_EQUAL(1, callbackCount);
+   LONGS_EQUAL(before.framesRx + 1, ChillHub.getStats()->framesRx);
+   LONGS_EQUAL(before.malformedMessages + 3, ChillHub.getStats()->malformedMessages);
+   LONGS_EQUAL(before.unhandledMessages, ChillHub.getStats()->unhandledMessages);
+}
+
+TEST(chillhubSchemaTests, wrongDataTypeIsDroppedAsMalformed)
+{
+   T_ChillHubStats before;
+
+   ChillHub.subscribe(doorStatusMsgType, countingCallback);
+   ChillHub.subscribe(waterUsageTimerMsgType, countingCallback);
+   memcpy(&before, ChillHub.getStats(), sizeof(before));
+   // long enough for the type they claim, but not the type of the message
+   FakeHub::queueMessage({ doorStatusMsgType, unsigned16DataType, 0, 1 });
+   FakeHub::queueMessage({ doorStatusMsgType, booleanDataType, 1 });
+   FakeHub::queueMessage({ waterUsageTimerMsgType, signed32DataType, 0, 0, 0, 1 });
+   FakeHub::queueMessage({ waterUsageTimerMsgType, unsigned32DataType, 0, 0, 0, 1 });
+   FakeHub::pump();
+
+   LONGS_EQUAL(1, callbackCount);
+   LONGS_EQUAL(before.malformedMessages + 3, ChillHub.getStats()->malformedMessages);
+   LONGS_EQUAL(before.unhandledMessages, ChillHub.getStats()->unhandledMessages);
+}
+
+TEST(chillhubSchemaTests, everyListedMessageTypeHasItsDataType)
+{
+   uint8_t dataType = 0xee;
+
+#define CHECK_MSG_DATA_TYPE(name, value, expected) \
+   CHECK(ChillHub_DataTypeOfMsg(value, &dataType)); \
+   LONGS_EQUAL(expected, dataType);
+   CHILLHUB_MSG_TYPES(CHECK_MSG_DATA_TYPE)
+#undef CHECK_MSG_DATA_TYPE
+
+   dataType = 0xee;
+   CHECK_FALSE(ChillHub_DataTypeOfMsg(0x0e, &dataType));
+   CHECK_FALSE(ChillHub_DataTypeOfMsg(0x91, &dataType));
+   LONGS_EQUAL(0xee, dataType);
+}
+
+TEST(chillhubSchemaTests, shortTimeResponseIsDroppedAsMalformed)
+{
+   T_ChillHubStats before;
+
+   ChillHub.getTime(countingCallback);
+   memcpy(&before, ChillHub.getStats(), sizeof(before));
+   FakeHub::queueMessage({ timeResponseMsgType, arrayDataType, 4, unsigned8DataType, 1, 2, 3 });
+   FakeHub::pump();
+   LONGS_EQUAL(0, callbackCount);
+   LONGS_EQUAL(before.malformedMessages + 1, ChillHub.getStats()->malformedMessages);
+
+   FakeHub::queueMessage({ timeResponseMsgType, arrayDataType, 4, unsigned8DataType, 1, 2, 3, 4 });
+   FakeHub::pump();
+   LONGS_EQUAL(1, callbackCount);
+}
+
+TEST(chillhubSchemaTests, lengthlessDataTypesAreNotChecked)
+{
+   ChillHub.addCloudListener(0x91, countingCallback);
+   FakeHub::queueMessage({ 0x91, jsonDataType });
+   FakeHub::queueMessage({ 0x91, stringDataType, 0 });
+   FakeHub::pump();
+
+   LONGS_EQUAL(2, callbackCount);
+}
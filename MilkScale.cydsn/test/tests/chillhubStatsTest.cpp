@@ -0,0 +1,193 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTestExt/MockSupport.h"
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "fakeHub.h"
+
+using namespace std;
+
+static int callbackCount;
+static T_ChillHubStats before;
+
+static void countingCallback(uint8_t dataType, void *pData)
+{
+   (void)dataType;
+   (void)pData;
+   callbackCount++;
+}
+
+static void noop(uint8_t dataType, void *pData)
+{
+   (void)dataType;
+   (void)pData;
+}
+
+TEST_GROUP(chillhubStatsTests)
+{
+   void setup()
+   {
+      FakeHub::reset();
+      ChillHub.setup("scale", "uuid", &FakeHub::serial);
+      FakeHub::tx.clear();
+      callbackCount = 0;
+      memcpy(&before, ChillHub.getStats(), sizeof(before));
+   }
+
+   void teardown()
+   {
+   }
+
+   const T_ChillHubStats *after()
+   {
+      return ChillHub.getStats();
+   }
+};
+
+TEST(chillhubStatsTests, goodFrameCountsFrameAndBytes)
+{
+   vector<uint8_t> wire = FakeHub::frame({ keepAliveType, unsigned8DataType, 1 });
+
+   ChillHub.subscribe(keepAliveType, countingCallback);
+   FakeHub::queue(wire);
+   FakeHub::pump();
+
+   LONGS_EQUAL(1, callbackCount);
+   LONGS_EQUAL(before.framesRx + 1, after()->framesRx);
+   LONGS_EQUAL(before.bytesRx + wire.size(), after()->bytesRx);
+   LONGS_EQUAL(before.crcFailures, after()->crcFailures);
+   LONGS_EQUAL(before.resyncs, after()->resyncs);
+}
+
+TEST(chillhubStatsTests, badCrcIsCountedAndDropped)
+{
+   vector<uint8_t> wire = FakeHub::frame({ keepAliveType, unsigned8DataType, 1 });
+
+   ChillHub.subscribe(keepAliveType, countingCallback);
+   wire[wire.size() - 1] ^= 0x01;
+   FakeHub::queue(wire);
+   FakeHub::pump();
+
+   LONGS_EQUAL(0, callbackCount);
+   LONGS_EQUAL(before.crcFailures + 1, after()->crcFailures);
+   LONGS_EQUAL(before.framesRx, after()->framesRx);
+}
+
+TEST(chillhubStatsTests, junkBeforeStxCountsOneResync)
+{
+   ChillHub.subscribe(keepAliveType, countingCallback);
+   FakeHub::queue({ 0x11, 0x22, 0x33 });
+   FakeHub::queueMessage({ keepAliveType, unsigned8DataType, 1 });
+   FakeHub::pump();
+
+   LONGS_EQUAL(1, callbackCount);
+   LONGS_EQUAL(before.resyncs + 1, after()->resyncs);
+}
+
+TEST(chillhubStatsTests, escapedStxInsidePayloadIsNotAResync)
+{
+   ChillHub.subscribe(keepAliveType, countingCallback);
+   FakeHub::queueMessage({ keepAliveType, unsigned8DataType, 0xff });
+   FakeHub::queueMessage({ keepAliveType, unsigned8DataType, 0xfe });
+   FakeHub::pump();
+
+   LONGS_EQUAL(2, callbackCount);
+   LONGS_EQUAL(before.framesRx + 2, after()->framesRx);
+   LONGS_EQUAL(before.resyncs, after()->resyncs);
+   LONGS_EQUAL(before.crcFailures, after()->crcFailures);
+}
+
+TEST(chillhubStatsTests, oversizeLengthIsCounted)
+{
+   FakeHub::queue({ 0xff, 70, 1, 2, 3 });
+   FakeHub::pump();
+
+   LONGS_EQUAL(before.oversizeFrames + 1, after()->oversizeFrames);
+}
+
+TEST(chillhubStatsTests, heavilyEscapedFrameFitsThroughBuffer)
+{
+   vector<uint8_t> msg;
+
+   // 87 bytes escaped, more than the packet buffer holds
+   msg.push_back(0x60);
+   msg.push_back(arrayDataType);
+   msg.insert(msg.end(), 40, 0xff);
+   FakeHub::queueMessage(msg);
+   FakeHub::queueMessage({ dcSwitchStateMsgType, unsigned8DataType, 1 });
+   FakeHub::pump();
+
+   LONGS_EQUAL(before.overflowDrops, after()->overflowDrops);
+   LONGS_EQUAL(before.framesRx + 2, after()->framesRx);
+}
+
+TEST(chillhubStatsTests, messageWithoutCallbackIsUnhandled)
+{
+   FakeHub::queueMessage({ dcSwitchStateMsgType, unsigned8DataType, 1 });
+   FakeHub::pump();
+
+   LONGS_EQUAL(before.framesRx + 1, after()->framesRx);
+   LONGS_EQUAL(before.unhandledMessages + 1, after()->unhandledMessages);
+}
+
+TEST(chillhubStatsTests, timeResponseWithoutCallbackIsUnhandled)
+{
+   FakeHub::queueMessage({ timeResponseMsgType, arrayDataType, 4, unsigned8DataType, 1, 2, 3, 4 });
+   FakeHub::pump();
+
+   LONGS_EQUAL(before.unhandledMessages + 1, after()->unhandledMessages);
+}
+
+TEST(chillhubStatsTests, fullCallbackTableIsCounted)
+{
+   for (uint8_t i = 0; i < CHILLHUB_MAX_CALLBACKS + 1; i++) {
+      ChillHub.addCloudListener(0x60 + i, noop);
+   }
+
+   LONGS_EQUAL(before.callbackTableMisses + 1, after()->callbackTableMisses);
+}
+
+TEST(chillhubStatsTests, usbResetsAreCounted)
+{
+   ChillHub.countUsbReset();
+   ChillHub.countUsbReset();
+
+   LONGS_EQUAL(before.usbResets + 2, after()->usbResets);
+}
+
+TEST(chillhubStatsTests, transmittedFramesAndBytesAreCounted)
+{
+   ChillHub.sendU8Msg(0x60, 0xff);
+   ChillHub.sendU16Msg(0x61, 0x1234);
+
+   LONGS_EQUAL(before.framesTx + 2, after()->framesTx);
+   LONGS_EQUAL(before.bytesTx + FakeHub::tx.size(), after()->bytesTx);
+   LONGS_EQUAL(2, FakeHub::sentMessages().size());
+}
+
+TEST(chillhubStatsTests, sendStatsReportsEveryCounterAsU32Array)
+{
+   vector<vector<uint8_t> > sent;
+   const uint32_t *pCounters = (const uint32_t *)ChillHub.getStats();
+   T_ChillHubStats snapshot;
+
+   ChillHub.countUsbReset();
+   memcpy(&snapshot, ChillHub.getStats(), sizeof(snapshot));
+   ChillHub.sendStats(0x96);
+
+   sent = FakeHub::sentMessages();
+   LONGS_EQUAL(1, sent.size());
+   LONGS_EQUAL(4 + 4 * CHILLHUB_STATS_COUNT, sent[0].size());
+   BYTES_EQUAL(0x96, sent[0][0]);
+   BYTES_EQUAL(arrayDataType, sent[0][1]);
+   BYTES_EQUAL(CHILLHUB_STATS_COUNT, sent[0][2]);
+   BYTES_EQUAL(unsigned32DataType, sent[0][3]);
+
+   // the counters as they were when the frame was built
+   pCounters = (const uint32_t *)&snapshot;
+   for (size_t i = 0; i < CHILLHUB_STATS_COUNT; i++) {
+      uint32_t v = ((uint32_t)sent[0][4 + 4 * i] << 24) | (sent[0][5 + 4 * i] << 16) |
+         (sent[0][6 + 4 * i] << 8) | sent[0][7 + 4 * i];
+      LONGS_EQUAL(pCounters[i], v);
+   }
+}
@@ -0,0 +1,152 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTestExt/MockSupport.h"
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+extern "C"
+{
+#include "chillhub.h"
+}
+
+using namespace std;
+
+/*
+ * Two links: one registers its resources and sends updates from templates,
+ * the other never registers and builds every update in full.
+ */
+static vector<uint8_t> txTemplate;
+static vector<uint8_t> txFull;
+
+static void writeTemplate(const uint8 wrBuf[], uint32 count)
+{
+   txTemplate.insert(txTemplate.end(), wrBuf, wrBuf + count);
+}
+
+static void writeFull(const uint8 wrBuf[], uint32 count)
+{
+   txFull.insert(txFull.end(), wrBuf, wrBuf + count);
+}
+
+static uint32 nothingAvailable(void)
+{
+   return 0;
+}
+
+static uint32 readNothing(void)
+{
+   return 0;
+}
+
+static void print(const char8 string[])
+{
+   (void)string;
+}
+
+static const T_Serial serialTemplate = { writeTemplate, nothingAvailable, readNothing, print };
+static const T_Serial serialFull = { writeFull, nothingAvailable, readNothing, print };
+
+TEST_GROUP(chillhubTemplateTests)
+{
+   T_ChillHubCB templated;
+   T_ChillHubCB full;
+
+   void setup()
+   {
+      ChillHub_Init(&templated);
+      ChillHub_Init(&full);
+      ChillHub_Setup(&templated, "scale", "uuid", &serialTemplate);
+      ChillHub_Setup(&full, "scale", "uuid", &serialFull);
+      txTemplate.clear();
+      txFull.clear();
+   }
+
+   void teardown()
+   {
+   }
+
+   void checkEveryValue(uint8_t resID)
+   {
+      for (uint32_t value = 0; value <= 0xffff; value++) {
+         ChillHub_UpdateCloudResourceU16(&templated, resID, (uint16_t)value);
+         ChillHub_UpdateCloudResourceU16(&full, resID, (uint16_t)value);
+         if (txTemplate != txFull) {
+            LONGS_EQUAL(-1, value);
+         }
+         txTemplate.clear();
+         txFull.clear();
+      }
+   }
+};
+
+TEST(chillhubTemplateTests, everyValueMatchesTheFullEncoder)
+{
+   const uint8_t ids[] = { 0x91, 0x00, 0xfe, 0xff };
+
+   for (size_t i = 0; i < sizeof(ids); i += CHILLHUB_MAX_RESOURCES) {
+      ChillHub_Init(&templated);
+      ChillHub_Setup(&templated, "scale", "uuid", &serialTemplate);
+      for (size_t j = i; j < i + CHILLHUB_MAX_RESOURCES; j++) {
+         ChillHub_CreateCloudResourceU16(&templated, "weight", ids[j], 0, 0);
+      }
+      txTemplate.clear();
+      for (size_t j = i; j < i + CHILLHUB_MAX_RESOURCES; j++) {
+         checkEveryValue(ids[j]);
+      }
+   }
+}
+
+TEST(chillhubTemplateTests, statisticsMatchTheFullEncoder)
+{
+   ChillHub_CreateCloudResourceU16(&templated, "weight", 0x91, 0, 0);
+   ChillHub_CreateCloudResourceU16(&full, "weight", 0x92, 0, 0);
+   ChillHub_UpdateCloudResourceU16(&templated, 0x91, 0xfeff);
+   ChillHub_UpdateCloudResourceU16(&full, 0x91, 0xfeff);
+
+   LONGS_EQUAL(ChillHub_GetStats(&full)->framesTx, ChillHub_GetStats(&templated)->framesTx);
+   LONGS_EQUAL(ChillHub_GetStats(&full)->bytesTx, ChillHub_GetStats(&templated)->bytesTx);
+}
+
+TEST(chillhubTemplateTests, registeringAgainKeepsTheSlot)
+{
+   ChillHub_CreateCloudResourceU16(&templated, "weight", 0x91, 0, 0);
+   ChillHub_CreateCloudResourceU16(&templated, "weight", 0x91, 0, 0);
+   ChillHub_CreateCloudResourceU16(&templated, "calibrate", 0x94, 1, 0);
+
+   LONGS_EQUAL(0x91, templated.resourceIds[0]);
+   LONGS_EQUAL(0x94, templated.resourceIds[1]);
+}
+
+TEST(chillhubTemplateTests, resourcesPastTheTableAreBuiltInFull)
+{
+   for (uint8_t i = 0; i < CHILLHUB_MAX_RESOURCES + 1; i++) {
+      ChillHub_CreateCloudResourceU16(&templated, "weight", 0x90 + i, 0, 0);
+   }
+   txTemplate.clear();
+
+   ChillHub_UpdateCloudResourceU16(&templated, 0x90 + CHILLHUB_MAX_RESOURCES, 0x1234);
+   ChillHub_UpdateCloudResourceU16(&full, 0x90 + CHILLHUB_MAX_RESOURCES, 0x1234);
+   CHECK(txTemplate == txFull);
+}
+
+TEST(chillhubTemplateTests, templateTooLongIsRefused)
+{
+   T_ChillHubTemplate tmpl;
+   uint8_t buf[CHILLHUB_TEMPLATE_SIZE] = { 0 };
+
+   CHECK(!ChillHub_InitTemplate(&tmpl, buf, sizeof(buf)));
+   LONGS_EQUAL(0, tmpl.prefixLen);
+   CHECK(ChillHub_InitTemplate(&tmpl, buf, (CHILLHUB_TEMPLATE_SIZE - 3) / 2));
+}
+
+TEST(chillhubTemplateTests, templateFrameMatchesSendPacket)
+{
+   // a U16 message built by hand as a template
+   uint8_t buf[] = { 4, 0x62, unsigned16DataType };
+   T_ChillHubTemplate tmpl;
+
+   CHECK(ChillHub_InitTemplate(&tmpl, buf, sizeof(buf)));
+   ChillHub_SendTemplate(&templated, &tmpl, 0xfeff);
+   ChillHub_SendU16Msg(&full, 0x62, 0xfeff);
+   CHECK(txTemplate == txFull);
+}
@@ -0,0 +1,126 @@
+#include "CppUTest/TestHarness.h"
+#include "fakeHub.h"
+
+extern "C"
+{
+#include "crc.h"
+}
+
+#define STX 0xff
+#define ESC 0xfe
+
+namespace FakeHub
+{
+   std::deque<uint8_t> rx;
+   std::vector<uint8_t> tx;
+
+   static void write(const uint8 wrBuf[], uint32 count)
+   {
+      tx.insert(tx.end(), wrBuf, wrBuf + count);
+   }
+
+   static uint32 available(void)
+   {
+      return rx.size();
+   }
+
+   static uint32 read(void)
+   {
+      uint8_t b = rx.front();
+      rx.pop_front();
+      return b;
+   }
+
+   static void print(const char8 string[])
+   {
+      (void)string;
+   }
+
+   const T_Serial serial = { write, available, read, print };
+
+   void reset(void)
+   {
+      rx.clear();
+      tx.clear();
+   }
+
+   static void putEscaped(std::vector<uint8_t> &out, uint8_t b)
+   {
+      if ((b == STX) || (b == ESC)) {
+         out.push_back(ESC);
+      }
+      out.push_back(b);
+   }
+
+   std::vector<uint8_t> frame(const std::vector<uint8_t> &msg)
+   {
+      std::vector<uint8_t> body;
+      std::vector<uint8_t> out;
+      crc_t crc = crc_init();
+
+      body.push_back((uint8_t)msg.size());
+      body.insert(body.end(), msg.begin(), msg.end());
+      crc = crc_finalize(crc_update(crc, &body[0], body.size()));
+
+      out.push_back(STX);
+      putEscaped(out, (uint8_t)body.size());
+      for (size_t i = 0; i < body.size(); i++) {
+         putEscaped(out, body[i]);
+      }
+      putEscaped(out, (crc >> 8) & 0xff);
+      putEscaped(out, crc & 0xff);
+
+      return out;
+   }
+
+   void queue(const std::vector<uint8_t> &bytes)
+   {
+      rx.insert(rx.end(), bytes.begin(), bytes.end());
+   }
+
+   void queueMessage(const std::vector<uint8_t> &msg)
+   {
+      queue(frame(msg));
+   }
+
+   void pump(void)
+   {
+      int guard = 0;
+
+      do {
+         ChillHub.loop();
+      } while ((!rx.empty() || !ChillHub.isIdle()) && (++guard < 10000));
+   }
+
+   std::vector<std::vector<uint8_t> > sentMessages(void)
+   {
+      std::vector<std::vector<uint8_t> > messages;
+      size_t i = 0;
+
+      while (i < tx.size()) {
+         std::vector<uint8_t> raw;
+         crc_t crc = crc_init();
+         size_t len;
+
+         CHECK_EQUAL(STX, tx[i]);
+         i++;
+         while ((i < tx.size()) && (tx[i] != STX)) {
+            if (tx[i] == ESC) {
+               i++;
+            }
+            raw.push_back(tx[i++]);
+         }
+
+         // STX, total length, payload length, payload..., CRC
+         CHECK(raw.size() >= 4);
+         len = raw[0];
+         LONGS_EQUAL(len + 3, raw.size());
+         LONGS_EQUAL(len - 1, raw[1]);
+         crc = crc_finalize(crc_update(crc, &raw[1], len));
+         LONGS_EQUAL(crc, (raw[len + 1] << 8) | raw[len + 2]);
+         messages.push_back(std::vector<uint8_t>(raw.begin() + 2, raw.begin() + 1 + len));
+      }
+
+      return messages;
+   }
+}
@@ -0,0 +1,41 @@
+/*
+ * A stand-in for the chillhub on the other end of the UART.  It queues
+ * framed messages for the device to read and collects what the device sends.
+ */
+#ifndef FAKEHUB_H
+#define FAKEHUB_H
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+
+extern "C"
+{
+#include "chillhub.h"
+}
+
+namespace FakeHub
+{
+   extern std::deque<uint8_t> rx;
+   extern std::vector<uint8_t> tx;
+   extern const T_Serial serial;
+
+   void reset(void);
+
+   // Frames a message (message type, data type, data...) the way sendPacket
+   // does and returns the bytes on the wire.
+   std::vector<uint8_t> frame(const std::vector<uint8_t> &msg);
+
+   // Queues raw bytes or a framed message for the device to read.
+   void queue(const std::vector<uint8_t> &bytes);
+   void queueMessage(const std::vector<uint8_t> &msg);
+
+   // Runs ChillHub.loop until everything queued has been consumed.
+   void pump(void);
+
+   // Splits what the device sent into de-escaped messages (message type,
+   // data type, data...), checking the framing and CRC of each.
+   std::vector<std::vector<uint8_t> > sentMessages(void);
+}
+
+#endif
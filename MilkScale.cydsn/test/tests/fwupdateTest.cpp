@@ -0,0 +1,379 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTestExt/MockSupport.h"
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "fakeHub.h"
+
+using namespace std;
+
+extern "C"
+{
+#include "crc.h"
+#include "fwupdate.h"
+}
+
+#define STORE_CAPACITY 4096
+
+static T_FwUpdateCB fw;
+static uint8_t store[STORE_CAPACITY];
+static uint32_t storeWritten;
+static int commits;
+static int finishes;
+
+static uint8_t storeBegin(uint32_t size)
+{
+   (void)size;
+   storeWritten = 0;
+   return FW_STORE_SUCCESS;
+}
+
+static uint8_t storeWrite(uint32_t offset, const uint8_t *pData, uint8_t length)
+{
+   if (offset != storeWritten) {
+      return FW_STORE_FAILURE;
+   }
+   memcpy(&store[offset], pData, length);
+   storeWritten += length;
+   return FW_STORE_SUCCESS;
+}
+
+static uint8_t storeFinish(void)
+{
+   finishes++;
+   return FW_STORE_SUCCESS;
+}
+
+static uint8_t storeRead(uint32_t offset, uint8_t *pData, uint8_t length)
+{
+   memcpy(pData, &store[offset], length);
+   return FW_STORE_SUCCESS;
+}
+
+static const T_FwStore ramStore = { STORE_CAPACITY, storeBegin, storeWrite, storeFinish, storeRead };
+
+static void sendStatus(const uint8_t *pStatus, uint8_t length)
+{
+   ChillHub.sendU8ArrayMsg(FW_UPDATE_STATUS_MSG, pStatus, length);
+}
+
+static void commit(void)
+{
+   commits++;
+}
+
+static void onStart(uint8_t dataType, void *pData)
+{
+   (void)dataType;
+   (void)pData;
+   FwUpdate_Start(&fw, ChillHub.getPayload());
+}
+
+static void onData(uint8_t dataType, void *pData)
+{
+   (void)dataType;
+   (void)pData;
+   FwUpdate_Data(&fw, ChillHub.getPayload());
+}
+
+static void onControl(uint8_t dataType, void *pData)
+{
+   (void)dataType;
+   (void)pData;
+   FwUpdate_Control(&fw, ChillHub.getPayload());
+}
+
+static uint16_t crcOf(const uint8_t *p, size_t n)
+{
+   return crc_finalize(crc_update(crc_init(), p, n));
+}
+
+TEST_GROUP(fwupdateTests)
+{
+   vector<uint8_t> image;
+
+   void setup()
+   {
+      FakeHub::reset();
+      ChillHub.setup("scale", "uuid", &FakeHub::serial);
+      ChillHub.addCloudListener(FW_UPDATE_START_MSG, onStart);
+      ChillHub.addCloudListener(FW_UPDATE_DATA_MSG, onData);
+      ChillHub.addCloudListener(FW_UPDATE_CONTROL_MSG, onControl);
+      FwUpdate_Init(&fw, &ramStore, sendStatus, commit);
+      memset(store, 0, sizeof(store));
+      commits = 0;
+      finishes = 0;
+
+      // three full chunks and a short one
+      image.clear();
+      for (int i = 0; i < 3 * FW_UPDATE_CHUNK_SIZE + 10; i++) {
+         image.push_back((uint8_t)(i * 7 + (i >> 3)));
+      }
+      // make sure the escaping is exercised
+      image[5] = 0xff;
+      image[6] = 0xfe;
+      FakeHub::tx.clear();
+   }
+
+   void teardown()
+   {
+   }
+
+   void sendStart(uint32_t size, uint16_t crc)
+   {
+      FakeHub::queueMessage({ FW_UPDATE_START_MSG, arrayDataType, 6, unsigned8DataType,
+                              (uint8_t)(size >> 24), (uint8_t)(size >> 16), (uint8_t)(size >> 8), (uint8_t)size,
+                              (uint8_t)(crc >> 8), (uint8_t)crc });
+      FakeHub::pump();
+   }
+
+   void start()
+   {
+      sendStart(image.size(), crcOf(&image[0], image.size()));
+   }
+
+   void sendChunk(uint16_t seq, uint8_t corrupt = 0)
+   {
+      size_t offset = (size_t)seq * FW_UPDATE_CHUNK_SIZE;
+      size_t length = image.size() - offset;
+      vector<uint8_t> body;
+      vector<uint8_t> msg;
+      uint16_t crc;
+
+      if (length > FW_UPDATE_CHUNK_SIZE) {
+         length = FW_UPDATE_CHUNK_SIZE;
+      }
+      body.push_back(seq >> 8);
+      body.push_back(seq & 0xff);
+      body.insert(body.end(), image.begin() + offset, image.begin() + offset + length);
+      crc = crcOf(&body[0], body.size());
+
+      msg.push_back(FW_UPDATE_DATA_MSG);
+      msg.push_back(arrayDataType);
+      msg.push_back((uint8_t)(length + 4));
+      msg.push_back(unsigned8DataType);
+      msg.push_back(body[0]);
+      msg.push_back(body[1]);
+      msg.push_back(crc >> 8);
+      msg.push_back(crc & 0xff);
+      msg.insert(msg.end(), body.begin() + 2, body.end());
+      msg[8] ^= corrupt;
+      FakeHub::queueMessage(msg);
+      FakeHub::pump();
+   }
+
+   void sendControl(uint8_t command)
+   {
+      FakeHub::queueMessage({ FW_UPDATE_CONTROL_MSG, unsigned8DataType, command });
+      FakeHub::pump();
+   }
+
+   // The status messages sent since the last call, as (state, next sequence, error).
+   vector<vector<uint16_t> > statuses()
+   {
+      vector<vector<uint8_t> > sent = FakeHub::sentMessages();
+      vector<vector<uint16_t> > out;
+
+      for (size_t i = 0; i < sent.size(); i++) {
+         if (sent[i][0] != FW_UPDATE_STATUS_MSG) {
+            continue;
+         }
+         LONGS_EQUAL(4 + FW_UPDATE_STATUS_LENGTH, sent[i].size());
+         BYTES_EQUAL(arrayDataType, sent[i][1]);
+         BYTES_EQUAL(FW_UPDATE_STATUS_LENGTH, sent[i][2]);
+         out.push_back({ sent[i][4], (uint16_t)((sent[i][5] << 8) | sent[i][6]), sent[i][9] });
+      }
+      FakeHub::tx.clear();
+      return out;
+   }
+
+   void checkStatus(const vector<uint16_t> &status, uint16_t state, uint16_t nextSeq, uint16_t error)
+   {
+      LONGS_EQUAL(state, status[0]);
+      LONGS_EQUAL(nextSeq, status[1]);
+      LONGS_EQUAL(error, status[2]);
+   }
+};
+
+TEST(fwupdateTests, startAnswersWithWindowAndChunkSize)
+{
+   vector<vector<uint8_t> > sent;
+
+   start();
+   sent = FakeHub::sentMessages();
+   LONGS_EQUAL(1, sent.size());
+   BYTES_EQUAL(FW_STATE_RECEIVING, sent[0][4]);
+   BYTES_EQUAL(FW_UPDATE_WINDOW, sent[0][7]);
+   BYTES_EQUAL(FW_UPDATE_CHUNK_SIZE, sent[0][8]);
+}
+
+TEST(fwupdateTests, imageLargerThanStoreIsRefused)
+{
+   vector<vector<uint16_t> > s;
+
+   sendStart(STORE_CAPACITY + 1, 0);
+   s = statuses();
+   checkStatus(s[0], FW_STATE_FAILED, 0, FW_ERROR_TOO_BIG);
+}
+
+TEST(fwupdateTests, inOrderChunksAreAcknowledgedEverySecondChunk)
+{
+   vector<vector<uint16_t> > s;
+
+   start();
+   statuses();
+   sendChunk(0);
+   LONGS_EQUAL(0, statuses().size());
+   sendChunk(1);
+   s = statuses();
+   LONGS_EQUAL(1, s.size());
+   checkStatus(s[0], FW_STATE_RECEIVING, 2, FW_ERROR_NONE);
+   sendChunk(2);
+   sendChunk(3);
+   s = statuses();
+   checkStatus(s[0], FW_STATE_COMPLETE, 4, FW_ERROR_NONE);
+   LONGS_EQUAL(1, finishes);
+   MEMCMP_EQUAL(&image[0], store, image.size());
+}
+
+TEST(fwupdateTests, corruptChunkIsNakedOnceAndResent)
+{
+   vector<vector<uint16_t> > s;
+
+   start();
+   sendChunk(0);
+   statuses();
+   sendChunk(1, 0x01);
+   sendChunk(2);
+   sendChunk(3);
+   s = statuses();
+   // one report for the gap, the chunks behind it are dropped quietly
+   LONGS_EQUAL(1, s.size());
+   checkStatus(s[0], FW_STATE_RECEIVING, 1, FW_ERROR_CHUNK_CRC);
+   LONGS_EQUAL(3, fw.rejectedChunks);
+
+   sendChunk(1);
+   sendChunk(2);
+   sendChunk(3);
+   s = statuses();
+   checkStatus(s.back(), FW_STATE_COMPLETE, 4, FW_ERROR_NONE);
+   MEMCMP_EQUAL(&image[0], store, image.size());
+}
+
+TEST(fwupdateTests, countsPastTheReceivedBytesAreRejected)
+{
+   vector<vector<uint16_t> > s;
+
+   // a start claiming 6 bytes with 2 of them sent
+   FakeHub::queueMessage({ FW_UPDATE_START_MSG, arrayDataType, 6, unsigned8DataType, 0, 0 });
+   FakeHub::pump();
+   checkStatus(statuses()[0], FW_STATE_IDLE, 0, FW_ERROR_BAD_MESSAGE);
+
+   start();
+   statuses();
+   // chunk 0 claiming a full chunk with 10 bytes of it sent, and one
+   // claiming far more than a frame holds
+   FakeHub::queueMessage({ FW_UPDATE_DATA_MSG, arrayDataType, FW_UPDATE_CHUNK_SIZE + 4, unsigned8DataType,
+                           0, 0, 0x12, 0x34, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 });
+   FakeHub::queueMessage({ FW_UPDATE_DATA_MSG, arrayDataType, 0xff, unsigned8DataType, 0, 0, 0x12, 0x34, 1 });
+   FakeHub::pump();
+   LONGS_EQUAL(2, fw.rejectedChunks);
+   LONGS_EQUAL(0, statuses().size());
+   LONGS_EQUAL(0, fw.nextSeq);
+
+   // a control message that is not a U8
+   FakeHub::queueMessage({ FW_UPDATE_CONTROL_MSG, unsigned16DataType, 0, FW_UPDATE_VERIFY });
+   FakeHub::pump();
+   checkStatus(statuses()[0], FW_STATE_RECEIVING, 0, FW_ERROR_BAD_MESSAGE);
+
+   sendChunk(0);
+   LONGS_EQUAL(1, fw.nextSeq);
+}
+
+TEST(fwupdateTests, chunkAfterALostOneReportsTheGap)
+{
+   vector<vector<uint16_t> > s;
+
+   start();
+   statuses();
+   sendChunk(1);
+   s = statuses();
+   checkStatus(s[0], FW_STATE_RECEIVING, 0, FW_ERROR_SEQUENCE);
+}
+
+TEST(fwupdateTests, repeatedStartResumes)
+{
+   vector<vector<uint16_t> > s;
+
+   start();
+   sendChunk(0);
+   sendChunk(1);
+   sendChunk(2);
+
+   // the link went through a USB reset, the hub registers the device again
+   ChillHub.setup("scale", "uuid", &FakeHub::serial);
+   ChillHub.addCloudListener(FW_UPDATE_START_MSG, onStart);
+   ChillHub.addCloudListener(FW_UPDATE_DATA_MSG, onData);
+   ChillHub.addCloudListener(FW_UPDATE_CONTROL_MSG, onControl);
+   FakeHub::tx.clear();
+   start();
+   s = statuses();
+   checkStatus(s[0], FW_STATE_RECEIVING, 3, FW_ERROR_NONE);
+   LONGS_EQUAL(1, fw.resumes);
+
+   sendChunk(3);
+   checkStatus(statuses().back(), FW_STATE_COMPLETE, 4, FW_ERROR_NONE);
+   MEMCMP_EQUAL(&image[0], store, image.size());
+}
+
+TEST(fwupdateTests, startForAnotherImageRestarts)
+{
+   start();
+   sendChunk(0);
+   sendChunk(1);
+   statuses();
+   sendStart(image.size(), 0x1234);
+   checkStatus(statuses()[0], FW_STATE_RECEIVING, 0, FW_ERROR_NONE);
+   LONGS_EQUAL(0, fw.resumes);
+}
+
+TEST(fwupdateTests, verifyThenCommitHandsOver)
+{
+   start();
+   for (uint16_t i = 0; i < 4; i++) {
+      sendChunk(i);
+   }
+   statuses();
+   sendControl(FW_UPDATE_COMMIT);
+   checkStatus(statuses()[0], FW_STATE_COMPLETE, 4, FW_ERROR_STATE);
+   LONGS_EQUAL(0, commits);
+
+   sendControl(FW_UPDATE_VERIFY);
+   checkStatus(statuses()[0], FW_STATE_VERIFIED, 4, FW_ERROR_NONE);
+   sendControl(FW_UPDATE_COMMIT);
+   checkStatus(statuses()[0], FW_STATE_COMMITTING, 4, FW_ERROR_NONE);
+   LONGS_EQUAL(1, commits);
+}
+
+TEST(fwupdateTests, verifyCatchesAWrongImage)
+{
+   start();
+   for (uint16_t i = 0; i < 4; i++) {
+      sendChunk(i);
+   }
+   statuses();
+   store[100] ^= 0x80;
+   sendControl(FW_UPDATE_VERIFY);
+   checkStatus(statuses()[0], FW_STATE_FAILED, 4, FW_ERROR_IMAGE_CRC);
+   sendControl(FW_UPDATE_COMMIT);
+   LONGS_EQUAL(0, commits);
+}
+
+TEST(fwupdateTests, verifyBeforeTheLastChunkIsRefused)
+{
+   start();
+   sendChunk(0);
+   statuses();
+   sendControl(FW_UPDATE_VERIFY);
+   checkStatus(statuses()[0], FW_STATE_RECEIVING, 1, FW_ERROR_STATE);
+}
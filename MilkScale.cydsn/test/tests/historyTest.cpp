@@ -0,0 +1,402 @@
+#include "CppUTest/TestHarness.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+#include "fakeHub.h"
+
+extern "C"
+{
+#include "history.h"
+}
+
+using namespace std;
+
+// As far forward as a fetch can reach from 0
+#define UNTIL_NOW 0x7fffffff
+
+static T_HistoryCB history;
+static vector<vector<uint8_t> > stored;
+static vector<vector<uint8_t> > fetched;
+
+static void store(const uint8_t *pBlock)
+{
+   stored.push_back(vector<uint8_t>(pBlock, pBlock + HISTORY_BLOCK_SIZE));
+}
+
+static void collect(const uint8_t *pBlock, uint8_t length)
+{
+   fetched.push_back(vector<uint8_t>(pBlock, pBlock + length));
+}
+
+struct Sample {
+   uint32_t seconds;
+   uint16_t value;
+};
+
+// Every sample in the blocks, in order.
+static vector<Sample> decode(const vector<vector<uint8_t> > &blocks)
+{
+   vector<Sample> samples;
+
+   for (size_t b = 0; b < blocks.size(); b++) {
+      T_HistoryReader reader;
+      Sample s;
+
+      CHECK(History_ReaderInit(&reader, &blocks[b][0], (uint8_t)blocks[b].size()));
+      while (History_ReaderNext(&reader, &s.seconds, &s.value)) {
+         samples.push_back(s);
+      }
+   }
+   return samples;
+}
+
+static void checkSamples(const vector<Sample> &expected, const vector<Sample> &actual)
+{
+   LONGS_EQUAL(expected.size(), actual.size());
+   for (size_t n = 0; n < expected.size(); n++) {
+      LONGS_EQUAL(expected[n].seconds, actual[n].seconds);
+      LONGS_EQUAL(expected[n].value, actual[n].value);
+   }
+}
+
+TEST_GROUP(historyTests)
+{
+   void setup()
+   {
+      stored.clear();
+      fetched.clear();
+      History_Init(&history, store);
+   }
+
+   void teardown()
+   {
+   }
+};
+
+TEST(historyTests, initChecksArguments)
+{
+   uint32_t seconds;
+
+   BYTES_EQUAL(HISTORY_FAILURE, History_Init(NULL, store));
+   BYTES_EQUAL(HISTORY_SUCCESS, History_Init(&history, NULL));
+   BYTES_EQUAL(0, History_LastSeconds(&history, &seconds));
+   BYTES_EQUAL(0, History_Fetch(&history, 0, UNTIL_NOW, collect));
+}
+
+TEST(historyTests, everyCodeLengthRoundTrips)
+{
+   // gaps changing by 0, a little, more, a lot and past 16 bits; values by
+   // 0, a little, more and past 7 bits
+   static const uint32_t gaps[] = { 300, 300, 302, 299, 150, 400, 20000, 300, 100000, 300, 0, 7 };
+   static const int32_t changes[] = { 0, 0, 5, -8, 7, 40, -64, 63, 1000, -30000, 0, 2 };
+   vector<Sample> samples;
+   Sample s = { 4294900000u, 30000 };
+
+   for (size_t n = 0; n < sizeof(gaps) / sizeof(gaps[0]); n++) {
+      s.seconds += gaps[n];
+      s.value = (uint16_t)(s.value + changes[n]);
+      samples.push_back(s);
+      History_Record(&history, s.seconds, s.value);
+   }
+   // the seconds wrapped on the way, and the range follows them
+   CHECK(s.seconds < 4294900000u);
+
+   BYTES_EQUAL(1, History_Fetch(&history, samples[0].seconds, s.seconds, collect));
+   checkSamples(samples, decode(fetched));
+}
+
+TEST(historyTests, aHeartbeatIsTwoBits)
+{
+   uint32_t seconds;
+
+   History_Record(&history, 1000, 87);
+   History_Record(&history, 1300, 87);
+   // a gap of 300 from none, 4 + 16 bits, and the same value
+   LONGS_EQUAL(21, history.bitCount);
+   for (uint32_t n = 2; n < 100; n++) {
+      History_Record(&history, 1000 + n * 300, 87);
+   }
+   LONGS_EQUAL(21 + 98 * 2, history.bitCount);
+   CHECK(History_LastSeconds(&history, &seconds));
+   LONGS_EQUAL(1000 + 99 * 300, seconds);
+
+   History_Fetch(&history, 0, UNTIL_NOW, collect);
+   LONGS_EQUAL(HISTORY_HEADER_SIZE + (21 + 98 * 2 + 7) / 8, fetched[0].size());
+}
+
+TEST(historyTests, fullBlocksAreStoredAndTheOldestDropped)
+{
+   vector<Sample> samples;
+   Sample s = { 0, 50 };
+
+   for (uint32_t n = 0; n < 2000; n++) {
+      s.seconds += 60 + n % 7;
+      s.value = (uint16_t)(50 + (n * 37) % 11);
+      samples.push_back(s);
+      History_Record(&history, s.seconds, s.value);
+   }
+   CHECK(stored.size() > HISTORY_BLOCKS);
+   LONGS_EQUAL(stored.size(), history.stats.blocks);
+   LONGS_EQUAL(stored.size() + 1 - HISTORY_BLOCKS, history.stats.dropped);
+   for (size_t b = 0; b < stored.size(); b++) {
+      // flagged as the first block after History_Init
+      BYTES_EQUAL((b == 0) ? HISTORY_FLAG_RESTART : 0, stored[b][7]);
+   }
+   // everything stored, and what is still in the open block
+   BYTES_EQUAL(HISTORY_BLOCKS, History_Fetch(&history, 0, UNTIL_NOW, collect));
+   fetched.erase(fetched.begin(), fetched.end() - 1);
+   {
+      vector<vector<uint8_t> > all = stored;
+
+      all.push_back(fetched[0]);
+      checkSamples(samples, decode(all));
+   }
+}
+
+TEST(historyTests, fetchSendsTheBlocksSince)
+{
+   const uint8_t *pNewest;
+   uint32_t firstOfNewest;
+
+   for (uint32_t n = 0; n < 1000; n++) {
+      History_Record(&history, n * 100, (uint16_t)(n % 50));
+   }
+   pNewest = history.blocks[(history.first + history.count - 1) % HISTORY_BLOCKS].bytes;
+   firstOfNewest = pNewest[0] | (pNewest[1] << 8) | (pNewest[2] << 16) | ((uint32_t)pNewest[3] << 24);
+
+   BYTES_EQUAL(1, History_Fetch(&history, 99900, UNTIL_NOW, collect));
+   BYTES_EQUAL(1, History_Fetch(&history, firstOfNewest, UNTIL_NOW, collect));
+   BYTES_EQUAL(1, History_Fetch(&history, firstOfNewest - 99, UNTIL_NOW, collect));
+   BYTES_EQUAL(2, History_Fetch(&history, firstOfNewest - 100, UNTIL_NOW, collect));
+   BYTES_EQUAL(0, History_Fetch(&history, 100000, UNTIL_NOW, collect));
+   LONGS_EQUAL(5, history.stats.fetches);
+}
+
+TEST(historyTests, fetchStopsAtTheEndOfTheRange)
+{
+   const uint8_t *pNewest;
+   uint32_t firstOfNewest;
+
+   for (uint32_t n = 0; n < 1000; n++) {
+      History_Record(&history, n * 100, (uint16_t)(n % 50));
+   }
+   pNewest = history.blocks[(history.first + history.count - 1) % HISTORY_BLOCKS].bytes;
+   firstOfNewest = pNewest[0] | (pNewest[1] << 8) | (pNewest[2] << 16) | ((uint32_t)pNewest[3] << 24);
+
+   // the two blocks around firstOfNewest, then only the one before it
+   BYTES_EQUAL(2, History_Fetch(&history, firstOfNewest - 100, firstOfNewest, collect));
+   fetched.clear();
+   BYTES_EQUAL(1, History_Fetch(&history, firstOfNewest - 100, firstOfNewest - 1, collect));
+   CHECK(memcmp(&fetched[0][0], pNewest, 4) != 0);
+   BYTES_EQUAL(0, History_Fetch(&history, 100000, 200000, collect));
+   BYTES_EQUAL(0, History_Fetch(&history, firstOfNewest, firstOfNewest - 1, collect));
+}
+
+TEST(historyTests, restoredBlocksComeFirst)
+{
+   vector<Sample> samples;
+   vector<vector<uint8_t> > kept;
+   uint32_t seconds;
+
+   for (uint32_t n = 0; n < 400; n++) {
+      Sample s = { 500 + n * 120, (uint16_t)(100 - n / 5) };
+
+      History_Record(&history, s.seconds, s.value);
+      samples.push_back(s);
+   }
+   kept = stored;
+   CHECK(kept.size() >= 2);
+   samples.resize(decode(kept).size());
+   CHECK(samples.size() < 400);
+
+   // reset: what was in flash comes back, the open block is lost
+   History_Init(&history, store);
+   stored.clear();
+   for (size_t b = 0; b < kept.size(); b++) {
+      BYTES_EQUAL(HISTORY_SUCCESS, History_Restore(&history, &kept[b][0]));
+   }
+   CHECK(History_LastSeconds(&history, &seconds));
+   LONGS_EQUAL(samples.back().seconds, seconds);
+
+   {
+      Sample s = { seconds + 1, 17 };
+
+      History_Record(&history, s.seconds, s.value);
+      samples.push_back(s);
+   }
+   BYTES_EQUAL(HISTORY_FAILURE, History_Restore(&history, &kept[0][0]));
+   History_Fetch(&history, 0, UNTIL_NOW, collect);
+   checkSamples(samples, decode(fetched));
+   BYTES_EQUAL(HISTORY_FLAG_RESTART, fetched.back()[7]);
+}
+
+TEST(historyTests, badBlocksAreNotRestored)
+{
+   uint8_t block[HISTORY_BLOCK_SIZE];
+
+   memset(block, 0, sizeof(block));
+   BYTES_EQUAL(HISTORY_FAILURE, History_Restore(&history, block));
+   // more samples than the bits hold
+   block[6] = 200;
+   memset(&block[HISTORY_HEADER_SIZE], 0xff, HISTORY_BLOCK_SIZE - HISTORY_HEADER_SIZE);
+   BYTES_EQUAL(HISTORY_FAILURE, History_Restore(&history, block));
+   // erased flash
+   memset(block, 0xff, sizeof(block));
+   BYTES_EQUAL(HISTORY_FAILURE, History_Restore(&history, block));
+   LONGS_EQUAL(0, history.count);
+}
+
+/*
+ * A week of a jug of milk in a family fridge.  The door opens a dozen times
+ * a day between 6:00 and 23:00; most times the jug is lifted out, the weight
+ * drops to 0 and comes back a few to 15% lighter once it is put back, and a
+ * new jug goes in when it runs low.  The weight is published as the
+ * publisher does: on a 2% change at most every 2 s, and a heartbeat after 5
+ * quiet minutes.  The seconds come from the ticks and jitter by one.
+ */
+static uint32_t lcg;
+
+static uint32_t nextRandom(void)
+{
+   lcg = lcg * 1664525u + 1013904223u;
+   return lcg >> 8;
+}
+
+static uint64_t nanosNow(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static vector<Sample> doorTrace(uint32_t days)
+{
+   vector<Sample> published;
+   uint32_t level = 100;
+   uint32_t lastSent = 0;
+   uint32_t shown = 100;
+   uint32_t now = 0;
+
+   published.push_back({ 0, 100 });
+   for (uint32_t day = 0; day < days; day++) {
+      vector<uint32_t> opens;
+
+      for (uint32_t n = 0; n < 9 + nextRandom() % 7; n++) {
+         opens.push_back(day * 86400 + 6 * 3600 + nextRandom() % (17 * 3600));
+      }
+      std::sort(opens.begin(), opens.end());
+      opens.push_back((day + 1) * 86400);
+
+      for (size_t n = 0; n < opens.size(); n++) {
+         uint32_t open = opens[n];
+         uint32_t back;
+
+         // heartbeats until the door opens
+         while ((lastSent + 300) <= open) {
+            lastSent += 300 + ((nextRandom() % 8 == 0) ? 1 : 0);
+            published.push_back({ lastSent, (uint16_t)shown });
+         }
+         if (n == (opens.size() - 1)) {
+            break;
+         }
+         if (nextRandom() % 5 == 0) {
+            // only something else taken out
+            continue;
+         }
+         now = open + 2 + nextRandom() % 4;
+         if (now < lastSent + 2) {
+            now = lastSent + 2;
+         }
+         shown = 0;
+         published.push_back({ now, 0 });
+         lastSent = now;
+
+         back = now + 5 + nextRandom() % 60;
+         if (level < 20) {
+            level = 100;
+         } else {
+            level -= 3 + nextRandom() % 13;
+         }
+         shown = level;
+         published.push_back({ back, (uint16_t)shown });
+         lastSent = back;
+      }
+   }
+   return published;
+}
+
+TEST(historyTests, weekOfDoorEvents)
+{
+   const uint32_t days = 7;
+   vector<Sample> trace;
+   vector<Sample> decoded;
+   uint64_t begin;
+   double encodeNanos;
+   double decodeNanos;
+   size_t compressed;
+   size_t perSampleWire;
+   size_t bulkWire;
+   size_t bulkFrames;
+
+   lcg = 8642;
+   trace = doorTrace(days);
+
+   begin = nanosNow();
+   for (size_t n = 0; n < trace.size(); n++) {
+      History_Record(&history, trace[n].seconds, trace[n].value);
+   }
+   encodeNanos = (double)(nanosNow() - begin) / trace.size();
+
+   History_Fetch(&history, 0, UNTIL_NOW, collect);
+   {
+      vector<vector<uint8_t> > all = stored;
+
+      all.push_back(fetched.back());
+      begin = nanosNow();
+      decoded = decode(all);
+      decodeNanos = (double)(nanosNow() - begin) / decoded.size();
+      compressed = stored.size() * HISTORY_BLOCK_SIZE + fetched.back().size();
+   }
+   checkSamples(trace, decoded);
+
+   // what the hub gets for the last day: a frame per sample against the
+   // blocks fetched in one go
+   FakeHub::reset();
+   ChillHub.setup("scale", "uuid", &FakeHub::serial);
+   ChillHub.createCloudResourceU16("weight", 0x91, 0, 0);
+   FakeHub::tx.clear();
+   {
+      size_t lastDay = 0;
+
+      for (size_t n = 0; n < trace.size(); n++) {
+         if (trace[n].seconds >= (days - 1) * 86400) {
+            ChillHub.updateCloudResourceU16(0x91, trace[n].value);
+            lastDay++;
+         }
+      }
+      perSampleWire = FakeHub::tx.size();
+      FakeHub::tx.clear();
+      fetched.clear();
+      History_Fetch(&history, (days - 1) * 86400, UNTIL_NOW, collect);
+      for (size_t b = 0; b < fetched.size(); b++) {
+         ChillHub.sendU8ArrayMsg(0x99, &fetched[b][0], (uint8_t)fetched[b].size());
+      }
+      bulkWire = FakeHub::tx.size();
+      bulkFrames = FakeHub::sentMessages().size();
+      LONGS_EQUAL(fetched.size(), bulkFrames);
+
+      printf("\nhistory, %u days of door events: %u samples, %.0f bytes/day (%.2f bits/sample, %.1fx against 6 "
+             "bytes/sample), encode %.0f ns/sample, decode %.0f ns/sample; last day on the wire: %u frames %u bytes "
+             "per sample, %u frames %u bytes in bulk",
+             days, (unsigned)trace.size(), (double)compressed / days, 8.0 * compressed / trace.size(),
+             6.0 * trace.size() / compressed, encodeNanos, decodeNanos, (unsigned)lastDay, (unsigned)perSampleWire,
+             (unsigned)bulkFrames, (unsigned)bulkWire);
+      CHECK(bulkWire * 4 < perSampleWire);
+   }
+   CHECK(compressed / days < 300);
+   printf("\n");
+}
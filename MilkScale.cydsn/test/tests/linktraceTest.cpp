@@ -0,0 +1,216 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTestExt/MockSupport.h"
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "fakeHub.h"
+
+extern "C"
+{
+#include "linktrace.h"
+}
+
+using namespace std;
+
+struct Event {
+   uint32_t ticks;
+   uint8_t direction;
+   uint8_t data;
+
+   bool operator==(const Event &other) const
+   {
+      return (ticks == other.ticks) && (direction == other.direction) && (data == other.data);
+   }
+};
+
+static uint32_t now;
+static T_LinkTraceCB trace;
+static string dumped;
+
+static uint32_t traceClock(void)
+{
+   return now;
+}
+
+static void print(const char *s)
+{
+   dumped += s;
+}
+
+static void traceHook(T_ChillHubCB *pControlBlock, uint8_t direction, const uint8_t *pData, uint8_t length)
+{
+   (void)pControlBlock;
+   LinkTrace_Record(&trace, direction, pData, length);
+}
+
+TEST_GROUP(linktraceTests)
+{
+   void setup()
+   {
+      now = 1000;
+      dumped.clear();
+      LinkTrace_Init(&trace, traceClock);
+      LinkTrace_Start(&trace);
+   }
+
+   void teardown()
+   {
+   }
+
+   void record(uint8_t direction, vector<uint8_t> bytes)
+   {
+      LinkTrace_Record(&trace, direction, bytes.data(), (uint8_t)bytes.size());
+   }
+
+   // The bytes in the ring with their times, oldest first.
+   vector<Event> events()
+   {
+      vector<Event> out;
+      uint32_t ticks = trace.startTicks;
+
+      for (uint16_t i = 0; i < trace.count; i++) {
+         const T_LinkTraceRecord *pRecord = LinkTrace_At(&trace, i);
+         Event e;
+
+         if (LinkTrace_Decode(pRecord, &ticks, &e.direction)) {
+            e.ticks = ticks;
+            e.data = pRecord->data;
+            out.push_back(e);
+         }
+      }
+      return out;
+   }
+
+   vector<uint8_t> bytes(uint8_t direction)
+   {
+      vector<uint8_t> out;
+
+      for (const Event &e : events()) {
+         if (e.direction == direction) {
+            out.push_back(e.data);
+         }
+      }
+      return out;
+   }
+};
+
+TEST(linktraceTests, initChecksArgumentsAndDoesNotCapture)
+{
+   BYTES_EQUAL(LINK_TRACE_FAILURE, LinkTrace_Init(NULL, traceClock));
+   BYTES_EQUAL(LINK_TRACE_FAILURE, LinkTrace_Init(&trace, NULL));
+   BYTES_EQUAL(LINK_TRACE_SUCCESS, LinkTrace_Init(&trace, traceClock));
+   record(LINK_TRACE_RX, { 1, 2 });
+   LONGS_EQUAL(0, trace.count);
+}
+
+TEST(linktraceTests, bytesCarryDirectionAndDelta)
+{
+   now = 1005;
+   record(LINK_TRACE_RX, { 0xff, 0x04 });
+   now = 1131;
+   record(LINK_TRACE_TX, { 0xfe });
+
+   LONGS_EQUAL(3, trace.count);
+   BYTES_EQUAL(5, LinkTrace_At(&trace, 0)->header);
+   BYTES_EQUAL(0xff, LinkTrace_At(&trace, 0)->data);
+   BYTES_EQUAL(0, LinkTrace_At(&trace, 1)->header);
+   BYTES_EQUAL(0x80 | 126, LinkTrace_At(&trace, 2)->header);
+   BYTES_EQUAL(0xfe, LinkTrace_At(&trace, 2)->data);
+}
+
+TEST(linktraceTests, pausesGoInGapRecords)
+{
+   const uint32_t pauses[] = { 127, 128, 254, 32511, 32512, 32639, 100000, 9000000 };
+   vector<Event> expected;
+
+   for (uint32_t pause : pauses) {
+      now += pause;
+      record(LINK_TRACE_RX, { (uint8_t)pause });
+      expected.push_back({ now, LINK_TRACE_RX, (uint8_t)pause });
+   }
+
+   CHECK(events() == expected);
+   // at most three gap records for a pause up to 2 hours
+   CHECK(trace.count <= 3 * 8 + 8 + 1);
+}
+
+TEST(linktraceTests, clockWrapIsJustAnotherDelta)
+{
+   now = 0xfffffff0UL;
+   LinkTrace_Start(&trace);
+   now += 0x20;
+   record(LINK_TRACE_TX, { 7 });
+   BYTES_EQUAL(0x80 | 0x20, LinkTrace_At(&trace, 0)->header);
+   LONGS_EQUAL(0x10, events()[0].ticks);
+}
+
+TEST(linktraceTests, fullRingKeepsTheNewestWithTheirTimes)
+{
+   vector<Event> expected;
+
+   for (uint32_t i = 0; i < 3 * LINK_TRACE_RECORDS; i++) {
+      now += (i % 3 == 0) ? 500 : 1;
+      record(LINK_TRACE_RX, { (uint8_t)i });
+      expected.push_back({ now, LINK_TRACE_RX, (uint8_t)i });
+   }
+
+   vector<Event> kept = events();
+   LONGS_EQUAL(LINK_TRACE_RECORDS, trace.count);
+   CHECK(trace.overwritten > 0);
+   CHECK(kept.size() > LINK_TRACE_RECORDS / 2);
+   CHECK(vector<Event>(expected.end() - kept.size(), expected.end()) == kept);
+}
+
+TEST(linktraceTests, stopAndStart)
+{
+   record(LINK_TRACE_RX, { 1 });
+   LinkTrace_Stop(&trace);
+   record(LINK_TRACE_RX, { 2 });
+   LONGS_EQUAL(1, trace.count);
+
+   now = 5000;
+   LinkTrace_Start(&trace);
+   LONGS_EQUAL(0, trace.count);
+   LONGS_EQUAL(5000, trace.startTicks);
+   record(LINK_TRACE_RX, { 3 });
+   LONGS_EQUAL(1, trace.count);
+}
+
+TEST(linktraceTests, dumpIsOldestFirstInHex)
+{
+   for (uint8_t i = 0; i < LINK_TRACE_LINE_RECORDS + 1; i++) {
+      record(i & 1, { i });
+   }
+
+   LinkTrace_Dump(&trace, print);
+   STRCMP_EQUAL("linktrace 1000 17 0\r\n"
+                "0000800100028003000480050006800700088009000a800b000c800d000e800f\r\n"
+                "0010\r\n"
+                "linktrace end\r\n", dumped.c_str());
+}
+
+TEST(linktraceTests, dumpOfAnEmptyTrace)
+{
+   LinkTrace_Dump(&trace, print);
+   STRCMP_EQUAL("linktrace 1000 0 0\r\nlinktrace end\r\n", dumped.c_str());
+}
+
+TEST(linktraceTests, hookSeesEveryByteOnTheWire)
+{
+   FakeHub::reset();
+   ChillHub.setTraceHook(traceHook);
+   ChillHub.setup("scale", "uuid-1", &FakeHub::serial);
+   ChillHub.updateCloudResourceU16(0x91, 0xfeff);
+   ChillHub.createCloudResourceU16("weight", 0x91, 0, 0);
+   ChillHub.updateCloudResourceU16(0x91, 0xfeff);
+   FakeHub::queueMessage({ doorStatusMsgType, unsigned8DataType, 0xff });
+   FakeHub::queue({ 0x12, 0xff, 0x01 });
+   FakeHub::pump();
+   ChillHub.setTraceHook(NULL);
+
+   CHECK(bytes(LINK_TRACE_TX) == FakeHub::tx);
+   vector<uint8_t> rx = FakeHub::frame({ doorStatusMsgType, unsigned8DataType, 0xff });
+   rx.insert(rx.end(), { 0x12, 0xff, 0x01 });
+   CHECK(bytes(LINK_TRACE_RX) == rx);
+}
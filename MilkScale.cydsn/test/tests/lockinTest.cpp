@@ -0,0 +1,261 @@
+#include "CppUTest/TestHarness.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+extern "C"
+{
+#include "lockin.h"
+}
+
+static T_LockInCB lockIn;
+
+// Rounded and clipped like a 12 bit ADC
+static int16_t adc(double value)
+{
+   long v = lround(value);
+
+   if (v < 0) {
+      return 0;
+   }
+   if (v > 4095) {
+      return 4095;
+   }
+   return (int16_t)v;
+}
+
+// Scan k of a sine at phase0 degrees against the reference
+static double excitation(uint32_t k, uint8_t phases, double amplitude, double phase0)
+{
+   return amplitude * sin(2 * M_PI * k / phases + phase0 * M_PI / 180);
+}
+
+static void feedSine(uint8_t phases, uint32_t scans, const double *amplitudes, double offset, double phase0)
+{
+   for (uint32_t k = 0; k < scans; k++) {
+      int16_t samples[LOCKIN_CHANNELS];
+
+      for (uint8_t j = 0; j < LOCKIN_CHANNELS; j++) {
+         samples[j] = adc(offset + excitation(k, phases, amplitudes[j], phase0));
+      }
+      LockIn_AddScan(&lockIn, samples);
+   }
+}
+
+TEST_GROUP(lockinTests)
+{
+   void setup()
+   {
+      LockIn_Init(&lockIn, 16, 32);
+   }
+
+   void teardown()
+   {
+   }
+};
+
+TEST(lockinTests, initChecksArguments)
+{
+   BYTES_EQUAL(LOCKIN_FAILURE, LockIn_Init(NULL, 16, 32));
+   BYTES_EQUAL(LOCKIN_FAILURE, LockIn_Init(&lockIn, 12, 32));
+   BYTES_EQUAL(LOCKIN_FAILURE, LockIn_Init(&lockIn, 16, 0));
+   BYTES_EQUAL(LOCKIN_FAILURE, LockIn_Init(&lockIn, 16, 33));
+   BYTES_EQUAL(LOCKIN_SUCCESS, LockIn_Init(&lockIn, 4, 128));
+   BYTES_EQUAL(LOCKIN_SUCCESS, LockIn_Init(&lockIn, 8, 64));
+}
+
+TEST(lockinTests, nothingToReadBeforeTheFirstReading)
+{
+   int32_t amplitudes[LOCKIN_CHANNELS];
+   const double a[LOCKIN_CHANNELS] = { 600, 600, 600 };
+
+   LONGS_EQUAL(0, LockIn_Read(&lockIn, amplitudes));
+   LONGS_EQUAL(0, amplitudes[0]);
+   feedSine(16, 16 * 32 - 1, a, 1024, 0);
+   LONGS_EQUAL(0, LockIn_Read(&lockIn, amplitudes));
+}
+
+TEST(lockinTests, readingCompletesAfterItsPeriods)
+{
+   int16_t samples[LOCKIN_CHANNELS] = { 1, 2, 3 };
+
+   for (uint16_t k = 1; k < 16 * 32; k++) {
+      BYTES_EQUAL(0, LockIn_AddScan(&lockIn, samples));
+   }
+   CHECK(LockIn_AddScan(&lockIn, samples));
+   BYTES_EQUAL(0, LockIn_AddScan(&lockIn, samples));
+}
+
+TEST(lockinTests, amplitudeOfEachChannelWhateverThePhase)
+{
+   const double a[LOCKIN_CHANNELS] = { 600, 150, 1500 };
+   int32_t amplitudes[LOCKIN_CHANNELS];
+   static const uint8_t phaseCounts[] = { 4, 8, 16 };
+
+   for (uint8_t n = 0; n < sizeof(phaseCounts); n++) {
+      uint8_t phases = phaseCounts[n];
+
+      LockIn_Init(&lockIn, phases, 256 / phases);
+      for (double phase0 = 0; phase0 < 360; phase0 += 15) {
+         feedSine(phases, 256, a, 2047, phase0);
+         LockIn_Read(&lockIn, amplitudes);
+         for (uint8_t j = 0; j < LOCKIN_CHANNELS; j++) {
+            LONGS_EQUAL(lround(a[j]), amplitudes[j]);
+         }
+      }
+   }
+}
+
+TEST(lockinTests, offsetIsRejected)
+{
+   const double a[LOCKIN_CHANNELS] = { 0, 0, 0 };
+   int32_t amplitudes[LOCKIN_CHANNELS];
+
+   feedSine(16, 16 * 32, a, 3000, 0);
+   LONGS_EQUAL(1, LockIn_Read(&lockIn, amplitudes));
+   LONGS_EQUAL(0, amplitudes[0]);
+   LONGS_EQUAL(0, amplitudes[2]);
+}
+
+TEST(lockinTests, fullScaleSquareWaveDoesNotOverflow)
+{
+   int32_t amplitudes[LOCKIN_CHANNELS];
+   double i = 0;
+   double q = 0;
+
+   // the worst case for the sums: the ADC rails in step with the reference
+   LockIn_Init(&lockIn, 16, LOCKIN_MAX_SAMPLES / 16);
+   for (uint16_t k = 0; k < LOCKIN_MAX_SAMPLES; k++) {
+      double reference = sin(2 * M_PI * (k + 0.5) / 16);
+      int16_t v = (reference > 0) ? 4095 : 0;
+      int16_t samples[LOCKIN_CHANNELS] = { v, v, v };
+
+      i += v * cos(2 * M_PI * k / 16);
+      q += v * sin(2 * M_PI * k / 16);
+      LockIn_AddScan(&lockIn, samples);
+   }
+   LockIn_Read(&lockIn, amplitudes);
+   // the fundamental of the square wave, 2 / pi of full scale
+   LONGS_EQUAL(lround(2 * sqrt(i * i + q * q) / LOCKIN_MAX_SAMPLES), amplitudes[0]);
+   CHECK(amplitudes[0] > 2550);
+}
+
+TEST(lockinTests, restartDropsAPartialReading)
+{
+   const double a[LOCKIN_CHANNELS] = { 600, 600, 600 };
+   const double b[LOCKIN_CHANNELS] = { 100, 100, 100 };
+   int32_t amplitudes[LOCKIN_CHANNELS];
+
+   feedSine(16, 100, a, 1024, 0);
+   LockIn_Restart(&lockIn);
+   feedSine(16, 16 * 32, b, 1024, 0);
+   LONGS_EQUAL(1, LockIn_Read(&lockIn, amplitudes));
+   LONGS_EQUAL(100, amplitudes[1]);
+}
+
+/*
+ * The FSRs on a 1 kHz excitation scanned 16 times a period, next to mains
+ * and a compressor: hum at the mains frequency and its harmonics, a few
+ * percent of full scale, and some white noise.  One ADC result at the peak
+ * of the sine, as readFromSensors takes it now, against a lock-in reading
+ * over 32 periods.
+ */
+static uint32_t lcg;
+
+static double gaussian(void)
+{
+   double sum = 0;
+
+   // twelve uniforms less six: mean 0, variance 1
+   for (int n = 0; n < 12; n++) {
+      lcg = lcg * 1664525u + 1013904223u;
+      sum += (lcg >> 8) / 16777216.0;
+   }
+   return sum - 6;
+}
+
+static double interference(double t, double mains, double phase)
+{
+   return 150 * sin(2 * M_PI * mains * t + phase) + 60 * sin(2 * M_PI * 2 * mains * t + 2 * phase) +
+          40 * sin(2 * M_PI * 3 * mains * t + 3 * phase) + 15 * gaussian();
+}
+
+static double snr(double amplitude, double squaredError, uint32_t count)
+{
+   return 20 * log10(amplitude / sqrt(squaredError / count));
+}
+
+static uint64_t cyclesNow(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+   return __rdtsc();
+#else
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+TEST(lockinTests, mainsAndCompressorRejection)
+{
+   const double amplitude = 600;
+   const double offset = 1024;
+   const double f0 = 1000;
+   const uint8_t phases = 16;
+   const uint16_t periods = 32;
+   static const double mainsFrequencies[] = { 50, 60 };
+
+   lcg = 4711;
+   for (uint8_t m = 0; m < 2; m++) {
+      double mains = mainsFrequencies[m];
+      double singleError = 0;
+      double lockInError = 0;
+      uint64_t cycles = 0;
+      uint32_t scans = 0;
+      const uint32_t readings = 200;
+
+      LockIn_Init(&lockIn, phases, periods);
+      for (uint32_t r = 0; r < readings; r++) {
+         double start = r * 0.0371;
+         double phase0 = r * 0.7;
+         double phase = r * 1.3;
+         int32_t amplitudes[LOCKIN_CHANNELS];
+         uint64_t begin;
+
+         for (uint32_t k = 0; k < (uint32_t)phases * periods; k++) {
+            double t = start + k / (f0 * phases);
+            int16_t v = adc(offset + amplitude * sin(2 * M_PI * k / phases + phase0) + interference(t, mains, phase));
+            int16_t samples[LOCKIN_CHANNELS] = { v, v, v };
+
+            begin = cyclesNow();
+            LockIn_AddScan(&lockIn, samples);
+            cycles += cyclesNow() - begin;
+            scans++;
+         }
+         LockIn_Read(&lockIn, amplitudes);
+         lockInError += (amplitudes[0] - amplitude) * (amplitudes[0] - amplitude);
+
+         // one result at the crest, with the offset known from calibration
+         {
+            double single = adc(offset + amplitude + interference(start, mains, phase)) - offset;
+            singleError += (single - amplitude) * (single - amplitude);
+         }
+      }
+
+      printf("\nlockin, %.0f Hz mains: one sample %.1f dB, lock-in over %u periods %.1f dB, %.1f %s/scan of %d channels",
+             mains, snr(amplitude, singleError, readings), periods, snr(amplitude, lockInError, readings),
+             (double)cycles / scans,
+#if defined(__x86_64__) || defined(__i386__)
+             "cycles",
+#else
+             "ns",
+#endif
+             LOCKIN_CHANNELS);
+      CHECK(snr(amplitude, lockInError, readings) > snr(amplitude, singleError, readings) + 20);
+   }
+   printf("\n");
+}
@@ -0,0 +1,362 @@
+#include "CppUTest/TestHarness.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+#include "fakeHub.h"
+
+extern "C"
+{
+#include "measure.h"
+}
+
+using namespace std;
+
+static const T_MeasurePolicy policy = { 1000, 40, 100, 16, 3 };
+
+static T_MeasureCB mcb;
+
+// What the sensors read, as a function of the simulated time
+static int32_t (*sensor)(uint8_t channel, uint32_t now);
+static uint32_t simNow;
+static uint32_t reads;
+
+static int32_t measured[MEASURE_CHANNELS];
+static uint32_t measuredAt;
+static uint32_t measurements;
+
+static void readSensors(int32_t *paMeas)
+{
+   for (uint8_t j = 0; j < MEASURE_CHANNELS; j++) {
+      paMeas[j] = sensor(j, simNow);
+   }
+   reads++;
+}
+
+static void measurementDone(int32_t *paMeas)
+{
+   for (uint8_t j = 0; j < MEASURE_CHANNELS; j++) {
+      measured[j] = paMeas[j];
+   }
+   measuredAt = simNow;
+   measurements++;
+}
+
+// 100, 200 and 300, a count either way on every other read
+static int32_t steady(uint8_t channel, uint32_t now)
+{
+   (void)now;
+   return 100 * (channel + 1) + (int32_t)(reads & 1) * 2 - 1;
+}
+
+// Swings by 50 counts until tick 2000, steady after
+static int32_t rockingUntil2000(uint8_t channel, uint32_t now)
+{
+   return steady(channel, now) + ((now < 2000) ? (int32_t)(reads & 1) * 100 - 50 : 0);
+}
+
+static int32_t neverQuiet(uint8_t channel, uint32_t now)
+{
+   return steady(channel, now) + (int32_t)(reads & 1) * 100 - 50;
+}
+
+// Polls like the main loop, which sleeps until the next sample is due
+static void runUntilIdle(uint32_t limit)
+{
+   while ((Measure_TicksUntilDue(&mcb, simNow) != MEASURE_NEVER) && (simNow < limit)) {
+      simNow += Measure_TicksUntilDue(&mcb, simNow);
+      Measure_Poll(&mcb, simNow);
+   }
+}
+
+TEST_GROUP(measureTests)
+{
+   void setup()
+   {
+      sensor = steady;
+      simNow = 0;
+      reads = 0;
+      measurements = 0;
+      Measure_Init(&mcb, &policy, readSensors, measurementDone);
+   }
+
+   void teardown()
+   {
+   }
+};
+
+TEST(measureTests, initChecksArguments)
+{
+   const T_MeasurePolicy empty = { 1000, 40, 100, 0, 3 };
+   const T_MeasurePolicy tooLong = { 1000, 40, 100, MEASURE_MAX_SAMPLES + 1, 3 };
+
+   BYTES_EQUAL(MEASURE_FAILURE, Measure_Init(NULL, &policy, readSensors, measurementDone));
+   BYTES_EQUAL(MEASURE_FAILURE, Measure_Init(&mcb, NULL, readSensors, measurementDone));
+   BYTES_EQUAL(MEASURE_FAILURE, Measure_Init(&mcb, &policy, NULL, measurementDone));
+   BYTES_EQUAL(MEASURE_FAILURE, Measure_Init(&mcb, &policy, readSensors, NULL));
+   BYTES_EQUAL(MEASURE_FAILURE, Measure_Init(&mcb, &empty, readSensors, measurementDone));
+   BYTES_EQUAL(MEASURE_FAILURE, Measure_Init(&mcb, &tooLong, readSensors, measurementDone));
+   BYTES_EQUAL(MEASURE_SUCCESS, Measure_Init(&mcb, &policy, readSensors, measurementDone));
+}
+
+TEST(measureTests, nothingIsDueUntilScheduled)
+{
+   LONGS_EQUAL(MEASURE_NEVER, Measure_TicksUntilDue(&mcb, 0));
+   BYTES_EQUAL(0, Measure_Poll(&mcb, 5000));
+   LONGS_EQUAL(0, reads);
+}
+
+TEST(measureTests, firstSampleAfterTheSettleDelay)
+{
+   Measure_Schedule(&mcb, 100);
+   LONGS_EQUAL(0, reads);
+   LONGS_EQUAL(1000, Measure_TicksUntilDue(&mcb, 100));
+   BYTES_EQUAL(0, Measure_Poll(&mcb, 1099));
+   CHECK(Measure_Poll(&mcb, 1100));
+   LONGS_EQUAL(1, reads);
+   LONGS_EQUAL(40, Measure_TicksUntilDue(&mcb, 1100));
+   // a late sample is due at once
+   LONGS_EQUAL(0, Measure_TicksUntilDue(&mcb, 1500));
+}
+
+TEST(measureTests, quietBurstGivesItsMean)
+{
+   Measure_Schedule(&mcb, simNow);
+   runUntilIdle(100000);
+   LONGS_EQUAL(1, measurements);
+   LONGS_EQUAL(16, reads);
+   LONGS_EQUAL(1000 + 15 * 40, measuredAt);
+   LONGS_EQUAL(100, measured[0]);
+   LONGS_EQUAL(200, measured[1]);
+   LONGS_EQUAL(300, measured[2]);
+   LONGS_EQUAL(MEASURE_NEVER, Measure_TicksUntilDue(&mcb, simNow));
+}
+
+TEST(measureTests, anotherCloseStartsOver)
+{
+   Measure_Schedule(&mcb, 0);
+   simNow = 1000;
+   Measure_Poll(&mcb, simNow);
+   Measure_Poll(&mcb, simNow + 40);
+   Measure_Schedule(&mcb, 1100);
+   LONGS_EQUAL(1000, Measure_TicksUntilDue(&mcb, 1100));
+   simNow = 1100;
+   runUntilIdle(100000);
+   LONGS_EQUAL(1, measurements);
+   LONGS_EQUAL(2 + 16, reads);
+   LONGS_EQUAL(2100 + 15 * 40, measuredAt);
+   LONGS_EQUAL(2, mcb.stats.scheduled);
+}
+
+TEST(measureTests, openCancels)
+{
+   Measure_Schedule(&mcb, 0);
+   Measure_Cancel(&mcb);
+   LONGS_EQUAL(MEASURE_NEVER, Measure_TicksUntilDue(&mcb, 0));
+   BYTES_EQUAL(0, Measure_Poll(&mcb, 2000));
+   Measure_Cancel(&mcb);
+   LONGS_EQUAL(1, mcb.stats.cancelled);
+   LONGS_EQUAL(0, measurements);
+}
+
+TEST(measureTests, rockingBurstIsTakenAgainAfterSettling)
+{
+   sensor = rockingUntil2000;
+   Measure_Schedule(&mcb, simNow);
+   runUntilIdle(100000);
+   LONGS_EQUAL(1, measurements);
+   LONGS_EQUAL(2, mcb.stats.bursts);
+   LONGS_EQUAL(1, mcb.stats.rejected);
+   LONGS_EQUAL(0, mcb.stats.unsettled);
+   // the second burst starts a settle delay after the first one ends
+   LONGS_EQUAL(1000 + 15 * 40 + 1000 + 15 * 40, measuredAt);
+   LONGS_EQUAL(200, measured[1]);
+}
+
+TEST(measureTests, neverQuietReportsAfterTheRetries)
+{
+   sensor = neverQuiet;
+   Measure_Schedule(&mcb, simNow);
+   runUntilIdle(100000);
+   LONGS_EQUAL(1, measurements);
+   LONGS_EQUAL(4, mcb.stats.bursts);
+   LONGS_EQUAL(4, mcb.stats.rejected);
+   LONGS_EQUAL(1, mcb.stats.unsettled);
+   LONGS_EQUAL(300, measured[2]);
+}
+
+TEST(measureTests, ticksMayWrap)
+{
+   simNow = 0xfffffe00UL;
+   Measure_Schedule(&mcb, simNow);
+   LONGS_EQUAL(1000, Measure_TicksUntilDue(&mcb, simNow));
+   BYTES_EQUAL(0, Measure_Poll(&mcb, 0xffffffffUL));
+   BYTES_EQUAL(0, Measure_Poll(&mcb, 0x1e7));
+   CHECK(Measure_Poll(&mcb, 0x1e8));
+   simNow = 0x1e8;
+   runUntilIdle(0x10000);
+   LONGS_EQUAL(1, measurements);
+}
+
+/*
+ * Door events from a simulated hub, through the chillhub receive path.  On
+ * every close the jug has just been put back and rocks on the FSRs: a damped
+ * swing of up to 400 counts on each channel, decaying over 100 to 500 ms,
+ * on top of a few counts of noise.  Reading the sensors in the door callback,
+ * as readMilkWeight did, against scheduling a measurement there.
+ */
+struct Jug {
+   uint32_t closedAt;
+   int32_t level[MEASURE_CHANNELS];
+   double swing[MEASURE_CHANNELS];
+   double decay;
+   double frequency;
+};
+
+static Jug jug;
+static uint32_t lcg;
+
+static uint32_t nextRandom(void)
+{
+   lcg = lcg * 1664525u + 1013904223u;
+   return lcg >> 8;
+}
+
+static double gaussian(void)
+{
+   double sum = 0;
+
+   for (int n = 0; n < 12; n++) {
+      sum += nextRandom() / 16777216.0;
+   }
+   return sum - 6;
+}
+
+static int32_t rockingJug(uint8_t channel, uint32_t now)
+{
+   double t = (now - jug.closedAt) / 1000.0;
+   double swing = jug.swing[channel] * exp(-t / jug.decay) * cos(2 * M_PI * jug.frequency * t);
+
+   return jug.level[channel] + (int32_t)lround(swing + 3 * gaussian());
+}
+
+static uint8_t doorWasOpen;
+static uint8_t readInCallback;
+static int32_t callbackReading[MEASURE_CHANNELS];
+static uint64_t callbackNanos;
+static uint32_t callbacks;
+
+static uint64_t nanosNow(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// readMilkWeight, reading the sensors itself or scheduling a measurement
+static void doorCallback(uint8_t dataType, void *pData)
+{
+   (void)dataType;
+   (void)pData;
+   uint64_t begin = nanosNow();
+   uint8_t doorStatus;
+
+   if (ChillHubPayload_AsU8(ChillHub.getPayload(), &doorStatus)) {
+      uint8_t doorNowOpen = doorStatus & 0x01;
+
+      if (doorWasOpen && !doorNowOpen) {
+         if (readInCallback) {
+            readSensors(callbackReading);
+         } else {
+            Measure_Schedule(&mcb, simNow);
+         }
+      } else if (doorNowOpen) {
+         Measure_Cancel(&mcb);
+      }
+      doorWasOpen = doorNowOpen;
+   }
+   callbackNanos += nanosNow() - begin;
+   callbacks++;
+}
+
+static double total(const int32_t *paMeas)
+{
+   return (double)paMeas[0] + paMeas[1] + paMeas[2];
+}
+
+static double percentile(vector<double> values, double p)
+{
+   sort(values.begin(), values.end());
+   return values[(size_t)(p * (values.size() - 1))];
+}
+
+TEST(measureTests, doorEventsFromTheHub)
+{
+   const uint32_t events = 300;
+   vector<double> errors[2];
+   double nanos[2];
+   uint32_t latency = 0;
+
+   FakeHub::reset();
+   ChillHub.setup("scale", "uuid", &FakeHub::serial);
+   ChillHub.subscribe(doorStatusMsgType, doorCallback);
+   sensor = rockingJug;
+
+   for (uint8_t pass = 0; pass < 2; pass++) {
+      readInCallback = (pass == 0);
+      lcg = 2468;
+      simNow = 1000;
+      doorWasOpen = 0;
+      callbackNanos = 0;
+      callbacks = 0;
+      for (uint32_t e = 0; e < events; e++) {
+         uint32_t reopen = (nextRandom() % 10 == 0) ? 300 + nextRandom() % 500 : 0;
+
+         FakeHub::queueMessage({ doorStatusMsgType, unsigned8DataType, 1 });
+         FakeHub::pump();
+         simNow += 2000 + nextRandom() % 20000;
+
+         jug.closedAt = simNow;
+         for (uint8_t j = 0; j < MEASURE_CHANNELS; j++) {
+            jug.level[j] = 500 + nextRandom() % 2500;
+            jug.swing[j] = (nextRandom() % 800) - 400.0;
+         }
+         jug.decay = 0.1 + (nextRandom() % 400) / 1000.0;
+         jug.frequency = 2 + (nextRandom() % 600) / 100.0;
+         measurements = 0;
+         FakeHub::queueMessage({ doorStatusMsgType, unsigned8DataType, 0 });
+         FakeHub::pump();
+
+         if (reopen != 0) {
+            // opened again before the jug settled, and closed on it
+            runUntilIdle(simNow + reopen);
+            FakeHub::queueMessage({ doorStatusMsgType, unsigned8DataType, 1 });
+            FakeHub::queueMessage({ doorStatusMsgType, unsigned8DataType, 0 });
+            FakeHub::pump();
+            jug.closedAt = simNow;
+         }
+
+         if (readInCallback) {
+            errors[1].push_back(fabs(total(callbackReading) - total(jug.level)));
+         } else {
+            runUntilIdle(simNow + 60000);
+            LONGS_EQUAL(1, measurements);
+            latency += measuredAt - jug.closedAt;
+            errors[0].push_back(fabs(total(measured) - total(jug.level)));
+         }
+      }
+      nanos[readInCallback] = (double)callbackNanos / callbacks;
+   }
+   ChillHub.unsubscribe(doorStatusMsgType);
+
+   printf("\ndoor callback: %.0f ns reading the sensors, %.0f ns scheduling; weight error in counts (median, p95, max):"
+          " read at close %.0f %.0f %.0f, settled %.1f %.1f %.1f after %u ms, %u of %u bursts dropped\n",
+          nanos[1], nanos[0], percentile(errors[1], 0.5), percentile(errors[1], 0.95), percentile(errors[1], 1),
+          percentile(errors[0], 0.5), percentile(errors[0], 0.95), percentile(errors[0], 1), latency / events,
+          mcb.stats.rejected, mcb.stats.bursts);
+   CHECK(percentile(errors[0], 0.95) * 10 < percentile(errors[1], 0.95));
+   CHECK(percentile(errors[0], 1) < 30);
+}
@@ -0,0 +1,463 @@
+#include "CppUTest/TestHarness.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <set>
+#include <vector>
+
+extern "C"
+{
+#include "outbox.h"
+}
+
+using namespace std;
+
+struct Update {
+   uint8_t resID;
+   uint16_t value;
+   uint32_t seconds;
+};
+
+static vector<Update> live;
+static vector<vector<Update> > replayed;
+
+static void send(uint8_t resID, uint16_t value)
+{
+   Update u = { resID, value, 0 };
+   live.push_back(u);
+}
+
+static vector<Update> decode(const uint8_t *pFrame, uint8_t length)
+{
+   vector<Update> updates;
+
+   LONGS_EQUAL(0, length % OUTBOX_EVENT_SIZE);
+   for (uint8_t n = 0; n < length; n += OUTBOX_EVENT_SIZE) {
+      const uint8_t *p = &pFrame[n];
+      Update u = { p[0], (uint16_t)(p[1] | (p[2] << 8)),
+                   (uint32_t)p[3] | ((uint32_t)p[4] << 8) | ((uint32_t)p[5] << 16) | ((uint32_t)p[6] << 24) };
+      updates.push_back(u);
+   }
+   return updates;
+}
+
+static void replay(const uint8_t *pFrame, uint8_t length)
+{
+   replayed.push_back(decode(pFrame, length));
+}
+
+static const T_OutboxPolicy policy = { 250, 7500, OUTBOX_MAX_BURST };
+
+static T_OutboxCB outbox;
+
+TEST_GROUP(outboxTests)
+{
+   void setup()
+   {
+      live.clear();
+      replayed.clear();
+      Outbox_Init(&outbox, &policy, send, replay, 0);
+   }
+
+   void teardown()
+   {
+   }
+};
+
+TEST(outboxTests, initChecksArguments)
+{
+   static const T_OutboxPolicy noBurst = { 250, 7500, 0 };
+   static const T_OutboxPolicy bigBurst = { 250, 7500, OUTBOX_MAX_BURST + 1 };
+
+   BYTES_EQUAL(OUTBOX_FAILURE, Outbox_Init(NULL, &policy, send, replay, 0));
+   BYTES_EQUAL(OUTBOX_FAILURE, Outbox_Init(&outbox, NULL, send, replay, 0));
+   BYTES_EQUAL(OUTBOX_FAILURE, Outbox_Init(&outbox, &policy, NULL, replay, 0));
+   BYTES_EQUAL(OUTBOX_FAILURE, Outbox_Init(&outbox, &policy, send, NULL, 0));
+   BYTES_EQUAL(OUTBOX_FAILURE, Outbox_Init(&outbox, &noBurst, send, replay, 0));
+   BYTES_EQUAL(OUTBOX_FAILURE, Outbox_Init(&outbox, &bigBurst, send, replay, 0));
+   BYTES_EQUAL(OUTBOX_SUCCESS, Outbox_Init(&outbox, &policy, send, replay, 0));
+   LONGS_EQUAL(OUTBOX_NEVER, Outbox_TicksUntilDue(&outbox, 0));
+}
+
+TEST(outboxTests, sentAtOnceAndFreedByTheNextKeepalive)
+{
+   Outbox_Put(&outbox, 0x91, 50, 10);
+   Outbox_Put(&outbox, 0x91, 50, 310);
+   LONGS_EQUAL(2, live.size());
+   LONGS_EQUAL(50, live[1].value);
+   LONGS_EQUAL(0, Outbox_Waiting(&outbox));
+   LONGS_EQUAL(2, outbox.count);
+
+   Outbox_LinkUp(&outbox, 5000);
+   LONGS_EQUAL(0, outbox.count);
+   LONGS_EQUAL(2, outbox.stats.confirmed);
+   BYTES_EQUAL(0, Outbox_Poll(&outbox, 5000));
+   LONGS_EQUAL(0, replayed.size());
+}
+
+TEST(outboxTests, queuedWhileDownAndReplayedInOrder)
+{
+   Outbox_LinkDown(&outbox);
+   for (uint16_t n = 0; n < 10; n++) {
+      Outbox_Put(&outbox, (n == 4) ? 0x94 : 0x91, n, 100 + n);
+   }
+   LONGS_EQUAL(0, live.size());
+   LONGS_EQUAL(10, Outbox_Waiting(&outbox));
+   BYTES_EQUAL(0, Outbox_Poll(&outbox, 1000));
+   LONGS_EQUAL(OUTBOX_NEVER, Outbox_TicksUntilDue(&outbox, 1000));
+
+   Outbox_LinkUp(&outbox, 30000);
+   LONGS_EQUAL(0, Outbox_TicksUntilDue(&outbox, 30000));
+   BYTES_EQUAL(OUTBOX_MAX_BURST, Outbox_Poll(&outbox, 30000));
+   LONGS_EQUAL(100, Outbox_TicksUntilDue(&outbox, 30150));
+   BYTES_EQUAL(0, Outbox_Poll(&outbox, 30150));
+
+   // made while the rest still waits, so it goes behind it
+   Outbox_Put(&outbox, 0x91, 99, 200);
+   LONGS_EQUAL(0, live.size());
+   BYTES_EQUAL(4, Outbox_Poll(&outbox, 30250));
+   LONGS_EQUAL(OUTBOX_NEVER, Outbox_TicksUntilDue(&outbox, 30250));
+
+   LONGS_EQUAL(2, replayed.size());
+   for (uint16_t n = 0; n < 10; n++) {
+      const Update &u = replayed[n / OUTBOX_MAX_BURST][n % OUTBOX_MAX_BURST];
+
+      BYTES_EQUAL((n == 4) ? 0x94 : 0x91, u.resID);
+      LONGS_EQUAL(n, u.value);
+      LONGS_EQUAL(100 + n, u.seconds);
+   }
+   LONGS_EQUAL(99, replayed[1][3].value);
+
+   // the queue is empty again, so the next goes at once
+   Outbox_Put(&outbox, 0x91, 7, 300);
+   LONGS_EQUAL(1, live.size());
+   Outbox_LinkUp(&outbox, 35000);
+   LONGS_EQUAL(0, outbox.count);
+}
+
+TEST(outboxTests, unconfirmedAreReplayedAfterAnOutage)
+{
+   Outbox_Put(&outbox, 0x91, 40, 1);
+   Outbox_Put(&outbox, 0x91, 0, 3);
+   Outbox_LinkDown(&outbox);
+   LONGS_EQUAL(2, Outbox_Waiting(&outbox));
+   LONGS_EQUAL(1, outbox.stats.outages);
+   LONGS_EQUAL(2, outbox.stats.resent);
+
+   Outbox_LinkUp(&outbox, 60000);
+   Outbox_Poll(&outbox, 60000);
+   LONGS_EQUAL(1, replayed.size());
+   LONGS_EQUAL(2, replayed[0].size());
+   LONGS_EQUAL(40, replayed[0][0].value);
+   LONGS_EQUAL(3, replayed[0][1].seconds);
+
+   // and the replay itself is freed by the keepalive after it
+   Outbox_LinkUp(&outbox, 65000);
+   LONGS_EQUAL(0, outbox.count);
+}
+
+TEST(outboxTests, aLateKeepaliveResendsTheUnconfirmed)
+{
+   Outbox_LinkUp(&outbox, 0);
+   Outbox_Put(&outbox, 0x91, 40, 1);
+   Outbox_LinkUp(&outbox, 7500);
+   LONGS_EQUAL(0, outbox.count);
+
+   Outbox_Put(&outbox, 0x91, 41, 9);
+   Outbox_LinkUp(&outbox, 15001);
+   LONGS_EQUAL(1, Outbox_Waiting(&outbox));
+   BYTES_EQUAL(1, Outbox_Poll(&outbox, 15001));
+   LONGS_EQUAL(41, replayed[0][0].value);
+   LONGS_EQUAL(0, outbox.stats.outages);
+}
+
+TEST(outboxTests, heartbeatsAreNotQueued)
+{
+   Outbox_LinkDown(&outbox);
+   Outbox_Put(&outbox, 0x91, 50, 0);
+   Outbox_Put(&outbox, 0x94, 0, 1);
+   Outbox_Put(&outbox, 0x91, 50, 300);
+   Outbox_Put(&outbox, 0x91, 50, 600);
+   LONGS_EQUAL(2, Outbox_Waiting(&outbox));
+   LONGS_EQUAL(2, outbox.stats.coalesced);
+   Outbox_Put(&outbox, 0x91, 0, 610);
+   Outbox_Put(&outbox, 0x91, 50, 640);
+   Outbox_Put(&outbox, 0x94, 0, 641);
+   LONGS_EQUAL(4, Outbox_Waiting(&outbox));
+   LONGS_EQUAL(3, outbox.stats.coalesced);
+}
+
+TEST(outboxTests, aFullQueueDropsTheOldest)
+{
+   Outbox_Put(&outbox, 0x91, 1000, 0);
+   Outbox_LinkDown(&outbox);
+   for (uint16_t n = 1; n < OUTBOX_EVENTS + 5; n++) {
+      Outbox_Put(&outbox, 0x91, n, n);
+   }
+   LONGS_EQUAL(OUTBOX_EVENTS, outbox.count);
+   LONGS_EQUAL(OUTBOX_EVENTS, Outbox_Waiting(&outbox));
+   LONGS_EQUAL(5, outbox.stats.dropped);
+
+   Outbox_LinkUp(&outbox, 100000);
+   for (uint32_t t = 100000; Outbox_Waiting(&outbox) != 0; t += 250) {
+      Outbox_Poll(&outbox, t);
+   }
+   LONGS_EQUAL(5, replayed[0][0].value);
+   LONGS_EQUAL(OUTBOX_EVENTS + 4, replayed.back().back().value);
+
+   // while the link is up the oldest to go are the ones already sent
+   Outbox_LinkUp(&outbox, 105000);
+   for (uint16_t n = 0; n < OUTBOX_EVENTS + 3; n++) {
+      Outbox_Put(&outbox, 0x91, n, 1000 + n);
+   }
+   LONGS_EQUAL(3, outbox.stats.droppedUnconfirmed);
+   LONGS_EQUAL(5, outbox.stats.dropped);
+}
+
+TEST(outboxTests, ticksWrap)
+{
+   Outbox_Init(&outbox, &policy, send, replay, 0xffffff00u);
+   Outbox_LinkDown(&outbox);
+   for (uint16_t n = 0; n < 9; n++) {
+      Outbox_Put(&outbox, 0x91, n, n);
+   }
+   Outbox_LinkUp(&outbox, 0xffffff80u);
+   BYTES_EQUAL(OUTBOX_MAX_BURST, Outbox_Poll(&outbox, 0xffffff80u));
+   LONGS_EQUAL(250, Outbox_TicksUntilDue(&outbox, 0xffffff80u));
+   BYTES_EQUAL(2, Outbox_Poll(&outbox, 0x7au));
+   Outbox_LinkUp(&outbox, 0x1000u);
+   LONGS_EQUAL(0, outbox.count);
+}
+
+/*
+ * A few days of a jug in a family fridge, published as the publisher does
+ * (on a change at most every 2 s, a heartbeat after 5 quiet minutes),
+ * against a hub that goes away now and then.  The hub sends a keepalive
+ * every 5 s while it is there and asks for the device ID 2 s after it comes
+ * back; the scale resets the USB after 20 s without a keepalive, which loses
+ * what crosses the link for half a second.  Updates sent while the hub is
+ * away, or during the reset, never reach it.  An update is delivered when
+ * the hub gets it, once or more; the ones that count are those that changed
+ * the value, since a lost heartbeat tells the hub nothing new.
+ */
+static uint32_t lcg;
+
+static uint32_t nextRandom(void)
+{
+   lcg = lcg * 1664525u + 1013904223u;
+   return lcg >> 8;
+}
+
+struct Published {
+   uint32_t seconds;
+   uint16_t value;
+   uint8_t change;
+};
+
+static vector<Published> doorTrace(uint32_t days)
+{
+   vector<Published> published;
+   uint32_t level = 100;
+   uint32_t lastSent = 0;
+   uint16_t shown = 100;
+
+   published.push_back({ 0, 100, 1 });
+   for (uint32_t day = 0; day < days; day++) {
+      vector<uint32_t> opens;
+
+      for (uint32_t n = 0; n < 9 + nextRandom() % 7; n++) {
+         opens.push_back(day * 86400 + 6 * 3600 + nextRandom() % (17 * 3600));
+      }
+      std::sort(opens.begin(), opens.end());
+      opens.push_back((day + 1) * 86400);
+
+      for (size_t n = 0; n < opens.size(); n++) {
+         uint32_t out;
+         uint32_t back;
+
+         while ((lastSent + 300) <= opens[n]) {
+            lastSent += 300;
+            published.push_back({ lastSent, shown, 0 });
+         }
+         if ((n == (opens.size() - 1)) || (nextRandom() % 5 == 0)) {
+            continue;
+         }
+         out = std::max(opens[n] + 2 + nextRandom() % 4, lastSent + 2);
+         back = out + 5 + nextRandom() % 60;
+         level = (level < 20) ? 100 : (level - 3 - nextRandom() % 13);
+         shown = 0;
+         published.push_back({ out, 0, 1 });
+         shown = (uint16_t)level;
+         published.push_back({ back, shown, 1 });
+         lastSent = back;
+      }
+   }
+   return published;
+}
+
+struct Outage {
+   uint64_t begin;
+   uint64_t end;
+};
+
+// Outages of the length, starting 2 to 10 hours after the one before ends.
+static vector<Outage> outages(uint64_t length, uint64_t until)
+{
+   vector<Outage> list;
+   uint64_t begin = 3600000 + nextRandom() % 7200000;
+
+   while (begin + length < until) {
+      list.push_back({ begin, begin + length });
+      begin += length + 7200000 + (uint64_t)(nextRandom() % 28800) * 1000;
+   }
+   return list;
+}
+
+struct HubResult {
+   uint32_t outages;
+   uint32_t changes;
+   uint32_t lost;
+   uint32_t duplicates;
+   uint32_t frames;
+   uint32_t deepest;
+   uint32_t dropped;
+};
+
+// The hub the scale talks to: the seconds of each update it got.
+static multiset<uint32_t> hubGot;
+static uint8_t linkCarries;
+static uint32_t putSeconds;
+
+static void hubSend(uint8_t resID, uint16_t value)
+{
+   (void)resID;
+   (void)value;
+   if (linkCarries) {
+      hubGot.insert(putSeconds);
+   }
+}
+
+static uint32_t hubFrames;
+
+static void hubReplay(const uint8_t *pFrame, uint8_t length)
+{
+   vector<Update> updates = decode(pFrame, length);
+
+   if (linkCarries) {
+      hubFrames++;
+      for (size_t n = 0; n < updates.size(); n++) {
+         hubGot.insert(updates[n].seconds);
+      }
+   }
+}
+
+static HubResult emulateHub(const vector<Published> &trace, const vector<Outage> &away, uint8_t withOutbox)
+{
+   const uint64_t step = 50;
+   const uint64_t end = (uint64_t)(trace.back().seconds + 60) * 1000;
+   const uint32_t base = 0xf0000000u;
+   HubResult result = { (uint32_t)away.size(), 0, 0, 0, 0, 0, 0 };
+   uint64_t keepAliveCheckTimer = 0;
+   uint64_t resetStartTicks = 0;
+   uint64_t nextHubMessage = 5000;
+   uint8_t resetPin = 1;
+   size_t outage = 0;
+   size_t next = 0;
+
+   hubGot.clear();
+   hubFrames = 0;
+   Outbox_Init(&outbox, &policy, hubSend, hubReplay, base);
+
+   for (uint64_t t = 0; t < end; t += step) {
+      uint32_t ticks = (uint32_t)(base + t);
+      uint8_t hubThere;
+
+      while ((outage < away.size()) && (t >= away[outage].end)) {
+         nextHubMessage = away[outage].end + 2000;
+         outage++;
+      }
+      hubThere = (outage >= away.size()) || (t < away[outage].begin);
+      linkCarries = hubThere && resetPin;
+
+      // a keepalive, or the device ID request when it is back
+      if (hubThere && (t >= nextHubMessage)) {
+         if (resetPin) {
+            keepAliveCheckTimer = t;
+            Outbox_LinkUp(&outbox, ticks);
+         }
+         nextHubMessage += 5000;
+      }
+
+      // operateUsbReset
+      if (resetPin) {
+         if ((t - keepAliveCheckTimer) >= 20000) {
+            resetPin = 0;
+            resetStartTicks = t;
+            Outbox_LinkDown(&outbox);
+         }
+      } else if ((t - resetStartTicks) >= 500) {
+         resetPin = 1;
+         keepAliveCheckTimer = t;
+      }
+      linkCarries = hubThere && resetPin;
+
+      while ((next < trace.size()) && ((uint64_t)trace[next].seconds * 1000 <= t)) {
+         putSeconds = trace[next].seconds;
+         if (withOutbox) {
+            Outbox_Put(&outbox, 0x91, trace[next].value, putSeconds);
+         } else {
+            hubSend(0x91, trace[next].value);
+         }
+         next++;
+      }
+      if (withOutbox) {
+         Outbox_Poll(&outbox, ticks);
+         result.deepest = std::max(result.deepest, (uint32_t)outbox.count);
+      }
+   }
+
+   for (size_t n = 0; n < trace.size(); n++) {
+      size_t got = hubGot.count(trace[n].seconds);
+
+      if (got > 1) {
+         result.duplicates += got - 1;
+      }
+      if (trace[n].change) {
+         result.changes++;
+         if (got == 0) {
+            result.lost++;
+         }
+      }
+   }
+   result.frames = hubFrames;
+   result.dropped = withOutbox ? outbox.stats.dropped : 0;
+   return result;
+}
+
+TEST(outboxTests, hubOutagesOfVaryingLength)
+{
+   static const uint32_t lengths[] = { 3, 12, 30, 120, 600, 3600, 6 * 3600, 24 * 3600 };
+   const uint32_t days = 14;
+   vector<Published> trace;
+
+   lcg = 1357;
+   trace = doorTrace(days);
+
+   for (size_t n = 0; n < sizeof(lengths) / sizeof(lengths[0]); n++) {
+      vector<Outage> away = outages((uint64_t)lengths[n] * 1000, (uint64_t)days * 86400000);
+      HubResult without = emulateHub(trace, away, 0);
+      HubResult with = emulateHub(trace, away, 1);
+
+      printf("\noutbox, %u outages of %u s: %u changes, lost %u without the outbox, %u with it (%u dropped when "
+             "full), %u duplicates, %u replay frames, at most %u of %u slots taken",
+             with.outages, lengths[n], with.changes, without.lost, with.lost, with.dropped, with.duplicates,
+             with.frames, with.deepest, OUTBOX_EVENTS);
+      CHECK(with.lost <= without.lost);
+      LONGS_EQUAL(with.changes, without.changes);
+      if ((lengths[n] >= 12) && (lengths[n] <= 6 * 3600)) {
+         LONGS_EQUAL(0, with.lost);
+      }
+   }
+   printf("\n");
+}
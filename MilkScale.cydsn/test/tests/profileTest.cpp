@@ -0,0 +1,161 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTestExt/MockSupport.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+using namespace std;
+
+extern "C"
+{
+#include "crc.h"
+}
+#include "profile.h"
+
+static uint32_t fakeNow;
+static string dumped;
+
+static uint32_t fakeClock(void)
+{
+   return fakeNow;
+}
+
+static void capturePrint(const char *s)
+{
+   dumped += s;
+}
+
+static void printToStdout(const char *s)
+{
+   fputs(s, stdout);
+}
+
+TEST_GROUP(profileTests)
+{
+   T_ProfileProbe probe;
+
+   void setup()
+   {
+      memset(&probe, 0, sizeof(probe));
+      probe.name = "probe";
+      fakeNow = 0;
+      dumped = "";
+      Profile_Init(fakeClock);
+   }
+
+   void teardown()
+   {
+      Profile_Reset();
+   }
+};
+
+TEST(profileTests, bucketsAreLog2)
+{
+   BYTES_EQUAL(0, Profile_Bucket(0));
+   BYTES_EQUAL(1, Profile_Bucket(1));
+   BYTES_EQUAL(2, Profile_Bucket(2));
+   BYTES_EQUAL(2, Profile_Bucket(3));
+   BYTES_EQUAL(3, Profile_Bucket(4));
+   BYTES_EQUAL(11, Profile_Bucket(1024));
+   BYTES_EQUAL(PROFILE_HISTOGRAM_BUCKETS - 1, Profile_Bucket(0xffffffffUL));
+}
+
+TEST(profileTests, recordAccumulatesStatistics)
+{
+   Profile_Add(&probe, 10);
+   Profile_Add(&probe, 3);
+   Profile_Add(&probe, 40);
+
+   LONGS_EQUAL(3, probe.count);
+   LONGS_EQUAL(3, probe.min);
+   LONGS_EQUAL(40, probe.max);
+   LONGS_EQUAL(53, (long)probe.total);
+   LONGS_EQUAL(1, probe.histogram[2]);
+   LONGS_EQUAL(1, probe.histogram[4]);
+   LONGS_EQUAL(1, probe.histogram[6]);
+}
+
+TEST(profileTests, recordUsesClockAcrossWrap)
+{
+   uint32_t start;
+
+   fakeNow = 0xfffffff0UL;
+   start = Profile_Now();
+   fakeNow = 0x10;
+   Profile_Record(&probe, start);
+   LONGS_EQUAL(0x20, probe.max);
+}
+
+TEST(profileTests, histogramSaturates)
+{
+   probe.histogram[1] = 0xfffe;
+   Profile_Add(&probe, 1);
+   Profile_Add(&probe, 1);
+   LONGS_EQUAL(0xffff, probe.histogram[1]);
+}
+
+TEST(profileTests, macrosTimeTheBracketedCode)
+{
+   PROFILE_PROBE(macroProbe, "macro");
+
+   fakeNow = 100;
+   PROFILE_BEGIN(macroProbe);
+   fakeNow = 125;
+   PROFILE_END(macroProbe);
+
+   LONGS_EQUAL(1, macroProbe.count);
+   LONGS_EQUAL(25, macroProbe.min);
+}
+
+TEST(profileTests, scopeRecordsOnExit)
+{
+   fakeNow = 7;
+   {
+      ProfileScope scope(probe);
+      fakeNow = 9;
+   }
+   LONGS_EQUAL(2, probe.max);
+}
+
+TEST(profileTests, dumpListsEveryRecordedProbe)
+{
+   Profile_Add(&probe, 5);
+   Profile_Add(&probe, 7);
+   Profile_Dump(capturePrint);
+
+   CHECK(dumped.find("probe: n=2 min=5 max=7 avg=6") != string::npos);
+   CHECK(dumped.find("log2: 0 0 0 2 0") != string::npos);
+}
+
+TEST(profileTests, resetClearsProbes)
+{
+   Profile_Add(&probe, 5);
+   Profile_Reset();
+   LONGS_EQUAL(0, probe.count);
+   LONGS_EQUAL(0, probe.histogram[3]);
+}
+
+// Timed with clock_gettime, so the dump can be put side by side with one
+// taken on the target.
+TEST(profileTests, hostClockProfilesCrcOfAFrame)
+{
+   static T_ProfileProbe crcProbe;
+   unsigned char frame[64];
+   crc_t crc = crc_init();
+
+   memset(&crcProbe, 0, sizeof(crcProbe));
+   crcProbe.name = "crc_update(64)";
+   memset(frame, 0x5a, sizeof(frame));
+   Profile_Init(Profile_HostClock);
+
+   for (int i = 0; i < 1000; i++) {
+      ProfileScope scope(crcProbe);
+      crc = crc_update(crc, frame, sizeof(frame));
+   }
+
+   LONGS_EQUAL(1000, crcProbe.count);
+   CHECK(crcProbe.max >= crcProbe.min);
+   CHECK(crc != 0);
+   Profile_Dump(printToStdout);
+}
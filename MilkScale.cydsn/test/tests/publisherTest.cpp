@@ -0,0 +1,261 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTestExt/MockSupport.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+extern "C"
+{
+#include "publisher.h"
+}
+
+using namespace std;
+
+struct Sent {
+   uint8_t resID;
+   uint16_t value;
+};
+
+static vector<Sent> sent;
+
+static void send(uint8_t resID, uint16_t value)
+{
+   Sent s = { resID, value };
+   sent.push_back(s);
+}
+
+static const T_PublishPolicy weightPolicy = { 2000, 300000, 2 };
+static const T_PublishPolicy replyPolicy = { 0, 0, 0 };
+
+static T_PublisherCB pcb;
+
+TEST_GROUP(publisherTests)
+{
+   void setup()
+   {
+      sent.clear();
+      Publisher_Init(&pcb, send);
+      Publisher_AddResource(&pcb, 0x91, 0, &weightPolicy, 0);
+      Publisher_AddResource(&pcb, 0x94, 0, &replyPolicy, 0);
+   }
+
+   void teardown()
+   {
+   }
+};
+
+TEST(publisherTests, initAndAddCheckArguments)
+{
+   BYTES_EQUAL(PUBLISHER_FAILURE, Publisher_Init(NULL, send));
+   BYTES_EQUAL(PUBLISHER_FAILURE, Publisher_Init(&pcb, NULL));
+   BYTES_EQUAL(PUBLISHER_SUCCESS, Publisher_Init(&pcb, send));
+   BYTES_EQUAL(PUBLISHER_FAILURE, Publisher_AddResource(&pcb, 0x91, 0, NULL, 0));
+   for (uint8_t i = 0; i < PUBLISHER_MAX_RESOURCES; i++) {
+      BYTES_EQUAL(PUBLISHER_SUCCESS, Publisher_AddResource(&pcb, 0x60 + i, 0, &replyPolicy, 0));
+   }
+   BYTES_EQUAL(PUBLISHER_FAILURE, Publisher_AddResource(&pcb, 0x70, 0, &replyPolicy, 0));
+   BYTES_EQUAL(PUBLISHER_SUCCESS, Publisher_AddResource(&pcb, 0x60, 0, &replyPolicy, 0));
+   BYTES_EQUAL(PUBLISHER_FAILURE, Publisher_Publish(&pcb, 0x70, 1));
+}
+
+TEST(publisherTests, publishingNeverSendsByItself)
+{
+   Publisher_Publish(&pcb, 0x91, 50);
+   LONGS_EQUAL(0, sent.size());
+   LONGS_EQUAL(1, Publisher_Flush(&pcb, 5000));
+   LONGS_EQUAL(1, sent.size());
+   LONGS_EQUAL(0x91, sent[0].resID);
+   LONGS_EQUAL(50, sent[0].value);
+}
+
+TEST(publisherTests, sameValueIsNotSentAgain)
+{
+   Publisher_Publish(&pcb, 0x91, 50);
+   Publisher_Flush(&pcb, 5000);
+   Publisher_Publish(&pcb, 0x91, 50);
+   LONGS_EQUAL(0, Publisher_Flush(&pcb, 10000));
+   LONGS_EQUAL(1, sent.size());
+}
+
+TEST(publisherTests, valueTheCloudAlreadyHoldsIsNotSent)
+{
+   Publisher_Publish(&pcb, 0x91, 0);
+   LONGS_EQUAL(0, Publisher_Flush(&pcb, 5000));
+}
+
+TEST(publisherTests, changesInsideTheDeadbandAreHeldBack)
+{
+   Publisher_Publish(&pcb, 0x91, 50);
+   Publisher_Flush(&pcb, 5000);
+   Publisher_Publish(&pcb, 0x91, 52);
+   LONGS_EQUAL(0, Publisher_Flush(&pcb, 10000));
+   Publisher_Publish(&pcb, 0x91, 47);
+   LONGS_EQUAL(1, Publisher_Flush(&pcb, 10000));
+   LONGS_EQUAL(47, sent[1].value);
+}
+
+TEST(publisherTests, minimumIntervalCoalescesToTheLatestValue)
+{
+   Publisher_Publish(&pcb, 0x91, 50);
+   Publisher_Flush(&pcb, 5000);
+   Publisher_Publish(&pcb, 0x91, 40);
+   LONGS_EQUAL(0, Publisher_Flush(&pcb, 5500));
+   Publisher_Publish(&pcb, 0x91, 30);
+   LONGS_EQUAL(1500, Publisher_TicksUntilDue(&pcb, 5500));
+   LONGS_EQUAL(0, Publisher_Flush(&pcb, 6999));
+   LONGS_EQUAL(1, Publisher_Flush(&pcb, 7000));
+   LONGS_EQUAL(2, sent.size());
+   LONGS_EQUAL(30, sent[1].value);
+}
+
+TEST(publisherTests, heartbeatResendsTheCurrentValue)
+{
+   Publisher_Publish(&pcb, 0x91, 50);
+   Publisher_Flush(&pcb, 5000);
+   Publisher_Publish(&pcb, 0x91, 51);
+   LONGS_EQUAL(300000, Publisher_TicksUntilDue(&pcb, 5000));
+   LONGS_EQUAL(0, Publisher_Flush(&pcb, 304999));
+   LONGS_EQUAL(1, Publisher_Flush(&pcb, 305000));
+   LONGS_EQUAL(51, sent[1].value);
+   LONGS_EQUAL(1, pcb.stats.heartbeats);
+}
+
+TEST(publisherTests, nothingPublishedIsNeverDue)
+{
+   LONGS_EQUAL(PUBLISHER_NEVER, Publisher_TicksUntilDue(&pcb, 1000000));
+   LONGS_EQUAL(0, Publisher_Flush(&pcb, 1000000));
+}
+
+TEST(publisherTests, dueResourcesGoOutInOneBurst)
+{
+   Publisher_Publish(&pcb, 0x91, 50);
+   Publisher_Publish(&pcb, 0x94, 1);
+   LONGS_EQUAL(2, Publisher_Flush(&pcb, 5000));
+   LONGS_EQUAL(1, pcb.stats.bursts);
+   LONGS_EQUAL(2, pcb.stats.sent);
+}
+
+TEST(publisherTests, invalidatedResourceIsSentWhateverItsValue)
+{
+   Publisher_Invalidate(&pcb, 0x94);
+   LONGS_EQUAL(0, Publisher_Flush(&pcb, 10));
+   Publisher_Publish(&pcb, 0x94, 0);
+   LONGS_EQUAL(1, Publisher_Flush(&pcb, 10));
+   Publisher_Publish(&pcb, 0x94, 0);
+   LONGS_EQUAL(0, Publisher_Flush(&pcb, 20));
+}
+
+TEST(publisherTests, reRegisteringStartsFromTheCloudValue)
+{
+   Publisher_Publish(&pcb, 0x91, 50);
+   Publisher_Flush(&pcb, 5000);
+   Publisher_AddResource(&pcb, 0x91, 0, &weightPolicy, 6000);
+   Publisher_Publish(&pcb, 0x91, 50);
+   LONGS_EQUAL(1, Publisher_Flush(&pcb, 8000));
+}
+
+TEST(publisherTests, ticksMayWrap)
+{
+   Publisher_AddResource(&pcb, 0x91, 0, &weightPolicy, 0xffffff00UL);
+   Publisher_Publish(&pcb, 0x91, 50);
+   LONGS_EQUAL(2000, Publisher_TicksUntilDue(&pcb, 0xffffff00UL));
+   LONGS_EQUAL(0, Publisher_Flush(&pcb, 0x600));
+   LONGS_EQUAL(1, Publisher_Flush(&pcb, 0x6d0));
+}
+
+/*
+ * An hour of a milk jug in the fridge: the door opens every few minutes, and
+ * on some of those the jug comes out and goes back lighter.  The sensors read
+ * a percent either side of the true weight.
+ */
+struct DoorEvent {
+   uint32_t openAt;
+   uint32_t closeAt;
+   uint16_t weightAfter;
+};
+
+static uint32_t lcg;
+
+static uint32_t nextRandom(void)
+{
+   lcg = lcg * 1664525u + 1013904223u;
+   return lcg >> 8;
+}
+
+static vector<DoorEvent> doorTrace(void)
+{
+   vector<DoorEvent> trace;
+   uint32_t t = 0;
+   uint16_t weight = 85;
+
+   lcg = 12345;
+   for (;;) {
+      DoorEvent e;
+
+      t += 60000 + nextRandom() % 300000;
+      if (t > 3500000) {
+         break;
+      }
+      e.openAt = t;
+      e.closeAt = t + 3000 + nextRandom() % 40000;
+      if ((nextRandom() % 3 == 0) && (weight > 10)) {
+         weight -= 3 + nextRandom() % 8;
+      }
+      e.weightAfter = weight;
+      trace.push_back(e);
+      t = e.closeAt;
+   }
+   return trace;
+}
+
+static uint16_t reading(uint16_t weight)
+{
+   return weight + 1 - nextRandom() % 3;
+}
+
+TEST(publisherTests, doorTraceFramesPerHour)
+{
+   vector<DoorEvent> trace = doorTrace();
+   uint32_t everyTwoSeconds = 0;
+   uint32_t published = 0;
+   uint16_t weight = 85;
+   uint16_t lastSentWeight = 0;
+   size_t next = 0;
+   uint8_t doorOpen = 0;
+
+   sent.clear();
+   CHECK(trace.size() > 8);
+
+   // the loop wakes at least every 10 ms when it is busy
+   for (uint32_t now = 10; now <= 3600000; now += 10) {
+      if ((next < trace.size()) && !doorOpen && (now >= trace[next].openAt)) {
+         doorOpen = 1;
+      }
+      if ((next < trace.size()) && doorOpen && (now >= trace[next].closeAt)) {
+         doorOpen = 0;
+         weight = trace[next++].weightAfter;
+         // readMilkWeight on the door closing
+         everyTwoSeconds++;
+         Publisher_Publish(&pcb, 0x91, reading(weight));
+      }
+      if (now % 2000 == 0) {
+         // periodicPrintOfWeight
+         everyTwoSeconds++;
+         Publisher_Publish(&pcb, 0x91, reading(weight));
+      }
+      Publisher_Flush(&pcb, now);
+   }
+
+   for (size_t i = 0; i < sent.size(); i++) {
+      published++;
+      lastSentWeight = sent[i].value;
+   }
+
+   printf("\npublisher: %lu frames/h (every 2 s: %lu frames/h), %lu door events\n",
+          (unsigned long)published, (unsigned long)everyTwoSeconds, (unsigned long)trace.size());
+   CHECK(published * 10 < everyTwoSeconds);
+   // at least one weight per door event that moved it and a heartbeat every five minutes
+   CHECK(published >= 12);
+   CHECK((lastSentWeight + 2 >= weight) && (lastSentWeight <= weight + 2));
+}
@@ -0,0 +1,373 @@
+#include "CppUTest/TestHarness.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#include "ringbuf.h"
+}
+
+using namespace std;
+
+/*
+ * Random operations run on the ring buffer and on a deque that holds what
+ * the buffer should hold, side by side, for every size the control block
+ * takes.  The first operation where the two disagree fails the test, with
+ * the shortest sequence found that still disagrees.
+ */
+
+enum EOp {
+   Op_Write,
+   Op_Read,
+   Op_Peek,
+   Op_WriteRun,   // writes until arg bytes are written or the buffer is full
+   Op_ReadRun,    // reads arg bytes
+   Op_PeekScan,   // peeks at every position from arg on, as the receive path does
+   Op_Count
+};
+
+struct Op {
+   uint8_t op;
+   uint8_t arg;
+};
+
+// Percentages of each operation
+struct Mix {
+   const char *name;
+   uint8_t percent[Op_Count];
+};
+
+static const Mix mixes[] = {
+   { "balanced", { 35, 35, 20, 4, 4, 2 } },
+   { "fill", { 55, 20, 15, 5, 3, 2 } },
+   { "drain", { 20, 55, 15, 3, 5, 2 } },
+   { "bulk", { 5, 5, 5, 35, 35, 15 } },
+   { "peek", { 15, 15, 40, 5, 5, 20 } }
+};
+
+#define MIX_COUNT (sizeof(mixes) / sizeof(mixes[0]))
+
+static uint32_t lcg;
+
+// Makes the ring smaller than the model, to see a failure found and shrunk
+static uint8_t ringShortBy;
+
+static uint32_t nextRandom(void)
+{
+   lcg = lcg * 1664525u + 1013904223u;
+   return lcg >> 8;
+}
+
+static vector<Op> generate(const Mix &mix, uint8_t size, uint32_t count, uint32_t seed)
+{
+   vector<Op> ops;
+
+   lcg = seed;
+   while (ops.size() < count) {
+      uint32_t r = nextRandom() % 100;
+      Op op;
+
+      for (op.op = 0; op.op < Op_Count - 1 && r >= mix.percent[op.op]; op.op++) {
+         r -= mix.percent[op.op];
+      }
+      // positions and run lengths reach a little past the size, to cover
+      // the checks against it
+      op.arg = (uint8_t)(nextRandom() % ((uint32_t)size + 2));
+      ops.push_back(op);
+   }
+   return ops;
+}
+
+static string describe(const Op &op)
+{
+   static const char *const names[Op_Count] = { "write", "read", "peek", "writeRun", "readRun", "peekScan" };
+   char text[32];
+
+   snprintf(text, sizeof(text), "%s(%u)", names[op.op], op.arg);
+   return text;
+}
+
+/*
+ * Runs ops from an empty buffer of the size, with a model next to it.
+ * Returns the index of the first op after which the two disagree, or
+ * ops.size() if they never do; pWhat says how and pBefore gets the control
+ * block as it was before that op.
+ */
+static size_t runAgainstModel(const vector<Op> &ops, uint8_t size, string *pWhat, T_RingBufferCB *pBefore = NULL)
+{
+   uint8_t storage[255];
+   T_RingBufferCB cb;
+   deque<uint8_t> model;
+   uint8_t next = 0;
+   char text[96];
+
+   RingBuffer_Init(&cb, storage, size - ringShortBy);
+   for (size_t i = 0; i < ops.size(); i++) {
+      const Op &op = ops[i];
+      uint32_t got = 0;
+      uint32_t want = 0;
+      uint16_t j;
+
+      if (pBefore != NULL) {
+         *pBefore = cb;
+      }
+      // runs are checked at their first difference
+      switch (op.op) {
+         case Op_Write:
+            got = RingBuffer_Write(&cb, next);
+            want = (model.size() < size) ? RING_BUFFER_ADD_SUCCESS : RING_BUFFER_ADD_FAILURE;
+            if (want == RING_BUFFER_ADD_SUCCESS) {
+               model.push_back(next);
+            }
+            next++;
+            break;
+         case Op_Read:
+            got = RingBuffer_Read(&cb);
+            want = 0xff;
+            if (!model.empty()) {
+               want = model.front();
+               model.pop_front();
+            }
+            break;
+         case Op_Peek:
+            got = RingBuffer_Peek(&cb, op.arg);
+            want = (op.arg < model.size()) ? model[op.arg] : 0xff;
+            break;
+         case Op_WriteRun:
+            for (j = 0; j < op.arg && model.size() < size && got == want; j++) {
+               got = RingBuffer_Write(&cb, next);
+               want = RING_BUFFER_ADD_SUCCESS;
+               model.push_back(next++);
+            }
+            break;
+         case Op_ReadRun:
+            for (j = 0; j < op.arg && got == want; j++) {
+               got = RingBuffer_Read(&cb);
+               want = 0xff;
+               if (!model.empty()) {
+                  want = model.front();
+                  model.pop_front();
+               }
+            }
+            break;
+         default:
+            for (j = op.arg; j < model.size() && got == want; j++) {
+               got = RingBuffer_Peek(&cb, (uint8_t)j);
+               want = model[j];
+            }
+            break;
+      }
+      if (got != want) {
+         snprintf(text, sizeof(text), "returned 0x%02x, expected 0x%02x", (unsigned)got, (unsigned)want);
+      } else if (RingBuffer_BytesUsed(&cb) != model.size()) {
+         snprintf(text, sizeof(text), "%u bytes used, expected %u", RingBuffer_BytesUsed(&cb), (unsigned)model.size());
+      } else if (RingBuffer_BytesAvailable(&cb) != size - model.size()) {
+         snprintf(text, sizeof(text), "%u bytes available, expected %u", RingBuffer_BytesAvailable(&cb),
+                  (unsigned)(size - model.size()));
+      } else if (RingBuffer_IsEmpty(&cb) != (model.empty() ? RING_BUFFER_IS_EMPTY : RING_BUFFER_NOT_EMPTY)) {
+         snprintf(text, sizeof(text), "empty flag %u with %u bytes", RingBuffer_IsEmpty(&cb), (unsigned)model.size());
+      } else if (RingBuffer_IsFull(&cb) != ((model.size() == size) ? RING_BUFFER_IS_FULL : RING_BUFFER_NOT_FULL)) {
+         snprintf(text, sizeof(text), "full flag %u with %u bytes", RingBuffer_IsFull(&cb), (unsigned)model.size());
+      } else {
+         continue;
+      }
+      if (pWhat != NULL) {
+         *pWhat = text;
+      }
+      return i;
+   }
+   return ops.size();
+}
+
+// Whether ops still fail; cut after the failure if they do
+static bool stillFails(vector<Op> *pOps, uint8_t size)
+{
+   size_t failsAt = runAgainstModel(*pOps, size, NULL);
+
+   if (failsAt == pOps->size()) {
+      return false;
+   }
+   pOps->resize(failsAt + 1);
+   return true;
+}
+
+// Drops what the failure does not need: every op that can go and every run
+// or position that can be smaller, until nothing can.
+static vector<Op> shrink(vector<Op> ops, uint8_t size)
+{
+   T_RingBufferCB before;
+   bool shorter;
+   size_t failsAt = runAgainstModel(ops, size, NULL, &before);
+   vector<Op> direct;
+   Op op;
+
+   // the shortest way there is usually to move the head to where it was and
+   // put as many bytes in
+   op.op = Op_WriteRun;
+   op.arg = before.head;
+   direct.push_back(op);
+   op.op = Op_ReadRun;
+   direct.push_back(op);
+   op.op = Op_WriteRun;
+   op.arg = before.bytesUsed;
+   direct.push_back(op);
+   direct.push_back(ops[failsAt]);
+   if (stillFails(&direct, size)) {
+      ops = direct;
+   } else {
+      stillFails(&ops, size);
+   }
+   do {
+      shorter = false;
+      for (size_t i = ops.size(); i-- > 0 && !shorter;) {
+         vector<Op> candidate = ops;
+
+         candidate.erase(candidate.begin() + i);
+         if (stillFails(&candidate, size)) {
+            ops = candidate;
+            shorter = true;
+         }
+      }
+      for (size_t i = 0; i < ops.size() && !shorter; i++) {
+         for (uint8_t step = ops[i].arg / 2; step > 0 && !shorter; step /= 2) {
+            vector<Op> candidate = ops;
+
+            candidate[i].arg -= step;
+            if (stillFails(&candidate, size)) {
+               ops = candidate;
+               shorter = true;
+            }
+         }
+      }
+   } while (shorter);
+   return ops;
+}
+
+static void checkAgainstModel(const vector<Op> &ops, uint8_t size, const char *mixName, uint32_t seed)
+{
+   string what;
+
+   if (runAgainstModel(ops, size, &what) < ops.size()) {
+      vector<Op> minimal = shrink(ops, size);
+      string message;
+      char text[160];
+
+      runAgainstModel(minimal, size, &what);
+      snprintf(text, sizeof(text), "size %u, %s mix, seed %lu: %s after\n  ", size, mixName, (unsigned long)seed,
+               what.c_str());
+      message = text;
+      for (size_t i = 0; i < minimal.size(); i++) {
+         message += describe(minimal[i]) + " ";
+      }
+      FAIL(message.c_str());
+   }
+}
+
+TEST_GROUP(ringBufModelTests)
+{
+   void teardown()
+   {
+      ringShortBy = 0;
+   }
+};
+
+TEST(ringBufModelTests, everySizeAndMixAgreesWithTheModel)
+{
+   for (uint16_t size = 1; size <= 255; size++) {
+      for (uint8_t m = 0; m < MIX_COUNT; m++) {
+         for (uint32_t seed = 1; seed <= 3; seed++) {
+            uint32_t runSeed = seed * 1000003u + size * 31u + m;
+
+            checkAgainstModel(generate(mixes[m], (uint8_t)size, 600, runSeed), (uint8_t)size, mixes[m].name,
+                              runSeed);
+         }
+      }
+   }
+}
+
+TEST(ringBufModelTests, shrinkingLeavesAShortSequenceThatStillFails)
+{
+   // a ring one byte smaller than the model thinks it is
+   vector<Op> ops = generate(mixes[1], 9, 400, 42);
+   vector<Op> minimal;
+
+   ringShortBy = 1;
+   CHECK(runAgainstModel(ops, 9, NULL) < ops.size());
+   minimal = shrink(ops, 9);
+   LONGS_EQUAL(minimal.size() - 1, runAgainstModel(minimal, 9, NULL));
+   CHECK(minimal.size() <= 9);
+   ringShortBy = 0;
+}
+
+static double nanosecondsPerOp(const vector<Op> &ops, uint8_t size, uint32_t *pSink)
+{
+   uint8_t storage[255];
+   T_RingBufferCB cb;
+   struct timespec start;
+   struct timespec end;
+   uint32_t sink = 0;
+   uint32_t count = 0;
+
+   RingBuffer_Init(&cb, storage, size);
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   for (size_t i = 0; i < ops.size(); i++) {
+      const Op &op = ops[i];
+      uint16_t j;
+
+      switch (op.op) {
+         case Op_Write:
+            sink += RingBuffer_Write(&cb, (uint8_t)i);
+            count++;
+            break;
+         case Op_Read:
+            sink += RingBuffer_Read(&cb);
+            count++;
+            break;
+         case Op_Peek:
+            sink += RingBuffer_Peek(&cb, op.arg);
+            count++;
+            break;
+         case Op_WriteRun:
+            for (j = 0; j < op.arg && RingBuffer_IsFull(&cb) == RING_BUFFER_NOT_FULL; j++) {
+               sink += RingBuffer_Write(&cb, (uint8_t)j);
+               count++;
+            }
+            break;
+         case Op_ReadRun:
+            for (j = 0; j < op.arg; j++) {
+               sink += RingBuffer_Read(&cb);
+               count++;
+            }
+            break;
+         default:
+            for (j = op.arg; j < RingBuffer_BytesUsed(&cb); j++) {
+               sink += RingBuffer_Peek(&cb, (uint8_t)j);
+               count++;
+            }
+            break;
+      }
+   }
+   clock_gettime(CLOCK_MONOTONIC, &end);
+   *pSink += sink;
+   return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / (count ? count : 1);
+}
+
+TEST(ringBufModelTests, throughputOfEachMix)
+{
+   uint32_t sink = 0;
+
+   printf("\nring buffer, 64 bytes as the chillhub packet buffer:");
+   for (uint8_t m = 0; m < MIX_COUNT; m++) {
+      vector<Op> ops = generate(mixes[m], 64, 200000, 7);
+
+      checkAgainstModel(ops, 64, mixes[m].name, 7);
+      printf(" %s %.1f ns/op", mixes[m].name, nanosecondsPerOp(ops, 64, &sink));
+   }
+   printf("\n");
+   CHECK(sink != 0);
+}
@@ -291,7 +291,7 @@ TEST(ringBufTests, peekCheckWrapCase)
       retVal = RingBuffer_Write(&rbcb, i++);
    } while(retVal != RING_BUFFER_ADD_FAILURE);
 
-   BYTES_EQUAL(13, RingBuffer_Peek(&rbcb, 8));
+   BYTES_EQUAL(12, RingBuffer_Peek(&rbcb, 8));
 }
 
 
@@ -0,0 +1,97 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTestExt/MockSupport.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include "fakeHub.h"
+
+using namespace std;
+
+#define TELEMETRY_MSG 0x97
+#define TELEMETRY_COUNT 9
+
+TEST_GROUP(telemetryTests)
+{
+   void setup()
+   {
+      FakeHub::reset();
+      ChillHub.setup("scale", "uuid", &FakeHub::serial);
+      FakeHub::tx.clear();
+   }
+
+   void teardown()
+   {
+   }
+};
+
+TEST(telemetryTests, u16ArrayIsBigEndianAfterTheElementHeader)
+{
+   const uint16_t data[] = { 0x1234, 0xfeff, 1 };
+   vector<vector<uint8_t> > sent;
+
+   ChillHub.sendU16ArrayMsg(TELEMETRY_MSG, data, 3);
+   sent = FakeHub::sentMessages();
+
+   LONGS_EQUAL(1, sent.size());
+   CHECK(sent[0] == vector<uint8_t>({ TELEMETRY_MSG, arrayDataType, 3, unsigned16DataType,
+                                      0x12, 0x34, 0xfe, 0xff, 0x00, 0x01 }));
+}
+
+TEST(telemetryTests, u16ArrayTooLongIsNotSent)
+{
+   uint16_t data[30] = { 0 };
+
+   ChillHub.sendU16ArrayMsg(TELEMETRY_MSG, data, 30);
+   LONGS_EQUAL(0, FakeHub::tx.size());
+   ChillHub.sendU16ArrayMsg(TELEMETRY_MSG, data, 29);
+   LONGS_EQUAL(1, FakeHub::sentMessages().size());
+}
+
+/*
+ * A thousand samples of a jug being emptied, each sent as one telemetry
+ * frame and as a resource update per value.
+ */
+TEST(telemetryTests, compositeFrameCostsLessThanSeparateUpdates)
+{
+   uint32_t lcg = 4321;
+   uint32_t composite = 0;
+   uint32_t separate = 0;
+   uint32_t separateFrames = 0;
+   int32_t level = 60000;
+
+   for (uint16_t seq = 0; seq < 1000; seq++) {
+      uint16_t sample[TELEMETRY_COUNT];
+      uint32_t total = 0;
+
+      lcg = lcg * 1664525u + 1013904223u;
+      level -= (lcg >> 28);
+      if (level < 0) {
+         level = 60000;
+      }
+      sample[0] = seq;
+      for (int j = 0; j < 3; j++) {
+         lcg = lcg * 1664525u + 1013904223u;
+         sample[4 + j] = (uint16_t)(level / 3 + ((lcg >> 20) & 0xff));
+         sample[1 + j] = (uint16_t)(600 + sample[4 + j] / 20);
+         total += sample[4 + j];
+      }
+      sample[7] = (uint16_t)(total > 0xffff ? 0xffff : total);
+      sample[8] = (uint16_t)(total / 600 > 100 ? 100 : total / 600);
+
+      ChillHub.sendU16ArrayMsg(TELEMETRY_MSG, sample, TELEMETRY_COUNT);
+      composite += FakeHub::tx.size();
+      FakeHub::tx.clear();
+
+      // everything but the sequence number as its own resource
+      for (uint8_t i = 1; i < TELEMETRY_COUNT; i++) {
+         ChillHub.updateCloudResourceU16(0xa0 + i, sample[i]);
+         separateFrames++;
+      }
+      separate += FakeHub::tx.size();
+      FakeHub::tx.clear();
+   }
+
+   printf("\ntelemetry: %.1f bytes/sample in one frame, %.1f bytes/sample in %lu updates\n",
+          composite / 1000.0, separate / 1000.0, (unsigned long)(separateFrames / 1000));
+   CHECK(composite * 4 < separate);
+}
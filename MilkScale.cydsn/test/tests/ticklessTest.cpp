@@ -0,0 +1,296 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTestExt/MockSupport.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+extern "C"
+{
+#include "tickless.h"
+}
+
+static T_TicklessCB tcb;
+
+#define COUNTS_PER_TICK 100
+#define COUNTER_MAX 0xffff
+
+TEST_GROUP(ticklessTests)
+{
+   void setup()
+   {
+      Tickless_Init(&tcb, COUNTS_PER_TICK, COUNTER_MAX);
+   }
+
+   void teardown()
+   {
+   }
+};
+
+TEST(ticklessTests, initChecksArguments)
+{
+   BYTES_EQUAL(TICKLESS_INIT_FAILURE, Tickless_Init(NULL, COUNTS_PER_TICK, COUNTER_MAX));
+   BYTES_EQUAL(TICKLESS_INIT_FAILURE, Tickless_Init(&tcb, 0, COUNTER_MAX));
+   BYTES_EQUAL(TICKLESS_INIT_FAILURE, Tickless_Init(&tcb, COUNTS_PER_TICK, 10));
+   BYTES_EQUAL(TICKLESS_INIT_SUCCESS, Tickless_Init(&tcb, COUNTS_PER_TICK, COUNTER_MAX));
+}
+
+TEST(ticklessTests, initComputesLongestPeriod)
+{
+   LONGS_EQUAL(655, tcb.maxTicksPerPeriod);
+   LONGS_EQUAL(1, tcb.ticksPerPeriod);
+   Tickless_Init(&tcb, 0x100, COUNTER_MAX);
+   LONGS_EQUAL(256, tcb.maxTicksPerPeriod);
+}
+
+TEST(ticklessTests, ticksUntilHandlesWrapAndPast)
+{
+   LONGS_EQUAL(10, Tickless_TicksUntil(100, 110));
+   LONGS_EQUAL(0, Tickless_TicksUntil(110, 100));
+   LONGS_EQUAL(0, Tickless_TicksUntil(100, 100));
+   LONGS_EQUAL(20, Tickless_TicksUntil(0xfffffff6UL, 10));
+}
+
+TEST(ticklessTests, regularTickLeavesPeriodAlone)
+{
+   LONGS_EQUAL(TICKLESS_NO_CHANGE, Tickless_TerminalCount(&tcb));
+   LONGS_EQUAL(1, tcb.ticks);
+}
+
+TEST(ticklessTests, sleepStretchesPeriodToDeadline)
+{
+   LONGS_EQUAL(50 * COUNTS_PER_TICK - 1, Tickless_PlanSleep(&tcb, 50));
+   LONGS_EQUAL(COUNTS_PER_TICK - 1, Tickless_TerminalCount(&tcb));
+   LONGS_EQUAL(50, tcb.ticks);
+   LONGS_EQUAL(1, tcb.ticksPerPeriod);
+}
+
+TEST(ticklessTests, sleepIsClampedToCounterRange)
+{
+   LONGS_EQUAL(655 * COUNTS_PER_TICK - 1, Tickless_PlanSleep(&tcb, 20000));
+}
+
+TEST(ticklessTests, noSleepWhenDeadlineIsNextTick)
+{
+   LONGS_EQUAL(TICKLESS_NO_CHANGE, Tickless_PlanSleep(&tcb, 1));
+   LONGS_EQUAL(TICKLESS_NO_CHANGE, Tickless_PlanSleep(&tcb, 0));
+}
+
+TEST(ticklessTests, noSecondStretchWhileStretched)
+{
+   Tickless_PlanSleep(&tcb, 50);
+   LONGS_EQUAL(TICKLESS_NO_CHANGE, Tickless_PlanSleep(&tcb, 100));
+}
+
+TEST(ticklessTests, cancelRestoresRegularTick)
+{
+   Tickless_PlanSleep(&tcb, 50);
+   LONGS_EQUAL(COUNTS_PER_TICK - 1, Tickless_CancelSleep(&tcb));
+   Tickless_TerminalCount(&tcb);
+   LONGS_EQUAL(1, tcb.ticks);
+}
+
+TEST(ticklessTests, earlyWakeCatchesUpAndEndsAtNextTick)
+{
+   Tickless_PlanSleep(&tcb, 50);
+   LONGS_EQUAL(13 * COUNTS_PER_TICK - 1, Tickless_EarlyWake(&tcb, 12 * COUNTS_PER_TICK + 40));
+   LONGS_EQUAL(12, tcb.ticks);
+   Tickless_TerminalCount(&tcb);
+   LONGS_EQUAL(13, tcb.ticks);
+   LONGS_EQUAL(1, tcb.ticksPerPeriod);
+}
+
+TEST(ticklessTests, earlyWakeNearBoundarySkipsAhead)
+{
+   Tickless_PlanSleep(&tcb, 50);
+   LONGS_EQUAL(14 * COUNTS_PER_TICK - 1, Tickless_EarlyWake(&tcb, 13 * COUNTS_PER_TICK - 2));
+   LONGS_EQUAL(12, tcb.ticks);
+   Tickless_TerminalCount(&tcb);
+   LONGS_EQUAL(14, tcb.ticks);
+}
+
+TEST(ticklessTests, earlyWakeNearTerminalCountLeavesPeriod)
+{
+   Tickless_PlanSleep(&tcb, 50);
+   LONGS_EQUAL(TICKLESS_NO_CHANGE, Tickless_EarlyWake(&tcb, 50 * COUNTS_PER_TICK - 3));
+   Tickless_TerminalCount(&tcb);
+   LONGS_EQUAL(50, tcb.ticks);
+}
+
+TEST(ticklessTests, earlyWakeInRegularTickDoesNothing)
+{
+   LONGS_EQUAL(TICKLESS_NO_CHANGE, Tickless_EarlyWake(&tcb, 40));
+   LONGS_EQUAL(0, tcb.earlyWakeups);
+}
+
+TEST(ticklessTests, nowIncludesRunningCounter)
+{
+   Tickless_PlanSleep(&tcb, 50);
+   LONGS_EQUAL(7, Tickless_Now(&tcb, 7 * COUNTS_PER_TICK + 99));
+}
+
+TEST(ticklessTests, microsCombineTicksAndCounter)
+{
+   Tickless_TerminalCount(&tcb);
+   Tickless_TerminalCount(&tcb);
+   LONGS_EQUAL(2000 + 420, Tickless_Micros(&tcb, 42, 0));
+}
+
+TEST(ticklessTests, microsCountPendingWrap)
+{
+   Tickless_PlanSleep(&tcb, 50);
+   LONGS_EQUAL(50000 + 10, Tickless_Micros(&tcb, 1, 1));
+}
+
+/*
+ * One hour of the main loop, modelled on a counter running at
+ * COUNTS_PER_TICK per millisecond.  The jobs mirror main.c: the button check
+ * every second, the weight print every two seconds, a hub keepalive every five
+ * seconds and a few door events arriving over the UART.
+ */
+TEST_GROUP(ticklessSimulation)
+{
+   uint64_t nowCounts;
+   uint32_t counter;
+   uint32_t period;
+   uint8_t tcPending;
+   uint64_t activeMicros;
+   uint32_t wakeups;
+   uint32_t buttonTicks;
+   uint32_t weightTicks;
+   uint32_t maxTickError;
+
+   void setup()
+   {
+      Tickless_Init(&tcb, COUNTS_PER_TICK, COUNTER_MAX);
+      nowCounts = 0;
+      counter = 0;
+      period = COUNTS_PER_TICK - 1;
+      tcPending = 0;
+      activeMicros = 0;
+      wakeups = 0;
+      buttonTicks = 0;
+      weightTicks = 0;
+      maxTickError = 0;
+   }
+
+   void timerIsr()
+   {
+      uint32_t p = Tickless_TerminalCount(&tcb);
+      if (p != TICKLESS_NO_CHANGE) {
+         period = p;
+      }
+      tcPending = 0;
+   }
+
+   // Run the counter until the terminal count or until the absolute time
+   // 'until', whichever comes first.
+   void runCounter(uint64_t until)
+   {
+      uint64_t toTc = (uint64_t)(period - counter) + 1;
+
+      if (nowCounts + toTc <= until) {
+         nowCounts += toTc;
+         counter = 0;
+         tcPending = 1;
+      } else {
+         counter += (uint32_t)(until - nowCounts);
+         nowCounts = until;
+      }
+   }
+
+   uint32_t earlier(uint32_t now, uint32_t a, uint32_t b)
+   {
+      return (Tickless_TicksUntil(now, a) <= Tickless_TicksUntil(now, b)) ? a : b;
+   }
+
+   void checkTicks()
+   {
+      uint32_t actual = (uint32_t)(nowCounts / COUNTS_PER_TICK);
+      uint32_t error = actual - tcb.ticks;
+
+      CHECK((int32_t)error >= 0);
+      if (error > maxTickError) {
+         maxTickError = error;
+      }
+   }
+
+   void runJobs()
+   {
+      activeMicros += 20;
+      if ((tcb.ticks - buttonTicks) >= 1000) {
+         buttonTicks = tcb.ticks;
+         activeMicros += 10;
+      }
+      if ((tcb.ticks - weightTicks) >= 2000) {
+         weightTicks = tcb.ticks;
+         activeMicros += 1500;
+      }
+   }
+
+   void simulateHour(uint8_t tickless)
+   {
+      const uint64_t hour = 3600ULL * 1000 * COUNTS_PER_TICK;
+      uint64_t nextUartEvent = 5000ULL * COUNTS_PER_TICK + 37;
+
+      while (nowCounts < hour) {
+         uint32_t deadline;
+         uint32_t p;
+
+         if (!tickless) {
+            runCounter(hour);
+            if (tcPending) {
+               timerIsr();
+               wakeups++;
+            }
+            continue;
+         }
+
+         deadline = earlier(tcb.ticks, buttonTicks + 1000, weightTicks + 2000);
+         p = Tickless_PlanSleep(&tcb, deadline);
+         if (p != TICKLESS_NO_CHANGE) {
+            period = p;
+         }
+
+         runCounter(nextUartEvent < hour ? nextUartEvent : hour);
+         wakeups++;
+         if (tcPending) {
+            timerIsr();
+         } else {
+            p = Tickless_EarlyWake(&tcb, counter);
+            if (p != TICKLESS_NO_CHANGE) {
+               period = p;
+            }
+         }
+         if (nowCounts == nextUartEvent) {
+            // a keepalive frame, plus a door event every ten minutes
+            activeMicros += 300;
+            nextUartEvent += 5000ULL * COUNTS_PER_TICK + 11;
+         }
+         checkTicks();
+         runJobs();
+      }
+   }
+};
+
+TEST(ticklessSimulation, busyLoopWakesEveryTick)
+{
+   simulateHour(0);
+   LONGS_EQUAL(3600000, wakeups);
+}
+
+TEST(ticklessSimulation, ticklessHourKeepsTimeAndSleeps)
+{
+   char line[160];
+
+   simulateHour(1);
+
+   // never more than the one tick lag allowed around a period boundary
+   CHECK(maxTickError <= 1);
+   CHECK(wakeups < 20000);
+   CHECK(activeMicros < 10ULL * 1000 * 1000);
+
+   snprintf(line, sizeof(line),
+      "tickless: %lu wakeups/h (busy loop: 3600000), %lu ms active/h (busy loop: 3600000), %lu early wakes",
+      (unsigned long)wakeups, (unsigned long)(activeMicros / 1000), (unsigned long)tcb.earlyWakeups);
+   UT_PRINT(line);
+}
@@ -0,0 +1,399 @@
+#include "CppUTest/TestHarness.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+#include "fakeHub.h"
+
+extern "C"
+{
+#include "wallclock.h"
+}
+
+using std::vector;
+
+static T_WallClockCB wallClock;
+static const T_WallClockPolicy policy = { 600000, 5000 };
+static uint32_t requests;
+
+static void request(void)
+{
+   requests++;
+}
+
+static void respond(uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint32_t now)
+{
+   const uint8_t time[4] = { month, day, hour, minute };
+
+   WallClock_Response(&wallClock, time, now);
+}
+
+static int64_t wallTime(uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second)
+{
+   static const uint16_t daysBefore[12] = { 0, 31, 60, 91, 121, 152, 182, 213, 244, 274, 305, 335 };
+
+   return ((((int64_t)(daysBefore[month - 1] + day - 1) * 24 + hour) * 60 + minute) * 60 + second) * 1000;
+}
+
+TEST_GROUP(wallclockTests)
+{
+   void setup()
+   {
+      requests = 0;
+      WallClock_Init(&wallClock, &policy, request, 1000);
+   }
+
+   void teardown()
+   {
+   }
+};
+
+TEST(wallclockTests, initChecksArguments)
+{
+   static const T_WallClockPolicy noInterval = { 0, 5000 };
+   static const T_WallClockPolicy noTimeout = { 600000, 0 };
+
+   BYTES_EQUAL(WALLCLOCK_FAILURE, WallClock_Init(NULL, &policy, request, 0));
+   BYTES_EQUAL(WALLCLOCK_FAILURE, WallClock_Init(&wallClock, NULL, request, 0));
+   BYTES_EQUAL(WALLCLOCK_FAILURE, WallClock_Init(&wallClock, &policy, NULL, 0));
+   BYTES_EQUAL(WALLCLOCK_FAILURE, WallClock_Init(&wallClock, &noInterval, request, 0));
+   BYTES_EQUAL(WALLCLOCK_FAILURE, WallClock_Init(&wallClock, &noTimeout, request, 0));
+   BYTES_EQUAL(WALLCLOCK_SUCCESS, WallClock_Init(&wallClock, &policy, request, 0));
+}
+
+TEST(wallclockTests, notSyncedUntilTheFirstAnswer)
+{
+   int64_t time = -1;
+
+   BYTES_EQUAL(0, WallClock_Now(&wallClock, 1000, &time));
+   LONGS_EQUAL(-1, time);
+   LONGS_EQUAL(0, WallClock_TicksUntilDue(&wallClock, 1000));
+}
+
+TEST(wallclockTests, requestsWhenDueAndRetriesAfterTimeout)
+{
+   CHECK(WallClock_Poll(&wallClock, 1000));
+   LONGS_EQUAL(1, requests);
+   BYTES_EQUAL(0, WallClock_Poll(&wallClock, 5999));
+   LONGS_EQUAL(1, WallClock_TicksUntilDue(&wallClock, 5999));
+   CHECK(WallClock_Poll(&wallClock, 6000));
+   LONGS_EQUAL(2, requests);
+   LONGS_EQUAL(1, wallClock.stats.timeouts);
+
+   respond(3, 15, 10, 20, 6100);
+   // a little after the interval, on what should be the turn of a minute
+   LONGS_EQUAL(600000 + 29900, WallClock_TicksUntilDue(&wallClock, 6100));
+   BYTES_EQUAL(0, WallClock_Poll(&wallClock, 635999));
+   CHECK(WallClock_Poll(&wallClock, 636000));
+   LONGS_EQUAL(3, requests);
+}
+
+TEST(wallclockTests, oneAnswerGivesTheMinute)
+{
+   int64_t time;
+
+   WallClock_Poll(&wallClock, 1000);
+   respond(3, 15, 10, 20, 1200);
+   CHECK(WallClock_Now(&wallClock, 1200, &time));
+   // the middle of the minute, give or take the round trip
+   CHECK(time >= wallTime(3, 15, 10, 20, 0));
+   CHECK(time < wallTime(3, 15, 10, 21, 0));
+   LONGS_EQUAL(wallTime(3, 15, 10, 20, 30) + 100, time);
+   LONGS_EQUAL(30100, WallClock_Uncertainty(&wallClock));
+
+   CHECK(WallClock_Now(&wallClock, 1200 + 3600000, &time));
+   LONGS_EQUAL(wallTime(3, 15, 11, 20, 30) + 100, time);
+}
+
+TEST(wallclockTests, badDatesAndUnaskedAnswersAreIgnored)
+{
+   int64_t time;
+
+   respond(3, 15, 10, 20, 900);
+   LONGS_EQUAL(1, wallClock.stats.unexpected);
+
+   WallClock_Poll(&wallClock, 1000);
+   respond(2, 30, 10, 20, 1100);
+   LONGS_EQUAL(1, wallClock.stats.rejected);
+   WallClock_Poll(&wallClock, 6100);
+   respond(13, 1, 0, 0, 6200);
+   WallClock_Poll(&wallClock, 11200);
+   respond(1, 1, 24, 0, 11300);
+   WallClock_Poll(&wallClock, 16300);
+   respond(1, 1, 0, 60, 16400);
+   LONGS_EQUAL(4, wallClock.stats.rejected);
+   BYTES_EQUAL(0, WallClock_Now(&wallClock, 16400, &time));
+
+   WallClock_Poll(&wallClock, 21400);
+   respond(2, 29, 23, 59, 21500);
+   CHECK(WallClock_Now(&wallClock, 21500, &time));
+}
+
+// Answers from a hub whose clock is offset ticks on, 40 ticks up the link and
+// 40 back, until the clock has had count of them.
+static uint32_t exchange(int64_t offset, uint32_t now, uint16_t count)
+{
+   for (uint16_t n = 0; n < count; n++) {
+      T_WallDate date;
+
+      now += WallClock_TicksUntilDue(&wallClock, now);
+      WallClock_Poll(&wallClock, now);
+      WallClock_ToDate((now + 40 + offset) % WALLCLOCK_YEAR, &date);
+      now += 80;
+      respond(date.month, date.day, date.hour, date.minute, now);
+   }
+   return now;
+}
+
+TEST(wallclockTests, answersNarrowTheMinute)
+{
+   int64_t time;
+   // the hub's clock is 10:20:13.5 at tick 1000
+   const int64_t offset = wallTime(3, 15, 10, 20, 13) + 500 - 1000;
+   uint32_t now = exchange(offset, 1000, 2);
+
+   CHECK(WallClock_Uncertainty(&wallClock) > 10000);
+   now = exchange(offset, now, 40);
+   WallClock_Now(&wallClock, now, &time);
+   CHECK(llabs(time - (now + offset)) <= WallClock_Uncertainty(&wallClock));
+   CHECK(WallClock_Uncertainty(&wallClock) < 1000);
+   CHECK(abs(wallClock.driftPpb) < WALLCLOCK_WANDER_PPB);
+}
+
+TEST(wallclockTests, aStepOfTheHubClockStartsOver)
+{
+   int64_t time;
+   const int64_t offset = wallTime(3, 29, 1, 40, 0);
+   uint32_t now = exchange(offset, 1000, 10);
+
+   LONGS_EQUAL(0, wallClock.stats.steps);
+   CHECK(wallClock.markCount > 1);
+   // daylight saving: an hour on
+   now = exchange(offset + 3600000, now, 1);
+   LONGS_EQUAL(1, wallClock.stats.steps);
+   LONGS_EQUAL(1, wallClock.markCount);
+   WallClock_Now(&wallClock, now, &time);
+   CHECK(llabs(time - (now + offset + 3600000)) < 30100);
+}
+
+TEST(wallclockTests, newYear)
+{
+   int64_t time;
+   T_WallDate date;
+   uint32_t now = exchange(wallTime(12, 31, 22, 0, 0), 1000, 20);
+
+   LONGS_EQUAL(0, wallClock.stats.steps);
+   WallClock_Now(&wallClock, now, &time);
+   WallClock_ToDate(time, &date);
+   BYTES_EQUAL(1, date.month);
+   BYTES_EQUAL(1, date.day);
+   BYTES_EQUAL(1, date.hour);
+}
+
+TEST(wallclockTests, toDate)
+{
+   T_WallDate date;
+
+   WallClock_ToDate(wallTime(2, 29, 12, 34, 56) + 789, &date);
+   BYTES_EQUAL(2, date.month);
+   BYTES_EQUAL(29, date.day);
+   BYTES_EQUAL(12, date.hour);
+   BYTES_EQUAL(34, date.minute);
+   BYTES_EQUAL(56, date.second);
+   LONGS_EQUAL(789, date.millis);
+
+   WallClock_ToDate(wallTime(12, 31, 23, 59, 59) + 999, &date);
+   BYTES_EQUAL(12, date.month);
+   BYTES_EQUAL(31, date.day);
+   WallClock_ToDate(0, &date);
+   BYTES_EQUAL(1, date.month);
+   BYTES_EQUAL(1, date.day);
+}
+
+static uint8_t answered;
+static uint8_t answer[4];
+
+static void timeCallback(uint8_t dataType, unsigned char time[4])
+{
+   (void)dataType;
+   answered++;
+   for (uint8_t n = 0; n < 4; n++) {
+      answer[n] = time[n];
+   }
+}
+
+TEST(wallclockTests, answerFromTheHub)
+{
+   int64_t time;
+
+   FakeHub::reset();
+   ChillHub.setup("scale", "uuid", &FakeHub::serial);
+   answered = 0;
+   ChillHub.getTime((chillhubCallbackFunction)timeCallback);
+   FakeHub::queueMessage({ timeResponseMsgType, arrayDataType, 4, unsigned8DataType, 7, 4, 18, 5 });
+   FakeHub::pump();
+   BYTES_EQUAL(1, answered);
+
+   WallClock_Poll(&wallClock, 1000);
+   WallClock_Response(&wallClock, answer, 1050);
+   WallClock_Now(&wallClock, 1050, &time);
+   LONGS_EQUAL(wallTime(7, 4, 18, 5, 30) + 25, time);
+}
+
+/*
+ * Three days of the scale on the IMO, 0.8% fast and wandering by 0.05% with
+ * the temperature of the fridge over a day, across a New Year.  Each request
+ * takes 5 to 400 ms to reach the hub and as long to come back.  The clock is
+ * read every ten seconds and compared with the hub's, against asking the hub
+ * for each timestamp.
+ */
+static uint32_t lcg;
+
+static uint32_t nextRandom(void)
+{
+   lcg = lcg * 1664525u + 1013904223u;
+   return lcg >> 8;
+}
+
+static const double skew = 0.008;
+static const double wander = 0.0002;
+static const double tick0 = 4294967296.0 - 86400000.0;
+
+// Ticks at real time t in ms.
+static double ticksAt(double t)
+{
+   return tick0 + t * (1 + skew) + wander * 86400000.0 / (2 * M_PI) * (1 - cos(2 * M_PI * t / 86400000.0));
+}
+
+static uint32_t ticksNow(double t)
+{
+   return (uint32_t)fmod(floor(ticksAt(t)), 4294967296.0);
+}
+
+// Real time at which the ticks reach target, a tick count not wrapped.
+static double timeOfTicks(double target)
+{
+   double t = (target - tick0) / (1 + skew);
+
+   for (uint8_t n = 0; n < 4; n++) {
+      double rate = 1 + skew + wander * sin(2 * M_PI * t / 86400000.0);
+
+      t -= (ticksAt(t) - target) / rate;
+   }
+   return t;
+}
+
+static const int64_t hubStart = 364LL * WALLCLOCK_DAY + 7 * 3600000LL + 123456;
+static double inFlightUntil;
+static int64_t hubAnswer;
+static double simTime;
+
+static void simRequest(void)
+{
+   double up = 5 + nextRandom() % 395;
+   double down = 5 + nextRandom() % 395;
+
+   hubAnswer = hubStart + (int64_t)(simTime + up);
+   inFlightUntil = simTime + up + down;
+}
+
+static int64_t wrapped(int64_t error)
+{
+   error %= WALLCLOCK_YEAR;
+   if (error > WALLCLOCK_YEAR / 2) {
+      error -= WALLCLOCK_YEAR;
+   }
+   if (error < -WALLCLOCK_YEAR / 2) {
+      error += WALLCLOCK_YEAR;
+   }
+   return error;
+}
+
+static double percentile(vector<double> &v, double p)
+{
+   std::sort(v.begin(), v.end());
+   return v[(size_t)(p * (v.size() - 1))];
+}
+
+TEST(wallclockTests, skewedOscillatorOverALink)
+{
+   static const uint32_t intervals[] = { 60000, 300000, 900000, 3600000, 14400000 };
+   const double end = 3 * 86400000.0;
+   const double firstRead = 6 * 3600000.0;
+
+   for (uint8_t i = 0; i < sizeof(intervals) / sizeof(intervals[0]); i++) {
+      T_WallClockPolicy simPolicy = { intervals[i], 5000 };
+      vector<double> errors;
+      double nextRead = firstRead;
+      uint32_t steps;
+
+      lcg = 1357;
+      simTime = 0;
+      inFlightUntil = -1;
+      WallClock_Init(&wallClock, &simPolicy, simRequest, ticksNow(0));
+      while (simTime < end) {
+         uint32_t now = ticksNow(simTime);
+         double next;
+
+         if ((inFlightUntil >= 0) && (simTime >= inFlightUntil)) {
+            T_WallDate date;
+            uint8_t time[4];
+
+            WallClock_ToDate(hubAnswer % WALLCLOCK_YEAR, &date);
+            time[0] = date.month;
+            time[1] = date.day;
+            time[2] = date.hour;
+            time[3] = date.minute;
+            inFlightUntil = -1;
+            WallClock_Response(&wallClock, time, now);
+         }
+         WallClock_Poll(&wallClock, now);
+         if (simTime >= nextRead) {
+            int64_t time;
+
+            CHECK(WallClock_Now(&wallClock, now, &time));
+            errors.push_back(fabs((double)wrapped(time - (hubStart + (int64_t)simTime))));
+            nextRead += 10000;
+         }
+
+         next = timeOfTicks(ticksAt(simTime) + WallClock_TicksUntilDue(&wallClock, now) + 1);
+         if ((inFlightUntil >= 0) && (inFlightUntil < next)) {
+            next = inFlightUntil;
+         }
+         if (nextRead < next) {
+            next = nextRead;
+         }
+         simTime = (next > simTime) ? next : simTime + 1;
+      }
+      steps = wallClock.stats.steps;
+
+      printf("\nwallclock, sync every %5.0f s: %4u requests, error median %6.0f ms, p95 %6.0f ms, max %6.0f ms, "
+             "drift %+.0f ppm against %+.0f to %+.0f",
+             intervals[i] / 1000.0, wallClock.stats.requests, percentile(errors, 0.5), percentile(errors, 0.95),
+             percentile(errors, 1), wallClock.driftPpb / 1000.0, -(skew + wander) * 1e6, -(skew - wander) * 1e6);
+      LONGS_EQUAL(0, steps);
+      if (intervals[i] <= 900000) {
+         CHECK(percentile(errors, 0.95) < 1000);
+      }
+   }
+
+   // one round trip per timestamp: the minute the hub answers with
+   {
+      vector<double> errors;
+
+      lcg = 1357;
+      for (uint32_t n = 0; n < 10000; n++) {
+         double t = n * 10000.0 + nextRandom() % 10000;
+         double up = 5 + nextRandom() % 395;
+         double down = 5 + nextRandom() % 395;
+         int64_t hub = hubStart + (int64_t)(t + up);
+         int64_t answer = hub - hub % WALLCLOCK_MINUTE;
+
+         errors.push_back(fabs((double)(answer - (hubStart + (int64_t)(t + up + down)))));
+      }
+      printf("\nwallclock, a round trip per timestamp: error median %6.0f ms, p95 %6.0f ms, max %6.0f ms",
+             percentile(errors, 0.5), percentile(errors, 0.95), percentile(errors, 1));
+   }
+   printf("\n");
+}
@@ -0,0 +1,181 @@
+/*
+ * Tickless time base bookkeeping for the idle loop.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "tickless.h"
+#include <stdlib.h>
+
+uint8_t Tickless_Init(T_TicklessCB *pControlBlock, uint32_t countsPerTick, uint32_t counterMax) {
+   if (pControlBlock == NULL) {
+      return TICKLESS_INIT_FAILURE;
+   }
+   if (countsPerTick <= TICKLESS_GUARD_COUNTS) {
+      return TICKLESS_INIT_FAILURE;
+   }
+   if (counterMax < countsPerTick - 1) {
+      return TICKLESS_INIT_FAILURE;
+   }
+
+   pControlBlock->countsPerTick = countsPerTick;
+   pControlBlock->maxTicksPerPeriod = (counterMax / countsPerTick);
+   if (((counterMax % countsPerTick) + 1) == countsPerTick) {
+      pControlBlock->maxTicksPerPeriod++;
+   }
+   pControlBlock->periodStartTicks = 0;
+   pControlBlock->ticksPerPeriod = 1;
+   pControlBlock->ticks = 0;
+   pControlBlock->terminalCounts = 0;
+   pControlBlock->earlyWakeups = 0;
+
+   return TICKLESS_INIT_SUCCESS;
+}
+
+// Wrap-safe distance to a deadline, zero once it has passed.
+uint32_t Tickless_TicksUntil(uint32_t now, uint32_t deadline) {
+   int32_t diff = (int32_t)(deadline - now);
+
+   if (diff <= 0) {
+      return 0;
+   }
+
+   return (uint32_t)diff;
+}
+
+// Stretch the current one-tick period so it terminates at the deadline.  Only
+// valid while the counter is in its normal one-tick period.
+uint32_t Tickless_PlanSleep(T_TicklessCB *pControlBlock, uint32_t deadline) {
+   uint32_t sleepTicks;
+
+   if (pControlBlock == NULL) {
+      return TICKLESS_NO_CHANGE;
+   }
+   if (pControlBlock->ticksPerPeriod != 1) {
+      return TICKLESS_NO_CHANGE;
+   }
+
+   sleepTicks = Tickless_TicksUntil(pControlBlock->periodStartTicks, deadline);
+   if (sleepTicks < 2) {
+      // the next regular tick comes first anyway
+      return TICKLESS_NO_CHANGE;
+   }
+   if (sleepTicks > pControlBlock->maxTicksPerPeriod) {
+      sleepTicks = pControlBlock->maxTicksPerPeriod;
+   }
+
+   pControlBlock->ticksPerPeriod = sleepTicks;
+
+   return (sleepTicks * pControlBlock->countsPerTick) - 1;
+}
+
+// Undo a planned sleep whose period write raced with a one-tick terminal count.
+uint32_t Tickless_CancelSleep(T_TicklessCB *pControlBlock) {
+   if (pControlBlock == NULL) {
+      return TICKLESS_NO_CHANGE;
+   }
+
+   pControlBlock->ticksPerPeriod = 1;
+
+   return pControlBlock->countsPerTick - 1;
+}
+
+// Called from the time base interrupt each time the counter wraps.
+uint32_t Tickless_TerminalCount(T_TicklessCB *pControlBlock) {
+   if (pControlBlock == NULL) {
+      return TICKLESS_NO_CHANGE;
+   }
+
+   pControlBlock->periodStartTicks += pControlBlock->ticksPerPeriod;
+   pControlBlock->ticks = pControlBlock->periodStartTicks;
+   pControlBlock->terminalCounts++;
+
+   if (pControlBlock->ticksPerPeriod != 1) {
+      pControlBlock->ticksPerPeriod = 1;
+      return pControlBlock->countsPerTick - 1;
+   }
+
+   return TICKLESS_NO_CHANGE;
+}
+
+// Called after something other than the time base woke the core in the middle
+// of a stretched period.  Catches the tick count up with the counter and cuts
+// the period short at the next tick boundary so regular ticking resumes.
+uint32_t Tickless_EarlyWake(T_TicklessCB *pControlBlock, uint32_t counter) {
+   uint32_t periodEnd;
+   uint32_t wholeTicks;
+   uint32_t nextBoundary;
+
+   if (pControlBlock == NULL) {
+      return TICKLESS_NO_CHANGE;
+   }
+   if (pControlBlock->ticksPerPeriod == 1) {
+      return TICKLESS_NO_CHANGE;
+   }
+
+   pControlBlock->earlyWakeups++;
+
+   periodEnd = (pControlBlock->ticksPerPeriod * pControlBlock->countsPerTick) - 1;
+   if ((counter > periodEnd) || ((periodEnd - counter) < TICKLESS_GUARD_COUNTS)) {
+      // the terminal count is about to fire, let it do the work
+      return TICKLESS_NO_CHANGE;
+   }
+
+   wholeTicks = counter / pControlBlock->countsPerTick;
+   nextBoundary = wholeTicks + 1;
+   if ((((nextBoundary * pControlBlock->countsPerTick) - 1) - counter) < TICKLESS_GUARD_COUNTS) {
+      nextBoundary++;
+   }
+
+   pControlBlock->ticks = pControlBlock->periodStartTicks + wholeTicks;
+   pControlBlock->ticksPerPeriod = nextBoundary;
+
+   return (nextBoundary * pControlBlock->countsPerTick) - 1;
+}
+
+// Current tick count derived from the running counter, for readers that can
+// not wait for the next terminal count.
+uint32_t Tickless_Now(const T_TicklessCB *pControlBlock, uint32_t counter) {
+   if (pControlBlock == NULL) {
+      return 0;
+   }
+
+   return pControlBlock->periodStartTicks + (counter / pControlBlock->countsPerTick);
+}
+
+// Microsecond time stamp from the running counter.  wrapPending is set when
+// the counter has already wrapped but the terminal count interrupt has not
+// run yet, so the period it just finished is not yet in periodStartTicks.
+// Wraps every 71 minutes; use differences.
+uint32_t Tickless_Micros(const T_TicklessCB *pControlBlock, uint32_t counter, uint8_t wrapPending) {
+   uint32_t startTicks;
+
+   if (pControlBlock == NULL) {
+      return 0;
+   }
+
+   startTicks = pControlBlock->periodStartTicks;
+   if (wrapPending) {
+      startTicks += pControlBlock->ticksPerPeriod;
+   }
+
+   return (startTicks * 1000) + ((counter * 1000) / pControlBlock->countsPerTick);
+}
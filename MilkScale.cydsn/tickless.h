@@ -0,0 +1,71 @@
+/*
+ * Tickless time base bookkeeping for the idle loop.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * The time base counter normally terminates once per millisecond tick.  When
+ * the main loop has nothing to do, the period is stretched so the next
+ * terminal count lands on the earliest deadline, and the core sleeps until
+ * then or until another interrupt (UART, ADC) wakes it.  These functions only
+ * do the arithmetic; the caller owns the counter hardware and programs the
+ * period values they return.
+ *
+ * Invariant: the counter restarted at zero exactly at tick periodStartTicks,
+ * so the current time is periodStartTicks + counter / countsPerTick.
+ */
+
+#ifndef TICKLESS_H
+#define TICKLESS_H
+
+#include <stdint.h>
+
+typedef struct T_TicklessCB {
+   uint32_t countsPerTick;
+   uint32_t maxTicksPerPeriod;
+   uint32_t periodStartTicks;
+   uint32_t ticksPerPeriod;
+   uint32_t ticks;
+   uint32_t terminalCounts;
+   uint32_t earlyWakeups;
+} T_TicklessCB;
+
+#define TICKLESS_INIT_FAILURE 0
+#define TICKLESS_INIT_SUCCESS 1
+
+// Returned instead of a period value when the counter must not be touched.
+#define TICKLESS_NO_CHANGE 0xffffffffUL
+
+// Counts left between an early wake and the end of the period below which
+// the period is not rewritten, so a write can never land behind the counter.
+#define TICKLESS_GUARD_COUNTS 8
+
+uint8_t Tickless_Init(T_TicklessCB *pControlBlock, uint32_t countsPerTick, uint32_t counterMax);
+uint32_t Tickless_TicksUntil(uint32_t now, uint32_t deadline);
+uint32_t Tickless_PlanSleep(T_TicklessCB *pControlBlock, uint32_t deadline);
+uint32_t Tickless_CancelSleep(T_TicklessCB *pControlBlock);
+uint32_t Tickless_TerminalCount(T_TicklessCB *pControlBlock);
+uint32_t Tickless_EarlyWake(T_TicklessCB *pControlBlock, uint32_t counter);
+uint32_t Tickless_Now(const T_TicklessCB *pControlBlock, uint32_t counter);
+uint32_t Tickless_Micros(const T_TicklessCB *pControlBlock, uint32_t counter, uint8_t wrapPending);
+
+#endif
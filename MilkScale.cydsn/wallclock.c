@@ -0,0 +1,291 @@
+/*
+ * Wall clock kept from the ticks and synced from the hub.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "wallclock.h"
+#include <stdlib.h>
+
+#ifndef FALSE
+#define FALSE 0
+#define TRUE !FALSE
+#endif
+
+#define PPB 1000000000LL
+
+// Days before each month and in each month, with a 29th of February.
+static const uint16_t daysBefore[12] = { 0, 31, 60, 91, 121, 152, 182, 213, 244, 274, 305, 335 };
+static const uint8_t daysIn[12] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+uint8_t WallClock_Init(T_WallClockCB *pControlBlock, const T_WallClockPolicy *pPolicy, void (*request)(void),
+                       uint32_t now) {
+   if ((pControlBlock == NULL) || (pPolicy == NULL) || (request == NULL)) {
+      return WALLCLOCK_FAILURE;
+   }
+   if ((pPolicy->syncInterval == 0) || (pPolicy->timeout == 0)) {
+      return WALLCLOCK_FAILURE;
+   }
+
+   pControlBlock->pPolicy = pPolicy;
+   pControlBlock->request = request;
+   pControlBlock->pending = FALSE;
+   pControlBlock->synced = FALSE;
+   pControlBlock->dueTicks = now;
+   pControlBlock->roundTrip = 0;
+   pControlBlock->driftPpb = 0;
+   pControlBlock->driftErrorPpb = WALLCLOCK_MAX_SKEW_PPB;
+   pControlBlock->markCount = 0;
+   pControlBlock->firstMark = 0;
+   pControlBlock->stats.requests = 0;
+   pControlBlock->stats.responses = 0;
+   pControlBlock->stats.timeouts = 0;
+   pControlBlock->stats.rejected = 0;
+   pControlBlock->stats.unexpected = 0;
+   pControlBlock->stats.steps = 0;
+
+   return WALLCLOCK_SUCCESS;
+}
+
+uint8_t WallClock_Poll(T_WallClockCB *pControlBlock, uint32_t now) {
+   if (pControlBlock->pending) {
+      if ((now - pControlBlock->sentTicks) < pControlBlock->pPolicy->timeout) {
+         return FALSE;
+      }
+      // a lost request is tried again straight away
+      pControlBlock->pending = FALSE;
+      pControlBlock->stats.timeouts++;
+   } else if ((int32_t)(now - pControlBlock->dueTicks) < 0) {
+      return FALSE;
+   }
+
+   pControlBlock->pending = TRUE;
+   pControlBlock->sentTicks = now;
+   pControlBlock->stats.requests++;
+   pControlBlock->request();
+
+   return TRUE;
+}
+
+// The start of the minute the hub sent, or -1 if it is not a date.
+static int64_t minuteStart(const uint8_t *pTime) {
+   uint8_t month = pTime[0];
+   uint8_t day = pTime[1];
+   uint8_t hour = pTime[2];
+   uint8_t minute = pTime[3];
+
+   if ((month < 1) || (month > 12) || (day < 1) || (day > daysIn[month - 1]) || (hour > 23) || (minute > 59)) {
+      return -1;
+   }
+   return (int64_t)(daysBefore[month - 1] + day - 1) * WALLCLOCK_DAY + ((int32_t)hour * 60 + minute) * WALLCLOCK_MINUTE;
+}
+
+// The drift of the ticks over elapsed ticks, rounded.
+static int64_t drifted(int64_t elapsed, int32_t driftPpb) {
+   int64_t product = elapsed * driftPpb;
+
+   return (product + ((product < 0) ? -PPB / 2 : PPB / 2)) / PPB;
+}
+
+// The wall time at now, not wrapped at the end of the year.
+static int64_t wallTime(const T_WallClockCB *pControlBlock, uint32_t now) {
+   int64_t elapsed = now - pControlBlock->baseTicks;
+   int64_t middle = pControlBlock->earliest + (pControlBlock->latest - pControlBlock->earliest) / 2;
+
+   return middle + elapsed + drifted(elapsed, pControlBlock->driftPpb);
+}
+
+/*
+ * Leaves a mark every WALLCLOCK_MARK_SPACING ticks and measures the drift
+ * against the mark that pins it down best, when that is better than the
+ * WALLCLOCK_MAX_SKEW_PPB the clock starts with.
+ */
+static void measureDrift(T_WallClockCB *pControlBlock) {
+   int64_t middle = pControlBlock->earliest + (pControlBlock->latest - pControlBlock->earliest) / 2;
+   uint32_t uncertainty = (uint32_t)((pControlBlock->latest - pControlBlock->earliest) / 2);
+   int64_t bestError = (int64_t)WALLCLOCK_MAX_SKEW_PPB - WALLCLOCK_WANDER_PPB;
+   const T_WallClockMark *pBest = NULL;
+   uint8_t n;
+
+   for (n = 0; n < pControlBlock->markCount; n++) {
+      const T_WallClockMark *pMark = &pControlBlock->marks[(pControlBlock->firstMark + n) % WALLCLOCK_MARKS];
+      int64_t elapsed = pControlBlock->baseTicks - pMark->ticks;
+      int64_t error;
+
+      if (elapsed == 0) {
+         continue;
+      }
+      error = ((int64_t)uncertainty + pMark->uncertainty) * PPB / elapsed;
+      if (error < bestError) {
+         bestError = error;
+         pBest = pMark;
+      }
+   }
+   if (pBest != NULL) {
+      int64_t elapsed = pControlBlock->baseTicks - pBest->ticks;
+
+      pControlBlock->driftPpb = (int32_t)((middle - pBest->time - elapsed) * PPB / elapsed);
+      pControlBlock->driftErrorPpb = (int32_t)bestError + WALLCLOCK_WANDER_PPB;
+   }
+
+   if ((pControlBlock->markCount == 0) ||
+       ((pControlBlock->baseTicks -
+         pControlBlock->marks[(pControlBlock->firstMark + pControlBlock->markCount - 1) % WALLCLOCK_MARKS].ticks) >=
+        WALLCLOCK_MARK_SPACING)) {
+      T_WallClockMark *pMark;
+
+      if (pControlBlock->markCount == WALLCLOCK_MARKS) {
+         pControlBlock->firstMark = (pControlBlock->firstMark + 1) % WALLCLOCK_MARKS;
+         pControlBlock->markCount--;
+      }
+      pMark = &pControlBlock->marks[(pControlBlock->firstMark + pControlBlock->markCount) % WALLCLOCK_MARKS];
+      pMark->time = middle;
+      pMark->ticks = pControlBlock->baseTicks;
+      pMark->uncertainty = uncertainty;
+      pControlBlock->markCount++;
+   }
+}
+
+// Cuts the bounds down to the minute the hub answered with at now.
+static void update(T_WallClockCB *pControlBlock, int64_t start, uint32_t now) {
+   int64_t roundTrip = now - pControlBlock->sentTicks;
+   int64_t earliest = start;
+   int64_t latest = start + WALLCLOCK_MINUTE + roundTrip + drifted(roundTrip, pControlBlock->driftPpb) + 1;
+
+   if (pControlBlock->synced) {
+      int64_t elapsed = now - pControlBlock->baseTicks;
+      int64_t carried = elapsed + drifted(elapsed, pControlBlock->driftPpb);
+      int64_t spread = drifted(elapsed, pControlBlock->driftErrorPpb) + 1;
+
+      if (((pControlBlock->earliest + carried - spread) >= latest) ||
+          ((pControlBlock->latest + carried + spread) <= earliest)) {
+         // the hub's clock stepped
+         pControlBlock->markCount = 0;
+         pControlBlock->stats.steps++;
+      } else {
+         if ((pControlBlock->earliest + carried - spread) > earliest) {
+            earliest = pControlBlock->earliest + carried - spread;
+         }
+         if ((pControlBlock->latest + carried + spread) < latest) {
+            latest = pControlBlock->latest + carried + spread;
+         }
+      }
+   }
+
+   pControlBlock->baseTicks = now;
+   pControlBlock->earliest = earliest;
+   pControlBlock->latest = latest;
+   pControlBlock->synced = TRUE;
+   measureDrift(pControlBlock);
+}
+
+/*
+ * Aims the next request, syncInterval ticks on, so that the hub should read
+ * its clock half a round trip later on the turn of a minute.  Whichever
+ * minute it answers with then cuts the bounds about in half.
+ */
+static void scheduleNext(T_WallClockCB *pControlBlock, uint32_t now) {
+   uint32_t due = now + pControlBlock->pPolicy->syncInterval;
+   int64_t reading = wallTime(pControlBlock, due) + pControlBlock->roundTrip / 2;
+   int64_t toTurn = WALLCLOCK_MINUTE - ((reading % WALLCLOCK_MINUTE) + WALLCLOCK_MINUTE) % WALLCLOCK_MINUTE;
+
+   pControlBlock->dueTicks = due + (uint32_t)(toTurn - drifted(toTurn, pControlBlock->driftPpb));
+}
+
+void WallClock_Response(T_WallClockCB *pControlBlock, const uint8_t *pTime, uint32_t now) {
+   int64_t start;
+
+   if (!pControlBlock->pending) {
+      pControlBlock->stats.unexpected++;
+      return;
+   }
+   pControlBlock->pending = FALSE;
+
+   start = minuteStart(pTime);
+   if (start < 0) {
+      pControlBlock->stats.rejected++;
+      pControlBlock->dueTicks = now + pControlBlock->pPolicy->timeout;
+      return;
+   }
+   if (pControlBlock->synced) {
+      // keep counting past the end of the year
+      int64_t expected = wallTime(pControlBlock, now);
+
+      while (start < (expected - WALLCLOCK_YEAR / 2)) {
+         start += WALLCLOCK_YEAR;
+      }
+      while (start > (expected + WALLCLOCK_YEAR / 2)) {
+         start -= WALLCLOCK_YEAR;
+      }
+   }
+
+   update(pControlBlock, start, now);
+   pControlBlock->roundTrip = now - pControlBlock->sentTicks;
+   pControlBlock->stats.responses++;
+   scheduleNext(pControlBlock, now);
+}
+
+// O(1) and without the hub: the wall time, wrapped at the end of the year.
+uint8_t WallClock_Now(const T_WallClockCB *pControlBlock, uint32_t now, int64_t *pTime) {
+   int64_t time;
+
+   if (!pControlBlock->synced) {
+      return FALSE;
+   }
+
+   time = wallTime(pControlBlock, now) % WALLCLOCK_YEAR;
+   if (time < 0) {
+      time += WALLCLOCK_YEAR;
+   }
+   *pTime = time;
+   return TRUE;
+}
+
+// How far the wall time may be off at the last answer, in milliseconds.
+uint32_t WallClock_Uncertainty(const T_WallClockCB *pControlBlock) {
+   return (uint32_t)((pControlBlock->latest - pControlBlock->earliest) / 2);
+}
+
+void WallClock_ToDate(int64_t time, T_WallDate *pDate) {
+   uint16_t day = (uint16_t)(time / WALLCLOCK_DAY);
+   uint32_t millis = (uint32_t)(time % WALLCLOCK_DAY);
+   uint8_t month = 11;
+
+   while (daysBefore[month] > day) {
+      month--;
+   }
+   pDate->month = month + 1;
+   pDate->day = (uint8_t)(day - daysBefore[month] + 1);
+   pDate->hour = (uint8_t)(millis / 3600000UL);
+   pDate->minute = (uint8_t)(millis / 60000UL % 60);
+   pDate->second = (uint8_t)(millis / 1000 % 60);
+   pDate->millis = (uint16_t)(millis % 1000);
+}
+
+uint32_t WallClock_TicksUntilDue(const T_WallClockCB *pControlBlock, uint32_t now) {
+   uint32_t due = pControlBlock->pending ? (pControlBlock->sentTicks + pControlBlock->pPolicy->timeout)
+                                         : pControlBlock->dueTicks;
+
+   if ((int32_t)(due - now) <= 0) {
+      return 0;
+   }
+   return due - now;
+}
@@ -0,0 +1,135 @@
+/*
+ * Wall clock kept from the ticks and synced from the hub.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * The hub answers getTime with its local month, day, hour and minute.
+ * WallClock_Poll sends getTime every syncInterval ticks and
+ * WallClock_Response takes the answer; in between WallClock_Now reads the
+ * wall clock from the ticks alone.
+ *
+ * An answer only says that the hub's clock was somewhere in that minute at
+ * some tick between the request and the response, so at the response the
+ * wall time is between the start of the minute and its end plus the round
+ * trip.  The clock keeps the earliest and the latest wall time it can be at
+ * the last response.  They are carried to the next response with the drift
+ * of the ticks and move apart by how far the drift may be off; the bounds of
+ * the new answer then cut them down.  The middle of the two is the wall
+ * time, which splits the round trip in half.  Each request is sent a little
+ * after syncInterval, so that the hub reads its clock on what the clock
+ * takes for the turn of a minute; either answer then halves the bounds and
+ * they close in to about the round trip.
+ *
+ * The drift is measured against marks of the wall time left every
+ * WALLCLOCK_MARK_SPACING ticks, from the one that pins it down best.  It may
+ * then be off by that much plus WALLCLOCK_WANDER_PPB for the temperature;
+ * until the first measurement it is taken as 0 give or take
+ * WALLCLOCK_MAX_SKEW_PPB.
+ *
+ * An answer outside the bounds is a step of the hub's clock (daylight
+ * saving, the end of February, someone setting it): the clock starts over
+ * from it and drops its marks, but keeps the drift.
+ *
+ * Wall time is in milliseconds from midnight on the 1st of January, in a
+ * year of 366 days since the hub does not send the year.  Ticks are the
+ * millisecond ticks of the main loop and may wrap.
+ */
+
+#ifndef WALLCLOCK_H
+#define WALLCLOCK_H
+
+#include <stdint.h>
+
+#define WALLCLOCK_MARKS 8
+#define WALLCLOCK_MARK_SPACING 3600000UL
+
+// The widest drift of the ticks, the 2% of the IMO, and how far it wanders
+// with the temperature in the fridge.
+#define WALLCLOCK_MAX_SKEW_PPB 20000000L
+#define WALLCLOCK_WANDER_PPB 500000L
+
+#define WALLCLOCK_MINUTE 60000L
+#define WALLCLOCK_DAY (24L * 60 * WALLCLOCK_MINUTE)
+#define WALLCLOCK_YEAR (366LL * WALLCLOCK_DAY)
+
+typedef struct T_WallClockPolicy {
+   uint32_t syncInterval;
+   uint32_t timeout;
+} T_WallClockPolicy;
+
+typedef struct T_WallDate {
+   uint8_t month;
+   uint8_t day;
+   uint8_t hour;
+   uint8_t minute;
+   uint8_t second;
+   uint16_t millis;
+} T_WallDate;
+
+typedef struct T_WallClockMark {
+   int64_t time;
+   uint32_t ticks;
+   uint32_t uncertainty;
+} T_WallClockMark;
+
+typedef struct T_WallClockStats {
+   uint32_t requests;
+   uint32_t responses;
+   uint32_t timeouts;
+   uint32_t rejected;
+   uint32_t unexpected;
+   uint32_t steps;
+} T_WallClockStats;
+
+typedef struct T_WallClockCB {
+   const T_WallClockPolicy *pPolicy;
+   void (*request)(void);
+   uint8_t pending;
+   uint8_t synced;
+   uint32_t sentTicks;
+   uint32_t dueTicks;
+   uint32_t roundTrip;
+   uint32_t baseTicks;
+   int64_t earliest;
+   int64_t latest;
+   int32_t driftPpb;
+   int32_t driftErrorPpb;
+   T_WallClockMark marks[WALLCLOCK_MARKS];
+   uint8_t firstMark;
+   uint8_t markCount;
+   T_WallClockStats stats;
+} T_WallClockCB;
+
+#define WALLCLOCK_FAILURE 0
+#define WALLCLOCK_SUCCESS 1
+
+uint8_t WallClock_Init(T_WallClockCB *pControlBlock, const T_WallClockPolicy *pPolicy, void (*request)(void),
+                       uint32_t now);
+uint8_t WallClock_Poll(T_WallClockCB *pControlBlock, uint32_t now);
+void WallClock_Response(T_WallClockCB *pControlBlock, const uint8_t *pTime, uint32_t now);
+uint8_t WallClock_Now(const T_WallClockCB *pControlBlock, uint32_t now, int64_t *pTime);
+uint32_t WallClock_Uncertainty(const T_WallClockCB *pControlBlock);
+void WallClock_ToDate(int64_t time, T_WallDate *pDate);
+uint32_t WallClock_TicksUntilDue(const T_WallClockCB *pControlBlock, uint32_t now);
+
+#endif
@@ -0,0 +1,223 @@
+/*
+ * Host emulation of the PSoC 4 UART bootloader command set.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "btldr_packet.h"
+#include "btldr_emu.h"
+#include "cyacd.h"
+
+#define BTLDR_VERSION_LO 0x1e
+#define BTLDR_VERSION_HI 0x01
+
+// Basic summation checksum: two's complement of the 16 bit sum.
+uint16_t BtldrEmu_PacketChecksum(const uint8_t *pData, uint16_t length)
+{
+   uint16_t sum = 0;
+   uint16_t i;
+
+   for (i = 0; i < length; i++) {
+      sum += pData[i];
+   }
+   return (uint16_t)(1 + ~sum);
+}
+
+// Frame a command or a response, returns the packet length.
+uint16_t BtldrEmu_Packet(uint8_t code, const uint8_t *pData, uint16_t length, uint8_t *pOut)
+{
+   uint16_t checksum;
+
+   pOut[0] = BTLDR_PACKET_SOP;
+   pOut[1] = code;
+   pOut[2] = (uint8_t)length;
+   pOut[3] = (uint8_t)(length >> 8);
+   if (length > 0) {
+      memcpy(&pOut[4], pData, length);
+   }
+   checksum = BtldrEmu_PacketChecksum(pOut, (uint16_t)(4 + length));
+   pOut[4 + length] = (uint8_t)checksum;
+   pOut[5 + length] = (uint8_t)(checksum >> 8);
+   pOut[6 + length] = BTLDR_PACKET_EOP;
+
+   return (uint16_t)(length + BTLDR_PACKET_OVERHEAD);
+}
+
+uint8_t BtldrEmu_Init(T_BtldrEmu *pControlBlock, uint32_t siliconId, uint8_t siliconRev,
+                      uint16_t firstRow, uint16_t rowCount, uint16_t rowSize)
+{
+   if (NULL == pControlBlock || rowSize == 0 || rowSize > BTLDR_EMU_MAX_ROW_SIZE ||
+       (uint32_t)firstRow + rowCount > BTLDR_EMU_MAX_ROWS) {
+      return BTLDR_EMU_INIT_FAILURE;
+   }
+
+   memset(pControlBlock, 0, sizeof(*pControlBlock));
+   pControlBlock->siliconId = siliconId;
+   pControlBlock->siliconRev = siliconRev;
+   pControlBlock->firstRow = firstRow;
+   pControlBlock->rowCount = rowCount;
+   pControlBlock->rowSize = rowSize;
+   pControlBlock->commandUs = BTLDR_EMU_COMMAND_US;
+   pControlBlock->rowWriteUs = BTLDR_EMU_ROW_WRITE_US;
+
+   return BTLDR_EMU_INIT_SUCCESS;
+}
+
+// Check the array and row of a row command, returns a status code.
+static uint8_t checkRow(const T_BtldrEmu *pControlBlock, const uint8_t *pData, uint16_t length, uint16_t *pRow)
+{
+   if (length < 3) {
+      return BTLDR_ERR_LENGTH;
+   }
+   if (pData[0] != 0) {
+      return BTLDR_ERR_ARRAY;
+   }
+   *pRow = (uint16_t)(pData[1] | (pData[2] << 8));
+   if (*pRow < pControlBlock->firstRow || *pRow >= pControlBlock->firstRow + pControlBlock->rowCount) {
+      return BTLDR_ERR_ROW;
+   }
+   return BTLDR_SUCCESS;
+}
+
+/*
+ * Execute one packet.  Fills pResponse and returns its length, or 0 when the
+ * bootloader sends nothing back (exit).
+ */
+uint16_t BtldrEmu_Command(T_BtldrEmu *pControlBlock, const uint8_t *pPacket, uint16_t length, uint8_t *pResponse)
+{
+   uint8_t reply[16];
+   uint16_t replyLength = 0;
+   uint8_t status = BTLDR_SUCCESS;
+   uint16_t packetLength = 0;
+   uint16_t dataLength;
+   const uint8_t *pData;
+   uint16_t row;
+
+   pControlBlock->busyUs = pControlBlock->commandUs;
+
+   if (BtldrPacket_Check(pPacket, length, BTLDR_EMU_MAX_PACKET, &packetLength) != BTLDR_PACKET_COMPLETE ||
+       packetLength != length) {
+      status = BTLDR_ERR_LENGTH;
+   } else if (BtldrEmu_PacketChecksum(pPacket, (uint16_t)(length - 3)) !=
+              (uint16_t)(pPacket[length - 3] | (pPacket[length - 2] << 8))) {
+      status = BTLDR_ERR_CHECKSUM;
+   } else if (!pControlBlock->active && pPacket[1] != BTLDR_CMD_ENTER) {
+      status = BTLDR_ERR_ACTIVE;
+   }
+   if (status != BTLDR_SUCCESS) {
+      pControlBlock->errors++;
+      return BtldrEmu_Packet(status, NULL, 0, pResponse);
+   }
+
+   dataLength = (uint16_t)(length - BTLDR_PACKET_OVERHEAD);
+   pData = &pPacket[4];
+
+   switch (pPacket[1]) {
+      case BTLDR_CMD_ENTER:
+         pControlBlock->active = 1;
+         pControlBlock->bufferCount = 0;
+         reply[0] = (uint8_t)pControlBlock->siliconId;
+         reply[1] = (uint8_t)(pControlBlock->siliconId >> 8);
+         reply[2] = (uint8_t)(pControlBlock->siliconId >> 16);
+         reply[3] = (uint8_t)(pControlBlock->siliconId >> 24);
+         reply[4] = pControlBlock->siliconRev;
+         reply[5] = BTLDR_VERSION_LO;
+         reply[6] = BTLDR_VERSION_HI;
+         reply[7] = 0;
+         replyLength = 8;
+         break;
+
+      case BTLDR_CMD_GET_FLASH_SIZE:
+         if (dataLength != 1 || pData[0] != 0) {
+            status = BTLDR_ERR_ARRAY;
+            break;
+         }
+         row = (uint16_t)(pControlBlock->firstRow + pControlBlock->rowCount - 1);
+         reply[0] = (uint8_t)pControlBlock->firstRow;
+         reply[1] = (uint8_t)(pControlBlock->firstRow >> 8);
+         reply[2] = (uint8_t)row;
+         reply[3] = (uint8_t)(row >> 8);
+         replyLength = 4;
+         break;
+
+      case BTLDR_CMD_SEND_DATA:
+         if (pControlBlock->bufferCount + dataLength > pControlBlock->rowSize) {
+            pControlBlock->bufferCount = 0;
+            status = BTLDR_ERR_LENGTH;
+            break;
+         }
+         memcpy(&pControlBlock->buffer[pControlBlock->bufferCount], pData, dataLength);
+         pControlBlock->bufferCount += dataLength;
+         break;
+
+      case BTLDR_CMD_PROGRAM_ROW:
+         status = checkRow(pControlBlock, pData, dataLength, &row);
+         if (status == BTLDR_SUCCESS && pControlBlock->bufferCount + dataLength - 3 != pControlBlock->rowSize) {
+            status = BTLDR_ERR_LENGTH;
+         }
+         if (status == BTLDR_SUCCESS) {
+            memcpy(&pControlBlock->buffer[pControlBlock->bufferCount], &pData[3], dataLength - 3);
+            memcpy(pControlBlock->flash[row], pControlBlock->buffer, pControlBlock->rowSize);
+            pControlBlock->rowsWritten++;
+            pControlBlock->busyUs += pControlBlock->rowWriteUs;
+         }
+         pControlBlock->bufferCount = 0;
+         break;
+
+      case BTLDR_CMD_ERASE_ROW:
+         status = checkRow(pControlBlock, pData, dataLength, &row);
+         if (status == BTLDR_SUCCESS) {
+            memset(pControlBlock->flash[row], 0, pControlBlock->rowSize);
+            pControlBlock->rowsWritten++;
+            pControlBlock->busyUs += pControlBlock->rowWriteUs;
+         }
+         break;
+
+      case BTLDR_CMD_VERIFY_ROW:
+         status = checkRow(pControlBlock, pData, dataLength, &row);
+         if (status == BTLDR_SUCCESS) {
+            reply[0] = Cyacd_RowChecksum(pControlBlock->flash[row], pControlBlock->rowSize);
+            replyLength = 1;
+            pControlBlock->rowsVerified++;
+         }
+         break;
+
+      case BTLDR_CMD_VERIFY_CHECKSUM:
+         reply[0] = 1;
+         replyLength = 1;
+         break;
+
+      case BTLDR_CMD_EXIT:
+         pControlBlock->active = 0;
+         return 0;
+
+      default:
+         status = BTLDR_ERR_CMD;
+         break;
+   }
+
+   if (status != BTLDR_SUCCESS) {
+      pControlBlock->errors++;
+      replyLength = 0;
+   }
+   return BtldrEmu_Packet(status, reply, replyLength, pResponse);
+}
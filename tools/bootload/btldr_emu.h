@@ -0,0 +1,90 @@
+/*
+ * Host emulation of the PSoC 4 UART bootloader command set.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Takes one command packet at a time, answers it the way the Bootloader
+ * component does and keeps a copy of the application flash.  busyUs is set
+ * to how long the command would keep the device from reading the UART.
+ */
+
+#ifndef BTLDR_EMU_H
+#define BTLDR_EMU_H
+
+#include <stdint.h>
+
+#define BTLDR_CMD_VERIFY_CHECKSUM 0x31
+#define BTLDR_CMD_GET_FLASH_SIZE 0x32
+#define BTLDR_CMD_ERASE_ROW 0x34
+#define BTLDR_CMD_SEND_DATA 0x37
+#define BTLDR_CMD_ENTER 0x38
+#define BTLDR_CMD_PROGRAM_ROW 0x39
+#define BTLDR_CMD_VERIFY_ROW 0x3a
+#define BTLDR_CMD_EXIT 0x3b
+
+#define BTLDR_SUCCESS 0x00
+#define BTLDR_ERR_LENGTH 0x03
+#define BTLDR_ERR_DATA 0x04
+#define BTLDR_ERR_CMD 0x05
+#define BTLDR_ERR_CHECKSUM 0x08
+#define BTLDR_ERR_ARRAY 0x09
+#define BTLDR_ERR_ROW 0x0a
+#define BTLDR_ERR_ACTIVE 0x0c
+
+#define BTLDR_EMU_MAX_ROWS 512
+#define BTLDR_EMU_MAX_ROW_SIZE 256
+#define BTLDR_EMU_MAX_PACKET 0xff
+
+// Command handling and flash row erase plus write, the latter from the
+// CY8C41 datasheet.
+#define BTLDR_EMU_COMMAND_US 20
+#define BTLDR_EMU_ROW_WRITE_US 20000
+
+typedef struct T_BtldrEmu {
+   uint32_t siliconId;
+   uint8_t siliconRev;
+   uint16_t firstRow;
+   uint16_t rowCount;
+   uint16_t rowSize;
+   uint8_t flash[BTLDR_EMU_MAX_ROWS][BTLDR_EMU_MAX_ROW_SIZE];
+   uint8_t buffer[BTLDR_EMU_MAX_ROW_SIZE];
+   uint16_t bufferCount;
+   uint8_t active;
+   uint32_t commandUs;
+   uint32_t rowWriteUs;
+   uint32_t busyUs;
+   uint32_t rowsWritten;
+   uint32_t rowsVerified;
+   uint32_t errors;
+} T_BtldrEmu;
+
+#define BTLDR_EMU_INIT_FAILURE 0
+#define BTLDR_EMU_INIT_SUCCESS 1
+
+uint8_t BtldrEmu_Init(T_BtldrEmu *pControlBlock, uint32_t siliconId, uint8_t siliconRev,
+                      uint16_t firstRow, uint16_t rowCount, uint16_t rowSize);
+uint16_t BtldrEmu_Command(T_BtldrEmu *pControlBlock, const uint8_t *pPacket, uint16_t length, uint8_t *pResponse);
+uint16_t BtldrEmu_Packet(uint8_t code, const uint8_t *pData, uint16_t length, uint8_t *pOut);
+uint16_t BtldrEmu_PacketChecksum(const uint8_t *pData, uint16_t length);
+
+#endif
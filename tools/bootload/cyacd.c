@@ -0,0 +1,192 @@
+/*
+ * Reader, writer and generator for .cyacd bootloadable images.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include "cyacd.h"
+
+// The PSoC 4 on the CY8CKIT-049-41xx
+#define SYNTH_SILICON_ID 0x04c81193UL
+#define SYNTH_SILICON_REV 0x11
+
+static int hexNibble(char c)
+{
+   if (c >= '0' && c <= '9') return c - '0';
+   c = (char)tolower((unsigned char)c);
+   if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+   return -1;
+}
+
+// Decode the hex digits of a line into bytes, returns the byte count or -1.
+static int hexDecode(const char *s, uint8_t *pOut, int max)
+{
+   int n = 0;
+
+   while (s[0] && s[0] != '\r' && s[0] != '\n') {
+      int hi = hexNibble(s[0]);
+      int lo = hexNibble(s[1]);
+      if (hi < 0 || lo < 0 || n >= max) {
+         return -1;
+      }
+      pOut[n++] = (uint8_t)((hi << 4) | lo);
+      s += 2;
+   }
+   return n;
+}
+
+uint8_t Cyacd_RowChecksum(const uint8_t *pData, uint16_t size)
+{
+   uint8_t sum = 0;
+   uint16_t i;
+
+   for (i = 0; i < size; i++) {
+      sum += pData[i];
+   }
+   return (uint8_t)(1 + ~sum);
+}
+
+int Cyacd_Load(const char *path, T_CyacdImage *pImage)
+{
+   static char line[2 * (CYACD_MAX_ROW_SIZE + 8) + 8];
+   uint8_t bytes[CYACD_MAX_ROW_SIZE + 8];
+   FILE *f;
+   int n;
+   int lineNum = 1;
+
+   if (NULL == path || NULL == pImage) {
+      return CYACD_FAILURE;
+   }
+   f = fopen(path, "r");
+   if (NULL == f) {
+      perror(path);
+      return CYACD_FAILURE;
+   }
+
+   memset(pImage, 0, sizeof(*pImage));
+   if (NULL == fgets(line, sizeof(line), f) || hexDecode(line, bytes, sizeof(bytes)) != 6) {
+      fprintf(stderr, "%s:1: bad header\n", path);
+      fclose(f);
+      return CYACD_FAILURE;
+   }
+   pImage->siliconId = ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+   pImage->siliconRev = bytes[4];
+   pImage->checksumType = bytes[5];
+
+   while (NULL != fgets(line, sizeof(line), f)) {
+      T_CyacdRow *pRow;
+
+      lineNum++;
+      if (line[0] == '\r' || line[0] == '\n') {
+         continue;
+      }
+      n = (line[0] == ':') ? hexDecode(line + 1, bytes, sizeof(bytes)) : -1;
+      if (n < 6 || n != 6 + ((bytes[3] << 8) | bytes[4]) || pImage->rowCount >= CYACD_MAX_ROWS) {
+         fprintf(stderr, "%s:%d: bad row\n", path, lineNum);
+         fclose(f);
+         return CYACD_FAILURE;
+      }
+      if (Cyacd_RowChecksum(bytes, (uint16_t)(n - 1)) != bytes[n - 1]) {
+         fprintf(stderr, "%s:%d: row checksum mismatch\n", path, lineNum);
+         fclose(f);
+         return CYACD_FAILURE;
+      }
+      pRow = &pImage->rows[pImage->rowCount++];
+      pRow->arrayId = bytes[0];
+      pRow->rowNum = (uint16_t)((bytes[1] << 8) | bytes[2]);
+      pRow->size = (uint16_t)(n - 6);
+      memcpy(pRow->data, &bytes[5], pRow->size);
+   }
+
+   fclose(f);
+   return CYACD_SUCCESS;
+}
+
+int Cyacd_Save(const char *path, const T_CyacdImage *pImage)
+{
+   FILE *f;
+   uint16_t r;
+   uint16_t i;
+
+   if (NULL == path || NULL == pImage) {
+      return CYACD_FAILURE;
+   }
+   f = fopen(path, "w");
+   if (NULL == f) {
+      perror(path);
+      return CYACD_FAILURE;
+   }
+
+   fprintf(f, "%08lX%02X%02X\r\n", (unsigned long)pImage->siliconId, pImage->siliconRev, pImage->checksumType);
+   for (r = 0; r < pImage->rowCount; r++) {
+      const T_CyacdRow *pRow = &pImage->rows[r];
+      uint8_t head[5];
+      uint8_t sum;
+
+      head[0] = pRow->arrayId;
+      head[1] = (uint8_t)(pRow->rowNum >> 8);
+      head[2] = (uint8_t)pRow->rowNum;
+      head[3] = (uint8_t)(pRow->size >> 8);
+      head[4] = (uint8_t)pRow->size;
+      sum = (uint8_t)(Cyacd_RowChecksum(head, sizeof(head)) + Cyacd_RowChecksum(pRow->data, pRow->size));
+
+      fprintf(f, ":%02X%02X%02X%02X%02X", head[0], head[1], head[2], head[3], head[4]);
+      for (i = 0; i < pRow->size; i++) {
+         fprintf(f, "%02X", pRow->data[i]);
+      }
+      fprintf(f, "%02X\r\n", sum);
+   }
+
+   return (0 == fclose(f)) ? CYACD_SUCCESS : CYACD_FAILURE;
+}
+
+/*
+ * Fill an image with rowCount rows of pseudo random code starting at
+ * firstRow, so the tools have something to chew on without a PSoC Creator
+ * build.  The same seed always gives the same image.
+ */
+void Cyacd_Synthesize(T_CyacdImage *pImage, uint16_t firstRow, uint16_t rowCount, uint16_t rowSize, uint32_t seed)
+{
+   uint16_t r;
+   uint16_t i;
+
+   memset(pImage, 0, sizeof(*pImage));
+   pImage->siliconId = SYNTH_SILICON_ID;
+   pImage->siliconRev = SYNTH_SILICON_REV;
+   if (rowCount > CYACD_MAX_ROWS) rowCount = CYACD_MAX_ROWS;
+   if (rowSize > CYACD_MAX_ROW_SIZE) rowSize = CYACD_MAX_ROW_SIZE;
+
+   for (r = 0; r < rowCount; r++) {
+      T_CyacdRow *pRow = &pImage->rows[r];
+
+      pRow->arrayId = 0;
+      pRow->rowNum = (uint16_t)(firstRow + r);
+      pRow->size = rowSize;
+      for (i = 0; i < rowSize; i++) {
+         seed = seed * 1103515245UL + 12345UL;
+         pRow->data[i] = (uint8_t)(seed >> 16);
+      }
+   }
+   pImage->rowCount = rowCount;
+}
@@ -0,0 +1,69 @@
+/*
+ * Reader, writer and generator for .cyacd bootloadable images.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * A .cyacd file is a header line of hex digits
+ *
+ *   SIID(4) REV(1) CHECKSUM_TYPE(1)
+ *
+ * followed by one line per flash row
+ *
+ *   :ARRAY(1) ROW(2) SIZE(2) DATA(SIZE) CHECKSUM(1)
+ *
+ * with multi byte fields big endian and the checksum the two's complement of
+ * the sum of the other bytes on the line.
+ */
+
+#ifndef CYACD_H
+#define CYACD_H
+
+#include <stdint.h>
+
+#define CYACD_MAX_ROWS 512
+#define CYACD_MAX_ROW_SIZE 256
+
+typedef struct T_CyacdRow {
+   uint8_t arrayId;
+   uint16_t rowNum;
+   uint16_t size;
+   uint8_t data[CYACD_MAX_ROW_SIZE];
+} T_CyacdRow;
+
+typedef struct T_CyacdImage {
+   uint32_t siliconId;
+   uint8_t siliconRev;
+   uint8_t checksumType;
+   uint16_t rowCount;
+   T_CyacdRow rows[CYACD_MAX_ROWS];
+} T_CyacdImage;
+
+#define CYACD_SUCCESS 0
+#define CYACD_FAILURE -1
+
+int Cyacd_Load(const char *path, T_CyacdImage *pImage);
+int Cyacd_Save(const char *path, const T_CyacdImage *pImage);
+void Cyacd_Synthesize(T_CyacdImage *pImage, uint16_t firstRow, uint16_t rowCount, uint16_t rowSize, uint32_t seed);
+uint8_t Cyacd_RowChecksum(const uint8_t *pData, uint16_t size);
+
+#endif
@@ -0,0 +1,334 @@
+/*
+ * Delta firmware update over the UART bootloader.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Programs only the flash rows that differ between what the device holds
+ * and a new .cyacd image.
+ *
+ *   delta [-j depth] [-b rx_buffer_bytes] [-w row_write_us] [-t host_turnaround_us]
+ *         [-c changed_rows] [-o prefix] [-d device.cyacd] [old.cyacd new.cyacd]
+ *
+ * Rows that differ between the two images are programmed straight away.
+ * Rows the images share are checked against the device with Verify Row and
+ * only programmed when its checksum disagrees, so a device that does not
+ * hold old.cyacd still ends up with new.cyacd.
+ *
+ * The device is the bootloader emulator loaded with old.cyacd, or with
+ * device.cyacd if given, on a virtual
+ * 115200 baud UART.  The update is run stop and wait and pipelined, next to a
+ * full flash of every row, and the rows written and the time each took are
+ * reported.  Without images a synthetic 200 row application is used with
+ * changed_rows rows (default 6) rewritten in the new one; -o saves the pair
+ * as prefix-old.cyacd and prefix-new.cyacd.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "btldr_emu.h"
+#include "cyacd.h"
+#include "link.h"
+#include "pipeline.h"
+#include "session.h"
+
+#define SYNTH_FIRST_ROW 56
+#define SYNTH_ROWS 200
+#define ROW_SIZE 128
+#define FLASH_ROWS 256
+
+#define DEFAULT_DEPTH 4
+#define DEFAULT_RX_BUFFER 128
+
+typedef struct T_DeltaOptions {
+   uint8_t depth;
+   uint32_t rxBufferBytes;
+   uint32_t rowWriteUs;
+   uint32_t turnaroundUs;
+} T_DeltaOptions;
+
+typedef struct T_DeltaResult {
+   uint32_t totalUs;
+   uint32_t rowsVerified;
+   uint32_t rowsWritten;
+   uint32_t overflows;
+   uint8_t ok;
+} T_DeltaResult;
+
+typedef struct T_VerifyContext {
+   const T_CyacdImage *pImage;
+   const uint16_t *pRowIndex;
+   uint32_t firstIndex;
+   uint8_t *pStale;
+} T_VerifyContext;
+
+static T_CyacdImage oldImage;
+static T_CyacdImage newImage;
+static T_CyacdImage deviceImage;
+static T_BtldrEmu emu;
+
+static const T_CyacdRow *findRow(const T_CyacdImage *pImage, uint8_t arrayId, uint16_t rowNum)
+{
+   uint16_t r;
+
+   for (r = 0; r < pImage->rowCount; r++) {
+      if (pImage->rows[r].arrayId == arrayId && pImage->rows[r].rowNum == rowNum) {
+         return &pImage->rows[r];
+      }
+   }
+   return NULL;
+}
+
+static uint8_t sameRow(const T_CyacdRow *pA, const T_CyacdRow *pB)
+{
+   return NULL != pA && NULL != pB && pA->size == pB->size && memcmp(pA->data, pB->data, pA->size) == 0;
+}
+
+static void onVerify(void *pContext, uint32_t index, const uint8_t *pResponse, uint16_t length)
+{
+   T_VerifyContext *pVerify = pContext;
+   const T_CyacdRow *pRow;
+
+   if (index < pVerify->firstIndex || length != BTLDR_PACKET_OVERHEAD + 1 || pResponse[1] != BTLDR_SUCCESS) {
+      return;
+   }
+   pRow = &pVerify->pImage->rows[pVerify->pRowIndex[index - pVerify->firstIndex]];
+   if (pResponse[4] != Cyacd_RowChecksum(pRow->data, pRow->size)) {
+      pVerify->pStale[pVerify->pRowIndex[index - pVerify->firstIndex]] = 1;
+   }
+}
+
+static void addRowCommand(T_Session *pSession, uint8_t command, const T_CyacdRow *pRow)
+{
+   uint8_t data[3];
+
+   data[0] = pRow->arrayId;
+   data[1] = (uint8_t)pRow->rowNum;
+   data[2] = (uint8_t)(pRow->rowNum >> 8);
+   Session_Add(pSession, command, data, sizeof(data));
+}
+
+static uint8_t checkFlash(const T_CyacdImage *pImage)
+{
+   uint16_t r;
+
+   for (r = 0; r < pImage->rowCount; r++) {
+      if (memcmp(emu.flash[pImage->rows[r].rowNum], pImage->rows[r].data, pImage->rows[r].size) != 0) {
+         return 0;
+      }
+   }
+   return 1;
+}
+
+static void loadDevice(const T_CyacdImage *pImage, const T_DeltaOptions *pOptions)
+{
+   uint16_t r;
+
+   Link_Reset();
+   Link_SetRxBufferSize(pOptions->rxBufferBytes);
+   BtldrEmu_Init(&emu, newImage.siliconId, newImage.siliconRev, 0, FLASH_ROWS, ROW_SIZE);
+   emu.rowWriteUs = pOptions->rowWriteUs;
+   for (r = 0; r < pImage->rowCount; r++) {
+      memcpy(emu.flash[pImage->rows[r].rowNum], pImage->rows[r].data, pImage->rows[r].size);
+   }
+}
+
+/*
+ * Three phases, each waiting for the responses of the one before: enter the
+ * bootloader and verify the rows the images share, program whatever is
+ * stale, then verify the application and exit.  With full set every row is
+ * programmed without asking.
+ */
+static void update(const T_DeltaOptions *pOptions, uint8_t full, T_DeltaResult *pResult)
+{
+   T_Pipeline pipeline;
+   T_Session session;
+   T_VerifyContext verify;
+   uint16_t *pRowIndex = calloc(newImage.rowCount + 1, sizeof(uint16_t));
+   uint8_t *pStale = calloc(newImage.rowCount + 1, 1);
+   uint8_t arrayId = 0;
+   uint16_t verifyCount = 0;
+   uint16_t r;
+   uint8_t ok;
+
+   if (NULL == pRowIndex || NULL == pStale) {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+   }
+   memset(pResult, 0, sizeof(*pResult));
+   loadDevice(&deviceImage, pOptions);
+   Pipeline_Init(&pipeline, &emu, pOptions->depth, pOptions->rxBufferBytes, pOptions->turnaroundUs);
+
+   Session_Init(&session);
+   Session_Add(&session, BTLDR_CMD_ENTER, NULL, 0);
+   Session_Add(&session, BTLDR_CMD_GET_FLASH_SIZE, &arrayId, 1);
+   for (r = 0; r < newImage.rowCount; r++) {
+      const T_CyacdRow *pRow = &newImage.rows[r];
+
+      if (full || !sameRow(pRow, findRow(&oldImage, pRow->arrayId, pRow->rowNum))) {
+         pStale[r] = 1;
+      } else {
+         addRowCommand(&session, BTLDR_CMD_VERIFY_ROW, pRow);
+         pRowIndex[verifyCount++] = r;
+      }
+   }
+   verify.pImage = &newImage;
+   verify.pRowIndex = pRowIndex;
+   verify.firstIndex = 2;
+   verify.pStale = pStale;
+   ok = Pipeline_Run(&pipeline, &session, onVerify, &verify);
+   Session_Free(&session);
+
+   for (r = 0; r < newImage.rowCount; r++) {
+      if (pStale[r]) {
+         Session_AddRow(&session, &newImage.rows[r]);
+      }
+   }
+   ok = ok && Pipeline_Run(&pipeline, &session, NULL, NULL);
+   Session_Free(&session);
+
+   Session_Add(&session, BTLDR_CMD_VERIFY_CHECKSUM, NULL, 0);
+   Session_Add(&session, BTLDR_CMD_EXIT, NULL, 0);
+   ok = ok && Pipeline_Run(&pipeline, &session, NULL, NULL);
+   Session_Free(&session);
+
+   pResult->totalUs = pipeline.hostUs;
+   pResult->rowsVerified = emu.rowsVerified;
+   pResult->rowsWritten = emu.rowsWritten;
+   pResult->overflows = Link_Overflows();
+   pResult->ok = ok && pResult->overflows == 0 && checkFlash(&newImage);
+
+   free(pRowIndex);
+   free(pStale);
+}
+
+static void report(const char *name, const T_DeltaResult *pResult)
+{
+   printf("%-22s %9.1f ms, %3lu rows written, %3lu rows verified%s\n", name, pResult->totalUs / 1000.0,
+          (unsigned long)pResult->rowsWritten, (unsigned long)pResult->rowsVerified,
+          pResult->ok ? "" : (pResult->overflows ? ", RX OVERFLOW" : ", FAILED"));
+}
+
+static void usage(const char *name)
+{
+   fprintf(stderr, "usage: %s [-j depth] [-b rx_buffer_bytes] [-w row_write_us] [-t host_turnaround_us]\n"
+                   "          [-c changed_rows] [-o prefix] [-d device.cyacd] [old.cyacd new.cyacd]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+   T_DeltaOptions options = { DEFAULT_DEPTH, DEFAULT_RX_BUFFER, BTLDR_EMU_ROW_WRITE_US, 0 };
+   T_DeltaOptions stopAndWait;
+   T_DeltaResult fullResult;
+   T_DeltaResult fullPipelinedResult;
+   T_DeltaResult deltaResult;
+   T_DeltaResult deltaPipelinedResult;
+   uint32_t changedRows = 6;
+   const char *pPrefix = NULL;
+   const char *pDevicePath = NULL;
+   char path[256];
+   uint16_t r;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "j:b:w:t:c:o:d:")) != -1) {
+      switch (opt) {
+         case 'j': options.depth = (uint8_t)strtoul(optarg, NULL, 0); break;
+         case 'b': options.rxBufferBytes = (uint32_t)strtoul(optarg, NULL, 0); break;
+         case 'w': options.rowWriteUs = (uint32_t)strtoul(optarg, NULL, 0); break;
+         case 't': options.turnaroundUs = (uint32_t)strtoul(optarg, NULL, 0); break;
+         case 'c': changedRows = (uint32_t)strtoul(optarg, NULL, 0); break;
+         case 'o': pPrefix = optarg; break;
+         case 'd': pDevicePath = optarg; break;
+         default: usage(argv[0]); return 2;
+      }
+   }
+   if (options.depth == 0 || options.rxBufferBytes < SESSION_MAX_PACKET) {
+      fprintf(stderr, "depth must be at least 1 and the RX buffer at least %u bytes\n", SESSION_MAX_PACKET);
+      return 2;
+   }
+
+   if (argc - optind == 2) {
+      if (Cyacd_Load(argv[optind], &oldImage) != CYACD_SUCCESS ||
+          Cyacd_Load(argv[optind + 1], &newImage) != CYACD_SUCCESS) {
+         return 1;
+      }
+   } else if (argc == optind) {
+      // A change in a few functions near the end of the application, plus
+      // the metadata row that carries the application checksum.
+      Cyacd_Synthesize(&oldImage, SYNTH_FIRST_ROW, SYNTH_ROWS, ROW_SIZE, 1);
+      memcpy(&newImage, &oldImage, sizeof(newImage));
+      for (r = 0; r < changedRows && r < SYNTH_ROWS; r++) {
+         T_CyacdRow *pRow = &newImage.rows[r == 0 ? SYNTH_ROWS - 1 : SYNTH_ROWS * 3 / 4 + r - 1];
+         pRow->data[r % ROW_SIZE] ^= 0x5a;
+      }
+      if (NULL != pPrefix) {
+         snprintf(path, sizeof(path), "%s-old.cyacd", pPrefix);
+         if (Cyacd_Save(path, &oldImage) != CYACD_SUCCESS) {
+            return 1;
+         }
+         snprintf(path, sizeof(path), "%s-new.cyacd", pPrefix);
+         if (Cyacd_Save(path, &newImage) != CYACD_SUCCESS) {
+            return 1;
+         }
+      }
+   } else {
+      usage(argv[0]);
+      return 2;
+   }
+   if (NULL == pDevicePath) {
+      memcpy(&deviceImage, &oldImage, sizeof(deviceImage));
+   } else if (Cyacd_Load(pDevicePath, &deviceImage) != CYACD_SUCCESS) {
+      return 1;
+   }
+   if (oldImage.siliconId != newImage.siliconId || deviceImage.siliconId != newImage.siliconId) {
+      fprintf(stderr, "images are for different devices\n");
+      return 1;
+   }
+   for (r = 0; r < newImage.rowCount; r++) {
+      if (newImage.rows[r].rowNum >= FLASH_ROWS || newImage.rows[r].size != ROW_SIZE) {
+         fprintf(stderr, "row %u does not fit a %u x %u byte flash\n", newImage.rows[r].rowNum, FLASH_ROWS, ROW_SIZE);
+         return 1;
+      }
+   }
+
+   stopAndWait = options;
+   stopAndWait.depth = 1;
+   update(&stopAndWait, 1, &fullResult);
+   update(&options, 1, &fullPipelinedResult);
+   update(&stopAndWait, 0, &deltaResult);
+   update(&options, 0, &deltaPipelinedResult);
+
+   printf("images: %u rows, %lu baud, row write %lu us, pipeline depth %u, RX buffer %lu bytes\n",
+          newImage.rowCount, (unsigned long)LINK_BAUD, (unsigned long)options.rowWriteUs, options.depth,
+          (unsigned long)options.rxBufferBytes);
+   report("full flash:", &fullResult);
+   report("full flash pipelined:", &fullPipelinedResult);
+   report("delta:", &deltaResult);
+   report("delta pipelined:", &deltaPipelinedResult);
+   if (deltaPipelinedResult.totalUs > 0) {
+      printf("speedup over full flash: %.1fx\n", (double)fullResult.totalUs / deltaPipelinedResult.totalUs);
+   }
+
+   return (fullResult.ok && fullPipelinedResult.ok && deltaResult.ok && deltaPipelinedResult.ok) ? 0 : 1;
+}
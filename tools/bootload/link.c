@@ -0,0 +1,177 @@
+/*
+ * Virtual UART between a bootload host and the device.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "link.h"
+
+typedef struct T_LinkByte {
+   uint32_t arrivalUs;
+   uint8_t value;
+} T_LinkByte;
+
+static T_LinkByte line[LINK_BUFFER_SIZE];
+static uint32_t head;
+static uint32_t tail;
+static uint32_t lineFreeUs;
+static uint32_t nowUs;
+static uint32_t rxBufferBytes;
+static uint32_t overflows;
+
+void Link_Reset(void)
+{
+   head = 0;
+   tail = 0;
+   lineFreeUs = 0;
+   nowUs = 0;
+   rxBufferBytes = 0;
+   overflows = 0;
+}
+
+uint32_t Link_Now(void)
+{
+   return nowUs;
+}
+
+void Link_AdvanceTo(uint32_t us)
+{
+   if (us > nowUs) {
+      nowUs = us;
+   }
+}
+
+// Queue bytes sent by the host no earlier than startUs, behind anything
+// still on the wire.  Returns when the last one has arrived.
+uint32_t Link_Send(const uint8_t *pData, uint16_t length, uint32_t startUs)
+{
+   uint16_t i;
+
+   if (startUs > lineFreeUs) {
+      lineFreeUs = startUs;
+   }
+   for (i = 0; i < length; i++) {
+      if (tail - head >= LINK_BUFFER_SIZE) {
+         fprintf(stderr, "link buffer overflow\n");
+         exit(1);
+      }
+      lineFreeUs += LINK_BYTE_US;
+      line[tail % LINK_BUFFER_SIZE].arrivalUs = lineFreeUs;
+      line[tail % LINK_BUFFER_SIZE].value = pData[i];
+      tail++;
+   }
+   return lineFreeUs;
+}
+
+// Zero, the default, means unlimited.
+void Link_SetRxBufferSize(uint32_t bytes)
+{
+   rxBufferBytes = bytes;
+}
+
+uint32_t Link_Overflows(void)
+{
+   return overflows;
+}
+
+// Bytes sent but not yet read, whether or not they have arrived.
+uint32_t Link_Pending(void)
+{
+   return tail - head;
+}
+
+static uint32_t rxBufferSize(void)
+{
+   uint32_t n = 0;
+
+   while (head + n != tail && line[(head + n) % LINK_BUFFER_SIZE].arrivalUs <= nowUs) {
+      n++;
+   }
+   if (rxBufferBytes != 0 && n > rxBufferBytes) {
+      overflows++;
+   }
+   return n;
+}
+
+static uint32_t readRxData(void)
+{
+   return line[head++ % LINK_BUFFER_SIZE].value;
+}
+
+static void delayUs(uint16_t microseconds)
+{
+   nowUs += microseconds;
+}
+
+static const T_BtldrPort port = { rxBufferSize, readRxData, delayUs };
+
+const T_BtldrPort *Link_Port(void)
+{
+   return &port;
+}
+
+/*
+ * CyBtldrCommRead as it was before btldr_packet.c: poll every millisecond,
+ * wait for 2 ms without a new byte, then another 5 ms if the data does not
+ * end in EOP.  Kept for the benchmark.
+ */
+uint8_t Link_DelayRead(const T_BtldrPort *pPort, uint8_t *pData, uint16_t size, uint16_t *pCount, uint8_t timeOut)
+{
+   uint32_t received = 0;
+   uint32_t oldCount;
+   uint32_t cntr;
+   uint8_t status = BTLDR_READ_EMPTY;
+
+   for (cntr = 0; cntr < (uint32_t)timeOut * 10; cntr++) {
+      received = pPort->rxBufferSize();
+      if (received != 0) {
+         do {
+            oldCount = received;
+            pPort->delayUs(2000);
+            received = pPort->rxBufferSize();
+         } while (received > oldCount);
+         status = BTLDR_READ_SUCCESS;
+         break;
+      } else {
+         pPort->delayUs(1000);
+      }
+   }
+
+   *pCount = 0;
+   if (received > 0) {
+      if (received >= size) {
+         while (pPort->rxBufferSize() != 0) {
+            (void)pPort->readRxData();
+         }
+         return BTLDR_READ_EMPTY;
+      }
+      for (cntr = 0; cntr < received; cntr++) {
+         pData[cntr] = (uint8_t)pPort->readRxData();
+      }
+      *pCount = (uint16_t)received;
+      if (pData[received - 1] != BTLDR_PACKET_EOP) {
+         pPort->delayUs(5000);
+      }
+   }
+   return status;
+}
@@ -0,0 +1,54 @@
+/*
+ * Virtual UART between a bootload host and the device.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Bytes from the host land in the device RX buffer one character time apart.
+ * Time only moves when the device code delays or the caller advances it, so
+ * a run is exact and repeatable.  Link_Port() gives the T_BtldrPort the
+ * device side reads through.  With an RX buffer size set, finding more bytes
+ * waiting than it holds counts as an overflow.
+ */
+
+#ifndef LINK_H
+#define LINK_H
+
+#include <stdint.h>
+#include "btldr_packet.h"
+
+#define LINK_BAUD 115200UL
+// Start, eight data bits and stop, rounded to the microsecond.
+#define LINK_BYTE_US ((10UL * 1000000UL + LINK_BAUD / 2) / LINK_BAUD)
+#define LINK_BUFFER_SIZE 4096
+
+void Link_Reset(void);
+uint32_t Link_Now(void);
+void Link_AdvanceTo(uint32_t us);
+uint32_t Link_Send(const uint8_t *pData, uint16_t length, uint32_t startUs);
+uint32_t Link_Pending(void);
+void Link_SetRxBufferSize(uint32_t bytes);
+uint32_t Link_Overflows(void);
+const T_BtldrPort *Link_Port(void);
+uint8_t Link_DelayRead(const T_BtldrPort *pPort, uint8_t *pData, uint16_t size, uint16_t *pCount, uint8_t timeOut);
+
+#endif
@@ -0,0 +1,123 @@
+/*
+ * Pipelined bootload host driving the bootloader emulator.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "btldr_packet.h"
+#include "link.h"
+#include "pipeline.h"
+
+uint8_t Pipeline_Init(T_Pipeline *pControlBlock, T_BtldrEmu *pEmu, uint8_t depth, uint32_t rxBufferBytes, uint32_t turnaroundUs)
+{
+   if (NULL == pControlBlock || NULL == pEmu || depth == 0 || rxBufferBytes < SESSION_MAX_PACKET) {
+      return PIPELINE_INIT_FAILURE;
+   }
+
+   memset(pControlBlock, 0, sizeof(*pControlBlock));
+   pControlBlock->pEmu = pEmu;
+   pControlBlock->depth = depth;
+   pControlBlock->rxBufferBytes = rxBufferBytes;
+   pControlBlock->turnaroundUs = turnaroundUs;
+   pControlBlock->hostUs = Link_Now();
+   pControlBlock->txFreeUs = Link_Now();
+
+   return PIPELINE_INIT_SUCCESS;
+}
+
+/*
+ * Send every command of the session and hand each response to onResponse.
+ * The session starts once the host has the last response of the previous
+ * one, since what it sends usually depends on that.  Returns 0 if any
+ * response carried an error status.
+ *
+ * The device and the host share one clock, so command k is put on the line
+ * just before the device reads it; by then the responses it has to wait for
+ * are all known.
+ */
+uint8_t Pipeline_Run(T_Pipeline *pControlBlock, const T_Session *pSession, T_PipelineResponse onResponse, void *pContext)
+{
+   uint8_t buffer[BTLDR_EMU_MAX_PACKET];
+   uint8_t response[BTLDR_EMU_MAX_PACKET];
+   uint32_t *pReceivedUs;
+   uint32_t errors = pControlBlock->errors;
+   uint32_t k;
+
+   if (pSession->count == 0) {
+      return 1;
+   }
+   pReceivedUs = malloc(pSession->count * sizeof(uint32_t));
+   if (NULL == pReceivedUs) {
+      return 0;
+   }
+
+   for (k = 0; k < pSession->count; k++) {
+      const T_SessionPacket *pPacket = &pSession->pPackets[k];
+      uint32_t readyUs = pControlBlock->hostUs;
+      uint32_t bytes = pPacket->length;
+      uint32_t j = k;
+      uint16_t count = 0;
+      uint16_t responseLength;
+
+      // Oldest command that may still be unanswered when this one goes out
+      while (j > 0 && k - (j - 1) < pControlBlock->depth &&
+             bytes + pSession->pPackets[j - 1].length <= pControlBlock->rxBufferBytes) {
+         j--;
+         bytes += pSession->pPackets[j].length;
+      }
+      if (j > 0 && pReceivedUs[j - 1] + pControlBlock->turnaroundUs > readyUs) {
+         readyUs = pReceivedUs[j - 1] + pControlBlock->turnaroundUs;
+      }
+      Link_Send(pPacket->bytes, pPacket->length, readyUs);
+
+      while (BtldrPacket_Read(Link_Port(), buffer, sizeof(buffer), &count, 0xff) != BTLDR_READ_SUCCESS) {
+      }
+      responseLength = BtldrEmu_Command(pControlBlock->pEmu, buffer, count, response);
+      Link_AdvanceTo(Link_Now() + pControlBlock->pEmu->busyUs);
+
+      if (pControlBlock->txFreeUs < Link_Now()) {
+         pControlBlock->txFreeUs = Link_Now();
+      }
+      pControlBlock->txFreeUs += responseLength * LINK_BYTE_US;
+      pReceivedUs[k] = pControlBlock->txFreeUs;
+      pControlBlock->commands++;
+
+      if (responseLength == 0) {
+         continue;
+      }
+      if (response[1] != BTLDR_SUCCESS) {
+         pControlBlock->errors++;
+      }
+      if (NULL != onResponse) {
+         onResponse(pContext, k, response, responseLength);
+      }
+   }
+
+   pControlBlock->hostUs = pReceivedUs[pSession->count - 1] + pControlBlock->turnaroundUs;
+   if (pControlBlock->hostUs < Link_Now()) {
+      pControlBlock->hostUs = Link_Now();
+   }
+   free(pReceivedUs);
+
+   return pControlBlock->errors == errors;
+}
@@ -0,0 +1,60 @@
+/*
+ * Pipelined bootload host driving the bootloader emulator.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Runs a session against the emulator over the virtual link, keeping up to
+ * depth commands in flight: the next command goes out as soon as it fits,
+ * without waiting for the response to the one before.  The bytes in flight
+ * never exceed the device RX buffer, so the bootloader can be busy writing a
+ * row while the next command waits for it.  Depth 1 is the stop and wait
+ * behaviour of the Cypress host.
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+#include "btldr_emu.h"
+#include "session.h"
+
+typedef void (*T_PipelineResponse)(void *pContext, uint32_t index, const uint8_t *pResponse, uint16_t length);
+
+typedef struct T_Pipeline {
+   T_BtldrEmu *pEmu;
+   uint8_t depth;
+   uint32_t rxBufferBytes;
+   uint32_t turnaroundUs;
+   uint32_t hostUs;
+   uint32_t txFreeUs;
+   uint32_t commands;
+   uint32_t errors;
+} T_Pipeline;
+
+#define PIPELINE_INIT_FAILURE 0
+#define PIPELINE_INIT_SUCCESS 1
+
+uint8_t Pipeline_Init(T_Pipeline *pControlBlock, T_BtldrEmu *pEmu, uint8_t depth, uint32_t rxBufferBytes, uint32_t turnaroundUs);
+uint8_t Pipeline_Run(T_Pipeline *pControlBlock, const T_Session *pSession, T_PipelineResponse onResponse, void *pContext);
+
+#endif
@@ -0,0 +1,180 @@
+/*
+ * Bootload session replay benchmark.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Replays a full bootload of a .cyacd image against the bootloader emulator
+ * over a virtual 115200 baud UART, once with the old delay based
+ * CyBtldrCommRead and once with BtldrPacket_Read, and reports the total time
+ * each takes.  The host waits for every response before sending the next
+ * command, as the Cypress bootload host does.
+ *
+ *   replay [-w row_write_us] [-t host_turnaround_us] [image.cyacd]
+ *
+ * Without an image a synthetic 200 row application is used.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "btldr_packet.h"
+#include "btldr_emu.h"
+#include "cyacd.h"
+#include "link.h"
+#include "session.h"
+
+#define SYNTH_FIRST_ROW 56
+#define SYNTH_ROWS 200
+#define ROW_SIZE 128
+#define FLASH_ROWS 256
+
+typedef uint8_t (*T_ReadFunction)(const T_BtldrPort *pPort, uint8_t *pData, uint16_t size, uint16_t *pCount, uint8_t timeOut);
+
+typedef struct T_ReplayResult {
+   uint32_t totalUs;
+   uint32_t waitUs;
+   uint32_t framingErrors;
+   uint32_t rowsWritten;
+   uint8_t flashMatches;
+} T_ReplayResult;
+
+static T_CyacdImage image;
+static T_BtldrEmu emu;
+
+static uint8_t flashMatches(void)
+{
+   uint16_t r;
+
+   for (r = 0; r < image.rowCount; r++) {
+      if (memcmp(emu.flash[image.rows[r].rowNum], image.rows[r].data, image.rows[r].size) != 0) {
+         return 0;
+      }
+   }
+   return 1;
+}
+
+static void replay(const T_Session *pSession, T_ReadFunction read, uint32_t rowWriteUs,
+                   uint32_t turnaroundUs, T_ReplayResult *pResult)
+{
+   uint8_t buffer[BTLDR_EMU_MAX_PACKET];
+   uint8_t response[BTLDR_EMU_MAX_PACKET];
+   uint32_t hostReadyUs = 0;
+   uint32_t i;
+
+   memset(pResult, 0, sizeof(*pResult));
+   Link_Reset();
+   BtldrEmu_Init(&emu, image.siliconId, image.siliconRev, 0, FLASH_ROWS, ROW_SIZE);
+   emu.rowWriteUs = rowWriteUs;
+
+   for (i = 0; i < pSession->count; i++) {
+      const T_SessionPacket *pPacket = &pSession->pPackets[i];
+      uint32_t arrivedUs = Link_Send(pPacket->bytes, pPacket->length, hostReadyUs);
+      uint16_t count = 0;
+      uint16_t responseLength;
+
+      while (read(Link_Port(), buffer, sizeof(buffer), &count, 0xff) != BTLDR_READ_SUCCESS) {
+      }
+      if (count != pPacket->length) {
+         pResult->framingErrors++;
+      }
+      pResult->waitUs += Link_Now() - arrivedUs;
+
+      responseLength = BtldrEmu_Command(&emu, buffer, count, response);
+      Link_AdvanceTo(Link_Now() + emu.busyUs);
+      hostReadyUs = Link_Now() + responseLength * LINK_BYTE_US;
+      if (responseLength > 0) {
+         hostReadyUs += turnaroundUs;
+      }
+   }
+
+   pResult->totalUs = hostReadyUs;
+   pResult->rowsWritten = emu.rowsWritten;
+   pResult->flashMatches = flashMatches();
+}
+
+static void report(const char *name, const T_ReplayResult *pResult, uint32_t rows)
+{
+   printf("%-14s %9.1f ms total, %6.2f ms/row, %8.1f ms waiting after packets, %lu rows written%s%s\n",
+          name, pResult->totalUs / 1000.0, rows ? pResult->totalUs / 1000.0 / rows : 0.0,
+          pResult->waitUs / 1000.0, (unsigned long)pResult->rowsWritten,
+          pResult->framingErrors ? ", FRAMING ERRORS" : "",
+          pResult->flashMatches ? "" : ", FLASH MISMATCH");
+}
+
+int main(int argc, char **argv)
+{
+   T_Session session;
+   T_ReplayResult delayResult;
+   T_ReplayResult packetResult;
+   uint32_t rowWriteUs = BTLDR_EMU_ROW_WRITE_US;
+   uint32_t turnaroundUs = 0;
+   uint32_t bytes = 0;
+   uint32_t i;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "w:t:")) != -1) {
+      switch (opt) {
+         case 'w': rowWriteUs = (uint32_t)strtoul(optarg, NULL, 0); break;
+         case 't': turnaroundUs = (uint32_t)strtoul(optarg, NULL, 0); break;
+         default:
+            fprintf(stderr, "usage: %s [-w row_write_us] [-t host_turnaround_us] [image.cyacd]\n", argv[0]);
+            return 2;
+      }
+   }
+
+   if (optind < argc) {
+      if (Cyacd_Load(argv[optind], &image) != CYACD_SUCCESS) {
+         return 1;
+      }
+   } else {
+      Cyacd_Synthesize(&image, SYNTH_FIRST_ROW, SYNTH_ROWS, ROW_SIZE, 1);
+   }
+   for (i = 0; i < image.rowCount; i++) {
+      if (image.rows[i].rowNum >= FLASH_ROWS || image.rows[i].size != ROW_SIZE) {
+         fprintf(stderr, "row %u does not fit a %u x %u byte flash\n", image.rows[i].rowNum, FLASH_ROWS, ROW_SIZE);
+         return 1;
+      }
+   }
+
+   Session_Init(&session);
+   Session_Full(&session, &image);
+   for (i = 0; i < session.count; i++) {
+      bytes += session.pPackets[i].length;
+   }
+
+   printf("session: %s, %lu rows, %lu packets, %lu bytes, %lu baud, row write %lu us, host turnaround %lu us\n",
+          optind < argc ? argv[optind] : "synthetic", (unsigned long)session.rows, (unsigned long)session.count,
+          (unsigned long)bytes, (unsigned long)LINK_BAUD, (unsigned long)rowWriteUs, (unsigned long)turnaroundUs);
+   printf("wire time alone: %.1f ms\n", bytes * LINK_BYTE_US / 1000.0);
+
+   replay(&session, Link_DelayRead, rowWriteUs, turnaroundUs, &delayResult);
+   replay(&session, BtldrPacket_Read, rowWriteUs, turnaroundUs, &packetResult);
+   report("delay read:", &delayResult, session.rows);
+   report("packet read:", &packetResult, session.rows);
+   printf("speedup: %.2fx\n", (double)delayResult.totalUs / packetResult.totalUs);
+
+   Session_Free(&session);
+   return (delayResult.framingErrors || packetResult.framingErrors ||
+           !delayResult.flashMatches || !packetResult.flashMatches) ? 1 : 0;
+}
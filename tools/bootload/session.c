@@ -0,0 +1,95 @@
+/*
+ * Bootload host command sequences.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "btldr_packet.h"
+#include "btldr_emu.h"
+#include "session.h"
+
+#define SESSION_MAX_DATA (SESSION_MAX_PACKET - BTLDR_PACKET_OVERHEAD)
+
+void Session_Init(T_Session *pSession)
+{
+   memset(pSession, 0, sizeof(*pSession));
+}
+
+void Session_Free(T_Session *pSession)
+{
+   free(pSession->pPackets);
+   Session_Init(pSession);
+}
+
+void Session_Add(T_Session *pSession, uint8_t command, const uint8_t *pData, uint16_t length)
+{
+   if (pSession->count == pSession->capacity) {
+      pSession->capacity = pSession->capacity ? 2 * pSession->capacity : 64;
+      pSession->pPackets = realloc(pSession->pPackets, pSession->capacity * sizeof(T_SessionPacket));
+      if (NULL == pSession->pPackets) {
+         fprintf(stderr, "out of memory\n");
+         exit(1);
+      }
+   }
+   pSession->pPackets[pSession->count].length = BtldrEmu_Packet(command, pData, length,
+                                                                 pSession->pPackets[pSession->count].bytes);
+   pSession->count++;
+}
+
+void Session_AddRow(T_Session *pSession, const T_CyacdRow *pRow)
+{
+   uint8_t data[SESSION_MAX_DATA];
+   uint16_t offset = 0;
+   uint16_t tail;
+
+   while ((uint16_t)(pRow->size - offset) > SESSION_MAX_DATA - 3) {
+      uint16_t chunk = (uint16_t)(pRow->size - offset);
+      if (chunk > SESSION_MAX_DATA) chunk = SESSION_MAX_DATA;
+      Session_Add(pSession, BTLDR_CMD_SEND_DATA, &pRow->data[offset], chunk);
+      offset += chunk;
+   }
+
+   tail = (uint16_t)(pRow->size - offset);
+   data[0] = pRow->arrayId;
+   data[1] = (uint8_t)pRow->rowNum;
+   data[2] = (uint8_t)(pRow->rowNum >> 8);
+   memcpy(&data[3], &pRow->data[offset], tail);
+   Session_Add(pSession, BTLDR_CMD_PROGRAM_ROW, data, (uint16_t)(tail + 3));
+   pSession->rows++;
+}
+
+// Enter, get flash size, every row, verify the application and exit.
+void Session_Full(T_Session *pSession, const T_CyacdImage *pImage)
+{
+   uint8_t arrayId = 0;
+   uint16_t r;
+
+   Session_Add(pSession, BTLDR_CMD_ENTER, NULL, 0);
+   Session_Add(pSession, BTLDR_CMD_GET_FLASH_SIZE, &arrayId, 1);
+   for (r = 0; r < pImage->rowCount; r++) {
+      Session_AddRow(pSession, &pImage->rows[r]);
+   }
+   Session_Add(pSession, BTLDR_CMD_VERIFY_CHECKSUM, NULL, 0);
+   Session_Add(pSession, BTLDR_CMD_EXIT, NULL, 0);
+}
@@ -0,0 +1,57 @@
+/*
+ * Bootload host command sequences.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * A session is the list of command packets a bootload host sends, in order,
+ * sized the way the Cypress host does it: packets of at most 64 bytes, a row
+ * split into Send Data commands with the tail carried by Program Row.
+ */
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdint.h>
+#include "cyacd.h"
+
+#define SESSION_MAX_PACKET 64
+
+typedef struct T_SessionPacket {
+   uint16_t length;
+   uint8_t bytes[SESSION_MAX_PACKET];
+} T_SessionPacket;
+
+typedef struct T_Session {
+   T_SessionPacket *pPackets;
+   uint32_t count;
+   uint32_t capacity;
+   uint32_t rows;
+} T_Session;
+
+void Session_Init(T_Session *pSession);
+void Session_Free(T_Session *pSession);
+void Session_Add(T_Session *pSession, uint8_t command, const uint8_t *pData, uint16_t length);
+void Session_AddRow(T_Session *pSession, const T_CyacdRow *pRow);
+void Session_Full(T_Session *pSession, const T_CyacdImage *pImage);
+
+#endif
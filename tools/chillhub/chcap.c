@@ -0,0 +1,1366 @@
+/*
+ * Indexed chillhub capture files and a protocol analyzer for them.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Hours of link traffic from the test rigs go into one capture file that is
+ * decoded once, when it is built, and queried through its index after that.
+ * The file is read through mmap; nothing in it needs parsing beyond the
+ * header.
+ *
+ *   chcap synth [-s megabytes] [-o out.pcap]
+ *       writes a synthetic session in both directions as a tracecap pcap
+ *   chcap build [-b baud] [-d rx|tx] [-t threads] -o out.chcap input
+ *       builds a capture from a tracecap pcap, or from the raw bytes of one
+ *       direction (timed at the baud rate, 115200 by default)
+ *   chcap stats capture
+ *       per message type statistics, from the index
+ *   chcap list [-f from_s] [-u until_s] [-m type] [-n count] [-x] capture
+ *       the frames in a time range, of one message type if asked, with -x
+ *       the message bytes as well
+ *   chcap scan [-t threads] capture
+ *       decodes the whole capture again and checks it against the index; the
+ *       benchmark, against a plain read of the file
+ *   chcap verify capture
+ *       runs the streams through the chillhub.c decoder and checks that it
+ *       finds the same frames
+ *
+ * The file, in host byte order:
+ *
+ *   T_CapHeader, padded to CAP_ALIGN
+ *   the bytes received (hub to scale) as one stream, then the bytes sent
+ *   for each stream, T_CapTime points mapping stream offsets to time; a
+ *     stream without any is timed at bytesPerSecond
+ *   T_CapFrame for every frame of both streams, by time
+ *   T_CapType for each of the 256 message types
+ *   the frame numbers of each message type, by time, as uint32_t; a type's
+ *     T_CapType says where its run starts
+ *
+ * Frames are found the way ChillHub_Loop finds them: an STX, an escaped
+ * length below CHILLHUB_BUFFER_SIZE - 2, and that many escaped bytes plus
+ * the CRC, with no resync on an STX inside the packet.  The streams are cut
+ * into one piece per thread; each thread runs on into the next piece until
+ * it meets a frame the next thread found too, and from that frame on both
+ * decode alike.
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "chillhub.h"
+#include "crc.h"
+
+#define STX 0xff
+#define ESC 0xfe
+
+#define CAP_MAGIC "CHCAP\r\n\032"
+#define CAP_VERSION 1
+#define CAP_ALIGN 4096
+#define CAP_MAX_PACKET (CHILLHUB_BUFFER_SIZE - 2)
+
+#define PCAP_MAGIC 0xa1b2c3d4UL
+#define PCAP_LINKTYPE_USER0 147
+
+#define CAP_RX 0
+#define CAP_TX 1
+
+// T_CapFrame.flags
+#define CAP_FLAG_TX 0x01
+#define CAP_FLAG_CRC_OK 0x02
+#define CAP_FLAG_OVERSIZE 0x04    // length too long, the packet was not read
+#define CAP_FLAG_TRUNCATED 0x08   // the stream ended inside the frame
+#define CAP_FLAG_SHORT 0x10       // length too short for the types, the packet was not read
+
+// Frames seen by the thread on the piece before, past its end
+#define OVERLAP_BYTES (256 * 1024)
+
+typedef struct T_CapHeader {
+   char magic[8];
+   uint32_t version;
+   uint32_t headerSize;
+   uint64_t streamOffset[2];
+   uint64_t streamLength[2];
+   uint64_t timeOffset[2];
+   uint64_t timeCount[2];
+   uint64_t bytesPerSecond;
+   uint64_t frameOffset;
+   uint64_t frameCount;
+   uint64_t typeOffset;
+   uint64_t postingOffset;
+   uint64_t oversizeFrames;
+   uint64_t truncatedFrames;
+   uint64_t shortFrames;
+} T_CapHeader;
+
+typedef struct T_CapTime {
+   uint64_t streamOffset;
+   uint64_t timeUs;
+} T_CapTime;
+
+typedef struct T_CapFrame {
+   uint64_t offset;              // of the STX in its stream; escapes in the top byte
+   uint32_t timeMs;
+   uint8_t msgType;
+   uint8_t dataType;
+   uint8_t wireLength;           // STX to the last CRC byte
+   uint8_t flags;
+} T_CapFrame;
+
+#define CAP_OFFSET(pFrame) ((pFrame)->offset & 0x00ffffffffffffffULL)
+#define CAP_ESCAPES(pFrame) ((uint8_t)((pFrame)->offset >> 56))
+#define CAP_SET_ESCAPES(pFrame, escapes) ((pFrame)->offset |= (uint64_t)(escapes) << 56)
+
+typedef struct T_CapType {
+   uint64_t firstPosting;
+   uint64_t frames;
+   uint64_t txFrames;
+   uint64_t crcFailures;
+   uint64_t wireBytes;
+   uint64_t escapes;
+} T_CapType;
+
+typedef struct T_Capture {
+   const uint8_t *pBase;
+   uint64_t size;
+   const T_CapHeader *pHeader;
+   const uint8_t *pStream[2];
+   const T_CapTime *pTimes[2];
+   const T_CapFrame *pFrames;
+   const T_CapType *pTypes;
+   const uint32_t *pPostings;
+} T_Capture;
+
+static const char *msgTypeNames[256] = {
+#define MSG_TYPE_NAME(name, value, dataType) [value] = #name,
+   CHILLHUB_MSG_TYPES(MSG_TYPE_NAME)
+#undef MSG_TYPE_NAME
+};
+
+static const char *dataTypeNames[256] = {
+#define DATA_TYPE_NAME(name, value, size) [value] = #name,
+   CHILLHUB_DATA_TYPES(DATA_TYPE_NAME)
+#undef DATA_TYPE_NAME
+};
+
+static const char *directionNames[] = { "rx", "tx" };
+
+static double wallNow(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *checkedRealloc(void *p, size_t size) {
+   p = realloc(p, size);
+   if (p == NULL) {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+   }
+   return p;
+}
+
+static const char *typeName(uint8_t msgType, char *pBuf) {
+   if (msgTypeNames[msgType] != NULL) {
+      return msgTypeNames[msgType];
+   }
+   sprintf(pBuf, "0x%02x", msgType);
+   return pBuf;
+}
+
+static int parseType(const char *s) {
+   int i;
+
+   for (i = 0; i < 256; i++) {
+      if (msgTypeNames[i] != NULL && strcasecmp(msgTypeNames[i], s) == 0) {
+         return i;
+      }
+   }
+   i = (int)strtol(s, NULL, 0);
+   return (i >= 0 && i < 256) ? i : -1;
+}
+
+static const uint8_t *mapFile(const char *pPath, uint64_t *pSize) {
+   struct stat st;
+   void *p;
+   int fd = open(pPath, O_RDONLY);
+
+   if (fd < 0 || fstat(fd, &st) != 0) {
+      perror(pPath);
+      exit(1);
+   }
+   *pSize = (uint64_t)st.st_size;
+   if (st.st_size == 0) {
+      close(fd);
+      return (const uint8_t *)"";
+   }
+   p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (p == MAP_FAILED) {
+      perror(pPath);
+      exit(1);
+   }
+   madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+   return (const uint8_t *)p;
+}
+
+/*
+ * Decoding
+ */
+
+typedef struct T_FrameList {
+   T_CapFrame *pFrames;
+   uint64_t count;
+   uint64_t capacity;
+} T_FrameList;
+
+static void reserveFrames(T_FrameList *pList, uint64_t count) {
+   if (pList->count + count > pList->capacity) {
+      while (pList->count + count > pList->capacity) {
+         pList->capacity = (pList->capacity == 0) ? 4096 : pList->capacity * 2;
+      }
+      pList->pFrames = checkedRealloc(pList->pFrames, pList->capacity * sizeof(T_CapFrame));
+   }
+}
+
+static void addFrame(T_FrameList *pList, const T_CapFrame *pFrame) {
+   reserveFrames(pList, 1);
+   pList->pFrames[pList->count++] = *pFrame;
+}
+
+// Takes the next byte of a packet, undoing an escape.  FALSE at the end.
+static inline int takeByte(const uint8_t *p, uint64_t length, uint64_t *pPos, uint8_t *pByte, uint8_t *pEscapes) {
+   if (*pPos >= length) {
+      return 0;
+   }
+   if (p[*pPos] == ESC) {
+      if (*pPos + 1 >= length) {
+         return 0;
+      }
+      (*pPos)++;
+      (*pEscapes)++;
+   }
+   *pByte = p[(*pPos)++];
+   return 1;
+}
+
+/*
+ * crc_update a byte at a time is the cost of decoding.  These tables come
+ * from crc_update itself: crcTables[k][i] is the register after k zero
+ * bytes, starting from i in the top byte.  The CRC is linear, so four bytes
+ * take four independent lookups.
+ */
+static uint16_t crcTables[5][256];
+
+static void initCrcTables(void) {
+   static const uint8_t zeros[4];
+   uint32_t k;
+   uint32_t i;
+
+   for (k = 1; k <= 4; k++) {
+      for (i = 0; i < 256; i++) {
+         crcTables[k][i] = (uint16_t)crc_update((crc_t)(i << 8), zeros, k);
+      }
+   }
+}
+
+static inline crc_t crcFast(crc_t crc, const uint8_t *p, uint64_t n) {
+   while (n >= 4) {
+      uint32_t x = (uint32_t)crc ^ ((uint32_t)p[0] << 8) ^ p[1];
+
+      crc = crcTables[4][x >> 8] ^ crcTables[3][x & 0xff] ^ crcTables[2][p[2]] ^ crcTables[1][p[3]];
+      p += 4;
+      n -= 4;
+   }
+   while (n-- > 0) {
+      crc = crcTables[1][((crc >> 8) ^ *p++) & 0xff] ^ ((crc << 8) & 0xffff);
+   }
+   return crc;
+}
+
+// Decodes the frames that start in [from, until) of a stream, looking for an
+// STX from 'from' on, and returns where the decoder stopped.
+static uint64_t decodeRange(const uint8_t *p, uint64_t length, uint64_t from, uint64_t until,
+                            uint8_t flags, T_FrameList *pList) {
+   uint64_t pos = from;
+   uint8_t packet[CHILLHUB_BUFFER_SIZE];
+
+   while (pos < until) {
+      // frames mostly follow one another, so look before calling memchr
+      const uint8_t *pStx = (p[pos] == STX) ? &p[pos] : memchr(&p[pos], STX, (size_t)(until - pos));
+      const uint8_t *pPacket = packet;
+      T_CapFrame frame;
+      uint8_t escapes = 0;
+      uint8_t packetLength;
+      uint8_t i;
+      uint8_t ok = 1;
+
+      if (pStx == NULL) {
+         return until;
+      }
+      frame.offset = (uint64_t)(pStx - p);
+      frame.timeMs = 0;
+      frame.msgType = 0;
+      frame.dataType = noDataType;
+      frame.flags = flags;
+      pos = frame.offset + 1;
+
+      if (!takeByte(p, length, &pos, &packetLength, &escapes)) {
+         ok = 0;
+      } else if (packetLength >= CAP_MAX_PACKET) {
+         frame.flags |= CAP_FLAG_OVERSIZE;
+      } else if (packetLength < 3) {
+         // chillhub.c turns these away at the length, like oversize ones
+         frame.flags |= CAP_FLAG_SHORT;
+      } else if ((pos + packetLength + 2 <= length) && (memchr(&p[pos], ESC, packetLength + 2) == NULL)) {
+         // nothing escaped, so the packet is checked where it lies
+         pPacket = &p[pos];
+         pos += packetLength + 2;
+      } else {
+         for (i = 0; i < packetLength + 2; i++) {
+            if (!takeByte(p, length, &pos, &packet[i], &escapes)) {
+               ok = 0;
+               break;
+            }
+         }
+      }
+
+      if (!ok) {
+         frame.flags |= CAP_FLAG_TRUNCATED;
+         pos = length;
+      } else if (!(frame.flags & (CAP_FLAG_OVERSIZE | CAP_FLAG_SHORT))) {
+         crc_t crc = crcFast(crc_init(), pPacket, packetLength);
+
+         if (crc == (crc_t)((pPacket[packetLength] << 8) | pPacket[packetLength + 1])) {
+            frame.flags |= CAP_FLAG_CRC_OK;
+         }
+         frame.msgType = pPacket[1];
+         frame.dataType = pPacket[2];
+      }
+      frame.wireLength = (uint8_t)(pos - frame.offset);
+      CAP_SET_ESCAPES(&frame, escapes);
+      addFrame(pList, &frame);
+   }
+   return pos;
+}
+
+typedef struct T_Piece {
+   pthread_t thread;
+   const uint8_t *pStream;
+   uint64_t length;
+   uint64_t from;
+   uint64_t until;               // frames starting before this are the piece's
+   uint64_t stop;                // then on to here, to meet the next piece
+   uint8_t flags;
+   T_FrameList list;
+} T_Piece;
+
+static void *decodePiece(void *pArg) {
+   T_Piece *pPiece = (T_Piece *)pArg;
+
+   decodeRange(pPiece->pStream, pPiece->length, pPiece->from, pPiece->stop, pPiece->flags, &pPiece->list);
+   return NULL;
+}
+
+// All frames of a stream, in order, decoded by up to threadCount threads.
+static void decodeStream(const uint8_t *pStream, uint64_t length, uint8_t flags, uint32_t threadCount,
+                         T_FrameList *pOut) {
+   T_Piece *pPieces;
+   uint64_t pieceBytes;
+   uint32_t i;
+
+   if (length / threadCount < 4 * OVERLAP_BYTES) {
+      threadCount = 1;
+   }
+   pieceBytes = length / threadCount;
+   pPieces = calloc(threadCount, sizeof(T_Piece));
+   if (pPieces == NULL) {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+   }
+   for (i = 0; i < threadCount; i++) {
+      pPieces[i].pStream = pStream;
+      pPieces[i].length = length;
+      pPieces[i].from = pieceBytes * i;
+      pPieces[i].until = (i + 1 == threadCount) ? length : pieceBytes * (i + 1);
+      pPieces[i].stop = pPieces[i].until + ((i + 1 == threadCount) ? 0 : OVERLAP_BYTES);
+      pPieces[i].flags = flags;
+      pthread_create(&pPieces[i].thread, NULL, decodePiece, &pPieces[i]);
+   }
+
+   memset(pOut, 0, sizeof(*pOut));
+   for (i = 0; i < threadCount; i++) {
+      pthread_join(pPieces[i].thread, NULL);
+   }
+
+   for (i = 0; i < threadCount; i++) {
+      T_FrameList *pList = &pPieces[i].list;
+      uint64_t take = pList->count;
+
+      if (i + 1 < threadCount) {
+         T_FrameList *pNext = &pPieces[i + 1].list;
+         uint64_t a = 0;
+         uint64_t b = 0;
+
+         // the first frame both found; from there on they agree
+         while (a < pList->count && b < pNext->count &&
+                CAP_OFFSET(&pList->pFrames[a]) != CAP_OFFSET(&pNext->pFrames[b])) {
+            if (CAP_OFFSET(&pList->pFrames[a]) < CAP_OFFSET(&pNext->pFrames[b])) {
+               a++;
+            } else {
+               b++;
+            }
+         }
+         if (a < pList->count && b < pNext->count) {
+            take = a;
+            memmove(pNext->pFrames, &pNext->pFrames[b], (pNext->count - b) * sizeof(T_CapFrame));
+            pNext->count -= b;
+         } else {
+            // no meeting point in the overlap: decode the next piece again
+            // from where this one stopped
+            uint64_t resume = (pList->count > 0) ?
+               CAP_OFFSET(&pList->pFrames[pList->count - 1]) + pList->pFrames[pList->count - 1].wireLength :
+               pPieces[i].from;
+
+            pNext->count = 0;
+            decodeRange(pStream, length, resume, pPieces[i + 1].stop, flags, pNext);
+         }
+      }
+      reserveFrames(pOut, take);
+      memcpy(&pOut->pFrames[pOut->count], pList->pFrames, take * sizeof(T_CapFrame));
+      pOut->count += take;
+      free(pList->pFrames);
+   }
+   free(pPieces);
+}
+
+/*
+ * Building a capture
+ */
+
+typedef struct T_TimeList {
+   T_CapTime *pTimes;
+   uint64_t count;
+   uint64_t capacity;
+} T_TimeList;
+
+static void addTime(T_TimeList *pList, uint64_t streamOffset, uint64_t timeUs) {
+   if (pList->count > 0 && pList->pTimes[pList->count - 1].timeUs == timeUs) {
+      return;
+   }
+   if (pList->count == pList->capacity) {
+      pList->capacity = (pList->capacity == 0) ? 4096 : pList->capacity * 2;
+      pList->pTimes = checkedRealloc(pList->pTimes, pList->capacity * sizeof(T_CapTime));
+   }
+   pList->pTimes[pList->count].streamOffset = streamOffset;
+   pList->pTimes[pList->count].timeUs = timeUs;
+   pList->count++;
+}
+
+static void writeOrDie(FILE *f, const void *p, uint64_t length) {
+   if (length > 0 && fwrite(p, 1, (size_t)length, f) != length) {
+      perror("write");
+      exit(1);
+   }
+}
+
+static void padTo(FILE *f, uint64_t alignment) {
+   static const uint8_t zeros[CAP_ALIGN];
+   uint64_t pos = (uint64_t)ftello(f);
+
+   writeOrDie(f, zeros, (alignment - (pos % alignment)) % alignment);
+}
+
+// Every frame gets the time of the first byte of the read it arrived in.
+static void timeFrames(T_FrameList *pList, const T_CapTime *pTimes, uint64_t timeCount, uint64_t bytesPerSecond) {
+   uint64_t k = 0;
+   uint64_t i;
+
+   for (i = 0; i < pList->count; i++) {
+      T_CapFrame *pFrame = &pList->pFrames[i];
+      uint64_t us;
+
+      if (timeCount == 0) {
+         us = (uint64_t)((double)CAP_OFFSET(pFrame) * 1e6 / bytesPerSecond);
+      } else {
+         while (k + 1 < timeCount && pTimes[k + 1].streamOffset <= CAP_OFFSET(pFrame)) {
+            k++;
+         }
+         us = pTimes[k].timeUs;
+      }
+      pFrame->timeMs = (us / 1000 > 0xffffffffULL) ? 0xffffffffUL : (uint32_t)(us / 1000);
+   }
+}
+
+static int byTime(const void *pA, const void *pB) {
+   const T_CapFrame *a = (const T_CapFrame *)pA;
+   const T_CapFrame *b = (const T_CapFrame *)pB;
+
+   if (a->timeMs != b->timeMs) {
+      return (a->timeMs < b->timeMs) ? -1 : 1;
+   }
+   return (CAP_OFFSET(a) < CAP_OFFSET(b)) ? -1 : (CAP_OFFSET(a) > CAP_OFFSET(b));
+}
+
+static void sortByTime(T_FrameList *pList) {
+   uint64_t i;
+
+   for (i = 1; i < pList->count; i++) {
+      if (pList->pFrames[i].timeMs < pList->pFrames[i - 1].timeMs) {
+         qsort(pList->pFrames, pList->count, sizeof(T_CapFrame), byTime);
+         return;
+      }
+   }
+}
+
+// Walks the frames of both streams by time, received first on a tie.
+typedef struct T_Merge {
+   const T_FrameList *pLists;
+   uint64_t next[2];
+} T_Merge;
+
+static const T_CapFrame *nextFrame(T_Merge *pMerge) {
+   const T_FrameList *pRx = &pMerge->pLists[CAP_RX];
+   const T_FrameList *pTx = &pMerge->pLists[CAP_TX];
+   uint8_t direction;
+
+   if (pMerge->next[CAP_RX] == pRx->count && pMerge->next[CAP_TX] == pTx->count) {
+      return NULL;
+   }
+   if (pMerge->next[CAP_RX] == pRx->count) {
+      direction = CAP_TX;
+   } else if (pMerge->next[CAP_TX] == pTx->count) {
+      direction = CAP_RX;
+   } else {
+      direction = (pTx->pFrames[pMerge->next[CAP_TX]].timeMs < pRx->pFrames[pMerge->next[CAP_RX]].timeMs) ?
+                  CAP_TX : CAP_RX;
+   }
+   return &pMerge->pLists[direction].pFrames[pMerge->next[direction]++];
+}
+
+static int isTyped(const T_CapFrame *pFrame) {
+   return (pFrame->flags & (CAP_FLAG_OVERSIZE | CAP_FLAG_TRUNCATED | CAP_FLAG_SHORT)) == 0;
+}
+
+static int build(const char *pIn, const char *pOut, uint32_t baud, uint8_t rawDirection, uint32_t threadCount) {
+   uint64_t inSize;
+   const uint8_t *pIn8 = mapFile(pIn, &inSize);
+   int isPcap = (inSize >= 24) && (*(const uint32_t *)pIn8 == PCAP_MAGIC);
+   T_CapHeader header;
+   T_TimeList times[2];
+   T_FrameList lists[2];
+   T_CapType types[256];
+   T_Merge merge;
+   const T_CapFrame *pFrame;
+   uint32_t *pPostings;
+   uint64_t fill[256];
+   uint64_t postingCount = 0;
+   uint64_t n;
+   const uint8_t *pMapped;
+   uint64_t mappedSize;
+   double start = wallNow();
+   double decodeSeconds;
+   FILE *f;
+   uint8_t direction;
+   uint32_t i;
+
+   if (isPcap && *(const uint32_t *)&pIn8[20] != PCAP_LINKTYPE_USER0) {
+      fprintf(stderr, "%s is not a tracecap pcap\n", pIn);
+      return 1;
+   }
+   f = fopen(pOut, "wb+");
+   if (f == NULL) {
+      perror(pOut);
+      return 1;
+   }
+
+   memset(&header, 0, sizeof(header));
+   memset(times, 0, sizeof(times));
+   header.headerSize = sizeof(header);
+   header.bytesPerSecond = baud / 10;
+   // room for the header, written at the end
+   writeOrDie(f, &header, sizeof(header));
+   padTo(f, CAP_ALIGN);
+
+   // the streams, one after the other
+   for (direction = CAP_RX; direction <= CAP_TX; direction++) {
+      header.streamOffset[direction] = (uint64_t)ftello(f);
+      if (isPcap) {
+         uint64_t pos = 24;
+
+         while (pos + 16 <= inSize) {
+            const uint32_t *pRecord = (const uint32_t *)&pIn8[pos];
+            uint32_t length = pRecord[2];
+
+            if (pos + 16 + length > inSize) {
+               fprintf(stderr, "truncated pcap file\n");
+               break;
+            }
+            if (length > 1 && pIn8[pos + 16] == direction) {
+               addTime(&times[direction], header.streamLength[direction],
+                       (uint64_t)pRecord[0] * 1000000 + pRecord[1]);
+               writeOrDie(f, &pIn8[pos + 17], length - 1);
+               header.streamLength[direction] += length - 1;
+            }
+            pos += 16 + length;
+         }
+      } else if (direction == rawDirection) {
+         writeOrDie(f, pIn8, inSize);
+         header.streamLength[direction] = inSize;
+      }
+      padTo(f, 8);
+   }
+   for (direction = CAP_RX; direction <= CAP_TX; direction++) {
+      header.timeOffset[direction] = (uint64_t)ftello(f);
+      header.timeCount[direction] = times[direction].count;
+      writeOrDie(f, times[direction].pTimes, times[direction].count * sizeof(T_CapTime));
+   }
+   padTo(f, 8);
+   fflush(f);
+
+   // decode the streams from the file
+   mappedSize = (uint64_t)ftello(f);
+   pMapped = mmap(NULL, (size_t)mappedSize, PROT_READ, MAP_SHARED, fileno(f), 0);
+   if (pMapped == MAP_FAILED) {
+      perror(pOut);
+      return 1;
+   }
+   decodeSeconds = wallNow();
+   for (direction = CAP_RX; direction <= CAP_TX; direction++) {
+      decodeStream(&pMapped[header.streamOffset[direction]], header.streamLength[direction],
+                   (direction == CAP_TX) ? CAP_FLAG_TX : 0, threadCount, &lists[direction]);
+      timeFrames(&lists[direction], times[direction].pTimes, times[direction].count, header.bytesPerSecond);
+      sortByTime(&lists[direction]);
+      free(times[direction].pTimes);
+   }
+   decodeSeconds = wallNow() - decodeSeconds;
+   header.frameCount = lists[CAP_RX].count + lists[CAP_TX].count;
+   if (header.frameCount > 0xffffffffULL) {
+      fprintf(stderr, "more frames than the index can number\n");
+      return 1;
+   }
+
+   // the index, counting the types on the way
+   memset(types, 0, sizeof(types));
+   header.frameOffset = (uint64_t)ftello(f);
+   memset(&merge, 0, sizeof(merge));
+   merge.pLists = lists;
+   while ((pFrame = nextFrame(&merge)) != NULL) {
+      writeOrDie(f, pFrame, sizeof(*pFrame));
+      if (isTyped(pFrame)) {
+         T_CapType *pType = &types[pFrame->msgType];
+
+         pType->frames++;
+         pType->txFrames += (pFrame->flags & CAP_FLAG_TX) != 0;
+         pType->crcFailures += (pFrame->flags & CAP_FLAG_CRC_OK) == 0;
+         pType->wireBytes += pFrame->wireLength;
+         pType->escapes += CAP_ESCAPES(pFrame);
+      } else {
+         header.oversizeFrames += (pFrame->flags & CAP_FLAG_OVERSIZE) != 0;
+         header.truncatedFrames += (pFrame->flags & CAP_FLAG_TRUNCATED) != 0;
+         header.shortFrames += (pFrame->flags & CAP_FLAG_SHORT) != 0;
+      }
+   }
+
+   // and the frame numbers of each type, in a second walk
+   for (i = 0; i < 256; i++) {
+      types[i].firstPosting = postingCount;
+      fill[i] = postingCount;
+      postingCount += types[i].frames;
+   }
+   pPostings = checkedRealloc(NULL, (postingCount + 1) * sizeof(uint32_t));
+   memset(&merge, 0, sizeof(merge));
+   merge.pLists = lists;
+   for (n = 0; (pFrame = nextFrame(&merge)) != NULL; n++) {
+      if (isTyped(pFrame)) {
+         pPostings[fill[pFrame->msgType]++] = (uint32_t)n;
+      }
+   }
+   header.typeOffset = (uint64_t)ftello(f);
+   writeOrDie(f, types, sizeof(types));
+   header.postingOffset = (uint64_t)ftello(f);
+   writeOrDie(f, pPostings, postingCount * sizeof(uint32_t));
+   free(pPostings);
+
+   // the header goes in last, so a capture cut short is not taken for one
+   memcpy(header.magic, CAP_MAGIC, sizeof(header.magic));
+   header.version = CAP_VERSION;
+   if (fseeko(f, 0, SEEK_SET) != 0) {
+      perror(pOut);
+      return 1;
+   }
+   writeOrDie(f, &header, sizeof(header));
+   if (fclose(f) != 0) {
+      perror(pOut);
+      return 1;
+   }
+   munmap((void *)pMapped, (size_t)mappedSize);
+   free(lists[CAP_RX].pFrames);
+   free(lists[CAP_TX].pFrames);
+
+   printf("%llu frames from %.1f MB %s in %.2f s, decoded at %.0f MB/s\n",
+          (unsigned long long)header.frameCount,
+          (header.streamLength[CAP_RX] + header.streamLength[CAP_TX]) / 1e6,
+          isPcap ? "of pcap" : "raw", wallNow() - start,
+          (header.streamLength[CAP_RX] + header.streamLength[CAP_TX]) / 1e6 / decodeSeconds);
+   return 0;
+}
+
+/*
+ * Reading a capture
+ */
+
+static int inFile(const T_Capture *pCapture, uint64_t offset, uint64_t length) {
+   return (offset <= pCapture->size) && (length <= pCapture->size - offset);
+}
+
+static void openCapture(const char *pPath, T_Capture *pCapture) {
+   const T_CapHeader *pHeader;
+   uint8_t direction;
+
+   pCapture->pBase = mapFile(pPath, &pCapture->size);
+   pHeader = (const T_CapHeader *)pCapture->pBase;
+   if (pCapture->size < sizeof(T_CapHeader) || memcmp(pHeader->magic, CAP_MAGIC, sizeof(pHeader->magic)) != 0 ||
+       pHeader->version != CAP_VERSION || pHeader->headerSize != sizeof(T_CapHeader)) {
+      fprintf(stderr, "%s is not a complete capture\n", pPath);
+      exit(1);
+   }
+   for (direction = CAP_RX; direction <= CAP_TX; direction++) {
+      if (!inFile(pCapture, pHeader->streamOffset[direction], pHeader->streamLength[direction]) ||
+          !inFile(pCapture, pHeader->timeOffset[direction], pHeader->timeCount[direction] * sizeof(T_CapTime))) {
+         fprintf(stderr, "%s is damaged\n", pPath);
+         exit(1);
+      }
+      pCapture->pStream[direction] = &pCapture->pBase[pHeader->streamOffset[direction]];
+      pCapture->pTimes[direction] = (const T_CapTime *)&pCapture->pBase[pHeader->timeOffset[direction]];
+   }
+   if (!inFile(pCapture, pHeader->frameOffset, pHeader->frameCount * sizeof(T_CapFrame)) ||
+       !inFile(pCapture, pHeader->typeOffset, 256 * sizeof(T_CapType))) {
+      fprintf(stderr, "%s is damaged\n", pPath);
+      exit(1);
+   }
+   pCapture->pHeader = pHeader;
+   pCapture->pFrames = (const T_CapFrame *)&pCapture->pBase[pHeader->frameOffset];
+   pCapture->pTypes = (const T_CapType *)&pCapture->pBase[pHeader->typeOffset];
+   pCapture->pPostings = (const uint32_t *)&pCapture->pBase[pHeader->postingOffset];
+   if (!inFile(pCapture, pHeader->postingOffset,
+               (pCapture->pTypes[255].firstPosting + pCapture->pTypes[255].frames) * sizeof(uint32_t))) {
+      fprintf(stderr, "%s is damaged\n", pPath);
+      exit(1);
+   }
+}
+
+// The packet of a frame, length byte first, de-escaped.  Returns its length.
+static uint8_t framePacket(const T_Capture *pCapture, const T_CapFrame *pFrame, uint8_t *pPacket) {
+   const uint8_t *p = pCapture->pStream[(pFrame->flags & CAP_FLAG_TX) ? CAP_TX : CAP_RX];
+   uint64_t end = CAP_OFFSET(pFrame) + pFrame->wireLength;
+   uint64_t pos = CAP_OFFSET(pFrame) + 1;
+   uint8_t escapes = 0;
+   uint8_t length = 0;
+
+   while (length < CHILLHUB_BUFFER_SIZE + 1 && takeByte(p, end, &pos, &pPacket[length], &escapes)) {
+      length++;
+   }
+   return length;
+}
+
+static int stats(const char *pPath) {
+   T_Capture capture;
+   const T_CapHeader *pHeader;
+   uint64_t frames = 0;
+   uint64_t crcFailures = 0;
+   uint64_t bytes = 0;
+   char name[8];
+   uint32_t i;
+
+   openCapture(pPath, &capture);
+   pHeader = capture.pHeader;
+
+   printf("%-42s %10s %10s %10s %8s %12s %10s\n", "message type", "frames", "rx", "tx", "bad crc", "bytes", "escapes");
+   for (i = 0; i < 256; i++) {
+      const T_CapType *pType = &capture.pTypes[i];
+
+      if (pType->frames == 0) {
+         continue;
+      }
+      printf("%-42s %10llu %10llu %10llu %8llu %12llu %10llu\n", typeName((uint8_t)i, name),
+             (unsigned long long)pType->frames, (unsigned long long)(pType->frames - pType->txFrames),
+             (unsigned long long)pType->txFrames, (unsigned long long)pType->crcFailures,
+             (unsigned long long)pType->wireBytes, (unsigned long long)pType->escapes);
+      frames += pType->frames;
+      crcFailures += pType->crcFailures;
+      bytes += pType->wireBytes;
+   }
+   printf("%-42s %10llu %10s %10s %8llu %12llu\n", "all", (unsigned long long)frames, "", "",
+          (unsigned long long)crcFailures, (unsigned long long)bytes);
+   printf("%llu oversize, %llu short and %llu truncated frames; %llu bytes received and %llu sent",
+          (unsigned long long)pHeader->oversizeFrames, (unsigned long long)pHeader->shortFrames,
+          (unsigned long long)pHeader->truncatedFrames, (unsigned long long)pHeader->streamLength[CAP_RX],
+          (unsigned long long)pHeader->streamLength[CAP_TX]);
+   if (pHeader->frameCount > 0) {
+      printf(" over %.3f s", (capture.pFrames[pHeader->frameCount - 1].timeMs - capture.pFrames[0].timeMs) / 1000.0);
+   }
+   printf("\n");
+   return 0;
+}
+
+// The first of count entries whose time is at least timeMs; pIndex, if
+// given, picks the frames the entries stand for.
+static uint64_t lowerBound(const T_Capture *pCapture, const uint32_t *pIndex, uint64_t count, uint32_t timeMs) {
+   uint64_t low = 0;
+   uint64_t high = count;
+
+   while (low < high) {
+      uint64_t mid = low + (high - low) / 2;
+      uint64_t frame = (pIndex != NULL) ? pIndex[mid] : mid;
+
+      if (pCapture->pFrames[frame].timeMs < timeMs) {
+         low = mid + 1;
+      } else {
+         high = mid;
+      }
+   }
+   return low;
+}
+
+static void printFrame(const T_Capture *pCapture, const T_CapFrame *pFrame, int withBytes) {
+   uint8_t packet[CHILLHUB_BUFFER_SIZE + 1];
+   char name[8];
+   uint8_t length = framePacket(pCapture, pFrame, packet);
+   uint8_t i;
+
+   printf("%12.3f %s ", pFrame->timeMs / 1000.0, directionNames[(pFrame->flags & CAP_FLAG_TX) ? CAP_TX : CAP_RX]);
+   if (pFrame->flags & CAP_FLAG_OVERSIZE) {
+      printf("oversize, length %u", packet[0]);
+   } else if (pFrame->flags & CAP_FLAG_TRUNCATED) {
+      printf("truncated");
+   } else if (pFrame->flags & CAP_FLAG_SHORT) {
+      printf("short, length %u", packet[0]);
+   } else {
+      printf("%-42s %-18s", typeName(pFrame->msgType, name),
+             (dataTypeNames[pFrame->dataType] != NULL) ? dataTypeNames[pFrame->dataType] : "?");
+   }
+   printf(" %3u bytes %2u escapes%s", pFrame->wireLength, CAP_ESCAPES(pFrame),
+          ((pFrame->flags & CAP_FLAG_CRC_OK) || !isTyped(pFrame)) ? "" : " BAD CRC");
+   if (withBytes) {
+      printf(" ");
+      for (i = 2; i + 2 < length; i++) {
+         printf(" %02x", packet[i]);
+      }
+   }
+   printf("\n");
+}
+
+static int list(const char *pPath, double fromSeconds, double untilSeconds, int msgType, uint64_t limit, int withBytes) {
+   T_Capture capture;
+   uint32_t fromMs = (fromSeconds <= 0) ? 0 : (uint32_t)(fromSeconds * 1000);
+   uint32_t untilMs = (untilSeconds < 0 || untilSeconds * 1000 > 0xffffffffUL) ? 0xffffffffUL : (uint32_t)(untilSeconds * 1000);
+   uint64_t shown = 0;
+
+   openCapture(pPath, &capture);
+
+   if (msgType >= 0) {
+      const T_CapType *pType = &capture.pTypes[msgType];
+      const uint32_t *pRun = &capture.pPostings[pType->firstPosting];
+      uint64_t i;
+
+      for (i = lowerBound(&capture, pRun, pType->frames, fromMs); i < pType->frames && shown < limit; i++, shown++) {
+         const T_CapFrame *pFrame = &capture.pFrames[pRun[i]];
+
+         if (pFrame->timeMs >= untilMs) {
+            break;
+         }
+         printFrame(&capture, pFrame, withBytes);
+      }
+   } else {
+      uint64_t i;
+
+      for (i = lowerBound(&capture, NULL, capture.pHeader->frameCount, fromMs);
+           i < capture.pHeader->frameCount && shown < limit; i++, shown++) {
+         if (capture.pFrames[i].timeMs >= untilMs) {
+            break;
+         }
+         printFrame(&capture, &capture.pFrames[i], withBytes);
+      }
+   }
+   return 0;
+}
+
+static volatile uint8_t readSink;
+
+// Decodes the streams again, without the index, and checks the result
+// against it.
+static int scan(const char *pPath, uint32_t threadCount) {
+   T_Capture capture;
+   T_FrameList lists[2];
+   T_CapType types[256];
+   uint64_t frames = 0;
+   uint64_t bytes;
+   static uint8_t buf[1 << 20];
+   double readSeconds;
+   double decodeSeconds;
+   ssize_t n;
+   uint8_t direction;
+   uint64_t i;
+   int mismatches = 0;
+   int fd;
+
+   // what the file system gives, as the yardstick
+   readSeconds = wallNow();
+   fd = open(pPath, O_RDONLY);
+   if (fd < 0) {
+      perror(pPath);
+      return 1;
+   }
+   while ((n = read(fd, buf, sizeof(buf))) > 0) {
+      for (i = 0; i < (uint64_t)n; i += 4096) {
+         readSink += buf[i];
+      }
+   }
+   close(fd);
+   readSeconds = wallNow() - readSeconds;
+
+   decodeSeconds = wallNow();
+   openCapture(pPath, &capture);
+   bytes = capture.pHeader->streamLength[CAP_RX] + capture.pHeader->streamLength[CAP_TX];
+   memset(types, 0, sizeof(types));
+   for (direction = CAP_RX; direction <= CAP_TX; direction++) {
+      decodeStream(capture.pStream[direction], capture.pHeader->streamLength[direction],
+                   (direction == CAP_TX) ? CAP_FLAG_TX : 0, threadCount, &lists[direction]);
+      for (i = 0; i < lists[direction].count; i++) {
+         const T_CapFrame *pFrame = &lists[direction].pFrames[i];
+
+         if (isTyped(pFrame)) {
+            types[pFrame->msgType].frames++;
+            types[pFrame->msgType].crcFailures += (pFrame->flags & CAP_FLAG_CRC_OK) == 0;
+            types[pFrame->msgType].wireBytes += pFrame->wireLength;
+         }
+      }
+      frames += lists[direction].count;
+   }
+   decodeSeconds = wallNow() - decodeSeconds;
+
+   if (frames != capture.pHeader->frameCount) {
+      fprintf(stderr, "%llu frames decoded, the index has %llu\n", (unsigned long long)frames,
+              (unsigned long long)capture.pHeader->frameCount);
+      mismatches++;
+   }
+   for (i = 0; i < 256; i++) {
+      if (types[i].frames != capture.pTypes[i].frames || types[i].crcFailures != capture.pTypes[i].crcFailures ||
+          types[i].wireBytes != capture.pTypes[i].wireBytes) {
+         char name[8];
+         fprintf(stderr, "%s differs from the index\n", typeName((uint8_t)i, name));
+         mismatches++;
+      }
+   }
+   free(lists[CAP_RX].pFrames);
+   free(lists[CAP_TX].pFrames);
+
+   printf("%llu frames from %.1f MB of streams in %.3f s: %.0f MB/s, %.1f M frames/s; "
+          "reading the %.1f MB file: %.0f MB/s\n",
+          (unsigned long long)frames, bytes / 1e6, decodeSeconds, bytes / 1e6 / decodeSeconds,
+          frames / 1e6 / decodeSeconds, capture.size / 1e6, capture.size / 1e6 / readSeconds);
+   return (mismatches == 0) ? 0 : 1;
+}
+
+/*
+ * Checking against chillhub.c
+ */
+
+typedef struct T_VerifyFeed {
+   const uint8_t *pData;
+   uint64_t length;
+   uint64_t pos;
+   uint64_t frames;
+   uint64_t overlong;   // frames handed over as longer than the receive buffer
+   uint64_t hash;
+} T_VerifyFeed;
+
+static T_VerifyFeed *pFeed;
+
+static void feedWrite(const uint8 wrBuf[], uint32 count) {
+   (void)wrBuf;
+   (void)count;
+}
+
+static uint32 feedAvailable(void) {
+   return (pFeed->length - pFeed->pos > 0xffffffffULL) ? 0xffffffffUL : (uint32)(pFeed->length - pFeed->pos);
+}
+
+static uint32 feedRead(void) {
+   return pFeed->pData[pFeed->pos++];
+}
+
+static void feedPrint(const char8 string[]) {
+   (void)string;
+}
+
+static const T_Serial feedSerial = { feedWrite, feedAvailable, feedRead, feedPrint };
+
+static uint64_t hashBytes(uint64_t hash, const uint8_t *p, uint8_t length) {
+   uint8_t i;
+
+   hash = (hash ^ length) * 1099511628211ULL;
+   for (i = 0; i < length; i++) {
+      hash = (hash ^ p[i]) * 1099511628211ULL;
+   }
+   return hash;
+}
+
+static void verifyFrame(T_ChillHubCB *pControlBlock, const uint8_t *pMsg, uint8_t length) {
+   (void)pControlBlock;
+   pFeed->frames++;
+   if (length > CHILLHUB_BUFFER_SIZE) {
+      pFeed->overlong++;
+      return;
+   }
+   pFeed->hash = hashBytes(pFeed->hash, pMsg, length);
+}
+
+// Every frame with a good CRC, message type first, should be what the
+// firmware's decoder hands its frame hook, in the same order.
+static int verify(const char *pPath) {
+   T_Capture capture;
+   int failures = 0;
+   uint8_t direction;
+
+   openCapture(pPath, &capture);
+   for (direction = CAP_RX; direction <= CAP_TX; direction++) {
+      T_VerifyFeed feed;
+      T_ChillHubCB *pHub = calloc(1, sizeof(T_ChillHubCB));
+      uint64_t frames = 0;
+      uint64_t hash = 14695981039346656037ULL;
+      uint64_t crcFailures = 0;
+      uint64_t oversize = 0;
+      uint64_t i;
+      double seconds = wallNow();
+
+      if (pHub == NULL) {
+         fprintf(stderr, "out of memory\n");
+         return 1;
+      }
+      memset(&feed, 0, sizeof(feed));
+      feed.pData = capture.pStream[direction];
+      feed.length = capture.pHeader->streamLength[direction];
+      feed.hash = hash;
+      pFeed = &feed;
+      ChillHub_Init(pHub);
+      ChillHub_Setup(pHub, "chcap", "verify", &feedSerial);
+      ChillHub_SetFrameHook(pHub, verifyFrame, NULL);
+      do {
+         ChillHub_Loop(pHub);
+      } while (feed.pos < feed.length || !ChillHub_IsIdle(pHub));
+      seconds = wallNow() - seconds;
+
+      for (i = 0; i < capture.pHeader->frameCount; i++) {
+         const T_CapFrame *pFrame = &capture.pFrames[i];
+         uint8_t packet[CHILLHUB_BUFFER_SIZE + 1];
+
+         if (((pFrame->flags & CAP_FLAG_TX) != 0) != (direction == CAP_TX)) {
+            continue;
+         }
+         oversize += (pFrame->flags & CAP_FLAG_OVERSIZE) != 0;
+         if (pFrame->flags & (CAP_FLAG_OVERSIZE | CAP_FLAG_TRUNCATED | CAP_FLAG_SHORT)) {
+            continue;
+         }
+         if (!(pFrame->flags & CAP_FLAG_CRC_OK)) {
+            crcFailures++;
+            continue;
+         }
+         framePacket(&capture, pFrame, packet);
+         frames++;
+         hash = hashBytes(hash, &packet[2], (uint8_t)(packet[0] - 1));
+      }
+
+      printf("%s: chillhub.c found %llu frames, %lu CRC failures, %lu oversize at %.1f MB/s; the index %llu, %llu, %llu%s\n",
+             directionNames[direction], (unsigned long long)feed.frames,
+             (unsigned long)ChillHub_GetStats(pHub)->crcFailures, (unsigned long)ChillHub_GetStats(pHub)->oversizeFrames,
+             feed.length / 1e6 / seconds, (unsigned long long)frames, (unsigned long long)crcFailures,
+             (unsigned long long)oversize,
+             (feed.frames == frames && feed.overlong == 0 && feed.hash == hash &&
+              ChillHub_GetStats(pHub)->crcFailures == crcFailures &&
+              ChillHub_GetStats(pHub)->oversizeFrames == oversize) ? "" : " MISMATCH");
+      if (feed.frames != frames || feed.overlong != 0 || feed.hash != hash ||
+          ChillHub_GetStats(pHub)->crcFailures != crcFailures ||
+          ChillHub_GetStats(pHub)->oversizeFrames != oversize) {
+         failures++;
+      }
+      free(pHub);
+   }
+   return (failures == 0) ? 0 : 1;
+}
+
+/*
+ * A synthetic session
+ */
+
+static uint32_t seed = 12345;
+
+static uint32_t nextRandom(void) {
+   seed = seed * 1103515245UL + 12345UL;
+   return seed >> 8;
+}
+
+static uint8_t putEscaped(uint8_t *pOut, uint8_t b) {
+   uint8_t n = 0;
+
+   if (b == STX || b == ESC) {
+      pOut[n++] = ESC;
+   }
+   pOut[n++] = b;
+   return n;
+}
+
+// Frames a message (message type, data type, data...) like sendPacket.
+static uint32_t frameMessage(uint8_t *pOut, const uint8_t *pMsg, uint8_t length) {
+   uint8_t body[CHILLHUB_BUFFER_SIZE];
+   uint32_t n = 0;
+   crc_t crc;
+   uint8_t i;
+
+   body[0] = length;
+   memcpy(&body[1], pMsg, length);
+   crc = crc_finalize(crc_update(crc_init(), body, length + 1));
+
+   pOut[n++] = STX;
+   n += putEscaped(&pOut[n], length + 1);
+   for (i = 0; i < length + 1; i++) {
+      n += putEscaped(&pOut[n], body[i]);
+   }
+   n += putEscaped(&pOut[n], (crc >> 8) & 0xff);
+   n += putEscaped(&pOut[n], crc & 0xff);
+   return n;
+}
+
+// Keepalives, door events and cloud messages from the hub; weight updates,
+// telemetry and statistics from the scale.  One frame in 500 has a bad CRC,
+// one in 1000 comes after line noise.
+static uint32_t synthFrame(uint8_t *pOut, uint8_t *pDirection) {
+   uint8_t msg[CAP_MAX_PACKET];
+   uint8_t length = 0;
+   uint32_t r = nextRandom();
+   uint32_t n = 0;
+   uint8_t i;
+
+   *pDirection = CAP_RX;
+   switch (r % 10) {
+      case 0:
+      case 1:
+         msg[length++] = keepAliveType;
+         msg[length++] = unsigned8DataType;
+         msg[length++] = 1;
+         break;
+      case 2:
+         msg[length++] = doorStatusMsgType;
+         msg[length++] = unsigned8DataType;
+         msg[length++] = (uint8_t)((r >> 8) & 1);
+         break;
+      case 3:
+         msg[length++] = timeResponseMsgType;
+         msg[length++] = arrayDataType;
+         msg[length++] = 4;
+         msg[length++] = unsigned8DataType;
+         for (i = 0; i < 4; i++) {
+            msg[length++] = (uint8_t)nextRandom();
+         }
+         break;
+      case 4:
+         msg[length++] = 0x96;
+         msg[length++] = noDataType;
+         break;
+      case 5:
+      case 6:
+      case 7:
+         *pDirection = CAP_TX;
+         msg[length++] = updateResourceType;
+         msg[length++] = jsonDataType;
+         msg[length++] = 2;
+         msg[length++] = 5;
+         memcpy(&msg[length], "resID", 5);
+         length += 5;
+         msg[length++] = unsigned8DataType;
+         msg[length++] = 0x91;
+         msg[length++] = 3;
+         memcpy(&msg[length], "val", 3);
+         length += 3;
+         msg[length++] = unsigned16DataType;
+         msg[length++] = (uint8_t)nextRandom();
+         msg[length++] = (uint8_t)nextRandom();
+         break;
+      case 8:
+         *pDirection = CAP_TX;
+         msg[length++] = 0x97;
+         msg[length++] = arrayDataType;
+         msg[length++] = 9;
+         msg[length++] = unsigned16DataType;
+         for (i = 0; i < 18; i++) {
+            msg[length++] = (uint8_t)nextRandom();
+         }
+         break;
+      default:
+         *pDirection = CAP_TX;
+         msg[length++] = 0x96;
+         msg[length++] = arrayDataType;
+         msg[length++] = 12;
+         msg[length++] = unsigned32DataType;
+         for (i = 0; i < 48; i++) {
+            msg[length++] = (nextRandom() % 4 == 0) ? (uint8_t)nextRandom() : 0;
+         }
+         break;
+   }
+
+   if (nextRandom() % 1000 == 0) {
+      for (i = (uint8_t)(nextRandom() % 8); i > 0; i--) {
+         pOut[n++] = (uint8_t)nextRandom();
+      }
+   }
+   n += frameMessage(&pOut[n], msg, length);
+   if (nextRandom() % 500 == 0) {
+      pOut[n - 1] ^= 0x01;
+      if (pOut[n - 1] == STX || pOut[n - 1] == ESC) {
+         pOut[n - 1] = 0x55;
+      }
+   }
+   return n;
+}
+
+static int synth(const char *pOut, uint64_t megabytes) {
+   FILE *f = fopen(pOut, "wb");
+   uint32_t header[6] = { PCAP_MAGIC, 2 | (4 << 16), 0, 0, 65535, PCAP_LINKTYPE_USER0 };
+   uint64_t written = sizeof(header);
+   uint64_t timeUs = 0;
+   uint8_t packet[1 + 256];
+
+   if (f == NULL) {
+      perror(pOut);
+      return 1;
+   }
+   writeOrDie(f, header, sizeof(header));
+   while (written < megabytes * 1000000) {
+      uint32_t record[4];
+      uint32_t length = 1 + synthFrame(&packet[1], &packet[0]);
+
+      timeUs += 1000 * (nextRandom() % 50);
+      record[0] = (uint32_t)(timeUs / 1000000);
+      record[1] = (uint32_t)(timeUs % 1000000);
+      record[2] = length;
+      record[3] = length;
+      writeOrDie(f, record, sizeof(record));
+      writeOrDie(f, packet, length);
+      written += sizeof(record) + length;
+   }
+   if (fclose(f) != 0) {
+      perror(pOut);
+      return 1;
+   }
+   printf("%.1f MB, %.1f hours of traffic, in %s\n", written / 1e6, timeUs / 3.6e9, pOut);
+   return 0;
+}
+
+static int usage(void) {
+   fprintf(stderr,
+           "usage: chcap synth [-s megabytes] [-o out.pcap]\n"
+           "       chcap build [-b baud] [-d rx|tx] [-t threads] -o out.chcap input\n"
+           "       chcap stats capture\n"
+           "       chcap list [-f from_s] [-u until_s] [-m type] [-n count] [-x] capture\n"
+           "       chcap scan [-t threads] capture\n"
+           "       chcap verify capture\n");
+   return 2;
+}
+
+int main(int argc, char **argv) {
+   const char *pCommand;
+   const char *pOut = NULL;
+   uint64_t megabytes = 64;
+   uint32_t baud = 115200;
+   uint8_t rawDirection = CAP_RX;
+   uint32_t threadCount = (uint32_t)sysconf(_SC_NPROCESSORS_ONLN);
+   double fromSeconds = 0;
+   double untilSeconds = -1;
+   int msgType = -1;
+   uint64_t limit = ~0ULL;
+   int withBytes = 0;
+   int opt;
+
+   if (argc < 2) {
+      return usage();
+   }
+   initCrcTables();
+   pCommand = argv[1];
+   argc--;
+   argv++;
+
+   while ((opt = getopt(argc, argv, "s:o:b:d:t:f:u:m:n:x")) != -1) {
+      switch (opt) {
+         case 's': megabytes = strtoull(optarg, NULL, 0); break;
+         case 'o': pOut = optarg; break;
+         case 'b': baud = (uint32_t)strtoul(optarg, NULL, 0); break;
+         case 'd': rawDirection = (strcmp(optarg, "tx") == 0) ? CAP_TX : CAP_RX; break;
+         case 't': threadCount = (uint32_t)strtoul(optarg, NULL, 0); break;
+         case 'f': fromSeconds = atof(optarg); break;
+         case 'u': untilSeconds = atof(optarg); break;
+         case 'm':
+            msgType = parseType(optarg);
+            if (msgType < 0) {
+               fprintf(stderr, "unknown message type %s\n", optarg);
+               return 2;
+            }
+            break;
+         case 'n': limit = strtoull(optarg, NULL, 0); break;
+         case 'x': withBytes = 1; break;
+         default: return usage();
+      }
+   }
+   if (threadCount == 0 || baud < 10) {
+      return usage();
+   }
+
+   if (strcmp(pCommand, "synth") == 0) {
+      return synth((pOut != NULL) ? pOut : "synth.pcap", megabytes);
+   }
+   if (optind + 1 != argc) {
+      return usage();
+   }
+   if (strcmp(pCommand, "build") == 0 && pOut != NULL) {
+      return build(argv[optind], pOut, baud, rawDirection, threadCount);
+   }
+   if (strcmp(pCommand, "stats") == 0) {
+      return stats(argv[optind]);
+   }
+   if (strcmp(pCommand, "list") == 0) {
+      return list(argv[optind], fromSeconds, untilSeconds, msgType, limit, withBytes);
+   }
+   if (strcmp(pCommand, "scan") == 0) {
+      return scan(argv[optind], threadCount);
+   }
+   if (strcmp(pCommand, "verify") == 0) {
+      return verify(argv[optind]);
+   }
+   return usage();
+}
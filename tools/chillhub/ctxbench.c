@@ -0,0 +1,409 @@
+/*
+ * Many chillhub links in one process, fed from recorded traffic.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Runs a thousand independent T_ChillHubCB links over the same recorded
+ * hub-to-device traffic and reports how many frames a core decodes per
+ * second.  The links are split over the threads; each thread polls its links
+ * in turn and hands every one the next slice of its recording, the way a
+ * gateway would after a read from that link's serial port.
+ *
+ * The recording is the raw bytes on the wire.  Without -f a typical session
+ * is synthesized: keepalives, door events, time responses and cloud
+ * messages, some with bytes that need escaping.  -o writes it out.
+ *
+ *   ctxbench [-n links] [-t threads] [-s slice_bytes] [-p passes] [-f recording] [-o recording]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "chillhub.h"
+#include "crc.h"
+
+#define STX 0xff
+#define ESC 0xfe
+
+#define MAX_RECORDING (1024 * 1024)
+
+typedef struct T_Feed {
+   const uint8_t *pData;
+   uint32_t length;
+   uint32_t pos;
+   uint32_t sliceEnd;
+} T_Feed;
+
+typedef struct T_Link {
+   T_ChillHubCB hub;
+   T_Feed feed;
+} T_Link;
+
+typedef struct T_Worker {
+   pthread_t thread;
+   T_Link *pLinks;
+   uint32_t firstId;
+   uint32_t linkCount;
+   uint32_t passes;
+   uint32_t sliceBytes;
+   uint64_t frames;
+   uint64_t callbacks;
+   double cpuSeconds;
+} T_Worker;
+
+static uint8_t recording[MAX_RECORDING];
+static uint32_t recordingLength;
+
+// Where frames start, so every link can join the recording at a frame
+static uint32_t frameStarts[MAX_RECORDING / 8];
+static uint32_t frameCount;
+
+// The serial port functions carry no link, so each thread points this at the
+// link it is about to poll.
+static __thread T_Feed *pCurrentFeed;
+static __thread uint64_t callbackCount;
+
+static void feedWrite(const uint8 wrBuf[], uint32 count) {
+   (void)wrBuf;
+   (void)count;
+}
+
+static uint32 feedAvailable(void) {
+   return pCurrentFeed->sliceEnd - pCurrentFeed->pos;
+}
+
+static uint32 feedRead(void) {
+   return pCurrentFeed->pData[pCurrentFeed->pos++];
+}
+
+static void feedPrint(const char8 string[]) {
+   (void)string;
+}
+
+static const T_Serial feedSerial = { feedWrite, feedAvailable, feedRead, feedPrint };
+
+static void countCallback(uint8_t dataType, void *pData) {
+   (void)dataType;
+   (void)pData;
+   callbackCount++;
+}
+
+/*
+ * The synthetic recording
+ */
+
+static void put(uint8_t b) {
+   if (recordingLength < MAX_RECORDING) {
+      recording[recordingLength++] = b;
+   }
+}
+
+static void putEscaped(uint8_t b) {
+   if (b == STX || b == ESC) {
+      put(ESC);
+   }
+   put(b);
+}
+
+// Frames a message (message type, data type, data...) like sendPacket.
+static void putMessage(const uint8_t *pMsg, uint8_t length) {
+   uint8_t body[64];
+   crc_t crc;
+   uint8_t i;
+
+   body[0] = length;
+   memcpy(&body[1], pMsg, length);
+   crc = crc_finalize(crc_update(crc_init(), body, length + 1));
+
+   put(STX);
+   putEscaped(length + 1);
+   for (i = 0; i < length + 1; i++) {
+      putEscaped(body[i]);
+   }
+   putEscaped((crc >> 8) & 0xff);
+   putEscaped(crc & 0xff);
+}
+
+static void synthesize(void) {
+   uint32_t seed = 12345;
+   uint32_t i;
+
+   for (i = 0; i < 2000; i++) {
+      seed = seed * 1103515245UL + 12345UL;
+      switch ((seed >> 16) % 8) {
+         case 0:
+         case 1:
+         case 2: {
+            uint8_t msg[] = { keepAliveType, unsigned8DataType, 1 };
+            putMessage(msg, sizeof(msg));
+            break;
+         }
+         case 3:
+         case 4: {
+            uint8_t msg[] = { doorStatusMsgType, unsigned8DataType, (uint8_t)((seed >> 8) & 1) };
+            putMessage(msg, sizeof(msg));
+            break;
+         }
+         case 5: {
+            uint8_t msg[] = { timeResponseMsgType, arrayDataType, 4, unsigned8DataType,
+                              (uint8_t)(seed >> 24), (uint8_t)(seed >> 16), 0xff, 0xfe };
+            putMessage(msg, sizeof(msg));
+            break;
+         }
+         case 6: {
+            uint8_t msg[] = { 0x51, unsigned32DataType, 0, 0, (uint8_t)(seed >> 8), 0xff };
+            putMessage(msg, sizeof(msg));
+            break;
+         }
+         default: {
+            uint8_t msg[4 + 48];
+            uint8_t j;
+            msg[0] = 0x60;
+            msg[1] = arrayDataType;
+            msg[2] = 48;
+            msg[3] = unsigned8DataType;
+            for (j = 0; j < 48; j++) {
+               seed = seed * 1103515245UL + 12345UL;
+               msg[4 + j] = (uint8_t)(seed >> 16);
+            }
+            putMessage(msg, sizeof(msg));
+            break;
+         }
+      }
+   }
+}
+
+// An STX that is not escaped starts a frame.
+static void findFrames(void) {
+   uint32_t i;
+
+   frameCount = 0;
+   for (i = 0; i < recordingLength && frameCount < sizeof(frameStarts) / sizeof(frameStarts[0]); i++) {
+      if (recording[i] == STX && (i == 0 || recording[i - 1] != ESC)) {
+         frameStarts[frameCount++] = i;
+      }
+   }
+}
+
+/*
+ * The benchmark
+ */
+
+static double cpuNow(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double wallNow(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void setupLink(T_Link *pLink, uint32_t id) {
+   char uuid[16];
+
+   pLink->feed.pData = recording;
+   pLink->feed.length = recordingLength;
+   // start each link at another frame so they are not in step
+   pLink->feed.pos = frameStarts[((uint64_t)id * 7919) % frameCount];
+   pLink->feed.sliceEnd = pLink->feed.pos;
+
+   snprintf(uuid, sizeof(uuid), "link%lu", (unsigned long)id);
+   pCurrentFeed = &pLink->feed;
+   ChillHub_Init(&pLink->hub);
+   ChillHub_Setup(&pLink->hub, "milkyWeighs", uuid, &feedSerial);
+   ChillHub_Subscribe(&pLink->hub, keepAliveType, countCallback);
+   ChillHub_Subscribe(&pLink->hub, doorStatusMsgType, countCallback);
+   ChillHub_GetTime(&pLink->hub, countCallback);
+   ChillHub_AddCloudListener(&pLink->hub, 0x51, countCallback);
+   ChillHub_AddCloudListener(&pLink->hub, 0x60, countCallback);
+}
+
+static void *work(void *pArg) {
+   T_Worker *pWorker = (T_Worker *)pArg;
+   uint64_t framesBefore = 0;
+   uint64_t bytesPerLink = (uint64_t)pWorker->passes * recordingLength;
+   uint64_t fed = 0;
+   double start;
+   uint32_t i;
+
+   callbackCount = 0;
+   for (i = 0; i < pWorker->linkCount; i++) {
+      setupLink(&pWorker->pLinks[i], pWorker->firstId + i);
+      framesBefore += ChillHub_GetStats(&pWorker->pLinks[i].hub)->framesRx;
+   }
+
+   start = cpuNow();
+   while (fed < bytesPerLink) {
+      uint32_t slice = pWorker->sliceBytes;
+
+      if (bytesPerLink - fed < slice) {
+         slice = (uint32_t)(bytesPerLink - fed);
+      }
+      for (i = 0; i < pWorker->linkCount; i++) {
+         T_Link *pLink = &pWorker->pLinks[i];
+         uint32_t left = slice;
+
+         pCurrentFeed = &pLink->feed;
+         while (left > 0) {
+            uint32_t n = pLink->feed.length - pLink->feed.pos;
+
+            if (n == 0) {
+               pLink->feed.pos = 0;
+               n = pLink->feed.length;
+            }
+            if (n > left) {
+               n = left;
+            }
+            pLink->feed.sliceEnd = pLink->feed.pos + n;
+            do {
+               ChillHub_Loop(&pLink->hub);
+            } while (!ChillHub_IsIdle(&pLink->hub));
+            left -= n;
+         }
+      }
+      fed += slice;
+   }
+   pWorker->cpuSeconds = cpuNow() - start;
+
+   pWorker->frames = 0;
+   for (i = 0; i < pWorker->linkCount; i++) {
+      pWorker->frames += ChillHub_GetStats(&pWorker->pLinks[i].hub)->framesRx;
+   }
+   pWorker->frames -= framesBefore;
+   pWorker->callbacks = callbackCount;
+   return NULL;
+}
+
+int main(int argc, char **argv) {
+   uint32_t linkCount = 1000;
+   uint32_t threadCount = (uint32_t)sysconf(_SC_NPROCESSORS_ONLN);
+   uint32_t sliceBytes = 16;
+   uint32_t passes = 2;
+   const char *pIn = NULL;
+   const char *pOut = NULL;
+   T_Link *pLinks;
+   T_Worker *pWorkers;
+   uint64_t frames = 0;
+   uint64_t callbacks = 0;
+   uint64_t crcFailures = 0;
+   double cpuSeconds = 0;
+   double wall;
+   uint32_t i;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "n:t:s:p:f:o:")) != -1) {
+      switch (opt) {
+         case 'n': linkCount = (uint32_t)strtoul(optarg, NULL, 0); break;
+         case 't': threadCount = (uint32_t)strtoul(optarg, NULL, 0); break;
+         case 's': sliceBytes = (uint32_t)strtoul(optarg, NULL, 0); break;
+         case 'p': passes = (uint32_t)strtoul(optarg, NULL, 0); break;
+         case 'f': pIn = optarg; break;
+         case 'o': pOut = optarg; break;
+         default:
+            fprintf(stderr, "usage: %s [-n links] [-t threads] [-s slice_bytes] [-p passes] [-f recording] [-o recording]\n", argv[0]);
+            return 2;
+      }
+   }
+   if (linkCount == 0 || threadCount == 0 || sliceBytes == 0 || passes == 0) {
+      fprintf(stderr, "links, threads, slice and passes must not be 0\n");
+      return 2;
+   }
+   if (threadCount > linkCount) {
+      threadCount = linkCount;
+   }
+
+   if (pIn != NULL) {
+      FILE *f = fopen(pIn, "rb");
+      if (f == NULL) {
+         perror(pIn);
+         return 1;
+      }
+      recordingLength = (uint32_t)fread(recording, 1, sizeof(recording), f);
+      fclose(f);
+   } else {
+      synthesize();
+   }
+   findFrames();
+   if (frameCount == 0) {
+      fprintf(stderr, "no frames in the recording\n");
+      return 1;
+   }
+   if (pOut != NULL) {
+      FILE *f = fopen(pOut, "wb");
+      if (f == NULL || fwrite(recording, 1, recordingLength, f) != recordingLength) {
+         perror(pOut);
+         return 1;
+      }
+      fclose(f);
+   }
+
+   pLinks = calloc(linkCount, sizeof(T_Link));
+   pWorkers = calloc(threadCount, sizeof(T_Worker));
+   if (pLinks == NULL || pWorkers == NULL) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+   }
+
+   wall = wallNow();
+   for (i = 0; i < threadCount; i++) {
+      uint32_t first = (uint32_t)((uint64_t)linkCount * i / threadCount);
+      uint32_t last = (uint32_t)((uint64_t)linkCount * (i + 1) / threadCount);
+
+      pWorkers[i].pLinks = &pLinks[first];
+      pWorkers[i].firstId = first;
+      pWorkers[i].linkCount = last - first;
+      pWorkers[i].passes = passes;
+      pWorkers[i].sliceBytes = sliceBytes;
+      pthread_create(&pWorkers[i].thread, NULL, work, &pWorkers[i]);
+   }
+   for (i = 0; i < threadCount; i++) {
+      pthread_join(pWorkers[i].thread, NULL);
+      frames += pWorkers[i].frames;
+      callbacks += pWorkers[i].callbacks;
+      cpuSeconds += pWorkers[i].cpuSeconds;
+   }
+   wall = wallNow() - wall;
+   for (i = 0; i < linkCount; i++) {
+      crcFailures += ChillHub_GetStats(&pLinks[i].hub)->crcFailures;
+   }
+
+   printf("%lu links on %lu threads, %lu byte recording x %lu passes, %lu byte slices, %lu bytes per link state\n",
+          (unsigned long)linkCount, (unsigned long)threadCount, (unsigned long)recordingLength,
+          (unsigned long)passes, (unsigned long)sliceBytes, (unsigned long)sizeof(T_ChillHubCB));
+   printf("%llu frames, %llu callbacks, %llu CRC failures in %.3f s (%.3f s CPU)\n",
+          (unsigned long long)frames, (unsigned long long)callbacks, (unsigned long long)crcFailures,
+          wall, cpuSeconds);
+   printf("%.0f frames/s per core, %.1f MB/s per core, %.0f frames/s in all\n",
+          frames / cpuSeconds, (double)linkCount * passes * recordingLength / cpuSeconds / 1e6,
+          frames / wall);
+
+   free(pLinks);
+   free(pWorkers);
+   return (crcFailures == 0 && frames > 0) ? 0 : 1;
+}
@@ -0,0 +1,806 @@
+/*
+ * Gateway that runs the chillhub link of many scales over ptys or sockets.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Each simulated scale is one end of a socket pair (or a pty with -P); the
+ * gateway holds the other end.  The gateway has one epoll I/O thread per
+ * core.  An I/O thread reads whatever its links have ready, runs the bytes
+ * through the link's T_ChillHubCB and hands every frame that passes the CRC
+ * to a worker through a single producer, single consumer queue.  There is one
+ * queue for every pair of I/O thread and worker, and a link always goes to
+ * the same worker, so frames of one link stay in order.
+ *
+ * Back-pressure is per link: once a link has LINK_INFLIGHT_MAX frames queued
+ * and not yet handled, its I/O thread stops reading it and the bytes back up
+ * in the kernel, and in the end in the scale.  The link is read again once
+ * its worker has caught up.
+ *
+ * The built-in load generator drives the scales through their own
+ * T_ChillHubCB: every scale sends a telemetry frame every -i microseconds,
+ * carrying a sequence number and the time it was sent.  The workers check the
+ * sequence and record the latency.  The run is repeated for a growing number
+ * of scales, and for each one the frame rate, the p50/p99 latency from
+ * encoding on the scale to handling on a worker, and the CPU time the gateway
+ * threads spent per thousand frames are printed.
+ *
+ * -W makes the workers spend that many nanoseconds on every frame, standing in
+ * for the hub software, to see the back-pressure at work.
+ *
+ *   gateway [-P] [-t io_threads] [-w workers] [-g generators] [-i interval_us]
+ *           [-d seconds] [-W work_ns] [device_count ...]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include "chillhub.h"
+
+#define MAX_THREADS 64
+
+// Bytes taken from a link per read.  Small enough that one read can never
+// produce more frames than a queue has room for below its high water mark.
+#define READ_SIZE 512
+#define MIN_FRAME_BYTES 6
+#define FRAMES_PER_READ (READ_SIZE / MIN_FRAME_BYTES + 1)
+
+#define QUEUE_SIZE 4096
+#define LINK_INFLIGHT_MAX 64
+#define LINK_INFLIGHT_RESUME 16
+
+#define TELEMETRY_MSG 0x70
+#define TELEMETRY_COUNT 20
+#define SCALE_TX_SIZE 4096
+
+// Latency histogram: 16 linear steps in every power of two of nanoseconds
+#define HIST_SUB_BITS 4
+#define HIST_BUCKETS (64 << HIST_SUB_BITS)
+
+typedef struct T_Frame {
+   uint32_t link;
+   uint8_t length;
+   uint8_t msg[CHILLHUB_BUFFER_SIZE];
+} T_Frame;
+
+typedef struct T_Queue {
+   uint32_t head __attribute__((aligned(64)));   // written by the consumer
+   uint32_t tail __attribute__((aligned(64)));   // written by the producer
+   T_Frame slots[QUEUE_SIZE] __attribute__((aligned(64)));
+} T_Queue;
+
+typedef struct T_Link {
+   T_ChillHubCB hub;
+   int fd;
+   uint32_t id;
+   uint32_t worker;
+   struct T_IoThread *pIo;
+
+   // the read being decoded
+   uint8_t buf[READ_SIZE];
+   uint32_t pos;
+   uint32_t end;
+
+   uint32_t inflight;   // frames queued and not yet handled, atomic
+   uint8_t paused;
+   uint32_t pauses;
+
+   // worker side
+   uint32_t expectedSeq;
+   uint32_t seqErrors;
+} T_Link;
+
+typedef struct T_IoThread {
+   pthread_t thread;
+   uint32_t index;
+   int epollFd;
+   T_Queue *pQueues;    // one per worker
+   T_Link **ppPaused;
+   uint32_t pausedCount;
+   double cpuSeconds;
+} T_IoThread;
+
+typedef struct T_Worker {
+   pthread_t thread;
+   uint32_t index;
+   uint64_t frames;
+   uint64_t telemetry;
+   uint64_t histogram[HIST_BUCKETS];
+   double cpuSeconds;
+} T_Worker;
+
+typedef struct T_Scale {
+   T_ChillHubCB hub;
+   int fd;
+   uint32_t seq;
+   uint64_t nextNs;
+   uint8_t tx[SCALE_TX_SIZE];
+   uint32_t txLength;
+   uint64_t throttled;
+} T_Scale;
+
+typedef struct T_Generator {
+   pthread_t thread;
+   T_Scale *pScales;
+   uint32_t scaleCount;
+   uint64_t sent;
+   uint64_t throttled;
+} T_Generator;
+
+static uint32_t ioCount;
+static uint32_t workerCount;
+static uint32_t generatorCount = 1;
+static uint32_t intervalUs = 10000;
+static double seconds = 2.0;
+static uint32_t workNs;
+static int usePty;
+
+static T_IoThread ioThreads[MAX_THREADS];
+static T_Worker workers[MAX_THREADS];
+static T_Generator generators[MAX_THREADS];
+static T_Link *pLinks;
+static T_Scale *pScales;
+static uint32_t linkCount;
+
+// Set by the main thread and read by the others, always with __atomic.
+static int generating;
+static int running;
+
+static __thread T_Link *pCurrentLink;
+static __thread T_Scale *pCurrentScale;
+
+static uint64_t nowNs(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double threadCpu(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print(const char8 string[]) {
+   (void)string;
+}
+
+/*
+ * Single producer, single consumer queue
+ */
+
+static uint32_t queueFree(const T_Queue *pQueue) {
+   return QUEUE_SIZE - (pQueue->tail - __atomic_load_n(&pQueue->head, __ATOMIC_ACQUIRE));
+}
+
+static T_Frame *queueSlot(T_Queue *pQueue) {
+   while (queueFree(pQueue) == 0) {
+      sched_yield();
+   }
+   return &pQueue->slots[pQueue->tail % QUEUE_SIZE];
+}
+
+static void queuePush(T_Queue *pQueue) {
+   __atomic_store_n(&pQueue->tail, pQueue->tail + 1, __ATOMIC_RELEASE);
+}
+
+static T_Frame *queuePeek(T_Queue *pQueue) {
+   if (pQueue->head == __atomic_load_n(&pQueue->tail, __ATOMIC_ACQUIRE)) {
+      return NULL;
+   }
+   return &pQueue->slots[pQueue->head % QUEUE_SIZE];
+}
+
+static void queuePop(T_Queue *pQueue) {
+   __atomic_store_n(&pQueue->head, pQueue->head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Gateway side of a link
+ */
+
+static void linkWrite(const uint8 wrBuf[], uint32 count) {
+   (void)wrBuf;
+   (void)count;
+}
+
+static uint32 linkAvailable(void) {
+   return pCurrentLink->end - pCurrentLink->pos;
+}
+
+static uint32 linkRead(void) {
+   return pCurrentLink->buf[pCurrentLink->pos++];
+}
+
+static const T_Serial linkSerial = { linkWrite, linkAvailable, linkRead, print };
+
+static void linkFrame(T_ChillHubCB *pControlBlock, const uint8_t *pMsg, uint8_t length) {
+   T_Link *pLink = (T_Link *)pControlBlock->pUserData;
+   T_Queue *pQueue = &pLink->pIo->pQueues[pLink->worker];
+   T_Frame *pFrame;
+
+   // the link turns away frames too short for a message, but a slot must
+   // not be overrun if one ever gets through with a wrapped length
+   if (length > sizeof(pFrame->msg)) {
+      return;
+   }
+   pFrame = queueSlot(pQueue);
+   pFrame->link = pLink->id;
+   pFrame->length = length;
+   memcpy(pFrame->msg, pMsg, length);
+   __atomic_add_fetch(&pLink->inflight, 1, __ATOMIC_RELAXED);
+   queuePush(pQueue);
+}
+
+static void setInterest(T_Link *pLink, uint32_t events) {
+   struct epoll_event ev;
+
+   ev.events = events;
+   ev.data.ptr = pLink;
+   epoll_ctl(pLink->pIo->epollFd, EPOLL_CTL_MOD, pLink->fd, &ev);
+}
+
+static void pauseLink(T_Link *pLink) {
+   T_IoThread *pIo = pLink->pIo;
+
+   setInterest(pLink, 0);
+   pLink->paused = 1;
+   pLink->pauses++;
+   pIo->ppPaused[pIo->pausedCount++] = pLink;
+}
+
+static void resumeCaughtUp(T_IoThread *pIo) {
+   uint32_t i = 0;
+
+   while (i < pIo->pausedCount) {
+      T_Link *pLink = pIo->ppPaused[i];
+
+      if (__atomic_load_n(&pLink->inflight, __ATOMIC_RELAXED) <= LINK_INFLIGHT_RESUME &&
+          queueFree(&pIo->pQueues[pLink->worker]) >= QUEUE_SIZE / 2) {
+         pLink->paused = 0;
+         setInterest(pLink, EPOLLIN);
+         pIo->ppPaused[i] = pIo->ppPaused[--pIo->pausedCount];
+      } else {
+         i++;
+      }
+   }
+}
+
+static void service(T_Link *pLink) {
+   ssize_t n;
+
+   if (__atomic_load_n(&pLink->inflight, __ATOMIC_RELAXED) >= LINK_INFLIGHT_MAX ||
+       queueFree(&pLink->pIo->pQueues[pLink->worker]) < FRAMES_PER_READ) {
+      pauseLink(pLink);
+      return;
+   }
+
+   n = read(pLink->fd, pLink->buf, sizeof(pLink->buf));
+   if (n <= 0) {
+      return;
+   }
+   pLink->pos = 0;
+   pLink->end = (uint32_t)n;
+   pCurrentLink = pLink;
+   do {
+      ChillHub_Loop(&pLink->hub);
+   } while (!ChillHub_IsIdle(&pLink->hub));
+}
+
+static void *ioMain(void *pArg) {
+   T_IoThread *pIo = (T_IoThread *)pArg;
+   struct epoll_event events[64];
+
+   while (__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+      int n = epoll_wait(pIo->epollFd, events, 64, 1);
+      int i;
+
+      for (i = 0; i < n; i++) {
+         T_Link *pLink = (T_Link *)events[i].data.ptr;
+         if (!pLink->paused) {
+            service(pLink);
+         }
+      }
+      resumeCaughtUp(pIo);
+   }
+   pIo->cpuSeconds = threadCpu();
+   return NULL;
+}
+
+/*
+ * Workers
+ */
+
+static void record(T_Worker *pWorker, uint64_t ns) {
+   uint32_t bucket;
+
+   if (ns < (1u << HIST_SUB_BITS)) {
+      bucket = (uint32_t)ns;
+   } else {
+      uint32_t msb = 63 - __builtin_clzll(ns);
+      bucket = ((msb - HIST_SUB_BITS + 1) << HIST_SUB_BITS) |
+               (uint32_t)((ns >> (msb - HIST_SUB_BITS)) & ((1u << HIST_SUB_BITS) - 1));
+   }
+   pWorker->histogram[bucket]++;
+}
+
+static uint64_t bucketValue(uint32_t bucket) {
+   uint32_t group = bucket >> HIST_SUB_BITS;
+   uint64_t sub = bucket & ((1u << HIST_SUB_BITS) - 1);
+
+   if (group == 0) {
+      return sub;
+   }
+   return ((1ULL << HIST_SUB_BITS) | sub) << (group - 1);
+}
+
+static void handle(T_Worker *pWorker, const T_Frame *pFrame) {
+   T_Link *pLink = &pLinks[pFrame->link];
+   const uint8_t *pMsg = pFrame->msg;
+
+   pWorker->frames++;
+   if (workNs > 0) {
+      // what the hub software would do with the frame
+      uint64_t until = nowNs() + workNs;
+      while (nowNs() < until) {
+      }
+   }
+   if (pFrame->length == 4 + TELEMETRY_COUNT && pMsg[0] == TELEMETRY_MSG && pMsg[1] == arrayDataType &&
+       pMsg[2] == TELEMETRY_COUNT && pMsg[3] == unsigned8DataType) {
+      uint32_t seq = ((uint32_t)pMsg[4] << 24) | ((uint32_t)pMsg[5] << 16) | ((uint32_t)pMsg[6] << 8) | pMsg[7];
+      uint64_t sentNs = 0;
+      int i;
+
+      for (i = 0; i < 8; i++) {
+         sentNs = (sentNs << 8) | pMsg[8 + i];
+      }
+      if (seq != pLink->expectedSeq) {
+         pLink->seqErrors++;
+      }
+      pLink->expectedSeq = seq + 1;
+      record(pWorker, nowNs() - sentNs);
+      __atomic_fetch_add(&pWorker->telemetry, 1, __ATOMIC_RELAXED);
+   }
+}
+
+static void *workerMain(void *pArg) {
+   T_Worker *pWorker = (T_Worker *)pArg;
+   uint32_t idle = 0;
+
+   while (__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+      uint32_t handled = 0;
+      uint32_t i;
+
+      for (i = 0; i < ioCount; i++) {
+         T_Queue *pQueue = &ioThreads[i].pQueues[pWorker->index];
+         T_Frame *pFrame;
+
+         while ((pFrame = queuePeek(pQueue)) != NULL) {
+            T_Link *pLink = &pLinks[pFrame->link];
+            handle(pWorker, pFrame);
+            queuePop(pQueue);
+            __atomic_sub_fetch(&pLink->inflight, 1, __ATOMIC_RELAXED);
+            handled++;
+         }
+      }
+      if (handled > 0) {
+         idle = 0;
+      } else if (++idle < 64) {
+         sched_yield();
+      } else {
+         struct timespec ts = { 0, 50000 };
+         nanosleep(&ts, NULL);
+      }
+   }
+   pWorker->cpuSeconds = threadCpu();
+   return NULL;
+}
+
+/*
+ * Load generator: the scales
+ */
+
+static void scaleWrite(const uint8 wrBuf[], uint32 count) {
+   T_Scale *pScale = pCurrentScale;
+
+   if (pScale->txLength + count <= sizeof(pScale->tx)) {
+      memcpy(&pScale->tx[pScale->txLength], wrBuf, count);
+      pScale->txLength += count;
+   }
+}
+
+static uint32 scaleAvailable(void) {
+   return 0;
+}
+
+static uint32 scaleRead(void) {
+   return 0;
+}
+
+static const T_Serial scaleSerial = { scaleWrite, scaleAvailable, scaleRead, print };
+
+static void flush(T_Scale *pScale) {
+   ssize_t n;
+
+   if (pScale->txLength == 0) {
+      return;
+   }
+   n = write(pScale->fd, pScale->tx, pScale->txLength);
+   if (n > 0) {
+      memmove(pScale->tx, &pScale->tx[n], pScale->txLength - n);
+      pScale->txLength -= (uint32_t)n;
+   }
+}
+
+static void sendTelemetry(T_Scale *pScale) {
+   uint8_t data[TELEMETRY_COUNT];
+   uint64_t sentNs = nowNs();
+   int i;
+
+   data[0] = (pScale->seq >> 24) & 0xff;
+   data[1] = (pScale->seq >> 16) & 0xff;
+   data[2] = (pScale->seq >> 8) & 0xff;
+   data[3] = pScale->seq & 0xff;
+   for (i = 0; i < 8; i++) {
+      data[4 + i] = (uint8_t)(sentNs >> (56 - 8 * i));
+   }
+   // the channel readings
+   for (i = 12; i < TELEMETRY_COUNT; i++) {
+      data[i] = (uint8_t)(pScale->seq * 37 + i * 11);
+   }
+   pCurrentScale = pScale;
+   ChillHub_SendU8ArrayMsg(&pScale->hub, TELEMETRY_MSG, data, sizeof(data));
+   pScale->seq++;
+}
+
+static void *generatorMain(void *pArg) {
+   T_Generator *pGen = (T_Generator *)pArg;
+
+   while (__atomic_load_n(&generating, __ATOMIC_ACQUIRE)) {
+      uint64_t now = nowNs();
+      uint64_t next = now + intervalUs * 1000ULL;
+      uint32_t i;
+
+      for (i = 0; i < pGen->scaleCount; i++) {
+         T_Scale *pScale = &pGen->pScales[i];
+
+         flush(pScale);
+         if (pScale->nextNs > now) {
+            if (pScale->nextNs < next) {
+               next = pScale->nextNs;
+            }
+            continue;
+         }
+         pScale->nextNs += intervalUs * 1000ULL;
+         if (pScale->txLength > 0) {
+            // the gateway is pushing back; this reading is not taken
+            pScale->throttled++;
+            continue;
+         }
+         sendTelemetry(pScale);
+         flush(pScale);
+         pGen->sent++;
+      }
+      now = nowNs();
+      if (next > now + 20000) {
+         struct timespec ts = { 0, (long)(next - now - 10000) };
+         nanosleep(&ts, NULL);
+      }
+   }
+   for (uint32_t i = 0; i < pGen->scaleCount; i++) {
+      pGen->throttled += pGen->pScales[i].throttled;
+   }
+   return NULL;
+}
+
+/*
+ * One run
+ */
+
+static int openPair(int fds[2]) {
+   if (usePty) {
+      struct termios tio;
+      int master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+      int slave;
+
+      if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+         return -1;
+      }
+      slave = open(ptsname(master), O_RDWR | O_NOCTTY | O_NONBLOCK);
+      if (slave < 0) {
+         return -1;
+      }
+      // raw, so the line discipline passes every byte through untouched
+      tcgetattr(slave, &tio);
+      cfmakeraw(&tio);
+      tcsetattr(slave, TCSANOW, &tio);
+      tcgetattr(master, &tio);
+      cfmakeraw(&tio);
+      tcsetattr(master, TCSANOW, &tio);
+      fds[0] = master;
+      fds[1] = slave;
+      return 0;
+   }
+   return socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds);
+}
+
+typedef struct T_Result {
+   double framesPerSecond;
+   double p50Us;
+   double p99Us;
+   double cpuMsPerThousand;
+   uint64_t telemetry;
+   uint64_t sent;
+   uint64_t throttled;
+   uint64_t pauses;
+   uint64_t seqErrors;
+} T_Result;
+
+static double percentile(const uint64_t *pHistogram, uint64_t total, double fraction) {
+   uint64_t target = (uint64_t)(total * fraction);
+   uint64_t seen = 0;
+   uint32_t i;
+
+   for (i = 0; i < HIST_BUCKETS; i++) {
+      seen += pHistogram[i];
+      if (seen > target) {
+         return bucketValue(i) / 1000.0;
+      }
+   }
+   return 0;
+}
+
+static int run(uint32_t count, T_Result *pResult) {
+   static uint64_t histogram[HIST_BUCKETS];
+   uint64_t frames = 0;
+   uint64_t start;
+   uint64_t deadline;
+   double elapsed;
+   double cpu = 0;
+   uint32_t perGenerator;
+   uint32_t i;
+   uint32_t j;
+
+   memset(pResult, 0, sizeof(*pResult));
+   memset(histogram, 0, sizeof(histogram));
+   linkCount = count;
+   pLinks = calloc(count, sizeof(T_Link));
+   pScales = calloc(count, sizeof(T_Scale));
+   if (pLinks == NULL || pScales == NULL) {
+      fprintf(stderr, "out of memory\n");
+      return -1;
+   }
+
+   for (i = 0; i < ioCount; i++) {
+      memset(&ioThreads[i], 0, sizeof(ioThreads[i]));
+      ioThreads[i].index = i;
+      ioThreads[i].epollFd = epoll_create1(0);
+      ioThreads[i].pQueues = aligned_alloc(64, workerCount * sizeof(T_Queue));
+      ioThreads[i].ppPaused = calloc(count, sizeof(T_Link *));
+      if (ioThreads[i].epollFd < 0 || ioThreads[i].pQueues == NULL || ioThreads[i].ppPaused == NULL) {
+         fprintf(stderr, "out of memory\n");
+         return -1;
+      }
+      memset(ioThreads[i].pQueues, 0, workerCount * sizeof(T_Queue));
+   }
+   for (i = 0; i < workerCount; i++) {
+      memset(&workers[i], 0, sizeof(workers[i]));
+      workers[i].index = i;
+   }
+
+   start = nowNs();
+   for (i = 0; i < count; i++) {
+      T_Link *pLink = &pLinks[i];
+      T_Scale *pScale = &pScales[i];
+      struct epoll_event ev;
+      char uuid[16];
+      int fds[2];
+
+      if (openPair(fds) != 0) {
+         perror("opening a link");
+         return -1;
+      }
+      pLink->fd = fds[0];
+      pLink->id = i;
+      pLink->worker = i % workerCount;
+      pLink->pIo = &ioThreads[i % ioCount];
+      ChillHub_Init(&pLink->hub);
+      ChillHub_SetFrameHook(&pLink->hub, linkFrame, pLink);
+      // the gateway only listens, so its own announcement goes nowhere
+      ChillHub_Setup(&pLink->hub, "gateway", "hub", &linkSerial);
+      ev.events = EPOLLIN;
+      ev.data.ptr = pLink;
+      epoll_ctl(pLink->pIo->epollFd, EPOLL_CTL_ADD, pLink->fd, &ev);
+
+      pScale->fd = fds[1];
+      snprintf(uuid, sizeof(uuid), "scale%lu", (unsigned long)i);
+      pCurrentScale = pScale;
+      ChillHub_Init(&pScale->hub);
+      ChillHub_Setup(&pScale->hub, "milkyWeighs", uuid, &scaleSerial);
+      // spread the scales evenly over the interval
+      pScale->nextNs = start + (uint64_t)intervalUs * 1000ULL * i / count;
+   }
+
+   __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+   __atomic_store_n(&generating, 1, __ATOMIC_RELEASE);
+   for (i = 0; i < ioCount; i++) {
+      pthread_create(&ioThreads[i].thread, NULL, ioMain, &ioThreads[i]);
+   }
+   for (i = 0; i < workerCount; i++) {
+      pthread_create(&workers[i].thread, NULL, workerMain, &workers[i]);
+   }
+   perGenerator = (count + generatorCount - 1) / generatorCount;
+   for (i = 0; i < generatorCount; i++) {
+      uint32_t first = i * perGenerator;
+
+      memset(&generators[i], 0, sizeof(generators[i]));
+      generators[i].pScales = &pScales[first < count ? first : count];
+      generators[i].scaleCount = (first >= count) ? 0 : ((count - first < perGenerator) ? count - first : perGenerator);
+      pthread_create(&generators[i].thread, NULL, generatorMain, &generators[i]);
+   }
+
+   {
+      struct timespec ts = { (time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9) };
+      nanosleep(&ts, NULL);
+   }
+   __atomic_store_n(&generating, 0, __ATOMIC_RELEASE);
+   for (i = 0; i < generatorCount; i++) {
+      pthread_join(generators[i].thread, NULL);
+      pResult->sent += generators[i].sent;
+      pResult->throttled += generators[i].throttled;
+   }
+
+   // let the gateway drain what the scales still have and what is queued
+   deadline = nowNs() + 2000000000ULL;
+   for (;;) {
+      uint64_t handled = 0;
+      uint32_t pending = 0;
+
+      for (i = 0; i < count; i++) {
+         flush(&pScales[i]);
+         pending += pScales[i].txLength;
+      }
+      for (i = 0; i < workerCount; i++) {
+         handled += __atomic_load_n(&workers[i].telemetry, __ATOMIC_RELAXED);
+      }
+      if ((pending == 0 && handled >= pResult->sent) || nowNs() > deadline) {
+         break;
+      }
+      sched_yield();
+   }
+   elapsed = (nowNs() - start) / 1e9;
+
+   __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+   for (i = 0; i < ioCount; i++) {
+      pthread_join(ioThreads[i].thread, NULL);
+      cpu += ioThreads[i].cpuSeconds;
+   }
+   for (i = 0; i < workerCount; i++) {
+      pthread_join(workers[i].thread, NULL);
+      cpu += workers[i].cpuSeconds;
+      frames += workers[i].frames;
+      pResult->telemetry += workers[i].telemetry;
+      for (j = 0; j < HIST_BUCKETS; j++) {
+         histogram[j] += workers[i].histogram[j];
+      }
+   }
+   for (i = 0; i < count; i++) {
+      pResult->pauses += pLinks[i].pauses;
+      pResult->seqErrors += pLinks[i].seqErrors;
+      close(pLinks[i].fd);
+      close(pScales[i].fd);
+   }
+   for (i = 0; i < ioCount; i++) {
+      close(ioThreads[i].epollFd);
+      free(ioThreads[i].pQueues);
+      free(ioThreads[i].ppPaused);
+   }
+   free(pLinks);
+   free(pScales);
+
+   pResult->framesPerSecond = pResult->telemetry / elapsed;
+   pResult->p50Us = percentile(histogram, pResult->telemetry, 0.50);
+   pResult->p99Us = percentile(histogram, pResult->telemetry, 0.99);
+   pResult->cpuMsPerThousand = (frames > 0) ? cpu * 1000.0 / (frames / 1000.0) : 0;
+   return 0;
+}
+
+int main(int argc, char **argv) {
+   static const uint32_t defaultCounts[] = { 50, 100, 250, 500, 1000 };
+   uint32_t counts[32];
+   uint32_t countCount = 0;
+   uint32_t cores = (uint32_t)sysconf(_SC_NPROCESSORS_ONLN);
+   struct rlimit limit;
+   int failed = 0;
+   uint32_t i;
+   int opt;
+
+   ioCount = cores;
+   workerCount = cores;
+   while ((opt = getopt(argc, argv, "Pt:w:g:i:d:W:")) != -1) {
+      switch (opt) {
+         case 'P': usePty = 1; break;
+         case 't': ioCount = (uint32_t)strtoul(optarg, NULL, 0); break;
+         case 'w': workerCount = (uint32_t)strtoul(optarg, NULL, 0); break;
+         case 'g': generatorCount = (uint32_t)strtoul(optarg, NULL, 0); break;
+         case 'i': intervalUs = (uint32_t)strtoul(optarg, NULL, 0); break;
+         case 'd': seconds = atof(optarg); break;
+         case 'W': workNs = (uint32_t)strtoul(optarg, NULL, 0); break;
+         default:
+            fprintf(stderr, "usage: %s [-P] [-t io_threads] [-w workers] [-g generators] [-i interval_us] [-d seconds] [-W work_ns] [device_count ...]\n", argv[0]);
+            return 2;
+      }
+   }
+   for (; optind < argc && countCount < sizeof(counts) / sizeof(counts[0]); optind++) {
+      counts[countCount++] = (uint32_t)strtoul(argv[optind], NULL, 0);
+   }
+   if (countCount == 0) {
+      memcpy(counts, defaultCounts, sizeof(defaultCounts));
+      countCount = sizeof(defaultCounts) / sizeof(defaultCounts[0]);
+   }
+   if (ioCount > MAX_THREADS) ioCount = MAX_THREADS;
+   if (workerCount > MAX_THREADS) workerCount = MAX_THREADS;
+   if (generatorCount > MAX_THREADS) generatorCount = MAX_THREADS;
+   if (ioCount == 0 || workerCount == 0 || generatorCount == 0 || intervalUs == 0 || seconds <= 0) {
+      fprintf(stderr, "threads, interval and duration must not be 0\n");
+      return 2;
+   }
+
+   // two descriptors per scale
+   if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+      limit.rlim_cur = limit.rlim_max;
+      setrlimit(RLIMIT_NOFILE, &limit);
+   }
+
+   printf("%s links, %lu I/O threads, %lu workers, %lu generators, one %u byte frame per scale every %lu us, %.1f s per step\n",
+          usePty ? "pty" : "socket", (unsigned long)ioCount, (unsigned long)workerCount, (unsigned long)generatorCount,
+          4 + TELEMETRY_COUNT, (unsigned long)intervalUs, seconds);
+   printf("%8s %12s %10s %10s %14s %10s %8s %8s\n",
+          "scales", "frames/s", "p50 us", "p99 us", "CPU ms/1000", "throttled", "pauses", "lost");
+   for (i = 0; i < countCount; i++) {
+      T_Result result;
+
+      if (counts[i] == 0 || run(counts[i], &result) != 0) {
+         return 1;
+      }
+      printf("%8lu %12.0f %10.1f %10.1f %14.2f %10llu %8llu %8llu\n",
+             (unsigned long)counts[i], result.framesPerSecond, result.p50Us, result.p99Us, result.cpuMsPerThousand,
+             (unsigned long long)result.throttled, (unsigned long long)result.pauses,
+             (unsigned long long)(result.sent - result.telemetry + result.seqErrors));
+      fflush(stdout);
+      if (result.seqErrors > 0 || result.telemetry != result.sent) {
+         failed = 1;
+      }
+   }
+   return failed;
+}
@@ -0,0 +1,439 @@
+/*
+ * Fuzz target over the chillhub receive and dispatch path.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Every input is fed to a link twice: as raw bytes on the wire, and as a
+ * frame with a good CRC so it reaches dispatch.  The input is laid out like
+ * the frame without STX and CRC: the frame length, the message length, then
+ * the message type, data type and data.  Both lengths are taken as they are,
+ * so a frame shorter or longer than its message, or empty, still checks out
+ * and gets as far as the receive path lets it.
+ *
+ * The frame hook checks that the frame it is handed is the one received.
+ * The callbacks walk the data they are given with the payload views, arrays
+ * and JSON objects all the way down, and check that every view lies inside
+ * the message.  Firmware update messages go to the firmware update code,
+ * whose store checks that every chunk it is handed lies inside the message
+ * too.  The receive buffer is larger than most messages, so
+ * AddressSanitizer alone would not see a view that ran past the message but
+ * stayed in the buffer.
+ *
+ * Built with -DCHILLHUB_LIBFUZZER and clang's -fsanitize=fuzzer this is a
+ * libFuzzer target.  Otherwise main mutates a few well formed frames and an
+ * empty one for the given number of runs, changing the two lengths apart
+ * from the rest, with the sanitizers gcc has.
+ *
+ *   payloadfuzz [-n runs] [-s seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "chillhub.h"
+#include "crc.h"
+#include "fwupdate.h"
+
+#define STX 0xff
+#define ESC 0xfe
+
+static const uint8_t *pInput;
+static size_t inputLength;
+static size_t inputPos;
+static T_ChillHubCB hub;
+static volatile uint32_t checksum;
+
+static void discard(const uint8 wrBuf[], uint32 count) {
+   (void)wrBuf;
+   (void)count;
+}
+
+static uint32 inputAvailable(void) {
+   return (uint32)(inputLength - inputPos);
+}
+
+static uint32 readInput(void) {
+   return pInput[inputPos++];
+}
+
+static void print(const char8 string[]) {
+   (void)string;
+}
+
+static const T_Serial fuzzSerial = { discard, inputAvailable, readInput, print };
+
+// The data of the message being dispatched, in the receive buffer
+static void inMessage(const uint8_t *pData, uint8_t length) {
+   const uint8_t *pStart = &hub.recvBuf[3];
+   const uint8_t *pEnd = &hub.recvBuf[hub.bufIndex];
+
+   if ((length != 0) && ((pData < pStart) || (pData + length > pEnd))) {
+      fprintf(stderr, "view of %u bytes at %ld is outside the message, bytes 3 to %u\n",
+              length, (long)(pData - hub.recvBuf), hub.bufIndex);
+      abort();
+   }
+}
+
+// The frame handed to the frame hook, from the message type to the CRC
+static void checkFrame(T_ChillHubCB *pControlBlock, const uint8_t *pMsg, uint8_t length) {
+   (void)pControlBlock;
+   if ((pMsg != &hub.recvBuf[1]) || (1 + length != hub.bufIndex)) {
+      fprintf(stderr, "frame of %u bytes at %ld is not the %u bytes received\n",
+              length, (long)(pMsg - hub.recvBuf), hub.bufIndex);
+      abort();
+   }
+}
+
+static void touch(const T_ChillHubPayload *pPayload) {
+   uint8_t i;
+
+   inMessage(pPayload->pData, pPayload->length);
+   for (i = 0; i < pPayload->length; i++) {
+      checksum += pPayload->pData[i];
+   }
+}
+
+static void walk(const T_ChillHubPayload *pPayload, uint8_t depth) {
+   T_ChillHubPayload element;
+   T_ChillHubIter iter;
+   const char *pChars;
+   uint8_t length;
+   uint32_t u32;
+   int32_t i32;
+   int16_t i16;
+   int8_t i8;
+   uint8_t b;
+
+   touch(pPayload);
+   if (ChillHubPayload_AsUnsigned(pPayload, &u32)) {
+      checksum += u32;
+   }
+   if (ChillHubPayload_AsI8(pPayload, &i8) || ChillHubPayload_AsI16(pPayload, &i16) ||
+       ChillHubPayload_AsI32(pPayload, &i32) || ChillHubPayload_AsBoolean(pPayload, &b)) {
+      checksum++;
+   }
+   if (ChillHubPayload_AsString(pPayload, &pChars, &length)) {
+      inMessage((const uint8_t *)pChars, length);
+      checksum += (length != 0) ? (uint8_t)pChars[length - 1] : 0;
+   }
+   if (depth > 40) {
+      return;
+   }
+   if (ChillHubPayload_AsArray(pPayload, &iter)) {
+      while (ChillHubIter_Next(&iter, &element)) {
+         walk(&element, depth + 1);
+      }
+   }
+   if (ChillHubPayload_AsJson(pPayload, &iter)) {
+      while (ChillHubIter_NextField(&iter, &pChars, &length, &element)) {
+         inMessage((const uint8_t *)pChars, length);
+         checksum += (length != 0) ? (uint8_t)pChars[length - 1] : 0;
+         walk(&element, depth + 1);
+      }
+   }
+}
+
+static void walkPayload(uint8_t dataType, void *pData) {
+   (void)dataType;
+   (void)pData;
+   walk(ChillHub_GetPayload(&hub), 0);
+}
+
+static void timeCallback(uint8_t dataType, void *pData) {
+   const uint8_t *pTime = (const uint8_t *)pData;
+
+   (void)dataType;
+   inMessage(pTime, 4);
+   checksum += pTime[0] + pTime[1] + pTime[2] + pTime[3];
+   // answered, so ask again for the next one
+   ChillHub_GetTime(&hub, timeCallback);
+}
+
+// The firmware update, into a RAM store of a few chunks.
+static T_FwUpdateCB fwUpdate;
+static uint8_t staged[4 * FW_UPDATE_CHUNK_SIZE];
+
+static uint8_t stagedBegin(uint32_t size) {
+   return (size <= sizeof(staged)) ? FW_STORE_SUCCESS : FW_STORE_FAILURE;
+}
+
+static uint8_t stagedWrite(uint32_t offset, const uint8_t *pData, uint8_t length) {
+   inMessage(pData, length);
+   if (offset + length > sizeof(staged)) {
+      fprintf(stderr, "chunk of %u bytes at %lu is past the store\n", length, (unsigned long)offset);
+      abort();
+   }
+   memcpy(&staged[offset], pData, length);
+   return FW_STORE_SUCCESS;
+}
+
+static uint8_t stagedFinish(void) {
+   return FW_STORE_SUCCESS;
+}
+
+static uint8_t stagedRead(uint32_t offset, uint8_t *pData, uint8_t length) {
+   memcpy(pData, &staged[offset], length);
+   return FW_STORE_SUCCESS;
+}
+
+static const T_FwStore stagedStore = { sizeof(staged), stagedBegin, stagedWrite, stagedFinish, stagedRead };
+
+static void fwSendStatus(const uint8_t *pStatus, uint8_t length) {
+   ChillHub_SendU8ArrayMsg(&hub, FW_UPDATE_STATUS_MSG, pStatus, length);
+}
+
+static void fwCommit(void) {
+   checksum++;
+}
+
+static void fwStart(uint8_t dataType, void *pData) {
+   (void)dataType;
+   (void)pData;
+   FwUpdate_Start(&fwUpdate, ChillHub_GetPayload(&hub));
+}
+
+static void fwData(uint8_t dataType, void *pData) {
+   (void)dataType;
+   (void)pData;
+   FwUpdate_Data(&fwUpdate, ChillHub_GetPayload(&hub));
+}
+
+static void fwControl(uint8_t dataType, void *pData) {
+   (void)dataType;
+   (void)pData;
+   FwUpdate_Control(&fwUpdate, ChillHub_GetPayload(&hub));
+}
+
+static void setupLink(void) {
+   char cron[] = "* * * * *";
+
+   ChillHub_Init(&hub);
+   ChillHub_Setup(&hub, "fuzz", "uuid", &fuzzSerial);
+   ChillHub_SetFrameHook(&hub, checkFrame, NULL);
+   ChillHub_Subscribe(&hub, doorStatusMsgType, walkPayload);
+   ChillHub_Subscribe(&hub, deviceIdRequestType, walkPayload);
+   ChillHub_Subscribe(&hub, setDeviceUUIDType, walkPayload);
+   ChillHub_AddCloudListener(&hub, 0x60, walkPayload);
+   ChillHub_AddCloudListener(&hub, 0x94, walkPayload);
+   ChillHub_AddCloudListener(&hub, 0x97, walkPayload);
+   ChillHub_AddCloudListener(&hub, resourceUpdatedType, walkPayload);
+   ChillHub_SetAlarm(&hub, 'a', cron, (unsigned char)strlen(cron), walkPayload);
+   ChillHub_GetTime(&hub, timeCallback);
+   FwUpdate_Init(&fwUpdate, &stagedStore, fwSendStatus, fwCommit);
+   ChillHub_AddCloudListener(&hub, FW_UPDATE_START_MSG, fwStart);
+   ChillHub_AddCloudListener(&hub, FW_UPDATE_DATA_MSG, fwData);
+   ChillHub_AddCloudListener(&hub, FW_UPDATE_CONTROL_MSG, fwControl);
+}
+
+static void feed(const uint8_t *pData, size_t length) {
+   int guard = 0;
+
+   pInput = pData;
+   inputLength = length;
+   inputPos = 0;
+   while ((inputPos < inputLength || !ChillHub_IsIdle(&hub)) && (++guard < 100000)) {
+      ChillHub_Loop(&hub);
+   }
+}
+
+static void putEscaped(uint8_t *pOut, size_t *pIndex, uint8_t c) {
+   if ((c == STX) || (c == ESC)) {
+      pOut[(*pIndex)++] = ESC;
+   }
+   pOut[(*pIndex)++] = c;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *pData, size_t size) {
+   static uint8_t initialized = 0;
+   uint8_t frame[2 * (CHILLHUB_BUFFER_SIZE + 4)];
+   uint8_t body[CHILLHUB_BUFFER_SIZE];
+   size_t bodyLength;
+   size_t index = 0;
+   size_t i;
+   uint16_t crc;
+
+   if (!initialized) {
+      setupLink();
+      initialized = 1;
+   }
+
+   // the raw bytes, then the same bytes as a good frame
+   feed(pData, size);
+
+   if (size < 2) {
+      return 0;
+   }
+   // as many bytes as the frame length asks for, zeros past the input; a
+   // length the link turns away still has its bytes sent as noise
+   bodyLength = (pData[0] < sizeof(body)) ? pData[0] : sizeof(body);
+   memset(body, 0, sizeof(body));
+   memcpy(body, &pData[1], (size - 1 < bodyLength) ? size - 1 : bodyLength);
+   crc = crc_finalize(crc_update(crc_init(), body, bodyLength));
+   frame[index++] = STX;
+   putEscaped(frame, &index, pData[0]);
+   for (i = 0; i < bodyLength; i++) {
+      putEscaped(frame, &index, body[i]);
+   }
+   putEscaped(frame, &index, (crc >> 8) & 0xff);
+   putEscaped(frame, &index, crc & 0xff);
+   feed(frame, index);
+   return 0;
+}
+
+#ifndef CHILLHUB_LIBFUZZER
+
+// each with its frame length and message length in front
+static const uint8_t seedDoor[] = { 4, 3, doorStatusMsgType, unsigned8DataType, 1 };
+static const uint8_t seedTelemetry[] = { 5, 4, 0x97, unsigned16DataType, 0x00, 0x0a };
+static const uint8_t seedTime[] = { 9, 8, timeResponseMsgType, arrayDataType, 4, unsigned8DataType, 1, 2, 3, 4 };
+static const uint8_t seedAlarm[] = { 10, 9, alarmNotifyMsgType, arrayDataType, 5, unsigned8DataType, 'a', 1, 2, 3, 4 };
+static const uint8_t seedUuid[] = { 8, 7, setDeviceUUIDType, stringDataType, 4, 'u', 'u', 'i', 'd' };
+static const uint8_t seedNested[] = { 11, 10, 0x60, arrayDataType, 2, arrayDataType, 1, stringDataType, 1, 'x',
+                                      0, unsigned8DataType };
+static const uint8_t seedJson[] = { 19, 18, resourceUpdatedType, jsonDataType, 2, 5, 'r', 'e', 's', 'I', 'D',
+                                    unsigned8DataType, 0x94, 3, 'v', 'a', 'l', unsigned16DataType, 0, 1 };
+// an image of 58 bytes, its first chunk with a good CRC and the rest of it
+static const uint8_t seedFwStart[] = { 11, 10, FW_UPDATE_START_MSG, arrayDataType, 6, unsigned8DataType,
+                                       0, 0, 0, 58, 0x5a, 0xa5 };
+static uint8_t seedFwData[2 + 4 + 4 + FW_UPDATE_CHUNK_SIZE] = { 1 + 4 + 4 + FW_UPDATE_CHUNK_SIZE,
+                                                                4 + 4 + FW_UPDATE_CHUNK_SIZE,
+                                                                FW_UPDATE_DATA_MSG, arrayDataType,
+                                                                4 + FW_UPDATE_CHUNK_SIZE, unsigned8DataType };
+static uint8_t seedFwLast[2 + 4 + 4 + 10] = { 1 + 4 + 4 + 10, 4 + 4 + 10, FW_UPDATE_DATA_MSG, arrayDataType,
+                                              4 + 10, unsigned8DataType, 0, 1 };
+static const uint8_t seedFwControl[] = { 4, 3, FW_UPDATE_CONTROL_MSG, unsigned8DataType, FW_UPDATE_VERIFY };
+// no message at all: the CRC of no bytes is 0xffff, so the frame checks out
+static const uint8_t seedEmpty[] = { 0, 0 };
+
+static const struct {
+   const uint8_t *pData;
+   size_t length;
+} seeds[] = {
+   { seedDoor, sizeof(seedDoor) },
+   { seedTelemetry, sizeof(seedTelemetry) },
+   { seedTime, sizeof(seedTime) },
+   { seedAlarm, sizeof(seedAlarm) },
+   { seedUuid, sizeof(seedUuid) },
+   { seedNested, sizeof(seedNested) },
+   { seedJson, sizeof(seedJson) },
+   { seedFwStart, sizeof(seedFwStart) },
+   { seedFwData, sizeof(seedFwData) },
+   { seedFwLast, sizeof(seedFwLast) },
+   { seedFwControl, sizeof(seedFwControl) },
+   { seedEmpty, sizeof(seedEmpty) },
+};
+
+// The CRC of a chunk seed, over its sequence and data.
+static void signChunk(uint8_t *pSeed, size_t length) {
+   crc_t crc = crc_finalize(crc_update(crc_update(crc_init(), &pSeed[6], 2), &pSeed[10], length - 10));
+
+   pSeed[8] = (uint8_t)(crc >> 8);
+   pSeed[9] = (uint8_t)crc;
+}
+
+static uint32_t lcg;
+
+static uint32_t nextRandom(void) {
+   lcg = lcg * 1664525u + 1013904223u;
+   return lcg >> 8;
+}
+
+int main(int argc, char **argv) {
+   uint8_t input[CHILLHUB_BUFFER_SIZE];
+   uint32_t runs = 1000000;
+   uint32_t run;
+   int opt;
+
+   signChunk(seedFwData, sizeof(seedFwData));
+   signChunk(seedFwLast, sizeof(seedFwLast));
+   lcg = 1;
+   while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+      switch (opt) {
+         case 'n': runs = (uint32_t)strtoul(optarg, NULL, 0); break;
+         case 's': lcg = (uint32_t)strtoul(optarg, NULL, 0); break;
+         default:
+            fprintf(stderr, "usage: %s [-n runs] [-s seed]\n", argv[0]);
+            return 2;
+      }
+   }
+
+   for (run = 0; run < runs; run++) {
+      uint32_t seed = nextRandom() % (sizeof(seeds) / sizeof(seeds[0]));
+      size_t length = seeds[seed].length;
+      uint32_t mutations = 1 + nextRandom() % 4;
+      uint32_t m;
+
+      memcpy(input, seeds[seed].pData, length);
+      for (m = 0; m < mutations; m++) {
+         size_t at = nextRandom() % (length + 1);
+
+         switch (nextRandom() % 5) {
+            case 0:
+               // a byte changed, kept small often so lengths and types stay near valid
+               if (at < length) {
+                  input[at] = (nextRandom() & 1) ? (uint8_t)nextRandom() : (uint8_t)(input[at] + 1);
+               }
+               break;
+            case 1:
+               // cut short
+               length = at;
+               break;
+            case 2:
+               // a byte inserted
+               if (length < sizeof(input)) {
+                  memmove(&input[at + 1], &input[at], length - at);
+                  input[at] = (uint8_t)nextRandom();
+                  length++;
+               }
+               break;
+            case 3:
+               // one of the two lengths, on its own, often off by one or 0
+               at = nextRandom() & 1;
+               if (at < length) {
+                  switch (nextRandom() % 3) {
+                     case 0: input[at] = (uint8_t)nextRandom(); break;
+                     case 1: input[at] = (uint8_t)(input[at] + ((nextRandom() & 1) ? 1 : -1)); break;
+                     default: input[at] = 0; break;
+                  }
+               }
+               break;
+            default:
+               // a data type where a count or a value was
+               if (at < length) {
+                  input[at] = (uint8_t)(nextRandom() % 0x11);
+               }
+               break;
+         }
+      }
+      LLVMFuzzerTestOneInput(input, length);
+   }
+
+   printf("payloadfuzz: %lu runs, %lu frames, %lu malformed, %lu CRC failures, %u firmware chunks rejected\n",
+          (unsigned long)runs, (unsigned long)ChillHub_GetStats(&hub)->framesRx,
+          (unsigned long)ChillHub_GetStats(&hub)->malformedMessages,
+          (unsigned long)ChillHub_GetStats(&hub)->crcFailures, fwUpdate.rejectedChunks);
+   return 0;
+}
+
+#endif
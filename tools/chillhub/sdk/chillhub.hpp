@@ -0,0 +1,1311 @@
+/*
+ * Header-only C++ library for the chillhub wire format.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Host side encoding and decoding of chillhub frames, built on the message
+ * and data types in the firmware's chillhub.h so the two cannot drift apart.
+ * Needs C++20 and the firmware directory (plus test/stubs for cytypes.h) on
+ * the include path.
+ *
+ * Nothing here allocates:
+ *  - Message collects a message (type, data type, data) in a fixed buffer,
+ *    and encode() frames it into a caller's span: STX, length, body, CRC,
+ *    with STX and ESC escaped, exactly as sendPacket does.
+ *  - Decoder takes bytes as they come and hands out each good frame as a
+ *    move-only Frame that points into one of the decoder's slots.  The slot
+ *    is reused once the Frame is gone; while all slots are held, the decoder
+ *    stops taking input.
+ *  - Link pairs a decoder with a write function and turns the two
+ *    request/response exchanges into awaitables: getTime() completes with the
+ *    next timeResponse, requestDeviceId() with the next deviceId.  The
+ *    coroutines that await them are the caller's; Task is a minimal one.
+ *
+ * The decoder looks for STX and ESC 16 bytes at a time with SSE2 and copies
+ * the bytes between them with memcpy; only an escape goes through the byte
+ * at a time path.  An AVX2 scan, 32 bytes at a time, can be picked with
+ * setScan() but is not the default: the runs between control bytes are
+ * shorter than a frame, so it measures no faster than SSE2.
+ *
+ * The decoder follows the firmware's receiver: the length must be below
+ * CHILLHUB_BUFFER_SIZE - 2, an unescaped STX inside a frame is taken as data,
+ * and a frame with a bad CRC is dropped.  Unlike the firmware it has no 64
+ * byte ring in front, so heavily escaped frames the firmware would overrun
+ * on still decode.
+ */
+
+#ifndef CHILLHUB_HPP
+#define CHILLHUB_HPP
+
+#include <algorithm>
+#include <array>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <utility>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CHILLHUB_HPP_X86 1
+#endif
+
+extern "C"
+{
+#include "chillhub.h"
+}
+
+namespace chillhub
+{
+
+inline constexpr uint8_t STX = 0xff;
+inline constexpr uint8_t ESC = 0xfe;
+
+// The longest message (message type, data type, data) the firmware accepts:
+// its length byte, the message and the CRC fit in the receive buffer.
+inline constexpr size_t maxMessage = CHILLHUB_BUFFER_SIZE - 4;
+
+// Worst case on the wire: STX, then the length, the body and the CRC all
+// escaped.
+inline constexpr size_t maxFrame = 1 + 2 * (1 + 1 + maxMessage + 2);
+
+/*
+ * CRC-16/CCITT as in crc.c, initial value 0xffff.  Eight bytes at a time
+ * with a table for each position ("slicing by 8"); crcTables[0] is the
+ * byte at a time table crc.c uses.
+ */
+
+namespace detail
+{
+   constexpr std::array<std::array<uint16_t, 256>, 8> makeCrcTables()
+   {
+      std::array<std::array<uint16_t, 256>, 8> tables{};
+
+      for (unsigned i = 0; i < 256; i++) {
+         uint16_t crc = (uint16_t)(i << 8);
+         for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+         }
+         tables[0][i] = crc;
+      }
+      // tables[k][x] is the CRC of x followed by k zero bytes
+      for (size_t k = 1; k < tables.size(); k++) {
+         for (unsigned i = 0; i < 256; i++) {
+            uint16_t crc = tables[k - 1][i];
+            tables[k][i] = (uint16_t)(tables[0][crc >> 8] ^ (crc << 8));
+         }
+      }
+      return tables;
+   }
+
+   inline constexpr std::array<std::array<uint16_t, 256>, 8> crcTables = makeCrcTables();
+}
+
+inline constexpr uint16_t crcInit = 0xffff;
+
+constexpr uint16_t crcUpdate(uint16_t crc, std::span<const uint8_t> data)
+{
+   const auto &t = detail::crcTables;
+   size_t i = 0;
+
+   for (; i + 8 <= data.size(); i += 8) {
+      crc = (uint16_t)(t[7][((crc >> 8) ^ data[i]) & 0xff] ^ t[6][(crc ^ data[i + 1]) & 0xff] ^
+                       t[5][data[i + 2]] ^ t[4][data[i + 3]] ^ t[3][data[i + 4]] ^ t[2][data[i + 5]] ^
+                       t[1][data[i + 6]] ^ t[0][data[i + 7]]);
+   }
+   for (; i < data.size(); i++) {
+      crc = (uint16_t)(t[0][((crc >> 8) ^ data[i]) & 0xff] ^ (crc << 8));
+   }
+   return crc;
+}
+
+/*
+ * The schema in chillhubSchema.h, at compile time
+ */
+
+namespace schema
+{
+   // Data bytes a value of the data type takes, 0 if the data says how long
+   // it is
+   constexpr uint8_t sizeOf(uint8_t dataType)
+   {
+      switch (dataType) {
+#define CHILLHUB_HPP_SIZE_CASE(name, value, size) \
+      case name:                                  \
+         return size;
+         CHILLHUB_DATA_TYPES(CHILLHUB_HPP_SIZE_CASE)
+#undef CHILLHUB_HPP_SIZE_CASE
+      default:
+         return 0;
+      }
+   }
+
+   // The data type a message type carries, if the schema lists it
+   constexpr std::optional<uint8_t> dataTypeOf(uint8_t msgType)
+   {
+      switch (msgType) {
+#define CHILLHUB_HPP_TYPE_CASE(name, value, dataType) \
+      case name:                                      \
+         return (uint8_t)dataType;
+         CHILLHUB_MSG_TYPES(CHILLHUB_HPP_TYPE_CASE)
+#undef CHILLHUB_HPP_TYPE_CASE
+      default:
+         return std::nullopt;
+      }
+   }
+
+   constexpr bool isScalar(uint8_t dataType)
+   {
+      return sizeOf(dataType) > 0;
+   }
+
+   // The C++ type of a scalar data type
+   template <uint8_t DataType> struct Value;
+   template <> struct Value<unsigned8DataType> { using type = uint8_t; };
+   template <> struct Value<signed8DataType> { using type = int8_t; };
+   template <> struct Value<unsigned16DataType> { using type = uint16_t; };
+   template <> struct Value<signed16DataType> { using type = int16_t; };
+   template <> struct Value<unsigned32DataType> { using type = uint32_t; };
+   template <> struct Value<signed32DataType> { using type = int32_t; };
+   template <> struct Value<booleanDataType> { using type = bool; };
+
+   template <uint8_t DataType>
+   using ValueOf = typename Value<DataType>::type;
+
+   // Length of a message with a scalar, and the most bytes its frame can take
+   // on the wire: STX, then the length, the length byte again, the message
+   // and the CRC, all escaped
+   template <uint8_t DataType>
+   inline constexpr size_t scalarMessageLength = 2 + sizeOf(DataType);
+
+   template <uint8_t DataType>
+   inline constexpr size_t scalarFrameMax = 1 + 2 * (2 + scalarMessageLength<DataType> + 2);
+
+   static_assert(scalarMessageLength<unsigned16DataType> == CHILLHUB_SCALAR_MSG_LEN(unsigned16DataType));
+}
+
+/*
+ * Encoding
+ */
+
+class Message
+{
+public:
+   explicit Message(uint8_t msgType)
+   {
+      body_[1] = msgType;
+      size_ = 2;
+   }
+
+   Message(uint8_t msgType, uint8_t dataType) : Message(msgType)
+   {
+      u8(dataType);
+   }
+
+   Message &u8(uint8_t v)
+   {
+      if (size_ < 1 + maxMessage) {
+         body_[size_++] = v;
+      } else {
+         overflow_ = true;
+      }
+      return *this;
+   }
+
+   Message &u16(uint16_t v)
+   {
+      return u8((uint8_t)(v >> 8)).u8((uint8_t)v);
+   }
+
+   Message &bytes(std::span<const uint8_t> data)
+   {
+      for (uint8_t b : data) {
+         u8(b);
+      }
+      return *this;
+   }
+
+   // A string with its length in front, as in deviceId and in JSON values
+   Message &string(std::string_view s)
+   {
+      if (s.size() > 0xff) {
+         overflow_ = true;
+         return *this;
+      }
+      u8((uint8_t)s.size());
+      return bytes(std::span<const uint8_t>((const uint8_t *)s.data(), s.size()));
+   }
+
+   // The JSON-ish fields of createCloudResourceU16 and updateCloudResourceU16
+   Message &jsonKey(std::string_view key)
+   {
+      return string(key);
+   }
+
+   Message &jsonU8(uint8_t v)
+   {
+      return u8(unsigned8DataType).u8(v);
+   }
+
+   Message &jsonU16(uint16_t v)
+   {
+      return u8(unsigned16DataType).u16(v);
+   }
+
+   Message &jsonString(std::string_view s)
+   {
+      return u8(stringDataType).string(s);
+   }
+
+   bool ok() const
+   {
+      return !overflow_;
+   }
+
+   // Message type, data type, data
+   std::span<const uint8_t> message() const
+   {
+      return std::span<const uint8_t>(&body_[1], size_ - 1);
+   }
+
+   // Frames the message into out.  Returns the bytes written, or an empty
+   // span if the message overflowed or out is too short.
+   std::span<uint8_t> encode(std::span<uint8_t> out) const
+   {
+      size_t n = 0;
+      uint16_t crc;
+
+      if (overflow_) {
+         return {};
+      }
+      body_[0] = (uint8_t)(size_ - 1);
+      crc = crcUpdate(crcInit, std::span<const uint8_t>(body_.data(), size_));
+
+      if (!put(out, n, STX, false) || !put(out, n, (uint8_t)size_, true)) {
+         return {};
+      }
+      for (size_t i = 0; i < size_; i++) {
+         if (!put(out, n, body_[i], true)) {
+            return {};
+         }
+      }
+      if (!put(out, n, (uint8_t)(crc >> 8), true) || !put(out, n, (uint8_t)crc, true)) {
+         return {};
+      }
+      return out.first(n);
+   }
+
+private:
+   static bool put(std::span<uint8_t> out, size_t &n, uint8_t b, bool escape)
+   {
+      if (escape && (b == STX || b == ESC)) {
+         if (n >= out.size()) {
+            return false;
+         }
+         out[n++] = ESC;
+      }
+      if (n >= out.size()) {
+         return false;
+      }
+      out[n++] = b;
+      return true;
+   }
+
+   // length byte, then the message
+   mutable std::array<uint8_t, 1 + maxMessage> body_;
+   size_t size_ = 0;
+   bool overflow_ = false;
+};
+
+// A scalar of the given data type, most significant byte first
+template <uint8_t DataType>
+std::span<uint8_t> encodeScalar(std::span<uint8_t> out, uint8_t msgType, schema::ValueOf<DataType> v)
+{
+   Message msg(msgType, DataType);
+   uint32_t bits = (uint32_t)v;
+
+   for (size_t i = schema::sizeOf(DataType); i > 0; i--) {
+      msg.u8((uint8_t)(bits >> (8 * (i - 1))));
+   }
+   return msg.encode(out);
+}
+
+// A message type the schema lists with a scalar data type, with a value
+// of that type
+template <uint8_t MsgType>
+std::span<uint8_t> encode(std::span<uint8_t> out, schema::ValueOf<*schema::dataTypeOf(MsgType)> v)
+{
+   static_assert(schema::isScalar(*schema::dataTypeOf(MsgType)), "message type carries no scalar");
+   return encodeScalar<*schema::dataTypeOf(MsgType)>(out, MsgType, v);
+}
+
+// One encoder for each of the firmware's senders
+inline std::span<uint8_t> encodeU8(std::span<uint8_t> out, uint8_t msgType, uint8_t v)
+{
+   return encodeScalar<unsigned8DataType>(out, msgType, v);
+}
+
+inline std::span<uint8_t> encodeI8(std::span<uint8_t> out, uint8_t msgType, int8_t v)
+{
+   return encodeScalar<signed8DataType>(out, msgType, v);
+}
+
+inline std::span<uint8_t> encodeU16(std::span<uint8_t> out, uint8_t msgType, uint16_t v)
+{
+   return encodeScalar<unsigned16DataType>(out, msgType, v);
+}
+
+inline std::span<uint8_t> encodeI16(std::span<uint8_t> out, uint8_t msgType, int16_t v)
+{
+   return encodeScalar<signed16DataType>(out, msgType, v);
+}
+
+inline std::span<uint8_t> encodeBoolean(std::span<uint8_t> out, uint8_t msgType, bool v)
+{
+   return encodeScalar<booleanDataType>(out, msgType, v);
+}
+
+inline std::span<uint8_t> encodeU8Array(std::span<uint8_t> out, uint8_t msgType, std::span<const uint8_t> data)
+{
+   if (data.size() > 0xff) {
+      return {};
+   }
+   return Message(msgType, arrayDataType).u8((uint8_t)data.size()).u8(unsigned8DataType).bytes(data).encode(out);
+}
+
+inline std::span<uint8_t> encodeU16Array(std::span<uint8_t> out, uint8_t msgType, std::span<const uint16_t> data)
+{
+   if (data.size() > 0xff) {
+      return {};
+   }
+   Message m(msgType, arrayDataType);
+   m.u8((uint8_t)data.size()).u8(unsigned16DataType);
+   for (uint16_t v : data) {
+      m.u16(v);
+   }
+   return m.encode(out);
+}
+
+inline std::span<uint8_t> encodeDeviceId(std::span<uint8_t> out, std::string_view name, std::string_view uuid)
+{
+   return Message(deviceIdMsgType, arrayDataType).u8(2).u8(stringDataType).string(name).string(uuid).encode(out);
+}
+
+inline std::span<uint8_t> encodeDeviceIdRequest(std::span<uint8_t> out)
+{
+   return encodeU8(out, deviceIdRequestType, 0);
+}
+
+inline std::span<uint8_t> encodeGetTime(std::span<uint8_t> out)
+{
+   return Message(getTimeMsgType).encode(out);
+}
+
+inline std::span<uint8_t> encodeTimeResponse(std::span<uint8_t> out, const std::array<uint8_t, 4> &time)
+{
+   return Message(timeResponseMsgType, arrayDataType).u8(4).u8(unsigned8DataType).bytes(time).encode(out);
+}
+
+inline std::span<uint8_t> encodeRegisterResourceU16(std::span<uint8_t> out, std::string_view name, uint8_t resID,
+                                                    bool canUpdate, uint16_t initVal)
+{
+   return Message(registerResourceType, jsonDataType)
+      .u8(4)
+      .jsonKey("name").jsonString(name)
+      .jsonKey("resID").jsonU8(resID)
+      .jsonKey("canUp").jsonU8(canUpdate ? 1 : 0)
+      .jsonKey("initVal").jsonU16(initVal)
+      .encode(out);
+}
+
+inline std::span<uint8_t> encodeUpdateResourceU16(std::span<uint8_t> out, uint8_t resID, uint16_t val)
+{
+   return Message(updateResourceType, jsonDataType)
+      .u8(2)
+      .jsonKey("resID").jsonU8(resID)
+      .jsonKey("val").jsonU16(val)
+      .encode(out);
+}
+
+inline std::span<uint8_t> encodeSubscribe(std::span<uint8_t> out, uint8_t type)
+{
+   return encodeU8(out, subscribeMsgType, type);
+}
+
+inline std::span<uint8_t> encodeUnsubscribe(std::span<uint8_t> out, uint8_t type)
+{
+   return encodeU8(out, unsubscribeMsgType, type);
+}
+
+// The ID rides in front of the cron string, counted in its length
+inline std::span<uint8_t> encodeSetAlarm(std::span<uint8_t> out, uint8_t id, std::string_view cron)
+{
+   if (cron.size() >= 0xff) {
+      return {};
+   }
+   return Message(setAlarmMsgType, stringDataType)
+      .u8((uint8_t)(cron.size() + 1))
+      .u8(id)
+      .bytes(std::span<const uint8_t>((const uint8_t *)cron.data(), cron.size()))
+      .encode(out);
+}
+
+/*
+ * Scanning for control bytes
+ */
+
+enum class Scan : uint8_t { Scalar, Sse2, Avx2 };
+
+namespace detail
+{
+   inline size_t findScalar(const uint8_t *p, size_t n, uint8_t value)
+   {
+      size_t i = 0;
+
+      while (i < n && p[i] != value) {
+         i++;
+      }
+      return i;
+   }
+
+#ifdef CHILLHUB_HPP_X86
+   __attribute__((target("sse2"))) inline size_t findSse2(const uint8_t *p, size_t n, uint8_t value)
+   {
+      const __m128i v = _mm_set1_epi8((char)value);
+      size_t i = 0;
+
+      for (; i + 16 <= n; i += 16) {
+         __m128i x = _mm_loadu_si128((const __m128i *)(p + i));
+         unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, v));
+         if (mask != 0) {
+            return i + (size_t)__builtin_ctz(mask);
+         }
+      }
+      return i + findScalar(p + i, n - i, value);
+   }
+
+   __attribute__((target("avx2"))) inline size_t findAvx2(const uint8_t *p, size_t n, uint8_t value)
+   {
+      const __m256i v = _mm256_set1_epi8((char)value);
+      size_t i = 0;
+
+      for (; i + 32 <= n; i += 32) {
+         __m256i x = _mm256_loadu_si256((const __m256i *)(p + i));
+         unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, v));
+         if (mask != 0) {
+            return i + (size_t)__builtin_ctz(mask);
+         }
+      }
+      return i + findSse2(p + i, n - i, value);
+   }
+#endif
+
+   using FindFunction = size_t (*)(const uint8_t *p, size_t n, uint8_t value);
+
+   // The widest scan the CPU has
+   inline Scan supportedScan()
+   {
+#ifdef CHILLHUB_HPP_X86
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx2")) {
+         return Scan::Avx2;
+      }
+      if (__builtin_cpu_supports("sse2")) {
+         return Scan::Sse2;
+      }
+#endif
+      return Scan::Scalar;
+   }
+
+   // A frame is at most 64 bytes, so the 32 byte AVX2 loop rarely runs more
+   // than once before the match; SSE2 is as fast and is used where both are.
+   inline Scan defaultScan()
+   {
+      return std::min(supportedScan(), Scan::Sse2);
+   }
+
+   inline FindFunction findFor(Scan scan)
+   {
+#ifdef CHILLHUB_HPP_X86
+      if (scan == Scan::Avx2) {
+         return findAvx2;
+      }
+      if (scan == Scan::Sse2) {
+         return findSse2;
+      }
+#endif
+      (void)scan;
+      return findScalar;
+   }
+
+   struct Scanner
+   {
+      Scan scan = defaultScan();
+      FindFunction find = findFor(scan);
+   };
+
+   inline Scanner &scanner()
+   {
+      static Scanner instance;
+      return instance;
+   }
+}
+
+// The scan in use; SSE2 where the CPU has it unless setScan() chose another.
+inline Scan scan()
+{
+   return detail::scanner().scan;
+}
+
+// Picks a scan, limited to what the CPU has, and returns the one in use.
+// Meant for tests and benchmarks: it is not safe while another thread
+// decodes.
+inline Scan setScan(Scan want)
+{
+   detail::Scanner &scanner = detail::scanner();
+
+   scanner.scan = std::min(want, detail::supportedScan());
+   scanner.find = detail::findFor(scanner.scan);
+   return scanner.scan;
+}
+
+// Index of the first value in p[0..n), or n if there is none
+inline size_t findByte(const uint8_t *p, size_t n, uint8_t value)
+{
+   return detail::scanner().find(p, n, value);
+}
+
+/*
+ * Decoding
+ */
+
+class Decoder;
+
+class Frame
+{
+public:
+   Frame(Frame &&other) noexcept : owner_(std::exchange(other.owner_, nullptr)), slot_(other.slot_)
+   {
+   }
+
+   Frame &operator=(Frame &&other) noexcept
+   {
+      if (this != &other) {
+         release();
+         owner_ = std::exchange(other.owner_, nullptr);
+         slot_ = other.slot_;
+      }
+      return *this;
+   }
+
+   Frame(const Frame &) = delete;
+   Frame &operator=(const Frame &) = delete;
+
+   ~Frame()
+   {
+      release();
+   }
+
+   // Message type, data type, data
+   std::span<const uint8_t> message() const;
+
+   uint8_t msgType() const
+   {
+      return message().empty() ? 0 : message()[0];
+   }
+
+   uint8_t dataType() const
+   {
+      return (message().size() < 2) ? 0 : message()[1];
+   }
+
+   std::span<const uint8_t> data() const
+   {
+      return (message().size() < 2) ? std::span<const uint8_t>() : message().subspan(2);
+   }
+
+   // The value, if the frame carries a scalar of this data type
+   template <uint8_t DataType>
+   std::optional<schema::ValueOf<DataType>> value() const
+   {
+      std::span<const uint8_t> d = data();
+      uint32_t v = 0;
+
+      if (dataType() != DataType || d.size() < schema::sizeOf(DataType)) {
+         return std::nullopt;
+      }
+      for (size_t i = 0; i < schema::sizeOf(DataType); i++) {
+         v = (v << 8) | d[i];
+      }
+      if constexpr (DataType == booleanDataType) {
+         return v != 0;
+      } else {
+         return (schema::ValueOf<DataType>)v;
+      }
+   }
+
+   // The value of a message type the schema lists with a scalar, if this
+   // frame is that message with the data type the schema gives it
+   template <uint8_t MsgType>
+   std::optional<schema::ValueOf<*schema::dataTypeOf(MsgType)>> as() const
+   {
+      if (msgType() != MsgType) {
+         return std::nullopt;
+      }
+      return value<*schema::dataTypeOf(MsgType)>();
+   }
+
+   // Whether the data is of the type the schema gives the message type and
+   // as long as that type needs, as the firmware checks before it hands a
+   // message to a callback.  The time in a time
+   // response or an alarm must also be an array of U8, alarm ID first.
+   bool fits() const
+   {
+      size_t needed = 2 + schema::sizeOf(dataType());
+      size_t elements = 0;
+      std::optional<uint8_t> expected = schema::dataTypeOf(msgType());
+
+      if (expected && *expected != dataType()) {
+         return false;
+      }
+      if (msgType() == timeResponseMsgType) {
+         needed = 2 + 2 + 4;
+         elements = 4;
+      } else if (msgType() == alarmNotifyMsgType) {
+         needed = 2 + 2 + 1 + 4;
+         elements = 5;
+      }
+      if (message().size() < needed) {
+         return false;
+      }
+      return (elements == 0) || ((dataType() == arrayDataType) && (message()[2] >= elements) &&
+                                 (message()[3] == unsigned8DataType));
+   }
+
+   std::optional<uint8_t> u8() const
+   {
+      return value<unsigned8DataType>();
+   }
+
+   std::optional<int8_t> i8() const
+   {
+      return value<signed8DataType>();
+   }
+
+   std::optional<uint16_t> u16() const
+   {
+      return value<unsigned16DataType>();
+   }
+
+   std::optional<int16_t> i16() const
+   {
+      return value<signed16DataType>();
+   }
+
+   std::optional<uint32_t> u32() const
+   {
+      return value<unsigned32DataType>();
+   }
+
+   std::optional<bool> boolean() const
+   {
+      return value<booleanDataType>();
+   }
+
+   // The elements of an array of U8
+   std::optional<std::span<const uint8_t>> u8Array() const
+   {
+      std::span<const uint8_t> d = data();
+
+      if (dataType() != arrayDataType || d.size() < 2 || d[1] != unsigned8DataType || d.size() - 2 < d[0]) {
+         return std::nullopt;
+      }
+      return d.subspan(2, d[0]);
+   }
+
+private:
+   friend class Decoder;
+
+   Frame(Decoder *owner, uint8_t slot) : owner_(owner), slot_(slot)
+   {
+   }
+
+   void release();
+
+   Decoder *owner_;
+   uint8_t slot_;
+};
+
+class Decoder
+{
+public:
+   static constexpr uint8_t slotCount = 4;
+
+   struct Stats
+   {
+      uint32_t frames = 0;
+      uint32_t crcFailures = 0;
+      uint32_t oversizeFrames = 0;
+      uint32_t shortFrames = 0;    // lengths too short for the two types
+      uint32_t resyncs = 0;
+   };
+
+   Decoder() = default;
+   Decoder(const Decoder &) = delete;
+   Decoder &operator=(const Decoder &) = delete;
+
+   // Takes bytes from the front of in until a good frame is complete or in is
+   // used up.  While every slot is held by a Frame nothing is taken.
+   std::optional<Frame> next(std::span<const uint8_t> &in)
+   {
+      size_t i = 0;
+      std::optional<Frame> frame;
+
+      while (i < in.size() && !frame) {
+         uint8_t b;
+
+         if (state_ == State::Stx) {
+            size_t skip = findByte(&in[i], in.size() - i, STX);
+
+            if (skip > 0) {
+               i += skip;
+               skipped_ = true;
+               continue;
+            }
+         } else if (state_ == State::Body && !escaped_) {
+            // an unescaped STX is data here, so only ESC needs the slow path
+            size_t want = std::min<size_t>((size_t)length_ + 2 - fill_, in.size() - i);
+            size_t run = findByte(&in[i], want, ESC);
+
+            if (run > 0) {
+               std::memcpy(&slots_[current_].bytes[fill_], &in[i], run);
+               fill_ = (uint8_t)(fill_ + run);
+               i += run;
+               if (fill_ >= length_ + 2) {
+                  state_ = State::Stx;
+                  frame = finish();
+               }
+               continue;
+            }
+         }
+
+         b = in[i];
+         if (state_ == State::Stx) {
+            i++;
+            if (b == STX) {
+               if (skipped_) {
+                  stats_.resyncs++;
+                  skipped_ = false;
+               }
+               state_ = State::Length;
+               escaped_ = false;
+            } else {
+               skipped_ = true;
+            }
+            continue;
+         }
+
+         if (state_ == State::Length) {
+            if (b == ESC && !escaped_) {
+               i++;
+               escaped_ = true;
+               continue;
+            }
+            if (b >= CHILLHUB_BUFFER_SIZE - 2) {
+               i++;
+               escaped_ = false;
+               stats_.oversizeFrames++;
+               state_ = State::Stx;
+               continue;
+            }
+            if (b < 3) {
+               // no room for the message type and data type; the firmware
+               // turns these away at the length too
+               i++;
+               escaped_ = false;
+               stats_.shortFrames++;
+               state_ = State::Stx;
+               continue;
+            }
+            if (!claimSlot()) {
+               // nowhere to put it; the byte is taken once a Frame is gone
+               break;
+            }
+            i++;
+            escaped_ = false;
+            length_ = b;
+            fill_ = 0;
+            state_ = State::Body;
+            continue;
+         }
+
+         i++;
+         if (b == ESC && !escaped_) {
+            escaped_ = true;
+            continue;
+         }
+         escaped_ = false;
+         slots_[current_].bytes[fill_++] = b;
+         if (fill_ >= length_ + 2) {
+            state_ = State::Stx;
+            frame = finish();
+         }
+      }
+
+      in = in.subspan(i);
+      return frame;
+   }
+
+   const Stats &stats() const
+   {
+      return stats_;
+   }
+
+   uint8_t slotsHeld() const
+   {
+      uint8_t n = 0;
+      for (const Slot &slot : slots_) {
+         n += slot.held ? 1 : 0;
+      }
+      return n;
+   }
+
+private:
+   friend class Frame;
+
+   enum class State : uint8_t { Stx, Length, Body };
+
+   struct Slot
+   {
+      std::array<uint8_t, CHILLHUB_BUFFER_SIZE> bytes{};
+      uint8_t length = 0;
+      bool held = false;
+   };
+
+   bool claimSlot()
+   {
+      for (uint8_t i = 0; i < slotCount; i++) {
+         if (!slots_[i].held) {
+            current_ = i;
+            return true;
+         }
+      }
+      return false;
+   }
+
+   std::optional<Frame> finish()
+   {
+      Slot &slot = slots_[current_];
+      uint16_t crcSent = (uint16_t)((slot.bytes[length_] << 8) | slot.bytes[length_ + 1]);
+
+      if (crcUpdate(crcInit, std::span<const uint8_t>(slot.bytes.data(), length_)) != crcSent) {
+         stats_.crcFailures++;
+         return std::nullopt;
+      }
+      stats_.frames++;
+      slot.length = length_;
+      slot.held = true;
+      return Frame(this, current_);
+   }
+
+   std::array<Slot, slotCount> slots_{};
+   State state_ = State::Stx;
+   bool escaped_ = false;
+   bool skipped_ = false;
+   uint8_t length_ = 0;
+   uint8_t fill_ = 0;
+   uint8_t current_ = 0;
+   Stats stats_;
+};
+
+inline std::span<const uint8_t> Frame::message() const
+{
+   const auto &slot = owner_->slots_[slot_];
+
+   // the first byte is the length of what follows it
+   return (slot.length == 0) ? std::span<const uint8_t>()
+                             : std::span<const uint8_t>(&slot.bytes[1], slot.length - 1);
+}
+
+inline void Frame::release()
+{
+   if (owner_ != nullptr) {
+      owner_->slots_[slot_].held = false;
+      owner_ = nullptr;
+   }
+}
+
+/*
+ * Request/response over a link
+ */
+
+struct DeviceId
+{
+   std::array<char, maxMessage> nameBytes{};
+   std::array<char, maxMessage> uuidBytes{};
+   uint8_t nameLength = 0;
+   uint8_t uuidLength = 0;
+
+   std::string_view name() const
+   {
+      return std::string_view(nameBytes.data(), nameLength);
+   }
+
+   std::string_view uuid() const
+   {
+      return std::string_view(uuidBytes.data(), uuidLength);
+   }
+};
+
+using Time = std::array<uint8_t, 4>;
+
+// Parses the payloads of the two responses; false if the frame is malformed.
+inline bool parseTimeResponse(const Frame &frame, Time &time)
+{
+   auto elems = frame.u8Array();
+
+   if (frame.msgType() != timeResponseMsgType || !elems || elems->size() < time.size()) {
+      return false;
+   }
+   std::memcpy(time.data(), elems->data(), time.size());
+   return true;
+}
+
+inline bool parseDeviceId(const Frame &frame, DeviceId &id)
+{
+   std::span<const uint8_t> d = frame.data();
+   size_t pos = 2;
+
+   if (frame.msgType() != deviceIdMsgType || frame.dataType() != arrayDataType || d.size() < 3 ||
+       d[0] != 2 || d[1] != stringDataType) {
+      return false;
+   }
+   for (int field = 0; field < 2; field++) {
+      uint8_t length;
+
+      if (pos >= d.size() || d.size() - pos - 1 < d[pos]) {
+         return false;
+      }
+      length = d[pos++];
+      std::memcpy(field == 0 ? id.nameBytes.data() : id.uuidBytes.data(), &d[pos], length);
+      (field == 0 ? id.nameLength : id.uuidLength) = length;
+      pos += length;
+   }
+   return true;
+}
+
+class Link
+{
+   // Intrusive list of waiting requests, oldest first
+   struct Waiter
+   {
+      Waiter *pNext = nullptr;
+      bool queued = false;
+      uint8_t responseType = 0;
+      void *pRequest = nullptr;
+      void (*complete)(void *pRequest, const Frame *pFrame) = nullptr;
+   };
+
+public:
+   using WriteFunction = void (*)(void *pContext, std::span<const uint8_t> bytes);
+
+   Link(WriteFunction write, void *pContext) : write_(write), pContext_(pContext)
+   {
+   }
+
+   Link(const Link &) = delete;
+   Link &operator=(const Link &) = delete;
+
+   ~Link()
+   {
+      cancelAll();
+   }
+
+   // The awaitable behind getTime() and requestDeviceId().  It sends the
+   // request when the coroutine suspends and holds its place in the queue
+   // of waiting requests, so it must be co_awaited where it is made.
+   template <typename Result>
+   class Request
+   {
+   public:
+      Request(Link &link, std::span<const uint8_t> request, uint8_t responseType,
+              bool (*parse)(const Frame &, Result &))
+         : link_(link), parse_(parse)
+      {
+         std::memcpy(request_.data(), request.data(), request.size());
+         requestSize_ = (uint8_t)request.size();
+         waiter_.responseType = responseType;
+         waiter_.pRequest = this;
+         waiter_.complete = &Request::complete;
+      }
+
+      Request(const Request &) = delete;
+      Request &operator=(const Request &) = delete;
+
+      // A coroutine destroyed while it waits takes its request off the queue
+      ~Request()
+      {
+         link_.dequeue(&waiter_);
+      }
+
+      bool await_ready() const noexcept
+      {
+         return false;
+      }
+
+      void await_suspend(std::coroutine_handle<> handle)
+      {
+         handle_ = handle;
+         link_.enqueue(&waiter_);
+         link_.write_(link_.pContext_, std::span<const uint8_t>(request_.data(), requestSize_));
+      }
+
+      std::optional<Result> await_resume() noexcept
+      {
+         return std::move(result_);
+      }
+
+   private:
+      static void complete(void *pRequest, const Frame *pFrame)
+      {
+         Request *pThis = static_cast<Request *>(pRequest);
+         Result result;
+
+         if ((pFrame != nullptr) && pThis->parse_(*pFrame, result)) {
+            pThis->result_ = result;
+         }
+         pThis->handle_.resume();
+      }
+
+      Link &link_;
+      bool (*parse_)(const Frame &, Result &);
+      Waiter waiter_;
+      std::array<uint8_t, maxFrame> request_{};
+      uint8_t requestSize_ = 0;
+      std::coroutine_handle<> handle_;
+      std::optional<Result> result_;
+   };
+
+   // co_await completes with the time, or nullopt if cancelled
+   Request<Time> getTime()
+   {
+      std::array<uint8_t, maxFrame> buf;
+      return Request<Time>(*this, encodeGetTime(buf), timeResponseMsgType, parseTimeResponse);
+   }
+
+   // co_await completes with the device's name and UUID, or nullopt
+   Request<DeviceId> requestDeviceId()
+   {
+      std::array<uint8_t, maxFrame> buf;
+      return Request<DeviceId>(*this, encodeDeviceIdRequest(buf), deviceIdMsgType, parseDeviceId);
+   }
+
+   // Sends bytes that are already framed
+   void send(std::span<const uint8_t> bytes)
+   {
+      write_(pContext_, bytes);
+   }
+
+   // Decodes what arrived.  Responses go to the oldest request waiting for
+   // them; every other frame, and responses nobody waits for, go to onFrame.
+   // A Frame kept past onFrame holds a decoder slot until it is destroyed.
+   template <typename OnFrame>
+   void receive(std::span<const uint8_t> in, OnFrame &&onFrame)
+   {
+      while (!in.empty()) {
+         size_t before = in.size();
+         std::optional<Frame> frame = decoder_.next(in);
+
+         if (frame) {
+            if (!complete(*frame)) {
+               onFrame(std::move(*frame));
+            }
+         } else if (in.size() == before) {
+            // every slot is held by the caller
+            break;
+         }
+      }
+   }
+
+   void receive(std::span<const uint8_t> in)
+   {
+      receive(in, [](Frame &&) {});
+   }
+
+   // Completes every waiting request with nullopt.
+   void cancelAll()
+   {
+      while (Waiter *pWaiter = pHead_) {
+         dequeue(pWaiter);
+         pWaiter->complete(pWaiter->pRequest, nullptr);
+      }
+   }
+
+   bool waiting() const
+   {
+      return pHead_ != nullptr;
+   }
+
+   const Decoder &decoder() const
+   {
+      return decoder_;
+   }
+
+private:
+   void enqueue(Waiter *pWaiter)
+   {
+      pWaiter->pNext = nullptr;
+      pWaiter->queued = true;
+      if (pTail_ == nullptr) {
+         pHead_ = pWaiter;
+      } else {
+         pTail_->pNext = pWaiter;
+      }
+      pTail_ = pWaiter;
+   }
+
+   void dequeue(Waiter *pWaiter)
+   {
+      Waiter *pPrev = nullptr;
+
+      if (!pWaiter->queued) {
+         return;
+      }
+      for (Waiter *pAt = pHead_; pAt != pWaiter; pAt = pAt->pNext) {
+         pPrev = pAt;
+      }
+      if (pPrev == nullptr) {
+         pHead_ = pWaiter->pNext;
+      } else {
+         pPrev->pNext = pWaiter->pNext;
+      }
+      if (pTail_ == pWaiter) {
+         pTail_ = pPrev;
+      }
+      pWaiter->queued = false;
+   }
+
+   bool complete(const Frame &frame)
+   {
+      for (Waiter *pWaiter = pHead_; pWaiter != nullptr; pWaiter = pWaiter->pNext) {
+         if (pWaiter->responseType == frame.msgType()) {
+            // the coroutine may start another request or destroy this link
+            dequeue(pWaiter);
+            pWaiter->complete(pWaiter->pRequest, &frame);
+            return true;
+         }
+      }
+      return false;
+   }
+
+   Decoder decoder_;
+   WriteFunction write_;
+   void *pContext_;
+   Waiter *pHead_ = nullptr;
+   Waiter *pTail_ = nullptr;
+};
+
+/*
+ * A coroutine that starts at once and runs until its first co_await.
+ * The coroutine frame comes from operator new like any other; everything
+ * else here stays off the heap.  A Task destroyed while it waits on a Link
+ * withdraws its request.
+ */
+class Task
+{
+public:
+   struct promise_type
+   {
+      Task get_return_object()
+      {
+         return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+      }
+
+      std::suspend_never initial_suspend() noexcept
+      {
+         return {};
+      }
+
+      std::suspend_always final_suspend() noexcept
+      {
+         return {};
+      }
+
+      void return_void()
+      {
+      }
+
+      void unhandled_exception()
+      {
+         throw;
+      }
+   };
+
+   Task(Task &&other) noexcept : handle_(std::exchange(other.handle_, nullptr))
+   {
+   }
+
+   Task &operator=(Task &&other) noexcept
+   {
+      if (this != &other) {
+         destroy();
+         handle_ = std::exchange(other.handle_, nullptr);
+      }
+      return *this;
+   }
+
+   Task(const Task &) = delete;
+   Task &operator=(const Task &) = delete;
+
+   ~Task()
+   {
+      destroy();
+   }
+
+   bool done() const
+   {
+      return !handle_ || handle_.done();
+   }
+
+private:
+   explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle)
+   {
+   }
+
+   void destroy()
+   {
+      if (handle_) {
+         handle_.destroy();
+         handle_ = nullptr;
+      }
+   }
+
+   std::coroutine_handle<promise_type> handle_;
+};
+
+}
+
+#endif
@@ -0,0 +1,876 @@
+#include "CppUTest/TestHarness.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <deque>
+#include <new>
+#include <random>
+#include <vector>
+#include "chillhub.hpp"
+
+extern "C"
+{
+#include "crc.h"
+}
+
+using namespace std;
+
+/*
+ * Every operator new in the process goes through here so the benchmarks
+ * can tell whether a frame cost an allocation.
+ */
+static atomic<unsigned long> allocations;
+
+void *operator new(size_t size)
+{
+   void *p;
+
+   allocations++;
+   p = malloc(size ? size : 1);
+   if (p == NULL) {
+      throw bad_alloc();
+   }
+   return p;
+}
+
+// gcc takes the free() below for a mismatch with the new above
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void operator delete(void *p) noexcept
+{
+   free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+   free(p);
+}
+
+static double nowNs(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * The firmware's side of the link, to compare against
+ */
+static deque<uint8_t> fwRx;
+static vector<uint8_t> fwTx;
+static vector<vector<uint8_t> > fwFrames;
+
+static void fwWrite(const uint8 wrBuf[], uint32 count)
+{
+   fwTx.insert(fwTx.end(), wrBuf, wrBuf + count);
+}
+
+static uint32 fwAvailable(void)
+{
+   return fwRx.size();
+}
+
+static uint32 fwRead(void)
+{
+   uint8_t b = fwRx.front();
+   fwRx.pop_front();
+   return b;
+}
+
+static void fwPrint(const char8 string[])
+{
+   (void)string;
+}
+
+static const T_Serial fwSerial = { fwWrite, fwAvailable, fwRead, fwPrint };
+
+static void fwHook(T_ChillHubCB *pControlBlock, const uint8_t *pMsg, uint8_t length)
+{
+   (void)pControlBlock;
+   fwFrames.push_back(vector<uint8_t>(pMsg, pMsg + length));
+}
+
+static void fwNoop(uint8_t dataType, void *pData)
+{
+   (void)dataType;
+   (void)pData;
+}
+
+/*
+ * The SDK's side, with what it writes collected here
+ */
+static vector<uint8_t> sdkTx;
+
+static void sdkWrite(void *pContext, span<const uint8_t> bytes)
+{
+   (void)pContext;
+   sdkTx.insert(sdkTx.end(), bytes.begin(), bytes.end());
+}
+
+static vector<uint8_t> bytesOf(span<const uint8_t> s)
+{
+   return vector<uint8_t>(s.begin(), s.end());
+}
+
+static vector<uint8_t> bytesOf(const chillhub::Frame &frame)
+{
+   return bytesOf(frame.message());
+}
+
+static void append(vector<uint8_t> &stream, span<const uint8_t> wire)
+{
+   stream.insert(stream.end(), wire.begin(), wire.end());
+}
+
+TEST_GROUP(sdkTests)
+{
+   T_ChillHubCB fw;
+   array<uint8_t, chillhub::maxFrame> buf;
+
+   void setup()
+   {
+      fwRx.clear();
+      fwTx.clear();
+      fwFrames.clear();
+      sdkTx.clear();
+      ChillHub_Init(&fw);
+      ChillHub_Setup(&fw, "scale", "uuid", &fwSerial);
+      ChillHub_SetFrameHook(&fw, fwHook, NULL);
+      fwTx.clear();
+   }
+
+   void teardown()
+   {
+      chillhub::setScan(chillhub::Scan::Sse2);
+   }
+
+   // What the firmware wrote since the last call
+   vector<uint8_t> fwSent()
+   {
+      vector<uint8_t> sent = fwTx;
+
+      fwTx.clear();
+      return sent;
+   }
+
+   void fwPump()
+   {
+      for (int guard = 0; guard < 100000; guard++) {
+         ChillHub_Loop(&fw);
+         if (fwRx.empty() && ChillHub_IsIdle(&fw)) {
+            break;
+         }
+      }
+   }
+};
+
+TEST(sdkTests, crcMatchesTheFirmware)
+{
+   mt19937 rng(7);
+   vector<uint8_t> data(300);
+
+   for (int round = 0; round < 50; round++) {
+      size_t n = rng() % data.size();
+      for (size_t i = 0; i < n; i++) {
+         data[i] = (uint8_t)rng();
+      }
+      LONGS_EQUAL(crc_finalize(crc_update(crc_init(), &data[0], n)),
+                  chillhub::crcUpdate(chillhub::crcInit, span<const uint8_t>(data.data(), n)));
+   }
+}
+
+TEST(sdkTests, scalarEncodersMatchTheFirmware)
+{
+   ChillHub_SendU8Msg(&fw, 0x60, 0xff);
+   CHECK(fwSent() == bytesOf(chillhub::encodeU8(buf, 0x60, 0xff)));
+   ChillHub_SendI8Msg(&fw, 0x61, -2);
+   CHECK(fwSent() == bytesOf(chillhub::encodeI8(buf, 0x61, -2)));
+   ChillHub_SendU16Msg(&fw, 0x62, 0xfeff);
+   CHECK(fwSent() == bytesOf(chillhub::encodeU16(buf, 0x62, 0xfeff)));
+   ChillHub_SendI16Msg(&fw, 0x63, -300);
+   CHECK(fwSent() == bytesOf(chillhub::encodeI16(buf, 0x63, -300)));
+   ChillHub_SendBooleanMsg(&fw, 0x64, 1);
+   CHECK(fwSent() == bytesOf(chillhub::encodeBoolean(buf, 0x64, true)));
+}
+
+TEST(sdkTests, arrayEncoderMatchesTheFirmware)
+{
+   const uint8_t data[] = { 1, 0xfe, 0xff, 4, 5 };
+   const uint16_t wide[] = { 0x1234, 0xfeff, 0xff00, 7 };
+
+   ChillHub_SendU8ArrayMsg(&fw, 0x65, data, sizeof(data));
+   CHECK(fwSent() == bytesOf(chillhub::encodeU8Array(buf, 0x65, data)));
+   ChillHub_SendU16ArrayMsg(&fw, 0x97, wide, 4);
+   CHECK(fwSent() == bytesOf(chillhub::encodeU16Array(buf, 0x97, wide)));
+}
+
+TEST(sdkTests, requestEncodersMatchTheFirmware)
+{
+   char cron[] = "*/5 * * * *";
+
+   ChillHub_Setup(&fw, "milkscale", "0123-4567", &fwSerial);
+   CHECK(fwSent() == bytesOf(chillhub::encodeDeviceId(buf, "milkscale", "0123-4567")));
+   ChillHub_Subscribe(&fw, doorStatusMsgType, fwNoop);
+   CHECK(fwSent() == bytesOf(chillhub::encodeSubscribe(buf, doorStatusMsgType)));
+   ChillHub_Unsubscribe(&fw, doorStatusMsgType);
+   CHECK(fwSent() == bytesOf(chillhub::encodeUnsubscribe(buf, doorStatusMsgType)));
+   ChillHub_SetAlarm(&fw, 'a', cron, strlen(cron), fwNoop);
+   CHECK(fwSent() == bytesOf(chillhub::encodeSetAlarm(buf, 'a', cron)));
+   ChillHub_GetTime(&fw, fwNoop);
+   CHECK(fwSent() == bytesOf(chillhub::encodeGetTime(buf)));
+}
+
+TEST(sdkTests, cloudResourceEncodersMatchTheFirmware)
+{
+   ChillHub_CreateCloudResourceU16(&fw, "weight", 3, 1, 0xfeff);
+   CHECK(fwSent() == bytesOf(chillhub::encodeRegisterResourceU16(buf, "weight", 3, true, 0xfeff)));
+   ChillHub_UpdateCloudResourceU16(&fw, 3, 0x1234);
+   CHECK(fwSent() == bytesOf(chillhub::encodeUpdateResourceU16(buf, 3, 0x1234)));
+}
+
+TEST(sdkTests, schemaEncodersMatchTheFirmware)
+{
+   array<uint8_t, chillhub::schema::scalarFrameMax<unsigned16DataType>> small;
+
+   ChillHub_SendU8Msg(&fw, doorStatusMsgType, 0xff);
+   CHECK(fwSent() == bytesOf(chillhub::encode<doorStatusMsgType>(buf, 0xff)));
+   ChillHub_SendU16Msg(&fw, iceCabinetThermistorTemperatureMsgType, 0xfefe);
+   CHECK(fwSent() == bytesOf(chillhub::encode<iceCabinetThermistorTemperatureMsgType>(small, 0xfefe)));
+   LONGS_EQUAL(CHILLHUB_SCALAR_MSG_LEN(unsigned16DataType),
+               chillhub::schema::scalarMessageLength<unsigned16DataType>);
+   CHECK(!chillhub::schema::dataTypeOf(0x60));
+   LONGS_EQUAL(noDataType, *chillhub::schema::dataTypeOf(getTimeMsgType));
+}
+
+TEST(sdkTests, typedFrameAccessFollowsTheSchema)
+{
+   chillhub::Decoder decoder;
+   vector<uint8_t> stream;
+   vector<chillhub::Frame> frames;
+   span<const uint8_t> in;
+
+   append(stream, chillhub::encode<doorStatusMsgType>(buf, 1));
+   append(stream, chillhub::encodeU16(buf, doorStatusMsgType, 1));
+   append(stream, chillhub::encode<waterUsageTimerMsgType>(buf, 0x01020304));
+   in = stream;
+   while (!in.empty()) {
+      if (optional<chillhub::Frame> frame = decoder.next(in)) {
+         frames.push_back(std::move(*frame));
+      }
+   }
+
+   LONGS_EQUAL(3, frames.size());
+   LONGS_EQUAL(1, *frames[0].as<doorStatusMsgType>());
+   CHECK(!frames[0].as<dcSwitchStateMsgType>());
+   CHECK(!frames[1].as<doorStatusMsgType>());
+   LONGS_EQUAL(0x01020304, *frames[2].as<waterUsageTimerMsgType>());
+}
+
+TEST(sdkTests, fitsAgreesWithTheFirmware)
+{
+   mt19937 rng(13);
+   vector<uint8_t> stream;
+   chillhub::Decoder decoder;
+   span<const uint8_t> in;
+   unsigned long unfit = 0;
+   const uint8_t types[] = { arrayDataType, stringDataType, unsigned8DataType, signed16DataType,
+                             unsigned32DataType, booleanDataType, jsonDataType, 0x33 };
+
+   for (int i = 0; i < 500; i++) {
+      const uint8_t listed[] = { timeResponseMsgType, doorStatusMsgType, waterUsageTimerMsgType };
+      uint8_t msgType = (rng() % 4 == 0) ? listed[rng() % sizeof(listed)] : (uint8_t)(0x60 + rng() % 8);
+      chillhub::Message msg(msgType, types[rng() % sizeof(types)]);
+
+      for (size_t n = rng() % 9; n > 0; n--) {
+         msg.u8((uint8_t)rng());
+      }
+      append(stream, msg.encode(buf));
+      if (rng() % 16 == 0) {
+         // too short for a message type and data type
+         const uint8_t empty[] = { 0xff, 0x00, 0xfe, 0xff, 0xfe, 0xff };
+         stream.insert(stream.end(), empty, empty + sizeof(empty));
+      }
+   }
+   fwRx.insert(fwRx.end(), stream.begin(), stream.end());
+   fwPump();
+
+   in = stream;
+   while (!in.empty()) {
+      if (optional<chillhub::Frame> frame = decoder.next(in)) {
+         unfit += frame->fits() ? 0 : 1;
+      }
+   }
+
+   CHECK(unfit > 100);
+   CHECK(decoder.stats().shortFrames > 10);
+   LONGS_EQUAL(ChillHub_GetStats(&fw)->malformedMessages, unfit + decoder.stats().shortFrames);
+}
+
+TEST(sdkTests, firmwareAcceptsWhatTheSdkEncodes)
+{
+   span<uint8_t> wire = chillhub::encodeTimeResponse(buf, { 1, 0xff, 0xfe, 4 });
+
+   fwRx.insert(fwRx.end(), wire.begin(), wire.end());
+   fwPump();
+
+   LONGS_EQUAL(1, fwFrames.size());
+   CHECK(fwFrames[0] == vector<uint8_t>({ timeResponseMsgType, arrayDataType, 4, unsigned8DataType, 1, 0xff, 0xfe, 4 }));
+}
+
+TEST(sdkTests, encodeRefusesShortBuffersAndLongMessages)
+{
+   array<uint8_t, 5> tiny;
+   array<uint8_t, chillhub::maxMessage + 1> big{};
+   chillhub::Message msg(0x60, arrayDataType);
+
+   CHECK(chillhub::encodeU16(tiny, 0x60, 0x1234).empty());
+   CHECK(chillhub::encodeU8Array(buf, 0x60, big).empty());
+   msg.bytes(span<const uint8_t>(big.data(), chillhub::maxMessage - 2));
+   CHECK(msg.ok());
+   CHECK(!msg.encode(buf).empty());
+   msg.u8(0);
+   CHECK(!msg.ok());
+   CHECK(msg.encode(buf).empty());
+}
+
+// Frames of up to 20 data bytes, a quarter of them STX or ESC, some with a
+// bad CRC and some with junk after them
+static vector<uint8_t> noisyStream(mt19937 &rng, int frames)
+{
+   array<uint8_t, chillhub::maxFrame> buf;
+   vector<uint8_t> stream;
+
+   for (int i = 0; i < frames; i++) {
+      chillhub::Message msg((uint8_t)(0x60 + rng() % 16), (uint8_t)(rng() % 16));
+      size_t n = rng() % 21;
+      span<uint8_t> wire;
+
+      for (size_t j = 0; j < n; j++) {
+         msg.u8((rng() % 4 == 0) ? (uint8_t)(chillhub::ESC + rng() % 2) : (uint8_t)rng());
+      }
+      wire = msg.encode(buf);
+      if (rng() % 10 == 0) {
+         wire[wire.size() - 1] ^= 0x01;
+      }
+      append(stream, wire);
+      for (size_t junk = rng() % 4; junk > 0; junk--) {
+         stream.push_back((uint8_t)(rng() % chillhub::STX));
+      }
+   }
+   return stream;
+}
+
+TEST(sdkTests, decoderAgreesWithTheFirmwareOnANoisyStream)
+{
+   mt19937 rng(11);
+   vector<uint8_t> stream = noisyStream(rng, 3000);
+
+   fwRx.insert(fwRx.end(), stream.begin(), stream.end());
+   fwPump();
+   CHECK(fwFrames.size() > 2500);
+   LONGS_EQUAL(0, ChillHub_GetStats(&fw)->overflowDrops);
+
+   for (chillhub::Scan want : { chillhub::Scan::Scalar, chillhub::Scan::Sse2, chillhub::Scan::Avx2 }) {
+      vector<vector<uint8_t> > decoded;
+      chillhub::Decoder decoder;
+      span<const uint8_t> in = stream;
+
+      chillhub::setScan(want);
+
+      // in odd sized pieces, the way reads come off a serial port
+      while (!in.empty()) {
+         span<const uint8_t> piece = in.first(min<size_t>(in.size(), 1 + rng() % 100));
+         in = in.subspan(piece.size());
+         while (!piece.empty()) {
+            optional<chillhub::Frame> frame = decoder.next(piece);
+            if (frame) {
+               decoded.push_back(bytesOf(*frame));
+            }
+         }
+      }
+
+      LONGS_EQUAL(fwFrames.size(), decoded.size());
+      CHECK(fwFrames == decoded);
+      LONGS_EQUAL(ChillHub_GetStats(&fw)->crcFailures, decoder.stats().crcFailures);
+      LONGS_EQUAL(ChillHub_GetStats(&fw)->resyncs, decoder.stats().resyncs);
+   }
+}
+
+TEST(sdkTests, everyScanFindsTheSameByte)
+{
+   mt19937 rng(5);
+   vector<uint8_t> data(200);
+
+   for (int round = 0; round < 2000; round++) {
+      size_t n = rng() % data.size();
+      uint8_t value = (rng() % 2) ? chillhub::STX : chillhub::ESC;
+      size_t expected;
+
+      for (size_t i = 0; i < data.size(); i++) {
+         data[i] = (uint8_t)(rng() % 0xfe);
+      }
+      if (n > 0 && rng() % 4 != 0) {
+         data[rng() % n] = value;
+      }
+      expected = chillhub::detail::findScalar(data.data(), n, value);
+      for (chillhub::Scan want : { chillhub::Scan::Sse2, chillhub::Scan::Avx2 }) {
+         chillhub::setScan(want);
+         LONGS_EQUAL(expected, chillhub::findByte(data.data(), n, value));
+      }
+   }
+}
+
+TEST(sdkTests, avx2IsOnlyUsedWhenAskedFor)
+{
+   chillhub::Scan supported = chillhub::detail::supportedScan();
+
+   CHECK(chillhub::detail::defaultScan() <= chillhub::Scan::Sse2);
+   CHECK(chillhub::detail::defaultScan() == min(supported, chillhub::Scan::Sse2));
+   CHECK(chillhub::setScan(chillhub::Scan::Avx2) == supported);
+}
+
+TEST(sdkTests, decoderCountsOversizeAndBadCrc)
+{
+   chillhub::Decoder decoder;
+   const uint8_t oversize[] = { 0xff, 70, 1, 2, 3 };
+   span<uint8_t> wire = chillhub::encodeU8(buf, 0x60, 1);
+   vector<uint8_t> stream(oversize, oversize + sizeof(oversize));
+   span<const uint8_t> in;
+   int frames = 0;
+
+   stream.insert(stream.end(), wire.begin(), wire.end());
+   stream[stream.size() - 1] ^= 0x01;
+   wire = chillhub::encodeU8(buf, 0x60, 2);
+   stream.insert(stream.end(), wire.begin(), wire.end());
+
+   in = stream;
+   while (!in.empty()) {
+      if (optional<chillhub::Frame> frame = decoder.next(in)) {
+         LONGS_EQUAL(2, *frame->u8());
+         frames++;
+      }
+   }
+
+   LONGS_EQUAL(1, frames);
+   LONGS_EQUAL(1, decoder.stats().oversizeFrames);
+   LONGS_EQUAL(1, decoder.stats().crcFailures);
+   LONGS_EQUAL(1, decoder.stats().resyncs);
+}
+
+TEST(sdkTests, decoderTurnsAwayShortLengthsLikeTheFirmware)
+{
+   chillhub::Decoder decoder;
+   // empty, then a message type alone; both with a good CRC
+   const uint8_t shortFrames[] = { 0xff, 0x00, 0xfe, 0xff, 0xfe, 0xff, 0xff, 0x02, 0x01, 0x60, 0x42, 0x98 };
+   span<uint8_t> wire = chillhub::encodeU8(buf, 0x60, 2);
+   vector<uint8_t> stream(shortFrames, shortFrames + sizeof(shortFrames));
+   span<const uint8_t> in;
+   int frames = 0;
+
+   stream.insert(stream.end(), wire.begin(), wire.end());
+   fwRx.insert(fwRx.end(), stream.begin(), stream.end());
+   fwPump();
+
+   in = stream;
+   while (!in.empty()) {
+      if (optional<chillhub::Frame> frame = decoder.next(in)) {
+         LONGS_EQUAL(2, *frame->u8());
+         frames++;
+      }
+   }
+
+   LONGS_EQUAL(1, frames);
+   LONGS_EQUAL(1, fwFrames.size());
+   LONGS_EQUAL(2, decoder.stats().shortFrames);
+   LONGS_EQUAL(2, ChillHub_GetStats(&fw)->malformedMessages);
+   LONGS_EQUAL(ChillHub_GetStats(&fw)->oversizeFrames, decoder.stats().oversizeFrames);
+   LONGS_EQUAL(ChillHub_GetStats(&fw)->resyncs, decoder.stats().resyncs);
+}
+
+TEST(sdkTests, frameAccessorsCheckTheDataType)
+{
+   chillhub::Decoder decoder;
+   vector<uint8_t> stream;
+   vector<chillhub::Frame> frames;
+   span<const uint8_t> in;
+   const uint8_t data[] = { 9, 8, 7 };
+
+   append(stream, chillhub::encodeI16(buf, 0x60, -2));
+   append(stream, chillhub::encodeU8Array(buf, 0x61, data));
+   in = stream;
+   while (!in.empty()) {
+      if (optional<chillhub::Frame> frame = decoder.next(in)) {
+         frames.push_back(std::move(*frame));
+      }
+   }
+
+   LONGS_EQUAL(2, frames.size());
+   LONGS_EQUAL(-2, *frames[0].i16());
+   CHECK(!frames[0].u16());
+   CHECK(!frames[0].u8Array());
+   CHECK(bytesOf(*frames[1].u8Array()) == vector<uint8_t>({ 9, 8, 7 }));
+   CHECK(!frames[1].u8());
+}
+
+TEST(sdkTests, heldFramesStopTheDecoder)
+{
+   chillhub::Decoder decoder;
+   vector<uint8_t> stream;
+   vector<chillhub::Frame> held;
+   span<const uint8_t> in;
+   optional<chillhub::Frame> frame;
+
+   for (uint8_t i = 0; i < chillhub::Decoder::slotCount + 1; i++) {
+      append(stream, chillhub::encodeU8(buf, 0x60, i));
+   }
+   in = stream;
+   while (held.size() < chillhub::Decoder::slotCount) {
+      frame = decoder.next(in);
+      CHECK(frame.has_value());
+      held.push_back(std::move(*frame));
+   }
+
+   // only the STX of the last frame goes in; the rest waits for a slot
+   CHECK(!decoder.next(in));
+   CHECK(!decoder.next(in));
+   LONGS_EQUAL(stream.size() / (chillhub::Decoder::slotCount + 1) - 1, in.size());
+
+   held.erase(held.begin());
+   frame = decoder.next(in);
+   CHECK(frame.has_value());
+   LONGS_EQUAL(chillhub::Decoder::slotCount, *frame->u8());
+   for (uint8_t i = 0; i < held.size(); i++) {
+      LONGS_EQUAL(i + 1, *held[i].u8());
+   }
+   CHECK(in.empty());
+}
+
+TEST(sdkTests, movedFrameKeepsItsSlot)
+{
+   chillhub::Decoder decoder;
+   span<uint8_t> wire = chillhub::encodeU16(buf, 0x60, 0xabcd);
+   span<const uint8_t> in = wire;
+   optional<chillhub::Frame> frame = decoder.next(in);
+
+   CHECK(frame.has_value());
+   LONGS_EQUAL(1, decoder.slotsHeld());
+   {
+      chillhub::Frame moved = std::move(*frame);
+      frame.reset();
+      LONGS_EQUAL(1, decoder.slotsHeld());
+      LONGS_EQUAL(0xabcd, *moved.u16());
+   }
+   LONGS_EQUAL(0, decoder.slotsHeld());
+}
+
+static chillhub::Task askTime(chillhub::Link &link, optional<chillhub::Time> &result, int &steps)
+{
+   result = co_await link.getTime();
+   steps++;
+}
+
+static chillhub::Task askId(chillhub::Link &link, optional<chillhub::DeviceId> &result)
+{
+   result = co_await link.requestDeviceId();
+}
+
+TEST(sdkTests, getTimeResumesWithTheResponse)
+{
+   chillhub::Link link(sdkWrite, NULL);
+   optional<chillhub::Time> time;
+   vector<vector<uint8_t> > other;
+   vector<uint8_t> stream;
+   int steps = 0;
+   chillhub::Task task = askTime(link, time, steps);
+
+   CHECK(sdkTx == bytesOf(chillhub::encodeGetTime(buf)));
+   CHECK(!task.done());
+
+   // a frame that is not the answer goes past the request
+   append(stream, chillhub::encodeU8(buf, doorStatusMsgType, 1));
+   append(stream, chillhub::encodeTimeResponse(buf, { 0x55, 0xff, 0, 9 }));
+   link.receive(stream, [&](chillhub::Frame &&frame) { other.push_back(bytesOf(frame)); });
+
+   CHECK(task.done());
+   LONGS_EQUAL(1, steps);
+   CHECK(time.has_value());
+   CHECK(*time == chillhub::Time({ 0x55, 0xff, 0, 9 }));
+   LONGS_EQUAL(1, other.size());
+   LONGS_EQUAL(doorStatusMsgType, other[0][0]);
+}
+
+TEST(sdkTests, requestDeviceIdTalksToTheFirmware)
+{
+   chillhub::Link link(sdkWrite, NULL);
+   optional<chillhub::DeviceId> id;
+   chillhub::Task task = askId(link, id);
+
+   // the firmware answers a deviceIdRequest by announcing itself again
+   fwRx.insert(fwRx.end(), sdkTx.begin(), sdkTx.end());
+   fwPump();
+   LONGS_EQUAL(1, fwFrames.size());
+   CHECK(fwFrames[0] == vector<uint8_t>({ deviceIdRequestType, unsigned8DataType, 0 }));
+
+   ChillHub_Setup(&fw, "milkscale", "0123-4567", &fwSerial);
+   link.receive(fwSent());
+
+   CHECK(task.done());
+   CHECK(id.has_value());
+   CHECK(id->name() == "milkscale");
+   CHECK(id->uuid() == "0123-4567");
+}
+
+TEST(sdkTests, responsesGoToTheOldestRequest)
+{
+   chillhub::Link link(sdkWrite, NULL);
+   optional<chillhub::Time> first;
+   optional<chillhub::Time> second;
+   int steps = 0;
+   chillhub::Task a = askTime(link, first, steps);
+   chillhub::Task b = askTime(link, second, steps);
+
+   link.receive(chillhub::encodeTimeResponse(buf, { 1, 1, 1, 1 }));
+   CHECK(a.done());
+   CHECK(!b.done());
+   link.receive(chillhub::encodeTimeResponse(buf, { 2, 2, 2, 2 }));
+   CHECK(b.done());
+   LONGS_EQUAL(1, (*first)[0]);
+   LONGS_EQUAL(2, (*second)[0]);
+   CHECK(!link.waiting());
+}
+
+TEST(sdkTests, cancelAllResumesWithNothing)
+{
+   chillhub::Link link(sdkWrite, NULL);
+   optional<chillhub::Time> time;
+   optional<chillhub::DeviceId> id;
+   int steps = 0;
+   chillhub::Task a = askTime(link, time, steps);
+   chillhub::Task b = askId(link, id);
+
+   link.cancelAll();
+
+   CHECK(a.done());
+   CHECK(b.done());
+   CHECK(!time.has_value());
+   CHECK(!id.has_value());
+   CHECK(!link.waiting());
+}
+
+TEST(sdkTests, malformedResponseResumesWithNothing)
+{
+   chillhub::Link link(sdkWrite, NULL);
+   optional<chillhub::Time> time;
+   int steps = 0;
+   chillhub::Task task = askTime(link, time, steps);
+   const uint8_t shortTime[] = { 1, 2 };
+
+   link.receive(chillhub::Message(timeResponseMsgType, arrayDataType)
+                   .u8(sizeof(shortTime))
+                   .u8(unsigned8DataType)
+                   .bytes(shortTime)
+                   .encode(buf));
+
+   CHECK(task.done());
+   CHECK(!time.has_value());
+}
+
+/*
+ * Benchmarks: time per frame, and operator new calls per frame, which
+ * should be none.
+ */
+static const int benchFrames = 200000;
+
+static void report(const char *what, double ns, unsigned long allocs)
+{
+   char line[128];
+
+   snprintf(line, sizeof(line), "%s: %.1f ns/frame, %.3f allocations/frame", what, ns / benchFrames,
+            (double)allocs / benchFrames);
+   UT_PRINT(line);
+}
+
+TEST(sdkTests, benchEncode)
+{
+   size_t bytes = 0;
+   unsigned long before = allocations;
+   double start = nowNs();
+
+   for (int i = 0; i < benchFrames; i++) {
+      bytes += chillhub::encodeU16(buf, 0x60, (uint16_t)i).size();
+      bytes += chillhub::encodeRegisterResourceU16(buf, "weight", 3, true, (uint16_t)i).size();
+   }
+
+   report("encode", (nowNs() - start) / 2, (allocations - before) / 2);
+   CHECK(bytes > 0);
+   LONGS_EQUAL(before, allocations);
+}
+
+TEST(sdkTests, benchDecode)
+{
+   vector<uint8_t> stream;
+   chillhub::Decoder decoder;
+   unsigned long before;
+   uint32_t sum = 0;
+   double start;
+
+   for (int i = 0; i < benchFrames; i++) {
+      append(stream, chillhub::encodeU16(buf, 0x60, (uint16_t)i));
+   }
+
+   before = allocations;
+   start = nowNs();
+   span<const uint8_t> in = stream;
+   while (!in.empty()) {
+      if (optional<chillhub::Frame> frame = decoder.next(in)) {
+         sum += *frame->u16();
+      }
+   }
+
+   report("decode", nowNs() - start, allocations - before);
+   LONGS_EQUAL(benchFrames, decoder.stats().frames);
+   CHECK(sum > 0);
+   LONGS_EQUAL(before, allocations);
+}
+
+static chillhub::Task pollTime(chillhub::Link &link, int count, uint32_t &sum)
+{
+   for (int i = 0; i < count; i++) {
+      optional<chillhub::Time> time = co_await link.getTime();
+      sum += (*time)[3];
+   }
+}
+
+TEST(sdkTests, benchRequestResponse)
+{
+   chillhub::Link link(sdkWrite, NULL);
+   span<uint8_t> wire = chillhub::encodeTimeResponse(buf, { 0, 0, 0, 1 });
+   uint32_t sum = 0;
+   unsigned long before;
+   double start;
+
+   // the coroutine frame is the one allocation, made here
+   chillhub::Task task = pollTime(link, benchFrames, sum);
+   sdkTx.reserve(sdkTx.size() + 2 * benchFrames * wire.size());
+
+   before = allocations;
+   start = nowNs();
+   while (!task.done()) {
+      link.receive(wire);
+   }
+
+   report("getTime round trip", nowNs() - start, allocations - before);
+   LONGS_EQUAL(benchFrames, sum);
+   LONGS_EQUAL(before, allocations);
+}
+
+/*
+ * De-escaping a capture: the firmware's receiver a byte at a time against
+ * the decoder with each scan, in GB/s of wire bytes.
+ */
+static const uint8_t *pCapture;
+static size_t captureSize;
+static size_t captureAt;
+static unsigned long captureFrames;
+
+static void captureWrite(const uint8 wrBuf[], uint32 count)
+{
+   (void)wrBuf;
+   (void)count;
+}
+
+static uint32 captureAvailable(void)
+{
+   return captureSize - captureAt;
+}
+
+static uint32 captureRead(void)
+{
+   return pCapture[captureAt++];
+}
+
+static const T_Serial captureSerial = { captureWrite, captureAvailable, captureRead, fwPrint };
+
+static void captureHook(T_ChillHubCB *pControlBlock, const uint8_t *pMsg, uint8_t length)
+{
+   (void)pControlBlock;
+   (void)pMsg;
+   (void)length;
+   captureFrames++;
+}
+
+static void benchCapture(const char *name, const vector<uint8_t> &capture)
+{
+   T_ChillHubCB hub;
+   char line[128];
+   unsigned long fwFrameCount;
+   double start;
+
+   pCapture = capture.data();
+   captureSize = capture.size();
+   captureAt = 0;
+   captureFrames = 0;
+   ChillHub_Init(&hub);
+   ChillHub_Setup(&hub, "scale", "uuid", &captureSerial);
+   ChillHub_SetFrameHook(&hub, captureHook, NULL);
+   start = nowNs();
+   while (captureAt < captureSize || !ChillHub_IsIdle(&hub)) {
+      ChillHub_Loop(&hub);
+   }
+   snprintf(line, sizeof(line), "%s, %.1f MB: firmware %.3f GB/s", name, capture.size() / 1e6,
+            capture.size() / (nowNs() - start));
+   UT_PRINT(line);
+   fwFrameCount = captureFrames;
+
+   for (chillhub::Scan want : { chillhub::Scan::Scalar, chillhub::Scan::Sse2, chillhub::Scan::Avx2 }) {
+      static const char *const names[] = { "scalar", "sse2", "avx2" };
+      chillhub::Decoder decoder;
+      span<const uint8_t> in = capture;
+      chillhub::Scan got = chillhub::setScan(want);
+      unsigned long before = allocations;
+
+      if (got != want) {
+         continue;
+      }
+      start = nowNs();
+      while (!in.empty()) {
+         // 64 KiB reads
+         span<const uint8_t> piece = in.first(min<size_t>(in.size(), 65536));
+         in = in.subspan(piece.size());
+         while (!piece.empty()) {
+            decoder.next(piece);
+         }
+      }
+      snprintf(line, sizeof(line), "%s, %.1f MB: %s %.3f GB/s", name, capture.size() / 1e6, names[(int)got],
+               capture.size() / (nowNs() - start));
+      UT_PRINT(line);
+      LONGS_EQUAL(fwFrameCount, decoder.stats().frames);
+      LONGS_EQUAL(before, allocations);
+   }
+}
+
+TEST(sdkTests, benchDeEscapeCapture)
+{
+   mt19937 rng(3);
+   vector<uint8_t> capture;
+   chillhub::Message full(0x70, arrayDataType);
+   const size_t fullData = chillhub::maxMessage - 4;
+
+   // short telemetry with plenty of escapes and noise
+   capture = noisyStream(rng, 600000);
+   benchCapture("telemetry", capture);
+
+   // the longest frames the firmware takes, an escape every 40 bytes or so
+   capture.clear();
+   full.u8(fullData).u8(unsigned8DataType);
+   for (size_t i = 0; i < fullData; i++) {
+      full.u8((uint8_t)((i * 41 + 7) % 0xff));
+   }
+   while (capture.size() < 16000000) {
+      append(capture, full.encode(buf));
+   }
+   benchCapture("full frames", capture);
+}
@@ -0,0 +1,130 @@
+/*
+ * Cycles per cloud resource update, from a template and built in full.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Times ChillHub_UpdateCloudResourceU16 two ways over every u16 value: on a
+ * link that registered the resource, so the update is sent from the template
+ * built at registration, and on a link that did not, so the whole frame is
+ * built, escaped and checksummed a byte at a time the way every update used
+ * to be.  The serial port only counts the bytes it is handed.
+ *
+ * Cycles come from the time stamp counter on x86 and are nanoseconds
+ * elsewhere.
+ *
+ *   tmplbench [-p passes] [-r resource_id]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "chillhub.h"
+
+static uint64_t bytesWritten;
+static uint64_t writeCalls;
+
+static void countWrite(const uint8 wrBuf[], uint32 count) {
+   (void)wrBuf;
+   bytesWritten += count;
+   writeCalls++;
+}
+
+static uint32 nothingAvailable(void) {
+   return 0;
+}
+
+static uint32 readNothing(void) {
+   return 0;
+}
+
+static void print(const char8 string[]) {
+   (void)string;
+}
+
+static const T_Serial countingSerial = { countWrite, nothingAvailable, readNothing, print };
+
+static uint64_t cyclesNow(void) {
+#if defined(__x86_64__) || defined(__i386__)
+   return __rdtsc();
+#else
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+static void run(const char *pName, T_ChillHubCB *pHub, uint8_t resID, uint32_t passes) {
+   uint64_t start;
+   uint64_t cycles;
+   uint64_t updates = (uint64_t)passes * 0x10000;
+   uint32_t pass;
+   uint32_t value;
+
+   bytesWritten = 0;
+   writeCalls = 0;
+   start = cyclesNow();
+   for (pass = 0; pass < passes; pass++) {
+      for (value = 0; value <= 0xffff; value++) {
+         ChillHub_UpdateCloudResourceU16(pHub, resID, (uint16_t)value);
+      }
+   }
+   cycles = cyclesNow() - start;
+
+   printf("%-9s %8.1f cycles/update  %5.2f bytes/update  %5.2f writes/update\n",
+      pName, (double)cycles / updates, (double)bytesWritten / updates,
+      (double)writeCalls / updates);
+}
+
+int main(int argc, char **argv) {
+   static T_ChillHubCB templated;
+   static T_ChillHubCB full;
+   uint32_t passes = 20;
+   uint8_t resID = 0x91;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "p:r:")) != -1) {
+      switch (opt) {
+         case 'p': passes = (uint32_t)strtoul(optarg, NULL, 0); break;
+         case 'r': resID = (uint8_t)strtoul(optarg, NULL, 0); break;
+         default:
+            fprintf(stderr, "usage: %s [-p passes] [-r resource_id]\n", argv[0]);
+            return 2;
+      }
+   }
+
+   ChillHub_Init(&templated);
+   ChillHub_Init(&full);
+   ChillHub_Setup(&templated, "milkyWeighs", "bench", &countingSerial);
+   ChillHub_Setup(&full, "milkyWeighs", "bench", &countingSerial);
+   ChillHub_CreateCloudResourceU16(&templated, "weight", resID, 0, 0);
+
+   // warm the caches and the branch predictors
+   run("warmup", &full, resID, 1);
+   run("template", &templated, resID, passes);
+   run("full", &full, resID, passes);
+   return 0;
+}
@@ -0,0 +1,397 @@
+/*
+ * Converts link trace dumps to pcap and replays them through the chillhub decoder.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Reads a link trace, either the text LinkTrace_Dump prints to the debug
+ * UART (the rest of a debug log around it is skipped) or a pcap this tool
+ * wrote, and
+ *
+ *   -w writes it as a pcap file with one packet per burst of bytes in one
+ *      direction, for Wireshark and friends.  The link type is USER0 (147);
+ *      every packet starts with a direction byte, 0 for hub to scale and 1
+ *      for scale to hub, followed by the bytes as they were on the wire.
+ *      The timestamps are the scale's millisecond ticks.
+ *   -r replays the bytes of each direction through a link of the host built
+ *      chillhub decoder the given number of times, as fast as it will go,
+ *      and reports frames, CRC failures and throughput.
+ *
+ * A log with several dumps in it gives the last one unless -d picks another,
+ * counting from 0.
+ *
+ *   tracecap [-d dump] [-w capture.pcap] [-r passes] [trace]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "chillhub.h"
+#include "linktrace.h"
+
+#define STX 0xff
+#define ESC 0xfe
+
+#define PCAP_MAGIC 0xa1b2c3d4UL
+#define PCAP_LINKTYPE_USER0 147
+#define PCAP_SNAPLEN 65535
+
+#define MAX_EVENTS (1024 * 1024)
+
+typedef struct T_Event {
+   uint32_t ticks;
+   uint8_t direction;
+   uint8_t data;
+} T_Event;
+
+static T_Event events[MAX_EVENTS];
+static uint32_t eventCount;
+
+static void addEvent(uint32_t ticks, uint8_t direction, uint8_t data) {
+   if (eventCount < MAX_EVENTS) {
+      events[eventCount].ticks = ticks;
+      events[eventCount].direction = direction;
+      events[eventCount].data = data;
+      eventCount++;
+   }
+}
+
+/*
+ * Reading a dump
+ */
+
+static int hexValue(char c) {
+   if (c >= '0' && c <= '9') {
+      return c - '0';
+   }
+   if (c >= 'a' && c <= 'f') {
+      return c - 'a' + 10;
+   }
+   if (c >= 'A' && c <= 'F') {
+      return c - 'A' + 10;
+   }
+   return -1;
+}
+
+// Returns the number of dumps in the log, and decodes the wanted one (-1 for
+// the last) into events.
+static int readDump(FILE *f, int wanted) {
+   char line[512];
+   int dumps = 0;
+   int inDump = 0;
+   int keep = 0;
+   unsigned long start = 0;
+   unsigned long count = 0;
+   unsigned long overwritten = 0;
+   uint32_t ticks = 0;
+   uint32_t records = 0;
+
+   while (fgets(line, sizeof(line), f) != NULL) {
+      char *p = strstr(line, "linktrace ");
+
+      if (p != NULL) {
+         if (strncmp(p, "linktrace end", 13) == 0) {
+            if (inDump && keep && records != count) {
+               fprintf(stderr, "dump %d has %lu records, expected %lu\n", dumps - 1,
+                       (unsigned long)records, count);
+            }
+            inDump = 0;
+         } else if (sscanf(p, "linktrace %lu %lu %lu", &start, &count, &overwritten) == 3) {
+            inDump = 1;
+            keep = (wanted < 0) || (wanted == dumps);
+            if (keep) {
+               eventCount = 0;
+               ticks = (uint32_t)start;
+               records = 0;
+               if (overwritten != 0) {
+                  fprintf(stderr, "dump %d: %lu older records were overwritten\n", dumps, overwritten);
+               }
+            }
+            dumps++;
+         }
+         continue;
+      }
+      if (!inDump || !keep) {
+         continue;
+      }
+
+      for (p = line; hexValue(p[0]) >= 0 && hexValue(p[1]) >= 0 && hexValue(p[2]) >= 0 && hexValue(p[3]) >= 0; p += 4) {
+         T_LinkTraceRecord record;
+         uint8_t direction;
+
+         record.header = (uint8_t)((hexValue(p[0]) << 4) | hexValue(p[1]));
+         record.data = (uint8_t)((hexValue(p[2]) << 4) | hexValue(p[3]));
+         if (LinkTrace_Decode(&record, &ticks, &direction)) {
+            addEvent(ticks, direction, record.data);
+         }
+         records++;
+      }
+   }
+   return dumps;
+}
+
+/*
+ * pcap
+ */
+
+static int writeU32(FILE *f, uint32_t value) {
+   return fwrite(&value, sizeof(value), 1, f) == 1;
+}
+
+static int writeU16(FILE *f, uint16_t value) {
+   return fwrite(&value, sizeof(value), 1, f) == 1;
+}
+
+static int writePacket(FILE *f, const T_Event *pFirst, uint32_t length) {
+   uint8_t packet[1 + PCAP_SNAPLEN];
+   uint32_t i;
+
+   packet[0] = pFirst->direction;
+   for (i = 0; i < length; i++) {
+      packet[1 + i] = pFirst[i].data;
+   }
+   return writeU32(f, pFirst->ticks / 1000) &&
+          writeU32(f, (pFirst->ticks % 1000) * 1000) &&
+          writeU32(f, length + 1) &&
+          writeU32(f, length + 1) &&
+          (fwrite(packet, 1, length + 1, f) == length + 1);
+}
+
+// A packet ends where the direction changes, time passes or a frame starts.
+static int writePcap(const char *pPath, uint32_t *pPackets) {
+   FILE *f = fopen(pPath, "wb");
+   uint32_t first = 0;
+   uint32_t i;
+   int ok;
+
+   if (f == NULL) {
+      return 0;
+   }
+   ok = writeU32(f, PCAP_MAGIC) && writeU16(f, 2) && writeU16(f, 4) && writeU32(f, 0) &&
+        writeU32(f, 0) && writeU32(f, PCAP_SNAPLEN) && writeU32(f, PCAP_LINKTYPE_USER0);
+
+   *pPackets = 0;
+   for (i = 1; ok && i <= eventCount; i++) {
+      if ((i == eventCount) ||
+          (events[i].direction != events[first].direction) ||
+          (events[i].ticks != events[i - 1].ticks) ||
+          (events[i].data == STX && events[i - 1].data != ESC) ||
+          (i - first == PCAP_SNAPLEN)) {
+         ok = writePacket(f, &events[first], i - first);
+         (*pPackets)++;
+         first = i;
+      }
+   }
+   if (fclose(f) != 0) {
+      ok = 0;
+   }
+   return ok;
+}
+
+static int readPcap(FILE *f) {
+   uint32_t header[6];
+   uint32_t record[4];
+   uint8_t packet[PCAP_SNAPLEN + 1];
+   uint32_t i;
+
+   if (fread(header, sizeof(header), 1, f) != 1 || header[0] != PCAP_MAGIC) {
+      fprintf(stderr, "not a pcap file in this machine's byte order\n");
+      return 0;
+   }
+   if (header[5] != PCAP_LINKTYPE_USER0) {
+      fprintf(stderr, "link type %lu is not a link trace\n", (unsigned long)header[5]);
+      return 0;
+   }
+
+   eventCount = 0;
+   while (fread(record, sizeof(record), 1, f) == 1) {
+      uint32_t ticks = record[0] * 1000 + record[1] / 1000;
+
+      if (record[2] > sizeof(packet) || fread(packet, 1, record[2], f) != record[2]) {
+         fprintf(stderr, "truncated pcap file\n");
+         return 0;
+      }
+      for (i = 1; i < record[2]; i++) {
+         addEvent(ticks, packet[0], packet[i]);
+      }
+   }
+   return 1;
+}
+
+/*
+ * Replay
+ */
+
+typedef struct T_Replay {
+   T_ChillHubCB hub;
+   uint8_t *pBytes;
+   uint32_t length;
+   uint32_t pos;
+   uint64_t frames;
+} T_Replay;
+
+static T_Replay *pCurrentReplay;
+
+static void replayWrite(const uint8 wrBuf[], uint32 count) {
+   (void)wrBuf;
+   (void)count;
+}
+
+static uint32 replayAvailable(void) {
+   return pCurrentReplay->length - pCurrentReplay->pos;
+}
+
+static uint32 replayRead(void) {
+   return pCurrentReplay->pBytes[pCurrentReplay->pos++];
+}
+
+static void replayPrint(const char8 string[]) {
+   (void)string;
+}
+
+static const T_Serial replaySerial = { replayWrite, replayAvailable, replayRead, replayPrint };
+
+static void countFrame(T_ChillHubCB *pControlBlock, const uint8_t *pMsg, uint8_t length) {
+   (void)pMsg;
+   (void)length;
+   ((T_Replay *)pControlBlock->pUserData)->frames++;
+}
+
+static double cpuNow(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void replay(uint8_t direction, uint32_t passes) {
+   static const char *names[] = { "hub to scale", "scale to hub" };
+   T_Replay *pReplay = calloc(1, sizeof(T_Replay));
+   double start;
+   double seconds;
+   uint32_t i;
+
+   if (pReplay == NULL || (pReplay->pBytes = malloc(eventCount + 1)) == NULL) {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+   }
+   for (i = 0; i < eventCount; i++) {
+      if (events[i].direction == direction) {
+         pReplay->pBytes[pReplay->length++] = events[i].data;
+      }
+   }
+
+   pCurrentReplay = pReplay;
+   ChillHub_Init(&pReplay->hub);
+   ChillHub_Setup(&pReplay->hub, "tracecap", "replay", &replaySerial);
+   ChillHub_SetFrameHook(&pReplay->hub, countFrame, pReplay);
+
+   start = cpuNow();
+   for (i = 0; i < passes; i++) {
+      pReplay->pos = 0;
+      do {
+         ChillHub_Loop(&pReplay->hub);
+      } while (pReplay->pos < pReplay->length || !ChillHub_IsIdle(&pReplay->hub));
+   }
+   seconds = cpuNow() - start;
+
+   printf("%s: %lu bytes x %lu passes, %llu frames, %lu CRC failures, %lu resyncs, "
+          "%.1f MB/s, %.0f frames/s\n",
+          names[direction], (unsigned long)pReplay->length, (unsigned long)passes,
+          (unsigned long long)pReplay->frames, (unsigned long)ChillHub_GetStats(&pReplay->hub)->crcFailures,
+          (unsigned long)ChillHub_GetStats(&pReplay->hub)->resyncs,
+          (seconds > 0) ? (double)pReplay->length * passes / seconds / 1e6 : 0.0,
+          (seconds > 0) ? pReplay->frames / seconds : 0.0);
+
+   free(pReplay->pBytes);
+   free(pReplay);
+}
+
+int main(int argc, char **argv) {
+   const char *pIn = NULL;
+   const char *pOut = NULL;
+   uint32_t passes = 0;
+   int wanted = -1;
+   uint32_t packets;
+   uint32_t rx = 0;
+   uint32_t i;
+   FILE *f;
+   int c;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "d:w:r:")) != -1) {
+      switch (opt) {
+         case 'd': wanted = atoi(optarg); break;
+         case 'w': pOut = optarg; break;
+         case 'r': passes = (uint32_t)strtoul(optarg, NULL, 0); break;
+         default:
+            fprintf(stderr, "usage: %s [-d dump] [-w capture.pcap] [-r passes] [trace]\n", argv[0]);
+            return 2;
+      }
+   }
+   if (optind < argc) {
+      pIn = argv[optind];
+   }
+
+   f = (pIn != NULL) ? fopen(pIn, "rb") : stdin;
+   if (f == NULL) {
+      perror(pIn);
+      return 1;
+   }
+   c = getc(f);
+   ungetc(c, f);
+   if (c == (PCAP_MAGIC & 0xff)) {
+      if (!readPcap(f)) {
+         return 1;
+      }
+   } else {
+      int dumps = readDump(f, wanted);
+
+      if (dumps == 0 || (wanted >= dumps)) {
+         fprintf(stderr, "no link trace dump %s\n", (dumps == 0) ? "found" : "with that number");
+         return 1;
+      }
+   }
+   if (f != stdin) {
+      fclose(f);
+   }
+
+   for (i = 0; i < eventCount; i++) {
+      rx += (events[i].direction == LINK_TRACE_RX);
+   }
+   printf("%lu bytes received, %lu sent over %.3f s\n", (unsigned long)rx, (unsigned long)(eventCount - rx),
+          (eventCount > 0) ? (events[eventCount - 1].ticks - events[0].ticks) / 1000.0 : 0.0);
+
+   if (pOut != NULL) {
+      if (!writePcap(pOut, &packets)) {
+         perror(pOut);
+         return 1;
+      }
+      printf("%lu packets written to %s\n", (unsigned long)packets, pOut);
+   }
+   if (passes > 0) {
+      replay(LINK_TRACE_RX, passes);
+      replay(LINK_TRACE_TX, passes);
+   }
+   return 0;
+}
@@ -0,0 +1,599 @@
+/*
+ * Firmware transfer over the chillhub link, against a local hub emulator.
+ *
+ * Copyright (c) 2015 FirstBuild
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * The scale side is the host build of the firmware: chillhub.c, ringbuf.c,
+ * crc.c and fwupdate.c with the test stubs for the PSoC headers.  The hub
+ * side streams an image with FW_UPDATE_WINDOW chunks in flight and goes back
+ * to the acknowledged chunk after a loss or a timeout.  Both ends share a
+ * virtual 115200 baud UART and a virtual clock, so every run is exact.
+ *
+ * The device stalls for a flash row write every 128 bytes stored, and bytes
+ * that arrive while its UART RX buffer is full are lost.  Optionally the USB
+ * link is reset part way through: everything on the wire is lost, the hub
+ * registers the device again and restarts the transfer with the same image,
+ * which the device resumes.
+ *
+ *   hubsim [-s image_bytes] [-b rx_buffer_bytes] [-w row_write_us] [-r reset_percent]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "chillhub.h"
+#include "crc.h"
+#include "fwupdate.h"
+
+#define BAUD 115200UL
+#define BYTE_US ((10UL * 1000000UL + BAUD / 2) / BAUD)
+
+// One pass of the main loop, and the row write from the CY8C41 datasheet
+#define LOOP_US 5
+#define ROW_SIZE 128
+#define DEFAULT_ROW_WRITE_US 20000
+
+// USB reset pulse from main.c plus the time the hub takes to enumerate again
+#define USB_OUTAGE_US (500000UL + 1000000UL)
+
+// The hub starts over from the last acknowledged chunk after this long
+// without a status.
+#define HUB_TIMEOUT_US 100000UL
+
+#define LINE_SIZE 65536
+#define MAX_IMAGE 65536
+#define STX 0xff
+#define ESC 0xfe
+
+typedef struct T_Line {
+   uint64_t arrivalUs[LINE_SIZE];
+   uint8_t value[LINE_SIZE];
+   uint32_t head;
+   uint32_t tail;
+   uint64_t freeUs;
+   uint64_t bytes;
+} T_Line;
+
+static uint64_t nowUs;
+static T_Line down;   // hub to device
+static T_Line up;     // device to hub
+
+static uint32_t rxBufferBytes = 128;   // as the Uart component is configured
+static uint32_t rowWriteUs = DEFAULT_ROW_WRITE_US;
+static uint64_t stallUs;
+static uint32_t rxDrops;
+
+static uint8_t image[MAX_IMAGE];
+static uint32_t imageSize = 12 * 1024;
+static uint16_t imageCrc;
+
+/*
+ * The line
+ */
+
+static void lineSend(T_Line *pLine, const uint8_t *pData, uint32_t length) {
+   uint32_t i;
+
+   if (pLine->freeUs < nowUs) {
+      pLine->freeUs = nowUs;
+   }
+   for (i = 0; i < length; i++) {
+      if (pLine->tail - pLine->head >= LINE_SIZE) {
+         fprintf(stderr, "line overflow\n");
+         exit(1);
+      }
+      pLine->freeUs += BYTE_US;
+      pLine->arrivalUs[pLine->tail % LINE_SIZE] = pLine->freeUs;
+      pLine->value[pLine->tail % LINE_SIZE] = pData[i];
+      pLine->tail++;
+   }
+   pLine->bytes += length;
+}
+
+static uint32_t lineArrived(const T_Line *pLine) {
+   uint32_t n = 0;
+
+   while (pLine->head + n != pLine->tail && pLine->arrivalUs[(pLine->head + n) % LINE_SIZE] <= nowUs) {
+      n++;
+   }
+   return n;
+}
+
+static uint8_t lineRead(T_Line *pLine) {
+   return pLine->value[pLine->head++ % LINE_SIZE];
+}
+
+static void lineDrop(T_Line *pLine) {
+   pLine->head = pLine->tail;
+   pLine->freeUs = nowUs;
+}
+
+static uint64_t lineNextArrival(const T_Line *pLine) {
+   return (pLine->head == pLine->tail) ? UINT64_MAX : pLine->arrivalUs[pLine->head % LINE_SIZE];
+}
+
+/*
+ * The device: the firmware's chillhub and fwupdate code behind a UART with
+ * an RX buffer of rxBufferBytes.
+ */
+
+static T_FwUpdateCB fw;
+static uint8_t staged[MAX_IMAGE];
+static uint32_t stagedRowFill;
+
+// Bytes that arrive while the RX buffer is full are lost.
+static void dropRxOverflow(void) {
+   uint32_t n = lineArrived(&down);
+
+   while (n > rxBufferBytes) {
+      uint32_t i;
+
+      for (i = down.head + rxBufferBytes; i + 1 != down.tail; i++) {
+         down.arrivalUs[i % LINE_SIZE] = down.arrivalUs[(i + 1) % LINE_SIZE];
+         down.value[i % LINE_SIZE] = down.value[(i + 1) % LINE_SIZE];
+      }
+      down.tail--;
+      rxDrops++;
+      n--;
+   }
+}
+
+static void devWrite(const uint8 wrBuf[], uint32 count) {
+   lineSend(&up, wrBuf, count);
+}
+
+static uint32 devAvailable(void) {
+   dropRxOverflow();
+   return lineArrived(&down);
+}
+
+static uint32 devRead(void) {
+   return lineRead(&down);
+}
+
+static void devPrint(const char8 string[]) {
+   (void)string;
+}
+
+static const T_Serial devSerial = { devWrite, devAvailable, devRead, devPrint };
+
+static uint8_t storeBegin(uint32_t size) {
+   (void)size;
+   stagedRowFill = 0;
+   return FW_STORE_SUCCESS;
+}
+
+static uint8_t storeWrite(uint32_t offset, const uint8_t *pData, uint8_t length) {
+   memcpy(&staged[offset], pData, length);
+   stagedRowFill += length;
+   while (stagedRowFill >= ROW_SIZE) {
+      stagedRowFill -= ROW_SIZE;
+      stallUs += rowWriteUs;
+   }
+   return FW_STORE_SUCCESS;
+}
+
+static uint8_t storeFinish(void) {
+   if (stagedRowFill > 0) {
+      stagedRowFill = 0;
+      stallUs += rowWriteUs;
+   }
+   return FW_STORE_SUCCESS;
+}
+
+static uint8_t storeRead(uint32_t offset, uint8_t *pData, uint8_t length) {
+   memcpy(pData, &staged[offset], length);
+   return FW_STORE_SUCCESS;
+}
+
+static const T_FwStore store = { MAX_IMAGE, storeBegin, storeWrite, storeFinish, storeRead };
+
+static int committed;
+
+static void devSendStatus(const uint8_t *pStatus, uint8_t length) {
+   ChillHub.sendU8ArrayMsg(FW_UPDATE_STATUS_MSG, pStatus, length);
+}
+
+static void devCommit(void) {
+   committed = 1;
+}
+
+static void devStart(uint8_t dataType, void *pData) {
+   (void)dataType;
+   (void)pData;
+   FwUpdate_Start(&fw, ChillHub.getPayload());
+}
+
+static void devData(uint8_t dataType, void *pData) {
+   (void)dataType;
+   (void)pData;
+   FwUpdate_Data(&fw, ChillHub.getPayload());
+}
+
+static void devControl(uint8_t dataType, void *pData) {
+   (void)dataType;
+   (void)pData;
+   FwUpdate_Control(&fw, ChillHub.getPayload());
+}
+
+// What deviceAnnounce in main.c does for the transfer.
+static void devAnnounce(uint8_t dataType, void *pData) {
+   (void)dataType;
+   (void)pData;
+   ChillHub.setup("milkyWeighs", "hubsim", &devSerial);
+   ChillHub.subscribe(deviceIdRequestType, devAnnounce);
+   ChillHub.addCloudListener(FW_UPDATE_START_MSG, devStart);
+   ChillHub.addCloudListener(FW_UPDATE_DATA_MSG, devData);
+   ChillHub.addCloudListener(FW_UPDATE_CONTROL_MSG, devControl);
+}
+
+/*
+ * The hub
+ */
+
+typedef struct T_Hub {
+   uint16_t chunkCount;
+   uint16_t base;
+   uint16_t next;
+   uint8_t window;
+   uint8_t deviceState;
+   uint64_t lastStatusUs;
+   uint32_t chunksSent;
+   uint32_t chunksResent;
+   uint16_t highestSent;
+   uint8_t waitingForStart;
+   uint8_t verifySent;
+   uint8_t commitSent;
+   uint32_t resumedAt;
+   // receive side
+   uint8_t frame[80];
+   uint8_t frameLength;
+   uint8_t framePos;
+   uint8_t escaped;
+   uint8_t inFrame;
+} T_Hub;
+
+static T_Hub hub;
+
+static uint8_t putEscaped(uint8_t *pWire, uint8_t n, uint8_t b) {
+   if (b == STX || b == ESC) {
+      pWire[n++] = ESC;
+   }
+   pWire[n++] = b;
+   return n;
+}
+
+// Same framing as sendPacket in chillhub.c: the length, then a body that
+// starts with the message length, then the CRC of the body.
+static void hubSend(const uint8_t *pMsg, uint8_t length) {
+   uint8_t wire[2 * 80];
+   uint8_t body[80];
+   uint8_t n = 0;
+   uint8_t i;
+   crc_t crc;
+
+   body[0] = length;
+   memcpy(&body[1], pMsg, length);
+   crc = crc_finalize(crc_update(crc_init(), body, length + 1));
+
+   wire[n++] = STX;
+   n = putEscaped(wire, n, length + 1);
+   for (i = 0; i < length + 1; i++) {
+      n = putEscaped(wire, n, body[i]);
+   }
+   n = putEscaped(wire, n, (crc >> 8) & 0xff);
+   n = putEscaped(wire, n, crc & 0xff);
+   lineSend(&down, wire, n);
+}
+
+static void hubSendStart(void) {
+   uint8_t msg[] = { FW_UPDATE_START_MSG, arrayDataType, 6, unsigned8DataType,
+                     (uint8_t)(imageSize >> 24), (uint8_t)(imageSize >> 16), (uint8_t)(imageSize >> 8),
+                     (uint8_t)imageSize, (uint8_t)(imageCrc >> 8), (uint8_t)imageCrc };
+   hubSend(msg, sizeof(msg));
+   hub.waitingForStart = 1;
+   hub.lastStatusUs = nowUs;
+}
+
+static void hubSendChunk(uint16_t seq) {
+   uint8_t msg[8 + FW_UPDATE_CHUNK_SIZE];
+   uint32_t offset = (uint32_t)seq * FW_UPDATE_CHUNK_SIZE;
+   uint8_t length = (imageSize - offset < FW_UPDATE_CHUNK_SIZE) ? (uint8_t)(imageSize - offset) : FW_UPDATE_CHUNK_SIZE;
+   crc_t crc;
+
+   msg[0] = FW_UPDATE_DATA_MSG;
+   msg[1] = arrayDataType;
+   msg[2] = length + 4;
+   msg[3] = unsigned8DataType;
+   msg[4] = seq >> 8;
+   msg[5] = seq & 0xff;
+   memcpy(&msg[8], &image[offset], length);
+   crc = crc_update(crc_init(), &msg[4], 2);
+   crc = crc_finalize(crc_update(crc, &msg[8], length));
+   msg[6] = (crc >> 8) & 0xff;
+   msg[7] = crc & 0xff;
+   hubSend(msg, 8 + length);
+
+   hub.chunksSent++;
+   if (seq < hub.highestSent) {
+      hub.chunksResent++;
+   } else {
+      hub.highestSent = seq + 1;
+   }
+}
+
+static void hubSendControl(uint8_t command) {
+   uint8_t msg[] = { FW_UPDATE_CONTROL_MSG, unsigned8DataType, command };
+   hubSend(msg, sizeof(msg));
+   hub.lastStatusUs = nowUs;
+}
+
+static void hubStatus(const uint8_t *pStatus) {
+   uint16_t nextSeq = (uint16_t)((pStatus[1] << 8) | pStatus[2]);
+
+   hub.lastStatusUs = nowUs;
+   hub.deviceState = pStatus[0];
+   hub.window = pStatus[3];
+   if (hub.waitingForStart) {
+      hub.waitingForStart = 0;
+      hub.base = nextSeq;
+      hub.next = nextSeq;
+      if (nextSeq > 0) {
+         hub.resumedAt = nextSeq;
+      }
+      return;
+   }
+   if (nextSeq > hub.base) {
+      hub.base = nextSeq;
+   }
+   if (pStatus[5] == FW_ERROR_SEQUENCE || pStatus[5] == FW_ERROR_CHUNK_CRC || hub.next < hub.base) {
+      hub.next = hub.base;
+   }
+}
+
+static void hubReceive(void) {
+   while (lineArrived(&up) > 0) {
+      uint8_t b = lineRead(&up);
+
+      if (b == STX && !hub.escaped) {
+         hub.inFrame = 1;
+         hub.frameLength = 0;
+         hub.framePos = 0;
+         continue;
+      }
+      if (!hub.inFrame) {
+         continue;
+      }
+      if (b == ESC && !hub.escaped) {
+         hub.escaped = 1;
+         continue;
+      }
+      hub.escaped = 0;
+      if (hub.frameLength == 0) {
+         hub.frameLength = b;
+         continue;
+      }
+      hub.frame[hub.framePos++] = b;
+      if (hub.framePos == hub.frameLength + 2) {
+         crc_t crc = crc_finalize(crc_update(crc_init(), hub.frame, hub.frameLength));
+         hub.inFrame = 0;
+         if (crc == (uint16_t)((hub.frame[hub.frameLength] << 8) | hub.frame[hub.frameLength + 1]) &&
+             hub.frame[1] == FW_UPDATE_STATUS_MSG && hub.frame[3] == FW_UPDATE_STATUS_LENGTH) {
+            hubStatus(&hub.frame[5]);
+         }
+      } else if (hub.framePos >= sizeof(hub.frame) - 2) {
+         hub.inFrame = 0;
+      }
+   }
+}
+
+static void hubStep(void) {
+   hubReceive();
+
+   if (hub.waitingForStart) {
+      if (nowUs - hub.lastStatusUs > HUB_TIMEOUT_US) {
+         hubSendStart();
+      }
+      return;
+   }
+
+   switch (hub.deviceState) {
+      case FW_STATE_RECEIVING:
+         // keep the window full, but only put on the line what the device
+         // will get to soon
+         while (hub.next < hub.chunkCount && hub.next < hub.base + hub.window &&
+                down.freeUs <= nowUs + BYTE_US) {
+            hubSendChunk(hub.next++);
+         }
+         if (nowUs - hub.lastStatusUs > HUB_TIMEOUT_US) {
+            hub.next = hub.base;
+            hub.lastStatusUs = nowUs;
+         }
+         break;
+
+      case FW_STATE_COMPLETE:
+         if (!hub.verifySent) {
+            hub.verifySent = 1;
+            hubSendControl(FW_UPDATE_VERIFY);
+         }
+         break;
+
+      case FW_STATE_VERIFIED:
+         if (!hub.commitSent) {
+            hub.commitSent = 1;
+            hubSendControl(FW_UPDATE_COMMIT);
+         }
+         break;
+
+      default:
+         break;
+   }
+}
+
+/*
+ * One run
+ */
+
+typedef struct T_Run {
+   uint64_t totalUs;
+   uint64_t bytesDown;
+   uint32_t chunksSent;
+   uint32_t chunksResent;
+   uint32_t rxDrops;
+   uint32_t resumedAt;
+   uint16_t resetAt;
+   uint8_t ok;
+} T_Run;
+
+static void run(int resetPercent, T_Run *pRun) {
+   uint16_t resetAtChunk;
+   uint8_t resetDone = 0;
+
+   memset(&down, 0, sizeof(down));
+   memset(&up, 0, sizeof(up));
+   memset(&hub, 0, sizeof(hub));
+   memset(staged, 0, sizeof(staged));
+   nowUs = 0;
+   stallUs = 0;
+   rxDrops = 0;
+   committed = 0;
+
+   FwUpdate_Init(&fw, &store, devSendStatus, devCommit);
+   devAnnounce(0, NULL);
+   lineDrop(&up);
+
+   hub.chunkCount = (uint16_t)((imageSize + FW_UPDATE_CHUNK_SIZE - 1) / FW_UPDATE_CHUNK_SIZE);
+   hub.window = 1;
+   resetAtChunk = (uint16_t)((uint32_t)hub.chunkCount * resetPercent / 100);
+   hubSendStart();
+
+   while (!committed && nowUs < 600ULL * 1000000ULL) {
+      if (resetPercent > 0 && !resetDone && hub.base >= resetAtChunk) {
+         // USB reset: the wire goes quiet and everything on it is lost
+         resetDone = 1;
+         pRun->resetAt = hub.base;
+         nowUs += USB_OUTAGE_US;
+         lineDrop(&down);
+         lineDrop(&up);
+         ChillHub.countUsbReset();
+         memset(&hub.frame, 0, sizeof(hub.frame));
+         hub.inFrame = 0;
+         hub.escaped = 0;
+         // the hub asks who is there, then starts the same image again
+         {
+            uint8_t msg[] = { deviceIdRequestType, unsigned8DataType, 0 };
+            hubSend(msg, sizeof(msg));
+         }
+         hubSendStart();
+      }
+
+      hubStep();
+      ChillHub.loop();
+      nowUs += LOOP_US + stallUs;
+      stallUs = 0;
+
+      if (ChillHub.isIdle() && lineArrived(&down) == 0 && lineArrived(&up) == 0) {
+         // nothing to do until the next byte lands on either side
+         uint64_t next = lineNextArrival(&down);
+         uint64_t nextUp = lineNextArrival(&up);
+         if (nextUp < next) next = nextUp;
+         if (hub.lastStatusUs + HUB_TIMEOUT_US + 1 < next) next = hub.lastStatusUs + HUB_TIMEOUT_US + 1;
+         if (down.freeUs > nowUs && down.freeUs < next) next = down.freeUs;
+         if (next > nowUs && next != UINT64_MAX) nowUs = next;
+      }
+   }
+
+   pRun->totalUs = nowUs;
+   pRun->bytesDown = down.bytes;
+   pRun->chunksSent = hub.chunksSent;
+   pRun->chunksResent = hub.chunksResent;
+   pRun->rxDrops = rxDrops;
+   pRun->resumedAt = hub.resumedAt;
+   pRun->ok = committed && memcmp(staged, image, imageSize) == 0;
+}
+
+static void report(const char *name, const T_Run *pRun) {
+   printf("%-16s %8.1f ms, %6.0f image bytes/s, %5.1f%% of the line, %4lu chunks sent, %3lu resent, %4lu RX bytes lost%s\n",
+          name, pRun->totalUs / 1000.0, imageSize / (pRun->totalUs / 1e6),
+          100.0 * imageSize / (pRun->totalUs / 1e6) / (BAUD / 10.0),
+          (unsigned long)pRun->chunksSent, (unsigned long)pRun->chunksResent, (unsigned long)pRun->rxDrops,
+          pRun->ok ? "" : ", FAILED");
+}
+
+int main(int argc, char **argv) {
+   T_Run clean;
+   T_Run reset;
+   T_Run noStall;
+   int resetPercent = 50;
+   uint32_t i;
+   uint32_t seed = 1;
+   unsigned chunkCount;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "s:b:w:r:")) != -1) {
+      switch (opt) {
+         case 's': imageSize = (uint32_t)strtoul(optarg, NULL, 0); break;
+         case 'b': rxBufferBytes = (uint32_t)strtoul(optarg, NULL, 0); break;
+         case 'w': rowWriteUs = (uint32_t)strtoul(optarg, NULL, 0); break;
+         case 'r': resetPercent = atoi(optarg); break;
+         default:
+            fprintf(stderr, "usage: %s [-s image_bytes] [-b rx_buffer_bytes] [-w row_write_us] [-r reset_percent]\n", argv[0]);
+            return 2;
+      }
+   }
+   if (imageSize == 0 || imageSize > MAX_IMAGE || resetPercent < 1 || resetPercent > 99) {
+      fprintf(stderr, "image must be 1..%u bytes and the reset 1..99%%\n", MAX_IMAGE);
+      return 2;
+   }
+
+   for (i = 0; i < imageSize; i++) {
+      seed = seed * 1103515245UL + 12345UL;
+      image[i] = (uint8_t)(seed >> 16);
+   }
+   imageCrc = crc_finalize(crc_update(crc_init(), image, imageSize));
+   chunkCount = (unsigned)((imageSize + FW_UPDATE_CHUNK_SIZE - 1) / FW_UPDATE_CHUNK_SIZE);
+
+   run(0, &clean);
+   run(resetPercent, &reset);
+   {
+      uint32_t saved = rowWriteUs;
+      rowWriteUs = 0;
+      run(0, &noStall);
+      rowWriteUs = saved;
+   }
+
+   printf("image %lu bytes in %u byte chunks, window %u, %lu baud, RX buffer %lu bytes, row write %lu us\n",
+          (unsigned long)imageSize, FW_UPDATE_CHUNK_SIZE, FW_UPDATE_WINDOW, (unsigned long)BAUD,
+          (unsigned long)rxBufferBytes, (unsigned long)rowWriteUs);
+   report("no flash stalls:", &noStall);
+   report("clean:", &clean);
+   report("USB reset:", &reset);
+   printf("USB reset at chunk %u of %u, resumed at chunk %lu: %.1f ms more than the clean run, of which %.1f ms is the outage;\n"
+          "starting over would have cost another %.1f ms\n",
+          reset.resetAt, chunkCount, (unsigned long)reset.resumedAt,
+          (reset.totalUs - clean.totalUs) / 1000.0, USB_OUTAGE_US / 1000.0,
+          clean.totalUs / 1000.0 * reset.resumedAt / chunkCount);
+
+   return (clean.ok && reset.ok && noStall.ok && reset.resumedAt > 0) ? 0 : 1;
+}